@@ -0,0 +1,535 @@
+/**
+ * collectd - src/archive.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+/*
+ * The archive plugin collects the values of all identifiers in memory,
+ * compresses them per series and appends them as one block to a daily
+ * archive file once the block is full or old enough. See utils_archive.h for
+ * the file format and collectd-archive(1) for reading the files.
+ */
+
+#include "collectd.h"
+#include "plugin.h"
+#include "common.h"
+#include "utils_avltree.h"
+#include "utils_archive.h"
+
+#include <pthread.h>
+
+/* All data sources of one identifier in the current block. */
+struct archive_vl_s
+{
+  char identifier[6 * DATA_MAX_NAME_LEN];
+  size_t ds_num;
+  char (*ds_names)[DATA_MAX_NAME_LEN];
+  archive_encoder_t *encoders;
+};
+typedef struct archive_vl_s archive_vl_t;
+
+static char *conf_datadir = NULL;
+static size_t conf_block_size = 1048576;
+static cdtime_t conf_block_timeout = 0;
+
+/* The block currently being collected. */
+static pthread_mutex_t data_lock = PTHREAD_MUTEX_INITIALIZER;
+static c_avl_tree_t *data_tree = NULL;
+static size_t data_bytes = 0;
+
+/* The file blocks are appended to. */
+static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+static char file_name[PATH_MAX] = "";
+static int file_fd = -1;
+
+static void archive_vl_free (archive_vl_t *avl) /* {{{ */
+{
+  size_t i;
+
+  if (avl == NULL)
+    return;
+
+  for (i = 0; i < avl->ds_num; i++)
+    archive_encoder_free (avl->encoders + i);
+  sfree (avl->encoders);
+  sfree (avl->ds_names);
+  sfree (avl);
+} /* }}} void archive_vl_free */
+
+static void archive_tree_free (c_avl_tree_t *tree) /* {{{ */
+{
+  void *key;
+  void *value;
+
+  if (tree == NULL)
+    return;
+
+  while (c_avl_pick (tree, &key, &value) == 0)
+    archive_vl_free (value);
+  c_avl_destroy (tree);
+} /* }}} void archive_tree_free */
+
+static archive_vl_t *archive_vl_create (const char *identifier, /* {{{ */
+    const data_set_t *ds)
+{
+  archive_vl_t *avl;
+  size_t i;
+
+  avl = calloc (1, sizeof (*avl));
+  if (avl == NULL)
+    return (NULL);
+
+  sstrncpy (avl->identifier, identifier, sizeof (avl->identifier));
+  avl->ds_num = ds->ds_num;
+  avl->ds_names = calloc (ds->ds_num, sizeof (*avl->ds_names));
+  avl->encoders = calloc (ds->ds_num, sizeof (*avl->encoders));
+  if ((avl->ds_names == NULL) || (avl->encoders == NULL))
+  {
+    sfree (avl->ds_names);
+    sfree (avl->encoders);
+    sfree (avl);
+    return (NULL);
+  }
+
+  for (i = 0; i < ds->ds_num; i++)
+  {
+    sstrncpy (avl->ds_names[i], ds->ds[i].name, sizeof (avl->ds_names[i]));
+    archive_encoder_init (avl->encoders + i, ds->ds[i].type);
+  }
+
+  return (avl);
+} /* }}} archive_vl_t *archive_vl_create */
+
+/* Replaces the current block with an empty one and returns the old one.
+ * Must be called with data_lock held. */
+static c_avl_tree_t *archive_take_block (void) /* {{{ */
+{
+  c_avl_tree_t *tree;
+  c_avl_tree_t *old;
+
+  if ((data_tree == NULL) || (data_bytes == 0))
+    return (NULL);
+
+  tree = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+  if (tree == NULL)
+  {
+    ERROR ("archive plugin: c_avl_create failed.");
+    return (NULL);
+  }
+
+  old = data_tree;
+  data_tree = tree;
+  data_bytes = 0;
+  return (old);
+} /* }}} c_avl_tree_t *archive_take_block */
+
+/* Opens the archive file for the current day, repairing a file that was
+ * left with a partially written block. Must be called with file_lock held. */
+static int archive_open_file (void) /* {{{ */
+{
+  char filename[PATH_MAX];
+  char date[16];
+  struct tm struct_tm;
+  struct stat statbuf;
+  time_t now;
+  int fd;
+
+  now = time (NULL);
+  if ((localtime_r (&now, &struct_tm) == NULL)
+      || (strftime (date, sizeof (date), "%Y-%m-%d", &struct_tm) == 0))
+  {
+    ERROR ("archive plugin: Formatting the current date failed.");
+    return (-1);
+  }
+
+  ssnprintf (filename, sizeof (filename), "%s%sarchive-%s.cda",
+      (conf_datadir != NULL) ? conf_datadir : "",
+      (conf_datadir != NULL) ? "/" : "",
+      date);
+
+  if ((file_fd >= 0) && (strcmp (filename, file_name) == 0))
+    return (0);
+
+  if (file_fd >= 0)
+  {
+    close (file_fd);
+    file_fd = -1;
+  }
+
+  if (check_create_dir (filename) != 0)
+    return (-1);
+
+  fd = open (filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if ((fd < 0) || (fstat (fd, &statbuf) != 0))
+  {
+    char errbuf[1024];
+    ERROR ("archive plugin: Opening \"%s\" failed: %s", filename,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    if (fd >= 0)
+      close (fd);
+    return (-1);
+  }
+
+  if (statbuf.st_size == 0)
+  {
+    char header[ARCHIVE_FILE_HEADER_SIZE];
+
+    archive_file_header (header, cdtime ());
+    if (swrite (fd, header, sizeof (header)) != 0)
+    {
+      char errbuf[1024];
+      ERROR ("archive plugin: Writing to \"%s\" failed: %s", filename,
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      close (fd);
+      return (-1);
+    }
+  }
+  else
+  {
+    archive_file_t *f;
+    archive_block_t b;
+    size_t offset = 0;
+
+    f = archive_file_open (filename);
+    if (f == NULL)
+    {
+      ERROR ("archive plugin: \"%s\" exists but is not an archive file.",
+          filename);
+      close (fd);
+      return (-1);
+    }
+
+    while (archive_file_next_block (f, &offset, &b) == 0)
+      /* do nothing */;
+    archive_file_close (f);
+
+    if (offset == 0)
+      offset = ARCHIVE_FILE_HEADER_SIZE;
+    if (offset < (size_t) statbuf.st_size)
+    {
+      WARNING ("archive plugin: \"%s\" ends with an incomplete block. "
+          "Truncating it from %lli to %zu bytes.", filename,
+          (long long) statbuf.st_size, offset);
+      if (ftruncate (fd, (off_t) offset) != 0)
+      {
+        char errbuf[1024];
+        ERROR ("archive plugin: ftruncate (%s) failed: %s", filename,
+            sstrerror (errno, errbuf, sizeof (errbuf)));
+        close (fd);
+        return (-1);
+      }
+    }
+  }
+
+  sstrncpy (file_name, filename, sizeof (file_name));
+  file_fd = fd;
+  return (0);
+} /* }}} int archive_open_file */
+
+/* Serializes a block, appends it to the archive file and frees it. */
+static int archive_write_block (c_avl_tree_t *tree) /* {{{ */
+{
+  archive_block_entry_t *entries;
+  size_t entries_num = 0;
+  c_avl_iterator_t *iter;
+  archive_vl_t *avl;
+  char *key;
+  void *block = NULL;
+  size_t block_size = 0;
+  size_t i;
+  int status;
+
+  if (tree == NULL)
+    return (0);
+
+  iter = c_avl_get_iterator (tree);
+  while (c_avl_iterator_next (iter, (void *) &key, (void *) &avl) == 0)
+    entries_num += avl->ds_num;
+  c_avl_iterator_destroy (iter);
+
+  entries = calloc (entries_num, sizeof (*entries));
+  if (entries == NULL)
+  {
+    ERROR ("archive plugin: calloc failed.");
+    archive_tree_free (tree);
+    return (-1);
+  }
+
+  entries_num = 0;
+  iter = c_avl_get_iterator (tree);
+  while (c_avl_iterator_next (iter, (void *) &key, (void *) &avl) == 0)
+  {
+    for (i = 0; i < avl->ds_num; i++)
+    {
+      entries[entries_num].identifier = avl->identifier;
+      entries[entries_num].ds_name = avl->ds_names[i];
+      entries[entries_num].encoder = avl->encoders + i;
+      entries_num++;
+    }
+  }
+  c_avl_iterator_destroy (iter);
+
+  status = archive_block_build (entries, entries_num, &block, &block_size);
+  sfree (entries);
+  archive_tree_free (tree);
+  if (status != 0)
+  {
+    ERROR ("archive plugin: archive_block_build failed with status %i.",
+        status);
+    return (-1);
+  }
+
+  pthread_mutex_lock (&file_lock);
+  status = archive_open_file ();
+  if (status == 0)
+  {
+    /* With O_APPEND a single write(2) keeps the block contiguous. */
+    status = swrite (file_fd, block, block_size);
+    if (status != 0)
+    {
+      char errbuf[1024];
+      ERROR ("archive plugin: Writing to \"%s\" failed: %s", file_name,
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      close (file_fd);
+      file_fd = -1;
+    }
+  }
+  pthread_mutex_unlock (&file_lock);
+
+  sfree (block);
+  return (status);
+} /* }}} int archive_write_block */
+
+static int archive_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
+    user_data_t __attribute__((unused)) *user_data)
+{
+  char identifier[6 * DATA_MAX_NAME_LEN];
+  c_avl_tree_t *full_block = NULL;
+  archive_vl_t *avl = NULL;
+  size_t i;
+  int status;
+
+  if (0 != strcmp (ds->type, vl->type))
+  {
+    ERROR ("archive plugin: DS type does not match value list type");
+    return (-1);
+  }
+
+  status = FORMAT_VL (identifier, sizeof (identifier), vl);
+  if (status != 0)
+    return (status);
+
+  pthread_mutex_lock (&data_lock);
+
+  if (data_tree == NULL)
+  {
+    pthread_mutex_unlock (&data_lock);
+    return (-1);
+  }
+
+  if (c_avl_get (data_tree, identifier, (void *) &avl) != 0)
+  {
+    avl = archive_vl_create (identifier, ds);
+    if ((avl == NULL) || (c_avl_insert (data_tree, avl->identifier, avl) != 0))
+    {
+      pthread_mutex_unlock (&data_lock);
+      ERROR ("archive plugin: Adding \"%s\" failed.", identifier);
+      archive_vl_free (avl);
+      return (-1);
+    }
+  }
+  else if (avl->ds_num != ds->ds_num)
+  {
+    pthread_mutex_unlock (&data_lock);
+    ERROR ("archive plugin: The number of data sources of \"%s\" changed.",
+        identifier);
+    return (-1);
+  }
+
+  status = 0;
+  for (i = 0; i < avl->ds_num; i++)
+  {
+    archive_block_entry_t entry = {
+      avl->identifier, avl->ds_names[i], avl->encoders + i
+    };
+    size_t size = archive_block_series_size (&entry);
+
+    status = archive_encoder_add (avl->encoders + i, vl->time, vl->values[i]);
+    if (status == EINVAL)
+    {
+      DEBUG ("archive plugin: Ignoring an out-of-order value for \"%s\".",
+          identifier);
+      status = 0;
+      continue;
+    }
+    else if (status != 0)
+    {
+      ERROR ("archive plugin: archive_encoder_add failed with status %i.",
+          status);
+      break;
+    }
+
+    /* The first point of a series also adds its directory entry and
+     * strings. */
+    data_bytes += archive_block_series_size (&entry) - size;
+  }
+
+  /* Leaves room for the block header and the padding of the strings. */
+  if ((data_bytes + ARCHIVE_BLOCK_HEADER_SIZE + 7) >= conf_block_size)
+    full_block = archive_take_block ();
+
+  pthread_mutex_unlock (&data_lock);
+
+  if (full_block != NULL)
+    archive_write_block (full_block);
+
+  return (status);
+} /* }}} int archive_write */
+
+static int archive_flush_block (void) /* {{{ */
+{
+  c_avl_tree_t *block;
+
+  pthread_mutex_lock (&data_lock);
+  block = archive_take_block ();
+  pthread_mutex_unlock (&data_lock);
+
+  return (archive_write_block (block));
+} /* }}} int archive_flush_block */
+
+/* Runs every BlockTimeout. */
+static int archive_read (user_data_t __attribute__((unused)) *user_data) /* {{{ */
+{
+  return (archive_flush_block ());
+} /* }}} int archive_read */
+
+/* All identifiers share one block, so the identifier is ignored. */
+static int archive_flush (cdtime_t __attribute__((unused)) timeout, /* {{{ */
+    const char __attribute__((unused)) *identifier,
+    user_data_t __attribute__((unused)) *user_data)
+{
+  return (archive_flush_block ());
+} /* }}} int archive_flush */
+
+static int archive_config (oconfig_item_t *ci) /* {{{ */
+{
+  int i;
+
+  for (i = 0; i < ci->children_num; i++)
+  {
+    oconfig_item_t *child = ci->children + i;
+    int status = 0;
+
+    if (strcasecmp ("DataDir", child->key) == 0)
+    {
+      status = cf_util_get_string (child, &conf_datadir);
+      if ((status == 0) && (conf_datadir != NULL))
+      {
+        size_t len = strlen (conf_datadir);
+        while ((len > 0) && (conf_datadir[len - 1] == '/'))
+        {
+          len--;
+          conf_datadir[len] = 0;
+        }
+        if (len == 0)
+          sfree (conf_datadir);
+      }
+    }
+    else if (strcasecmp ("BlockSize", child->key) == 0)
+    {
+      int tmp = 0;
+      status = cf_util_get_int (child, &tmp);
+      if ((status == 0) && (tmp < 4096))
+      {
+        ERROR ("archive plugin: BlockSize must be at least 4096 bytes.");
+        status = -1;
+      }
+      else if (status == 0)
+        conf_block_size = (size_t) tmp;
+    }
+    else if (strcasecmp ("BlockTimeout", child->key) == 0)
+      status = cf_util_get_cdtime (child, &conf_block_timeout);
+    else
+    {
+      WARNING ("archive plugin: Ignoring unknown config option \"%s\".",
+          child->key);
+    }
+
+    if (status != 0)
+      return (status);
+  }
+
+  return (0);
+} /* }}} int archive_config */
+
+static int archive_init (void) /* {{{ */
+{
+  pthread_mutex_lock (&data_lock);
+  if (data_tree == NULL)
+    data_tree = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+  pthread_mutex_unlock (&data_lock);
+
+  if (data_tree == NULL)
+  {
+    ERROR ("archive plugin: c_avl_create failed.");
+    return (-1);
+  }
+
+  if (conf_block_timeout == 0)
+    conf_block_timeout = TIME_T_TO_CDTIME_T (60);
+
+  plugin_register_complex_read (/* group = */ NULL, "archive",
+      archive_read, conf_block_timeout, /* user_data = */ NULL);
+  plugin_register_flush ("archive", archive_flush, /* user_data = */ NULL);
+
+  return (0);
+} /* }}} int archive_init */
+
+static int archive_shutdown (void) /* {{{ */
+{
+  archive_flush_block ();
+
+  pthread_mutex_lock (&data_lock);
+  archive_tree_free (data_tree);
+  data_tree = NULL;
+  pthread_mutex_unlock (&data_lock);
+
+  pthread_mutex_lock (&file_lock);
+  if (file_fd >= 0)
+    close (file_fd);
+  file_fd = -1;
+  pthread_mutex_unlock (&file_lock);
+
+  sfree (conf_datadir);
+
+  return (0);
+} /* }}} int archive_shutdown */
+
+void module_register (void)
+{
+  plugin_register_complex_config ("archive", archive_config);
+  plugin_register_init ("archive", archive_init);
+  plugin_register_write ("archive", archive_write, /* user_data = */ NULL);
+  plugin_register_shutdown ("archive", archive_shutdown);
+} /* void module_register */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
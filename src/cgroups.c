@@ -25,87 +25,130 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_avltree.h"
+#include "utils_cgroup_watch.h"
 #include "utils_mount.h"
 #include "utils_ignorelist.h"
+#include "utils_procfile.h"
+
 
 static char const *config_keys[] =
 {
 	"CGroup",
-	"IgnoreSelected"
+	"IgnoreSelected",
+	"UnifiedHierarchy"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static ignorelist_t *il_cgroup = NULL;
 
+/* -1: use the cpuacct hierarchy if mounted, the unified one otherwise */
+static int conf_unified = -1;
+
+/* The pressure stall information files of the unified hierarchy. */
+static char const *pressure_resources[] = { "cpu", "memory", "io" };
+#define PRESSURE_NUM STATIC_ARRAY_SIZE (pressure_resources)
+
+/*
+ * The cgroups two levels below the mount point, such as
+ * "system.slice/sshd.service", are collected and named after their directory.
+ * They are found once and then tracked with inotify; their files are kept
+ * open and re-read with pread.
+ */
+typedef struct cg_cgroup_s
+{
+	char *path; /* relative to the mount point, key of cgroups_g */
+	char *name;
+
+	procfile_t *cpu;
+	procfile_t *memory;
+	procfile_t *io;
+	procfile_t *pressure[PRESSURE_NUM];
+
+	unsigned long generation;
+	struct cg_cgroup_s *next_removed;
+} cg_cgroup_t;
+
+static char *mount_point_g = NULL;
+static _Bool unified_g = 0;
+static long user_hz_g = 100;
+
+static c_avl_tree_t *cgroups_g = NULL;
+static cgroup_watch_t *watch_g = NULL;
+static unsigned long generation_g = 0;
+
 __attribute__ ((nonnull(1)))
 __attribute__ ((nonnull(2)))
-static void cgroups_submit_one (char const *plugin_instance,
-		char const *type_instance, value_t value)
+__attribute__ ((nonnull(3)))
+static void cgroups_submit (char const *plugin_instance, char const *type,
+		char const *type_instance, value_t *values, size_t values_len)
 {
 	value_list_t vl = VALUE_LIST_INIT;
 
-	vl.values = &value;
-	vl.values_len = 1;
+	vl.values = values;
+	vl.values_len = values_len;
 	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
 	sstrncpy (vl.plugin, "cgroups", sizeof (vl.plugin));
 	sstrncpy (vl.plugin_instance, plugin_instance,
 			sizeof (vl.plugin_instance));
-	sstrncpy (vl.type, "cpu", sizeof (vl.type));
+	sstrncpy (vl.type, type, sizeof (vl.type));
 	sstrncpy (vl.type_instance, type_instance,
 			sizeof (vl.type_instance));
 
 	plugin_dispatch_values (&vl);
-} /* void cgroups_submit_one */
+} /* void cgroups_submit */
 
-/*
- * This callback reads the user/system CPU time for each cgroup.
- */
-static int read_cpuacct_procs (const char *dirname, char const *cgroup_name,
-    void *user_data)
+static void cgroups_submit_one (char const *plugin_instance, char const *type,
+		char const *type_instance, value_t value)
 {
-	char abs_path[PATH_MAX];
-	struct stat statbuf;
-	char buf[1024];
-	int status;
-
-	FILE *fh;
+	cgroups_submit (plugin_instance, type, type_instance, &value, 1);
+} /* void cgroups_submit_one */
 
-	if (ignorelist_match (il_cgroup, cgroup_name))
-		return (0);
+/* Reads one of the files of a cgroup. Files which do not exist, because a
+ * controller is not enabled for the cgroup or the kernel lacks a feature, are
+ * not tried again. */
+static char *cg_read_file (cg_cgroup_t *cg, procfile_t **pf)
+{
+	char *buffer;
 
-	ssnprintf (abs_path, sizeof (abs_path), "%s/%s", dirname, cgroup_name);
+	if (*pf == NULL)
+		return (NULL);
 
-	status = lstat (abs_path, &statbuf);
-	if (status != 0)
+	buffer = procfile_read (*pf, NULL);
+	if ((buffer == NULL) && (errno == ENOENT))
 	{
-		ERROR ("cgroups plugin: stat (\"%s\") failed.",
-				abs_path);
-		return (-1);
+		DEBUG ("cgroups plugin: %s does not exist, not reading it again.",
+				procfile_path (*pf));
+		procfile_destroy (*pf);
+		*pf = NULL;
 	}
+	else if (buffer == NULL)
+		DEBUG ("cgroups plugin: Reading %s of cgroup %s failed.",
+				procfile_path (*pf), cg->path);
 
-	/* We are only interested in directories, so skip everything else. */
-	if (!S_ISDIR (statbuf.st_mode))
-		return (0);
+	return (buffer);
+} /* char *cg_read_file */
 
-	ssnprintf (abs_path, sizeof (abs_path), "%s/%s/cpuacct.stat",
-			dirname, cgroup_name);
-	fh = fopen (abs_path, "r");
-	if (fh == NULL)
-	{
-		char errbuf[1024];
-		ERROR ("cgroups plugin: fopen (\"%s\") failed: %s",
-				abs_path,
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		return (-1);
-	}
+/*
+ * Reads the user/system CPU time from cpuacct.stat.
+ */
+static void cg_read_cpuacct (cg_cgroup_t *cg)
+{
+	char *buffer;
+	char *line;
+
+	buffer = cg_read_file (cg, &cg->cpu);
+	if (buffer == NULL)
+		return;
 
-	while (fgets (buf, sizeof (buf), fh) != NULL)
+	while ((line = procfile_next_line (&buffer)) != NULL)
 	{
 		char *fields[8];
 		int numfields = 0;
 		char *key;
 		size_t key_len;
 		value_t value;
+		char *endptr = NULL;
 
 		/* Expected format:
 		 *
@@ -117,8 +160,8 @@ static int read_cpuacct_procs (const char *dirname, char const *cgroup_name,
 		 *   user 12345
 		 *   system 23456
 		 */
-		strstripnewline (buf);
-		numfields = strsplit (buf, fields, STATIC_ARRAY_SIZE (fields));
+		numfields = procfile_split (line, fields,
+				STATIC_ARRAY_SIZE (fields));
 		if (numfields != 2)
 			continue;
 
@@ -131,54 +174,399 @@ static int read_cpuacct_procs (const char *dirname, char const *cgroup_name,
 		if (key[key_len - 1] == ':')
 			key[key_len - 1] = 0;
 
-		status = parse_value (fields[1], &value, DS_TYPE_DERIVE);
-		if (status != 0)
+		value.derive = (derive_t) procfile_u64 (fields[1], &endptr);
+		if (endptr == fields[1])
 			continue;
 
-		cgroups_submit_one (cgroup_name, key, value);
+		cgroups_submit_one (cg->name, "cpu", key, value);
 	}
+} /* void cg_read_cpuacct */
 
-	fclose (fh);
-	return (0);
-} /* int read_cpuacct_procs */
+/*
+ * Reads the user/system CPU time from cpu.stat of the unified hierarchy.
+ * It is reported in clock ticks like cpuacct.stat.
+ */
+static void cg_read_cpu_stat (cg_cgroup_t *cg)
+{
+	char *buffer;
+	char *line;
+
+	buffer = cg_read_file (cg, &cg->cpu);
+	if (buffer == NULL)
+		return;
+
+	while ((line = procfile_next_line (&buffer)) != NULL)
+	{
+		char *fields[2];
+		char const *type_instance;
+		value_t value;
+
+		if (procfile_split (line, fields, STATIC_ARRAY_SIZE (fields)) != 2)
+			continue;
+
+		if (strcmp ("user_usec", fields[0]) == 0)
+			type_instance = "user";
+		else if (strcmp ("system_usec", fields[0]) == 0)
+			type_instance = "system";
+		else
+			continue;
+
+		value.derive = (derive_t) (procfile_u64 (fields[1], NULL)
+				* user_hz_g / 1000000);
+		cgroups_submit_one (cg->name, "cpu", type_instance, value);
+	}
+} /* void cg_read_cpu_stat */
+
+static void cg_read_memory_current (cg_cgroup_t *cg)
+{
+	char *buffer;
+	char *endptr = NULL;
+	value_t value;
+
+	buffer = cg_read_file (cg, &cg->memory);
+	if (buffer == NULL)
+		return;
+
+	value.gauge = (gauge_t) procfile_u64 (buffer, &endptr);
+	if (endptr == buffer)
+		return;
+
+	cgroups_submit_one (cg->name, "memory", "used", value);
+} /* void cg_read_memory_current */
 
 /*
- * Gets called for every file/folder in /sys/fs/cgroup/cpu,cpuacct (or
- * wherever cpuacct is mounted on the system). Calls walk_directory with the
- * read_cpuacct_procs callback on every folder it finds, such as "system".
+ * Sums up io.stat over all devices. Expected format:
+ *
+ *   8:0 rbytes=90112 wbytes=0 rios=4 wios=0 dbytes=0 dios=0
  */
-static int read_cpuacct_root (const char *dirname, const char *filename,
-		void *user_data)
+static void cg_read_io_stat (cg_cgroup_t *cg)
+{
+	char *buffer;
+	char *line;
+	uint64_t rbytes = 0;
+	uint64_t wbytes = 0;
+	uint64_t rios = 0;
+	uint64_t wios = 0;
+	value_t values[2];
+
+	buffer = cg_read_file (cg, &cg->io);
+	if (buffer == NULL)
+		return;
+
+	while ((line = procfile_next_line (&buffer)) != NULL)
+	{
+		char *fields[16];
+		int numfields;
+		int i;
+
+		numfields = procfile_split (line, fields, STATIC_ARRAY_SIZE (fields));
+		for (i = 1; i < numfields; i++)
+		{
+			char *value = strchr (fields[i], '=');
+
+			if (value == NULL)
+				continue;
+			*value = 0;
+			value++;
+
+			if (strcmp ("rbytes", fields[i]) == 0)
+				rbytes += procfile_u64 (value, NULL);
+			else if (strcmp ("wbytes", fields[i]) == 0)
+				wbytes += procfile_u64 (value, NULL);
+			else if (strcmp ("rios", fields[i]) == 0)
+				rios += procfile_u64 (value, NULL);
+			else if (strcmp ("wios", fields[i]) == 0)
+				wios += procfile_u64 (value, NULL);
+		}
+	}
+
+	values[0].derive = (derive_t) rbytes;
+	values[1].derive = (derive_t) wbytes;
+	cgroups_submit (cg->name, "disk_octets", "", values, 2);
+
+	values[0].derive = (derive_t) rios;
+	values[1].derive = (derive_t) wios;
+	cgroups_submit (cg->name, "disk_ops", "", values, 2);
+} /* void cg_read_io_stat */
+
+/*
+ * Reads the total stall time from a pressure file and reports it in
+ * milliseconds. Expected format:
+ *
+ *   some avg10=0.00 avg60=0.00 avg300=0.00 total=12345
+ *   full avg10=0.00 avg60=0.00 avg300=0.00 total=6789
+ */
+static void cg_read_pressure (cg_cgroup_t *cg, size_t index)
+{
+	char *buffer;
+	char *line;
+
+	buffer = cg_read_file (cg, &cg->pressure[index]);
+	if (buffer == NULL)
+		return;
+
+	while ((line = procfile_next_line (&buffer)) != NULL)
+	{
+		char *fields[5];
+		char type_instance[DATA_MAX_NAME_LEN];
+		value_t value;
+
+		if (procfile_split (line, fields, STATIC_ARRAY_SIZE (fields)) != 5)
+			continue;
+		if (strncmp ("total=", fields[4], strlen ("total=")) != 0)
+			continue;
+
+		ssnprintf (type_instance, sizeof (type_instance), "%s-%s",
+				pressure_resources[index], fields[0]);
+		value.derive = (derive_t) (procfile_u64 (fields[4]
+					+ strlen ("total="), NULL) / 1000);
+		cgroups_submit_one (cg->name, "total_time_in_ms", type_instance,
+				value);
+	}
+} /* void cg_read_pressure */
+
+static void cg_read_cgroup (cg_cgroup_t *cg)
+{
+	size_t i;
+
+	if (!unified_g)
+	{
+		cg_read_cpuacct (cg);
+		return;
+	}
+
+	cg_read_cpu_stat (cg);
+	cg_read_memory_current (cg);
+	cg_read_io_stat (cg);
+	for (i = 0; i < PRESSURE_NUM; i++)
+		cg_read_pressure (cg, i);
+} /* void cg_read_cgroup */
+
+static procfile_t *cg_open_file (char const *path, char const *file)
 {
 	char abs_path[PATH_MAX];
-	struct stat statbuf;
-	int status;
 
-	ssnprintf (abs_path, sizeof (abs_path), "%s/%s", dirname, filename);
+	ssnprintf (abs_path, sizeof (abs_path), "%s/%s/%s",
+			mount_point_g, path, file);
+	return (procfile_create (abs_path));
+} /* procfile_t *cg_open_file */
+
+static void cg_cgroup_free (cg_cgroup_t *cg)
+{
+	size_t i;
+
+	if (cg == NULL)
+		return;
+
+	procfile_destroy (cg->cpu);
+	procfile_destroy (cg->memory);
+	procfile_destroy (cg->io);
+	for (i = 0; i < PRESSURE_NUM; i++)
+		procfile_destroy (cg->pressure[i]);
+	sfree (cg->path);
+	sfree (cg);
+} /* void cg_cgroup_free */
+
+/* Adds the cgroup "parent/name", or marks it as seen if it is known. */
+static void cg_cgroup_found (char const *path,
+		__attribute__((unused)) void *user_data)
+{
+	char const *name;
+	cg_cgroup_t *cg;
+	size_t i;
 
-	status = lstat (abs_path, &statbuf);
-	if (status != 0)
+	name = strchr (path, '/');
+	if (name == NULL)
+		return;
+	name++;
+
+	if (ignorelist_match (il_cgroup, name))
+		return;
+
+	if (c_avl_get (cgroups_g, path, (void *) &cg) == 0)
+	{
+		cg->generation = generation_g;
+		return;
+	}
+
+	cg = calloc (1, sizeof (*cg));
+	if (cg == NULL)
+		return;
+
+	cg->path = strdup (path);
+	if (cg->path == NULL)
 	{
-		ERROR ("cgroups plugin: stat (%s) failed.", abs_path);
+		sfree (cg);
+		return;
+	}
+	cg->name = cg->path + (name - path);
+	cg->generation = generation_g;
+
+	if (unified_g)
+	{
+		cg->cpu = cg_open_file (path, "cpu.stat");
+		cg->memory = cg_open_file (path, "memory.current");
+		cg->io = cg_open_file (path, "io.stat");
+		for (i = 0; i < PRESSURE_NUM; i++)
+		{
+			char file[32];
+
+			ssnprintf (file, sizeof (file), "%s.pressure",
+					pressure_resources[i]);
+			cg->pressure[i] = cg_open_file (path, file);
+		}
+	}
+	else
+		cg->cpu = cg_open_file (path, "cpuacct.stat");
+
+	if (c_avl_insert (cgroups_g, cg->path, cg) != 0)
+	{
+		cg_cgroup_free (cg);
+		return;
+	}
+
+	DEBUG ("cgroups plugin: Added cgroup %s.", path);
+} /* void cg_cgroup_found */
+
+/* Removes the cgroup "parent/name", or all cgroups below "parent". */
+static void cg_cgroup_lost (char const *path,
+		__attribute__((unused)) void *user_data)
+{
+	c_avl_iterator_t *iter;
+	cg_cgroup_t *removed = NULL;
+	cg_cgroup_t *cg;
+	char *key;
+	size_t path_len = strlen (path);
+
+	if (strchr (path, '/') != NULL)
+	{
+		if (c_avl_remove (cgroups_g, path, (void *) &key, (void *) &cg) != 0)
+			return;
+
+		DEBUG ("cgroups plugin: Removed cgroup %s.", path);
+		cg_cgroup_free (cg);
+		return;
+	}
+
+	iter = c_avl_get_iterator (cgroups_g);
+	while (c_avl_iterator_next (iter, (void *) &key, (void *) &cg) == 0)
+	{
+		if ((strncmp (path, cg->path, path_len) != 0)
+				|| (cg->path[path_len] != '/'))
+			continue;
+		cg->next_removed = removed;
+		removed = cg;
+	}
+	c_avl_iterator_destroy (iter);
+
+	while ((cg = removed) != NULL)
+	{
+		removed = cg->next_removed;
+		c_avl_remove (cgroups_g, cg->path, NULL, NULL);
+		cg_cgroup_free (cg);
+	}
+} /* void cg_cgroup_lost */
+
+/* Drops the cgroups which were not found by the last listing. */
+static void cg_cgroup_drop_stale (void)
+{
+	c_avl_iterator_t *iter;
+	cg_cgroup_t *removed = NULL;
+	cg_cgroup_t *cg;
+	char *key;
+
+	iter = c_avl_get_iterator (cgroups_g);
+	while (c_avl_iterator_next (iter, (void *) &key, (void *) &cg) == 0)
+	{
+		if (cg->generation == generation_g)
+			continue;
+		cg->next_removed = removed;
+		removed = cg;
+	}
+	c_avl_iterator_destroy (iter);
+
+	while ((cg = removed) != NULL)
+	{
+		removed = cg->next_removed;
+		c_avl_remove (cgroups_g, cg->path, NULL, NULL);
+		cg_cgroup_free (cg);
+	}
+} /* void cg_cgroup_drop_stale */
+
+/* Finds the hierarchy to read: the one with the cpuacct controller, or the
+ * unified hierarchy. */
+static int cg_find_mount_point (void)
+{
+	cu_mount_t *mnt_list;
+	cu_mount_t *mnt_ptr;
+	cu_mount_t *found = NULL;
+
+	mnt_list = NULL;
+	if (cu_mount_getlist (&mnt_list) == NULL)
+	{
+		ERROR ("cgroups plugin: cu_mount_getlist failed.");
 		return (-1);
 	}
 
-	if (S_ISDIR (statbuf.st_mode))
+	/* It doesn't make sense to check other cpuacct mount-points (if any),
+	 * they contain the same data. */
+	if (conf_unified != 1)
+		for (mnt_ptr = mnt_list; mnt_ptr != NULL; mnt_ptr = mnt_ptr->next)
+			if ((strcmp (mnt_ptr->type, "cgroup") == 0)
+					&& cu_mount_checkoption (mnt_ptr->options,
+						"cpuacct", /* full = */ 1))
+			{
+				found = mnt_ptr;
+				unified_g = 0;
+				break;
+			}
+
+	if ((found == NULL) && (conf_unified != 0))
+		for (mnt_ptr = mnt_list; mnt_ptr != NULL; mnt_ptr = mnt_ptr->next)
+			if (strcmp (mnt_ptr->type, "cgroup2") == 0)
+			{
+				found = mnt_ptr;
+				unified_g = 1;
+				break;
+			}
+
+	if (found != NULL)
+	{
+		sfree (mount_point_g);
+		mount_point_g = strdup (found->dir);
+	}
+
+	cu_mount_freelist (mnt_list);
+
+	if (mount_point_g == NULL)
 	{
-		status = walk_directory (abs_path, read_cpuacct_procs,
-				/* user_data = */ NULL,
-				/* include_hidden = */ 0);
-		return (status);
+		WARNING ("cgroups plugin: Unable to find a cgroup "
+				"mount-point with the \"cpuacct\" option%s.",
+				(conf_unified != 0) ? " or of the unified hierarchy" : "");
+		return (-1);
 	}
 
+	INFO ("cgroups plugin: Reading the %s hierarchy at `%s'.",
+			unified_g ? "unified" : "cpuacct", mount_point_g);
 	return (0);
-}
+} /* int cg_find_mount_point */
 
 static int cgroups_init (void)
 {
 	if (il_cgroup == NULL)
 		il_cgroup = ignorelist_create (1);
 
+	if (cgroups_g == NULL)
+	{
+		long hz = sysconf (_SC_CLK_TCK);
+		if (hz > 0)
+			user_hz_g = hz;
+
+		cgroups_g = c_avl_create ((void *) strcmp);
+		if (cgroups_g == NULL)
+			return (-1);
+	}
+
 	return (0);
 }
 
@@ -200,52 +588,76 @@ static int cgroups_config (const char *key, const char *value)
 			ignorelist_set_invert (il_cgroup, 1);
 		return (0);
 	}
+	else if (strcasecmp (key, "UnifiedHierarchy") == 0)
+	{
+		conf_unified = IS_TRUE (value) ? 1 : 0;
+		return (0);
+	}
 
 	return (-1);
 }
 
 static int cgroups_read (void)
 {
-	cu_mount_t *mnt_list;
-	cu_mount_t *mnt_ptr;
-	_Bool cgroup_found = 0;
+	c_avl_iterator_t *iter;
+	cg_cgroup_t *cg;
+	char *key;
+	int status;
 
-	mnt_list = NULL;
-	if (cu_mount_getlist (&mnt_list) == NULL)
-	{
-		ERROR ("cgroups plugin: cu_mount_getlist failed.");
+	if ((mount_point_g == NULL) && (cg_find_mount_point () != 0))
 		return (-1);
-	}
 
-	for (mnt_ptr = mnt_list; mnt_ptr != NULL; mnt_ptr = mnt_ptr->next)
+	if (watch_g == NULL)
 	{
-		/* Find the cgroup mountpoint which contains the cpuacct
-		 * controller. */
-		if ((strcmp(mnt_ptr->type, "cgroup") != 0)
-				|| !cu_mount_checkoption(mnt_ptr->options,
-					"cpuacct", /* full = */ 1))
-			continue;
-
-		walk_directory (mnt_ptr->dir, read_cpuacct_root,
-				/* user_data = */ NULL,
-				/* include_hidden = */ 0);
-		cgroup_found = 1;
-		/* It doesn't make sense to check other cpuacct mount-points
-		 * (if any), they contain the same data. */
-		break;
+		watch_g = cgroup_watch_create ("cgroups", mount_point_g,
+				/* depth = */ 2);
+		if (watch_g == NULL)
+		{
+			ERROR ("cgroups plugin: cgroup_watch_create failed.");
+			return (-1);
+		}
 	}
 
-	cu_mount_freelist (mnt_list);
+	/* The hierarchy is only listed when inotify is not available or has
+	 * lost track of it. */
+	generation_g++;
+	status = cgroup_watch_read (watch_g, cg_cgroup_found, cg_cgroup_lost,
+			/* user_data = */ NULL);
+	if (status < 0)
+		return (-1);
+	else if (status > 0)
+		cg_cgroup_drop_stale ();
 
-	if (!cgroup_found)
+	iter = c_avl_get_iterator (cgroups_g);
+	while (c_avl_iterator_next (iter, (void *) &key, (void *) &cg) == 0)
+		cg_read_cgroup (cg);
+	c_avl_iterator_destroy (iter);
+
+	return (0);
+} /* int cgroup_read */
+
+static int cgroups_shutdown (void)
+{
+	cg_cgroup_t *cg;
+	char *key;
+
+	cgroup_watch_destroy (watch_g);
+	watch_g = NULL;
+
+	if (cgroups_g != NULL)
 	{
-		WARNING ("cgroups plugin: Unable to find cgroup "
-				"mount-point with the \"cpuacct\" option.");
-		return (-1);
+		while (c_avl_pick (cgroups_g, (void *) &key, (void *) &cg) == 0)
+			cg_cgroup_free (cg);
+		c_avl_destroy (cgroups_g);
+		cgroups_g = NULL;
 	}
 
+	sfree (mount_point_g);
+	ignorelist_free (il_cgroup);
+	il_cgroup = NULL;
+
 	return (0);
-} /* int cgroup_read */
+} /* int cgroups_shutdown */
 
 void module_register (void)
 {
@@ -253,4 +665,5 @@ void module_register (void)
 			config_keys, config_keys_num);
 	plugin_register_init ("cgroups", cgroups_init);
 	plugin_register_read ("cgroups", cgroups_read);
+	plugin_register_shutdown ("cgroups", cgroups_shutdown);
 } /* void module_register */
@@ -0,0 +1,344 @@
+/**
+ * collectd - src/collectd-archive.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+#include "collectd.h"
+#include "plugin.h"
+#include "utils_avltree.h"
+#include "utils_archive.h"
+
+#include <getopt.h>
+
+#if HAVE_FNMATCH_H
+# include <fnmatch.h>
+#endif
+
+/* Per series totals for "-l". */
+struct series_info_s
+{
+  char *key;
+  int ds_type;
+  uint64_t points_num;
+  cdtime_t time_first;
+  cdtime_t time_last;
+};
+typedef struct series_info_s series_info_t;
+
+enum { MODE_DUMP, MODE_LIST, MODE_BLOCKS };
+
+static int conf_mode = MODE_DUMP;
+static const char *conf_pattern = NULL;
+static cdtime_t conf_time_begin = 0;
+static cdtime_t conf_time_end = 0;
+
+static c_avl_tree_t *series_tree = NULL;
+
+__attribute__((noreturn))
+static void exit_usage (int exit_status) /* {{{ */
+{
+  fprintf ((exit_status == EXIT_FAILURE) ? stderr : stdout,
+      "collectd-archive -- read archive files written by collectd\n"
+      "\n"
+      "  Usage: collectd-archive [OPTION] <file> [<file> ...]\n"
+      "\n"
+      "  Valid options:\n"
+      "    -l             List the series with their number of points and\n"
+      "                   time range instead of printing the values.\n"
+      "    -b             Print the block index instead of the values.\n"
+      "    -i <pattern>   Only consider identifiers matching this wildcard\n"
+      "                   pattern, e.g. \"*/cpu-*/*\".\n"
+      "    -s <time>      Ignore values before this time (seconds since\n"
+      "                   the epoch).\n"
+      "    -e <time>      Ignore values after this time (seconds since\n"
+      "                   the epoch).\n"
+      "    -h             Print usage information (this output).\n"
+      "\n"
+      "Copyright (C) 2026  ETH Zurich\n"
+      "Licensed under the MIT license.\n");
+  exit (exit_status);
+} /* }}} void exit_usage */
+
+static cdtime_t get_time_opt (const char *str) /* {{{ */
+{
+  char *endptr = NULL;
+  double tmp;
+
+  errno = 0;
+  tmp = strtod (str, &endptr);
+  if ((errno != 0) || (endptr == str) || (*endptr != 0) || (tmp < 0.0))
+  {
+    fprintf (stderr, "Unable to parse option as a time: \"%s\"\n", str);
+    exit (EXIT_FAILURE);
+  }
+
+  return (DOUBLE_TO_CDTIME_T (tmp));
+} /* }}} cdtime_t get_time_opt */
+
+static _Bool identifier_matches (const char *identifier) /* {{{ */
+{
+  if (conf_pattern == NULL)
+    return (1);
+#if HAVE_FNMATCH_H
+  return (fnmatch (conf_pattern, identifier, 0) == 0);
+#else
+  return (strcmp (conf_pattern, identifier) == 0);
+#endif
+} /* }}} _Bool identifier_matches */
+
+static _Bool time_in_range (cdtime_t first, cdtime_t last) /* {{{ */
+{
+  if ((conf_time_begin != 0) && (last < conf_time_begin))
+    return (0);
+  if ((conf_time_end != 0) && (first > conf_time_end))
+    return (0);
+  return (1);
+} /* }}} _Bool time_in_range */
+
+static void print_value (int ds_type, value_t v) /* {{{ */
+{
+  if (ds_type == DS_TYPE_GAUGE)
+    printf ("%.15g", v.gauge);
+  else if (ds_type == DS_TYPE_COUNTER)
+    printf ("%llu", v.counter);
+  else if (ds_type == DS_TYPE_DERIVE)
+    printf ("%"PRIi64, v.derive);
+  else
+    printf ("%"PRIu64, v.absolute);
+} /* }}} void print_value */
+
+static int dump_series (archive_series_t const *s) /* {{{ */
+{
+  archive_decoder_t d;
+  cdtime_t t;
+  value_t v;
+  int status;
+
+  archive_decoder_init (&d, s);
+  while ((status = archive_decoder_next (&d, &t, &v)) == 0)
+  {
+    if (!time_in_range (t, t))
+      continue;
+
+    printf ("%.3f,%s,%s,", CDTIME_T_TO_DOUBLE (t), s->identifier, s->ds_name);
+    print_value (s->ds_type, v);
+    printf ("\n");
+  }
+
+  return ((status < 0) ? -1 : 0);
+} /* }}} int dump_series */
+
+static int list_series (archive_series_t const *s) /* {{{ */
+{
+  series_info_t *info = NULL;
+  char key[6 * DATA_MAX_NAME_LEN + DATA_MAX_NAME_LEN + 2];
+
+  snprintf (key, sizeof (key), "%s %s", s->identifier, s->ds_name);
+  if (c_avl_get (series_tree, key, (void *) &info) != 0)
+  {
+    info = calloc (1, sizeof (*info));
+    if (info == NULL)
+      return (-1);
+    info->key = strdup (key);
+    if ((info->key == NULL)
+        || (c_avl_insert (series_tree, info->key, info) != 0))
+    {
+      free (info->key);
+      free (info);
+      return (-1);
+    }
+    info->ds_type = s->ds_type;
+    info->time_first = s->time_first;
+    info->time_last = s->time_last;
+  }
+
+  info->points_num += s->points_num;
+  if (s->time_first < info->time_first)
+    info->time_first = s->time_first;
+  if (s->time_last > info->time_last)
+    info->time_last = s->time_last;
+
+  return (0);
+} /* }}} int list_series */
+
+static int process_file (const char *path) /* {{{ */
+{
+  archive_file_t *f;
+  archive_block_t b;
+  size_t offset = ARCHIVE_FILE_HEADER_SIZE;
+  size_t block_offset;
+  int status;
+
+  f = archive_file_open (path);
+  if (f == NULL)
+  {
+    fprintf (stderr, "Opening \"%s\" failed: %s\n", path, strerror (errno));
+    return (-1);
+  }
+
+  while (42)
+  {
+    uint32_t i;
+
+    block_offset = offset;
+    status = archive_file_next_block (f, &offset, &b);
+    if (status != 0)
+      break;
+
+    if (conf_mode == MODE_BLOCKS)
+    {
+      printf ("%s: offset %zu, size %zu, %"PRIu32" series, %"PRIu64" points, "
+          "%.3f - %.3f\n",
+          path, block_offset, b.size, b.series_num, b.points_num,
+          CDTIME_T_TO_DOUBLE (b.time_min), CDTIME_T_TO_DOUBLE (b.time_max));
+      continue;
+    }
+
+    /* The block index allows skipping blocks without decoding them. */
+    if (!time_in_range (b.time_min, b.time_max))
+      continue;
+
+    for (i = 0; i < b.series_num; i++)
+    {
+      archive_series_t s;
+
+      status = archive_block_series (&b, i, &s);
+      if (status != 0)
+        break;
+
+      if (!identifier_matches (s.identifier)
+          || !time_in_range (s.time_first, s.time_last))
+        continue;
+
+      if (conf_mode == MODE_LIST)
+        status = list_series (&s);
+      else
+        status = dump_series (&s);
+      if (status != 0)
+        break;
+    }
+
+    if (status != 0)
+    {
+      status = -1;
+      break;
+    }
+  }
+
+  archive_file_close (f);
+
+  if (status < 0)
+  {
+    fprintf (stderr, "%s: Corrupt or truncated block at offset %zu.\n",
+        path, block_offset);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int process_file */
+
+/* Prints the series sorted by identifier and frees them. */
+static void print_list (void) /* {{{ */
+{
+  c_avl_iterator_t *iter;
+  series_info_t *info;
+  char *key;
+
+  iter = c_avl_get_iterator (series_tree);
+  while (c_avl_iterator_next (iter, (void *) &key, (void *) &info) == 0)
+    printf ("%s %s %"PRIu64" %.3f %.3f\n", info->key,
+        DS_TYPE_TO_STRING (info->ds_type), info->points_num,
+        CDTIME_T_TO_DOUBLE (info->time_first),
+        CDTIME_T_TO_DOUBLE (info->time_last));
+  c_avl_iterator_destroy (iter);
+
+  while (c_avl_pick (series_tree, (void *) &key, (void *) &info) == 0)
+  {
+    free (info->key);
+    free (info);
+  }
+} /* }}} void print_list */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  int exit_status = EXIT_SUCCESS;
+  int opt;
+  int i;
+
+  while ((opt = getopt (argc, argv, "lbi:s:e:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'l':
+        conf_mode = MODE_LIST;
+        break;
+
+      case 'b':
+        conf_mode = MODE_BLOCKS;
+        break;
+
+      case 'i':
+        conf_pattern = optarg;
+        break;
+
+      case 's':
+        conf_time_begin = get_time_opt (optarg);
+        break;
+
+      case 'e':
+        conf_time_end = get_time_opt (optarg);
+        break;
+
+      case 'h':
+        exit_usage (EXIT_SUCCESS);
+
+      default:
+        exit_usage (EXIT_FAILURE);
+    } /* switch (opt) */
+  } /* while (getopt) */
+
+  if (optind >= argc)
+    exit_usage (EXIT_FAILURE);
+
+  series_tree = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+  if (series_tree == NULL)
+  {
+    fprintf (stderr, "c_avl_create failed.\n");
+    exit (EXIT_FAILURE);
+  }
+
+  if (conf_mode == MODE_DUMP)
+    printf ("epoch,identifier,ds_name,value\n");
+
+  for (i = optind; i < argc; i++)
+    if (process_file (argv[i]) != 0)
+      exit_status = EXIT_FAILURE;
+
+  if (conf_mode == MODE_LIST)
+    print_list ();
+  c_avl_destroy (series_tree);
+
+  exit (exit_status);
+  return (exit_status);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -69,8 +69,21 @@ static int conf_num_values = DEF_NUM_VALUES;
 static double conf_interval = DEF_INTERVAL;
 static const char *conf_destination = NET_DEFAULT_V6_ADDR;
 static const char *conf_service = NET_DEFAULT_PORT;
+static lcc_protocol_t conf_protocol = LCC_PROTOCOL_UDP;
+static int conf_max_values_sent = 0;
+static const char *conf_unixsock = NULL;
+static _Bool conf_reconnect = 0;
+static int conf_batch_size = 0;
+static _Bool conf_binary = 0;
+static int conf_pipeline_depth = 0;
 
 static lcc_network_t *net;
+static lcc_connection_t *unixsock_conn = NULL;
+
+/* Value lists collected for the next BATCH or PUTBIN command. */
+static lcc_value_list_t *batch_vl = NULL;
+static value_t *batch_values = NULL;
+static int batch_fill = 0;
 
 static c_heap_t *values_heap = NULL;
 
@@ -96,6 +109,18 @@ static void exit_usage (int exit_status) /* {{{ */
       "                   (Default: %s)\n"
       "    -D <port>      Destination port of the network packets.\n"
       "                   (Default: %s)\n"
+      "    -T             Send over a TCP connection instead of UDP.\n"
+      "    -c <number>    Exit after sending this many values and print\n"
+      "                   the achieved rate. (Default: run until killed)\n"
+      "    -u <path>      Send PUTVAL commands to the UNIX socket of the\n"
+      "                   unixsock plugin instead of network packets.\n"
+      "    -r             With -u: Open a new connection for every value.\n"
+      "    -b <number>    With -u: Submit this many values with a single\n"
+      "                   BATCH command.\n"
+      "    -B             With -b: Use the binary PUTBIN command instead of\n"
+      "                   BATCH.\n"
+      "    -P <number>    With -u: Keep up to this many PUTVAL commands in\n"
+      "                   flight before waiting for their responses.\n"
       "    -h             Print usage information (this output).\n"
       "\n"
       "Copyright (C) 2010-2012  Florian Forster\n"
@@ -204,6 +229,83 @@ static void destroy_value_list (lcc_value_list_t *vl) /* {{{ */
   free (vl);
 } /* }}} void destroy_value_list */
 
+static int unixsock_connect (void) /* {{{ */
+{
+  int status;
+
+  if (unixsock_conn != NULL)
+    return (0);
+
+  status = lcc_connect (conf_unixsock, &unixsock_conn);
+  if (status != 0)
+  {
+    fprintf (stderr, "lcc_connect (%s) failed with status %i.\n",
+        conf_unixsock, status);
+    unixsock_conn = NULL;
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int unixsock_connect */
+
+static int send_batch (void) /* {{{ */
+{
+  int status;
+
+  if (batch_fill == 0)
+    return (0);
+
+  status = unixsock_connect ();
+  if (status != 0)
+    return (status);
+
+  if (conf_binary)
+    status = lcc_putval_binary (unixsock_conn, batch_vl, (size_t) batch_fill);
+  else
+    status = lcc_putval_batch (unixsock_conn, batch_vl, (size_t) batch_fill);
+  if (status != 0)
+    fprintf (stderr, "%s failed: %s\n",
+        conf_binary ? "lcc_putval_binary" : "lcc_putval_batch",
+        lcc_strerror (unixsock_conn));
+
+  if (conf_reconnect || (status != 0))
+  {
+    lcc_disconnect (unixsock_conn);
+    unixsock_conn = NULL;
+  }
+
+  batch_fill = 0;
+  return (status);
+} /* }}} int send_batch */
+
+/* Receives pipelined responses until at most "max_pending" are outstanding. */
+static int receive_pipelined (size_t max_pending) /* {{{ */
+{
+  int status = 0;
+
+  if (unixsock_conn == NULL)
+    return (0);
+
+  while (lcc_pending (unixsock_conn) > max_pending)
+  {
+    status = lcc_recv_status (unixsock_conn);
+    if (status != 0)
+    {
+      fprintf (stderr, "lcc_recv_status failed: %s\n",
+          lcc_strerror (unixsock_conn));
+      break;
+    }
+  }
+
+  if (status != 0)
+  {
+    lcc_disconnect (unixsock_conn);
+    unixsock_conn = NULL;
+  }
+
+  return (status);
+} /* }}} int receive_pipelined */
+
 static int send_value (lcc_value_list_t *vl) /* {{{ */
 {
   int status;
@@ -213,9 +315,57 @@ static int send_value (lcc_value_list_t *vl) /* {{{ */
   else
     vl->values[0].derive += get_boundet_random (0, 100);
 
-  status = lcc_network_values_send (net, vl);
-  if (status != 0)
-    fprintf (stderr, "lcc_network_values_send failed with status %i.\n", status);
+  if ((conf_unixsock != NULL) && (conf_batch_size > 1))
+  {
+    memcpy (batch_vl + batch_fill, vl, sizeof (*vl));
+    batch_values[batch_fill] = vl->values[0];
+    batch_vl[batch_fill].values = batch_values + batch_fill;
+    batch_fill++;
+
+    status = 0;
+    if (batch_fill >= conf_batch_size)
+      status = send_batch ();
+  }
+  else if ((conf_unixsock != NULL) && (conf_pipeline_depth > 0))
+  {
+    status = unixsock_connect ();
+    if (status != 0)
+      return (status);
+
+    status = lcc_send_putval (unixsock_conn, vl);
+    if (status != 0)
+    {
+      fprintf (stderr, "lcc_send_putval failed: %s\n",
+          lcc_strerror (unixsock_conn));
+      lcc_disconnect (unixsock_conn);
+      unixsock_conn = NULL;
+    }
+    else
+      receive_pipelined ((size_t) conf_pipeline_depth);
+  }
+  else if (conf_unixsock != NULL)
+  {
+    status = unixsock_connect ();
+    if (status != 0)
+      return (status);
+
+    status = lcc_putval (unixsock_conn, vl);
+    if (status != 0)
+      fprintf (stderr, "lcc_putval failed: %s\n",
+          lcc_strerror (unixsock_conn));
+
+    if (conf_reconnect || (status != 0))
+    {
+      lcc_disconnect (unixsock_conn);
+      unixsock_conn = NULL;
+    }
+  }
+  else
+  {
+    status = lcc_network_values_send (net, vl);
+    if (status != 0)
+      fprintf (stderr, "lcc_network_values_send failed with status %i.\n", status);
+  }
 
   vl->time += vl->interval;
 
@@ -284,7 +434,7 @@ static int read_options (int argc, char **argv) /* {{{ */
 {
   int opt;
 
-  while ((opt = getopt (argc, argv, "n:H:p:i:d:D:h")) != -1)
+  while ((opt = getopt (argc, argv, "n:H:p:i:d:D:Tc:u:rb:BP:h")) != -1)
   {
     switch (opt)
     {
@@ -312,6 +462,34 @@ static int read_options (int argc, char **argv) /* {{{ */
         conf_service = optarg;
         break;
 
+      case 'T':
+        conf_protocol = LCC_PROTOCOL_TCP;
+        break;
+
+      case 'c':
+        get_integer_opt (optarg, &conf_max_values_sent);
+        break;
+
+      case 'u':
+        conf_unixsock = optarg;
+        break;
+
+      case 'r':
+        conf_reconnect = 1;
+        break;
+
+      case 'b':
+        get_integer_opt (optarg, &conf_batch_size);
+        break;
+
+      case 'B':
+        conf_binary = 1;
+        break;
+
+      case 'P':
+        get_integer_opt (optarg, &conf_pipeline_depth);
+        break;
+
       case 'h':
         exit_usage (EXIT_SUCCESS);
 
@@ -328,6 +506,9 @@ int main (int argc, char **argv) /* {{{ */
   int i;
   time_t last_time;
   int values_sent = 0;
+  struct timespec ts_begin;
+  struct timespec ts_end;
+  double duration;
 
   read_options (argc, argv);
 
@@ -363,12 +544,24 @@ int main (int argc, char **argv) /* {{{ */
     }
 
     lcc_server_set_ttl (srv, 42);
+    lcc_server_set_protocol (srv, conf_protocol);
 #if 0
     lcc_server_set_security_level (srv, ENCRYPT,
         "admin", "password1");
 #endif
   }
 
+  if (conf_batch_size > 1)
+  {
+    batch_vl = calloc ((size_t) conf_batch_size, sizeof (*batch_vl));
+    batch_values = calloc ((size_t) conf_batch_size, sizeof (*batch_values));
+    if ((batch_vl == NULL) || (batch_values == NULL))
+    {
+      fprintf (stderr, "calloc failed.\n");
+      exit (EXIT_FAILURE);
+    }
+  }
+
   fprintf (stdout, "Creating %i values ... ", conf_num_values);
   fflush (stdout);
   for (i = 0; i < conf_num_values; i++)
@@ -386,6 +579,8 @@ int main (int argc, char **argv) /* {{{ */
   }
   fprintf (stdout, "done\n");
 
+  clock_gettime (CLOCK_MONOTONIC, &ts_begin);
+
   last_time = 0;
   while (loop)
   {
@@ -418,8 +613,21 @@ int main (int argc, char **argv) /* {{{ */
     values_sent++;
 
     c_heap_insert (values_heap, vl);
+
+    if ((conf_max_values_sent > 0) && (values_sent >= conf_max_values_sent))
+      break;
   }
 
+  send_batch ();
+  receive_pipelined (/* max_pending = */ 0);
+
+  clock_gettime (CLOCK_MONOTONIC, &ts_end);
+  duration = ((double) (ts_end.tv_sec - ts_begin.tv_sec))
+    + ((double) (ts_end.tv_nsec - ts_begin.tv_nsec)) / 1e9;
+  fprintf (stdout, "%i values have been sent in %.3f seconds (%.0f values/s).\n",
+      values_sent, duration,
+      (duration > 0.0) ? ((double) values_sent) / duration : 0.0);
+
   fprintf (stdout, "Shutting down.\n");
   fflush (stdout);
 
@@ -433,6 +641,10 @@ int main (int argc, char **argv) /* {{{ */
   c_heap_destroy (values_heap);
 
   lcc_network_destroy (net);
+  if (unixsock_conn != NULL)
+    lcc_disconnect (unixsock_conn);
+  free (batch_vl);
+  free (batch_values);
   exit (EXIT_SUCCESS);
   return (0);
 } /* }}} int main */
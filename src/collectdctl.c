@@ -86,7 +86,7 @@ static void exit_usage (const char *name, int status) {
 
       " * getval <identifier>\n"
       " * flush [timeout=<seconds>] [plugin=<name>] [identifier=<id>]\n"
-      " * listval\n"
+      " * listval [<pattern>]\n"
       " * putval <identifier> [interval=<seconds>] <value-list(s)>\n"
 
       "\nIdentifiers:\n\n"
@@ -343,49 +343,44 @@ static int flush (lcc_connection_t *c, int argc, char **argv)
 #undef BAIL_OUT
 } /* flush */
 
-static int listval (lcc_connection_t *c, int argc, char **argv)
+static int listval_print (const lcc_identifier_t *ident,
+    double __attribute__((unused)) time, void *user_data)
 {
-  lcc_identifier_t *ret_ident     = NULL;
-  size_t            ret_ident_num = 0;
+  lcc_connection_t *c = user_data;
+  char id[1024];
+  int status;
+
+  status = lcc_identifier_to_string (c, id, sizeof (id), ident);
+  if (status != 0) {
+    fprintf (stderr, "ERROR: listval: Failed to convert returned "
+        "identifier to a string: %s\n", lcc_strerror (c));
+    return (0);
+  }
+
+  printf ("%s\n", id);
+  return (0);
+} /* listval_print */
 
+static int listval (lcc_connection_t *c, int argc, char **argv)
+{
   int status;
-  size_t i;
 
   assert (strcasecmp (argv[0], "listval") == 0);
 
-  if (argc != 1) {
-    fprintf (stderr, "ERROR: listval: Does not accept any arguments.\n");
+  if (argc > 2) {
+    fprintf (stderr, "ERROR: listval: Too many arguments.\n");
     return (-1);
   }
 
-#define BAIL_OUT(s) \
-  do { \
-    if (ret_ident != NULL) \
-      free (ret_ident); \
-    ret_ident_num = 0; \
-    return (s); \
-  } while (0)
-
-  status = lcc_listval (c, &ret_ident, &ret_ident_num);
+  /* Identifiers are printed as they are received. */
+  status = lcc_listval_foreach (c, (argc == 2) ? argv[1] : NULL,
+      listval_print, c);
   if (status != 0) {
     fprintf (stderr, "ERROR: %s\n", lcc_strerror (c));
-    BAIL_OUT (status);
+    return (status);
   }
 
-  for (i = 0; i < ret_ident_num; ++i) {
-    char id[1024];
-
-    status = lcc_identifier_to_string (c, id, sizeof (id), ret_ident + i);
-    if (status != 0) {
-      fprintf (stderr, "ERROR: listval: Failed to convert returned "
-          "identifier to a string: %s\n", lcc_strerror (c));
-      continue;
-    }
-
-    printf ("%s\n", id);
-  }
-  BAIL_OUT (0);
-#undef BAIL_OUT
+  return (0);
 } /* listval */
 
 static int putval (lcc_connection_t *c, int argc, char **argv)
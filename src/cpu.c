@@ -134,7 +134,8 @@ static mach_msg_type_number_t cpu_list_len;
 /* #endif PROCESSOR_CPU_LOAD_INFO */
 
 #elif defined(KERNEL_LINUX)
-/* no variables needed */
+# include "utils_procfile.h"
+static procfile_t *proc_stat;
 /* #endif KERNEL_LINUX */
 
 #elif defined(HAVE_LIBKSTAT)
@@ -597,49 +598,53 @@ static int cpu_read (void)
 
 #elif defined(KERNEL_LINUX) /* {{{ */
 	int cpu;
-	FILE *fh;
-	char buf[1024];
+	char *buf;
+	char *line;
 
 	char *fields[9];
 	int numfields;
 
-	if ((fh = fopen ("/proc/stat", "r")) == NULL)
+	if ((proc_stat == NULL)
+			&& ((proc_stat = procfile_create ("/proc/stat")) == NULL))
+		return (-1);
+
+	if ((buf = procfile_read (proc_stat, NULL)) == NULL)
 	{
 		char errbuf[1024];
-		ERROR ("cpu plugin: fopen (/proc/stat) failed: %s",
+		ERROR ("cpu plugin: Reading /proc/stat failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	while (fgets (buf, 1024, fh) != NULL)
+	/* The per-CPU lines come right after the summary line. */
+	while ((line = procfile_next_line (&buf)) != NULL)
 	{
-		if (strncmp (buf, "cpu", 3))
-			continue;
-		if ((buf[3] < '0') || (buf[3] > '9'))
+		if (strncmp (line, "cpu", 3))
+			break;
+		if ((line[3] < '0') || (line[3] > '9'))
 			continue;
 
-		numfields = strsplit (buf, fields, 9);
+		numfields = procfile_split (line, fields, 9);
 		if (numfields < 5)
 			continue;
 
-		cpu = atoi (fields[0] + 3);
+		cpu = (int) procfile_u64 (fields[0] + 3, NULL);
 
-		cpu_stage (cpu, COLLECTD_CPU_STATE_USER,   (derive_t) atoll(fields[1]), now);
-		cpu_stage (cpu, COLLECTD_CPU_STATE_NICE,   (derive_t) atoll(fields[2]), now);
-		cpu_stage (cpu, COLLECTD_CPU_STATE_SYSTEM, (derive_t) atoll(fields[3]), now);
-		cpu_stage (cpu, COLLECTD_CPU_STATE_IDLE,   (derive_t) atoll(fields[4]), now);
+		cpu_stage (cpu, COLLECTD_CPU_STATE_USER,   (derive_t) procfile_u64 (fields[1], NULL), now);
+		cpu_stage (cpu, COLLECTD_CPU_STATE_NICE,   (derive_t) procfile_u64 (fields[2], NULL), now);
+		cpu_stage (cpu, COLLECTD_CPU_STATE_SYSTEM, (derive_t) procfile_u64 (fields[3], NULL), now);
+		cpu_stage (cpu, COLLECTD_CPU_STATE_IDLE,   (derive_t) procfile_u64 (fields[4], NULL), now);
 
 		if (numfields >= 8)
 		{
-			cpu_stage (cpu, COLLECTD_CPU_STATE_WAIT,      (derive_t) atoll(fields[5]), now);
-			cpu_stage (cpu, COLLECTD_CPU_STATE_INTERRUPT, (derive_t) atoll(fields[6]), now);
-			cpu_stage (cpu, COLLECTD_CPU_STATE_SOFTIRQ,   (derive_t) atoll(fields[7]), now);
+			cpu_stage (cpu, COLLECTD_CPU_STATE_WAIT,      (derive_t) procfile_u64 (fields[5], NULL), now);
+			cpu_stage (cpu, COLLECTD_CPU_STATE_INTERRUPT, (derive_t) procfile_u64 (fields[6], NULL), now);
+			cpu_stage (cpu, COLLECTD_CPU_STATE_SOFTIRQ,   (derive_t) procfile_u64 (fields[7], NULL), now);
 
 			if (numfields >= 9)
-				cpu_stage (cpu, COLLECTD_CPU_STATE_STEAL, (derive_t) atoll(fields[8]), now);
+				cpu_stage (cpu, COLLECTD_CPU_STATE_STEAL, (derive_t) procfile_u64 (fields[8], NULL), now);
 		}
 	}
-	fclose (fh);
 /* }}} #endif defined(KERNEL_LINUX) */
 
 #elif defined(HAVE_LIBKSTAT) /* {{{ */
@@ -25,6 +25,47 @@
 #include "plugin.h"
 #include "common.h"
 #include "utils_cache.h"
+#include "utils_avltree.h"
+
+#include <pthread.h>
+
+/*
+ * Private data types
+ */
+/* A cached CSV file. Lines are collected in "buffer" and appended to the
+ * file in one write(2) when the buffer is full, on flush and on shutdown.
+ * The file is opened on the first write and reopened if it was moved away
+ * or deleted in the meantime. */
+struct csv_file_s;
+typedef struct csv_file_s csv_file_t;
+struct csv_file_s
+{
+	char    *filename;
+	char    *header;
+
+	/* Protects the descriptor and the buffer. */
+	pthread_mutex_t lock;
+	int      fd;
+	dev_t    dev;
+	ino_t    ino;
+	char    *buffer;
+	size_t   buffer_fill;
+	cdtime_t first_buffered;
+
+	/* The remaining members are protected by file_cache_lock. */
+	cdtime_t last_write;
+	cdtime_t interval;
+
+	/* Number of threads using the file without holding file_cache_lock.
+	 * A file removed from the cache is closed by the last of them. */
+	int      refs;
+	_Bool    removed;
+
+	/* LRU list; the head is the most recently used file. Files removed
+	 * from the cache are chained by "next" until they are closed. */
+	csv_file_t *prev;
+	csv_file_t *next;
+};
 
 /*
  * Private variables
@@ -32,7 +73,10 @@
 static const char *config_keys[] =
 {
 	"DataDir",
-	"StoreRates"
+	"StoreRates",
+	"FileCacheSize",
+	"WriteBufferSize",
+	"BufferTimeout"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -40,6 +84,22 @@ static char *datadir   = NULL;
 static int store_rates = 0;
 static int use_stdio   = 0;
 
+static size_t   file_cache_size   = 512;
+static size_t   write_buffer_size = 16384;
+static cdtime_t buffer_timeout    = 0;
+
+/* Open files, keyed by file name. */
+static c_avl_tree_t *file_cache = NULL;
+static csv_file_t   *file_lru_head = NULL;
+static csv_file_t   *file_lru_tail = NULL;
+static size_t        file_cache_num = 0;
+static pthread_mutex_t file_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The date suffix of file names only changes at midnight. */
+static char   date_suffix[16] = "";
+static time_t date_suffix_valid_until = 0;
+static pthread_mutex_t date_suffix_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static int value_list_to_string (char *buffer, int buffer_len,
 		const data_set_t *ds, const value_list_t *vl)
 {
@@ -162,29 +222,48 @@ static int value_list_to_filename (char *buffer, size_t buffer_size,
 		return (ENOMEM);
 	}
 
-	/* TODO: Find a way to minimize the calls to `localtime_r',
-	 * since they are pretty expensive.. */
+	/* `localtime_r' is pretty expensive, so the suffix is only
+	 * recomputed once the day changes. */
 	now = time (NULL);
-	if (localtime_r (&now, &struct_tm) == NULL)
+	pthread_mutex_lock (&date_suffix_lock);
+	if (now >= date_suffix_valid_until)
 	{
-		ERROR ("csv plugin: localtime_r failed");
-		return (-1);
-	}
+		if (localtime_r (&now, &struct_tm) == NULL)
+		{
+			pthread_mutex_unlock (&date_suffix_lock);
+			ERROR ("csv plugin: localtime_r failed");
+			return (-1);
+		}
 
-	status = strftime (ptr, ptr_size, "-%Y-%m-%d", &struct_tm);
-	if (status == 0) /* yep, it returns zero on error. */
-	{
-		ERROR ("csv plugin: strftime failed");
-		return (-1);
+		status = strftime (date_suffix, sizeof (date_suffix),
+				"-%Y-%m-%d", &struct_tm);
+		if (status == 0) /* yep, it returns zero on error. */
+		{
+			pthread_mutex_unlock (&date_suffix_lock);
+			ERROR ("csv plugin: strftime failed");
+			return (-1);
+		}
+
+		/* Next midnight; mktime normalizes the out-of-range fields
+		 * and takes care of DST changes. */
+		struct_tm.tm_mday++;
+		struct_tm.tm_hour = 0;
+		struct_tm.tm_min = 0;
+		struct_tm.tm_sec = 0;
+		struct_tm.tm_isdst = -1;
+		date_suffix_valid_until = mktime (&struct_tm);
+		if (date_suffix_valid_until == ((time_t) -1))
+			date_suffix_valid_until = 0;
 	}
+	sstrncpy (ptr, date_suffix, ptr_size);
+	pthread_mutex_unlock (&date_suffix_lock);
 
 	return (0);
 } /* int value_list_to_filename */
 
-static int csv_create_file (const char *filename, const data_set_t *ds)
+static int csv_create_file (const char *filename, const char *header)
 {
 	FILE *csv;
-	size_t i;
 
 	if (check_create_dir (filename))
 		return (-1);
@@ -199,16 +278,35 @@ static int csv_create_file (const char *filename, const data_set_t *ds)
 		return (-1);
 	}
 
-	fprintf (csv, "epoch");
-	for (i = 0; i < ds->ds_num; i++)
-		fprintf (csv, ",%s", ds->ds[i].name);
-
-	fprintf (csv, "\n");
+	fputs (header, csv);
 	fclose (csv);
 
 	return 0;
 } /* int csv_create_file */
 
+/* Returns the first line of a new file, "epoch" and the data source names. */
+static char *csv_header (const data_set_t *ds)
+{
+	char buffer[4096];
+	size_t offset;
+	size_t i;
+
+	sstrncpy (buffer, "epoch", sizeof (buffer));
+	offset = strlen (buffer);
+	for (i = 0; (i < ds->ds_num) && (offset < sizeof (buffer) - 1); i++)
+	{
+		ssnprintf (buffer + offset, sizeof (buffer) - offset, ",%s",
+				ds->ds[i].name);
+		offset += strlen (buffer + offset);
+	}
+	if (offset >= sizeof (buffer) - 1)
+		offset = sizeof (buffer) - 2;
+	buffer[offset] = '\n';
+	buffer[offset + 1] = 0;
+
+	return (strdup (buffer));
+} /* char *csv_header */
+
 static int csv_config (const char *key, const char *value)
 {
 	if (strcasecmp ("DataDir", key) == 0)
@@ -251,6 +349,37 @@ static int csv_config (const char *key, const char *value)
 		else
 			store_rates = 0;
 	}
+	else if ((strcasecmp ("FileCacheSize", key) == 0)
+			|| (strcasecmp ("WriteBufferSize", key) == 0))
+	{
+		char *endptr = NULL;
+		long tmp;
+
+		errno = 0;
+		tmp = strtol (value, &endptr, /* base = */ 0);
+		if ((errno != 0) || (endptr == value) || (tmp < 0))
+		{
+			ERROR ("csv plugin: Invalid value for %s: \"%s\"",
+					key, value);
+			return (-1);
+		}
+
+		if (strcasecmp ("FileCacheSize", key) == 0)
+			file_cache_size = (size_t) tmp;
+		else
+			write_buffer_size = (size_t) tmp;
+	}
+	else if (strcasecmp ("BufferTimeout", key) == 0)
+	{
+		double tmp = atof (value);
+		if (tmp <= 0.0)
+		{
+			ERROR ("csv plugin: Invalid value for BufferTimeout: "
+					"\"%s\"", value);
+			return (-1);
+		}
+		buffer_timeout = DOUBLE_TO_CDTIME_T (tmp);
+	}
 	else
 	{
 		return (-1);
@@ -258,15 +387,309 @@ static int csv_config (const char *key, const char *value)
 	return (0);
 } /* int csv_config */
 
+/* Opens the file, creating it with a header line if it does not exist.
+ * Must be called with the file's lock held. */
+static int csv_file_open (csv_file_t *f)
+{
+	struct stat statbuf;
+
+	if (stat (f->filename, &statbuf) == -1)
+	{
+		if (errno == ENOENT)
+		{
+			if (csv_create_file (f->filename, f->header))
+				return (-1);
+		}
+		else
+		{
+			char errbuf[1024];
+			ERROR ("stat(%s) failed: %s", f->filename,
+					sstrerror (errno, errbuf,
+						sizeof (errbuf)));
+			return (-1);
+		}
+	}
+	else if (!S_ISREG (statbuf.st_mode))
+	{
+		ERROR ("stat(%s): Not a regular file!",
+				f->filename);
+		return (-1);
+	}
+
+	f->fd = open (f->filename, O_WRONLY | O_APPEND);
+	if (f->fd < 0)
+	{
+		char errbuf[1024];
+		ERROR ("csv plugin: open (%s) failed: %s", f->filename,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	if (fstat (f->fd, &statbuf) == 0)
+	{
+		f->dev = statbuf.st_dev;
+		f->ino = statbuf.st_ino;
+	}
+
+	return (0);
+} /* int csv_file_open */
+
+/* Appends the buffered lines to the file. The buffer is emptied even if
+ * writing fails, i.e. the lines are lost in that case. Must be called with
+ * the file's lock held. */
+static int csv_file_flush (csv_file_t *f)
+{
+	struct flock fl;
+	struct stat statbuf;
+	size_t offset;
+	int status;
+
+	if (f->buffer_fill == 0)
+		return (0);
+
+	/* A file that was moved away or deleted, e.g. by a log rotation
+	 * script, is reopened under its name. */
+	if ((f->fd >= 0)
+			&& ((stat (f->filename, &statbuf) != 0)
+				|| (statbuf.st_dev != f->dev)
+				|| (statbuf.st_ino != f->ino)))
+	{
+		close (f->fd);
+		f->fd = -1;
+	}
+
+	if ((f->fd < 0) && (csv_file_open (f) != 0))
+	{
+		f->buffer_fill = 0;
+		return (-1);
+	}
+
+	memset (&fl, '\0', sizeof (fl));
+	fl.l_start  = 0;
+	fl.l_len    = 0; /* till end of file */
+	fl.l_pid    = getpid ();
+	fl.l_type   = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+
+	status = fcntl (f->fd, F_SETLK, &fl);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("csv plugin: flock (%s) failed: %s", f->filename,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		f->buffer_fill = 0;
+		return (-1);
+	}
+
+	offset = 0;
+	while (offset < f->buffer_fill)
+	{
+		ssize_t len = write (f->fd, f->buffer + offset,
+				f->buffer_fill - offset);
+		if ((len < 0) && (errno == EINTR))
+			continue;
+		if (len < 0)
+		{
+			char errbuf[1024];
+			ERROR ("csv plugin: write (%s) failed: %s", f->filename,
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
+		offset += (size_t) len;
+	}
+
+	fl.l_type = F_UNLCK;
+	fcntl (f->fd, F_SETLK, &fl);
+
+	status = (offset < f->buffer_fill) ? -1 : 0;
+	f->buffer_fill = 0;
+	return (status);
+} /* int csv_file_flush */
+
+static void csv_lru_unlink (csv_file_t *f)
+{
+	if (f->prev != NULL)
+		f->prev->next = f->next;
+	else
+		file_lru_head = f->next;
+
+	if (f->next != NULL)
+		f->next->prev = f->prev;
+	else
+		file_lru_tail = f->prev;
+
+	f->prev = NULL;
+	f->next = NULL;
+} /* void csv_lru_unlink */
+
+static void csv_lru_push (csv_file_t *f)
+{
+	f->prev = NULL;
+	f->next = file_lru_head;
+	if (file_lru_head != NULL)
+		file_lru_head->prev = f;
+	file_lru_head = f;
+	if (file_lru_tail == NULL)
+		file_lru_tail = f;
+} /* void csv_lru_push */
+
+/* Flushes and closes a file which is no longer reachable from the cache.
+ * Must be called without any lock held. */
+static void csv_file_destroy (csv_file_t *f)
+{
+	csv_file_flush (f);
+
+	if (f->fd >= 0)
+		close (f->fd);
+	pthread_mutex_destroy (&f->lock);
+	sfree (f->buffer);
+	sfree (f->header);
+	sfree (f->filename);
+	sfree (f);
+} /* void csv_file_destroy */
+
+/* Closes all files chained by "next". */
+static void csv_file_destroy_list (csv_file_t *f)
+{
+	while (f != NULL)
+	{
+		csv_file_t *next = f->next;
+		csv_file_destroy (f);
+		f = next;
+	}
+} /* void csv_file_destroy_list */
+
+/* Removes the file from the cache. If no thread uses it, it is added to
+ * "closed" to be destroyed once file_cache_lock is released; otherwise the
+ * last thread using it destroys it. Must be called with file_cache_lock
+ * held. */
+static void csv_file_remove (csv_file_t *f, csv_file_t **closed)
+{
+	c_avl_remove (file_cache, f->filename, NULL, NULL);
+	csv_lru_unlink (f);
+	file_cache_num--;
+	f->removed = 1;
+
+	if (f->refs == 0)
+	{
+		f->next = *closed;
+		*closed = f;
+	}
+} /* void csv_file_remove */
+
+/* Drops a reference taken by csv_file_get. Returns true if the caller has
+ * to destroy the file. Must be called with file_cache_lock held. */
+static _Bool csv_file_release (csv_file_t *f)
+{
+	f->refs--;
+	return (f->removed && (f->refs == 0));
+} /* _Bool csv_file_release */
+
+/* Returns the cached file or adds it to the cache, and takes a reference.
+ * Least recently used files are removed from the cache and added to
+ * "closed". Must be called with file_cache_lock held. */
+static csv_file_t *csv_file_get (const char *filename, const data_set_t *ds,
+		csv_file_t **closed)
+{
+	csv_file_t *f = NULL;
+
+	/* The write threads are stopped after the shutdown callbacks. */
+	if (file_cache == NULL)
+		return (NULL);
+
+	if (c_avl_get (file_cache, filename, (void *) &f) == 0)
+	{
+		if (f != file_lru_head)
+		{
+			csv_lru_unlink (f);
+			csv_lru_push (f);
+		}
+		f->refs++;
+		return (f);
+	}
+
+	f = calloc (1, sizeof (*f));
+	if (f == NULL)
+	{
+		ERROR ("csv plugin: calloc failed.");
+		return (NULL);
+	}
+
+	f->fd = -1;
+	f->filename = strdup (filename);
+	f->header = csv_header (ds);
+	if (write_buffer_size > 0)
+		f->buffer = malloc (write_buffer_size);
+	if ((f->filename == NULL) || (f->header == NULL)
+			|| ((write_buffer_size > 0) && (f->buffer == NULL)))
+	{
+		ERROR ("csv plugin: malloc failed.");
+		sfree (f->buffer);
+		sfree (f->header);
+		sfree (f->filename);
+		sfree (f);
+		return (NULL);
+	}
+	pthread_mutex_init (&f->lock, /* attr = */ NULL);
+
+	if (c_avl_insert (file_cache, f->filename, f) != 0)
+	{
+		ERROR ("csv plugin: c_avl_insert (%s) failed.", filename);
+		pthread_mutex_destroy (&f->lock);
+		sfree (f->buffer);
+		sfree (f->header);
+		sfree (f->filename);
+		sfree (f);
+		return (NULL);
+	}
+	csv_lru_push (f);
+	file_cache_num++;
+	f->refs++;
+
+	/* Evict the least recently used files, but never the new one. */
+	while ((file_cache_num > file_cache_size)
+			&& (file_lru_tail != f))
+		csv_file_remove (file_lru_tail, closed);
+
+	return (f);
+} /* csv_file_t *csv_file_get */
+
+static int csv_file_append (csv_file_t *f, const char *line, size_t line_len)
+{
+	int status = 0;
+
+	if (f->buffer_fill + line_len > write_buffer_size)
+		status = csv_file_flush (f);
+
+	if (line_len > write_buffer_size)
+	{
+		/* Too large to be buffered: write it like a full buffer. */
+		char *buffer = f->buffer;
+
+		f->buffer = (char *) line;
+		f->buffer_fill = line_len;
+		status = csv_file_flush (f);
+		f->buffer = buffer;
+		return (status);
+	}
+
+	if (f->buffer_fill == 0)
+		f->first_buffered = cdtime ();
+	memcpy (f->buffer + f->buffer_fill, line, line_len);
+	f->buffer_fill += line_len;
+
+	return (status);
+} /* int csv_file_append */
+
 static int csv_write (const data_set_t *ds, const value_list_t *vl,
 		user_data_t __attribute__((unused)) *user_data)
 {
-	struct stat  statbuf;
 	char         filename[512];
 	char         values[4096];
-	FILE        *csv;
-	int          csv_fd;
-	struct flock fl;
+	size_t       values_len;
+	csv_file_t  *f;
+	csv_file_t  *closed = NULL;
+	_Bool        destroy;
 	int          status;
 
 	if (0 != strcmp (ds->type, vl->type)) {
@@ -306,68 +729,193 @@ static int csv_write (const data_set_t *ds, const value_list_t *vl,
 		return (0);
 	}
 
-	if (stat (filename, &statbuf) == -1)
+	values_len = strlen (values);
+	if (values_len >= sizeof (values) - 1)
+		return (-1);
+	values[values_len] = '\n';
+	values_len++;
+
+	/* The cache lock only covers the lookup; the file is written to with
+	 * its own lock held, so writes to different files do not wait for
+	 * each other. */
+	pthread_mutex_lock (&file_cache_lock);
+	f = csv_file_get (filename, ds, &closed);
+	pthread_mutex_unlock (&file_cache_lock);
+	csv_file_destroy_list (closed);
+	if (f == NULL)
+		return (-1);
+
+	pthread_mutex_lock (&f->lock);
+	status = csv_file_append (f, values, values_len);
+	pthread_mutex_unlock (&f->lock);
+
+	pthread_mutex_lock (&file_cache_lock);
+	f->last_write = cdtime ();
+	f->interval = vl->interval;
+
+	/* Without a cache, every line is written and the file closed right
+	 * away. */
+	if ((file_cache_size == 0) && !f->removed)
+		csv_file_remove (f, &closed);
+	destroy = csv_file_release (f);
+	pthread_mutex_unlock (&file_cache_lock);
+
+	if (destroy)
+		csv_file_destroy (f);
+
+	return (status);
+} /* int csv_write */
+
+/* Writes the buffered lines of the files starting with "prefix" which were
+ * buffered for at least "timeout". If "close_idle" is true, files that have
+ * not been written to for two of their intervals are closed. */
+static void csv_flush_files (const char *prefix, cdtime_t timeout,
+		_Bool close_idle)
+{
+	size_t prefix_len = strlen (prefix);
+	cdtime_t now = cdtime ();
+	csv_file_t **files;
+	csv_file_t *closed = NULL;
+	csv_file_t *f;
+	csv_file_t *next;
+	size_t files_num = 0;
+	size_t i;
+
+	pthread_mutex_lock (&file_cache_lock);
+	files = calloc (file_cache_num + 1, sizeof (*files));
+	if (files == NULL)
 	{
-		if (errno == ENOENT)
-		{
-			if (csv_create_file (filename, ds))
-				return (-1);
-		}
-		else
+		pthread_mutex_unlock (&file_cache_lock);
+		ERROR ("csv plugin: calloc failed.");
+		return;
+	}
+
+	for (f = file_lru_head; f != NULL; f = next)
+	{
+		cdtime_t idle = (f->interval > buffer_timeout)
+			? f->interval : buffer_timeout;
+
+		next = f->next;
+		if ((prefix_len > 0)
+				&& (strncmp (prefix, f->filename, prefix_len) != 0))
+			continue;
+
+		if (close_idle && ((now - f->last_write) > (2 * idle)))
 		{
-			char errbuf[1024];
-			ERROR ("stat(%s) failed: %s", filename,
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
-			return (-1);
+			csv_file_remove (f, &closed);
+			continue;
 		}
+
+		f->refs++;
+		files[files_num] = f;
+		files_num++;
 	}
-	else if (!S_ISREG (statbuf.st_mode))
+	pthread_mutex_unlock (&file_cache_lock);
+
+	csv_file_destroy_list (closed);
+
+	/* Write the files without holding the cache lock. */
+	for (i = 0; i < files_num; i++)
 	{
-		ERROR ("stat(%s): Not a regular file!",
-				filename);
-		return (-1);
+		f = files[i];
+		pthread_mutex_lock (&f->lock);
+		if ((f->buffer_fill > 0)
+				&& ((now - f->first_buffered) >= timeout))
+			csv_file_flush (f);
+		pthread_mutex_unlock (&f->lock);
 	}
 
-	csv = fopen (filename, "a");
-	if (csv == NULL)
+	pthread_mutex_lock (&file_cache_lock);
+	for (i = 0; i < files_num; i++)
+		if (!csv_file_release (files[i]))
+			files[i] = NULL;
+	pthread_mutex_unlock (&file_cache_lock);
+
+	for (i = 0; i < files_num; i++)
+		if (files[i] != NULL)
+			csv_file_destroy (files[i]);
+
+	sfree (files);
+} /* void csv_flush_files */
+
+static int csv_flush (cdtime_t timeout,
+		const char *identifier,
+		user_data_t __attribute__((unused)) *user_data)
+{
+	char prefix[512] = "";
+
+	if (identifier != NULL)
 	{
-		char errbuf[1024];
-		ERROR ("csv plugin: fopen (%s) failed: %s", filename,
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		return (-1);
+		if (datadir != NULL)
+			ssnprintf (prefix, sizeof (prefix), "%s/%s",
+					datadir, identifier);
+		else
+			sstrncpy (prefix, identifier, sizeof (prefix));
 	}
-	csv_fd = fileno (csv);
 
-	memset (&fl, '\0', sizeof (fl));
-	fl.l_start  = 0;
-	fl.l_len    = 0; /* till end of file */
-	fl.l_pid    = getpid ();
-	fl.l_type   = F_WRLCK;
-	fl.l_whence = SEEK_SET;
+	csv_flush_files (prefix, timeout, /* close_idle = */ 0);
 
-	status = fcntl (csv_fd, F_SETLK, &fl);
-	if (status != 0)
+	return (0);
+} /* int csv_flush */
+
+/* Runs every BufferTimeout: writes all buffered lines and closes files that
+ * have not been written to for two of their intervals, e.g. the files of the
+ * previous day. */
+static int csv_flush_read (user_data_t __attribute__((unused)) *user_data)
+{
+	csv_flush_files ("", /* timeout = */ 0, /* close_idle = */ 1);
+
+	return (0);
+} /* int csv_flush_read */
+
+static int csv_init (void)
+{
+	if (use_stdio)
+		return (0);
+
+	if (buffer_timeout == 0)
+		buffer_timeout = plugin_get_interval ();
+
+	pthread_mutex_lock (&file_cache_lock);
+	if (file_cache == NULL)
+		file_cache = c_avl_create ((int (*) (const void *,
+						const void *)) strcmp);
+	pthread_mutex_unlock (&file_cache_lock);
+	if (file_cache == NULL)
 	{
-		char errbuf[1024];
-		ERROR ("csv plugin: flock (%s) failed: %s", filename,
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (csv);
+		ERROR ("csv plugin: c_avl_create failed.");
 		return (-1);
 	}
 
-	fprintf (csv, "%s\n", values);
+	plugin_register_complex_read (/* group = */ NULL, "csv",
+			csv_flush_read, buffer_timeout, /* user_data = */ NULL);
+	plugin_register_flush ("csv", csv_flush, /* user_data = */ NULL);
 
-	/* The lock is implicitely released. I we don't release it explicitely
-	 * because the `FILE *' may need to flush a cache first */
-	fclose (csv);
+	return (0);
+} /* int csv_init */
+
+static int csv_shutdown (void)
+{
+	csv_file_t *closed = NULL;
+
+	pthread_mutex_lock (&file_cache_lock);
+	while (file_lru_head != NULL)
+		csv_file_remove (file_lru_head, &closed);
+	if (file_cache != NULL)
+		c_avl_destroy (file_cache);
+	file_cache = NULL;
+	pthread_mutex_unlock (&file_cache_lock);
+
+	csv_file_destroy_list (closed);
 
 	return (0);
-} /* int csv_write */
+} /* int csv_shutdown */
 
 void module_register (void)
 {
 	plugin_register_config ("csv", csv_config,
 			config_keys, config_keys_num);
+	plugin_register_init ("csv", csv_init);
 	plugin_register_write ("csv", csv_write, /* user_data = */ NULL);
+	plugin_register_shutdown ("csv", csv_shutdown);
 } /* void module_register */
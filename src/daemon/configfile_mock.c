@@ -0,0 +1,144 @@
+/**
+ * collectd - src/daemon/configfile_mock.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/* The config helpers used by plugins, for tests which configure a plugin
+ * without the config file parser. */
+
+#include "collectd.h"
+#include "common.h"
+#include "configfile.h"
+
+static int cf_util_check (const oconfig_item_t *ci, int type)
+{
+  if ((ci == NULL) || (ci->values_num != 1) || (ci->values[0].type != type))
+    return (-1);
+  return (0);
+}
+
+int cf_util_get_string (const oconfig_item_t *ci, char **ret_string)
+{
+  char *string;
+
+  if (cf_util_check (ci, OCONFIG_TYPE_STRING) != 0)
+    return (-1);
+
+  string = strdup (ci->values[0].value.string);
+  if (string == NULL)
+    return (-1);
+
+  sfree (*ret_string);
+  *ret_string = string;
+  return (0);
+}
+
+int cf_util_get_string_buffer (const oconfig_item_t *ci, char *buffer,
+    size_t buffer_size)
+{
+  if (cf_util_check (ci, OCONFIG_TYPE_STRING) != 0)
+    return (-1);
+
+  sstrncpy (buffer, ci->values[0].value.string, buffer_size);
+  return (0);
+}
+
+int cf_util_get_int (const oconfig_item_t *ci, int *ret_value)
+{
+  if (cf_util_check (ci, OCONFIG_TYPE_NUMBER) != 0)
+    return (-1);
+
+  *ret_value = (int) ci->values[0].value.number;
+  return (0);
+}
+
+int cf_util_get_double (const oconfig_item_t *ci, double *ret_value)
+{
+  if (cf_util_check (ci, OCONFIG_TYPE_NUMBER) != 0)
+    return (-1);
+
+  *ret_value = ci->values[0].value.number;
+  return (0);
+}
+
+int cf_util_get_boolean (const oconfig_item_t *ci, _Bool *ret_bool)
+{
+  if (cf_util_check (ci, OCONFIG_TYPE_BOOLEAN) != 0)
+    return (-1);
+
+  *ret_bool = ci->values[0].value.boolean ? 1 : 0;
+  return (0);
+}
+
+int cf_util_get_flag (const oconfig_item_t *ci,
+    unsigned int *ret_value, unsigned int flag)
+{
+  _Bool b = 0;
+
+  if (cf_util_get_boolean (ci, &b) != 0)
+    return (-1);
+
+  if (b)
+    *ret_value |= flag;
+  else
+    *ret_value &= ~flag;
+  return (0);
+}
+
+int cf_util_get_port_number (const oconfig_item_t *ci)
+{
+  if (cf_util_check (ci, OCONFIG_TYPE_NUMBER) == 0)
+    return ((int) ci->values[0].value.number);
+  if (cf_util_check (ci, OCONFIG_TYPE_STRING) == 0)
+    return (service_name_to_port_number (ci->values[0].value.string));
+  return (-1);
+}
+
+int cf_util_get_service (const oconfig_item_t *ci, char **ret_string)
+{
+  char buffer[16];
+  char *service;
+
+  if (cf_util_check (ci, OCONFIG_TYPE_STRING) == 0)
+    return (cf_util_get_string (ci, ret_string));
+  if (cf_util_check (ci, OCONFIG_TYPE_NUMBER) != 0)
+    return (-1);
+
+  ssnprintf (buffer, sizeof (buffer), "%i", (int) ci->values[0].value.number);
+  service = strdup (buffer);
+  if (service == NULL)
+    return (-1);
+
+  sfree (*ret_string);
+  *ret_string = service;
+  return (0);
+}
+
+int cf_util_get_cdtime (const oconfig_item_t *ci, cdtime_t *ret_value)
+{
+  if (cf_util_check (ci, OCONFIG_TYPE_NUMBER) != 0)
+    return (-1);
+
+  *ret_value = DOUBLE_TO_CDTIME_T (ci->values[0].value.number);
+  return (0);
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -2255,22 +2255,14 @@ static double get_drop_probability (void) /* {{{ */
 	return (((double) pos) / ((double) size));
 } /* }}} double get_drop_probability */
 
-static _Bool check_drop_value (void) /* {{{ */
+/* Logs at most once per second that values are being dropped. */
+static void log_drop_probability (double p) /* {{{ */
 {
 	static cdtime_t last_message_time = 0;
 	static pthread_mutex_t last_message_lock = PTHREAD_MUTEX_INITIALIZER;
 
-	double p;
-	double q;
 	int status;
 
-	if (write_limit_high == 0)
-		return (0);
-
-	p = get_drop_probability ();
-	if (p == 0.0)
-		return (0);
-
 	status = pthread_mutex_trylock (&last_message_lock);
 	if (status == 0)
 	{
@@ -2286,7 +2278,15 @@ static _Bool check_drop_value (void) /* {{{ */
 		}
 		pthread_mutex_unlock (&last_message_lock);
 	}
+} /* }}} void log_drop_probability */
+
+/* Decides whether to drop one value, given the drop probability "p". */
+static _Bool drop_value (double p) /* {{{ */
+{
+	double q;
 
+	if (p == 0.0)
+		return (0);
 	if (p == 1.0)
 		return (1);
 
@@ -2295,12 +2295,28 @@ static _Bool check_drop_value (void) /* {{{ */
 		return (1);
 	else
 		return (0);
+} /* }}} _Bool drop_value */
+
+static _Bool check_drop_value (void) /* {{{ */
+{
+	double p;
+
+	if (write_limit_high == 0)
+		return (0);
+
+	p = get_drop_probability ();
+	if (p == 0.0)
+		return (0);
+
+	log_drop_probability (p);
+	return (drop_value (p));
 } /* }}} _Bool check_drop_value */
 
+static pthread_mutex_t statistics_lock = PTHREAD_MUTEX_INITIALIZER;
+
 int plugin_dispatch_values (value_list_t const *vl)
 {
 	int status;
-	static pthread_mutex_t statistics_lock = PTHREAD_MUTEX_INITIALIZER;
 
 	if (check_drop_value ()) {
 		if(record_statistics) {
@@ -2324,6 +2340,97 @@ int plugin_dispatch_values (value_list_t const *vl)
 	return (0);
 }
 
+int plugin_dispatch_values_batch (value_list_t const *vl, /* {{{ */
+		size_t vl_num)
+{
+	write_queue_t *head = NULL;
+	write_queue_t *tail = NULL;
+	plugin_ctx_t ctx;
+	size_t enqueued = 0;
+	size_t dropped = 0;
+	double drop_p = 0.0;
+	size_t i;
+
+	if ((vl == NULL) || (vl_num == 0))
+		return (0);
+
+	ctx = plugin_get_ctx ();
+
+	/* The queue length is looked up once for the entire batch, so the
+	 * values of a batch are dropped with the same probability. */
+	if (write_limit_high != 0)
+		drop_p = get_drop_probability ();
+	if (drop_p > 0.0)
+		log_drop_probability (drop_p);
+
+	/* Build the list of queue entries first so that the write lock is
+	 * taken only once more to append the entire batch. */
+	for (i = 0; i < vl_num; i++)
+	{
+		write_queue_t *q;
+
+		if (drop_value (drop_p))
+		{
+			dropped++;
+			continue;
+		}
+
+		q = malloc (sizeof (*q));
+		if (q == NULL)
+			break;
+		q->next = NULL;
+		q->ctx = ctx;
+
+		q->vl = plugin_value_list_clone (vl + i);
+		if (q->vl == NULL)
+		{
+			sfree (q);
+			break;
+		}
+
+		if (tail == NULL)
+			head = q;
+		else
+			tail->next = q;
+		tail = q;
+		enqueued++;
+	}
+
+	if ((dropped > 0) && record_statistics)
+	{
+		pthread_mutex_lock (&statistics_lock);
+		stats_values_dropped += (derive_t) dropped;
+		pthread_mutex_unlock (&statistics_lock);
+	}
+
+	if (head != NULL)
+	{
+		pthread_mutex_lock (&write_lock);
+
+		if (write_queue_tail == NULL)
+			write_queue_head = head;
+		else
+			write_queue_tail->next = head;
+		write_queue_tail = tail;
+		write_queue_length += (long) enqueued;
+
+		/* Wake up all write threads; there is more than one value list
+		 * to be handled. */
+		pthread_cond_broadcast (&write_cond);
+		pthread_mutex_unlock (&write_lock);
+	}
+
+	if ((enqueued + dropped) != vl_num)
+	{
+		ERROR ("plugin_dispatch_values_batch: Enqueueing %zu of %zu "
+				"value lists failed: Out of memory.",
+				vl_num - (enqueued + dropped), vl_num);
+		return (ENOMEM);
+	}
+
+	return (0);
+} /* }}} int plugin_dispatch_values_batch */
+
 __attribute__((sentinel))
 int plugin_dispatch_multivalue (value_list_t const *template, /* {{{ */
 		_Bool store_percentage, int store_type, ...)
@@ -352,6 +352,24 @@ void plugin_log_available_writers ();
  */
 int plugin_dispatch_values (value_list_t const *vl);
 
+/*
+ * NAME
+ *  plugin_dispatch_values_batch
+ *
+ * DESCRIPTION
+ *  Dispatches an array of value lists. This is equivalent to calling
+ *  `plugin_dispatch_values' for each element of the array, but the write
+ *  queue is only locked once for the entire batch.
+ *
+ * ARGUMENTS
+ *  `vl'        Array of value lists.
+ *  `vl_num'    Number of elements in `vl'.
+ *
+ * RETURNS
+ *  Zero on success, an errno value if not all value lists could be enqueued.
+ */
+int plugin_dispatch_values_batch (value_list_t const *vl, size_t vl_num);
+
 /*
  * NAME
  *  plugin_dispatch_multivalue
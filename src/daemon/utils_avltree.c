@@ -673,6 +673,50 @@ c_avl_iterator_t *c_avl_get_iterator (c_avl_tree_t *t)
 	return (iter);
 } /* c_avl_iterator_t *c_avl_get_iterator */
 
+c_avl_iterator_t *c_avl_get_iterator_at (c_avl_tree_t *t, const void *key)
+{
+	c_avl_iterator_t *iter;
+	c_avl_node_t *lower_bound = NULL;
+	c_avl_node_t *last = NULL;
+	c_avl_node_t *n;
+
+	if ((t == NULL) || (key == NULL))
+		return (NULL);
+
+	iter = c_avl_get_iterator (t);
+	if (iter == NULL)
+		return (NULL);
+
+	/* Find the smallest node that is not smaller than `key'. */
+	n = t->root;
+	while (n != NULL)
+	{
+		last = n;
+		if (t->compare (key, n->key) <= 0)
+		{
+			lower_bound = n;
+			n = n->left;
+		}
+		else
+			n = n->right;
+	}
+
+	/* c_avl_iterator_next() returns the successor of `iter->node', or the
+	 * first node if `iter->node' is NULL. */
+	if (lower_bound != NULL)
+		iter->node = c_avl_node_prev (lower_bound);
+	else
+	{
+		/* All nodes are smaller than `key': Position the iterator on the
+		 * last node, so that no node is returned. */
+		while ((last != NULL) && (last->right != NULL))
+			last = last->right;
+		iter->node = last;
+	}
+
+	return (iter);
+} /* c_avl_iterator_t *c_avl_get_iterator_at */
+
 int c_avl_iterator_next (c_avl_iterator_t *iter, void **key, void **value)
 {
 	c_avl_node_t *n;
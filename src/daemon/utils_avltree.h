@@ -148,6 +148,26 @@ int c_avl_get (c_avl_tree_t *t, const void *key, void **value);
 int c_avl_pick (c_avl_tree_t *t, void **key, void **value);
 
 c_avl_iterator_t *c_avl_get_iterator (c_avl_tree_t *t);
+
+/*
+ * NAME
+ *   c_avl_get_iterator_at
+ *
+ * DESCRIPTION
+ *   Returns an iterator whose first call to `c_avl_iterator_next' returns the
+ *   smallest element that is greater than or equal to `key'. Together with
+ *   an ordering that sorts common prefixes together, this allows to visit
+ *   all keys with a given prefix without iterating over the entire tree.
+ *
+ * PARAMETERS
+ *   `t'	AVL-tree to iterate over.
+ *   `key'      Key to start at. Doesn't need to exist in the tree.
+ *
+ * RETURN VALUE
+ *   An iterator that has to be freed with `c_avl_iterator_destroy' or NULL
+ *   on error.
+ */
+c_avl_iterator_t *c_avl_get_iterator_at (c_avl_tree_t *t, const void *key);
 int c_avl_iterator_next (c_avl_iterator_t *iter, void **key, void **value);
 int c_avl_iterator_prev (c_avl_iterator_t *iter, void **key, void **value);
 void c_avl_iterator_destroy (c_avl_iterator_t *iter);
@@ -72,9 +72,65 @@ DEF_TEST(success)
   return (0);
 }
 
+DEF_TEST(iterator_at)
+{
+  c_avl_tree_t *t;
+  c_avl_iterator_t *iter;
+  char *keys[] = { "b", "d", "f", "h", "j" };
+  char *key_ret = NULL;
+  char *value_ret = NULL;
+  size_t i;
+
+  t = c_avl_create (compare_callback);
+  OK (t != NULL);
+
+  for (i = 0; i < sizeof (keys) / sizeof (keys[0]); i++)
+    OK (c_avl_insert (t, keys[i], keys[i]) == 0);
+
+  /* Existing key. */
+  iter = c_avl_get_iterator_at (t, "d");
+  OK (iter != NULL);
+  OK (c_avl_iterator_next (iter, (void *) &key_ret, (void *) &value_ret) == 0);
+  STREQ ("d", key_ret);
+  OK (c_avl_iterator_next (iter, (void *) &key_ret, (void *) &value_ret) == 0);
+  STREQ ("f", key_ret);
+  c_avl_iterator_destroy (iter);
+
+  /* Key between two existing keys. */
+  iter = c_avl_get_iterator_at (t, "e");
+  OK (c_avl_iterator_next (iter, (void *) &key_ret, (void *) &value_ret) == 0);
+  STREQ ("f", key_ret);
+  c_avl_iterator_destroy (iter);
+
+  /* Key before the first key. */
+  iter = c_avl_get_iterator_at (t, "a");
+  OK (c_avl_iterator_next (iter, (void *) &key_ret, (void *) &value_ret) == 0);
+  STREQ ("b", key_ret);
+  c_avl_iterator_destroy (iter);
+
+  /* Key after the last key. */
+  iter = c_avl_get_iterator_at (t, "k");
+  OK (c_avl_iterator_next (iter, (void *) &key_ret, (void *) &value_ret) != 0);
+  c_avl_iterator_destroy (iter);
+
+  /* The last key. */
+  iter = c_avl_get_iterator_at (t, "j");
+  OK (c_avl_iterator_next (iter, (void *) &key_ret, (void *) &value_ret) == 0);
+  STREQ ("j", key_ret);
+  OK (c_avl_iterator_next (iter, (void *) &key_ret, (void *) &value_ret) != 0);
+  c_avl_iterator_destroy (iter);
+
+  while (c_avl_pick (t, (void *) &key_ret, (void *) &value_ret) == 0)
+    /* do nothing */;
+  c_avl_destroy (t);
+
+  return (0);
+}
+
 int main (void)
 {
   RUN_TEST(success);
+  RUN_TEST(iterator_at);
 
   END_TEST;
 }
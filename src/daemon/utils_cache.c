@@ -34,6 +34,10 @@
 #include <assert.h>
 #include <pthread.h>
 
+#if HAVE_FNMATCH_H
+# include <fnmatch.h>
+#endif
+
 typedef struct cache_entry_s
 {
 	char name[6 * DATA_MAX_NAME_LEN];
@@ -674,6 +678,88 @@ int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number)
   return (0);
 } /* int uc_get_names */
 
+/* Copies the part of `pattern' before the first wildcard character to
+ * `prefix'. */
+static void uc_pattern_prefix (char *prefix, size_t prefix_size, /* {{{ */
+    const char *pattern)
+{
+  size_t len;
+
+  len = strcspn (pattern, "*?[\\");
+  if (len >= prefix_size)
+    len = prefix_size - 1;
+
+  memcpy (prefix, pattern, len);
+  prefix[len] = 0;
+} /* }}} void uc_pattern_prefix */
+
+static _Bool uc_pattern_match (const char *pattern, /* {{{ */
+    const char *name)
+{
+  if (pattern == NULL)
+    return (1);
+
+#if HAVE_FNMATCH_H
+  return (fnmatch (pattern, name, /* flags = */ 0) == 0);
+#else
+  /* Without fnmatch(3), patterns are reduced to their prefix, which has been
+   * checked by the caller already. */
+  return (1);
+#endif
+} /* }}} _Bool uc_pattern_match */
+
+int uc_iterate (const char *pattern, /* {{{ */
+    uc_iterate_callback_t callback, void *user_data)
+{
+  c_avl_iterator_t *iter;
+  char prefix[6 * DATA_MAX_NAME_LEN] = "";
+  size_t prefix_len;
+  char *key;
+  cache_entry_t *value;
+  int status = 0;
+
+  if (callback == NULL)
+    return (EINVAL);
+
+  if (pattern != NULL)
+    uc_pattern_prefix (prefix, sizeof (prefix), pattern);
+  prefix_len = strlen (prefix);
+
+  pthread_mutex_lock (&cache_lock);
+
+  /* The cache is sorted by name, so all entries sharing the prefix are
+   * adjacent. Start at the first one and stop after the last one. */
+  iter = c_avl_get_iterator_at (cache_tree, prefix);
+  if (iter == NULL)
+  {
+    pthread_mutex_unlock (&cache_lock);
+    return (ENOMEM);
+  }
+
+  while (c_avl_iterator_next (iter, (void *) &key, (void *) &value) == 0)
+  {
+    if (strncmp (key, prefix, prefix_len) != 0)
+      break;
+
+    /* remove missing values when list values */
+    if (value->state == STATE_MISSING)
+      continue;
+
+    if (!uc_pattern_match (pattern, key))
+      continue;
+
+    status = (*callback) (key, value->last_time,
+        value->values_gauge, value->values_num, user_data);
+    if (status != 0)
+      break;
+  } /* while (c_avl_iterator_next) */
+
+  c_avl_iterator_destroy (iter);
+  pthread_mutex_unlock (&cache_lock);
+
+  return (status);
+} /* }}} int uc_iterate */
+
 int uc_get_state (const data_set_t *ds, const value_list_t *vl)
 {
   char name[6 * DATA_MAX_NAME_LEN];
@@ -43,6 +43,18 @@ gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl);
 size_t uc_get_size();
 int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number);
 
+/* Calls `callback' for each cache entry whose name matches the shell wildcard
+ * `pattern' (see fnmatch(3)), or for all entries if `pattern' is NULL. Only
+ * the part of the cache sharing the literal prefix of `pattern' is visited,
+ * so "host/plugin*" is cheap even with a large cache. Nothing is copied; the
+ * cache is locked during the iteration, which means that `callback' must
+ * neither block nor call other uc_* functions. The iteration stops when
+ * `callback' returns non-zero, and that value is returned. */
+typedef int (*uc_iterate_callback_t) (const char *name, cdtime_t last_time,
+    const gauge_t *rates, size_t rates_num, void *user_data);
+int uc_iterate (const char *pattern,
+    uc_iterate_callback_t callback, void *user_data);
+
 int uc_get_state (const data_set_t *ds, const value_list_t *vl);
 int uc_set_state (const data_set_t *ds, const value_list_t *vl, int state);
 int uc_get_hits (const data_set_t *ds, const value_list_t *vl);
@@ -0,0 +1,409 @@
+/**
+ * collectd - src/daemon/utils_cgroup_watch.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_cgroup_watch.h"
+#include "utils_complain.h"
+
+#include <dirent.h>
+
+#if HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+
+#define CGW_WATCH_MASK                                                         \
+  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+#endif
+
+/* A directory directly below the root, if the cgroups are two levels down. */
+typedef struct cgw_parent_s {
+  char *name;
+  int wd;
+  unsigned long generation;
+  struct cgw_parent_s *next;
+} cgw_parent_t;
+
+struct cgroup_watch_s {
+  char *plugin;
+  char *root;
+  int depth;
+
+  cgw_parent_t *parents;
+  unsigned long generation;
+  _Bool rescan;
+
+  int fd;
+  int root_wd;
+  c_complain_t complaint;
+};
+
+/* Calls "callback" with every directory in "path" but the hidden ones. The
+ * directory entry type saves a stat(2) per entry. */
+static int cgw_list_dirs(const char *path,
+                         void (*callback)(cgroup_watch_t *, const char *,
+                                          void *),
+                         cgroup_watch_t *cw, void *arg) {
+  DIR *dh;
+  struct dirent *ent;
+
+  dh = opendir(path);
+  if (dh == NULL)
+    return -1;
+
+  while ((ent = readdir(dh)) != NULL) {
+    if (ent->d_name[0] == '.')
+      continue;
+
+    if (ent->d_type == DT_UNKNOWN) {
+      char abs_path[PATH_MAX];
+      struct stat statbuf;
+
+      ssnprintf(abs_path, sizeof(abs_path), "%s/%s", path, ent->d_name);
+      if ((lstat(abs_path, &statbuf) != 0) || !S_ISDIR(statbuf.st_mode))
+        continue;
+    } else if (ent->d_type != DT_DIR)
+      continue;
+
+    callback(cw, ent->d_name, arg);
+  }
+
+  closedir(dh);
+  return 0;
+}
+
+typedef struct {
+  cgroup_watch_callback_t found;
+  cgroup_watch_callback_t lost;
+  void *user_data;
+  const char *parent;
+} cgw_report_t;
+
+static void cgw_found(cgroup_watch_t *cw, const char *name, void *arg) {
+  cgw_report_t *r = arg;
+  char path[PATH_MAX];
+
+  if (r->parent == NULL) {
+    r->found(name, r->user_data);
+    return;
+  }
+
+  ssnprintf(path, sizeof(path), "%s/%s", r->parent, name);
+  r->found(path, r->user_data);
+}
+
+static void cgw_close(cgroup_watch_t *cw) {
+  cgw_parent_t *p;
+
+  if (cw->fd >= 0)
+    close(cw->fd);
+  cw->fd = -1;
+  cw->root_wd = -1;
+
+  for (p = cw->parents; p != NULL; p = p->next)
+    p->wd = -1;
+}
+
+/* Adds the intermediate directory "name" and reports the cgroups in it. */
+static void cgw_parent_add(cgroup_watch_t *cw, const char *name, void *arg) {
+  cgw_report_t report = *(cgw_report_t *)arg;
+  char path[PATH_MAX];
+  cgw_parent_t *p;
+
+  for (p = cw->parents; p != NULL; p = p->next)
+    if (strcmp(p->name, name) == 0)
+      break;
+
+  if (p == NULL) {
+    p = calloc(1, sizeof(*p));
+    if (p == NULL)
+      return;
+    p->name = strdup(name);
+    if (p->name == NULL) {
+      free(p);
+      return;
+    }
+    p->wd = -1;
+    p->next = cw->parents;
+    cw->parents = p;
+  }
+  p->generation = cw->generation;
+
+  ssnprintf(path, sizeof(path), "%s/%s", cw->root, name);
+
+#if HAVE_SYS_INOTIFY_H
+  /* Watch the directory before listing it, so that no cgroup created in
+   * between is missed. */
+  if ((cw->fd >= 0) && (p->wd < 0)) {
+    p->wd = inotify_add_watch(cw->fd, path, CGW_WATCH_MASK);
+    if (p->wd < 0) {
+      char errbuf[1024];
+      WARNING("%s plugin: Cannot watch `%s', scanning `%s' on every "
+              "read: %s",
+              cw->plugin, path, cw->root,
+              sstrerror(errno, errbuf, sizeof(errbuf)));
+      cgw_close(cw);
+    }
+  }
+#endif
+
+  report.parent = p->name;
+  cgw_list_dirs(path, cgw_found, cw, &report);
+}
+
+static void cgw_parent_remove(cgroup_watch_t *cw, const char *name,
+                              cgw_report_t *r) {
+  cgw_parent_t *prev = NULL;
+  cgw_parent_t *p;
+
+  for (p = cw->parents; p != NULL; prev = p, p = p->next)
+    if (strcmp(p->name, name) == 0)
+      break;
+  if (p == NULL)
+    return;
+
+  if (prev == NULL)
+    cw->parents = p->next;
+  else
+    prev->next = p->next;
+
+  /* The watch is gone with the directory already. */
+  r->lost(p->name, r->user_data);
+  free(p->name);
+  free(p);
+}
+
+/* Lists all directories and drops the intermediate ones which are gone. */
+static int cgw_scan(cgroup_watch_t *cw, cgw_report_t *r) {
+  cgw_parent_t *p;
+  cgw_parent_t *next;
+
+  cw->generation++;
+
+  if (cw->depth == 1) {
+    r->parent = NULL;
+    if (cgw_list_dirs(cw->root, cgw_found, cw, r) == 0)
+      return 0;
+  } else if (cgw_list_dirs(cw->root, cgw_parent_add, cw, r) == 0) {
+    for (p = cw->parents; p != NULL; p = next) {
+      next = p->next;
+      if (p->generation != cw->generation)
+        cgw_parent_remove(cw, p->name, r);
+    }
+    return 0;
+  }
+
+  {
+    char errbuf[1024];
+    ERROR("%s plugin: Cannot open `%s': %s", cw->plugin, cw->root,
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+  }
+  return -1;
+}
+
+#if HAVE_SYS_INOTIFY_H
+static void cgw_open(cgroup_watch_t *cw) {
+  cw->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (cw->fd < 0) {
+    char errbuf[1024];
+    c_complain(LOG_WARNING, &cw->complaint,
+               "%s plugin: inotify_init1 failed: %s", cw->plugin,
+               sstrerror(errno, errbuf, sizeof(errbuf)));
+    return;
+  }
+
+  cw->root_wd = inotify_add_watch(cw->fd, cw->root, CGW_WATCH_MASK);
+  if (cw->root_wd < 0) {
+    char errbuf[1024];
+    c_complain(LOG_WARNING, &cw->complaint,
+               "%s plugin: Cannot watch `%s', scanning it on every read: %s",
+               cw->plugin, cw->root, sstrerror(errno, errbuf, sizeof(errbuf)));
+    cgw_close(cw);
+    return;
+  }
+
+  c_release(LOG_INFO, &cw->complaint, "%s plugin: Watching `%s'.", cw->plugin,
+            cw->root);
+
+  /* catch up with everything that happened while not watching */
+  cw->rescan = 1;
+}
+
+/* Reports the changes queued by inotify. Falls back to a full scan if
+ * events were lost or the root directory itself went away. */
+static void cgw_read_events(cgroup_watch_t *cw, cgw_report_t *r) {
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+
+  if (cw->fd < 0) {
+    cgw_open(cw);
+    return;
+  }
+
+  while ((len = read(cw->fd, buffer, sizeof(buffer))) > 0) {
+    char *ptr = buffer;
+
+    while (ptr < buffer + len) {
+      const struct inotify_event *event;
+      cgw_parent_t *p;
+
+      event = (const struct inotify_event *)ptr;
+      ptr += sizeof(*event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        cw->rescan = 1;
+        continue;
+      } else if ((event->mask & IN_IGNORED) && (event->wd == cw->root_wd)) {
+        cgw_close(cw);
+        cw->rescan = 1;
+        return;
+      } else if (((event->mask & IN_ISDIR) == 0) || (event->len == 0) ||
+                 (event->name[0] == '.'))
+        continue;
+
+      if (event->wd == cw->root_wd) {
+        if (cw->depth == 1) {
+          r->parent = NULL;
+          if (event->mask & (IN_CREATE | IN_MOVED_TO))
+            r->found(event->name, r->user_data);
+          else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+            r->lost(event->name, r->user_data);
+        } else if (event->mask & (IN_CREATE | IN_MOVED_TO))
+          cgw_parent_add(cw, event->name, r);
+        else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+          cgw_parent_remove(cw, event->name, r);
+
+        /* adding a watch may have failed */
+        if (cw->fd < 0)
+          return;
+        continue;
+      }
+
+      for (p = cw->parents; p != NULL; p = p->next)
+        if (p->wd == event->wd)
+          break;
+      if (p == NULL)
+        continue;
+
+      r->parent = p->name;
+      if (event->mask & (IN_CREATE | IN_MOVED_TO))
+        cgw_found(cw, event->name, r);
+      else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        char path[PATH_MAX];
+
+        ssnprintf(path, sizeof(path), "%s/%s", p->name, event->name);
+        r->lost(path, r->user_data);
+      }
+    }
+  }
+}
+#endif /* HAVE_SYS_INOTIFY_H */
+
+cgroup_watch_t *cgroup_watch_create(const char *plugin, const char *root,
+                                    int depth) {
+  cgroup_watch_t *cw;
+
+  if ((depth != 1) && (depth != 2))
+    return NULL;
+
+  cw = calloc(1, sizeof(*cw));
+  if (cw == NULL)
+    return NULL;
+
+  cw->plugin = strdup(plugin);
+  cw->root = strdup(root);
+  if ((cw->plugin == NULL) || (cw->root == NULL)) {
+    free(cw->plugin);
+    free(cw->root);
+    free(cw);
+    return NULL;
+  }
+
+  cw->depth = depth;
+  cw->rescan = 1;
+  cw->fd = -1;
+  cw->root_wd = -1;
+  C_COMPLAIN_INIT(&cw->complaint);
+
+  return cw;
+}
+
+void cgroup_watch_destroy(cgroup_watch_t *cw) {
+  if (cw == NULL)
+    return;
+
+  cgw_close(cw);
+  while (cw->parents != NULL) {
+    cgw_parent_t *p = cw->parents;
+    cw->parents = p->next;
+    free(p->name);
+    free(p);
+  }
+
+  free(cw->plugin);
+  free(cw->root);
+  free(cw);
+}
+
+int cgroup_watch_read(cgroup_watch_t *cw, cgroup_watch_callback_t found,
+                      cgroup_watch_callback_t lost, void *user_data) {
+  cgw_report_t report = {found, lost, user_data, NULL};
+
+#if HAVE_SYS_INOTIFY_H
+  cgw_read_events(cw, &report);
+  if (!cw->rescan)
+    return 0;
+  if (cgw_scan(cw, &report) != 0)
+    return -1;
+  cw->rescan = (cw->fd < 0);
+  return 1;
+#else
+  if (cgw_scan(cw, &report) != 0)
+    return -1;
+  return 1;
+#endif
+}
+
+void cgroup_job_id(const char *dir_name, char *job_id, size_t job_id_size) {
+  const char *id;
+  size_t id_len;
+
+  id = strchr(dir_name, '.');
+  if (id == NULL) {
+    sstrncpy(job_id, dir_name, job_id_size);
+    return;
+  }
+
+  id++;
+  id_len = strcspn(id, ".[");
+  if (id_len == 0)
+    sstrncpy(job_id, dir_name, job_id_size);
+  else if (id[id_len] == '[')
+    ssnprintf(job_id, job_id_size, "%.*s.%.*s", (int)id_len, id,
+              (int)strcspn(id + id_len + 1, "]"), id + id_len + 1);
+  else
+    ssnprintf(job_id, job_id_size, "%.*s", (int)id_len, id);
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -0,0 +1,87 @@
+/**
+ * collectd - src/daemon/utils_cgroup_watch.h
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * DESCRIPTION
+ *   Tracking of the cgroups below a directory, such as the LSF jobs below
+ *   the LSF cgroup or the cgroups two levels below a mount point. The
+ *   directories are listed once and then followed with inotify; they are
+ *   only listed again if inotify is not available or events were lost.
+ **/
+
+#ifndef UTILS_CGROUP_WATCH_H
+#define UTILS_CGROUP_WATCH_H 1
+
+#include <stddef.h>
+
+struct cgroup_watch_s;
+typedef struct cgroup_watch_s cgroup_watch_t;
+
+/* "path" is relative to the root directory, e.g. "job.123" or
+ * "system.slice/sshd.service". */
+typedef void (*cgroup_watch_callback_t)(const char *path, void *user_data);
+
+/*
+ * cgroup_watch_create
+ *
+ * Tracks the directories "depth" levels below "root", where "depth" is 1 or
+ * 2. "plugin" is the name of the plugin used in log messages. Nothing is
+ * read until the first call of cgroup_watch_read(). Returns NULL if out of
+ * memory or "depth" is not supported.
+ */
+cgroup_watch_t *cgroup_watch_create(const char *plugin, const char *root,
+                                    int depth);
+
+/*
+ * cgroup_watch_destroy
+ *
+ * Stops watching and frees the tracker.
+ */
+void cgroup_watch_destroy(cgroup_watch_t *cw);
+
+/*
+ * cgroup_watch_read
+ *
+ * Reports the changes since the last call. "found" is called for every
+ * directory "depth" levels below the root that appeared, "lost" for every
+ * directory that disappeared. For "depth" 2, "lost" is also called with the
+ * intermediate directory, which means that all directories below it are gone.
+ *
+ * If the directories had to be listed again, "found" is called for all of
+ * them and 1 is returned; the caller should then drop the directories which
+ * were not reported. Returns 0 otherwise, or -1 if the root directory
+ * cannot be read.
+ */
+int cgroup_watch_read(cgroup_watch_t *cw, cgroup_watch_callback_t found,
+                      cgroup_watch_callback_t lost, void *user_data);
+
+/*
+ * cgroup_job_id
+ *
+ * Returns the ID of the LSF job in the cgroup directory "dir_name":
+ * "<prefix>.<id>" becomes "<id>" and "<prefix>.<id>[<index>]" becomes
+ * "<id>.<index>". Other names are used as they are.
+ */
+void cgroup_job_id(const char *dir_name, char *job_id, size_t job_id_size);
+
+#endif /* UTILS_CGROUP_WATCH_H */
+
+/* vim: set sw=2 sts=2 et : */
@@ -0,0 +1,888 @@
+/**
+ * collectd - src/daemon/utils_proc_events.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_proc_events.h"
+
+#if KERNEL_LINUX && HAVE_LINUX_CONNECTOR_H && HAVE_LINUX_CN_PROC_H
+#define PROCEV_HAVE_CONNECTOR 1
+#endif
+
+#if PROCEV_HAVE_CONNECTOR && HAVE_LINUX_GENETLINK_H && HAVE_LINUX_TASKSTATS_H
+#define PROCEV_HAVE_TASKSTATS 1
+#endif
+
+#if PROCEV_HAVE_CONNECTOR
+#include "utils_avltree.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#if PROCEV_HAVE_TASKSTATS
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
+#endif
+
+#ifndef AGROUP
+#define AGROUP 0x20
+#endif
+
+/* Upper bound of a subscriber's queue. A subscriber which does not poll for
+ * this many events gets a "lost" indication and has to rescan. */
+#define PROCEV_QUEUE_MAX 65536
+
+#define PROCEV_RCVBUF (8 * 1024 * 1024)
+
+typedef struct {
+  procev_event_t *events;
+  size_t len;
+  size_t size;
+} procev_queue_t;
+
+struct procev_subscriber_s {
+  procev_queue_t queue;
+  procev_queue_t spare;
+  _Bool lost;
+  procev_subscriber_t *next;
+};
+
+static pthread_mutex_t procev_lock = PTHREAD_MUTEX_INITIALIZER;
+static procev_subscriber_t *subscribers_g = NULL;
+
+static pthread_t listener_g;
+static _Bool listener_running_g = 0;
+static int wakeup_g[2] = {-1, -1};
+
+static int cn_fd_g = -1;
+#if PROCEV_HAVE_TASKSTATS
+static int ts_fd_g = -1;
+static uint16_t ts_family_g = 0;
+static uint32_t ts_seq_g = 0;
+/* Sums of the exit records of threads whose group is still alive. Only used
+ * if the kernel reports the thread group of every record (ac_tgid). */
+static c_avl_tree_t *ts_groups_g = NULL;
+#endif
+
+/*
+ * Queues
+ */
+static int procev_queue_push(procev_queue_t *q, const procev_event_t *ev) {
+  if (q->len >= q->size) {
+    procev_event_t *tmp;
+    size_t size = (q->size == 0) ? 256 : 2 * q->size;
+
+    if (q->size >= PROCEV_QUEUE_MAX)
+      return -1;
+
+    tmp = realloc(q->events, size * sizeof(*tmp));
+    if (tmp == NULL)
+      return -1;
+    q->events = tmp;
+    q->size = size;
+  }
+
+  q->events[q->len] = *ev;
+  q->len++;
+  return 0;
+}
+
+/* Appends "ev" to the queues of all subscribers. */
+static void procev_dispatch(const procev_event_t *ev) {
+  procev_subscriber_t *s;
+
+  pthread_mutex_lock(&procev_lock);
+  for (s = subscribers_g; s != NULL; s = s->next)
+    if (procev_queue_push(&s->queue, ev) != 0)
+      s->lost = 1;
+  pthread_mutex_unlock(&procev_lock);
+}
+
+static void procev_dispatch_lost(void) {
+  procev_subscriber_t *s;
+
+  pthread_mutex_lock(&procev_lock);
+  for (s = subscribers_g; s != NULL; s = s->next)
+    s->lost = 1;
+  pthread_mutex_unlock(&procev_lock);
+}
+
+/*
+ * Proc connector
+ */
+static int procev_cn_send(int fd, enum proc_cn_mcast_op op) {
+  char buffer[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(op))];
+  struct nlmsghdr *nh;
+  struct cn_msg *cn;
+
+  memset(buffer, 0, sizeof(buffer));
+  nh = (struct nlmsghdr *)buffer;
+  nh->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+  nh->nlmsg_type = NLMSG_DONE;
+
+  cn = NLMSG_DATA(nh);
+  cn->id.idx = CN_IDX_PROC;
+  cn->id.val = CN_VAL_PROC;
+  cn->len = sizeof(op);
+  memcpy(cn->data, &op, sizeof(op));
+
+  if (send(fd, buffer, nh->nlmsg_len, 0) < 0)
+    return -1;
+  return 0;
+}
+
+static void procev_set_rcvbuf(int fd) {
+  int size = PROCEV_RCVBUF;
+
+  /* SO_RCVBUFFORCE ignores rmem_max but needs CAP_NET_ADMIN, which we need
+   * for the connector anyway. */
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) != 0)
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+}
+
+static int procev_cn_open(void) {
+  struct sockaddr_nl sa = {0};
+  char errbuf[1024];
+  int fd;
+
+  fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+              NETLINK_CONNECTOR);
+  if (fd < 0) {
+    ERROR("proc_events: socket (NETLINK_CONNECTOR) failed: %s",
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    return -1;
+  }
+
+  sa.nl_family = AF_NETLINK;
+  sa.nl_groups = CN_IDX_PROC;
+  if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+    ERROR("proc_events: Binding to the proc connector failed: %s",
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    close(fd);
+    return -1;
+  }
+
+  procev_set_rcvbuf(fd);
+
+  if (procev_cn_send(fd, PROC_CN_MCAST_LISTEN) != 0) {
+    ERROR("proc_events: Subscribing to process events failed: %s",
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static void procev_cn_close(void) {
+  if (cn_fd_g < 0)
+    return;
+  procev_cn_send(cn_fd_g, PROC_CN_MCAST_IGNORE);
+  close(cn_fd_g);
+  cn_fd_g = -1;
+}
+
+static void procev_cn_handle(const struct proc_event *pe) {
+  procev_event_t ev = {0};
+
+  switch (pe->what) {
+  case PROC_EVENT_FORK:
+    /* New threads are reported as forks, too. */
+    if (pe->event_data.fork.child_pid != pe->event_data.fork.child_tgid)
+      return;
+    ev.type = PROCEV_FORK;
+    ev.pid = pe->event_data.fork.child_tgid;
+    ev.ppid = pe->event_data.fork.parent_tgid;
+    break;
+
+  case PROC_EVENT_EXEC:
+    ev.type = PROCEV_EXEC;
+    ev.pid = pe->event_data.exec.process_tgid;
+    break;
+
+  case PROC_EVENT_COMM:
+    /* Only the main thread's name is the process' name. */
+    if (pe->event_data.comm.process_pid != pe->event_data.comm.process_tgid)
+      return;
+    ev.type = PROCEV_EXEC;
+    ev.pid = pe->event_data.comm.process_tgid;
+    break;
+
+  case PROC_EVENT_EXIT:
+#if PROCEV_HAVE_TASKSTATS
+    /* Exits are reported with their accounting record instead. */
+    if (ts_fd_g >= 0)
+      return;
+#endif
+    if (pe->event_data.exit.process_pid != pe->event_data.exit.process_tgid)
+      return;
+    ev.type = PROCEV_EXIT;
+    ev.pid = pe->event_data.exit.process_tgid;
+    break;
+
+  default:
+    return;
+  }
+
+  procev_dispatch(&ev);
+}
+
+/* Reads all pending connector messages. */
+static void procev_cn_drain(void) {
+  char buffer[16384];
+  struct nlmsghdr *nh;
+
+  while (42) {
+    ssize_t status = recv(cn_fd_g, buffer, sizeof(buffer), 0);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == ENOBUFS) {
+        procev_dispatch_lost();
+        continue;
+      }
+      return;
+    }
+
+    for (nh = (struct nlmsghdr *)buffer; NLMSG_OK(nh, (size_t)status);
+         nh = NLMSG_NEXT(nh, status)) {
+      struct cn_msg *cn;
+
+      if ((nh->nlmsg_type == NLMSG_ERROR) || (nh->nlmsg_type == NLMSG_NOOP))
+        continue;
+      if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*cn) + sizeof(struct proc_event)))
+        continue;
+
+      cn = NLMSG_DATA(nh);
+      if ((cn->id.idx != CN_IDX_PROC) || (cn->id.val != CN_VAL_PROC))
+        continue;
+
+      procev_cn_handle((struct proc_event *)cn->data);
+    }
+  }
+}
+
+#if PROCEV_HAVE_TASKSTATS
+/*
+ * Taskstats
+ */
+typedef struct {
+  pid_t tgid;
+  procev_acct_t acct;
+} procev_group_t;
+
+static int procev_group_compare(const void *a, const void *b) {
+  pid_t pa = *(const pid_t *)a;
+  pid_t pb = *(const pid_t *)b;
+  return (pa > pb) - (pa < pb);
+}
+
+#define NLA_DATA(na) ((void *)((char *)(na) + NLA_HDRLEN))
+#define NLA_PAYLOAD(na) ((size_t)((na)->nla_len - NLA_HDRLEN))
+
+/* Attribute iteration: "len" holds the bytes left, starting with "na". */
+static struct nlattr *procev_nla_check(struct nlattr *na, size_t len) {
+  if ((len < NLA_HDRLEN) || (na->nla_len < NLA_HDRLEN) || (na->nla_len > len))
+    return NULL;
+  return na;
+}
+
+static struct nlattr *procev_nla_next(struct nlattr *na, size_t *len) {
+  size_t size = NLA_ALIGN(na->nla_len);
+
+  if (size >= *len)
+    return NULL;
+  *len -= size;
+  return procev_nla_check((struct nlattr *)((char *)na + size), *len);
+}
+
+static int procev_genl_send(uint16_t type, uint8_t cmd, uint16_t attr,
+                            const void *data, size_t data_len) {
+  char buffer[NLMSG_SPACE(GENL_HDRLEN + NLA_HDRLEN + 256)];
+  struct nlmsghdr *nh;
+  struct genlmsghdr *genl;
+  struct nlattr *na;
+
+  if (data_len > 256)
+    return -1;
+
+  memset(buffer, 0, sizeof(buffer));
+  nh = (struct nlmsghdr *)buffer;
+  nh->nlmsg_type = type;
+  nh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+  nh->nlmsg_seq = ++ts_seq_g;
+
+  genl = NLMSG_DATA(nh);
+  genl->cmd = cmd;
+  genl->version = 1;
+
+  na = (struct nlattr *)((char *)genl + GENL_HDRLEN);
+  na->nla_type = attr;
+  na->nla_len = NLA_HDRLEN + data_len;
+  memcpy(NLA_DATA(na), data, data_len);
+
+  nh->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN + NLA_ALIGN(na->nla_len));
+
+  if (send(ts_fd_g, buffer, nh->nlmsg_len, 0) < 0)
+    return -1;
+  return 0;
+}
+
+/* Waits for the answer to the last request. Returns the family id for
+ * CTRL_CMD_GETFAMILY replies, zero for a plain acknowledgement, and -1 on
+ * error. Exit records arriving in between are discarded. */
+static int procev_genl_recv(void) {
+  char buffer[8192];
+  struct nlmsghdr *nh;
+  int family = 0;
+
+  while (42) {
+    ssize_t status = recv(ts_fd_g, buffer, sizeof(buffer), 0);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+
+    for (nh = (struct nlmsghdr *)buffer; NLMSG_OK(nh, (size_t)status);
+         nh = NLMSG_NEXT(nh, status)) {
+      if (nh->nlmsg_seq != ts_seq_g)
+        continue;
+
+      if (nh->nlmsg_type == NLMSG_ERROR) {
+        struct nlmsgerr *err = NLMSG_DATA(nh);
+        if (err->error != 0) {
+          errno = -err->error;
+          return -1;
+        }
+        return family;
+      }
+
+      if (nh->nlmsg_type == GENL_ID_CTRL) {
+        size_t len = nh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+        struct nlattr *na = procev_nla_check(
+            (struct nlattr *)((char *)NLMSG_DATA(nh) + GENL_HDRLEN), len);
+
+        for (; na != NULL; na = procev_nla_next(na, &len)) {
+          if ((na->nla_type == CTRL_ATTR_FAMILY_ID) &&
+              (NLA_PAYLOAD(na) >= sizeof(uint16_t)))
+            family = *(uint16_t *)NLA_DATA(na);
+        }
+      }
+    }
+  }
+}
+
+static int procev_ts_cpumask(char *buffer, size_t buffer_size) {
+  ssize_t status;
+  long cpus;
+
+  status = read_file_contents("/sys/devices/system/cpu/possible", buffer,
+                              buffer_size - 1);
+  if (status > 0) {
+    buffer[status] = 0;
+    strstripnewline(buffer);
+    if (buffer[0] != 0)
+      return 0;
+  }
+
+  cpus = sysconf(_SC_NPROCESSORS_CONF);
+  if (cpus < 1)
+    return -1;
+  snprintf(buffer, buffer_size, "0-%ld", cpus - 1);
+  return 0;
+}
+
+static int procev_ts_open(void) {
+  struct sockaddr_nl sa = {0};
+  struct timeval tv = {1, 0};
+  char cpumask[256];
+  char errbuf[1024];
+  int family;
+  int flags;
+
+  ts_fd_g = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+  if (ts_fd_g < 0) {
+    INFO("proc_events: socket (NETLINK_GENERIC) failed: %s",
+         sstrerror(errno, errbuf, sizeof(errbuf)));
+    return -1;
+  }
+
+  sa.nl_family = AF_NETLINK;
+  if (bind(ts_fd_g, (struct sockaddr *)&sa, sizeof(sa)) != 0)
+    goto fail;
+
+  /* Only for the setup below; the listener uses non-blocking reads. */
+  setsockopt(ts_fd_g, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  if (procev_genl_send(GENL_ID_CTRL, CTRL_CMD_GETFAMILY, CTRL_ATTR_FAMILY_NAME,
+                       TASKSTATS_GENL_NAME,
+                       strlen(TASKSTATS_GENL_NAME) + 1) != 0)
+    goto fail;
+  family = procev_genl_recv();
+  if (family <= 0)
+    goto fail;
+  ts_family_g = (uint16_t)family;
+
+  if (procev_ts_cpumask(cpumask, sizeof(cpumask)) != 0)
+    goto fail;
+
+  procev_set_rcvbuf(ts_fd_g);
+
+  if (procev_genl_send(ts_family_g, TASKSTATS_CMD_GET,
+                       TASKSTATS_CMD_ATTR_REGISTER_CPUMASK, cpumask,
+                       strlen(cpumask) + 1) != 0)
+    goto fail;
+  if (procev_genl_recv() != 0)
+    goto fail;
+
+  flags = fcntl(ts_fd_g, F_GETFL);
+  fcntl(ts_fd_g, F_SETFL, flags | O_NONBLOCK);
+
+  ts_groups_g = c_avl_create(procev_group_compare);
+  if (ts_groups_g == NULL)
+    goto fail;
+
+  return 0;
+
+fail:
+  INFO("proc_events: Taskstats are not available, exiting processes will "
+       "be reported without accounting records: %s",
+       sstrerror(errno, errbuf, sizeof(errbuf)));
+  close(ts_fd_g);
+  ts_fd_g = -1;
+  return -1;
+}
+
+static void procev_ts_clear_groups(void) {
+  void *key;
+  void *value;
+
+  if (ts_groups_g == NULL)
+    return;
+  while (c_avl_pick(ts_groups_g, &key, &value) == 0)
+    sfree(value);
+}
+
+static void procev_ts_close(void) {
+  char cpumask[256];
+
+  if (ts_fd_g < 0)
+    return;
+
+  if (procev_ts_cpumask(cpumask, sizeof(cpumask)) == 0)
+    procev_genl_send(ts_family_g, TASKSTATS_CMD_GET,
+                     TASKSTATS_CMD_ATTR_DEREGISTER_CPUMASK, cpumask,
+                     strlen(cpumask) + 1);
+  close(ts_fd_g);
+  ts_fd_g = -1;
+
+  procev_ts_clear_groups();
+  c_avl_destroy(ts_groups_g);
+  ts_groups_g = NULL;
+}
+
+static void procev_acct_add(procev_acct_t *sum, const procev_acct_t *a) {
+  sum->cpu_user += a->cpu_user;
+  sum->cpu_system += a->cpu_system;
+  sum->minflt += a->minflt;
+  sum->majflt += a->majflt;
+  sum->read_char += a->read_char;
+  sum->write_char += a->write_char;
+  sum->read_syscalls += a->read_syscalls;
+  sum->write_syscalls += a->write_syscalls;
+  sum->nvcsw += a->nvcsw;
+  sum->nivcsw += a->nivcsw;
+}
+
+static void procev_acct_from_stats(procev_acct_t *acct,
+                                   const struct taskstats *ts) {
+  /* ac_utime and ac_stime are sampled at timer ticks. Like /proc, split the
+   * precise run time of the task in the same ratio, so that the values
+   * match the ones read from /proc before. */
+  uint64_t runtime = ts->cpu_run_virtual_total / 1000;
+  uint64_t total = ts->ac_utime + ts->ac_stime;
+
+  memset(acct, 0, sizeof(*acct));
+  sstrncpy(acct->comm, ts->ac_comm, sizeof(acct->comm));
+  if ((runtime == 0) || (total == 0)) {
+    acct->cpu_user = ts->ac_utime;
+    acct->cpu_system = ts->ac_stime;
+  } else {
+    acct->cpu_user =
+        (uint64_t)((double)runtime * (double)ts->ac_utime / (double)total);
+    acct->cpu_system = runtime - acct->cpu_user;
+  }
+  acct->minflt = ts->ac_minflt;
+  acct->majflt = ts->ac_majflt;
+  acct->read_char = ts->read_char;
+  acct->write_char = ts->write_char;
+  acct->read_syscalls = ts->read_syscalls;
+  acct->write_syscalls = ts->write_syscalls;
+  acct->nvcsw = ts->nvcsw;
+  acct->nivcsw = ts->nivcsw;
+}
+
+/* Every exiting task sends a record with its own counters. The last task of
+ * a thread group has AGROUP set; if the group ever had more than one task,
+ * the same message also carries a TGID record, but that one only contains
+ * delay accounting. The per-task CPU, fault and I/O counters of a
+ * multi-threaded process therefore have to be summed up here, which needs
+ * the thread group of every record (ac_tgid, only sent by newer kernels). */
+static void procev_ts_handle_exit(const struct taskstats *ts, pid_t pid,
+                                  pid_t tgid) {
+  procev_event_t ev = {0};
+  procev_acct_t acct;
+  procev_group_t *g = NULL;
+  pid_t group = 0;
+
+#if HAVE_STRUCT_TASKSTATS_AC_TGID
+  group = (pid_t)ts->ac_tgid;
+#endif
+
+  procev_acct_from_stats(&acct, ts);
+
+  if (!(ts->ac_flag & AGROUP)) {
+    /* A thread exited, the process lives on. */
+    if (group == 0)
+      return;
+
+    if (c_avl_get(ts_groups_g, &group, (void *)&g) != 0) {
+      g = calloc(1, sizeof(*g));
+      if (g == NULL)
+        return;
+      g->tgid = group;
+      if (c_avl_insert(ts_groups_g, &g->tgid, g) != 0) {
+        sfree(g);
+        return;
+      }
+    }
+    /* The name of the process is the name of its main thread. */
+    if (pid == group)
+      sstrncpy(g->acct.comm, acct.comm, sizeof(g->acct.comm));
+    procev_acct_add(&g->acct, &acct);
+    return;
+  }
+
+  ev.type = PROCEV_EXIT;
+  if (tgid == 0) {
+    /* Single-threaded process: its counters are the process' counters. */
+    ev.pid = pid;
+    ev.have_acct = 1;
+    ev.acct = acct;
+  } else {
+    ev.pid = tgid;
+    if (group == tgid) {
+      ev.have_acct = 1;
+      ev.acct = acct;
+      if (c_avl_remove(ts_groups_g, &group, NULL, (void *)&g) == 0) {
+        procev_acct_add(&ev.acct, &g->acct);
+        if (g->acct.comm[0] != 0)
+          sstrncpy(ev.acct.comm, g->acct.comm, sizeof(ev.acct.comm));
+        sfree(g);
+      }
+    }
+  }
+
+  procev_dispatch(&ev);
+}
+
+static void procev_ts_handle(struct nlmsghdr *nh) {
+  struct taskstats ts;
+  _Bool have_stats = 0;
+  pid_t pid = 0;
+  pid_t tgid = 0;
+  struct nlattr *na;
+  size_t len;
+
+  if (nh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+    return;
+
+  len = nh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+  na = procev_nla_check((struct nlattr *)((char *)NLMSG_DATA(nh) + GENL_HDRLEN),
+                        len);
+  for (; na != NULL; na = procev_nla_next(na, &len)) {
+    int type = na->nla_type & NLA_TYPE_MASK;
+    size_t nlen = NLA_PAYLOAD(na);
+    struct nlattr *nested;
+
+    if ((type != TASKSTATS_TYPE_AGGR_PID) && (type != TASKSTATS_TYPE_AGGR_TGID))
+      continue;
+
+    nested = procev_nla_check((struct nlattr *)NLA_DATA(na), nlen);
+    for (; nested != NULL; nested = procev_nla_next(nested, &nlen)) {
+      switch (nested->nla_type & NLA_TYPE_MASK) {
+      case TASKSTATS_TYPE_PID:
+        if (NLA_PAYLOAD(nested) >= sizeof(uint32_t))
+          pid = (pid_t)*(uint32_t *)NLA_DATA(nested);
+        break;
+      case TASKSTATS_TYPE_TGID:
+        if (NLA_PAYLOAD(nested) >= sizeof(uint32_t))
+          tgid = (pid_t)*(uint32_t *)NLA_DATA(nested);
+        break;
+      case TASKSTATS_TYPE_STATS:
+        /* The per-task record comes first; the group record only has
+         * delay accounting. Older kernels send shorter structs. */
+        if ((type == TASKSTATS_TYPE_AGGR_PID) && !have_stats) {
+          size_t size = NLA_PAYLOAD(nested);
+          memset(&ts, 0, sizeof(ts));
+          memcpy(&ts, NLA_DATA(nested), size < sizeof(ts) ? size : sizeof(ts));
+          have_stats = 1;
+        }
+        break;
+      }
+    }
+  }
+
+  if (have_stats && (pid > 0))
+    procev_ts_handle_exit(&ts, pid, tgid);
+}
+
+static void procev_ts_drain(void) {
+  char buffer[16384];
+  struct nlmsghdr *nh;
+
+  while (42) {
+    ssize_t status = recv(ts_fd_g, buffer, sizeof(buffer), 0);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == ENOBUFS) {
+        procev_ts_clear_groups();
+        procev_dispatch_lost();
+        continue;
+      }
+      return;
+    }
+
+    /* A process' fork is queued on the connector socket before its exit
+     * record is queued here. Reading the connector first keeps the order. */
+    procev_cn_drain();
+
+    for (nh = (struct nlmsghdr *)buffer; NLMSG_OK(nh, (size_t)status);
+         nh = NLMSG_NEXT(nh, status)) {
+      if (nh->nlmsg_type == ts_family_g)
+        procev_ts_handle(nh);
+    }
+  }
+}
+#endif /* PROCEV_HAVE_TASKSTATS */
+
+/*
+ * Listener
+ */
+static void *procev_listener(void __attribute__((unused)) * arg) {
+  while (42) {
+    struct pollfd fds[3] = {
+        {.fd = wakeup_g[0], .events = POLLIN},
+        {.fd = cn_fd_g, .events = POLLIN},
+#if PROCEV_HAVE_TASKSTATS
+        {.fd = ts_fd_g, .events = POLLIN},
+#else
+        {.fd = -1},
+#endif
+    };
+
+    if (poll(fds, STATIC_ARRAY_SIZE(fds), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    if (fds[0].revents != 0)
+      break;
+    if (fds[1].revents != 0)
+      procev_cn_drain();
+#if PROCEV_HAVE_TASKSTATS
+    if (fds[2].revents != 0)
+      procev_ts_drain();
+#endif
+  }
+
+  return NULL;
+}
+
+static int procev_start(void) {
+  int status;
+
+  cn_fd_g = procev_cn_open();
+  if (cn_fd_g < 0)
+    return -1;
+
+#if PROCEV_HAVE_TASKSTATS
+  procev_ts_open();
+#endif
+
+  if (pipe(wakeup_g) != 0) {
+    wakeup_g[0] = wakeup_g[1] = -1;
+    goto fail;
+  }
+
+  status = plugin_thread_create(&listener_g, NULL, procev_listener, NULL);
+  if (status != 0) {
+    close(wakeup_g[0]);
+    close(wakeup_g[1]);
+    wakeup_g[0] = wakeup_g[1] = -1;
+    goto fail;
+  }
+
+  listener_running_g = 1;
+  return 0;
+
+fail:
+  ERROR("proc_events: Starting the listener thread failed.");
+  procev_cn_close();
+#if PROCEV_HAVE_TASKSTATS
+  procev_ts_close();
+#endif
+  return -1;
+}
+
+static void procev_stop(void) {
+  if (!listener_running_g)
+    return;
+
+  /* Closing the write end wakes up poll(2). */
+  close(wakeup_g[1]);
+  pthread_join(listener_g, NULL);
+  close(wakeup_g[0]);
+  wakeup_g[0] = wakeup_g[1] = -1;
+  listener_running_g = 0;
+
+  procev_cn_close();
+#if PROCEV_HAVE_TASKSTATS
+  procev_ts_close();
+#endif
+}
+
+/* Serializes starting and stopping the listener; procev_lock is taken by
+ * the listener itself and must not be held while joining it. */
+static pthread_mutex_t procev_start_lock = PTHREAD_MUTEX_INITIALIZER;
+
+procev_subscriber_t *procev_subscribe(void) {
+  procev_subscriber_t *s;
+
+  s = calloc(1, sizeof(*s));
+  if (s == NULL)
+    return NULL;
+
+  pthread_mutex_lock(&procev_start_lock);
+  if (!listener_running_g && (procev_start() != 0)) {
+    pthread_mutex_unlock(&procev_start_lock);
+    sfree(s);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&procev_lock);
+  s->next = subscribers_g;
+  subscribers_g = s;
+  pthread_mutex_unlock(&procev_lock);
+  pthread_mutex_unlock(&procev_start_lock);
+
+  return s;
+}
+
+void procev_unsubscribe(procev_subscriber_t *s) {
+  procev_subscriber_t **p;
+  _Bool last;
+
+  if (s == NULL)
+    return;
+
+  pthread_mutex_lock(&procev_start_lock);
+  pthread_mutex_lock(&procev_lock);
+  for (p = &subscribers_g; *p != NULL; p = &(*p)->next) {
+    if (*p == s) {
+      *p = s->next;
+      break;
+    }
+  }
+  last = (subscribers_g == NULL);
+  pthread_mutex_unlock(&procev_lock);
+
+  if (last)
+    procev_stop();
+  pthread_mutex_unlock(&procev_start_lock);
+
+  sfree(s->queue.events);
+  sfree(s->spare.events);
+  sfree(s);
+}
+
+int procev_poll(procev_subscriber_t *s, procev_callback_t callback,
+                void *user_data) {
+  procev_queue_t tmp;
+  _Bool lost;
+  size_t i;
+
+  if (s == NULL)
+    return -1;
+
+  /* Swap the queues so that the listener can continue while the events
+   * are handled. */
+  pthread_mutex_lock(&procev_lock);
+  tmp = s->spare;
+  s->spare = s->queue;
+  s->queue = tmp;
+  lost = s->lost;
+  s->lost = 0;
+  pthread_mutex_unlock(&procev_lock);
+
+  for (i = 0; i < s->spare.len; i++)
+    callback(&s->spare.events[i], user_data);
+
+  tmp.len = s->spare.len;
+  s->spare.len = 0;
+
+  return lost ? -1 : (int)tmp.len;
+}
+
+_Bool procev_have_accounting(void) {
+#if PROCEV_HAVE_TASKSTATS
+  return ts_fd_g >= 0;
+#else
+  return 0;
+#endif
+}
+
+#else /* !PROCEV_HAVE_CONNECTOR */
+
+procev_subscriber_t *procev_subscribe(void) { return NULL; }
+
+void procev_unsubscribe(procev_subscriber_t __attribute__((unused)) * s) {}
+
+int procev_poll(procev_subscriber_t __attribute__((unused)) * s,
+                procev_callback_t __attribute__((unused)) callback,
+                void __attribute__((unused)) * user_data) {
+  return -1;
+}
+
+_Bool procev_have_accounting(void) { return 0; }
+
+#endif /* PROCEV_HAVE_CONNECTOR */
+
+/* vim: set sw=2 sts=2 et : */
@@ -0,0 +1,112 @@
+/**
+ * collectd - src/daemon/utils_proc_events.h
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * DESCRIPTION
+ *   Process life cycle events from the Linux proc connector, with the final
+ *   resource usage of exiting processes taken from taskstats. A single
+ *   listener thread serves all plugins; every subscriber has its own queue
+ *   which it drains from its read callback, so plugins need no locking.
+ **/
+
+#ifndef UTILS_PROC_EVENTS_H
+#define UTILS_PROC_EVENTS_H 1
+
+#include <sys/types.h>
+#include <stdint.h>
+
+typedef enum {
+  /* "pid" was forked by process "ppid". Only new processes are reported,
+   * not new threads. */
+  PROCEV_FORK,
+  /* "pid" called exec(2) or changed its command name. */
+  PROCEV_EXEC,
+  /* Process "pid" exited. "acct" is valid if "have_acct" is set. */
+  PROCEV_EXIT,
+} procev_type_t;
+
+/* Final counters of an exited process, summed over all of its threads. */
+typedef struct {
+  char comm[32];
+  uint64_t cpu_user;   /* microseconds */
+  uint64_t cpu_system; /* microseconds */
+  uint64_t minflt;
+  uint64_t majflt;
+  uint64_t read_char;
+  uint64_t write_char;
+  uint64_t read_syscalls;
+  uint64_t write_syscalls;
+  uint64_t nvcsw;
+  uint64_t nivcsw;
+} procev_acct_t;
+
+typedef struct {
+  procev_type_t type;
+  pid_t pid;
+  pid_t ppid;
+  _Bool have_acct;
+  procev_acct_t acct;
+} procev_event_t;
+
+struct procev_subscriber_s;
+typedef struct procev_subscriber_s procev_subscriber_t;
+
+typedef void (*procev_callback_t)(const procev_event_t *event,
+                                  void *user_data);
+
+/*
+ * procev_subscribe
+ *
+ * Starts the listener thread if this is the first subscriber and returns a
+ * new, empty event queue. Returns NULL if process events are not available,
+ * e.g. because the daemon lacks CAP_NET_ADMIN or the kernel has no proc
+ * connector. Callers are expected to fall back to scanning /proc then.
+ */
+procev_subscriber_t *procev_subscribe(void);
+
+/*
+ * procev_unsubscribe
+ *
+ * Frees the queue. The listener thread is stopped with the last subscriber.
+ */
+void procev_unsubscribe(procev_subscriber_t *s);
+
+/*
+ * procev_poll
+ *
+ * Calls "callback" for every event queued since the last call, in the order
+ * they happened. Returns the number of events, or -1 if events were lost
+ * since the last call (queue or socket overflow). In the latter case the
+ * queued events are still delivered but the caller must rescan /proc.
+ */
+int procev_poll(procev_subscriber_t *s, procev_callback_t callback,
+                void *user_data);
+
+/*
+ * procev_have_accounting
+ *
+ * Returns true if exit events carry the final counters of the process.
+ */
+_Bool procev_have_accounting(void);
+
+#endif /* UTILS_PROC_EVENTS_H */
+
+/* vim: set sw=2 sts=2 et : */
@@ -0,0 +1,205 @@
+/**
+ * collectd - src/daemon/utils_procfile.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+#include "collectd.h"
+#include "utils_procfile.h"
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+#define PROCFILE_INITIAL_SIZE 4096
+
+struct procfile_s {
+  char *path;
+  int fd;
+
+  char *buffer;
+  size_t size;
+};
+
+procfile_t *procfile_create(const char *path) {
+  procfile_t *pf;
+
+  pf = calloc(1, sizeof(*pf));
+  if (pf == NULL)
+    return NULL;
+
+  pf->path = strdup(path);
+  if (pf->path == NULL) {
+    free(pf);
+    return NULL;
+  }
+  pf->fd = -1;
+
+  return pf;
+}
+
+void procfile_destroy(procfile_t *pf) {
+  if (pf == NULL)
+    return;
+
+  if (pf->fd >= 0)
+    close(pf->fd);
+  free(pf->buffer);
+  free(pf->path);
+  free(pf);
+}
+
+const char *procfile_path(const procfile_t *pf) { return pf->path; }
+
+/* Reads the file from the start into the buffer. Returns the length read,
+ * or -1 if the buffer is too small or on error (errno is zero then). */
+static ssize_t procfile_pread(procfile_t *pf) {
+  size_t len = 0;
+
+  while (len < pf->size - 1) {
+    ssize_t status = pread(pf->fd, pf->buffer + len, pf->size - 1 - len,
+                           (off_t)len);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (status == 0)
+      return (ssize_t)len;
+
+    /* seq_file based files return about a page per call, so a short read
+     * does not mean the end of the file. */
+    len += (size_t)status;
+  }
+
+  errno = 0;
+  return -1;
+}
+
+char *procfile_read(procfile_t *pf, size_t *len) {
+  ssize_t status;
+
+  if (pf->buffer == NULL) {
+    pf->buffer = malloc(PROCFILE_INITIAL_SIZE);
+    if (pf->buffer == NULL)
+      return NULL;
+    pf->size = PROCFILE_INITIAL_SIZE;
+  }
+
+  if (pf->fd < 0) {
+    pf->fd = open(pf->path, O_RDONLY | O_CLOEXEC);
+    if (pf->fd < 0)
+      return NULL;
+  }
+
+  while ((status = procfile_pread(pf)) < 0) {
+    char *tmp;
+    int saved_errno = errno;
+
+    if (saved_errno != 0) {
+      /* The device or process behind the file may be gone. */
+      close(pf->fd);
+      pf->fd = -1;
+      errno = saved_errno;
+      return NULL;
+    }
+
+    /* The file does not fit, which happens once per file when it is read
+     * for the first time. */
+    tmp = realloc(pf->buffer, 2 * pf->size);
+    if (tmp == NULL)
+      return NULL;
+    pf->buffer = tmp;
+    pf->size *= 2;
+  }
+
+  pf->buffer[status] = 0;
+  if (len != NULL)
+    *len = (size_t)status;
+  return pf->buffer;
+}
+
+char *procfile_next_line(char **ptr) {
+  char *line = *ptr;
+  char *end;
+
+  if ((line == NULL) || (*line == 0))
+    return NULL;
+
+  end = strchr(line, '\n');
+  if (end == NULL) {
+    *ptr = line + strlen(line);
+  } else {
+    *end = 0;
+    *ptr = end + 1;
+  }
+
+  return line;
+}
+
+int procfile_split(char *line, char **fields, int size) {
+  int num = 0;
+  char *ptr = line;
+
+  while (num < size) {
+    while ((*ptr == ' ') || (*ptr == '\t') || (*ptr == '\n'))
+      ptr++;
+    if (*ptr == 0)
+      break;
+
+    fields[num] = ptr;
+    num++;
+
+    while ((*ptr != ' ') && (*ptr != '\t') && (*ptr != '\n') && (*ptr != 0))
+      ptr++;
+    if (*ptr == 0)
+      break;
+    *ptr = 0;
+    ptr++;
+  }
+
+  return num;
+}
+
+uint64_t procfile_u64(const char *str, char **endptr) {
+  const char *ptr = str;
+  uint64_t value = 0;
+
+  while ((*ptr == ' ') || (*ptr == '\t'))
+    ptr++;
+
+  if ((*ptr < '0') || (*ptr > '9')) {
+    if (endptr != NULL)
+      *endptr = (char *)str;
+    return 0;
+  }
+
+  while ((*ptr >= '0') && (*ptr <= '9')) {
+    value = 10 * value + (uint64_t)(*ptr - '0');
+    ptr++;
+  }
+
+  if (endptr != NULL)
+    *endptr = (char *)ptr;
+  return value;
+}
+
+/* vim: set sw=2 sts=2 et : */
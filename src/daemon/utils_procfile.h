@@ -0,0 +1,100 @@
+/**
+ * collectd - src/daemon/utils_procfile.h
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * DESCRIPTION
+ *   Re-reading of /proc and /sys files. A file is registered once; its
+ *   descriptor is kept open and the whole file is read with pread(2) from
+ *   offset zero into a buffer which is reused on the next read. The
+ *   tokenizer and number parser work in place and do not allocate.
+ **/
+
+#ifndef UTILS_PROCFILE_H
+#define UTILS_PROCFILE_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct procfile_s;
+typedef struct procfile_s procfile_t;
+
+/*
+ * procfile_create
+ *
+ * Registers "path". The file is opened on the first read, so files which do
+ * not exist yet are fine. Returns NULL if out of memory.
+ */
+procfile_t *procfile_create(const char *path);
+
+/*
+ * procfile_destroy
+ *
+ * Closes the descriptor and frees the buffer.
+ */
+void procfile_destroy(procfile_t *pf);
+
+/*
+ * procfile_read
+ *
+ * Reads the current contents of the file. Returns a pointer to the
+ * NUL-terminated contents, which the caller may modify, e.g. by splitting
+ * it. The buffer stays valid until the next call. If "len" is not NULL, the
+ * number of bytes read is stored there. Returns NULL and sets errno if the
+ * file cannot be read; the file is reopened on the next call then.
+ */
+char *procfile_read(procfile_t *pf, size_t *len);
+
+/*
+ * procfile_path
+ *
+ * Returns the path the file was registered with, for log messages.
+ */
+const char *procfile_path(const procfile_t *pf);
+
+/*
+ * procfile_next_line
+ *
+ * Returns the line at "*ptr", terminated in place, and advances "*ptr" to
+ * the next line. Returns NULL at the end of the buffer.
+ */
+char *procfile_next_line(char **ptr);
+
+/*
+ * procfile_split
+ *
+ * Splits "line" in place at spaces and tabs, like strsplit(), and stores up
+ * to "size" fields in "fields". Returns the number of fields stored.
+ */
+int procfile_split(char *line, char **fields, int size);
+
+/*
+ * procfile_u64
+ *
+ * Parses an unsigned decimal number after optional blanks, like
+ * strtoull(3) with base 10 but without locale and errno handling. Values
+ * which do not fit wrap around. If "endptr" is not NULL, it is set to the
+ * first character not parsed, which is "str" if there are no digits.
+ */
+uint64_t procfile_u64(const char *str, char **endptr);
+
+#endif /* UTILS_PROCFILE_H */
+
+/* vim: set sw=2 sts=2 et : */
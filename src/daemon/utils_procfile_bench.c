@@ -0,0 +1,146 @@
+/**
+ * collectd - src/daemon/utils_procfile_bench.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+/*
+ * Microbenchmark of reading /proc files the way the read plugins did, with
+ * fopen, fgets, strsplit and strtoull, against utils_procfile. Every round
+ * reads the file and sums up all numeric fields so that both variants do
+ * the same work. Build with "make bench_utils_procfile" and run with the
+ * files to read as arguments, or without arguments for a default set.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "utils_procfile.h"
+
+#define BENCH_ROUNDS 2000
+
+static double now_seconds (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ((double) ts.tv_sec + ((double) ts.tv_nsec) / 1e9);
+}
+
+static uint64_t read_legacy (const char *path)
+{
+  FILE *fh;
+  char buffer[4096];
+  char *fields[256];
+  uint64_t sum = 0;
+
+  fh = fopen (path, "r");
+  if (fh == NULL)
+    return (0);
+
+  while (fgets (buffer, sizeof (buffer), fh) != NULL)
+  {
+    int num = strsplit (buffer, fields, STATIC_ARRAY_SIZE (fields));
+    int i;
+
+    for (i = 0; i < num; i++)
+      sum += strtoull (fields[i], NULL, 10);
+  }
+
+  fclose (fh);
+  return (sum);
+}
+
+static uint64_t read_procfile (procfile_t *pf)
+{
+  char *buffer;
+  char *line;
+  char *fields[256];
+  uint64_t sum = 0;
+
+  buffer = procfile_read (pf, NULL);
+  if (buffer == NULL)
+    return (0);
+
+  while ((line = procfile_next_line (&buffer)) != NULL)
+  {
+    int num = procfile_split (line, fields, STATIC_ARRAY_SIZE (fields));
+    int i;
+
+    for (i = 0; i < num; i++)
+      sum += procfile_u64 (fields[i], NULL);
+  }
+
+  return (sum);
+}
+
+static void run (const char *path)
+{
+  procfile_t *pf;
+  double start;
+  double legacy;
+  double fast;
+  uint64_t check = 0;
+  int i;
+
+  if (access (path, R_OK) != 0)
+  {
+    printf ("%-24s not readable, skipped\n", path);
+    return;
+  }
+
+  start = now_seconds ();
+  for (i = 0; i < BENCH_ROUNDS; i++)
+    check += read_legacy (path);
+  legacy = now_seconds () - start;
+
+  pf = procfile_create (path);
+  if (pf == NULL)
+    return;
+  start = now_seconds ();
+  for (i = 0; i < BENCH_ROUNDS; i++)
+    check += read_procfile (pf);
+  fast = now_seconds () - start;
+  procfile_destroy (pf);
+
+  printf ("%-24s fopen/fgets %8.2f us   procfile %8.2f us   (%.2fx)%s\n",
+      path, 1e6 * legacy / BENCH_ROUNDS, 1e6 * fast / BENCH_ROUNDS,
+      legacy / fast, (check == 0) ? "   [no numbers]" : "");
+}
+
+int main (int argc, char **argv)
+{
+  const char *defaults[] = {
+    "/proc/stat", "/proc/meminfo", "/proc/vmstat", "/proc/diskstats",
+    "/proc/net/dev", "/proc/interrupts", "/proc/net/snmp",
+  };
+  int i;
+
+  printf ("%d reads per file, time per read:\n", BENCH_ROUNDS);
+  if (argc > 1)
+    for (i = 1; i < argc; i++)
+      run (argv[i]);
+  else
+    for (i = 0; i < (int) STATIC_ARRAY_SIZE (defaults); i++)
+      run (defaults[i]);
+
+  return (0);
+}
+
+/* vim: set sw=2 sts=2 et : */
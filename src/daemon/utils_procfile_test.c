@@ -0,0 +1,202 @@
+/**
+ * collectd - src/daemon/utils_procfile_test.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+#include "testing.h"
+#include "collectd.h"
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+#include "utils_procfile.h"
+
+static int write_file (const char *path, const char *content, size_t len)
+{
+  FILE *fh;
+
+  fh = fopen (path, "w");
+  if (fh == NULL)
+    return (-1);
+  if (fwrite (content, 1, len, fh) != len)
+  {
+    fclose (fh);
+    return (-1);
+  }
+  return (fclose (fh));
+}
+
+DEF_TEST(split)
+{
+  char line[] = "  cpu0 \t12 0  345\n";
+  char *fields[8];
+  char empty[] = " \t ";
+  char *few[2];
+  char three[] = "a b c";
+
+  OK (procfile_split (line, fields, STATIC_ARRAY_SIZE (fields)) == 4);
+  STREQ ("cpu0", fields[0]);
+  STREQ ("12", fields[1]);
+  STREQ ("0", fields[2]);
+  STREQ ("345", fields[3]);
+
+  OK (procfile_split (empty, fields, STATIC_ARRAY_SIZE (fields)) == 0);
+
+  OK (procfile_split (three, few, STATIC_ARRAY_SIZE (few)) == 2);
+  STREQ ("a", few[0]);
+  STREQ ("b", few[1]);
+
+  return (0);
+}
+
+DEF_TEST(u64)
+{
+  struct {
+    const char *str;
+    uint64_t value;
+    size_t parsed;
+  } cases[] = {
+    { "0", 0, 1 },
+    { "  42 kB", 42, 4 },
+    { "18446744073709551615", UINT64_MAX, 20 },
+    { "123abc", 123, 3 },
+    { "abc", 0, 0 },
+    { "", 0, 0 },
+    { "-1", 0, 0 },
+  };
+  size_t i;
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (cases); i++)
+  {
+    char *endptr = NULL;
+
+    OK (procfile_u64 (cases[i].str, &endptr) == cases[i].value);
+    OK (endptr == cases[i].str + cases[i].parsed);
+  }
+
+  OK (procfile_u64 ("7", NULL) == 7);
+
+  return (0);
+}
+
+DEF_TEST(read)
+{
+  char path[] = "/tmp/utils_procfile_test.XXXXXX";
+  char big[10000];
+  procfile_t *pf;
+  char *buffer;
+  char *ptr;
+  char *line;
+  size_t len = 0;
+  int fd;
+
+  fd = mkstemp (path);
+  OK (fd >= 0);
+  if (fd < 0)
+    return (-1);
+  close (fd);
+
+  CHECK_NOT_NULL (pf = procfile_create (path));
+  STREQ (path, procfile_path (pf));
+
+  CHECK_ZERO (write_file (path, "first 1\nsecond 2\n", 17));
+  CHECK_NOT_NULL (buffer = procfile_read (pf, &len));
+  OK (len == 17);
+
+  ptr = buffer;
+  CHECK_NOT_NULL (line = procfile_next_line (&ptr));
+  STREQ ("first 1", line);
+  CHECK_NOT_NULL (line = procfile_next_line (&ptr));
+  STREQ ("second 2", line);
+  OK (procfile_next_line (&ptr) == NULL);
+
+  /* The file is re-read from the start through the same descriptor, and
+   * the buffer grows to fit. */
+  memset (big, 'x', sizeof (big));
+  big[sizeof (big) - 1] = '\n';
+  CHECK_ZERO (write_file (path, big, sizeof (big)));
+  CHECK_NOT_NULL (buffer = procfile_read (pf, &len));
+  OK (len == sizeof (big));
+  OK (buffer[len] == 0);
+
+  CHECK_ZERO (write_file (path, "last", 4));
+  CHECK_NOT_NULL (buffer = procfile_read (pf, &len));
+  STREQ ("last", buffer);
+  ptr = buffer;
+  CHECK_NOT_NULL (line = procfile_next_line (&ptr));
+  STREQ ("last", line);
+  OK (procfile_next_line (&ptr) == NULL);
+
+  unlink (path);
+  procfile_destroy (pf);
+
+  /* Files which do not exist are not an error until read. */
+  CHECK_NOT_NULL (pf = procfile_create (path));
+  OK (procfile_read (pf, NULL) == NULL);
+  procfile_destroy (pf);
+
+  return (0);
+}
+
+DEF_TEST(seq_file)
+{
+  /* seq_file based /proc files return about one page per read(2). The
+   * symbol table is large and does not change between reads. */
+  const char *path = "/proc/kallsyms";
+  char chunk[4096];
+  procfile_t *pf;
+  FILE *fh;
+  size_t expected = 0;
+  size_t len = 0;
+  size_t n;
+
+  fh = fopen (path, "r");
+  if (fh == NULL)
+  {
+    printf ("# %s not readable, skipped\n", path);
+    return (0);
+  }
+  while ((n = fread (chunk, 1, sizeof (chunk), fh)) > 0)
+    expected += n;
+  fclose (fh);
+  OK (expected > sizeof (chunk));
+
+  CHECK_NOT_NULL (pf = procfile_create (path));
+  OK (procfile_read (pf, &len) != NULL);
+  OK (len == expected);
+
+  /* again through the kept open descriptor */
+  OK (procfile_read (pf, &len) != NULL);
+  OK (len == expected);
+  procfile_destroy (pf);
+
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(split);
+  RUN_TEST(u64);
+  RUN_TEST(read);
+  RUN_TEST(seq_file);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
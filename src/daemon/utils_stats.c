@@ -0,0 +1,90 @@
+/**
+ * collectd - src/daemon/utils_stats.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_stats.h"
+
+void stats_latency_add (stats_latency_t *l, cdtime_t duration) /* {{{ */
+{
+	l->sum += duration;
+	l->num++;
+	if (l->max < duration)
+		l->max = duration;
+} /* }}} void stats_latency_add */
+
+gauge_t stats_latency_average (stats_latency_t const *l) /* {{{ */
+{
+	if (l->num == 0)
+		return (NAN);
+	return (CDTIME_T_TO_DOUBLE (l->sum) / ((gauge_t) l->num));
+} /* }}} gauge_t stats_latency_average */
+
+gauge_t stats_latency_max (stats_latency_t const *l) /* {{{ */
+{
+	if (l->num == 0)
+		return (NAN);
+	return (CDTIME_T_TO_DOUBLE (l->max));
+} /* }}} gauge_t stats_latency_max */
+
+static void stats_submit (const char *plugin, /* {{{ */
+		const char *plugin_instance, const char *type,
+		const char *type_instance, value_t value)
+{
+	value_list_t vl = VALUE_LIST_INIT;
+
+	vl.values = &value;
+	vl.values_len = 1;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, plugin, sizeof (vl.plugin));
+	if (plugin_instance != NULL)
+		sstrncpy (vl.plugin_instance, plugin_instance,
+				sizeof (vl.plugin_instance));
+	sstrncpy (vl.type, type, sizeof (vl.type));
+	sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
+
+	plugin_dispatch_values (&vl);
+} /* }}} void stats_submit */
+
+void stats_submit_derive (const char *plugin, /* {{{ */
+		const char *plugin_instance, const char *type,
+		const char *type_instance, derive_t value)
+{
+	value_t v;
+
+	v.derive = value;
+	stats_submit (plugin, plugin_instance, type, type_instance, v);
+} /* }}} void stats_submit_derive */
+
+void stats_submit_gauge (const char *plugin, /* {{{ */
+		const char *plugin_instance, const char *type,
+		const char *type_instance, gauge_t value)
+{
+	value_t v;
+
+	v.gauge = value;
+	stats_submit (plugin, plugin_instance, type, type_instance, v);
+} /* }}} void stats_submit_gauge */
+
+/* vim: set sw=8 ts=8 noet fdm=marker : */
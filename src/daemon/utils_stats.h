@@ -0,0 +1,55 @@
+/**
+ * collectd - src/daemon/utils_stats.h
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_STATS_H
+#define UTILS_STATS_H 1
+
+#include "plugin.h"
+
+/*
+ * Helpers for the statistics plugins report about themselves when
+ * "ReportStats" is enabled.
+ */
+
+/* Durations measured since the last report. */
+struct stats_latency_s
+{
+	cdtime_t sum;
+	cdtime_t max;
+	uint64_t num;
+};
+typedef struct stats_latency_s stats_latency_t;
+
+void stats_latency_add (stats_latency_t *l, cdtime_t duration);
+
+/* Average and maximum in seconds, NAN if nothing has been measured. */
+gauge_t stats_latency_average (stats_latency_t const *l);
+gauge_t stats_latency_max (stats_latency_t const *l);
+
+/* Dispatches one value for the local host. "plugin_instance" may be NULL. */
+void stats_submit_derive (const char *plugin, const char *plugin_instance,
+		const char *type, const char *type_instance, derive_t value);
+void stats_submit_gauge (const char *plugin, const char *plugin_instance,
+		const char *type, const char *type_instance, gauge_t value);
+
+#endif /* UTILS_STATS_H */
@@ -106,6 +106,11 @@ typedef struct diskstats
 } diskstats_t;
 
 static diskstats_t *disklist;
+
+# include "utils_procfile.h"
+static procfile_t *proc_diskstats;
+/* Set when reading /proc/partitions of a 2.4 kernel. */
+static int disk_fieldshift;
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -219,7 +224,20 @@ static int disk_init (void)
 /* #endif HAVE_IOKIT_IOKITLIB_H */
 
 #elif KERNEL_LINUX
-	/* do nothing */
+	if (proc_diskstats == NULL)
+	{
+		if (access ("/proc/diskstats", R_OK) == 0)
+		{
+			proc_diskstats = procfile_create ("/proc/diskstats");
+			disk_fieldshift = 0;
+		}
+		else
+		{
+			/* Kernel is 2.4.* */
+			proc_diskstats = procfile_create ("/proc/partitions");
+			disk_fieldshift = 1;
+		}
+	}
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -506,12 +524,12 @@ static int disk_read (void)
 /* #endif HAVE_IOKIT_IOKITLIB_H */
 
 #elif KERNEL_LINUX
-	FILE *fh;
-	char buffer[1024];
-	
+	char *buffer;
+	char *line;
+
 	char *fields[32];
 	int numfields;
-	int fieldshift = 0;
+	int fieldshift = disk_fieldshift;
 
 	int minor = 0;
 
@@ -531,35 +549,34 @@ static int disk_read (void)
 
 	diskstats_t *ds, *pre_ds;
 
-	if ((fh = fopen ("/proc/diskstats", "r")) == NULL)
-	{
-		fh = fopen ("/proc/partitions", "r");
-		if (fh == NULL)
-		{
-			ERROR ("disk plugin: fopen (/proc/{diskstats,partitions}) failed.");
-			return (-1);
-		}
+	if (proc_diskstats == NULL)
+		return (-1);
 
-		/* Kernel is 2.4.* */
-		fieldshift = 1;
+	if ((buffer = procfile_read (proc_diskstats, NULL)) == NULL)
+	{
+		char errbuf[1024];
+		ERROR ("disk plugin: Reading %s failed: %s",
+				procfile_path (proc_diskstats),
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
 	}
 
 #if HAVE_LIBUDEV
 	handle_udev = udev_new();
 #endif
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	while ((line = procfile_next_line (&buffer)) != NULL)
 	{
 		char *disk_name;
 		char *output_name;
 		char *alt_name;
 
-		numfields = strsplit (buffer, fields, 32);
+		numfields = procfile_split (line, fields, 32);
 
 		if ((numfields != (14 + fieldshift)) && (numfields != 7))
 			continue;
 
-		minor = atoll (fields[1]);
+		minor = (int) procfile_u64 (fields[1], NULL);
 
 		disk_name = fields[2 + fieldshift];
 
@@ -588,31 +605,31 @@ static int disk_read (void)
 		if (numfields == 7)
 		{
 			/* Kernel 2.6, Partition */
-			read_ops      = atoll (fields[3]);
-			read_sectors  = atoll (fields[4]);
-			write_ops     = atoll (fields[5]);
-			write_sectors = atoll (fields[6]);
+			read_ops      = (derive_t) procfile_u64 (fields[3], NULL);
+			read_sectors  = (derive_t) procfile_u64 (fields[4], NULL);
+			write_ops     = (derive_t) procfile_u64 (fields[5], NULL);
+			write_sectors = (derive_t) procfile_u64 (fields[6], NULL);
 		}
 		else if (numfields == (14 + fieldshift))
 		{
-			read_ops  =  atoll (fields[3 + fieldshift]);
-			write_ops =  atoll (fields[7 + fieldshift]);
+			read_ops  = (derive_t) procfile_u64 (fields[3 + fieldshift], NULL);
+			write_ops = (derive_t) procfile_u64 (fields[7 + fieldshift], NULL);
 
-			read_sectors  = atoll (fields[5 + fieldshift]);
-			write_sectors = atoll (fields[9 + fieldshift]);
+			read_sectors  = (derive_t) procfile_u64 (fields[5 + fieldshift], NULL);
+			write_sectors = (derive_t) procfile_u64 (fields[9 + fieldshift], NULL);
 
 			if ((fieldshift == 0) || (minor == 0))
 			{
 				is_disk = 1;
-				read_merged  = atoll (fields[4 + fieldshift]);
-				read_time    = atoll (fields[6 + fieldshift]);
-				write_merged = atoll (fields[8 + fieldshift]);
-				write_time   = atoll (fields[10+ fieldshift]);
+				read_merged  = (derive_t) procfile_u64 (fields[4 + fieldshift], NULL);
+				read_time    = (derive_t) procfile_u64 (fields[6 + fieldshift], NULL);
+				write_merged = (derive_t) procfile_u64 (fields[8 + fieldshift], NULL);
+				write_time   = (derive_t) procfile_u64 (fields[10+ fieldshift], NULL);
 
-				in_progress = atof (fields[11 + fieldshift]);
+				in_progress = (gauge_t) procfile_u64 (fields[11 + fieldshift], NULL);
 
-				io_time       = atof (fields[12 + fieldshift]);
-				weighted_time = atof (fields[13 + fieldshift]);
+				io_time       = (derive_t) procfile_u64 (fields[12 + fieldshift], NULL);
+				weighted_time = (derive_t) procfile_u64 (fields[13 + fieldshift], NULL);
 			}
 		}
 		else
@@ -742,13 +759,11 @@ static int disk_read (void)
 
 		/* release udev-based alternate name, if allocated */
 		free(alt_name);
-	} /* while (fgets (buffer, sizeof (buffer), fh) != NULL) */
+	} /* while (procfile_next_line (&buffer) != NULL) */
 
 #if HAVE_LIBUDEV
 	udev_unref(handle_udev);
 #endif
-
-	fclose (fh);
 /* #endif defined(KERNEL_LINUX) */
 
 #elif HAVE_LIBKSTAT
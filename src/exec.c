@@ -535,16 +535,22 @@ static int fork_child (program_list_t *pl, int *fd_in, int *fd_out, int *fd_err)
 
 static int parse_line (char *buffer) /* {{{ */
 {
+  int status;
+
+  /* The handle_* functions leave flushing the responses to the caller. */
   if (strncasecmp ("PUTVAL", buffer, strlen ("PUTVAL")) == 0)
-    return (handle_putval (stdout, buffer));
+    status = handle_putval (stdout, buffer);
   else if (strncasecmp ("PUTNOTIF", buffer, strlen ("PUTNOTIF")) == 0)
-    return (handle_putnotif (stdout, buffer));
+    status = handle_putnotif (stdout, buffer);
   else
   {
     ERROR ("exec plugin: Unable to parse command, ignoring line: \"%s\"",
 	buffer);
     return (-1);
   }
+
+  fflush (stdout);
+  return (status);
 } /* int parse_line }}} */
 
 static void *exec_read_one (void *arg) /* {{{ */
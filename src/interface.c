@@ -100,6 +100,65 @@ static kstat_t *ksp[MAX_NUMIF];
 static int numif = 0;
 #endif /* HAVE_LIBKSTAT */
 
+#if !HAVE_GETIFADDRS && KERNEL_LINUX
+# include "utils_complain.h"
+# include "utils_procfile.h"
+static procfile_t *proc_net_dev;
+
+/*
+ * InfiniBand ports are read from sysfs: The IPoIB network devices in
+ * /proc/net/dev only count IPoIB traffic, not all traffic of the port.
+ */
+# ifndef IB_SYSFS_DIR
+#  define IB_SYSFS_DIR "/sys/class/infiniband"
+# endif
+# define IB_ARPHRD_INFINIBAND 32
+
+typedef struct ib_counter_s
+{
+	procfile_t *file;
+	/* Counters of the performance management agent (PMA) stop at their
+	 * maximum instead of wrapping around, and only ever go down when they
+	 * are reset. Driver counters in hw_counters may wrap around. */
+	_Bool pma;
+	/* The 64 bit counters from the PortCountersExtended attribute. */
+	_Bool extended;
+
+	_Bool have_last;
+	uint64_t last;
+	uint64_t total;
+} ib_counter_t;
+
+typedef struct ib_hw_counter_s
+{
+	char name[DATA_MAX_NAME_LEN];
+	ib_counter_t counter;
+	struct ib_hw_counter_s *next;
+} ib_hw_counter_t;
+
+typedef struct ib_port_s
+{
+	/* The IPoIB device of the port if there is one, "<hca>-<port>"
+	 * otherwise. */
+	char name[DATA_MAX_NAME_LEN];
+	_Bool is_netdev;
+
+	ib_counter_t rx_octets;
+	ib_counter_t tx_octets;
+	ib_counter_t rx_packets;
+	ib_counter_t tx_packets;
+	ib_counter_t rx_errors;
+	ib_counter_t tx_errors;
+	procfile_t *rate;
+	ib_hw_counter_t *hw_counters;
+
+	c_complain_t complaint;
+	struct ib_port_s *next;
+} ib_port_t;
+
+static ib_port_t *ib_ports = NULL;
+#endif
+
 static int interface_config (const char *key, const char *value)
 {
 	if (ignorelist == NULL)
@@ -197,6 +256,369 @@ static void if_submit_rate(const char *dev, const char *type, derive_t rate)
     plugin_dispatch_values (&vl);
 }
 
+#if !HAVE_GETIFADDRS && KERNEL_LINUX
+static void if_submit_hw_counter (const char *dev, const char *name,
+		derive_t value)
+{
+	value_t values[1];
+	value_list_t vl = VALUE_LIST_INIT;
+
+	if (ignorelist_match (ignorelist, dev) != 0)
+		return;
+
+	values[0].derive = value;
+
+	vl.values = values;
+	vl.values_len = 1;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "interface", sizeof (vl.plugin));
+	sstrncpy (vl.plugin_instance, dev, sizeof (vl.plugin_instance));
+	sstrncpy (vl.type, "derive", sizeof (vl.type));
+	sstrncpy (vl.type_instance, name, sizeof (vl.type_instance));
+
+	plugin_dispatch_values (&vl);
+} /* void if_submit_hw_counter */
+
+/* Reads a small sysfs attribute into "buffer" and strips the newline. */
+static int ib_read_attr (const char *dir, const char *name,
+		char *buffer, size_t buffer_size)
+{
+	char path[PATH_MAX];
+	ssize_t len;
+
+	ssnprintf (path, sizeof (path), "%s/%s", dir, name);
+	len = read_file_contents (path, buffer, buffer_size - 1);
+	if (len < 0)
+		return (-1);
+	buffer[len] = 0;
+	strstripnewline (buffer);
+
+	return (0);
+} /* int ib_read_attr */
+
+struct ib_netdev_search_s
+{
+	int port;
+	char name[DATA_MAX_NAME_LEN];
+};
+
+static int ib_netdev_callback (const char *dir, const char *netdev,
+		void *user_data)
+{
+	struct ib_netdev_search_s *search = user_data;
+	char netdev_dir[PATH_MAX];
+	char buffer[32];
+	long port;
+
+	/* Skip partition child devices such as "ib0.8001". */
+	if (strchr (netdev, '.') != NULL)
+		return (0);
+
+	ssnprintf (netdev_dir, sizeof (netdev_dir), "%s/%s", dir, netdev);
+	if ((ib_read_attr (netdev_dir, "type", buffer, sizeof (buffer)) != 0)
+			|| (atoi (buffer) != IB_ARPHRD_INFINIBAND))
+		return (0);
+
+	/* Older kernels only have dev_id, which held the port number then. */
+	if ((ib_read_attr (netdev_dir, "dev_port", buffer, sizeof (buffer)) != 0)
+			&& (ib_read_attr (netdev_dir, "dev_id", buffer, sizeof (buffer)) != 0))
+		return (0);
+	port = strtol (buffer, NULL, 0) + 1;
+
+	if ((port == search->port) && (search->name[0] == 0))
+		sstrncpy (search->name, netdev, sizeof (search->name));
+
+	return (0);
+} /* int ib_netdev_callback */
+
+static int ib_counter_open (ib_counter_t *counter, const char *port_dir,
+		const char *extended_name, const char *name)
+{
+	char path[PATH_MAX];
+
+	counter->pma = 1;
+
+	/* Older drivers export the 64 bit counters separately. Newer kernels
+	 * show the extended counters in "counters" if the HCA has them. */
+	if (extended_name != NULL)
+	{
+		ssnprintf (path, sizeof (path), "%s/counters_ext/%s",
+				port_dir, extended_name);
+		if (access (path, R_OK) == 0)
+		{
+			counter->extended = 1;
+			counter->file = procfile_create (path);
+			return ((counter->file != NULL) ? 0 : -1);
+		}
+	}
+
+	ssnprintf (path, sizeof (path), "%s/counters/%s", port_dir, name);
+	if (access (path, R_OK) != 0)
+		return (-1);
+
+	counter->file = procfile_create (path);
+	return ((counter->file != NULL) ? 0 : -1);
+} /* int ib_counter_open */
+
+static void ib_counter_close (ib_counter_t *counter)
+{
+	procfile_destroy (counter->file);
+	counter->file = NULL;
+}
+
+static int ib_hw_counter_callback (__attribute__((unused)) const char *dir,
+		const char *name, void *user_data)
+{
+	ib_port_t *port = user_data;
+	ib_hw_counter_t *hw;
+	char path[PATH_MAX];
+
+	/* Not a counter but the time the driver caches the values. */
+	if (strcmp ("lifespan", name) == 0)
+		return (0);
+
+	hw = calloc (1, sizeof (*hw));
+	if (hw == NULL)
+		return (-1);
+
+	ssnprintf (path, sizeof (path), "%s/%s", dir, name);
+	sstrncpy (hw->name, name, sizeof (hw->name));
+	hw->counter.file = procfile_create (path);
+	if (hw->counter.file == NULL)
+	{
+		free (hw);
+		return (-1);
+	}
+
+	hw->next = port->hw_counters;
+	port->hw_counters = hw;
+
+	return (0);
+} /* int ib_hw_counter_callback */
+
+static int ib_port_callback (const char *dir, const char *port_num,
+		void *user_data)
+{
+	const char *hca = user_data;
+	struct ib_netdev_search_s search;
+	char port_dir[PATH_MAX];
+	char path[PATH_MAX];
+	ib_port_t *port;
+
+	port = calloc (1, sizeof (*port));
+	if (port == NULL)
+		return (-1);
+	C_COMPLAIN_INIT (&port->complaint);
+
+	/* Name the port like the IPoIB device, which is what its traffic used
+	 * to be reported as. */
+	memset (&search, 0, sizeof (search));
+	search.port = atoi (port_num);
+	ssnprintf (path, sizeof (path), "%s/%s/device/net", IB_SYSFS_DIR, hca);
+	if (access (path, R_OK) == 0)
+		walk_directory (path, ib_netdev_callback, &search,
+				/* include hidden = */ 0);
+	if (search.name[0] != 0)
+	{
+		sstrncpy (port->name, search.name, sizeof (port->name));
+		port->is_netdev = 1;
+	}
+	else
+		ssnprintf (port->name, sizeof (port->name), "%s-%s", hca, port_num);
+
+	ssnprintf (port_dir, sizeof (port_dir), "%s/%s", dir, port_num);
+	ib_counter_open (&port->rx_octets, port_dir,
+			"port_rcv_data_64", "port_rcv_data");
+	ib_counter_open (&port->tx_octets, port_dir,
+			"port_xmit_data_64", "port_xmit_data");
+	ib_counter_open (&port->rx_packets, port_dir,
+			"port_rcv_packets_64", "port_rcv_packets");
+	ib_counter_open (&port->tx_packets, port_dir,
+			"port_xmit_packets_64", "port_xmit_packets");
+	ib_counter_open (&port->rx_errors, port_dir,
+			NULL, "port_rcv_errors");
+	ib_counter_open (&port->tx_errors, port_dir,
+			NULL, "port_xmit_constraint_errors");
+
+	ssnprintf (path, sizeof (path), "%s/rate", port_dir);
+	port->rate = procfile_create (path);
+
+	ssnprintf (path, sizeof (path), "%s/hw_counters", port_dir);
+	if (access (path, R_OK) == 0)
+		walk_directory (path, ib_hw_counter_callback, port,
+				/* include hidden = */ 0);
+
+	INFO ("interface plugin: Found InfiniBand port %s/%s as \"%s\"%s.",
+			hca, port_num, port->name,
+			port->rx_octets.extended ? " with extended counters" : "");
+
+	port->next = ib_ports;
+	ib_ports = port;
+
+	return (0);
+} /* int ib_port_callback */
+
+static int ib_hca_callback (const char *dir, const char *hca,
+		__attribute__((unused)) void *user_data)
+{
+	char path[PATH_MAX];
+
+	ssnprintf (path, sizeof (path), "%s/%s/ports", dir, hca);
+	if (access (path, R_OK) != 0)
+		return (0);
+
+	return (walk_directory (path, ib_port_callback, (void *) hca,
+				/* include hidden = */ 0));
+} /* int ib_hca_callback */
+
+/* Finds all ports of all HCAs. This is repeated until some are found, in
+ * case the drivers are loaded after the daemon is started. */
+static void ib_scan (void)
+{
+	if (ib_ports != NULL)
+		return;
+	if (access (IB_SYSFS_DIR, R_OK) != 0)
+		return;
+
+	walk_directory (IB_SYSFS_DIR, ib_hca_callback, NULL,
+			/* include hidden = */ 0);
+} /* void ib_scan */
+
+static _Bool ib_is_port_netdev (const char *device)
+{
+	ib_port_t *port;
+
+	for (port = ib_ports; port != NULL; port = port->next)
+		if (port->is_netdev && (strcmp (port->name, device) == 0))
+			return (1);
+
+	return (0);
+} /* _Bool ib_is_port_netdev */
+
+/* Reads a counter and returns its sum since the daemon was started, which
+ * neither wraps around nor goes down when the counter is reset. */
+static int ib_counter_read (ib_port_t *port, ib_counter_t *counter,
+		uint64_t *ret_value)
+{
+	char *buffer;
+	char *endptr = NULL;
+	uint64_t value;
+
+	if (counter->file == NULL)
+		return (-1);
+
+	buffer = procfile_read (counter->file, NULL);
+	if (buffer == NULL)
+		return (-1);
+
+	value = procfile_u64 (buffer, &endptr);
+	if (endptr == buffer)
+		return (-1);
+
+	if (!counter->have_last)
+		counter->total = value;
+	else if (value >= counter->last)
+		counter->total += value - counter->last;
+	else if (counter->pma)
+		counter->total += value;
+	else
+		counter->total += counter_diff (counter->last, value);
+
+	if (counter->pma && !counter->extended && (value == UINT32_MAX))
+		c_complain (LOG_WARNING, &port->complaint,
+				"interface plugin: The 32 bit counter %s of the "
+				"InfiniBand port \"%s\" is stuck at its maximum. "
+				"The HCA does not provide extended counters, so the "
+				"counter needs to be reset to count again.",
+				procfile_path (counter->file), port->name);
+
+	counter->have_last = 1;
+	counter->last = value;
+	*ret_value = counter->total;
+	return (0);
+} /* int ib_counter_read */
+
+static void ib_submit_pair (ib_port_t *port, const char *type,
+		ib_counter_t *rx, ib_counter_t *tx, uint64_t factor)
+{
+	uint64_t rx_value;
+	uint64_t tx_value;
+
+	if ((ib_counter_read (port, rx, &rx_value) != 0)
+			|| (ib_counter_read (port, tx, &tx_value) != 0))
+		return;
+
+	if_submit (port->name, type, (derive_t) (factor * rx_value),
+			(derive_t) (factor * tx_value));
+} /* void ib_submit_pair */
+
+static void ib_read (void)
+{
+	ib_port_t *port;
+
+	for (port = ib_ports; port != NULL; port = port->next)
+	{
+		ib_hw_counter_t *hw;
+		char *buffer;
+
+		/* The data counters count units of four octets. */
+		ib_submit_pair (port, "if_octets",
+				&port->rx_octets, &port->tx_octets, 4);
+		ib_submit_pair (port, "if_packets",
+				&port->rx_packets, &port->tx_packets, 1);
+		ib_submit_pair (port, "if_errors",
+				&port->rx_errors, &port->tx_errors, 1);
+
+		/* E.g. "100 Gb/sec (4X EDR)" */
+		if ((buffer = procfile_read (port->rate, NULL)) != NULL)
+			if_submit_rate (port->name, "if_rate",
+					(derive_t) procfile_u64 (buffer, NULL));
+
+		for (hw = port->hw_counters; hw != NULL; hw = hw->next)
+		{
+			uint64_t value;
+
+			if (ib_counter_read (port, &hw->counter, &value) == 0)
+				if_submit_hw_counter (port->name, hw->name,
+						(derive_t) value);
+		}
+	}
+} /* void ib_read */
+
+static int interface_shutdown (void)
+{
+	while (ib_ports != NULL)
+	{
+		ib_port_t *port = ib_ports;
+
+		ib_ports = port->next;
+
+		while (port->hw_counters != NULL)
+		{
+			ib_hw_counter_t *hw = port->hw_counters;
+
+			port->hw_counters = hw->next;
+			ib_counter_close (&hw->counter);
+			free (hw);
+		}
+
+		ib_counter_close (&port->rx_octets);
+		ib_counter_close (&port->tx_octets);
+		ib_counter_close (&port->rx_packets);
+		ib_counter_close (&port->tx_packets);
+		ib_counter_close (&port->rx_errors);
+		ib_counter_close (&port->tx_errors);
+		procfile_destroy (port->rate);
+		free (port);
+	}
+
+	procfile_destroy (proc_net_dev);
+	proc_net_dev = NULL;
+
+	return (0);
+} /* int interface_shutdown */
+#endif /* !HAVE_GETIFADDRS && KERNEL_LINUX */
+
 static int interface_read (void)
 {
 #if HAVE_GETIFADDRS
@@ -252,119 +674,67 @@ static int interface_read (void)
 /* #endif HAVE_GETIFADDRS */
 
 #elif KERNEL_LINUX
-	FILE *fh;
-	char buffer[1024];
-	derive_t incoming, outgoing, rate;
+	char *buffer;
+	char *line;
+	derive_t incoming, outgoing;
 	char *device;
 
 	char *dummy;
 	char *fields[16];
 	int numfields;
 
-    incoming = outgoing = rate = 0;
+	/* Find the InfiniBand ports first, so that their IPoIB devices are
+	 * not reported twice. */
+	ib_scan ();
+
+	if ((proc_net_dev == NULL)
+			&& ((proc_net_dev = procfile_create ("/proc/net/dev")) == NULL))
+		return (-1);
 
-	if ((fh = fopen ("/proc/net/dev", "r")) == NULL)
+	if ((buffer = procfile_read (proc_net_dev, NULL)) == NULL)
 	{
 		char errbuf[1024];
-		WARNING ("interface plugin: fopen: %s",
+		WARNING ("interface plugin: Reading /proc/net/dev failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	while (fgets (buffer, 1024, fh) != NULL)
+	while ((line = procfile_next_line (&buffer)) != NULL)
 	{
-    
-		if (!(dummy = strchr(buffer, ':')))
+		if (!(dummy = strchr(line, ':')))
 			continue;
 		dummy[0] = '\0';
 		dummy++;
 
-		device = buffer;
+		device = line;
 		while (device[0] == ' ')
 			device++;
 
 		if (device[0] == '\0')
 			continue;
 
-		numfields = strsplit (dummy, fields, 16);
+		if (ib_is_port_netdev (device))
+			continue;
+
+		numfields = procfile_split (dummy, fields, 16);
 
 		if (numfields < 11)
 			continue;
 
-        if (strcmp(device, "ib0") != 0 && strcmp(device, "ib1") != 0 ){
-   
-            incoming = atoll (fields[0]);
-            outgoing = atoll (fields[8]);
-            if_submit (device, "if_octets", incoming, outgoing);
-
-            incoming = atoll (fields[1]);
-            outgoing = atoll (fields[9]);
-            if_submit (device, "if_packets", incoming, outgoing);
-
-            incoming = atoll (fields[2]);
-            outgoing = atoll (fields[10]);
-            if_submit (device, "if_errors", incoming, outgoing);
-        }
-	}    
-
-	fclose (fh);
-
-    /*For infiniband stuff, we look at /sys/class/infiniband
-     and not the default for other interfaces
-    TODO: We do it only for port 1, need to do it for other ports
-    */
-    if ((fh = fopen ("/sys/class/infiniband/mlx4_0/ports/1/counters/port_rcv_data", "r")) != NULL){
-        if (fgets (buffer, 1024, fh) != NULL){
-                incoming = atoll (buffer);
-	    }	
-        fclose (fh);
-    }	
-
-    if ((fh = fopen ("/sys/class/infiniband/mlx4_0/ports/1/counters/port_xmit_data", "r")) != NULL){
-        if (fgets (buffer, 1024, fh) != NULL)
-                outgoing = atoll (buffer);
-        fclose (fh);
-    }
-
-    if (incoming != 0 && outgoing != 0)
-        if_submit ("ib0", "if_octets", incoming, outgoing);
- 
-    if ((fh = fopen ("/sys/class/infiniband/mlx4_0/ports/1/counters/port_rcv_errors", "r")) != NULL){
-        if (fgets (buffer, 1024, fh) != NULL)
-                incoming = atoll (buffer);
-        fclose (fh);
-    }
-
-    if ((fh = fopen ("/sys/class/infiniband/mlx4_0/ports/1/counters/port_xmit_constraint_errors", "r")) != NULL){
-        if (fgets (buffer, 1024, fh) != NULL)
-                outgoing = atoll (buffer);
-        fclose (fh);
-    }
-    
-    if (incoming != 0 && outgoing != 0)
-        if_submit ("ib0", "if_errors", incoming, outgoing);
-
-    if ((fh = fopen ("/sys/class/infiniband/mlx4_0/ports/1/counters/port_rcv_packets", "r")) != NULL){
-        if (fgets (buffer, 1024, fh) != NULL)
-                incoming = atoll (buffer);
-        fclose (fh);
-    }
-
-    if ((fh = fopen ("/sys/class/infiniband/mlx4_0/ports/1/counters/port_xmit_packets", "r")) != NULL){
-        if (fgets (buffer, 1024, fh) != NULL)
-                outgoing = atoll (buffer);
-        fclose (fh);
-    }
-
-    if (incoming != 0 && outgoing != 0)
-        if_submit ("ib0", "if_packets", incoming, outgoing);
-
-    if ((fh = fopen ("/sys/class/infiniband/mlx4_0/ports/1/rate", "r")) != NULL){
-        if (fgets (buffer, 3, fh) != NULL)
-                rate = atoll (buffer);
-        fclose (fh);
-        if_submit_rate ("ib0", "if_rate", rate);
-    }
+		incoming = (derive_t) procfile_u64 (fields[0], NULL);
+		outgoing = (derive_t) procfile_u64 (fields[8], NULL);
+		if_submit (device, "if_octets", incoming, outgoing);
+
+		incoming = (derive_t) procfile_u64 (fields[1], NULL);
+		outgoing = (derive_t) procfile_u64 (fields[9], NULL);
+		if_submit (device, "if_packets", incoming, outgoing);
+
+		incoming = (derive_t) procfile_u64 (fields[2], NULL);
+		outgoing = (derive_t) procfile_u64 (fields[10], NULL);
+		if_submit (device, "if_errors", incoming, outgoing);
+	}
+
+	ib_read ();
 
 /* #endif KERNEL_LINUX */
 
@@ -469,4 +839,7 @@ void module_register (void)
 	plugin_register_init ("interface", interface_init);
 #endif
 	plugin_register_read ("interface", interface_read);
+#if !HAVE_GETIFADDRS && KERNEL_LINUX
+	plugin_register_shutdown ("interface", interface_shutdown);
+#endif
 } /* void module_register */
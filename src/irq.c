@@ -26,6 +26,7 @@
 #include "plugin.h"
 #include "configfile.h"
 #include "utils_ignorelist.h"
+#include "utils_procfile.h"
 
 #if !KERNEL_LINUX
 # error "No applicable input method."
@@ -43,6 +44,8 @@ static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static ignorelist_t *ignorelist = NULL;
 
+static procfile_t *proc_interrupts = NULL;
+
 /*
  * Private functions
  */
@@ -92,8 +95,8 @@ static void irq_submit (const char *irq_name, derive_t value)
 
 static int irq_read (void)
 {
-	FILE *fh;
-	char buffer[1024];
+	char *buffer;
+	char *line;
 	int  cpu_count;
 	char *fields[256];
 
@@ -104,18 +107,23 @@ static int irq_read (void)
 	 * 1:     102553     158669     218062      70587   IO-APIC-edge      i8042
 	 * 8:          0          0          0          1   IO-APIC-edge      rtc0
 	 */
-	fh = fopen ("/proc/interrupts", "r");
-	if (fh == NULL)
+	if ((proc_interrupts == NULL)
+			&& ((proc_interrupts = procfile_create ("/proc/interrupts")) == NULL))
+		return (-1);
+
+	buffer = procfile_read (proc_interrupts, NULL);
+	if (buffer == NULL)
 	{
 		char errbuf[1024];
-		ERROR ("irq plugin: fopen (/proc/interrupts): %s",
+		ERROR ("irq plugin: Reading /proc/interrupts failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	/* Get CPU count from the first line */
-	if(fgets (buffer, sizeof (buffer), fh) != NULL) {
-		cpu_count = strsplit (buffer, fields,
+	/* Get CPU count from the first line. The file is read as a whole, so
+	 * lines longer than any fixed buffer on hosts with many CPUs are fine. */
+	if ((line = procfile_next_line (&buffer)) != NULL) {
+		cpu_count = procfile_split (line, fields,
 				STATIC_ARRAY_SIZE (fields));
 	} else {
 		ERROR ("irq plugin: unable to get CPU count from first line "
@@ -123,7 +131,7 @@ static int irq_read (void)
 		return (-1);
 	}
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	while ((line = procfile_next_line (&buffer)) != NULL)
 	{
 		char *irq_name;
 		size_t irq_name_len;
@@ -132,7 +140,7 @@ static int irq_read (void)
 		int fields_num;
 		int irq_values_to_parse;
 
-		fields_num = strsplit (buffer, fields,
+		fields_num = procfile_split (line, fields,
 				STATIC_ARRAY_SIZE (fields));
 		if (fields_num < 2)
 			continue;
@@ -162,14 +170,14 @@ static int irq_read (void)
 		for (i = 1; i <= irq_values_to_parse; i++)
 		{
 			/* Per-CPU value */
-			value_t v;
-			int status;
+			char *endptr = NULL;
+			derive_t v;
 
-			status = parse_value (fields[i], &v, DS_TYPE_DERIVE);
-			if (status != 0)
+			v = (derive_t) procfile_u64 (fields[i], &endptr);
+			if ((endptr == fields[i]) || (*endptr != 0))
 				break;
 
-			irq_value += v.derive;
+			irq_value += v;
 		} /* for (i) */
 
 		/* No valid fields -> do not submit anything. */
@@ -179,8 +187,6 @@ static int irq_read (void)
 		irq_submit (irq_name, irq_value);
 	}
 
-	fclose (fh);
-
 	return (0);
 } /* int irq_read */
 
@@ -20,10 +20,14 @@
  *   Christiane Pousa < pousa at ethz.ch >
  **/
 
+
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_avltree.h"
+#include "utils_cgroup_watch.h"
+#include "utils_proc_events.h"
 
 #include <ctype.h>
 
@@ -36,67 +40,89 @@
 #  endif
 
 #include <sys/stat.h>
-
-#define MAXPID 65536
+#include <sys/resource.h>
 /* #endif KERNEL_LINUX */
 #endif
 
-#if HAVE_REGEX_H
-# include <regex.h>
-#endif
-
-#ifndef CMDLINE_BUFFER_SIZE
-# if defined(ARG_MAX) && (ARG_MAX < 4096)
-#  define CMDLINE_BUFFER_SIZE ARG_MAX
-# else
-#  define CMDLINE_BUFFER_SIZE 4096
-# endif
+#ifndef O_CLOEXEC
+# define O_CLOEXEC 0
 #endif
 
-typedef struct procstat_entry_s
+#define JM_CGROUP_PATH "/cgroup/cpuset/lsf/euler"
+#define JM_CPUACCT_PATH "/cgroup/cpuacct/lsf/euler"
+#define JM_MEMORY_PATH "/cgroup/memory/lsf/euler"
+#define JM_BLKIO_PATH "/cgroup/blkio/lsf/euler"
+#define JM_NAME_LEN 256
+
+/* Where the values of a job come from: the sum over its processes in /proc
+ * or the accounting of the job's cgroups. */
+#define JM_MODE_PROCESSES 0
+#define JM_MODE_CGROUP    1
+
+/* Cgroup files read per job in cgroup mode. With cgroup v2 all of them live
+ * in the job's directory, CPU_USAGE and IO_OPS are not used there. */
+enum {
+	JM_CG_CPU_USAGE = 0,
+	JM_CG_CPU_STAT,
+	JM_CG_MEM_USAGE,
+	JM_CG_MEM_MAX,
+	JM_CG_MEM_STAT,
+	JM_CG_IO_BYTES,
+	JM_CG_IO_OPS,
+	JM_CG_FILES_NUM
+};
+
+typedef struct jm_job_s jm_job_t;
+
+/* One task listed in the "tasks" file of a job. Threads and LSF helper
+ * processes are kept with "ignore" set, so that they are only inspected
+ * once. The descriptors of the /proc files are kept open between reads.
+ * Processes learned from fork and exec events have "check" set until they
+ * have been inspected. */
+typedef struct jm_process_s
 {
-	unsigned long id;
-	unsigned long age;
-
-	unsigned long num_proc;
-	unsigned long num_lwp;
-	unsigned long vmem_size;
-	unsigned long vmem_rss;
-	unsigned long vmem_data;
-	unsigned long vmem_code;
-	unsigned long stack_size;
-    unsigned long voluntary_ctxt_switches;
-    unsigned long nonvoluntary_ctxt_switches;
-
-	unsigned long vmem_minflt;
-	unsigned long vmem_majflt;
-	derive_t      vmem_minflt_counter;
-	derive_t      vmem_majflt_counter;
-
-	unsigned long cpu_user;
-	unsigned long cpu_system;
-	derive_t      cpu_user_counter;
-	derive_t      cpu_system_counter;
-
-	/* io data */
+	pid_t pid;
+	jm_job_t *job;
+	_Bool ignore;
+	_Bool check;
+	_Bool no_io;
+	unsigned long generation;
+
+	int fd_stat;
+	int fd_status;
+	int fd_io;
+
+	/* last values read, used to add deltas to the job's counters */
+	derive_t cpu_user;
+	derive_t cpu_system;
+	derive_t vmem_minflt;
+	derive_t vmem_majflt;
 	derive_t io_rchar;
 	derive_t io_wchar;
 	derive_t io_syscr;
 	derive_t io_syscw;
 
-	struct procstat_entry_s *next;
-} procstat_entry_t;
+	struct jm_process_s *next;
+} jm_process_t;
 
-#define PROCSTAT_NAME_LEN 256
-typedef struct procstat
+/* One LSF job, i.e. one directory below the cgroup path. */
+struct jm_job_s
 {
-	char          name[PROCSTAT_NAME_LEN];
-    char          jobId[PROCSTAT_NAME_LEN];
-    char          username[256];
-                
-#if HAVE_REGEX_H
-	regex_t *re;
-#endif
+	char dirname[JM_NAME_LEN];
+	char jobId[JM_NAME_LEN];
+	char username[DATA_MAX_NAME_LEN];
+	unsigned long generation;
+
+	int fd_tasks;
+	jm_process_t *processes;
+
+	/* cgroup mode only: cached descriptors, files known to be missing and
+	 * the read at which the processes are inspected next */
+	int fd_cgroup[JM_CG_FILES_NUM];
+	unsigned int cgroup_missing;
+	unsigned long next_sample;
+	_Bool active;
+
 	unsigned long num_proc;
 	unsigned long num_lwp;
 	unsigned long vmem_size;
@@ -104,336 +130,227 @@ typedef struct procstat
 	unsigned long vmem_data;
 	unsigned long vmem_code;
 	unsigned long stack_size;
-    unsigned long voluntary_ctxt_switches;
-    unsigned long nonvoluntary_ctxt_switches;
+	unsigned long voluntary_ctxt_switches;
+	unsigned long nonvoluntary_ctxt_switches;
 
+	/* Counters are kept across reads and only grow, processes which
+	 * exit leave their share behind. */
 	derive_t vmem_minflt_counter;
 	derive_t vmem_majflt_counter;
-
 	derive_t cpu_user_counter;
 	derive_t cpu_system_counter;
 
-	/* io data */
+	_Bool have_cpu;
+	_Bool have_faults;
+	_Bool have_io;
 	derive_t io_rchar;
 	derive_t io_wchar;
 	derive_t io_syscr;
 	derive_t io_syscw;
 
-	struct procstat   *next;
-	struct procstat_entry_s *instances;
-} procstat_t;
+	/* cgroup mode only */
+	_Bool have_memory;
+	derive_t cpu_usage;
+	unsigned long mem_usage;
+	unsigned long mem_max_usage;
+	unsigned long mem_cache;
 
-static procstat_t *list_head_g = NULL;
+	/* used to collect jobs which are to be removed */
+	jm_job_t *next_removed;
+};
 
-#if KERNEL_LINUX
-static long pagesize_g;
-/* #endif KERNEL_LINUX */
-#endif 
+static char *conf_cgroup_path = NULL;
+static char *conf_cpuacct_path = NULL;
+static char *conf_memory_path = NULL;
+static char *conf_blkio_path = NULL;
+static int   conf_max_open_files = -1;
+static int   conf_mode = JM_MODE_PROCESSES;
+static int   conf_process_interval = 10;
+static _Bool conf_process_events = 1;
 
-/* try to match jobId against entry, returns 1 if success */
-static int jobmetrics_list_match (const char *jobId, const char *name, const char *cmdline, procstat_t *ps)
-{
-#if HAVE_REGEX_H
-	if (ps->re != NULL)
-	{
-		int status;
-		const char *str;
+/* set if CgroupPath is part of a cgroup v2 hierarchy */
+static _Bool cgroup_v2 = 0;
 
-		str = cmdline;
-		if ((str == NULL) || (str[0] == 0))
-			str = jobId;
+/* jobs by directory name and tasks by PID */
+static c_avl_tree_t *jobs_g = NULL;
+static c_avl_tree_t *pids_g = NULL;
 
-		assert (str != NULL);
+static unsigned long generation_g = 0;
 
-		status = regexec (ps->re, str,
-				/* nmatch = */ 0,
-				/* pmatch = */ NULL,
-				/* eflags = */ 0);
-		if (status == 0 && strcmp (ps->jobId, jobId) == 0)
-			return (1);
-	}
-	else
+static long fds_open_g = 0;
+static long fds_max_g = 0;
+
+static char  *tasks_buffer_g = NULL;
+static size_t tasks_buffer_size_g = 0;
+
+#if KERNEL_LINUX
+static long pagesize_g;
+/* #endif KERNEL_LINUX */
 #endif
-	if (strcmp (ps->jobId, jobId) == 0 && strcmp (ps->name, name) == 0)
-		            return (1);
 
-	return (0);
-} /* int jobmetrics_list_match */
+static cgroup_watch_t *watch_g = NULL;
 
+/* process events: forked children are added to their parent's job right
+ * away and exiting processes leave their final counters behind */
+static procev_subscriber_t *procev_g = NULL;
 
-/* remove process entry for jobs that have already finished*/
-static void jobmetrics_list_remove(const char *jobId)
-{
-    procstat_t *ps, *ps_ahead, *ps_behind;
-    int found = 0 ;
-
-    ps = ps_ahead = ps_behind = NULL;
-    
-    if (list_head_g != NULL)
-    {
-        ps = list_head_g;
-        while (ps != NULL){
-            if (strcmp(ps->jobId, jobId) == 0)
-            {
-                ps_ahead = ps->next;
-                found = 1;
-                break;
-            }
-            ps_behind = ps;
-            ps = ps->next;        
-        }
-
-        if (found == 1){
-            if (ps_behind == ps)
-                ps_behind = NULL;
-            else if (ps_behind != NULL)
-                ps_behind->next = ps_ahead;
-            if (list_head_g == ps)
-                list_head_g = ps_ahead;
-
-            free(ps);
-        }
-    }/*end if there is any entry on the list*/
-}
-
-
-/* add process entry to 'instances' of process 'name' and job jobId (or refresh it)*/
-static void jobmetrics_list_add (const char *jobId, const char *name, const char *username, const char *cmdline, procstat_entry_t *entry)
+static int jm_pid_compare (const void *a, const void *b)
 {
-	procstat_t *ps;
-    procstat_t *new;
-    procstat_t *ptr;
-	procstat_entry_t *pse;
-    int already_added;
+	pid_t pid_a = *((const pid_t *) a);
+	pid_t pid_b = *((const pid_t *) b);
+
+	if (pid_a < pid_b)
+		return (-1);
+	else if (pid_a > pid_b)
+		return (1);
+	return (0);
+} /* int jm_pid_compare */
 
-	if (entry->id == 0)
+static void jm_fd_close (int *fd)
+{
+	if (*fd < 0)
 		return;
 
+	close (*fd);
+	*fd = -1;
+	fds_open_g--;
+} /* void jm_fd_close */
+
+/* Reads the file "path" into "buffer" and null-terminates it. The
+ * descriptor is cached in "fd" and the file is re-read with pread(2) on
+ * the next call, as long as fewer than "MaxOpenFiles" descriptors are
+ * cached. Otherwise the file is opened and closed for this read only.
+ * Returns the number of bytes read or -1 on error. */
+static ssize_t jm_read_file (int *fd, const char *path,
+		char *buffer, size_t buffer_size)
+{
+	int read_fd;
+	int tmp_fd = -1;
+	size_t len = 0;
 
-    /*Since we do not register jobs, they come and go very fast, 
-    we need to add them before uptading the list*/
-    if (list_head_g == NULL)
-    {
-        new = (procstat_t *) malloc (sizeof (procstat_t));
-        if (new == NULL)
-        {
-                ERROR ("jobmetrics plugin: jobmetrics_list_register: malloc failed.");
-                return;
-        }
-        memset (new, 0, sizeof (procstat_t));
-        sstrncpy (new->name, name, sizeof (new->name));
-        sstrncpy (new->jobId, jobId, sizeof (new->jobId));
-        sstrncpy (new->username, username, sizeof (new->username));
-        list_head_g = new;
-    }
-    else
-    {
-        ps = list_head_g;
-        already_added = 0;
-
-        while (ps != NULL)
-        {
-                if (jobmetrics_list_match (jobId, name, cmdline, ps) != 0)
-                { 
-                    already_added = 1; 
-                    break;
-                }
-                ps = ps->next;
-        }
-
-        /*no job added with this id and name, add it to the jobs list*/
-        if (! already_added)
-        {
-            new = (procstat_t *) malloc (sizeof (procstat_t));
-            if (new == NULL)
-            {
-                ERROR ("jobmetrics plugin: jobmetrics_list_register: malloc failed.");
-                return;
-            }
-            memset (new, 0, sizeof (procstat_t));
-            sstrncpy (new->name, name, sizeof (new->name));
-            sstrncpy (new->username, username, sizeof (new->username));
-            sstrncpy (new->jobId, jobId, sizeof (new->jobId));
-            for (ptr = list_head_g; ptr != NULL; ptr = ptr->next)
-                if (ptr->next == NULL)
-                        break;
-            ptr->next = new;
-        }
-    }/*end create entry on the list*/
-
-    /*Now, we update the jobs that have been already added
-    The follwoing code is the same as processes.c
-    We just added more metrics and the jobid for LSF jobs
-    */
-	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	if (*fd < 0)
 	{
+		tmp_fd = open (path, O_RDONLY | O_CLOEXEC);
+		if (tmp_fd < 0)
+			return (-1);
 
-		if ((jobmetrics_list_match (jobId, name, cmdline, ps)) == 0){
-			continue;
-		}
-        
-		for (pse = ps->instances; pse != NULL; pse = pse->next)
-			if ((pse->id == entry->id) || (pse->next == NULL))
-				break;
-
-		if ((pse == NULL) || (pse->id != entry->id))
+		if (fds_open_g < fds_max_g)
 		{
-			procstat_entry_t *new;
-
-			new = (procstat_entry_t *) malloc (sizeof (procstat_entry_t));
-			if (new == NULL)
-				return;
-			memset (new, 0, sizeof (procstat_entry_t));
-			new->id = entry->id;
-
-			if (pse == NULL)
-				ps->instances = new;
-			else
-				pse->next = new;
-
-			pse = new;
+			*fd = tmp_fd;
+			fds_open_g++;
+			tmp_fd = -1;
 		}
+	}
 
-		pse->age = 0;
-		pse->num_proc   = entry->num_proc;
-		pse->num_lwp    = entry->num_lwp;
-		pse->vmem_size  = entry->vmem_size;
-		pse->vmem_rss   = entry->vmem_rss;
-		pse->vmem_data  = entry->vmem_data;
-		pse->vmem_code  = entry->vmem_code;
-		pse->stack_size = entry->stack_size;
-		pse->io_rchar   = entry->io_rchar;
-		pse->io_wchar   = entry->io_wchar;
-		pse->io_syscr   = entry->io_syscr;
-		pse->io_syscw   = entry->io_syscw;
-        pse->voluntary_ctxt_switches = entry->voluntary_ctxt_switches;
-        pse->nonvoluntary_ctxt_switches = entry->nonvoluntary_ctxt_switches;
-
-        ps->num_proc   += pse->num_proc;
-		ps->num_lwp    += pse->num_lwp;
-		ps->vmem_size  += pse->vmem_size;
-		ps->vmem_rss   += pse->vmem_rss;
-		ps->vmem_data  += pse->vmem_data;
-		ps->vmem_code  += pse->vmem_code;
-		ps->stack_size += pse->stack_size;
-
-		ps->io_rchar   += ((pse->io_rchar == -1)?0:pse->io_rchar);
-		ps->io_wchar   += ((pse->io_wchar == -1)?0:pse->io_wchar);
-		ps->io_syscr   += ((pse->io_syscr == -1)?0:pse->io_syscr);
-		ps->io_syscw   += ((pse->io_syscw == -1)?0:pse->io_syscw);
-    
-        ps->voluntary_ctxt_switches += pse->voluntary_ctxt_switches;
-        ps->nonvoluntary_ctxt_switches += pse->nonvoluntary_ctxt_switches;
-
-		if ((entry->vmem_minflt_counter == 0)
-				&& (entry->vmem_majflt_counter == 0))
-		{
-			pse->vmem_minflt_counter += entry->vmem_minflt;
-			pse->vmem_minflt = entry->vmem_minflt;
+	read_fd = (tmp_fd >= 0) ? tmp_fd : *fd;
+	while (len < buffer_size - 1)
+	{
+		ssize_t status;
 
-			pse->vmem_majflt_counter += entry->vmem_majflt;
-			pse->vmem_majflt = entry->vmem_majflt;
-		}
-		else
+		status = pread (read_fd, buffer + len, buffer_size - 1 - len,
+				(off_t) len);
+		if ((status < 0) && (errno == EINTR))
+			continue;
+		if (status < 0)
 		{
-			if (entry->vmem_minflt_counter < pse->vmem_minflt_counter)
-			{
-				pse->vmem_minflt = entry->vmem_minflt_counter
-					+ (ULONG_MAX - pse->vmem_minflt_counter);
-			}
-			else
-			{
-				pse->vmem_minflt = entry->vmem_minflt_counter - pse->vmem_minflt_counter;
-			}
-			pse->vmem_minflt_counter = entry->vmem_minflt_counter;
-
-			if (entry->vmem_majflt_counter < pse->vmem_majflt_counter)
-			{
-				pse->vmem_majflt = entry->vmem_majflt_counter
-					+ (ULONG_MAX - pse->vmem_majflt_counter);
-			}
+			if (tmp_fd >= 0)
+				close (tmp_fd);
 			else
-			{
-				pse->vmem_majflt = entry->vmem_majflt_counter - pse->vmem_majflt_counter;
-			}
-			pse->vmem_majflt_counter = entry->vmem_majflt_counter;
+				jm_fd_close (fd);
+			return (-1);
 		}
+		if (status == 0)
+			break;
+		len += (size_t) status;
+	}
+
+	if (tmp_fd >= 0)
+		close (tmp_fd);
 
-		ps->vmem_minflt_counter += pse->vmem_minflt;
-		ps->vmem_majflt_counter += pse->vmem_majflt;
-    
-        pse->cpu_user_counter += entry->cpu_user_counter;
-        pse->cpu_user = entry->cpu_user_counter;
+	buffer[len] = 0;
+	return ((ssize_t) len);
+} /* ssize_t jm_read_file */
 
-        pse->cpu_system_counter += entry->cpu_system_counter;
-        pse->cpu_system = entry->cpu_system_counter;
+/* Returns the value following "key" in a /proc/<pid>/status style buffer,
+ * or NULL if there is no such line. */
+static const char *jm_status_field (const char *buffer, const char *key)
+{
+	size_t key_len = strlen (key);
+	const char *ptr = buffer;
+
+	while (ptr != NULL)
+	{
+		if (strncmp (ptr, key, key_len) == 0)
+			return (ptr + key_len);
 
-        ps->cpu_user_counter   += pse->cpu_user;
-        ps->cpu_system_counter += pse->cpu_system;
+		ptr = strchr (ptr, '\n');
+		if (ptr != NULL)
+			ptr++;
 	}
-}/*end list_add */
 
-/* remove old entries from instances of jobs in list_head_g */
-static void jobmetrics_list_reset (void)
+	return (NULL);
+} /* const char *jm_status_field */
+
+/* Adds the increase of the counter "value" since the last read to "sum".
+ * The first value read for a process is added completely. The counters of
+ * a process never decrease, but the final values reported by taskstats are
+ * not rounded like the ones in /proc and may be slightly smaller. */
+static void jm_account (derive_t *last, derive_t value, derive_t *sum)
 {
-	procstat_t *ps;
-	procstat_entry_t *pse;
-	procstat_entry_t *pse_prev;
+	if (value > *last)
+		*sum += value - *last;
+	*last = value;
+} /* void jm_account */
 
-	ps = NULL;
-	pse = NULL;
-	pse_prev = NULL;
+static int jobmetrics_config (oconfig_item_t *ci)
+{
+	int i;
 
-	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	for (i = 0; i < ci->children_num; i++)
 	{
-		ps->num_proc    = 0;
-		ps->num_lwp     = 0;
-		ps->vmem_size   = 0;
-		ps->vmem_rss    = 0;
-		ps->vmem_data   = 0;
-		ps->vmem_code   = 0;
-		ps->stack_size  = 0;
-        ps->voluntary_ctxt_switches    = 0;  
-        ps->nonvoluntary_ctxt_switches = 0;
-        ps->cpu_user_counter = 0;
-        ps->cpu_system_counter = 0;
-		ps->io_rchar = -1;
-		ps->io_wchar = -1;
-		ps->io_syscr = -1;
-		ps->io_syscw = -1;
-
-		pse_prev = NULL;
-		pse = ps->instances;
-		while (pse != NULL)
+		oconfig_item_t *child = ci->children + i;
+
+		if (strcasecmp ("CgroupPath", child->key) == 0)
+			cf_util_get_string (child, &conf_cgroup_path);
+		else if (strcasecmp ("CpuacctPath", child->key) == 0)
+			cf_util_get_string (child, &conf_cpuacct_path);
+		else if (strcasecmp ("MemoryPath", child->key) == 0)
+			cf_util_get_string (child, &conf_memory_path);
+		else if (strcasecmp ("BlkioPath", child->key) == 0)
+			cf_util_get_string (child, &conf_blkio_path);
+		else if (strcasecmp ("MaxOpenFiles", child->key) == 0)
+			cf_util_get_int (child, &conf_max_open_files);
+		else if (strcasecmp ("ProcessEvents", child->key) == 0)
+			cf_util_get_boolean (child, &conf_process_events);
+		else if (strcasecmp ("ProcessInterval", child->key) == 0)
 		{
-			if (pse->age > 10)
-			{
-				DEBUG ("Removing this procstat entry cause it's too old: "
-						"id = %lu; name = %s;",
-						pse->id, ps->name);
-
-				if (pse_prev == NULL)
-				{
-					ps->instances = pse->next;
-					free (pse);
-					pse = ps->instances;
-				}
-				else
-				{
-					pse_prev->next = pse->next;
-					free (pse);
-					pse = pse_prev->next;
-				}
-			}
+			cf_util_get_int (child, &conf_process_interval);
+			if (conf_process_interval < 1)
+				conf_process_interval = 1;
+		}
+		else if (strcasecmp ("AccountingMode", child->key) == 0)
+		{
+			char *mode = NULL;
+
+			if (cf_util_get_string (child, &mode) != 0)
+				continue;
+
+			if (strcasecmp ("Processes", mode) == 0)
+				conf_mode = JM_MODE_PROCESSES;
+			else if (strcasecmp ("Cgroup", mode) == 0)
+				conf_mode = JM_MODE_CGROUP;
 			else
-			{
-				pse->age++;
-				pse_prev = pse;
-				pse = pse->next;
-			}
-		} 
+				WARNING ("jobmetrics plugin: Unknown accounting mode `%s'.",
+						mode);
+			sfree (mode);
+		}
+		else
+			WARNING ("jobmetrics plugin: Ignoring unknown config option `%s'.",
+					child->key);
 	}
-}
+
+	return (0);
+} /* int jobmetrics_config */
 
 static int jobmetrics_init (void)
 {
@@ -442,11 +359,99 @@ static int jobmetrics_init (void)
 	DEBUG ("pagesize_g = %li; CONFIG_HZ = %i;", pagesize_g, CONFIG_HZ);
 /* #endif KERNEL_LINUX */
 #endif
+
+	if (conf_cgroup_path == NULL)
+		conf_cgroup_path = strdup (JM_CGROUP_PATH);
+	if (conf_cpuacct_path == NULL)
+		conf_cpuacct_path = strdup (JM_CPUACCT_PATH);
+	if (conf_memory_path == NULL)
+		conf_memory_path = strdup (JM_MEMORY_PATH);
+	if (conf_blkio_path == NULL)
+		conf_blkio_path = strdup (JM_BLKIO_PATH);
+	if ((conf_cgroup_path == NULL) || (conf_cpuacct_path == NULL)
+			|| (conf_memory_path == NULL) || (conf_blkio_path == NULL))
+	{
+		ERROR ("jobmetrics plugin: strdup failed.");
+		return (-1);
+	}
+
+	/* A unified (v2) hierarchy has all controllers in the job's directory
+	 * and lists the processes of a job in "cgroup.procs". */
+	{
+		char filename[PATH_MAX];
+
+		ssnprintf (filename, sizeof (filename), "%s/cgroup.controllers",
+				conf_cgroup_path);
+		cgroup_v2 = (access (filename, R_OK) == 0);
+		INFO ("jobmetrics plugin: Reading jobs from cgroup v%i in %s mode.",
+				cgroup_v2 ? 2 : 1,
+				(conf_mode == JM_MODE_CGROUP) ? "cgroup" : "processes");
+	}
+
+	/* Leave half of the descriptors to the rest of the daemon unless the
+	 * limit has been configured explicitly. */
+	if (conf_max_open_files >= 0)
+		fds_max_g = conf_max_open_files;
+	else
+	{
+		struct rlimit rl;
+
+		if (getrlimit (RLIMIT_NOFILE, &rl) != 0)
+			fds_max_g = 512;
+		else if (rl.rlim_cur == RLIM_INFINITY)
+			fds_max_g = 4096;
+		else
+			fds_max_g = (long) (rl.rlim_cur / 2);
+	}
+
+	if (jobs_g == NULL)
+		jobs_g = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+	if (pids_g == NULL)
+		pids_g = c_avl_create (jm_pid_compare);
+	if ((jobs_g == NULL) || (pids_g == NULL))
+	{
+		ERROR ("jobmetrics plugin: c_avl_create failed.");
+		return (-1);
+	}
+
+	if (watch_g == NULL)
+		watch_g = cgroup_watch_create ("jobmetrics", conf_cgroup_path,
+				/* depth = */ 1);
+	if (watch_g == NULL)
+	{
+		ERROR ("jobmetrics plugin: cgroup_watch_create failed.");
+		return (-1);
+	}
+
+	if (tasks_buffer_g == NULL)
+	{
+		tasks_buffer_size_g = 4096;
+		tasks_buffer_g = malloc (tasks_buffer_size_g);
+		if (tasks_buffer_g == NULL)
+		{
+			ERROR ("jobmetrics plugin: malloc failed.");
+			return (-1);
+		}
+	}
+
+	/* The cgroup controllers account for exited processes themselves. */
+	if ((conf_mode == JM_MODE_PROCESSES) && conf_process_events
+			&& (procev_g == NULL))
+	{
+		procev_g = procev_subscribe ();
+		if (procev_g == NULL)
+			NOTICE ("jobmetrics plugin: Process events are not available, "
+					"processes exiting between reads are not accounted for.");
+		else if (!procev_have_accounting ())
+			NOTICE ("jobmetrics plugin: Taskstats are not available, "
+					"processes exiting between reads are not accounted for.");
+	}
+
 	return (0);
 } /* int jobmetrics_init */
 
 /* submit info about specific job (e.g.: memory taken, cpu usage, etc..) */
-static void jobmetrics_submit_proc_list (procstat_t *ps)
+static void jobmetrics_submit_job (jm_job_t *job)
 {
 
 	value_t values[2];
@@ -456,831 +461,1029 @@ static void jobmetrics_submit_proc_list (procstat_t *ps)
 	vl.values_len = 2;
 	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
 	sstrncpy (vl.plugin, "job", sizeof (vl.plugin));
-	sstrncpy (vl.plugin_instance, ps->jobId, sizeof (vl.plugin_instance));
+	sstrncpy (vl.plugin_instance, job->jobId, sizeof (vl.plugin_instance));
+	sstrncpy (vl.type_instance, job->username, sizeof (vl.type_instance));
 
 	sstrncpy (vl.type, "jm_vm", sizeof (vl.type));
-    sstrncpy (vl.type_instance, ps->username, sizeof (vl.type_instance));
-	vl.values[0].gauge = ps->vmem_size;
+	vl.values[0].gauge = job->vmem_size;
 	vl.values_len = 1;
 	plugin_dispatch_values (&vl);
 
 	sstrncpy (vl.type, "jm_rss", sizeof (vl.type));
-    sstrncpy (vl.type_instance, ps->username, sizeof (vl.type_instance));
-	vl.values[0].gauge = ps->vmem_rss;
+	vl.values[0].gauge = job->vmem_rss;
 	vl.values_len = 1;
 	plugin_dispatch_values (&vl);
 
 	sstrncpy (vl.type, "jm_data", sizeof (vl.type));
-    sstrncpy (vl.type_instance, ps->username, sizeof (vl.type_instance));
-	vl.values[0].gauge = ps->vmem_data;
+	vl.values[0].gauge = job->vmem_data;
 	vl.values_len = 1;
 	plugin_dispatch_values (&vl);
 
 	sstrncpy (vl.type, "jm_code", sizeof (vl.type));
-    sstrncpy (vl.type_instance, ps->username, sizeof (vl.type_instance));
-	vl.values[0].gauge = ps->vmem_code;
+	vl.values[0].gauge = job->vmem_code;
 	vl.values_len = 1;
 	plugin_dispatch_values (&vl);
 
 	sstrncpy (vl.type, "jm_stacksize", sizeof (vl.type));
-    sstrncpy (vl.type_instance, ps->username, sizeof (vl.type_instance));
-	vl.values[0].gauge = ps->stack_size;
+	vl.values[0].gauge = job->stack_size;
 	vl.values_len = 1;
 	plugin_dispatch_values (&vl);
-    
-    sstrncpy (vl.type, "jm_ctxt", sizeof (vl.type));
-    sstrncpy (vl.type_instance, ps->username, sizeof (vl.type_instance));
-    vl.values[0].gauge = ps->voluntary_ctxt_switches;
-    vl.values_len = 1;
-    plugin_dispatch_values (&vl);    
-
-    sstrncpy (vl.type, "jm_nonctxt", sizeof (vl.type));
-    sstrncpy (vl.type_instance, ps->username, sizeof (vl.type_instance));
-    vl.values[0].gauge = ps->nonvoluntary_ctxt_switches;
-    vl.values_len = 1;
-    plugin_dispatch_values (&vl);    
-
-	sstrncpy (vl.type, "jm_cputime", sizeof (vl.type));
-    sstrncpy (vl.type_instance, ps->username, sizeof (vl.type_instance));
-	vl.values[0].derive = ps->cpu_user_counter;
-	vl.values[1].derive = ps->cpu_system_counter;
-	vl.values_len = 2;
+
+	sstrncpy (vl.type, "jm_ctxt", sizeof (vl.type));
+	vl.values[0].gauge = job->voluntary_ctxt_switches;
+	vl.values_len = 1;
 	plugin_dispatch_values (&vl);
 
-	sstrncpy (vl.type, "jm_count", sizeof (vl.type));
-    sstrncpy (vl.type_instance, ps->username, sizeof (vl.type_instance));
-	vl.values[0].gauge = ps->num_proc;
-	vl.values[1].gauge = ps->num_lwp;
-	vl.values_len = 2;
+	sstrncpy (vl.type, "jm_nonctxt", sizeof (vl.type));
+	vl.values[0].gauge = job->nonvoluntary_ctxt_switches;
+	vl.values_len = 1;
 	plugin_dispatch_values (&vl);
 
-	sstrncpy (vl.type, "jm_pagefaults", sizeof (vl.type));
-    sstrncpy (vl.type_instance, ps->username, sizeof (vl.type_instance));
-	vl.values[0].derive = ps->vmem_minflt_counter;
-	vl.values[1].derive = ps->vmem_majflt_counter;
+	/* Convert jiffies to seconds */
+	if (job->have_cpu)
+	{
+		sstrncpy (vl.type, "jm_cputime", sizeof (vl.type));
+		vl.values[0].derive = job->cpu_user_counter / CONFIG_HZ;
+		vl.values[1].derive = job->cpu_system_counter / CONFIG_HZ;
+		vl.values_len = 2;
+		plugin_dispatch_values (&vl);
+	}
+
+	sstrncpy (vl.type, "jm_count", sizeof (vl.type));
+	vl.values[0].gauge = job->num_proc;
+	vl.values[1].gauge = job->num_lwp;
 	vl.values_len = 2;
 	plugin_dispatch_values (&vl);
 
-	if ( (ps->io_rchar != -1) && (ps->io_wchar != -1) )
+	if (job->have_faults)
 	{
-		sstrncpy (vl.type, "jm_disk_octets", sizeof (vl.type));
-        sstrncpy (vl.type_instance, ps->username, sizeof (vl.type_instance));
-		vl.values[0].derive = ps->io_rchar;
-		vl.values[1].derive = ps->io_wchar;
+		sstrncpy (vl.type, "jm_pagefaults", sizeof (vl.type));
+		vl.values[0].derive = job->vmem_minflt_counter;
+		vl.values[1].derive = job->vmem_majflt_counter;
 		vl.values_len = 2;
 		plugin_dispatch_values (&vl);
 	}
 
-	if ( (ps->io_syscr != -1) && (ps->io_syscw != -1) )
+	if (job->have_io)
 	{
+		sstrncpy (vl.type, "jm_disk_octets", sizeof (vl.type));
+		vl.values[0].derive = job->io_rchar;
+		vl.values[1].derive = job->io_wchar;
+		vl.values_len = 2;
+		plugin_dispatch_values (&vl);
+
 		sstrncpy (vl.type, "jm_disk_ops", sizeof (vl.type));
-        sstrncpy (vl.type_instance, ps->username, sizeof (vl.type_instance));
-		vl.values[0].derive = ps->io_syscr;
-		vl.values[1].derive = ps->io_syscw;
+		vl.values[0].derive = job->io_syscr;
+		vl.values[1].derive = job->io_syscw;
 		vl.values_len = 2;
 		plugin_dispatch_values (&vl);
 	}
 
+	/* values only available from the job's cgroups */
+	if ((conf_mode == JM_MODE_CGROUP) && job->have_cpu)
+	{
+		sstrncpy (vl.type, "jm_cpuusage", sizeof (vl.type));
+		vl.values[0].derive = job->cpu_usage;
+		vl.values_len = 1;
+		plugin_dispatch_values (&vl);
+	}
+
+	if ((conf_mode == JM_MODE_CGROUP) && job->have_memory)
+	{
+		sstrncpy (vl.type, "jm_mem_usage", sizeof (vl.type));
+		vl.values[0].gauge = job->mem_usage;
+		vl.values_len = 1;
+		plugin_dispatch_values (&vl);
+
+		sstrncpy (vl.type, "jm_mem_cache", sizeof (vl.type));
+		vl.values[0].gauge = job->mem_cache;
+		vl.values_len = 1;
+		plugin_dispatch_values (&vl);
+
+		if (job->mem_max_usage > 0)
+		{
+			sstrncpy (vl.type, "jm_mem_max", sizeof (vl.type));
+			vl.values[0].gauge = job->mem_max_usage;
+			vl.values_len = 1;
+			plugin_dispatch_values (&vl);
+		}
+	}
 
-	DEBUG ("list_submit jobId = %s; name = %s; num_proc = %lu; num_lwp = %lu; "
+	DEBUG ("list_submit jobId = %s; num_proc = %lu; num_lwp = %lu; "
 			"vmem_size = %lu; vmem_rss = %lu; vmem_data = %lu; "
 			"vmem_code = %lu; "
 			"vmem_minflt_counter = %"PRIi64"; vmem_majflt_counter = %"PRIi64"; "
 			"cpu_user_counter = %"PRIi64"; cpu_system_counter = %"PRIi64"; "
 			"io_rchar = %"PRIi64"; io_wchar = %"PRIi64"; "
 			"io_syscr = %"PRIi64"; io_syscw = %"PRIi64";",
-			ps->jobId, ps->name, ps->num_proc, ps->num_lwp,
-			ps->vmem_size, ps->vmem_rss,
-			ps->vmem_data, ps->vmem_code,
-			ps->vmem_minflt_counter, ps->vmem_majflt_counter,
-			ps->cpu_user_counter, ps->cpu_system_counter,
-			ps->io_rchar, ps->io_wchar, ps->io_syscr, ps->io_syscw);
-
-} /* void jobmetrics_submit_proc_list */
-
-/* ------- additional functions for KERNEL_LINUX ------- 
-            Those are the same functions of processes.c
-            except jobmetrics_read_ctxt, has been added
-*/
+			job->jobId, job->num_proc, job->num_lwp,
+			job->vmem_size, job->vmem_rss,
+			job->vmem_data, job->vmem_code,
+			job->vmem_minflt_counter, job->vmem_majflt_counter,
+			job->cpu_user_counter, job->cpu_system_counter,
+			job->io_rchar, job->io_wchar, job->io_syscr, job->io_syscw);
+
+} /* void jobmetrics_submit_job */
+
+/* ------- additional functions for KERNEL_LINUX ------- */
 #if KERNEL_LINUX
-static int jobmetrics_read_tasks (int pid)
+static void jm_process_free (jm_process_t *proc)
 {
-	char           dirname[64];
-	DIR           *dh;
-	struct dirent *ent;
-	int count = 0;
+	c_avl_remove (pids_g, &proc->pid, NULL, NULL);
 
-	ssnprintf (dirname, sizeof (dirname), "/proc/%i/task", pid);
+	jm_fd_close (&proc->fd_stat);
+	jm_fd_close (&proc->fd_status);
+	jm_fd_close (&proc->fd_io);
+	free (proc);
+} /* void jm_process_free */
 
-	if ((dh = opendir (dirname)) == NULL)
-	{
-		DEBUG ("Failed to open directory `%s'", dirname);
+/* Processes of LSF itself (`res' and numeric names) are not accounted. */
+static _Bool jm_process_ignored (const char *name)
+{
+	return ((strcmp (name, "res") == 0) || isdigit ((int) name[0])
+			|| (name[0] == 0));
+} /* _Bool jm_process_ignored */
+
+/* Looks at a task for the first time, or again after it called exec:
+ * processes of LSF itself and threads are flagged to be ignored. Returns -1
+ * if the task is gone. */
+static int jm_process_classify (jm_process_t *proc)
+{
+	jm_job_t *job = proc->job;
+	char  filename[64];
+	char  buffer[4096];
+	char  name[JM_NAME_LEN];
+	const char *value;
+	char *name_start;
+	char *name_end;
+	ssize_t len;
+
+	proc->check = 0;
+	proc->ignore = 0;
+
+	/* The name of the process is enclosed in parens and may contain
+	 * parens itself. */
+	ssnprintf (filename, sizeof (filename), "/proc/%i/stat", (int) proc->pid);
+	len = jm_read_file (&proc->fd_stat, filename, buffer, sizeof (buffer));
+	name_start = (len > 0) ? strchr (buffer, '(') : NULL;
+	name_end = (len > 0) ? strrchr (buffer, ')') : NULL;
+	if ((name_start == NULL) || (name_end == NULL) || (name_end < name_start))
 		return (-1);
+	sstrncpy (name, name_start + 1,
+			MIN ((size_t) (name_end - name_start), sizeof (name)));
+
+	/*we exclude any LSF process*/
+	proc->ignore = jm_process_ignored (name);
+
+	if (!proc->ignore)
+	{
+		ssnprintf (filename, sizeof (filename), "/proc/%i/status",
+				(int) proc->pid);
+		len = jm_read_file (&proc->fd_status, filename,
+				buffer, sizeof (buffer));
+		if (len <= 0)
+			return (-1);
+
+		/*if pid is a thread we do not look at it*/
+		value = jm_status_field (buffer, "Tgid:");
+		if ((value == NULL) || (atoi (value) != (int) proc->pid))
+			proc->ignore = 1;
+
+		value = jm_status_field (buffer, "Uid:");
+		if ((value != NULL) && (job->username[0] == 0))
+		{
+			value += strspn (value, " \t");
+			sstrncpy (job->username, value,
+					MIN (strcspn (value, " \t\n") + 1,
+						sizeof (job->username)));
+		}
 	}
 
-	while ((ent = readdir (dh)) != NULL)
+	if (proc->ignore)
 	{
-		if (!isdigit ((int) ent->d_name[0]))
-			continue;
-		else
-			count++;
+		jm_fd_close (&proc->fd_stat);
+		jm_fd_close (&proc->fd_status);
+		jm_fd_close (&proc->fd_io);
 	}
-	closedir (dh);
 
-	return ((count >= 1) ? count : 1);
-} /* int *jobmetrics_read_tasks */
+	return (0);
+} /* int jm_process_classify */
 
-/* Read advanced virtual memory data from /proc/pid/status */
-static procstat_t *jobmetrics_read_vmem (int pid, procstat_t *ps)
+/* Adds a task to a job without looking at it. */
+static jm_process_t *jm_process_add (jm_job_t *job, pid_t pid)
 {
-	FILE *fh;
-	char buffer[1024];
-	char filename[64];
-	unsigned long long lib = 0;
-	unsigned long long exe = 0;
-	unsigned long long data = 0;
-	char *fields[8];
-	int numfields;
-
-	ssnprintf (filename, sizeof (filename), "/proc/%i/status", pid);
-	if ((fh = fopen (filename, "r")) == NULL)
-		return (NULL);
+	jm_process_t *proc;
 
-	while (fgets (buffer, sizeof(buffer), fh) != NULL)
+	proc = calloc (1, sizeof (*proc));
+	if (proc == NULL)
 	{
-		long long tmp;
-		char *endptr;
+		ERROR ("jobmetrics plugin: calloc failed.");
+		return (NULL);
+	}
+	proc->pid = pid;
+	proc->fd_stat = -1;
+	proc->fd_status = -1;
+	proc->fd_io = -1;
+	/* I/O is taken from the blkio controller in cgroup mode */
+	proc->no_io = (conf_mode == JM_MODE_CGROUP);
+	proc->check = 1;
+
+	if (c_avl_insert (pids_g, &proc->pid, proc) != 0)
+	{
+		ERROR ("jobmetrics plugin: c_avl_insert failed.");
+		free (proc);
+		return (NULL);
+	}
 
-		if (strncmp (buffer, "Vm", 2) != 0)
-			continue;
+	proc->job = job;
+	proc->next = job->processes;
+	job->processes = proc;
 
-		numfields = strsplit (buffer, fields,
-				STATIC_ARRAY_SIZE (fields));
+	return (proc);
+} /* jm_process_t *jm_process_add */
 
-		if (numfields < 2)
-			continue;
+static void jm_process_unlink (jm_process_t *proc)
+{
+	jm_process_t **prev;
 
-		errno = 0;
-		endptr = NULL;
-		tmp = strtoll (fields[1], &endptr, /* base = */ 10);
-		if ((errno == 0) && (endptr != fields[1]))
-		{
-			if (strncmp (buffer, "VmData", 6) == 0)
-			{
-				data = tmp;
-			}
-			else if (strncmp (buffer, "VmLib", 5) == 0)
-			{
-				lib = tmp;
-			}
-			else if  (strncmp(buffer, "VmExe", 5) == 0)
-			{
-				exe = tmp;
-			}
-		}
-	} /* while (fgets) */
+	for (prev = &proc->job->processes; *prev != proc; prev = &(*prev)->next);
+	*prev = proc->next;
+} /* void jm_process_unlink */
+
+static jm_process_t *jm_process_create (jm_job_t *job, pid_t pid)
+{
+	jm_process_t *proc;
 
-	if (fclose (fh))
+	proc = jm_process_add (job, pid);
+	if (proc == NULL)
+		return (NULL);
+
+	if (jm_process_classify (proc) != 0)
 	{
-		char errbuf[1024];
-		WARNING ("processes: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
+		jm_process_unlink (proc);
+		jm_process_free (proc);
+		return (NULL);
 	}
 
-	ps->vmem_data = data * 1024;
-	ps->vmem_code = (exe + lib) * 1024;
+	return (proc);
+} /* jm_process_t *jm_process_create */
 
-	return (ps);
-} /* procstat_t *jobmetrics_read_vmem */
-
-static procstat_t *jobmetrics_read_io (int pid, procstat_t *ps)
+/* Reads the current state of a process and adds it to its job. Returns
+ * -1 if the process is gone. */
+static int jm_process_read (jm_process_t *proc)
 {
-	FILE *fh;
-	char buffer[1024];
-	char filename[64];
+	jm_job_t *job = proc->job;
+	char  filename[64];
+	char  buffer[4096];
+	char *fields[64];
+	int   fields_len;
+	char *ptr;
+	ssize_t len;
 
-	char *fields[8];
-	int numfields=0;
+	unsigned long long stack_start;
+	unsigned long long stack_ptr;
 
-	ssnprintf (filename, sizeof (filename), "/proc/%i/io", pid);
-	if ((fh = fopen (filename, "r")) == NULL)
-		return (NULL);
+	ssnprintf (filename, sizeof (filename), "/proc/%i/stat", (int) proc->pid);
+	len = jm_read_file (&proc->fd_stat, filename, buffer, sizeof (buffer));
+	if (len <= 0)
+		return (-1);
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	ptr = strrchr (buffer, ')');
+	if ((ptr == NULL) || (ptr[1] == 0))
+		return (-1);
+
+	fields_len = strsplit (ptr + 2, fields, STATIC_ARRAY_SIZE (fields));
+	if (fields_len < 27)
 	{
-		derive_t *val = NULL;
-		long long tmp;
-		char *endptr;
+		DEBUG ("jobmetrics plugin: jm_process_read (pid = %i):"
+				" `%s' has only %i fields..",
+				(int) proc->pid, filename, fields_len);
+		return (-1);
+	}
 
-		if (strncasecmp (buffer, "rchar:", 6) == 0)
-			val = &(ps->io_rchar);
-		else if (strncasecmp (buffer, "wchar:", 6) == 0)
-			val = &(ps->io_wchar);
-		else if (strncasecmp (buffer, "syscr:", 6) == 0)
-			val = &(ps->io_syscr);
-		else if (strncasecmp (buffer, "syscw:", 6) == 0)
-			val = &(ps->io_syscw);
-		else
-			continue;
+	/* Leave the rest at zero if this is only a zombi */
+	if (fields[0][0] == 'Z')
+		return (0);
 
-		numfields = strsplit (buffer, fields,
-				STATIC_ARRAY_SIZE (fields));
+	job->num_proc++;
+	job->num_lwp += strtoul (fields[17], NULL, 10);
+	job->vmem_size += strtoul (fields[20], NULL, 10);
+	job->vmem_rss += strtoul (fields[21], NULL, 10) * pagesize_g;
+
+	stack_start = strtoull (fields[25], NULL, 10);
+	stack_ptr   = strtoull (fields[26], NULL, 10);
+	job->stack_size += (stack_start > stack_ptr)
+		? stack_start - stack_ptr
+		: stack_ptr - stack_start;
+
+	jm_account (&proc->vmem_minflt, (derive_t) strtoll (fields[7], NULL, 10),
+			&job->vmem_minflt_counter);
+	jm_account (&proc->vmem_majflt, (derive_t) strtoll (fields[9], NULL, 10),
+			&job->vmem_majflt_counter);
+	jm_account (&proc->cpu_user, (derive_t) strtoll (fields[11], NULL, 10),
+			&job->cpu_user_counter);
+	jm_account (&proc->cpu_system, (derive_t) strtoll (fields[12], NULL, 10),
+			&job->cpu_system_counter);
+
+	ssnprintf (filename, sizeof (filename), "/proc/%i/status", (int) proc->pid);
+	len = jm_read_file (&proc->fd_status, filename, buffer, sizeof (buffer));
+	if (len > 0)
+	{
+		unsigned long long lib = 0;
+		unsigned long long exe = 0;
+		unsigned long long data = 0;
 
-		if (numfields < 2)
-			continue;
+		ptr = buffer;
+		while (ptr != NULL)
+		{
+			if (strncmp (ptr, "VmData:", 7) == 0)
+				data = strtoull (ptr + 7, NULL, 10);
+			else if (strncmp (ptr, "VmLib:", 6) == 0)
+				lib = strtoull (ptr + 6, NULL, 10);
+			else if (strncmp (ptr, "VmExe:", 6) == 0)
+				exe = strtoull (ptr + 6, NULL, 10);
+			else if (strncmp (ptr, "voluntary_ctxt_switches:", 24) == 0)
+				job->voluntary_ctxt_switches += strtoul (ptr + 24, NULL, 10);
+			else if (strncmp (ptr, "nonvoluntary_ctxt_switches:", 27) == 0)
+				job->nonvoluntary_ctxt_switches += strtoul (ptr + 27, NULL, 10);
+
+			ptr = strchr (ptr, '\n');
+			if (ptr != NULL)
+				ptr++;
+		}
 
-		errno = 0;
-		endptr = NULL;
-		tmp = strtoll (fields[1], &endptr, /* base = */ 10);
-		if ((errno != 0) || (endptr == fields[1]))
-			*val = -1;
-		else
-			*val = (derive_t) tmp;
-	} /* while (fgets) */
+		job->vmem_data += data * 1024;
+		job->vmem_code += (exe + lib) * 1024;
+	}
+
+	/* /proc/<pid>/io is only readable by the owner and root, don't retry
+	 * once it failed. */
+	if (proc->no_io)
+		return (0);
+
+	ssnprintf (filename, sizeof (filename), "/proc/%i/io", (int) proc->pid);
+	len = jm_read_file (&proc->fd_io, filename, buffer, sizeof (buffer));
+	if (len <= 0)
+	{
+		proc->no_io = 1;
+		jm_fd_close (&proc->fd_io);
+		return (0);
+	}
 
-	if (fclose (fh))
+	ptr = buffer;
+	while (ptr != NULL)
 	{
-		char errbuf[1024];
-		WARNING ("processes: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
+		if (strncmp (ptr, "rchar:", 6) == 0)
+			jm_account (&proc->io_rchar, (derive_t) strtoll (ptr + 6, NULL, 10),
+					&job->io_rchar);
+		else if (strncmp (ptr, "wchar:", 6) == 0)
+			jm_account (&proc->io_wchar, (derive_t) strtoll (ptr + 6, NULL, 10),
+					&job->io_wchar);
+		else if (strncmp (ptr, "syscr:", 6) == 0)
+			jm_account (&proc->io_syscr, (derive_t) strtoll (ptr + 6, NULL, 10),
+					&job->io_syscr);
+		else if (strncmp (ptr, "syscw:", 6) == 0)
+			jm_account (&proc->io_syscw, (derive_t) strtoll (ptr + 6, NULL, 10),
+					&job->io_syscw);
+
+		ptr = strchr (ptr, '\n');
+		if (ptr != NULL)
+			ptr++;
 	}
+	job->have_io = 1;
 
-	return (ps);
-} /* procstat_t *jobmetrics_read_io */
+	return (0);
+} /* int jm_process_read */
 
-static procstat_t *jobmetrics_read_ctxt (int pid, procstat_t *ps)
-{
-    FILE *fh;
-    char  filename[64];
-    char  buffer[1024];
-
-    char *fields[64];
-
-    ssnprintf (filename, sizeof (filename), "/proc/%i/status", pid);
-    if ((fh = fopen (filename, "r")) == NULL)
-                return NULL;
-    while (fgets (buffer, sizeof(buffer), fh) != NULL)
-    {
-
-       if (strncmp (buffer, "voluntary_ctxt_switches", 23) == 0){
-          strsplit (buffer, fields,STATIC_ARRAY_SIZE (fields));
-          ps->voluntary_ctxt_switches = atoll(fields[1]);
-       }
-       if (strncmp (buffer, "nonvoluntary_ctxt_switches", 26) == 0){
-          strsplit (buffer, fields,STATIC_ARRAY_SIZE (fields));
-          ps->nonvoluntary_ctxt_switches = atoll(fields[1]);
-       }
-    }
-    fclose (fh);
-
-    return ps;
-}
-
-int jobmetrics_read_process (int pid, procstat_t *ps, char *state)
+/* Handles one process event. Called before the jobs are read, so that
+ * short-lived children are accounted for with their whole life time. */
+static void jm_process_event (const procev_event_t *ev,
+		void __attribute__((unused)) *user_data)
 {
-	char  filename[64];
-	char  buffer[1024];
+	jm_process_t *proc;
+	jm_process_t *parent;
+	jm_job_t *job;
 
-	char *fields[64];
-	char  fields_len;
+	switch (ev->type)
+	{
+		case PROCEV_FORK:
+			/* Children stay in their parent's cgroup unless moved, which the
+			 * next read of the tasks file notices. */
+			if ((c_avl_get (pids_g, &ev->ppid, (void *) &parent) != 0)
+					|| (c_avl_get (pids_g, &ev->pid, (void *) &proc) == 0))
+				return;
+			jm_process_add (parent->job, ev->pid);
+			break;
 
-	int   buffer_len;
+		case PROCEV_EXEC:
+			if (c_avl_get (pids_g, &ev->pid, (void *) &proc) == 0)
+				proc->check = 1;
+			break;
 
-	char *buffer_ptr;
-	size_t name_start_pos;
-	size_t name_end_pos;
-	size_t name_len;
+		case PROCEV_EXIT:
+			if (c_avl_get (pids_g, &ev->pid, (void *) &proc) != 0)
+				return;
 
-	derive_t cpu_user_counter;
-	derive_t cpu_system_counter;
-	long long unsigned vmem_size;
-	long long unsigned vmem_rss;
-	long long unsigned stack_size;
+			job = proc->job;
+			if (ev->have_acct && (proc->check
+						? !jm_process_ignored (ev->acct.comm)
+						: !proc->ignore))
+			{
+				/* taskstats reports microseconds, /proc clock ticks */
+				jm_account (&proc->cpu_user,
+						(derive_t) (ev->acct.cpu_user * CONFIG_HZ / 1000000),
+						&job->cpu_user_counter);
+				jm_account (&proc->cpu_system,
+						(derive_t) (ev->acct.cpu_system * CONFIG_HZ / 1000000),
+						&job->cpu_system_counter);
+				jm_account (&proc->vmem_minflt, (derive_t) ev->acct.minflt,
+						&job->vmem_minflt_counter);
+				jm_account (&proc->vmem_majflt, (derive_t) ev->acct.majflt,
+						&job->vmem_majflt_counter);
+				jm_account (&proc->io_rchar, (derive_t) ev->acct.read_char,
+						&job->io_rchar);
+				jm_account (&proc->io_wchar, (derive_t) ev->acct.write_char,
+						&job->io_wchar);
+				jm_account (&proc->io_syscr, (derive_t) ev->acct.read_syscalls,
+						&job->io_syscr);
+				jm_account (&proc->io_syscw, (derive_t) ev->acct.write_syscalls,
+						&job->io_syscw);
+				job->have_io = 1;
+			}
 
-	memset (ps, 0, sizeof (procstat_t));
+			jm_process_unlink (proc);
+			jm_process_free (proc);
+			break;
+	}
+} /* void jm_process_event */
 
-	ssnprintf (filename, sizeof (filename), "/proc/%i/stat", pid);
+static jm_job_t *jm_job_add (const char *dirname)
+{
+	jm_job_t *job;
+	int i;
 
-	buffer_len = read_file_contents (filename,
-			buffer, sizeof(buffer) - 1);
-	if (buffer_len <= 0)
-		return (-1);
-	buffer[buffer_len] = 0;
-
-	/* The name of the process is enclosed in parens. Since the name can
-	 * contain parens itself, spaces, numbers and pretty much everything
-	 * else, use these to determine the process name. We don't use
-	 * strchr(3) and strrchr(3) to avoid pointer arithmetic which would
-	 * otherwise be required to determine name_len. */
-	name_start_pos = 0;
-	while ((buffer[name_start_pos] != '(')
-			&& (name_start_pos < buffer_len))
-		name_start_pos++;
-
-	name_end_pos = buffer_len;
-	while ((buffer[name_end_pos] != ')')
-			&& (name_end_pos > 0))
-		name_end_pos--;
-
-	/* Either '(' or ')' is not found or they are in the wrong order.
-	 * Anyway, something weird that shouldn't happen ever. */
-	if (name_start_pos >= name_end_pos)
+	if (c_avl_get (jobs_g, dirname, (void *) &job) == 0)
+		return (job);
+
+	job = calloc (1, sizeof (*job));
+	if (job == NULL)
 	{
-		ERROR ("jobmetrics plugin: name_start_pos = %zu >= name_end_pos = %zu",
-				name_start_pos, name_end_pos);
-		return (-1);
+		ERROR ("jobmetrics plugin: calloc failed.");
+		return (NULL);
 	}
 
-	name_len = (name_end_pos - name_start_pos) - 1;
-	if (name_len >= sizeof (ps->name))
-		name_len = sizeof (ps->name) - 1;
+	sstrncpy (job->dirname, dirname, sizeof (job->dirname));
+	cgroup_job_id (dirname, job->jobId, sizeof (job->jobId));
+	job->fd_tasks = -1;
+	for (i = 0; i < JM_CG_FILES_NUM; i++)
+		job->fd_cgroup[i] = -1;
+	job->next_sample = generation_g;
 
-	sstrncpy (ps->name, &buffer[name_start_pos + 1], name_len + 1);
+	/* in cgroup mode these depend on the controllers being available */
+	job->have_cpu = (conf_mode == JM_MODE_PROCESSES);
+	job->have_faults = (conf_mode == JM_MODE_PROCESSES);
 
-	if ((buffer_len - name_end_pos) < 2)
-		return (-1);
-	buffer_ptr = &buffer[name_end_pos + 2];
-
-	fields_len = strsplit (buffer_ptr, fields, STATIC_ARRAY_SIZE (fields));
-	if (fields_len < 22)
+	if (c_avl_insert (jobs_g, job->dirname, job) != 0)
 	{
-		DEBUG ("jobmetrics plugin: jobmetrics_read_process (pid = %i):"
-				" `%s' has only %i fields..",
-				(int) pid, filename, fields_len);
-		return (-1);
+		ERROR ("jobmetrics plugin: c_avl_insert failed.");
+		free (job);
+		return (NULL);
 	}
 
-	*state = fields[0][0];
+	DEBUG ("jobmetrics plugin: Added job %s (%s).", job->jobId, dirname);
+	return (job);
+} /* jm_job_t *jm_job_add */
+
+static void jm_job_free (jm_job_t *job)
+{
+	jm_process_t *proc;
+	int i;
+
+	c_avl_remove (jobs_g, job->dirname, NULL, NULL);
 
-	if (*state == 'Z')
+	while ((proc = job->processes) != NULL)
 	{
-		ps->num_lwp  = 0;
-		ps->num_proc = 0;
+		job->processes = proc->next;
+		jm_process_free (proc);
 	}
-	else
+
+	jm_fd_close (&job->fd_tasks);
+	for (i = 0; i < JM_CG_FILES_NUM; i++)
+		jm_fd_close (&job->fd_cgroup[i]);
+	free (job);
+} /* void jm_job_free */
+
+/* Re-reads the "tasks" file of a job and updates all its processes.
+ * Returns 1 if the job has processes, 0 if it has none and -1 if the job's
+ * directory is gone. */
+static int jm_job_read (jm_job_t *job)
+{
+	char filename[PATH_MAX];
+	jm_process_t *proc;
+	jm_process_t **prev;
+	char *ptr;
+	ssize_t len;
+
+	ssnprintf (filename, sizeof (filename), "%s/%s/%s",
+			conf_cgroup_path, job->dirname,
+			cgroup_v2 ? "cgroup.procs" : "tasks");
+
+	while (42)
 	{
-		if ( (ps->num_lwp = jobmetrics_read_tasks (pid)) == -1 )
+		char *tmp;
+
+		len = jm_read_file (&job->fd_tasks, filename,
+				tasks_buffer_g, tasks_buffer_size_g);
+		if (len < 0)
+			return (-1);
+		if ((size_t) len < tasks_buffer_size_g - 1)
+			break;
+
+		tmp = realloc (tasks_buffer_g, 2 * tasks_buffer_size_g);
+		if (tmp == NULL)
 		{
-			/* returns -1 => kernel 2.4 */
-			ps->num_lwp = 1;
+			ERROR ("jobmetrics plugin: realloc failed.");
+			break;
 		}
-		ps->num_proc = 1;
+		tasks_buffer_g = tmp;
+		tasks_buffer_size_g *= 2;
 	}
 
-	/* Leave the rest at zero if this is only a zombi */
-	if (ps->num_proc == 0)
+	job->num_proc = 0;
+	job->num_lwp = 0;
+	job->vmem_size = 0;
+	job->vmem_rss = 0;
+	job->vmem_data = 0;
+	job->vmem_code = 0;
+	job->stack_size = 0;
+	job->voluntary_ctxt_switches = 0;
+	job->nonvoluntary_ctxt_switches = 0;
+
+	/* the tasks file lists one PID per line */
+	ptr = tasks_buffer_g;
+	while (*ptr != 0)
 	{
-		DEBUG ("jobmetrics plugin: This is only a zombi: pid = %i; "
-				"name = %s;", pid, ps->name);
-		return (0);
-	}
+		char *endptr;
+		pid_t pid;
+
+		pid = (pid_t) strtol (ptr, &endptr, 10);
+		if (endptr == ptr)
+			break;
+		ptr = endptr;
 
-	cpu_user_counter   = atoll (fields[11]);
-	cpu_system_counter = atoll (fields[12]);
-	vmem_size          = atoll (fields[20]);
-	vmem_rss           = atoll (fields[21]);
-	ps->vmem_minflt_counter = atol (fields[7]);
-	ps->vmem_majflt_counter = atol (fields[9]);
+		if (pid <= 0)
+			continue;
 
+		if (c_avl_get (pids_g, &pid, (void *) &proc) != 0)
+		{
+			proc = jm_process_create (job, pid);
+			if (proc == NULL)
+				continue;
+		}
+		else if (proc->job != job)
+		{
+			/* The task was moved from a job which has not been read yet. */
+			jm_process_unlink (proc);
+
+			proc->job = job;
+			proc->next = job->processes;
+			job->processes = proc;
+		}
+		else if (proc->generation == generation_g)
+			continue;
+
+		proc->generation = generation_g;
+		if (proc->check && (jm_process_classify (proc) != 0))
+		{
+			proc->generation = 0;
+			continue;
+		}
+		if (proc->ignore)
+			continue;
+
+		/* exited processes are removed below */
+		if (jm_process_read (proc) != 0)
+			proc->generation = 0;
+	}
+
+	prev = &job->processes;
+	while ((proc = *prev) != NULL)
 	{
-		unsigned long long stack_start = atoll (fields[25]);
-		unsigned long long stack_ptr   = atoll (fields[26]);
+		if (proc->generation == generation_g)
+		{
+			prev = &proc->next;
+			continue;
+		}
 
-		stack_size = (stack_start > stack_ptr)
-			? stack_start - stack_ptr
-			: stack_ptr - stack_start;
+		*prev = proc->next;
+		jm_process_free (proc);
 	}
 
-	/* Convert jiffies to seconds */
-	cpu_user_counter   = cpu_user_counter   / CONFIG_HZ;
-	cpu_system_counter = cpu_system_counter / CONFIG_HZ;
-	vmem_rss = vmem_rss * pagesize_g;
+	return ((job->processes != NULL) ? 1 : 0);
+} /* int jm_job_read */
 
-	if ( (jobmetrics_read_vmem(pid, ps)) == NULL)
+/* Reads one of the cgroup files of a job. Files which cannot be read are
+ * not tried again until the job's processes are inspected next, since the
+ * controllers' directories may be created after the job's cpuset. */
+static ssize_t jm_cgroup_read_file (jm_job_t *job, int index,
+		const char *path, const char *name,
+		char *buffer, size_t buffer_size)
+{
+	char filename[PATH_MAX];
+	ssize_t len;
+
+	if (job->cgroup_missing & (1 << index))
+		return (-1);
+
+	ssnprintf (filename, sizeof (filename), "%s/%s/%s",
+			path, job->dirname, name);
+	len = jm_read_file (&job->fd_cgroup[index], filename,
+			buffer, buffer_size);
+	if (len < 0)
 	{
-		/* No VMem data */
-		ps->vmem_data = -1;
-		ps->vmem_code = -1;
-		DEBUG("jobmetrics_read_process: did not get vmem data for pid %i",pid);
+		DEBUG ("jobmetrics plugin: Cannot read `%s'.", filename);
+		job->cgroup_missing |= (1 << index);
 	}
 
-	ps->cpu_user_counter = cpu_user_counter;
-	ps->cpu_system_counter = cpu_system_counter;
-	ps->vmem_size = (unsigned long) vmem_size;
-	ps->vmem_rss = (unsigned long) vmem_rss;
-	ps->stack_size = (unsigned long) stack_size;
+	return (len);
+} /* ssize_t jm_cgroup_read_file */
 
-	if ( (jobmetrics_read_io (pid, ps)) == NULL)
-	{
-		/* no io data */
-		ps->io_rchar = -1;
-		ps->io_wchar = -1;
-		ps->io_syscr = -1;
-		ps->io_syscw = -1;
+/* Looks up "key" in a flat-keyed cgroup file such as memory.stat. */
+static int jm_cgroup_value (const char *buffer, const char *key,
+		derive_t *ret)
+{
+	const char *value;
 
-		DEBUG("jobmetrics_read_process: not get io data for pid %i",pid);
-	}
+	value = jm_status_field (buffer, key);
+	if (value == NULL)
+		return (-1);
 
-    if ( ( jobmetrics_read_ctxt(pid, ps)) == NULL)
-    {
-        ps->voluntary_ctxt_switches = -1;
-        ps->nonvoluntary_ctxt_switches = -1;
-
-        DEBUG("jobmetrics_read_process: not get ctxt data for pid %i",pid);
-    }
-
-	DEBUG ("jobmetrics_read_process; name = %s; num_proc = %lu; num_lwp = %lu; "
-                        "vmem_size = %lu; vmem_rss = %lu; vmem_data = %lu; "
-                        "vmem_code = %lu; "
-                        "vmem_minflt_counter = %"PRIi64"; vmem_majflt_counter = %"PRIi64"; "
-                        "cpu_user_counter = %"PRIi64"; cpu_system_counter = %"PRIi64"; "
-                        "io_rchar = %"PRIi64"; io_wchar = %"PRIi64"; "
-                        "io_syscr = %"PRIi64"; io_syscw = %"PRIi64";",
-                         ps->name, ps->num_proc, ps->num_lwp,
-                        ps->vmem_size, ps->vmem_rss,
-                        ps->vmem_data, ps->vmem_code,
-                        ps->vmem_minflt_counter, ps->vmem_majflt_counter,
-                        ps->cpu_user_counter, ps->cpu_system_counter,
-                        ps->io_rchar, ps->io_wchar, ps->io_syscr, ps->io_syscw);
-
-	/* success */
+	*ret = (derive_t) strtoll (value, NULL, 10);
 	return (0);
-} /* int ps_read_process (...) */
+} /* int jm_cgroup_value */
 
-static char *jobmetrics_get_cmdline (pid_t pid, char *name, char *buf, size_t buf_len)
+/* Sums the "Read" and "Write" lines of all devices in a blkio file. */
+static void jm_cgroup_blkio_sum (const char *buffer,
+		derive_t *read, derive_t *write)
 {
-	char  *buf_ptr;
-	size_t len;
-
-	char file[PATH_MAX];
-	int  fd;
-
-	size_t n;
-
-	if ((pid < 1) || (NULL == buf) || (buf_len < 2))
-		return NULL;
-
-	ssnprintf (file, sizeof (file), "/proc/%u/cmdline",
-		       	(unsigned int) pid);
-
-	errno = 0;
-	fd = open (file, O_RDONLY);
-	if (fd < 0) {
-		char errbuf[4096];
-		/* ENOENT means the process exited while we were handling it.
-		 * Don't complain about this, it only fills the logs. */
-		if (errno != ENOENT)
-			WARNING ("jobmetrics plugin: Failed to open `%s': %s.", file,
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-		return NULL;
+	const char *ptr = buffer;
+
+	*read = 0;
+	*write = 0;
+	while (ptr != NULL)
+	{
+		char op[16];
+		long long value;
+
+		if (sscanf (ptr, "%*u:%*u %15s %lld", op, &value) == 2)
+		{
+			if (strcmp ("Read", op) == 0)
+				*read += value;
+			else if (strcmp ("Write", op) == 0)
+				*write += value;
+		}
+
+		ptr = strchr (ptr, '\n');
+		if (ptr != NULL)
+			ptr++;
 	}
+} /* void jm_cgroup_blkio_sum */
 
-	buf_ptr = buf;
-	len     = buf_len;
+static void jm_cgroup_read_v1 (jm_job_t *job, char *buffer, size_t buffer_size)
+{
+	derive_t usage;
+	derive_t user;
+	derive_t system;
+	derive_t value;
+
+	job->have_cpu = 0;
+	if (jm_cgroup_read_file (job, JM_CG_CPU_USAGE, conf_cpuacct_path,
+				"cpuacct.usage", buffer, buffer_size) > 0)
+	{
+		usage = (derive_t) strtoll (buffer, NULL, 10);
 
-	n = 0;
+		/* user and system time are reported in jiffies */
+		if ((jm_cgroup_read_file (job, JM_CG_CPU_STAT, conf_cpuacct_path,
+						"cpuacct.stat", buffer, buffer_size) > 0)
+				&& (jm_cgroup_value (buffer, "user ", &user) == 0)
+				&& (jm_cgroup_value (buffer, "system ", &system) == 0))
+		{
+			job->cpu_usage = usage;
+			job->cpu_user_counter = user;
+			job->cpu_system_counter = system;
+			job->have_cpu = 1;
+		}
+	}
 
-	while (42) {
-		ssize_t status;
+	job->have_memory = 0;
+	job->have_faults = 0;
+	if (jm_cgroup_read_file (job, JM_CG_MEM_USAGE, conf_memory_path,
+				"memory.usage_in_bytes", buffer, buffer_size) > 0)
+	{
+		job->mem_usage = strtoul (buffer, NULL, 10);
+		job->have_memory = 1;
 
-		status = read (fd, (void *)buf_ptr, len);
+		job->mem_max_usage = 0;
+		if (jm_cgroup_read_file (job, JM_CG_MEM_MAX, conf_memory_path,
+					"memory.max_usage_in_bytes", buffer, buffer_size) > 0)
+			job->mem_max_usage = strtoul (buffer, NULL, 10);
 
-		if (status < 0) {
-			char errbuf[1024];
+		if (jm_cgroup_read_file (job, JM_CG_MEM_STAT, conf_memory_path,
+					"memory.stat", buffer, buffer_size) > 0)
+		{
+			derive_t pgfault;
+			derive_t pgmajfault;
+
+			if (jm_cgroup_value (buffer, "total_rss ", &value) == 0)
+				job->vmem_rss = (unsigned long) value;
+			if (jm_cgroup_value (buffer, "total_cache ", &value) == 0)
+				job->mem_cache = (unsigned long) value;
+			if ((jm_cgroup_value (buffer, "total_pgfault ", &pgfault) == 0)
+					&& (jm_cgroup_value (buffer, "total_pgmajfault ",
+							&pgmajfault) == 0))
+			{
+				job->vmem_minflt_counter = pgfault - pgmajfault;
+				job->vmem_majflt_counter = pgmajfault;
+				job->have_faults = 1;
+			}
+		}
+	}
 
-			if ((EAGAIN == errno) || (EINTR == errno))
-				continue;
+	job->have_io = 0;
+	if ((jm_cgroup_read_file (job, JM_CG_IO_BYTES, conf_blkio_path,
+					"blkio.throttle.io_service_bytes",
+					buffer, buffer_size) >= 0))
+	{
+		jm_cgroup_blkio_sum (buffer, &job->io_rchar, &job->io_wchar);
 
-			WARNING ("jobmetrics plugin: Failed to read from `%s': %s.", file,
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (fd);
-			return NULL;
+		if (jm_cgroup_read_file (job, JM_CG_IO_OPS, conf_blkio_path,
+					"blkio.throttle.io_serviced", buffer, buffer_size) >= 0)
+		{
+			jm_cgroup_blkio_sum (buffer, &job->io_syscr, &job->io_syscw);
+			job->have_io = 1;
 		}
+	}
+} /* void jm_cgroup_read_v1 */
 
-		n += status;
+static void jm_cgroup_read_v2 (jm_job_t *job, char *buffer, size_t buffer_size)
+{
+	derive_t usage;
+	derive_t user;
+	derive_t system;
+	derive_t value;
+	const char *ptr;
+
+	/* cpu.stat is in microseconds */
+	job->have_cpu = 0;
+	if ((jm_cgroup_read_file (job, JM_CG_CPU_STAT, conf_cgroup_path,
+					"cpu.stat", buffer, buffer_size) > 0)
+			&& (jm_cgroup_value (buffer, "usage_usec ", &usage) == 0)
+			&& (jm_cgroup_value (buffer, "user_usec ", &user) == 0)
+			&& (jm_cgroup_value (buffer, "system_usec ", &system) == 0))
+	{
+		job->cpu_usage = usage * 1000;
+		job->cpu_user_counter = user * CONFIG_HZ / 1000000;
+		job->cpu_system_counter = system * CONFIG_HZ / 1000000;
+		job->have_cpu = 1;
+	}
 
-		if (status == 0)
-			break;
+	job->have_memory = 0;
+	job->have_faults = 0;
+	if (jm_cgroup_read_file (job, JM_CG_MEM_USAGE, conf_cgroup_path,
+				"memory.current", buffer, buffer_size) > 0)
+	{
+		job->mem_usage = strtoul (buffer, NULL, 10);
+		job->have_memory = 1;
 
-		buf_ptr += status;
-		len     -= status;
+		/* memory.peak only exists since Linux 5.19 */
+		job->mem_max_usage = 0;
+		if (jm_cgroup_read_file (job, JM_CG_MEM_MAX, conf_cgroup_path,
+					"memory.peak", buffer, buffer_size) > 0)
+			job->mem_max_usage = strtoul (buffer, NULL, 10);
 
-		if (len <= 0)
-			break;
+		if (jm_cgroup_read_file (job, JM_CG_MEM_STAT, conf_cgroup_path,
+					"memory.stat", buffer, buffer_size) > 0)
+		{
+			derive_t pgfault;
+			derive_t pgmajfault;
+
+			if (jm_cgroup_value (buffer, "anon ", &value) == 0)
+				job->vmem_rss = (unsigned long) value;
+			if (jm_cgroup_value (buffer, "file ", &value) == 0)
+				job->mem_cache = (unsigned long) value;
+			if ((jm_cgroup_value (buffer, "pgfault ", &pgfault) == 0)
+					&& (jm_cgroup_value (buffer, "pgmajfault ",
+							&pgmajfault) == 0))
+			{
+				job->vmem_minflt_counter = pgfault - pgmajfault;
+				job->vmem_majflt_counter = pgmajfault;
+				job->have_faults = 1;
+			}
+		}
 	}
 
-	close (fd);
+	/* io.stat has one line per device with "key=value" fields and is empty
+	 * until the job did any I/O. */
+	job->have_io = 0;
+	if (jm_cgroup_read_file (job, JM_CG_IO_BYTES, conf_cgroup_path,
+				"io.stat", buffer, buffer_size) >= 0)
+	{
+		job->io_rchar = 0;
+		job->io_wchar = 0;
+		job->io_syscr = 0;
+		job->io_syscw = 0;
 
-	if (0 == n) {
-		/* cmdline not available; e.g. kernel thread, zombie */
-		if (NULL == name)
-			return NULL;
+		for (ptr = buffer; *ptr != 0; ptr++)
+		{
+			if ((ptr != buffer) && (ptr[-1] != ' '))
+				continue;
 
-		ssnprintf (buf, buf_len, "[%s]", name);
-		return buf;
+			if (strncmp (ptr, "rbytes=", 7) == 0)
+				job->io_rchar += (derive_t) strtoll (ptr + 7, NULL, 10);
+			else if (strncmp (ptr, "wbytes=", 7) == 0)
+				job->io_wchar += (derive_t) strtoll (ptr + 7, NULL, 10);
+			else if (strncmp (ptr, "rios=", 5) == 0)
+				job->io_syscr += (derive_t) strtoll (ptr + 5, NULL, 10);
+			else if (strncmp (ptr, "wios=", 5) == 0)
+				job->io_syscw += (derive_t) strtoll (ptr + 5, NULL, 10);
+		}
+		job->have_io = 1;
 	}
+} /* void jm_cgroup_read_v2 */
 
-	assert (n <= buf_len);
+/* Cgroup mode: the accounting of a job is read from its cgroups on every
+ * read, its processes are only inspected every "ProcessInterval" reads.
+ * Returns the same as jm_job_read. */
+static int jm_job_read_cgroup (jm_job_t *job)
+{
+	char buffer[16384];
 
-	if (n == buf_len)
-		--n;
-	buf[n] = '\0';
+	if (generation_g >= job->next_sample)
+	{
+		int status;
 
-	--n;
-	/* remove trailing whitespace */
-	while ((n > 0) && (isspace (buf[n]) || ('\0' == buf[n]))) {
-		buf[n] = '\0';
-		--n;
-	}
+		status = jm_job_read (job);
+		if (status < 0)
+			return (-1);
 
-	/* arguments are separated by '\0' in /proc/<pid>/cmdline */
-	while (n > 0) {
-		if ('\0' == buf[n])
-			buf[n] = ' ';
-		--n;
+		job->active = (status > 0);
+		job->next_sample = generation_g + conf_process_interval;
+		job->cgroup_missing = 0;
 	}
-	return buf;
-} /* char *ps_get_cmdline (...) */
-#endif
 
-/*read the name of the process*/
-static void jobmetrics_read_name(char *fl_name, char *name)
-{
-    int ch, i;
-
-    ch = i = 0;
-
-    for (ch = 0; fl_name[ch] != '\0'; ch++)
-    {
-       i = 0;
-       if ( fl_name[ch] == ' ')
-       {
-          ch = ch + 2;
-          while (fl_name[ch] != ' '){
-             name[i] = fl_name[ch];
-             i++;
-             ch++;
-          }
-          name[--i] = '\0';
-          break;
-       }
-    }
-}
-
-/*read jobid and jobidx for a job*/
-static void jobmetrics_read_jobid(char *dir_name, char *jobId)
-{
-    int ch, i;
-
-    ch = i = 0;
-
-    for ( ch = 0; dir_name[ch] != '\0'; ch++)
-    {
-        if ( dir_name[ch] == '.' ){
-            ch++;
-            i = 0;
-            while (dir_name[ch] != '.' && dir_name[ch] != '[')
-            {
-               jobId[i] = dir_name[ch];
-               i++;
-               ch++;
-            }
-        }
-        if ( dir_name[ch] == '[' ){
-            jobId[i] = '.';
-            i++;
-            ch++;
-            while (dir_name[ch] != ']'){
-                jobId[i] = dir_name[ch];
-                ch++;
-                i++;
-            }
-                jobId[i] = '\0';
-                break;
-        }
-        else if (i != 0){
-                jobId[i] = '\0';
-                break;
-        }
-    }
-}
-
-/*check if a pid is a thread*/
-static int isthread(int pid)
-{
-    FILE *fh;
-    char  filename[64];
-    char  buffer[1024];
-
-    char *fields[64];
-
-    ssnprintf (filename, sizeof (filename), "/proc/%i/status", pid);
-    if ((fh = fopen (filename, "r")) == NULL)
-                return (0);
-    while (fgets (buffer, sizeof(buffer), fh) != NULL)
-    {
-
-       if (strncmp (buffer, "Tgid", 4) != 0)
-                   continue;
-        
-       strsplit (buffer, fields,STATIC_ARRAY_SIZE (fields)); 
-       break; 
-    }
-    fclose (fh);
-
-    if (atoi(fields[1]) == pid)
-        return 0;
-    else
-        return 1;
-
-}
-
-static int get_username(long pid, char *username)
+	if (!job->active)
+		return (0);
+
+	if (cgroup_v2)
+		jm_cgroup_read_v2 (job, buffer, sizeof (buffer));
+	else
+		jm_cgroup_read_v1 (job, buffer, sizeof (buffer));
+
+	return (1);
+} /* int jm_job_read_cgroup */
+
+static void jm_job_found (const char *dirname,
+		__attribute__((unused)) void *user_data)
 {
-    char path[40], line[100], *p, userid[32];
-    FILE* statusf;
-
-    ssnprintf(path, 40, "/proc/%ld/status", pid);
-
-    statusf = fopen(path, "r");
-    if(!statusf)
-        return -1;
-
-    int index = 0;
-    while(fgets(line, 100, statusf)) {
-        if(strncmp(line, "Uid:", 4) != 0)
-            continue;
-        // Ignore "Uid:" and whitespace
-        p = line + 4;
-        while(isspace(*p)) ++p;
-        index = 0;
-        while(!isspace(*p)){
-          userid[index] = *p;
-          p++;
-          index++;
-        }
-        break;
-    }
-
-    userid[index] = '\0';
-    fclose(statusf);
-
-    sstrncpy (username, userid, sizeof(userid));
-    return 0;
-}
+	jm_job_t *job;
 
-/* do actual readings from kernel */
-static int jobmetrics_read (void)
+	job = jm_job_add (dirname);
+	if (job != NULL)
+		job->generation = generation_g;
+} /* void jm_job_found */
+
+static void jm_job_lost (const char *dirname,
+		__attribute__((unused)) void *user_data)
 {
+	jm_job_t *job;
 
-#if KERNEL_LINUX
-    struct dirent *ent;
-	DIR           *proc;
-	int            pid;
+	if (c_avl_get (jobs_g, dirname, (void *) &job) != 0)
+		return;
 
-	char cmdline[CMDLINE_BUFFER_SIZE];
+	DEBUG ("jobmetrics plugin: Removing job %s.", job->jobId);
+	jm_job_free (job);
+} /* void jm_job_lost */
 
-	int        status;
-	procstat_t ps;
-	procstat_entry_t pse;
-	char       state;
+/* #endif KERNEL_LINUX */
+#endif
 
-    char        jobId[PROCSTAT_NAME_LEN], name[PROCSTAT_NAME_LEN];
-    char        username[256];
-	char        filename[100], line[80];
-	FILE        *fp,*fh;
-	procstat_t  *ps_ptr;
-	
-	jobmetrics_list_reset ();
+/* do actual readings from kernel */
+static int jobmetrics_read (void)
+{
+#if KERNEL_LINUX
+	c_avl_iterator_t *iter;
+	jm_job_t *job;
+	jm_job_t *removed = NULL;
+	char *key;
+	int status;
+
+	generation_g++;
+
+	/* Jobs are only looked up in the cgroup directory when inotify is not
+	 * available or has lost track of it. */
+	status = cgroup_watch_read (watch_g, jm_job_found, jm_job_lost, NULL);
+	if (status < 0)
+		return (-1);
+	else if (status > 0)
+	{
+		/* The directory has been listed: drop the jobs not found. */
+		iter = c_avl_get_iterator (jobs_g);
+		while (c_avl_iterator_next (iter, (void *) &key, (void *) &job) == 0)
+		{
+			if (job->generation == generation_g)
+				continue;
+			job->next_removed = removed;
+			removed = job;
+		}
+		c_avl_iterator_destroy (iter);
 
+		while ((job = removed) != NULL)
+		{
+			removed = job->next_removed;
+			DEBUG ("jobmetrics plugin: Removing job %s.", job->jobId);
+			jm_job_free (job);
+		}
+	}
 
-    if ((proc = opendir ("/cgroup/cpuset/lsf/euler")) == NULL)
+	/* Lost events only cost the accounting of the processes which exited
+	 * in the meantime; the tasks files are read on every interval anyway. */
+	if ((procev_g != NULL)
+			&& (procev_poll (procev_g, jm_process_event, NULL) < 0))
 	{
-		char errbuf[1024];
-		ERROR ("Cannot open `/cgroup/cpuset/lsf/euler': %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		return (-1);
+		DEBUG ("jobmetrics plugin: Process events have been lost.");
 	}
 
-	while ((ent = readdir (proc)) != NULL)
+	iter = c_avl_get_iterator (jobs_g);
+	while (c_avl_iterator_next (iter, (void *) &key, (void *) &job) == 0)
 	{
-	   if (ent->d_type & DT_DIR)
-        {	
-	     if (strcmp (ent->d_name, "..") != 0 && strcmp (ent->d_name, ".") != 0)
-         {
-            /*get jobid*/
-		    jobmetrics_read_jobid(ent->d_name, jobId);
-
-
-		    ssnprintf( filename , sizeof(filename), "%s/%s/%s", "/cgroup/cpuset/lsf/euler", ent->d_name,"tasks");	
-		    fp = fopen(filename,"r");
-            if (fp == NULL ){
-                     ERROR("jobmetrics plugin: could not open LSF fs");
-                     return -1;
-            }
-
-            /*if job is DONE, remove from list and close the open file*/
-            if ( fgets(line, 80, fp) == NULL){ 
-                jobmetrics_list_remove (jobId);
-                fclose(fp);
-            }
-            else
-            {
-                
-                /*read PIDs from a job, use LSF cgroups for this*/
-		        while(fgets(line, 80, fp) != NULL)
-                {
-                    sscanf (line, "%d", &pid);
-           		    ssnprintf (filename, sizeof(filename), "/proc/%i/stat", pid);
-                    if ((fh = fopen (filename, "r")) == NULL)	
-                        	return -1;
-
-                    /*get process name*/
-			        name[0] = '\0';
-                    if (fgets(line, sizeof(line), fh) != NULL)
-                	    jobmetrics_read_name(line, name);
-                    fclose(fh);
-
-                    /*we exclude any LSF process*/
-                    if ((strcmp(name,"res") != 0) && (!isdigit(name[0]))
-                        && (name[0] != '\0'))
-                    {
-                        /*if pid is not a thread than get some data from it*/
-     			        if ( !isthread(pid)) 
-			            {
-                            status = jobmetrics_read_process (pid, &ps, &state);
-                            if (status != 0 )
-                            {
-                                ERROR ("jobmetrics_read_process failed: %i", status);
-                                continue;
-                            }
-                            status = get_username(pid, username);
-                            if (status != 0 )
-                            {
-                                ERROR ("jobmetrics_read_username failed: %i", status);
-                                continue;
-                            }
-                            sstrncpy (ps.username, username, sizeof(ps.username));
-                            sstrncpy (ps.jobId, jobId, sizeof(ps.jobId));
-                            sstrncpy (ps.name, name, sizeof(ps.name));
-
-                            pse.id       = pid;
-                            pse.age      = 0;
-
-                            pse.num_proc   = ps.num_proc;
-                            pse.num_lwp    = ps.num_lwp;
-                            pse.vmem_size  = ps.vmem_size;
-                            pse.vmem_rss   = ps.vmem_rss;
-                            pse.vmem_data  = ps.vmem_data;
-                            pse.vmem_code  = ps.vmem_code;
-                            pse.stack_size = ps.stack_size;
-
-                            pse.voluntary_ctxt_switches = ps.voluntary_ctxt_switches;
-                            pse.nonvoluntary_ctxt_switches = ps.nonvoluntary_ctxt_switches;
-                            
-                            pse.vmem_minflt = 0;
-                            pse.vmem_minflt_counter = ps.vmem_minflt_counter;
-                            pse.vmem_majflt = 0;
-                            pse.vmem_majflt_counter = ps.vmem_majflt_counter;
-
-                            pse.cpu_user = 0;
-                            pse.cpu_user_counter = ps.cpu_user_counter;
-                            pse.cpu_system = 0;
-                            pse.cpu_system_counter = ps.cpu_system_counter;
-
-                            pse.io_rchar = ps.io_rchar;
-                            pse.io_wchar = ps.io_wchar;
-                            pse.io_syscr = ps.io_syscr;
-                            pse.io_syscw = ps.io_syscw;
-
-                            jobmetrics_list_add (ps.jobId, ps.name, ps.username, 
-                                jobmetrics_get_cmdline (pid, ps.name, 
-                                cmdline, sizeof (cmdline)),&pse);
-			            } /*end if(!isthread)*/
-		            }/*end if not LSF process*/
-	            }/*end while job has pid*/	
-		        fclose(fp);
-            }/*end if it is a running job*/
-          } /*end if .. . dir*/  
-	    }/*end if not dir*/
-	}/*end while have some file/dir inside the current dir*/
-
-	closedir (proc);
-
-	for (ps_ptr = list_head_g; ps_ptr != NULL; ps_ptr = ps_ptr->next)
+		if (conf_mode == JM_MODE_CGROUP)
+			status = jm_job_read_cgroup (job);
+		else
+			status = jm_job_read (job);
+		if (status > 0)
+			jobmetrics_submit_job (job);
+		else if (status < 0)
+		{
+			job->next_removed = removed;
+			removed = job;
+		}
+	}
+	c_avl_iterator_destroy (iter);
+
+	while ((job = removed) != NULL)
 	{
-		jobmetrics_submit_proc_list (ps_ptr);
-        //jobmetrics_submit_proc_sublist (ps_ptr);
+		removed = job->next_removed;
+		DEBUG ("jobmetrics plugin: Removing job %s.", job->jobId);
+		jm_job_free (job);
 	}
 
 /* #endif KERNEL_LINUX */
-#endif 
+#endif
 
 	return (0);
 } /* int jobmetrics_read */
 
+static int jobmetrics_shutdown (void)
+{
+#if KERNEL_LINUX
+	char *key;
+	jm_job_t *job;
+
+	procev_unsubscribe (procev_g);
+	procev_g = NULL;
+
+	if (jobs_g != NULL)
+	{
+		while (c_avl_pick (jobs_g, (void *) &key, (void *) &job) == 0)
+			jm_job_free (job);
+		c_avl_destroy (jobs_g);
+		jobs_g = NULL;
+	}
+#endif
+
+	if (pids_g != NULL)
+	{
+		c_avl_destroy (pids_g);
+		pids_g = NULL;
+	}
+
+	cgroup_watch_destroy (watch_g);
+	watch_g = NULL;
+
+	sfree (tasks_buffer_g);
+	tasks_buffer_size_g = 0;
+	sfree (conf_cgroup_path);
+	sfree (conf_cpuacct_path);
+	sfree (conf_memory_path);
+	sfree (conf_blkio_path);
+
+	return (0);
+} /* int jobmetrics_shutdown */
+
 void module_register (void)
 {
+	plugin_register_complex_config ("jobmetrics", jobmetrics_config);
 	plugin_register_init ("jobmetrics", jobmetrics_init);
 	plugin_register_read ("jobmetrics", jobmetrics_read);
+	plugin_register_shutdown ("jobmetrics", jobmetrics_shutdown);
 } /* void module_register */
@@ -0,0 +1,954 @@
+/**
+ * collectd - src/jobperf.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+/*
+ * Hardware performance counters of LSF jobs. Every directory below the LSF
+ * cpuset cgroup is one job, as in the jobmetrics plugin. For each job, a
+ * group of counters (cycles, instructions and last level cache misses) is
+ * opened with perf_event_open(2) in cgroup mode on every CPU of the job's
+ * cpuset. The kernel only counts while a task of the job runs on that CPU
+ * and multiplexes the groups if they do not fit on the PMU; one read(2) per
+ * group returns all counters together with the times needed for scaling.
+ *
+ * Uncore events cannot be attached to a cgroup, so the memory bandwidth of a
+ * job is estimated from its cache misses. The bandwidth of each package is
+ * read from the memory controllers' uncore PMUs, if the kernel has them.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+#include "utils_avltree.h"
+#include "utils_cgroup_watch.h"
+#include "utils_complain.h"
+#include "utils_procfile.h"
+
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+#ifndef PERF_FLAG_PID_CGROUP
+#define PERF_FLAG_PID_CGROUP (1UL << 2)
+#endif
+
+#define JP_CGROUP_PATH "/cgroup/cpuset/lsf/euler"
+#define JP_PERF_EVENT_PATH "/cgroup/perf_event/lsf/euler"
+#define JP_PMU_DIR "/sys/bus/event_source/devices"
+#define JP_NAME_LEN 256
+#define JP_MAX_CPUS 4096
+
+/* The counters of a job, in the order they are opened in a group. The
+ * first one leads the group. */
+enum { JP_CYCLES = 0, JP_INSTRUCTIONS, JP_LLC_MISSES, JP_EVENTS_NUM };
+
+static const struct {
+  const char *name;
+  uint64_t config;
+} jp_events[JP_EVENTS_NUM] = {
+    {"cycles", PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache-misses", PERF_COUNT_HW_CACHE_MISSES},
+};
+
+/* The group of counters of a job on one CPU, and the values of the last
+ * read. Counters the PMU does not support are not opened (fd is -1). */
+typedef struct {
+  int cpu;
+  int fd[JP_EVENTS_NUM];
+  uint64_t num;
+  uint64_t value[JP_EVENTS_NUM];
+  uint64_t time_enabled;
+  uint64_t time_running;
+} jp_group_t;
+
+typedef struct jp_job_s jp_job_t;
+struct jp_job_s {
+  char dirname[JP_NAME_LEN];
+  char jobId[JP_NAME_LEN];
+  unsigned long generation;
+
+  /* the job's CPUs, and the list the groups have been opened for */
+  procfile_t *cpus_file;
+  char *cpus;
+  jp_group_t *groups;
+  size_t groups_num;
+
+  /* scaled counts since the job was found */
+  uint64_t counter[JP_EVENTS_NUM];
+  cdtime_t last_read;
+
+  /* used to collect jobs which are to be removed */
+  jp_job_t *next_removed;
+};
+
+/* One memory controller of a package. Its counters count cache lines read
+ * and written, "scale" converts them to bytes. */
+typedef struct jp_imc_s {
+  unsigned int package;
+  int fd[2];
+  double scale[2];
+  struct jp_imc_s *next;
+} jp_imc_t;
+
+static const char *jp_imc_events[2] = {"cas_count_read", "cas_count_write"};
+
+static char *conf_cgroup_path = NULL;
+static char *conf_perf_event_path = NULL;
+static _Bool conf_memory_bandwidth = 1;
+static int conf_max_open_files = -1;
+
+/* set if CgroupPath is part of a cgroup v2 hierarchy */
+static _Bool cgroup_v2 = 0;
+
+static c_avl_tree_t *jobs_g = NULL;
+static cgroup_watch_t *watch_g = NULL;
+static unsigned long generation_g = 0;
+
+/* cleared at init if the PMU does not support an event */
+static _Bool supported_g[JP_EVENTS_NUM] = {1, 1, 1};
+static long cache_line_g = 64;
+static procfile_t *online_g = NULL;
+static c_complain_t perf_complaint = C_COMPLAIN_INIT_STATIC;
+
+/* counters open for jobs, and the limit from "MaxOpenFiles" */
+static long fds_open_g = 0;
+static long fds_max_g = 0;
+static c_complain_t fds_complaint = C_COMPLAIN_INIT_STATIC;
+
+static jp_imc_t *imcs_g = NULL;
+static unsigned int imc_packages_g = 0;
+
+static int jp_perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu,
+                              int group_fd, unsigned long flags) {
+  return (int)syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+/* Parses a CPU list such as "0-3,8,10-11". Stores up to "size" CPUs in
+ * "cpus" and returns their number, or -1 if the list is malformed. */
+static int jp_parse_cpulist(const char *list, int *cpus, int size) {
+  const char *ptr = list;
+  int num = 0;
+
+  while (*ptr != 0) {
+    char *end;
+    unsigned long first, last;
+
+    if ((*ptr == ',') || isspace((unsigned char)*ptr)) {
+      ptr++;
+      continue;
+    }
+
+    first = strtoul(ptr, &end, 10);
+    if (end == ptr)
+      return -1;
+    last = first;
+    if (*end == '-') {
+      ptr = end + 1;
+      last = strtoul(ptr, &end, 10);
+      if ((end == ptr) || (last < first))
+        return -1;
+    }
+    ptr = end;
+
+    for (; (first <= last) && (num < size); first++)
+      cpus[num++] = (int)first;
+  }
+
+  return num;
+}
+
+/* Reads a small sysfs file into "buffer", without the trailing newline. */
+static int jp_read_sysfs(const char *path, char *buffer, size_t size) {
+  ssize_t len;
+
+  if (access(path, R_OK) != 0)
+    return -1;
+  len = read_file_contents(path, buffer, size - 1);
+  if (len <= 0)
+    return -1;
+  while ((len > 0) && isspace((unsigned char)buffer[len - 1]))
+    len--;
+  buffer[len] = 0;
+  return 0;
+}
+
+static int jp_cpu_package(int cpu) {
+  char path[PATH_MAX];
+  char buffer[32];
+
+  ssnprintf(path, sizeof(path),
+            "/sys/devices/system/cpu/cpu%i/topology/physical_package_id", cpu);
+  if (jp_read_sysfs(path, buffer, sizeof(buffer)) != 0)
+    return 0;
+  return atoi(buffer);
+}
+
+/*
+ * Groups of counters
+ */
+
+/* Opens each event once for the calling thread to find out whether the PMU
+ * supports it. Failures when opening the groups of a job later on are
+ * errors of that job, such as a cgroup that went away. Returns -1 if the
+ * group leader is not supported. */
+static int jp_probe_events(void) {
+  int i;
+
+  for (i = 0; i < JP_EVENTS_NUM; i++) {
+    struct perf_event_attr attr = {0};
+    int fd;
+
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = jp_events[i].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    fd = jp_perf_event_open(&attr, /* pid = */ 0, /* cpu = */ -1,
+                            /* group_fd = */ -1, /* flags = */ 0);
+    if (fd >= 0) {
+      close(fd);
+      continue;
+    }
+    /* Anything else, such as EACCES, says nothing about the PMU. */
+    if ((errno != ENOENT) && (errno != EOPNOTSUPP) && (errno != EINVAL))
+      continue;
+
+    if (i == JP_CYCLES) {
+      ERROR("jobperf plugin: The PMU does not support %s.", jp_events[i].name);
+      return -1;
+    }
+    WARNING("jobperf plugin: The PMU does not support %s, it is not "
+            "collected.",
+            jp_events[i].name);
+    supported_g[i] = 0;
+  }
+
+  return 0;
+}
+
+static void jp_group_close(jp_group_t *g) {
+  int i;
+
+  /* members first, closing the leader would detach them */
+  for (i = JP_EVENTS_NUM - 1; i >= 0; i--)
+    if (g->fd[i] >= 0) {
+      close(g->fd[i]);
+      g->fd[i] = -1;
+      fds_open_g--;
+    }
+  g->num = 0;
+}
+
+static int jp_group_open(jp_group_t *g, int cgroup_fd, int cpu) {
+  int i;
+
+  g->cpu = cpu;
+  g->num = 0;
+  for (i = 0; i < JP_EVENTS_NUM; i++)
+    g->fd[i] = -1;
+
+  for (i = 0; i < JP_EVENTS_NUM; i++) {
+    struct perf_event_attr attr = {0};
+    int fd;
+
+    if (!supported_g[i])
+      continue;
+
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = jp_events[i].config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    fd = jp_perf_event_open(&attr, cgroup_fd, cpu,
+                            (g->num == 0) ? -1 : g->fd[JP_CYCLES],
+                            PERF_FLAG_PID_CGROUP);
+    if (fd < 0) {
+      int saved_errno = errno;
+      jp_group_close(g);
+      errno = saved_errno;
+      return -1;
+    }
+
+    g->fd[i] = fd;
+    g->num++;
+    fds_open_g++;
+  }
+
+  return 0;
+}
+
+/* Adds the increase of the group's counters since the last read to "delta".
+ * A group which was multiplexed with others has only been counting for part
+ * of the time; its increase is scaled up to the whole time. */
+static int jp_group_read(jp_group_t *g, uint64_t delta[JP_EVENTS_NUM]) {
+  /* PERF_FORMAT_GROUP: number of counters, times, then the values */
+  uint64_t buffer[3 + JP_EVENTS_NUM];
+  uint64_t enabled, running;
+  ssize_t len;
+  size_t j = 3;
+  int i;
+
+  len = read(g->fd[JP_CYCLES], buffer, sizeof(buffer));
+  if ((len < (ssize_t)(3 * sizeof(uint64_t))) || (buffer[0] != g->num))
+    return -1;
+
+  enabled = buffer[1] - g->time_enabled;
+  running = buffer[2] - g->time_running;
+  g->time_enabled = buffer[1];
+  g->time_running = buffer[2];
+
+  for (i = 0; i < JP_EVENTS_NUM; i++) {
+    uint64_t d;
+
+    if (g->fd[i] < 0)
+      continue;
+
+    d = buffer[j] - g->value[i];
+    g->value[i] = buffer[j];
+    j++;
+
+    if ((running > 0) && (running < enabled))
+      d = (uint64_t)((double)d * (double)enabled / (double)running);
+    delta[i] += d;
+  }
+
+  return 0;
+}
+
+/*
+ * Jobs
+ */
+static void jp_job_close(jp_job_t *job) {
+  size_t i;
+
+  for (i = 0; i < job->groups_num; i++)
+    jp_group_close(&job->groups[i]);
+  sfree(job->groups);
+  job->groups_num = 0;
+  sfree(job->cpus);
+}
+
+/* Opens the groups of a job on the CPUs in "cpus". Returns 0 on success and
+ * -1 if the job's perf_event cgroup is not there (yet) or its counters would
+ * exceed "MaxOpenFiles". A job is counted on all of its CPUs or not at all. */
+static int jp_job_open(jp_job_t *job, const char *cpus) {
+  char path[PATH_MAX];
+  int cpu_list[JP_MAX_CPUS];
+  int cpus_num;
+  int events_num = 0;
+  int cgroup_fd;
+  int i;
+
+  cpus_num = jp_parse_cpulist(cpus, cpu_list, STATIC_ARRAY_SIZE(cpu_list));
+  if (cpus_num <= 0)
+    return -1;
+
+  for (i = 0; i < JP_EVENTS_NUM; i++)
+    if (supported_g[i])
+      events_num++;
+  if (fds_open_g + (long)cpus_num * events_num > fds_max_g) {
+    c_complain_once(LOG_WARNING, &fds_complaint,
+                    "jobperf plugin: Not counting job %s and others: "
+                    "MaxOpenFiles (%li) has been reached.",
+                    job->jobId, fds_max_g);
+    return -1;
+  }
+
+  ssnprintf(path, sizeof(path), "%s/%s", conf_perf_event_path, job->dirname);
+  cgroup_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (cgroup_fd < 0) {
+    DEBUG("jobperf plugin: Cannot open `%s' yet.", path);
+    return -1;
+  }
+
+  job->groups = calloc((size_t)cpus_num, sizeof(*job->groups));
+  job->cpus = strdup(cpus);
+  if ((job->groups == NULL) || (job->cpus == NULL)) {
+    ERROR("jobperf plugin: calloc failed.");
+    close(cgroup_fd);
+    jp_job_close(job);
+    return -1;
+  }
+
+  for (i = 0; i < cpus_num; i++) {
+    if (jp_group_open(&job->groups[job->groups_num], cgroup_fd,
+                      cpu_list[i]) != 0) {
+      char errbuf[1024];
+      c_complain(LOG_ERR, &perf_complaint,
+                 "jobperf plugin: Opening the counters of job %s on cpu %i "
+                 "failed: %s",
+                 job->jobId, cpu_list[i],
+                 sstrerror(errno, errbuf, sizeof(errbuf)));
+      continue;
+    }
+    job->groups_num++;
+  }
+  close(cgroup_fd);
+
+  if (job->groups_num == 0) {
+    jp_job_close(job);
+    return -1;
+  }
+
+  c_release(LOG_INFO, &perf_complaint,
+            "jobperf plugin: Opening counters succeeded again.");
+  DEBUG("jobperf plugin: Counting job %s on cpus %s.", job->jobId, job->cpus);
+  return 0;
+}
+
+static jp_job_t *jp_job_add(const char *dirname) {
+  char path[PATH_MAX];
+  jp_job_t *job;
+
+  if (c_avl_get(jobs_g, dirname, (void *)&job) == 0)
+    return job;
+
+  job = calloc(1, sizeof(*job));
+  if (job == NULL) {
+    ERROR("jobperf plugin: calloc failed.");
+    return NULL;
+  }
+
+  sstrncpy(job->dirname, dirname, sizeof(job->dirname));
+  cgroup_job_id(dirname, job->jobId, sizeof(job->jobId));
+
+  ssnprintf(path, sizeof(path), "%s/%s/%s", conf_cgroup_path, dirname,
+            cgroup_v2 ? "cpuset.cpus.effective" : "cpuset.cpus");
+  job->cpus_file = procfile_create(path);
+
+  if ((job->cpus_file == NULL) ||
+      (c_avl_insert(jobs_g, job->dirname, job) != 0)) {
+    ERROR("jobperf plugin: Adding job %s failed.", dirname);
+    procfile_destroy(job->cpus_file);
+    free(job);
+    return NULL;
+  }
+
+  DEBUG("jobperf plugin: Added job %s (%s).", job->jobId, dirname);
+  return job;
+}
+
+static void jp_job_free(jp_job_t *job) {
+  c_avl_remove(jobs_g, job->dirname, NULL, NULL);
+  jp_job_close(job);
+  procfile_destroy(job->cpus_file);
+  free(job);
+}
+
+static void jp_submit(const char *plugin_instance, const char *type,
+                      value_t *values, size_t values_len) {
+  value_list_t vl = VALUE_LIST_INIT;
+
+  vl.values = values;
+  vl.values_len = values_len;
+  sstrncpy(vl.host, hostname_g, sizeof(vl.host));
+  sstrncpy(vl.plugin, "jobperf", sizeof(vl.plugin));
+  sstrncpy(vl.plugin_instance, plugin_instance, sizeof(vl.plugin_instance));
+  sstrncpy(vl.type, type, sizeof(vl.type));
+
+  plugin_dispatch_values(&vl);
+}
+
+static void jp_job_submit(jp_job_t *job, const uint64_t delta[JP_EVENTS_NUM],
+                          double interval) {
+  static const char *types[JP_EVENTS_NUM] = {"jm_cycles", "jm_instructions",
+                                             "jm_llc_misses"};
+  value_t value;
+  int i;
+
+  for (i = 0; i < JP_EVENTS_NUM; i++) {
+    if (!supported_g[i])
+      continue;
+    value.derive = (derive_t)job->counter[i];
+    jp_submit(job->jobId, types[i], &value, 1);
+  }
+
+  /* Rates need a previous read. Without cycles the job did not run. */
+  if ((interval <= 0.0) || (delta[JP_CYCLES] == 0))
+    return;
+
+  if (supported_g[JP_INSTRUCTIONS]) {
+    value.gauge = (gauge_t)delta[JP_INSTRUCTIONS] / (gauge_t)delta[JP_CYCLES];
+    jp_submit(job->jobId, "jm_ipc", &value, 1);
+  }
+
+  if (supported_g[JP_LLC_MISSES]) {
+    value.gauge = (gauge_t)delta[JP_LLC_MISSES] * (gauge_t)cache_line_g /
+                  (gauge_t)interval;
+    jp_submit(job->jobId, "jm_mem_bandwidth", &value, 1);
+  }
+}
+
+/* Reads the counters of a job. Returns -1 if the job is gone. */
+static int jp_job_read(jp_job_t *job, cdtime_t now) {
+  uint64_t delta[JP_EVENTS_NUM] = {0};
+  char *cpus = NULL;
+  size_t read_num = 0;
+  double interval;
+  size_t i;
+
+  if (job->cpus_file != NULL) {
+    cpus = procfile_read(job->cpus_file, NULL);
+    if ((cpus == NULL) && (errno == ENOENT)) {
+      char path[PATH_MAX];
+
+      ssnprintf(path, sizeof(path), "%s/%s", conf_cgroup_path, job->dirname);
+      if (access(path, F_OK) != 0)
+        return -1;
+
+      /* no cpuset controller: the job may run everywhere */
+      procfile_destroy(job->cpus_file);
+      job->cpus_file = NULL;
+    }
+  }
+  if (job->cpus_file == NULL)
+    cpus = procfile_read(online_g, NULL);
+  if (cpus == NULL)
+    return 0;
+  while (isspace((unsigned char)*cpus))
+    cpus++;
+  /* LSF fills in the cpuset after creating the directory */
+  if (*cpus == 0)
+    return 0;
+  cpus[strcspn(cpus, "\n")] = 0;
+
+  if ((job->cpus == NULL) || (strcmp(job->cpus, cpus) != 0)) {
+    jp_job_close(job);
+    if (jp_job_open(job, cpus) == 0)
+      job->last_read = now;
+    /* start counting from here */
+    return 0;
+  }
+
+  for (i = 0; i < job->groups_num; i++)
+    if (jp_group_read(&job->groups[i], delta) == 0)
+      read_num++;
+
+  /* The counters are gone, e.g. with the job's perf_event cgroup. Open them
+   * again on the next read. */
+  if (read_num == 0) {
+    jp_job_close(job);
+    return 0;
+  }
+
+  for (i = 0; i < JP_EVENTS_NUM; i++)
+    job->counter[i] += delta[i];
+
+  interval = CDTIME_T_TO_DOUBLE(now - job->last_read);
+  job->last_read = now;
+
+  jp_job_submit(job, delta, interval);
+  return 0;
+}
+
+/*
+ * Memory controllers
+ */
+
+/* Translates an event of a PMU, e.g. "event=0x04,umask=0x03", into the
+ * config of perf_event_attr using the PMU's format descriptions, e.g.
+ * "config:0-7" and "config:8-15". */
+static int jp_pmu_event_config(const char *pmu, const char *event,
+                               uint64_t *config) {
+  char path[PATH_MAX];
+  char buffer[256];
+  char *saveptr = NULL;
+  char *term;
+
+  ssnprintf(path, sizeof(path), JP_PMU_DIR "/%s/events/%s", pmu, event);
+  if (jp_read_sysfs(path, buffer, sizeof(buffer)) != 0)
+    return -1;
+
+  *config = 0;
+  for (term = strtok_r(buffer, ",", &saveptr); term != NULL;
+       term = strtok_r(NULL, ",", &saveptr)) {
+    char format[64];
+    char *value_str = strchr(term, '=');
+    uint64_t value = 1;
+    unsigned int lo, hi;
+    int n;
+
+    if (value_str != NULL) {
+      *value_str = 0;
+      value = (uint64_t)strtoull(value_str + 1, NULL, 0);
+    }
+
+    ssnprintf(path, sizeof(path), JP_PMU_DIR "/%s/format/%s", pmu, term);
+    if (jp_read_sysfs(path, format, sizeof(format)) != 0)
+      return -1;
+
+    n = sscanf(format, "config:%u-%u", &lo, &hi);
+    if (n == 1)
+      hi = lo;
+    else if (n != 2)
+      return -1; /* config1 and config2 are not needed here */
+    if ((hi < lo) || (hi > 63))
+      return -1;
+
+    if (hi - lo < 63)
+      value &= (UINT64_C(1) << (hi - lo + 1)) - 1;
+    *config |= value << lo;
+  }
+
+  return 0;
+}
+
+static double jp_pmu_event_scale(const char *pmu, const char *event) {
+  char path[PATH_MAX];
+  char buffer[64];
+  double scale;
+
+  ssnprintf(path, sizeof(path), JP_PMU_DIR "/%s/events/%s.scale", pmu, event);
+  if (jp_read_sysfs(path, buffer, sizeof(buffer)) != 0)
+    return (double)cache_line_g;
+  scale = atof(buffer);
+
+  ssnprintf(path, sizeof(path), JP_PMU_DIR "/%s/events/%s.unit", pmu, event);
+  if ((jp_read_sysfs(path, buffer, sizeof(buffer)) == 0) &&
+      (strcmp("MiB", buffer) == 0))
+    scale *= 1048576.0;
+  return scale;
+}
+
+static void jp_imc_close(void) {
+  while (imcs_g != NULL) {
+    jp_imc_t *imc = imcs_g;
+    size_t i;
+
+    imcs_g = imc->next;
+    for (i = 0; i < STATIC_ARRAY_SIZE(imc->fd); i++)
+      if (imc->fd[i] >= 0)
+        close(imc->fd[i]);
+    free(imc);
+  }
+  imc_packages_g = 0;
+}
+
+/* Opens the read and write counters of the memory controllers, once on
+ * each package as listed in the PMU's cpumask. */
+static void jp_imc_open(void) {
+  DIR *dh;
+  struct dirent *ent;
+
+  dh = opendir(JP_PMU_DIR);
+  if (dh == NULL)
+    return;
+
+  while ((ent = readdir(dh)) != NULL) {
+    struct perf_event_attr attr[2];
+    uint64_t config[2];
+    char path[PATH_MAX];
+    char buffer[256];
+    int cpus[JP_MAX_CPUS];
+    int cpus_num;
+    uint32_t type;
+    size_t i;
+    int cpu;
+
+    if (strncmp("uncore_imc", ent->d_name, strlen("uncore_imc")) != 0)
+      continue;
+
+    ssnprintf(path, sizeof(path), JP_PMU_DIR "/%s/type", ent->d_name);
+    if (jp_read_sysfs(path, buffer, sizeof(buffer)) != 0)
+      continue;
+    type = (uint32_t)strtoul(buffer, NULL, 0);
+
+    ssnprintf(path, sizeof(path), JP_PMU_DIR "/%s/cpumask", ent->d_name);
+    if (jp_read_sysfs(path, buffer, sizeof(buffer)) != 0)
+      continue;
+    cpus_num = jp_parse_cpulist(buffer, cpus, STATIC_ARRAY_SIZE(cpus));
+
+    if ((jp_pmu_event_config(ent->d_name, jp_imc_events[0], &config[0]) !=
+         0) ||
+        (jp_pmu_event_config(ent->d_name, jp_imc_events[1], &config[1]) != 0))
+      continue;
+
+    memset(attr, 0, sizeof(attr));
+    for (i = 0; i < STATIC_ARRAY_SIZE(attr); i++) {
+      attr[i].size = sizeof(attr[i]);
+      attr[i].type = type;
+      attr[i].config = config[i];
+    }
+
+    for (cpu = 0; cpu < cpus_num; cpu++) {
+      jp_imc_t *imc;
+
+      imc = calloc(1, sizeof(*imc));
+      if (imc == NULL)
+        break;
+      imc->package = (unsigned int)jp_cpu_package(cpus[cpu]);
+
+      for (i = 0; i < STATIC_ARRAY_SIZE(imc->fd); i++) {
+        imc->fd[i] = jp_perf_event_open(&attr[i], -1, cpus[cpu], -1, 0);
+        imc->scale[i] = jp_pmu_event_scale(ent->d_name, jp_imc_events[i]);
+      }
+      if ((imc->fd[0] < 0) || (imc->fd[1] < 0)) {
+        char errbuf[1024];
+        WARNING("jobperf plugin: Opening the counters of %s on cpu %i "
+                "failed: %s",
+                ent->d_name, cpus[cpu],
+                sstrerror(errno, errbuf, sizeof(errbuf)));
+        for (i = 0; i < STATIC_ARRAY_SIZE(imc->fd); i++)
+          if (imc->fd[i] >= 0)
+            close(imc->fd[i]);
+        free(imc);
+        continue;
+      }
+
+      if (imc->package >= imc_packages_g)
+        imc_packages_g = imc->package + 1;
+      imc->next = imcs_g;
+      imcs_g = imc;
+    }
+  }
+  closedir(dh);
+
+  if (imcs_g == NULL)
+    NOTICE("jobperf plugin: No memory controller counters found, the memory "
+           "bandwidth of the packages is not collected.");
+}
+
+static void jp_imc_read(void) {
+  uint64_t bytes[2][imc_packages_g];
+  jp_imc_t *imc;
+  unsigned int pkg;
+  size_t i;
+
+  if (imcs_g == NULL)
+    return;
+
+  memset(bytes, 0, sizeof(bytes));
+  for (imc = imcs_g; imc != NULL; imc = imc->next) {
+    for (i = 0; i < STATIC_ARRAY_SIZE(imc->fd); i++) {
+      uint64_t count;
+
+      if (read(imc->fd[i], &count, sizeof(count)) != sizeof(count))
+        continue;
+      bytes[i][imc->package] += (uint64_t)((double)count * imc->scale[i]);
+    }
+  }
+
+  for (pkg = 0; pkg < imc_packages_g; pkg++) {
+    char name[DATA_MAX_NAME_LEN];
+    value_t values[2];
+
+    values[0].derive = (derive_t)bytes[0][pkg];
+    values[1].derive = (derive_t)bytes[1][pkg];
+    ssnprintf(name, sizeof(name), "pkg%02u", pkg);
+    jp_submit(name, "mem_octets", values, STATIC_ARRAY_SIZE(values));
+  }
+}
+
+/*
+ * Finding jobs
+ */
+
+static void jp_job_found(const char *dirname,
+                         __attribute__((unused)) void *user_data) {
+  jp_job_t *job = jp_job_add(dirname);
+
+  if (job != NULL)
+    job->generation = generation_g;
+}
+
+static void jp_job_lost(const char *dirname,
+                        __attribute__((unused)) void *user_data) {
+  jp_job_t *job;
+
+  if (c_avl_get(jobs_g, dirname, (void *)&job) != 0)
+    return;
+
+  DEBUG("jobperf plugin: Removing job %s.", job->jobId);
+  jp_job_free(job);
+}
+
+/*
+ * Plugin callbacks
+ */
+static int jobperf_config(oconfig_item_t *ci) {
+  int i;
+
+  for (i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp("CgroupPath", child->key) == 0)
+      cf_util_get_string(child, &conf_cgroup_path);
+    else if (strcasecmp("PerfEventPath", child->key) == 0)
+      cf_util_get_string(child, &conf_perf_event_path);
+    else if (strcasecmp("MemoryBandwidth", child->key) == 0)
+      cf_util_get_boolean(child, &conf_memory_bandwidth);
+    else if (strcasecmp("MaxOpenFiles", child->key) == 0)
+      cf_util_get_int(child, &conf_max_open_files);
+    else
+      WARNING("jobperf plugin: Ignoring unknown config option `%s'.",
+              child->key);
+  }
+
+  return 0;
+}
+
+static int jobperf_init(void) {
+  char filename[PATH_MAX];
+  long line;
+
+  if (conf_cgroup_path == NULL)
+    conf_cgroup_path = strdup(JP_CGROUP_PATH);
+  if (conf_cgroup_path == NULL) {
+    ERROR("jobperf plugin: strdup failed.");
+    return -1;
+  }
+
+  /* With cgroup v2 the job's directory is its perf_event cgroup as well. */
+  ssnprintf(filename, sizeof(filename), "%s/cgroup.controllers",
+            conf_cgroup_path);
+  cgroup_v2 = (access(filename, R_OK) == 0);
+  if (conf_perf_event_path == NULL)
+    conf_perf_event_path =
+        strdup(cgroup_v2 ? conf_cgroup_path : JP_PERF_EVENT_PATH);
+  if (conf_perf_event_path == NULL) {
+    ERROR("jobperf plugin: strdup failed.");
+    return -1;
+  }
+
+  if (jp_probe_events() != 0)
+    return -1;
+
+  line = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+  if (line > 0)
+    cache_line_g = line;
+
+  /* Every job holds one counter per event and CPU. Leave half of the
+   * descriptors to the rest of the daemon unless the limit has been
+   * configured explicitly. */
+  if (conf_max_open_files >= 0)
+    fds_max_g = conf_max_open_files;
+  else {
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+      fds_max_g = 512;
+    else if (rl.rlim_cur == RLIM_INFINITY)
+      fds_max_g = 4096;
+    else
+      fds_max_g = (long)(rl.rlim_cur / 2);
+  }
+
+  if (online_g == NULL)
+    online_g = procfile_create("/sys/devices/system/cpu/online");
+  if (jobs_g == NULL)
+    jobs_g = c_avl_create((int (*)(const void *, const void *))strcmp);
+  if (watch_g == NULL)
+    watch_g = cgroup_watch_create("jobperf", conf_cgroup_path, /* depth = */ 1);
+  if ((online_g == NULL) || (jobs_g == NULL) || (watch_g == NULL)) {
+    ERROR("jobperf plugin: Allocating the job list failed.");
+    return -1;
+  }
+
+  if (conf_memory_bandwidth && (imcs_g == NULL))
+    jp_imc_open();
+
+  INFO("jobperf plugin: Counting jobs in %s (cgroup v%i).",
+       conf_perf_event_path, cgroup_v2 ? 2 : 1);
+  return 0;
+}
+
+static int jobperf_read(void) {
+  c_avl_iterator_t *iter;
+  jp_job_t *job;
+  jp_job_t *removed = NULL;
+  cdtime_t now;
+  char *key;
+  int status;
+
+  generation_g++;
+  status = cgroup_watch_read(watch_g, jp_job_found, jp_job_lost, NULL);
+  if (status < 0)
+    return -1;
+
+  now = cdtime();
+  iter = c_avl_get_iterator(jobs_g);
+  while (c_avl_iterator_next(iter, (void *)&key, (void *)&job) == 0) {
+    /* After the directory has been listed, jobs not found are gone. */
+    if (((status > 0) && (job->generation != generation_g)) ||
+        (jp_job_read(job, now) < 0)) {
+      job->next_removed = removed;
+      removed = job;
+    }
+  }
+  c_avl_iterator_destroy(iter);
+
+  while ((job = removed) != NULL) {
+    removed = job->next_removed;
+    DEBUG("jobperf plugin: Removing job %s.", job->jobId);
+    jp_job_free(job);
+  }
+
+  jp_imc_read();
+  return 0;
+}
+
+static int jobperf_shutdown(void) {
+  char *key;
+  jp_job_t *job;
+
+  if (jobs_g != NULL) {
+    while (c_avl_pick(jobs_g, (void *)&key, (void *)&job) == 0) {
+      jp_job_close(job);
+      procfile_destroy(job->cpus_file);
+      free(job);
+    }
+    c_avl_destroy(jobs_g);
+    jobs_g = NULL;
+  }
+
+  jp_imc_close();
+
+  cgroup_watch_destroy(watch_g);
+  watch_g = NULL;
+
+  procfile_destroy(online_g);
+  online_g = NULL;
+  sfree(conf_cgroup_path);
+  sfree(conf_perf_event_path);
+
+  return 0;
+}
+
+void module_register(void) {
+  plugin_register_complex_config("jobperf", jobperf_config);
+  plugin_register_init("jobperf", jobperf_init);
+  plugin_register_read("jobperf", jobperf_read);
+  plugin_register_shutdown("jobperf", jobperf_shutdown);
+}
+
+/* vim: set sw=2 sts=2 et : */
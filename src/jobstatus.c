@@ -22,6 +22,8 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_avltree.h"
+#include "jobstatus.h"
 
 #include <unistd.h>
 
@@ -48,6 +50,9 @@ static const char *config_keys[] =
 {
 	"LSF_SERVERDIR",
 	"LSF_ENVDIR",
+	"ReportChangedJobsOnly",
+	"DependencyCacheTimeout",
+	"MaxDependencyQueries",
 };
 
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
@@ -62,7 +67,6 @@ typedef struct  jobstatus
     unsigned long ndep;
 	unsigned long npend;
 	unsigned long nrun;
-	struct jobstatus *next;
 } jobstatus_t;
 
 typedef struct  jobresources
@@ -75,11 +79,41 @@ typedef struct  jobresources
     unsigned long runtime;
     unsigned long memory;
     unsigned long scratch;
-    struct jobresources *next;
 } jobresources_t;
 
-static jobstatus_t 	*list_head_g = NULL;
-static jobresources_t 	*list_head_res_g = NULL;
+/* What is known about a job from the previous reads. Only jobs whose state
+ * differs from what LSF reports are processed again. */
+typedef struct jobstate
+{
+	LS_LONG_INT id;
+	int status;
+	int numExHosts;
+	time_t jRusageUpdateTime;
+	unsigned long generation;
+	_Bool changed;
+
+	/* cached result of lsb_getjobdepinfo */
+	unsigned long ndep;
+	_Bool ndep_valid;
+	cdtime_t ndep_time;
+
+	jobstatus_t *user;
+	jobresources_t res;
+
+	/* used to collect jobs which are done */
+	struct jobstate *next_done;
+} jobstate_t;
+
+/* users by name and jobs by LSF job ID */
+static c_avl_tree_t *users_g = NULL;
+static c_avl_tree_t *jobs_g = NULL;
+
+static unsigned long generation_g = 0;
+static _Bool lsb_initialized = 0;
+
+static _Bool report_changed_only = 0;
+static cdtime_t dependency_cache_timeout = TIME_T_TO_CDTIME_T (300);
+static int max_dependency_queries = 100;
 
 static void jobstatus_submit_user (jobstatus_t *js)
 {
@@ -169,112 +203,90 @@ static void jobstatus_submit_resources (jobresources_t *js)
 
 }
 
-static void jobstatus_list_add_user (jobstatus_t *js)
+static int jobstatus_id_compare (const void *a, const void *b)
 {
-	jobstatus_t *new;
-
-	new = js;
-    if (new == NULL)
-         return;
-
-    sstrncpy(new->name, js->name, sizeof(new->name));
-    new->nrun = js->nrun;
-    new->npend = js->npend;
-    new->ncores_run = js->ncores_run;
-    new->ncores_pend = js->ncores_pend;
-    new->ndep = js->ndep;
-	new->next = NULL;
-
-	if (list_head_g == NULL){
-		list_head_g = new;
-	}	
-	else{
+	LS_LONG_INT id_a = *((const LS_LONG_INT *) a);
+	LS_LONG_INT id_b = *((const LS_LONG_INT *) b);
 
-		jobstatus_t *ps = list_head_g;
-       	jobstatus_t *last_ps;
-		while(ps != NULL && strcmp(ps->name,js->name) != 0)
-		{
-			last_ps = ps;
-			ps = ps->next;			
-		}	
-	
-		if (ps == NULL){
-			last_ps->next = new;
-		}	
-		else{
-			ps->nrun += new->nrun;
-			ps->npend += new->npend;
-			ps->ncores_run += new->ncores_run;
-			ps->ncores_pend += new->ncores_pend;
-            ps->ndep += new->ndep;
-		}
-	}	
+	if (id_a < id_b)
+		return (-1);
+	else if (id_a > id_b)
+		return (1);
+	return (0);
 }
 
-static void jobstatus_list_add_res (jobresources_t *js)
+/* returns the aggregate of a user, creating it if necessary */
+static jobstatus_t *jobstatus_user_get (const char *name)
 {
-    jobresources_t *new;
-
-    new = js;
-    if (new == NULL)
-         return;
-
-    sstrncpy(new->jobId, js->jobId, sizeof(js->jobId));
-    sstrncpy(new->username, js->username, sizeof(js->username));
-    new->ncores = js->ncores;
-    new->runtime = js->runtime;
-    new->memory = js->memory;
-    new->scratch = js->scratch;
-    new->reasons = js->reasons;
-    new->subreasons = js->subreasons;
-    new->next = NULL;
-
-    if (list_head_res_g == NULL){
-        list_head_res_g = new;
-    }
-    else{
-
-            jobresources_t *ps = list_head_res_g;
-            jobresources_t *last_ps;
-            while(ps != NULL && strcmp(ps->jobId,js->jobId) != 0)
-            {
-                last_ps = ps;
-                ps = ps->next;
-            }
-            if (ps == NULL){
-                last_ps->next = new;
-            }
-            else{
-		sstrncpy(ps->username, new->username, sizeof(new->username));
-                ps->ncores = new->ncores;
-                ps->memory = new->memory;
-                ps->scratch = new->scratch;
-                ps->runtime = new->runtime;
-                ps->reasons = new->reasons;
-                ps->subreasons = new->subreasons;
-            }
-        }
+	jobstatus_t *js;
+
+	if (c_avl_get (users_g, name, (void *) &js) == 0)
+		return (js);
+
+	js = calloc (1, sizeof (*js));
+	if (js == NULL)
+		return (NULL);
+	sstrncpy (js->name, name, sizeof (js->name));
+
+	if (c_avl_insert (users_g, js->name, js) != 0)
+	{
+		free (js);
+		return (NULL);
+	}
+
+	return (js);
 }
 
-static void jobstatus_list_reset (void)
+/* adds (sign = 1) or removes (sign = -1) the share of a job to its user */
+static void jobstatus_user_account (jobstate_t *state, int sign)
 {
-    jobstatus_t *ps;
-    jobresources_t *ps_res;
-
-    ps = list_head_g;
-    ps_res = list_head_res_g;   
-
-   while( list_head_res_g!= NULL) {
-            ps_res = list_head_res_g;
-            list_head_res_g = list_head_res_g->next;
-            free(ps_res);
-        }	
-    
-    while( list_head_g!= NULL) {
-            ps = list_head_g;
-            list_head_g = list_head_g->next;
-            free(ps);
-        }
+	jobstatus_t *js = state->user;
+	unsigned long ncores;
+
+	if (js == NULL)
+		return;
+
+	//TODO: RUN_JOB define can't be used, using for now the value
+	if (state->status == 4)
+	{
+		ncores = (unsigned long) state->numExHosts;
+		if (sign > 0)
+		{
+			js->nrun++;
+			js->ncores_run += ncores;
+		}
+		else
+		{
+			js->nrun--;
+			js->ncores_run -= ncores;
+		}
+	}
+	else
+	{
+		ncores = state->res.ncores;
+		if (sign > 0)
+		{
+			js->npend++;
+			js->ncores_pend += ncores;
+		}
+		else
+		{
+			js->npend--;
+			js->ncores_pend -= ncores;
+		}
+	}
+
+	if (sign > 0)
+		js->ndep += state->ndep;
+	else
+		js->ndep -= state->ndep;
+}
+
+static void jobstatus_job_remove (jobstate_t *state)
+{
+	jobstatus_user_account (state, -1);
+	c_avl_remove (jobs_g, &state->id, NULL, NULL);
+	free (state);
 }
 
 /*
@@ -348,75 +360,120 @@ static int get_rr_scratch(char *rr) {
 }
 
 
-static jobstatus_t* read_single_job_user (struct jobInfoEnt *job, jobstatus_t *js)
+static void read_single_job_res (struct jobInfoEnt *job, jobresources_t *js)
 {
-    if (job == NULL)
-        return NULL;
+    if(LSB_ARRAY_IDX(job->jobId) > 0){
+        ssnprintf (js->jobId, sizeof (js->jobId), "%d.%d", LSB_ARRAY_JOBID(job->jobId),LSB_ARRAY_IDX(job->jobId));
+    }
+    else
+        ssnprintf (js->jobId, sizeof (js->jobId), "%lli", job->jobId);
+    sstrncpy(js->username, job->user, sizeof(js->username));
+    js->ncores = job->submit.numProcessors;
+    js->memory = get_rr_mem(job->submit.resReq);
+    js->scratch = get_rr_scratch(job->submit.resReq);
+}
 
-        sstrncpy(js->name, job->user, sizeof(js->name));
+/* Number of unsatisfied dependencies of a pending job. The answer is cached
+ * for "DependencyCacheTimeout" and at most "MaxDependencyQueries" queries
+ * are sent to the master per read. */
+static void read_single_job_dep (jobstate_t *state, cdtime_t now,
+		int *queries)
+{
+	struct jobDepRequest jobdepReq;
+	struct jobDependInfo *jobDep;
 
-	//TODO: RUN_JOB define can't be used, using for now the value
-	if (job->status == 4){
-		js->nrun = 1;
-		js->npend = 0;
-		js->ncores_run = job->numExHosts;
-        js->ncores_pend = 0;
-    }
-	else{
-		js->npend = 1;
-		js->nrun = 0;
-		js->ncores_run = 0;
-		js->ncores_pend = job->submit.numProcessors;
-    }
+	if (state->ndep_valid
+			&& ((dependency_cache_timeout == 0)
+				|| ((now - state->ndep_time) < dependency_cache_timeout)))
+		return;
 
-	js->next = NULL;
-    return js;
+	if ((max_dependency_queries > 0) && (*queries >= max_dependency_queries))
+		return;
+	(*queries)++;
+
+	jobdepReq.jobId = state->id;
+	jobdepReq.options = QUERY_DEPEND_UNSATISFIED;
+	jobDep = lsb_getjobdepinfo(&jobdepReq);
+
+	state->ndep = (jobDep != NULL) ? (unsigned long) jobDep->numJobs : 0;
+	state->ndep_valid = 1;
+	state->ndep_time = now;
 }
 
-static jobresources_t* read_single_job_res (struct jobInfoEnt *job, jobresources_t *js)
+/* Updates the state kept for a job from what LSF reports. Returns the
+ * state or NULL on failure. */
+static jobstate_t *read_single_job (struct jobInfoEnt *job, cdtime_t now,
+		int *queries)
 {
-    if (job == NULL)
-        return NULL;
+	jobstate_t *state;
+	unsigned long ndep;
 
-    char jobId[JOB_NAME_LEN];
+	if (c_avl_get (jobs_g, &job->jobId, (void *) &state) != 0)
+	{
+		state = calloc (1, sizeof (*state));
+		if (state == NULL)
+			return (NULL);
 
-    if (job->status == 4){
-	    if(LSB_ARRAY_IDX(job->jobId) > 0){
-		    ssnprintf (jobId, sizeof (jobId), "%d.%d", LSB_ARRAY_JOBID(job->jobId),LSB_ARRAY_IDX(job->jobId));
-	    } 
-	    else
-	
-    		ssnprintf (jobId, sizeof (jobId), "%lli", job->jobId);
-    	sstrncpy(js->jobId, jobId, sizeof(js->jobId));
-        sstrncpy(js->username, job->user, sizeof(js->username));
-        js->ncores = job->submit.numProcessors;
-        js->runtime = job->jRusageUpdateTime - job->startTime;
-        js->memory = get_rr_mem(job->submit.resReq);
-        js->scratch = get_rr_scratch(job->submit.resReq);
-        js->reasons = 0;
-        js->subreasons = 0;
-        js->next = NULL;
-    }
-	else{
-        if(LSB_ARRAY_IDX(job->jobId) > 0){
-            ssnprintf (jobId, sizeof (jobId), "%d.%d", LSB_ARRAY_JOBID(job->jobId),LSB_ARRAY_IDX(job->jobId));
-        }
-        else
-            ssnprintf (jobId, sizeof (jobId), "%lli", job->jobId);
-        sstrncpy(js->jobId, jobId, sizeof(js->jobId));
-        sstrncpy(js->username, job->user, sizeof(js->username));
-        js->ncores = job->submit.numProcessors;
-        js->runtime = 0;
-        js->memory = get_rr_mem(job->submit.resReq);
-        js->scratch = get_rr_scratch(job->submit.resReq);
-        js->reasons = job->reasons;
-        js->subreasons = job->subreasons;
-        js->next = NULL;
+		state->id = job->jobId;
+		state->status = -1;
+		state->user = jobstatus_user_get (job->user);
+		read_single_job_res (job, &state->res);
+
+		if (c_avl_insert (jobs_g, &state->id, state) != 0)
+		{
+			free (state);
+			return (NULL);
+		}
+		state->changed = 1;
+	}
+	else
+	{
+		jobstatus_user_account (state, -1);
+		state->changed = (state->status != job->status)
+			|| (state->numExHosts != job->numExHosts)
+			|| (state->jRusageUpdateTime != job->jRusageUpdateTime)
+			|| (state->res.reasons != job->reasons)
+			|| (state->res.subreasons != job->subreasons);
 	}
 
-    return js;
-}
+	if (state->changed)
+	{
+		/* dependencies may have changed along with the state */
+		if (state->status != job->status)
+			state->ndep_valid = 0;
+
+		state->status = job->status;
+		state->numExHosts = job->numExHosts;
+		state->jRusageUpdateTime = job->jRusageUpdateTime;
+
+		if (job->status == 4)
+		{
+			state->res.runtime = job->jRusageUpdateTime - job->startTime;
+			state->res.reasons = 0;
+			state->res.subreasons = 0;
+		}
+		else
+		{
+			state->res.runtime = 0;
+			state->res.reasons = job->reasons;
+			state->res.subreasons = job->subreasons;
+		}
+	}
 
+	/* only pending jobs wait for their dependencies */
+	ndep = state->ndep;
+	if (job->status == 4)
+		state->ndep = 0;
+	else
+		read_single_job_dep (state, now, queries);
+	if (state->ndep != ndep)
+		state->changed = 1;
+
+	state->generation = generation_g;
+	jobstatus_user_account (state, 1);
+
+	return (state);
+}
 
 static int add_lsf_conf(const char *key, const char *value)
 {
@@ -427,10 +484,7 @@ static int add_lsf_conf(const char *key, const char *value)
             memset (lsf_server, 0, sizeof (lsf_conf_server_t));
         }
 	    sstrncpy(lsf_server->serverdir,value, sizeof(lsf_server->serverdir));
-            if ( lsf_server->serverdir == NULL)
-                        return (-1);
-            else
-                putenv(lsf_server->serverdir);
+            putenv(lsf_server->serverdir);
 	}	
 	else if ((strcasecmp (key, "LSF_ENVDIR") == 0))
     {
@@ -440,22 +494,25 @@ static int add_lsf_conf(const char *key, const char *value)
         }
       
         sstrncpy(lsf_env->envdir, value, sizeof(lsf_env->envdir));
-            if ( lsf_env->envdir == NULL)
-                        return (-1);
-            else
-                putenv(lsf_env->envdir);
+            putenv(lsf_env->envdir);
     }
 
 	return 0;
 }
 
-static int jobstatus_config (const char *key, const char *value)
+int jobstatus_config (const char *key, const char *value)
 {
 
 	if ((strcasecmp (key, "LSF_SERVERDIR") == 0) || (strcasecmp (key, "LSF_ENVDIR") == 0))
 	{
 		add_lsf_conf(key, value);
 	}
+	else if (strcasecmp (key, "ReportChangedJobsOnly") == 0)
+		report_changed_only = IS_TRUE (value) ? 1 : 0;
+	else if (strcasecmp (key, "DependencyCacheTimeout") == 0)
+		dependency_cache_timeout = DOUBLE_TO_CDTIME_T (atof (value));
+	else if (strcasecmp (key, "MaxDependencyQueries") == 0)
+		max_dependency_queries = atoi (value);
 	else
 		return (-1);
 
@@ -463,14 +520,15 @@ static int jobstatus_config (const char *key, const char *value)
 	return (0);
 }
 
-static int init(void)
+int jobstatus_init (void)
 {
 	//If appName is NULL, the logfile $LSF_LOGDIR/bcmd receives LSBLIB transaction
+	/* Not fatal: the read callback tries again while this fails. */
 	if (lsb_init(NULL) < 0)
-	{
-		ERROR("Jobstatus plugin: Initialization problems");
-		return (-1);
-	}
+		WARNING ("jobstatus plugin: Could not start connection to the "
+				"LSF master, trying again on the next read.");
+	else
+		lsb_initialized = 1;
 
     if (getenv("LSF_SERVERDIR") != NULL && getenv("LSF_ENVDIR") != NULL )
         {
@@ -478,13 +536,29 @@ static int init(void)
             free(lsf_server);
         }
 
+	if (users_g == NULL)
+		users_g = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+	if (jobs_g == NULL)
+		jobs_g = c_avl_create (jobstatus_id_compare);
+	if ((users_g == NULL) || (jobs_g == NULL))
+	{
+		ERROR ("jobstatus plugin: c_avl_create failed.");
+		return (-1);
+	}
+
 	return 0;
 }
 
-static int jobstatus_read (void)
+int jobstatus_read (void)
 {
-	jobstatus_t *js_user;	
-	jobresources_t *js_res;
+	c_avl_iterator_t *iter;
+	jobstatus_t *js_user;
+	jobstate_t *state;
+	jobstate_t *done = NULL;
+	void *key;
+	cdtime_t now;
+	int queries = 0;
+	int status = 0;
 
 	//jobs state
 	int jopts = 0;
@@ -493,15 +567,19 @@ static int jobstatus_read (void)
 	jopts |= PEND_JOB;
 
 	char jobuser[] = "all";
-	
-	jobstatus_list_reset();
 
 	struct jobInfoHead *jInfoH;
-	struct jobInfoEnt *job;	
+	struct jobInfoEnt *job;
 
-    if (lsb_init(NULL) < 0)
+	/* The library is only initialized again if this failed before. */
+	if (!lsb_initialized)
 	{
-		ERROR ("jobstatus plugin: Could not start connection com LSF master");
+		if (lsb_init(NULL) < 0)
+		{
+			ERROR ("jobstatus plugin: Could not start connection com LSF master");
+			return (-1);
+		}
+		lsb_initialized = 1;
 	}
 
 	jInfoH = lsb_openjobinfo_a(0, NULL, jobuser, NULL, NULL, jopts);
@@ -512,73 +590,86 @@ static int jobstatus_read (void)
 		return (-1);
  	}
 
+	generation_g++;
+	now = cdtime ();
+
    	int i;	
 
 	for(i = 0; i < jInfoH->numJobs; i++) {
-        	job = lsb_readjobinfo(NULL);
+		job = lsb_readjobinfo(NULL);
 
-        	if(job == NULL){
+		if(job == NULL){
 			ERROR ("jobstatus plugin: Could not read job information");
-			return (-1);
+			status = -1;
+			break;
 		}
 
-		js_user = (jobstatus_t *) malloc (sizeof(jobstatus_t));
-		if (js_user == NULL)
-			return (-1);		
-
-		if ( read_single_job_user(job, js_user) == NULL )
+		if (read_single_job (job, now, &queries) == NULL)
 		{
-			memset(js_user->name,' ',sizeof(js_user->name));
-			js_user->nrun = -1;
-			js_user->npend = -1;
-			js_user->ncores_run = -1;
-			js_user->ncores_pend = -1;
-            js_user->ndep = -1;
+			ERROR ("jobstatus plugin: Could not allocate job state");
+			status = -1;
+			break;
 		}
-		else{
-			jobstatus_list_add_user(js_user);
-		} 
-
-       	if (job->status == 4){
-            		struct jobDepRequest jobdepReq;
-            		jobdepReq.jobId = job->jobId;
-            		jobdepReq.options = QUERY_DEPEND_UNSATISFIED;
-            		struct jobDependInfo *jobDep = lsb_getjobdepinfo(&jobdepReq); 
-                    if ( jobDep != NULL )
-                        js_user->ndep = jobDep->numJobs;
-                    else
-                        js_user->ndep = 0;
-        	}
-        	else
-            		js_user->ndep = 0;
-	
-		js_res = (jobresources_t *) malloc (sizeof(jobresources_t));
-                if (js_res == NULL)
-                        return (-1);
-
-		if ( read_single_job_res(job, js_res) == NULL )
-                {
-                    memset(js_res->jobId,' ',sizeof(js_res->jobId));
-                    memset(js_res->username,' ',sizeof(js_res->username));
-                    js_res->ncores = 0;
-                	js_res->runtime = 0;
-                	js_res->memory = 0;
-                    js_res->scratch = 0;
-                    js_res->reasons = 0;
-                    js_res->subreasons = 0;
-                }
-		else{
-			jobstatus_list_add_res(js_res);
-		}
-
-	}		
+	}
 
 	lsb_closejobinfo();
-	for (js_user=list_head_g; js_user != NULL; js_user=js_user->next)
-		jobstatus_submit_user(js_user);
 
-	for (js_res=list_head_res_g; js_res != NULL; js_res=js_res->next)
-                jobstatus_submit_resources(js_res);
+	/* Keep the previous state of all jobs if the list is incomplete. */
+	if (status != 0)
+		return (status);
+
+	/* forget jobs which are neither running nor pending anymore */
+	iter = c_avl_get_iterator (jobs_g);
+	while (c_avl_iterator_next (iter, &key, (void *) &state) == 0)
+	{
+		if (state->generation == generation_g)
+			continue;
+		state->next_done = done;
+		done = state;
+	}
+	c_avl_iterator_destroy (iter);
+
+	while ((state = done) != NULL)
+	{
+		done = state->next_done;
+		jobstatus_job_remove (state);
+	}
+
+	iter = c_avl_get_iterator (users_g);
+	while (c_avl_iterator_next (iter, &key, (void *) &js_user) == 0)
+		if ((js_user->nrun + js_user->npend) > 0)
+			jobstatus_submit_user(js_user);
+	c_avl_iterator_destroy (iter);
+
+	iter = c_avl_get_iterator (jobs_g);
+	while (c_avl_iterator_next (iter, &key, (void *) &state) == 0)
+		if (!report_changed_only || state->changed)
+			jobstatus_submit_resources(&state->res);
+	c_avl_iterator_destroy (iter);
+
+	return (0);
+}
+
+int jobstatus_shutdown (void)
+{
+	void *key;
+	void *value;
+
+	if (jobs_g != NULL)
+	{
+		while (c_avl_pick (jobs_g, &key, &value) == 0)
+			free (value);
+		c_avl_destroy (jobs_g);
+		jobs_g = NULL;
+	}
+
+	if (users_g != NULL)
+	{
+		while (c_avl_pick (users_g, &key, &value) == 0)
+			free (value);
+		c_avl_destroy (users_g);
+		users_g = NULL;
+	}
 
 	return (0);
 }
@@ -586,6 +677,7 @@ static int jobstatus_read (void)
 void module_register (void)
 {
 	plugin_register_config ("jobstatus", jobstatus_config, config_keys, config_keys_num);
-	plugin_register_init ("jobstatus", init);
+	plugin_register_init ("jobstatus", jobstatus_init);
 	plugin_register_read ("jobstatus", jobstatus_read);
+	plugin_register_shutdown ("jobstatus", jobstatus_shutdown);
 } /* void module_register */
@@ -0,0 +1,138 @@
+/**
+ * collectd - src/jobstatus_bench.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+
+/*
+ * Benchmark of the jobstatus plugin against lsf_mock.c: reads a synthetic
+ * population of jobs repeatedly and reports the time per read, the values
+ * dispatched and the queries sent to the (mock) LSF master.
+ * Build with "make bench_jobstatus" and run as
+ *   bench_jobstatus [jobs [reads [change]]]
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "jobstatus.h"
+#include "lsf_mock.h"
+
+char hostname_g[DATA_MAX_NAME_LEN] = "bench";
+
+static unsigned long dispatched = 0;
+
+int plugin_register_config (const char *name,
+    int (*callback) (const char *key, const char *val),
+    const char **keys, int keys_num)
+{
+  return (0);
+}
+
+int plugin_register_init (const char *name, plugin_init_cb callback)
+{
+  return (0);
+}
+
+int plugin_register_read (const char *name, int (*callback) (void))
+{
+  return (0);
+}
+
+int plugin_register_shutdown (const char *name, plugin_shutdown_cb callback)
+{
+  return (0);
+}
+
+cdtime_t plugin_get_interval (void)
+{
+  return (TIME_T_TO_CDTIME_T (10));
+}
+
+int plugin_dispatch_values (value_list_t const *vl)
+{
+  dispatched++;
+  return (0);
+}
+
+static double now_seconds (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ((double) ts.tv_sec + ((double) ts.tv_nsec) / 1e9);
+}
+
+static void run (const char *name, const char *changed_only,
+    int jobs, int reads, double change)
+{
+  double start;
+  double first;
+  double elapsed;
+  int i;
+
+  lsf_mock_setup (jobs, jobs / 200 + 1, 0.2, change);
+  jobstatus_config ("ReportChangedJobsOnly", changed_only);
+
+  if (jobstatus_init () != 0)
+  {
+    fprintf (stderr, "init failed\n");
+    exit (EXIT_FAILURE);
+  }
+
+  /* The first read learns all jobs and is reported separately. */
+  start = now_seconds ();
+  jobstatus_read ();
+  first = now_seconds () - start;
+
+  dispatched = 0;
+  lsf_mock_getjobdepinfo_calls = 0;
+
+  start = now_seconds ();
+  for (i = 0; i < reads; i++)
+    jobstatus_read ();
+  elapsed = now_seconds () - start;
+
+  printf ("%-14s first %8.1f ms, then %8.1f ms/read, "
+      "%9.0f values/read, %6.0f dependency queries/read\n",
+      name, first * 1e3, elapsed * 1e3 / reads,
+      (double) dispatched / reads,
+      (double) lsf_mock_getjobdepinfo_calls / reads);
+
+  jobstatus_shutdown ();
+}
+
+int main (int argc, char **argv)
+{
+  int jobs = (argc > 1) ? atoi (argv[1]) : 100000;
+  int reads = (argc > 2) ? atoi (argv[2]) : 10;
+  double change = (argc > 3) ? atof (argv[3]) : 0.01;
+
+  printf ("%i jobs, %i reads, %.1f%% of the jobs change per read\n",
+      jobs, reads, 100.0 * change);
+
+  run ("all jobs", "false", jobs, reads, change);
+  run ("changed only", "true", jobs, reads, change);
+
+  return (0);
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -45,8 +45,19 @@
 #include <errno.h>
 #include <math.h>
 #include <netdb.h>
+#include <pthread.h>
 
 #include "collectd/client.h"
+#include "collectd/network_buffer.h"
+
+/* Size of the packets sent by `lcc_putval_binary'. */
+#define LCC_PUTBIN_SIZE (1024 * 1024)
+
+/* Maximum number of pipelined commands whose responses haven't been read from
+ * the socket. When this is exceeded, responses are read ahead and queued, so
+ * that the server never blocks on a full socket buffer while the client
+ * blocks writing more commands. */
+#define LCC_PIPELINE_WINDOW 128
 
 /* NI_MAXHOST has been obsoleted by RFC 3493 which is a reason for SunOS 5.11
  * to no longer define it. We'll use the old, RFC 2553 value here. */
@@ -100,12 +111,6 @@
 /*
  * Types
  */
-struct lcc_connection_s
-{
-  FILE *fh;
-  char errbuf[1024];
-};
-
 struct lcc_response_s
 {
   int status;
@@ -115,6 +120,45 @@ struct lcc_response_s
 };
 typedef struct lcc_response_s lcc_response_t;
 
+struct lcc_response_entry_s
+{
+  lcc_response_t res;
+  struct lcc_response_entry_s *next;
+};
+typedef struct lcc_response_entry_s lcc_response_entry_t;
+
+struct lcc_connection_s
+{
+  /* Separate streams for reading and writing, so that commands can be
+   * written while responses are still buffered for reading. */
+  FILE *fh;
+  FILE *fh_out;
+  char errbuf[1024];
+
+  /* Number of pipelined commands whose responses have not been returned by
+   * one of the lcc_recv_* functions yet. Some of those responses may have
+   * been read ahead into the queue. */
+  size_t pending;
+  lcc_response_entry_t *queue_head;
+  lcc_response_entry_t *queue_tail;
+  size_t queue_len;
+};
+
+struct lcc_pool_s
+{
+  char *address;
+  size_t max_connections;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  /* Idle connections, linked through a separate array. */
+  lcc_connection_t **idle;
+  size_t idle_num;
+  /* Number of connections handed out by "lcc_pool_acquire". */
+  size_t active_num;
+};
+
 /*
  * Private functions
  */
@@ -252,13 +296,13 @@ static int lcc_send (lcc_connection_t *c, const char *command) /* {{{ */
 
   LCC_DEBUG ("send:    --> %s\n", command);
 
-  status = fprintf (c->fh, "%s\r\n", command);
+  status = fprintf (c->fh_out, "%s\r\n", command);
   if (status < 0)
   {
     lcc_set_errno (c, errno);
     return (-1);
   }
-  fflush(c->fh);
+  fflush(c->fh_out);
 
   return (0);
 } /* }}} int lcc_send */
@@ -355,17 +399,35 @@ static int lcc_receive (lcc_connection_t *c, /* {{{ */
   return (0);
 } /* }}} int lcc_receive */
 
+/* Synchronous commands can't be used while pipelined responses are
+ * outstanding, because they would read the wrong response. */
+static int lcc_check_idle (lcc_connection_t *c) /* {{{ */
+{
+  if ((c->fh == NULL) || (c->fh_out == NULL))
+  {
+    lcc_set_errno (c, EBADF);
+    return (-1);
+  }
+
+  if (c->pending != 0)
+  {
+    LCC_SET_ERRSTR (c, "Responses to %zu pipelined commands are pending.",
+        c->pending);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int lcc_check_idle */
+
 static int lcc_sendreceive (lcc_connection_t *c, /* {{{ */
     const char *command, lcc_response_t *ret_res)
 {
   lcc_response_t res;
   int status;
 
-  if (c->fh == NULL)
-  {
-    lcc_set_errno (c, EBADF);
-    return (-1);
-  }
+  status = lcc_check_idle (c);
+  if (status != 0)
+    return (status);
 
   status = lcc_send (c, command);
   if (status != 0)
@@ -379,6 +441,42 @@ static int lcc_sendreceive (lcc_connection_t *c, /* {{{ */
   return (status);
 } /* }}} int lcc_sendreceive */
 
+/* Creates the read and write streams of a connected socket. On failure, the
+ * socket is closed and an errno value is returned. */
+static int lcc_open_streams (lcc_connection_t *c, int fd) /* {{{ */
+{
+  int fd_out;
+
+  fd_out = dup (fd);
+  if (fd_out < 0)
+  {
+    int status = errno;
+    close (fd);
+    return (status);
+  }
+
+  c->fh = fdopen (fd, "r");
+  if (c->fh == NULL)
+  {
+    int status = errno;
+    close (fd);
+    close (fd_out);
+    return (status);
+  }
+
+  c->fh_out = fdopen (fd_out, "w");
+  if (c->fh_out == NULL)
+  {
+    int status = errno;
+    fclose (c->fh);
+    c->fh = NULL;
+    close (fd_out);
+    return (status);
+  }
+
+  return (0);
+} /* }}} int lcc_open_streams */
+
 static int lcc_open_unixsocket (lcc_connection_t *c, const char *path) /* {{{ */
 {
   struct sockaddr_un sa;
@@ -410,11 +508,10 @@ static int lcc_open_unixsocket (lcc_connection_t *c, const char *path) /* {{{ */
     return (-1);
   }
 
-  c->fh = fdopen (fd, "r+");
-  if (c->fh == NULL)
+  status = lcc_open_streams (c, fd);
+  if (status != 0)
   {
-    lcc_set_errno (c, errno);
-    close (fd);
+    lcc_set_errno (c, status);
     return (-1);
   }
 
@@ -511,13 +608,9 @@ static int lcc_open_netsocket (lcc_connection_t *c, /* {{{ */
       continue;
     }
 
-    c->fh = fdopen (fd, "r+");
-    if (c->fh == NULL)
-    {
-      status = errno;
-      close (fd);
+    status = lcc_open_streams (c, fd);
+    if (status != 0)
       continue;
-    }
 
     assert (status == 0);
     break;
@@ -603,34 +696,37 @@ int lcc_disconnect (lcc_connection_t *c) /* {{{ */
   if (c == NULL)
     return (-1);
 
+  if (c->fh_out != NULL)
+  {
+    fclose (c->fh_out);
+    c->fh_out = NULL;
+  }
+
   if (c->fh != NULL)
   {
     fclose (c->fh);
     c->fh = NULL;
   }
 
+  while (c->queue_head != NULL)
+  {
+    lcc_response_entry_t *next = c->queue_head->next;
+    lcc_response_free (&c->queue_head->res);
+    free (c->queue_head);
+    c->queue_head = next;
+  }
+
   free (c);
   return (0);
 } /* }}} int lcc_disconnect */
 
-int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
-    size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names)
+static int lcc_format_getval (lcc_connection_t *c, /* {{{ */
+    char *command, size_t command_size, const lcc_identifier_t *ident)
 {
   char ident_str[6 * LCC_NAME_LEN];
   char ident_esc[12 * LCC_NAME_LEN];
-  char command[14 * LCC_NAME_LEN];
-
-  lcc_response_t res;
-  size_t   values_num;
-  gauge_t *values = NULL;
-  char   **values_names = NULL;
-
-  size_t i;
   int status;
 
-  if (c == NULL)
-    return (-1);
-
   if (ident == NULL)
   {
     lcc_set_errno (c, EINVAL);
@@ -642,23 +738,31 @@ int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
   if (status != 0)
     return (status);
 
-  snprintf (command, sizeof (command), "GETVAL %s",
+  snprintf (command, command_size, "GETVAL %s",
       lcc_strescape (ident_esc, ident_str, sizeof (ident_esc)));
-  command[sizeof (command) - 1] = 0;
+  command[command_size - 1] = 0;
 
-  /* Send talk to the daemon.. */
-  status = lcc_sendreceive (c, command, &res);
-  if (status != 0)
-    return (status);
+  return (0);
+} /* }}} int lcc_format_getval */
 
-  if (res.status != 0)
+/* Parses the response to a GETVAL command and frees it. */
+static int lcc_parse_getval (lcc_connection_t *c, lcc_response_t *res, /* {{{ */
+    size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names)
+{
+  size_t   values_num;
+  gauge_t *values = NULL;
+  char   **values_names = NULL;
+
+  size_t i;
+
+  if (res->status != 0)
   {
-    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
-    lcc_response_free (&res);
+    LCC_SET_ERRSTR (c, "Server error: %s", res->message);
+    lcc_response_free (res);
     return (-1);
   }
 
-  values_num = res.lines_num;
+  values_num = res->lines_num;
 
 #define BAIL_OUT(e) do { \
   lcc_set_errno (c, (e)); \
@@ -669,7 +773,7 @@ int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
     } \
   } \
   free (values_names); \
-  lcc_response_free (&res); \
+  lcc_response_free (res); \
   return (-1); \
 } while (0)
 
@@ -678,7 +782,7 @@ int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
   {
     if (ret_values_num != NULL)
       *ret_values_num = values_num;
-    lcc_response_free (&res);
+    lcc_response_free (res);
     return (0);
   }
 
@@ -697,13 +801,13 @@ int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
       BAIL_OUT (ENOMEM);
   }
 
-  for (i = 0; i < res.lines_num; i++)
+  for (i = 0; i < res->lines_num; i++)
   {
     char *key;
     char *value;
     char *endptr;
 
-    key = res.lines[i];
+    key = res->lines[i];
     value = strchr (key, '=');
     if (value == NULL)
       BAIL_OUT (EILSEQ);
@@ -727,7 +831,8 @@ int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
       if (values_names[i] == NULL)
         BAIL_OUT (ENOMEM);
     }
-  } /* for (i = 0; i < res.lines_num; i++) */
+  } /* for (i = 0; i < res->lines_num; i++) */
+#undef BAIL_OUT
 
   if (ret_values_num != NULL)
     *ret_values_num = values_num;
@@ -736,21 +841,44 @@ int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
   if (ret_values_names != NULL)
     *ret_values_names = values_names;
 
-  lcc_response_free (&res);
+  lcc_response_free (res);
 
   return (0);
+} /* }}} int lcc_parse_getval */
+
+int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
+    size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names)
+{
+  char command[14 * LCC_NAME_LEN];
+  lcc_response_t res;
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  status = lcc_format_getval (c, command, sizeof (command), ident);
+  if (status != 0)
+    return (status);
+
+  /* Send talk to the daemon.. */
+  status = lcc_sendreceive (c, command, &res);
+  if (status != 0)
+    return (status);
+
+  return (lcc_parse_getval (c, &res,
+        ret_values_num, ret_values, ret_values_names));
 } /* }}} int lcc_getval */
 
-int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
+static int lcc_format_putval (lcc_connection_t *c, /* {{{ */
+    char *command, size_t command_size, const lcc_value_list_t *vl)
 {
   char ident_str[6 * LCC_NAME_LEN];
   char ident_esc[12 * LCC_NAME_LEN];
-  char command[1024] = "";
-  lcc_response_t res;
+  char buffer[1024] = "";
   int status;
   size_t i;
 
-  if ((c == NULL) || (vl == NULL) || (vl->values_len < 1)
+  if ((vl == NULL) || (vl->values_len < 1)
       || (vl->values == NULL) || (vl->values_types == NULL))
   {
     lcc_set_errno (c, EINVAL);
@@ -762,35 +890,53 @@ int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
   if (status != 0)
     return (status);
 
-  SSTRCATF (command, "PUTVAL %s",
+  SSTRCATF (buffer, "PUTVAL %s",
       lcc_strescape (ident_esc, ident_str, sizeof (ident_esc)));
 
   if (vl->interval > 0.0)
-    SSTRCATF (command, " interval=%.3f", vl->interval);
+    SSTRCATF (buffer, " interval=%.3f", vl->interval);
 
   if (vl->time > 0.0)
-    SSTRCATF (command, " %.3f", vl->time);
+    SSTRCATF (buffer, " %.3f", vl->time);
   else
-    SSTRCAT (command, " N");
+    SSTRCAT (buffer, " N");
 
   for (i = 0; i < vl->values_len; i++)
   {
     if (vl->values_types[i] == LCC_TYPE_COUNTER)
-      SSTRCATF (command, ":%"PRIu64, vl->values[i].counter);
+      SSTRCATF (buffer, ":%"PRIu64, vl->values[i].counter);
     else if (vl->values_types[i] == LCC_TYPE_GAUGE)
     {
       if (isnan (vl->values[i].gauge))
-        SSTRCATF (command, ":U");
+        SSTRCATF (buffer, ":U");
       else
-        SSTRCATF (command, ":%g", vl->values[i].gauge);
+        SSTRCATF (buffer, ":%g", vl->values[i].gauge);
     }
     else if (vl->values_types[i] == LCC_TYPE_DERIVE)
-	SSTRCATF (command, ":%"PRIu64, vl->values[i].derive);
+	SSTRCATF (buffer, ":%"PRIu64, vl->values[i].derive);
     else if (vl->values_types[i] == LCC_TYPE_ABSOLUTE)
-	SSTRCATF (command, ":%"PRIu64, vl->values[i].absolute);
+	SSTRCATF (buffer, ":%"PRIu64, vl->values[i].absolute);
 
   } /* for (i = 0; i < vl->values_len; i++) */
 
+  strncpy (command, buffer, command_size);
+  command[command_size - 1] = 0;
+  return (0);
+} /* }}} int lcc_format_putval */
+
+int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
+{
+  char command[1024] = "";
+  lcc_response_t res;
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  status = lcc_format_putval (c, command, sizeof (command), vl);
+  if (status != 0)
+    return (status);
+
   status = lcc_sendreceive (c, command, &res);
   if (status != 0)
     return (status);
@@ -806,143 +952,726 @@ int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
   return (0);
 } /* }}} int lcc_putval */
 
-int lcc_flush (lcc_connection_t *c, const char *plugin, /* {{{ */
-    lcc_identifier_t *ident, int timeout)
+/* Receives the response to a batch command. */
+static int lcc_receive_status (lcc_connection_t *c) /* {{{ */
 {
-  char command[1024] = "";
   lcc_response_t res;
   int status;
 
+  memset (&res, 0, sizeof (res));
+  status = lcc_receive (c, &res);
+  if (status != 0)
+    return (status);
+
+  status = res.status;
+  if (status != 0)
+    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
+
+  lcc_response_free (&res);
+  return ((status == 0) ? 0 : -1);
+} /* }}} int lcc_receive_status */
+
+int lcc_putval_batch (lcc_connection_t *c, /* {{{ */
+    const lcc_value_list_t *vl, size_t vl_num)
+{
+  size_t i;
+
   if (c == NULL)
-  {
-    lcc_set_errno (c, EINVAL);
     return (-1);
-  }
 
-  SSTRCPY (command, "FLUSH");
+  if (lcc_check_idle (c) != 0)
+    return (-1);
 
-  if (timeout > 0)
-    SSTRCATF (command, " timeout=%i", timeout);
+  if (vl_num == 0)
+    return (0);
 
-  if (plugin != NULL)
+  /* The whole batch is written before the single response is read. */
+  if (fprintf (c->fh_out, "BATCH\r\n") < 0)
   {
-    char buffer[2 * LCC_NAME_LEN];
-    SSTRCATF (command, " plugin=%s",
-        lcc_strescape (buffer, plugin, sizeof (buffer)));
+    lcc_set_errno (c, errno);
+    return (-1);
   }
 
-  if (ident != NULL)
+  for (i = 0; i < vl_num; i++)
   {
-    char ident_str[6 * LCC_NAME_LEN];
-    char ident_esc[12 * LCC_NAME_LEN];
+    char command[1024] = "";
+    int status;
 
-    status = lcc_identifier_to_string (c, ident_str, sizeof (ident_str), ident);
+    status = lcc_format_putval (c, command, sizeof (command), vl + i);
     if (status != 0)
-      return (status);
+    {
+      /* Terminate the batch so the connection remains usable. */
+      fprintf (c->fh_out, "END\r\n");
+      fflush (c->fh_out);
+      lcc_receive_status (c);
+      lcc_set_errno (c, EINVAL);
+      return (-1);
+    }
 
-    SSTRCATF (command, " identifier=%s",
-        lcc_strescape (ident_esc, ident_str, sizeof (ident_esc)));
+    if (fprintf (c->fh_out, "%s\r\n", command) < 0)
+    {
+      lcc_set_errno (c, errno);
+      return (-1);
+    }
   }
 
-  status = lcc_sendreceive (c, command, &res);
-  if (status != 0)
-    return (status);
-
-  if (res.status != 0)
+  if ((fprintf (c->fh_out, "END\r\n") < 0) || (fflush (c->fh_out) != 0))
   {
-    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
-    lcc_response_free (&res);
+    lcc_set_errno (c, errno);
     return (-1);
   }
 
-  lcc_response_free (&res);
-  return (0);
-} /* }}} int lcc_flush */
-
-/* TODO: Implement lcc_putnotif */
+  return (lcc_receive_status (c));
+} /* }}} int lcc_putval_batch */
 
-int lcc_listval (lcc_connection_t *c, /* {{{ */
-    lcc_identifier_t **ret_ident, size_t *ret_ident_num)
+int lcc_putval_binary (lcc_connection_t *c, /* {{{ */
+    const lcc_value_list_t *vl, size_t vl_num)
 {
-  lcc_response_t res;
+  lcc_network_buffer_t *nb;
+  char *buffer;
+  size_t chunks_num = 0;
   size_t i;
-  int status;
-
-  lcc_identifier_t *ident;
-  size_t ident_num;
+  int status = 0;
 
   if (c == NULL)
     return (-1);
 
-  if ((ret_ident == NULL) || (ret_ident_num == NULL))
-  {
-    lcc_set_errno (c, EINVAL);
+  if (lcc_check_idle (c) != 0)
     return (-1);
-  }
 
-  status = lcc_sendreceive (c, "LISTVAL", &res);
-  if (status != 0)
-    return (status);
-
-  if (res.status != 0)
-  {
-    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
-    lcc_response_free (&res);
-    return (-1);
-  }
+  if (vl_num == 0)
+    return (0);
 
-  ident_num = res.lines_num;
-  ident = (lcc_identifier_t *) malloc (ident_num * sizeof (*ident));
-  if (ident == NULL)
+  nb = lcc_network_buffer_create (LCC_PUTBIN_SIZE);
+  buffer = malloc (LCC_PUTBIN_SIZE);
+  if ((nb == NULL) || (buffer == NULL))
   {
-    lcc_response_free (&res);
+    lcc_network_buffer_destroy (nb);
+    free (buffer);
     lcc_set_errno (c, ENOMEM);
     return (-1);
   }
 
-  for (i = 0; i < res.lines_num; i++)
+  /* Value lists are encoded into chunks of up to LCC_PUTBIN_SIZE bytes. All
+   * chunks are sent before the responses are read. */
+  i = 0;
+  while (i < vl_num)
   {
-    char *time_str;
-    char *ident_str;
-
-    /* First field is the time. */
-    time_str = res.lines[i];
+    size_t buffer_size = LCC_PUTBIN_SIZE;
+    size_t added = 0;
 
-    /* Set `ident_str' to the beginning of the second field. */
-    ident_str = time_str;
-    while ((*ident_str != ' ') && (*ident_str != '\t') && (*ident_str != 0))
-      ident_str++;
-    while ((*ident_str == ' ') || (*ident_str == '\t'))
+    lcc_network_buffer_initialize (nb);
+    while ((i < vl_num)
+        && (lcc_network_buffer_add_value (nb, vl + i) == 0))
     {
-      *ident_str = 0;
-      ident_str++;
+      i++;
+      added++;
     }
 
-    if (*ident_str == 0)
+    if (added == 0)
     {
-      lcc_set_errno (c, EILSEQ);
+      /* A single value list doesn't fit into an empty buffer. */
+      lcc_set_errno (c, EINVAL);
       status = -1;
       break;
     }
 
-    status = lcc_string_to_identifier (c, ident + i, ident_str);
-    if (status != 0)
+    lcc_network_buffer_finalize (nb);
+    lcc_network_buffer_get (nb, buffer, &buffer_size);
+
+    if ((fprintf (c->fh_out, "PUTBIN %zu\r\n", buffer_size) < 0)
+        || (fwrite (buffer, 1, buffer_size, c->fh_out) != buffer_size))
+    {
+      lcc_set_errno (c, errno);
+      status = -1;
       break;
+    }
+    chunks_num++;
   }
 
-  lcc_response_free (&res);
+  lcc_network_buffer_destroy (nb);
+  free (buffer);
 
-  if (status != 0)
+  if (fflush (c->fh_out) != 0)
   {
-    free (ident);
+    lcc_set_errno (c, errno);
     return (-1);
   }
 
-  *ret_ident = ident;
-  *ret_ident_num = ident_num;
+  for (i = 0; i < chunks_num; i++)
+  {
+    int tmp = lcc_receive_status (c);
+    if ((tmp != 0) && (status == 0))
+      status = tmp;
+  }
+
+  return (status);
+} /* }}} int lcc_putval_binary */
 
-  return (0);
-} /* }}} int lcc_listval */
+static int lcc_format_flush (lcc_connection_t *c, /* {{{ */
+    char *command, size_t command_size, const char *plugin,
+    const lcc_identifier_t *ident, int timeout)
+{
+  char buffer[1024] = "";
+  int status;
+
+  SSTRCPY (buffer, "FLUSH");
+
+  if (timeout > 0)
+    SSTRCATF (buffer, " timeout=%i", timeout);
+
+  if (plugin != NULL)
+  {
+    char plugin_esc[2 * LCC_NAME_LEN];
+    SSTRCATF (buffer, " plugin=%s",
+        lcc_strescape (plugin_esc, plugin, sizeof (plugin_esc)));
+  }
+
+  if (ident != NULL)
+  {
+    char ident_str[6 * LCC_NAME_LEN];
+    char ident_esc[12 * LCC_NAME_LEN];
+
+    status = lcc_identifier_to_string (c, ident_str, sizeof (ident_str), ident);
+    if (status != 0)
+      return (status);
+
+    SSTRCATF (buffer, " identifier=%s",
+        lcc_strescape (ident_esc, ident_str, sizeof (ident_esc)));
+  }
+
+  strncpy (command, buffer, command_size);
+  command[command_size - 1] = 0;
+  return (0);
+} /* }}} int lcc_format_flush */
+
+int lcc_flush (lcc_connection_t *c, const char *plugin, /* {{{ */
+    lcc_identifier_t *ident, int timeout)
+{
+  char command[1024] = "";
+  lcc_response_t res;
+  int status;
+
+  if (c == NULL)
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  status = lcc_format_flush (c, command, sizeof (command),
+      plugin, ident, timeout);
+  if (status != 0)
+    return (status);
+
+  status = lcc_sendreceive (c, command, &res);
+  if (status != 0)
+    return (status);
+
+  if (res.status != 0)
+  {
+    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
+    lcc_response_free (&res);
+    return (-1);
+  }
+
+  lcc_response_free (&res);
+  return (0);
+} /* }}} int lcc_flush */
+
+/* TODO: Implement lcc_putnotif */
+
+int lcc_listval_foreach (lcc_connection_t *c, const char *pattern, /* {{{ */
+    lcc_listval_callback_t callback, void *user_data)
+{
+  char command[1024];
+  char buffer[4096];
+  char *ptr;
+  long lines_num;
+  long i;
+  int cb_status = 0;
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  if (callback == NULL)
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  if (lcc_check_idle (c) != 0)
+    return (-1);
+
+  if (pattern != NULL)
+  {
+    char pattern_esc[sizeof (command) - 16];
+
+    snprintf (command, sizeof (command), "LISTVAL %s",
+        lcc_strescape (pattern_esc, pattern, sizeof (pattern_esc)));
+  }
+  else
+    SSTRCPY (command, "LISTVAL");
+
+  status = lcc_send (c, command);
+  if (status != 0)
+    return (status);
+
+  /* The response is parsed line by line, so the identifiers are never held
+   * in memory all at once. */
+  if (fgets (buffer, sizeof (buffer), c->fh) == NULL)
+  {
+    lcc_set_errno (c, errno);
+    return (-1);
+  }
+  lcc_chomp (buffer);
+  LCC_DEBUG ("receive: <-- %s\n", buffer);
+
+  ptr = NULL;
+  errno = 0;
+  lines_num = strtol (buffer, &ptr, 0);
+  if ((errno != 0) || (ptr == &buffer[0]))
+  {
+    lcc_set_errno (c, EILSEQ);
+    return (-1);
+  }
+
+  if (lines_num < 0)
+  {
+    while ((*ptr == ' ') || (*ptr == '\t'))
+      ptr++;
+    LCC_SET_ERRSTR (c, "Server error: %s", ptr);
+    return (-1);
+  }
+
+  for (i = 0; i < lines_num; i++)
+  {
+    lcc_identifier_t ident;
+    char *time_str;
+    char *ident_str;
+
+    if (fgets (buffer, sizeof (buffer), c->fh) == NULL)
+    {
+      lcc_set_errno (c, errno);
+      return (-1);
+    }
+    lcc_chomp (buffer);
+    LCC_DEBUG ("receive: <-- %s\n", buffer);
+
+    /* Once the callback has failed, the remaining lines are only read to
+     * keep the connection usable. */
+    if (cb_status != 0)
+      continue;
+
+    /* First field is the time. */
+    time_str = buffer;
+
+    /* Set `ident_str' to the beginning of the second field. */
+    ident_str = time_str;
+    while ((*ident_str != ' ') && (*ident_str != '\t') && (*ident_str != 0))
+      ident_str++;
+    while ((*ident_str == ' ') || (*ident_str == '\t'))
+    {
+      *ident_str = 0;
+      ident_str++;
+    }
+
+    if (*ident_str == 0)
+    {
+      lcc_set_errno (c, EILSEQ);
+      cb_status = -1;
+      continue;
+    }
+
+    memset (&ident, 0, sizeof (ident));
+    if (lcc_string_to_identifier (c, &ident, ident_str) != 0)
+    {
+      cb_status = -1;
+      continue;
+    }
+
+    cb_status = (*callback) (&ident, atof (time_str), user_data);
+  }
+
+  return (cb_status);
+} /* }}} int lcc_listval_foreach */
+
+struct lcc_listval_array_s
+{
+  lcc_identifier_t *ident;
+  size_t ident_num;
+  size_t ident_size;
+};
+
+static int lcc_listval_append (const lcc_identifier_t *ident, /* {{{ */
+    double __attribute__((unused)) time, void *user_data)
+{
+  struct lcc_listval_array_s *array = user_data;
+
+  if (array->ident_num >= array->ident_size)
+  {
+    size_t new_size = (array->ident_size == 0) ? 64 : 2 * array->ident_size;
+    lcc_identifier_t *tmp;
+
+    tmp = realloc (array->ident, new_size * sizeof (*tmp));
+    if (tmp == NULL)
+      return (ENOMEM);
+    array->ident = tmp;
+    array->ident_size = new_size;
+  }
+
+  memcpy (array->ident + array->ident_num, ident, sizeof (*ident));
+  array->ident_num++;
+
+  return (0);
+} /* }}} int lcc_listval_append */
+
+int lcc_listval_match (lcc_connection_t *c, const char *pattern, /* {{{ */
+    lcc_identifier_t **ret_ident, size_t *ret_ident_num)
+{
+  struct lcc_listval_array_s array;
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  if ((ret_ident == NULL) || (ret_ident_num == NULL))
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  memset (&array, 0, sizeof (array));
+
+  status = lcc_listval_foreach (c, pattern, lcc_listval_append, &array);
+  if (status != 0)
+  {
+    if (status == ENOMEM)
+      lcc_set_errno (c, ENOMEM);
+    free (array.ident);
+    return (-1);
+  }
+
+  *ret_ident = array.ident;
+  *ret_ident_num = array.ident_num;
+
+  return (0);
+} /* }}} int lcc_listval_match */
+
+int lcc_listval (lcc_connection_t *c, /* {{{ */
+    lcc_identifier_t **ret_ident, size_t *ret_ident_num)
+{
+  return (lcc_listval_match (c, /* pattern = */ NULL,
+        ret_ident, ret_ident_num));
+} /* }}} int lcc_listval */
+
+/*
+ * Pipelining
+ */
+/* Reads the next response from the socket and appends it to the queue. */
+static int lcc_pipeline_read_ahead (lcc_connection_t *c) /* {{{ */
+{
+  lcc_response_entry_t *e;
+
+  if (fflush (c->fh_out) != 0)
+  {
+    lcc_set_errno (c, errno);
+    return (-1);
+  }
+
+  e = calloc (1, sizeof (*e));
+  if (e == NULL)
+  {
+    lcc_set_errno (c, ENOMEM);
+    return (-1);
+  }
+
+  if (lcc_receive (c, &e->res) != 0)
+  {
+    free (e);
+    return (-1);
+  }
+
+  if (c->queue_tail == NULL)
+    c->queue_head = e;
+  else
+    c->queue_tail->next = e;
+  c->queue_tail = e;
+  c->queue_len++;
+
+  return (0);
+} /* }}} int lcc_pipeline_read_ahead */
+
+static int lcc_pipeline_send (lcc_connection_t *c, /* {{{ */
+    const char *command)
+{
+  if ((c->fh == NULL) || (c->fh_out == NULL))
+  {
+    lcc_set_errno (c, EBADF);
+    return (-1);
+  }
+
+  LCC_DEBUG ("send:    --> %s\n", command);
+
+  /* The command is only buffered; it is written when the buffer is full or
+   * when a response is read. */
+  if (fprintf (c->fh_out, "%s\r\n", command) < 0)
+  {
+    lcc_set_errno (c, errno);
+    return (-1);
+  }
+  c->pending++;
+
+  while ((c->pending - c->queue_len) > LCC_PIPELINE_WINDOW)
+  {
+    if (lcc_pipeline_read_ahead (c) != 0)
+      return (-1);
+  }
+
+  return (0);
+} /* }}} int lcc_pipeline_send */
+
+static int lcc_pipeline_receive (lcc_connection_t *c, /* {{{ */
+    lcc_response_t *ret_res)
+{
+  lcc_response_entry_t *e;
+
+  if (c->pending == 0)
+  {
+    LCC_SET_ERRSTR (c, "No pipelined command is pending.");
+    return (-1);
+  }
+
+  if ((c->queue_head == NULL) && (lcc_pipeline_read_ahead (c) != 0))
+    return (-1);
+
+  e = c->queue_head;
+  c->queue_head = e->next;
+  if (c->queue_head == NULL)
+    c->queue_tail = NULL;
+  c->queue_len--;
+  c->pending--;
+
+  memcpy (ret_res, &e->res, sizeof (*ret_res));
+  free (e);
+
+  return (0);
+} /* }}} int lcc_pipeline_receive */
+
+int lcc_send_getval (lcc_connection_t *c, /* {{{ */
+    const lcc_identifier_t *ident)
+{
+  char command[14 * LCC_NAME_LEN];
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  status = lcc_format_getval (c, command, sizeof (command), ident);
+  if (status != 0)
+    return (status);
+
+  return (lcc_pipeline_send (c, command));
+} /* }}} int lcc_send_getval */
+
+int lcc_send_putval (lcc_connection_t *c, /* {{{ */
+    const lcc_value_list_t *vl)
+{
+  char command[1024] = "";
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  status = lcc_format_putval (c, command, sizeof (command), vl);
+  if (status != 0)
+    return (status);
+
+  return (lcc_pipeline_send (c, command));
+} /* }}} int lcc_send_putval */
+
+int lcc_send_flush (lcc_connection_t *c, const char *plugin, /* {{{ */
+    const lcc_identifier_t *ident, int timeout)
+{
+  char command[1024] = "";
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  status = lcc_format_flush (c, command, sizeof (command),
+      plugin, ident, timeout);
+  if (status != 0)
+    return (status);
+
+  return (lcc_pipeline_send (c, command));
+} /* }}} int lcc_send_flush */
+
+int lcc_recv_getval (lcc_connection_t *c, /* {{{ */
+    size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names)
+{
+  lcc_response_t res;
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  status = lcc_pipeline_receive (c, &res);
+  if (status != 0)
+    return (status);
+
+  return (lcc_parse_getval (c, &res,
+        ret_values_num, ret_values, ret_values_names));
+} /* }}} int lcc_recv_getval */
+
+int lcc_recv_status (lcc_connection_t *c) /* {{{ */
+{
+  lcc_response_t res;
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  status = lcc_pipeline_receive (c, &res);
+  if (status != 0)
+    return (status);
+
+  status = res.status;
+  if (status < 0)
+    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
+
+  lcc_response_free (&res);
+  return ((status < 0) ? -1 : 0);
+} /* }}} int lcc_recv_status */
+
+size_t lcc_pending (lcc_connection_t *c) /* {{{ */
+{
+  if (c == NULL)
+    return (0);
+  return (c->pending);
+} /* }}} size_t lcc_pending */
+
+/*
+ * Connection pool
+ */
+lcc_pool_t *lcc_pool_create (const char *address, /* {{{ */
+    size_t max_connections)
+{
+  lcc_pool_t *pool;
+
+  if ((address == NULL) || (max_connections == 0))
+  {
+    errno = EINVAL;
+    return (NULL);
+  }
+
+  pool = calloc (1, sizeof (*pool));
+  if (pool == NULL)
+    return (NULL);
+
+  pool->address = strdup (address);
+  pool->idle = calloc (max_connections, sizeof (*pool->idle));
+  if ((pool->address == NULL) || (pool->idle == NULL))
+  {
+    free (pool->address);
+    free (pool->idle);
+    free (pool);
+    errno = ENOMEM;
+    return (NULL);
+  }
+  pool->max_connections = max_connections;
+
+  pthread_mutex_init (&pool->lock, /* attr = */ NULL);
+  pthread_cond_init (&pool->cond, /* attr = */ NULL);
+
+  return (pool);
+} /* }}} lcc_pool_t *lcc_pool_create */
+
+void lcc_pool_destroy (lcc_pool_t *pool) /* {{{ */
+{
+  size_t i;
+
+  if (pool == NULL)
+    return;
+
+  for (i = 0; i < pool->idle_num; i++)
+    lcc_disconnect (pool->idle[i]);
+
+  pthread_cond_destroy (&pool->cond);
+  pthread_mutex_destroy (&pool->lock);
+  free (pool->idle);
+  free (pool->address);
+  free (pool);
+} /* }}} void lcc_pool_destroy */
+
+int lcc_pool_acquire (lcc_pool_t *pool, /* {{{ */
+    lcc_connection_t **ret_con)
+{
+  lcc_connection_t *c = NULL;
+  int status;
+
+  if ((pool == NULL) || (ret_con == NULL))
+    return (-1);
+
+  pthread_mutex_lock (&pool->lock);
+  while ((pool->idle_num == 0)
+      && (pool->active_num >= pool->max_connections))
+    pthread_cond_wait (&pool->cond, &pool->lock);
+
+  if (pool->idle_num > 0)
+  {
+    pool->idle_num--;
+    c = pool->idle[pool->idle_num];
+  }
+  pool->active_num++;
+  pthread_mutex_unlock (&pool->lock);
+
+  if (c != NULL)
+  {
+    *ret_con = c;
+    return (0);
+  }
+
+  /* Connect without holding the lock. */
+  status = lcc_connect (pool->address, &c);
+  if (status != 0)
+  {
+    pthread_mutex_lock (&pool->lock);
+    pool->active_num--;
+    pthread_cond_signal (&pool->cond);
+    pthread_mutex_unlock (&pool->lock);
+    return (status);
+  }
+
+  *ret_con = c;
+  return (0);
+} /* }}} int lcc_pool_acquire */
+
+void lcc_pool_release (lcc_pool_t *pool, /* {{{ */
+    lcc_connection_t *c, int status)
+{
+  if (pool == NULL)
+    return;
+
+  /* Connections in an unknown state are not reused. */
+  if ((c != NULL) && ((status != 0) || (c->pending != 0)))
+  {
+    lcc_disconnect (c);
+    c = NULL;
+  }
+
+  pthread_mutex_lock (&pool->lock);
+  assert (pool->active_num > 0);
+  pool->active_num--;
+  if (c != NULL)
+  {
+    assert (pool->idle_num < pool->max_connections);
+    pool->idle[pool->idle_num] = c;
+    pool->idle_num++;
+  }
+  pthread_cond_signal (&pool->cond);
+  pthread_mutex_unlock (&pool->lock);
+} /* }}} void lcc_pool_release */
 
 const char *lcc_strerror (lcc_connection_t *c) /* {{{ */
 {
@@ -106,14 +106,80 @@ int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident,
 
 int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl);
 
+/* Submits "vl_num" value lists in one round trip using the "BATCH" command of
+ * the unixsock plugin. */
+int lcc_putval_batch (lcc_connection_t *c,
+    const lcc_value_list_t *vl, size_t vl_num);
+
+/* Like "lcc_putval_batch", but encodes the value lists in the binary network
+ * protocol and submits them with the "PUTBIN" command, which avoids parsing
+ * text on the server side. */
+int lcc_putval_binary (lcc_connection_t *c,
+    const lcc_value_list_t *vl, size_t vl_num);
+
 int lcc_flush (lcc_connection_t *c, const char *plugin,
     lcc_identifier_t *ident, int timeout);
 
 int lcc_listval (lcc_connection_t *c,
     lcc_identifier_t **ret_ident, size_t *ret_ident_num);
 
+/* Like "lcc_listval", but only returns identifiers matching the shell wildcard
+ * "pattern", e.g. "host/plugin*". A NULL pattern matches all identifiers. */
+int lcc_listval_match (lcc_connection_t *c, const char *pattern,
+    lcc_identifier_t **ret_ident, size_t *ret_ident_num);
+
+/* Calls "callback" for each identifier matching "pattern" while the response
+ * is being received, without building an array of all identifiers. If the
+ * callback returns non-zero, it is not called again and that value is
+ * returned. */
+typedef int (*lcc_listval_callback_t) (const lcc_identifier_t *ident,
+    double time, void *user_data);
+int lcc_listval_foreach (lcc_connection_t *c, const char *pattern,
+    lcc_listval_callback_t callback, void *user_data);
+
 /* TODO: putnotif */
 
+/*
+ * Pipelining
+ *
+ * The lcc_send_* functions queue a command without waiting for its response.
+ * Responses are returned in the same order by lcc_recv_getval (for GETVAL)
+ * and lcc_recv_status (for PUTVAL and FLUSH). All responses have to be
+ * received before any of the synchronous functions above may be used again.
+ * The library reads responses ahead of time as needed, so any number of
+ * commands may be queued.
+ */
+int lcc_send_getval (lcc_connection_t *c, const lcc_identifier_t *ident);
+int lcc_send_putval (lcc_connection_t *c, const lcc_value_list_t *vl);
+int lcc_send_flush (lcc_connection_t *c, const char *plugin,
+    const lcc_identifier_t *ident, int timeout);
+
+int lcc_recv_getval (lcc_connection_t *c,
+    size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names);
+int lcc_recv_status (lcc_connection_t *c);
+
+/* Returns the number of commands whose responses haven't been received. */
+size_t lcc_pending (lcc_connection_t *c);
+
+/*
+ * Connection pool
+ *
+ * A thread-safe pool of up to "max_connections" connections to "address".
+ * lcc_pool_acquire blocks until a connection is available; it opens new
+ * connections as needed. A connection must only be used by one thread at a
+ * time and is handed back with lcc_pool_release. If "status" is non-zero or
+ * responses are still pending, the connection is closed instead of being
+ * reused.
+ */
+struct lcc_pool_s;
+typedef struct lcc_pool_s lcc_pool_t;
+
+lcc_pool_t *lcc_pool_create (const char *address, size_t max_connections);
+void lcc_pool_destroy (lcc_pool_t *pool);
+
+int lcc_pool_acquire (lcc_pool_t *pool, lcc_connection_t **ret_con);
+void lcc_pool_release (lcc_pool_t *pool, lcc_connection_t *c, int status);
+
 const char *lcc_strerror (lcc_connection_t *c);
 
 int lcc_identifier_to_string (lcc_connection_t *c,
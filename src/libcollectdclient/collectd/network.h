@@ -36,6 +36,9 @@
 #define NET_DEFAULT_V6_ADDR "ff18::efc0:4a42"
 #define NET_DEFAULT_PORT    "25826"
 
+/* Length prefix of every packet sent over a TCP connection. */
+#define LCC_NETWORK_STREAM_HEADER_SIZE 4
+
 struct lcc_network_s;
 typedef struct lcc_network_s lcc_network_t;
 
@@ -50,6 +53,13 @@ enum lcc_security_level_e
 };
 typedef enum lcc_security_level_e lcc_security_level_t;
 
+enum lcc_protocol_e
+{
+  LCC_PROTOCOL_UDP,
+  LCC_PROTOCOL_TCP
+};
+typedef enum lcc_protocol_e lcc_protocol_t;
+
 /*
  * Create / destroy object
  */
@@ -65,6 +75,7 @@ int lcc_server_destroy (lcc_network_t *net, lcc_server_t *srv);
 
 /* Configure servers */
 int lcc_server_set_ttl (lcc_server_t *srv, uint8_t ttl);
+int lcc_server_set_protocol (lcc_server_t *srv, lcc_protocol_t protocol);
 int lcc_server_set_interface (lcc_server_t *srv, char const *interface);
 int lcc_server_set_security_level (lcc_server_t *srv,
     lcc_security_level_t level,
@@ -38,6 +38,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <arpa/inet.h> /* htonl */
 
 #if HAVE_NETINET_IN_H
 # include <netinet/in.h>
@@ -64,6 +65,7 @@ struct lcc_server_s
   char *service;
 
   int ttl;
+  lcc_protocol_t protocol;
   lcc_security_level_t security_level;
   char *username;
   char *password;
@@ -89,6 +91,7 @@ static int server_close_socket (lcc_server_t *srv) /* {{{ */
     return (0);
 
   close (srv->fd);
+  srv->fd = -1;
   free (srv->sa);
   srv->sa = NULL;
   srv->sa_len = 0;
@@ -139,7 +142,8 @@ static int server_open_socket (lcc_server_t *srv) /* {{{ */
   ai_hints.ai_flags |= AI_ADDRCONFIG;
 #endif
   ai_hints.ai_family   = AF_UNSPEC;
-  ai_hints.ai_socktype = SOCK_DGRAM;
+  ai_hints.ai_socktype = (srv->protocol == LCC_PROTOCOL_TCP)
+    ? SOCK_STREAM : SOCK_DGRAM;
 
   status = getaddrinfo (srv->node, srv->service, &ai_hints, &ai_list);
   if (status != 0)
@@ -152,6 +156,16 @@ static int server_open_socket (lcc_server_t *srv) /* {{{ */
     if (srv->fd < 0)
       continue;
 
+    if (srv->protocol == LCC_PROTOCOL_TCP)
+    {
+      if (connect (srv->fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen) != 0)
+      {
+        close (srv->fd);
+        srv->fd = -1;
+        continue;
+      }
+    }
+
     if (ai_ptr->ai_family == AF_INET)
     {
 
@@ -203,6 +217,39 @@ static int server_open_socket (lcc_server_t *srv) /* {{{ */
   return (0);
 } /* }}} int server_open_socket */
 
+/* Stream sockets: Prefix the packet with its length and write all of it. */
+static int server_send_buffer_stream (lcc_server_t *srv, /* {{{ */
+    const char *buffer, size_t buffer_size)
+{
+  char frame[LCC_NETWORK_STREAM_HEADER_SIZE + buffer_size];
+  uint32_t frame_len = htonl ((uint32_t) buffer_size);
+  size_t sent = 0;
+
+  memcpy (frame, &frame_len, sizeof (frame_len));
+  memcpy (frame + LCC_NETWORK_STREAM_HEADER_SIZE, buffer, buffer_size);
+
+  while (sent < sizeof (frame))
+  {
+    ssize_t status;
+
+    status = send (srv->fd, frame + sent, sizeof (frame) - sent,
+        /* flags = */ 0);
+    if ((status < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+      continue;
+    else if (status < 0)
+    {
+      /* The peer would see the rest of this frame as garbage. Start over
+       * on a new connection. */
+      server_close_socket (srv);
+      return (-1);
+    }
+
+    sent += (size_t) status;
+  }
+
+  return (0);
+} /* }}} int server_send_buffer_stream */
+
 static int server_send_buffer (lcc_server_t *srv) /* {{{ */
 {
   char buffer[LCC_NETWORK_BUFFER_SIZE_DEFAULT];
@@ -235,6 +282,9 @@ static int server_send_buffer (lcc_server_t *srv) /* {{{ */
   if (buffer_size > sizeof (buffer))
     buffer_size = sizeof (buffer);
 
+  if (srv->protocol == LCC_PROTOCOL_TCP)
+    return (server_send_buffer_stream (srv, buffer, buffer_size));
+
   while (42)
   {
     assert (srv->fd >= 0);
@@ -306,6 +356,7 @@ lcc_server_t *lcc_server_create (lcc_network_t *net, /* {{{ */
   memset (srv, 0, sizeof (*srv));
 
   srv->fd = -1;
+  srv->protocol = LCC_PROTOCOL_UDP;
   srv->security_level = NONE;
   srv->username = NULL;
   srv->password = NULL;
@@ -391,6 +442,21 @@ int lcc_server_set_ttl (lcc_server_t *srv, uint8_t ttl) /* {{{ */
   return (0);
 } /* }}} int lcc_server_set_ttl */
 
+int lcc_server_set_protocol (lcc_server_t *srv, lcc_protocol_t protocol) /* {{{ */
+{
+  if (srv == NULL)
+    return (EINVAL);
+
+  if ((protocol != LCC_PROTOCOL_UDP) && (protocol != LCC_PROTOCOL_TCP))
+    return (EINVAL);
+
+  if (srv->protocol != protocol)
+    server_close_socket (srv);
+  srv->protocol = protocol;
+
+  return (0);
+} /* }}} int lcc_server_set_protocol */
+
 int lcc_server_set_interface (lcc_server_t *srv, char const *interface) /* {{{ */
 {
   int if_index;
@@ -0,0 +1,198 @@
+/**
+ * collectd - src/lsf_mock.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+
+/*
+ * Stand-in for the parts of the LSF batch library used by the jobstatus
+ * plugin. Serves a synthetic job population from memory so the plugin can
+ * be benchmarked without an LSF master.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <lsf.h>
+#include <lsbatch.h>
+
+#include "lsf_mock.h"
+
+#define MOCK_RESREQ "select[mem>1024] rusage[mem=2048,scratch=10000]"
+
+unsigned long lsf_mock_openjobinfo_calls = 0;
+unsigned long lsf_mock_getjobdepinfo_calls = 0;
+
+static struct jobInfoEnt *jobs = NULL;
+static int jobs_num = 0;
+static int jobs_pos = 0;
+static char (*users)[16] = NULL;
+static int users_num = 0;
+static double change_share = 0.0;
+
+static LS_LONG_INT next_id = 1000;
+static time_t mock_time = 1000000000;
+static unsigned int seed = 1;
+
+static struct jobInfoHead head;
+static struct jobDependInfo depend;
+
+static unsigned int mock_rand (void)
+{
+  seed = seed * 1103515245 + 12345;
+  return ((seed >> 16) & 0x7fff);
+}
+
+static void job_new (struct jobInfoEnt *job, _Bool running)
+{
+  memset (job, 0, sizeof (*job));
+
+  /* every tenth job is an element of a job array */
+  if ((next_id % 10) == 0)
+    job->jobId = LSB_JOBID (next_id, (1 + mock_rand () % 100));
+  else
+    job->jobId = next_id;
+  next_id++;
+
+  job->user = users[mock_rand () % users_num];
+  job->submit.numProcessors = 1 << (mock_rand () % 5);
+  job->submit.resReq = MOCK_RESREQ;
+  job->submitTime = mock_time;
+
+  if (running)
+  {
+    job->status = JOB_STAT_RUN;
+    job->startTime = mock_time;
+    job->jRusageUpdateTime = mock_time;
+    job->numExHosts = job->submit.numProcessors;
+  }
+  else
+  {
+    job->status = JOB_STAT_PEND;
+    job->reasons = 1 + mock_rand () % 8;
+  }
+}
+
+void lsf_mock_setup (int jobs_count, int users_count,
+    double running, double change)
+{
+  int i;
+
+  free (jobs);
+  free (users);
+
+  jobs_num = jobs_count;
+  jobs = calloc (jobs_num, sizeof (*jobs));
+  users_num = users_count;
+  users = calloc (users_num, sizeof (*users));
+  if ((jobs == NULL) || (users == NULL))
+  {
+    fprintf (stderr, "lsf_mock_setup: calloc failed\n");
+    exit (EXIT_FAILURE);
+  }
+
+  for (i = 0; i < users_num; i++)
+    snprintf (users[i], sizeof (users[i]), "user%04i", i);
+  for (i = 0; i < jobs_num; i++)
+    job_new (jobs + i, (mock_rand () % 1000) < (unsigned int) (running * 1000));
+
+  change_share = change;
+  lsf_mock_openjobinfo_calls = 0;
+  lsf_mock_getjobdepinfo_calls = 0;
+}
+
+/* Lets time pass: some jobs start, finish, report usage or change their
+ * pending reason. */
+static void mock_step (void)
+{
+  int changes = (int) (change_share * jobs_num);
+  int i;
+
+  mock_time += 60;
+  for (i = 0; i < changes; i++)
+  {
+    struct jobInfoEnt *job = jobs + (mock_rand () % jobs_num);
+
+    if (job->status == JOB_STAT_RUN)
+    {
+      if (mock_rand () % 2)
+        job->jRusageUpdateTime = mock_time;
+      else
+        job_new (job, 0);
+    }
+    else if (mock_rand () % 2)
+    {
+      job->status = JOB_STAT_RUN;
+      job->startTime = mock_time;
+      job->jRusageUpdateTime = mock_time;
+      job->numExHosts = job->submit.numProcessors;
+      job->reasons = 0;
+    }
+    else
+      job->reasons = 1 + mock_rand () % 8;
+  }
+}
+
+int lsb_init (char *appName)
+{
+  return (0);
+}
+
+struct jobInfoHead *lsb_openjobinfo_a (LS_LONG_INT jobId, char *jobName,
+    char *userName, char *queueName, char *hostName, int options)
+{
+  lsf_mock_openjobinfo_calls++;
+  mock_step ();
+
+  memset (&head, 0, sizeof (head));
+  head.numJobs = jobs_num;
+  jobs_pos = 0;
+  return (&head);
+}
+
+struct jobInfoEnt *lsb_readjobinfo (int *more)
+{
+  if (jobs_pos >= jobs_num)
+    return (NULL);
+
+  if (more != NULL)
+    *more = jobs_num - jobs_pos - 1;
+  return (jobs + jobs_pos++);
+}
+
+void lsb_closejobinfo (void)
+{
+  jobs_pos = jobs_num;
+}
+
+struct jobDependInfo *lsb_getjobdepinfo (struct jobDepRequest *jobdepReq)
+{
+  lsf_mock_getjobdepinfo_calls++;
+
+  memset (&depend, 0, sizeof (depend));
+  depend.numJobs = (int) (LSB_ARRAY_JOBID (jobdepReq->jobId) % 3);
+  return (&depend);
+}
+
+/* vim: set sw=2 sts=2 et : */
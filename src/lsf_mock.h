@@ -0,0 +1,38 @@
+/**
+ * collectd - src/lsf_mock.h
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+
+#ifndef LSF_MOCK_H
+#define LSF_MOCK_H 1
+
+/* Creates "jobs" jobs of "users" users, of which a share of "running" is
+ * running. On every lsb_openjobinfo_a() call, a share of "change" of the
+ * jobs starts, finishes, reports new usage or changes its pending reason. */
+void lsf_mock_setup (int jobs, int users, double running, double change);
+
+/* calls since lsf_mock_setup */
+extern unsigned long lsf_mock_openjobinfo_calls;
+extern unsigned long lsf_mock_getjobdepinfo_calls;
+
+#endif /* LSF_MOCK_H */
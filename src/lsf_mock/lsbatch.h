@@ -0,0 +1,103 @@
+/**
+ * collectd - src/lsf_mock/lsbatch.h
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+/*
+ * Stand-in for the LSF batch header, see lsf.h. The names and semantics
+ * follow LSF; only lsf_mock.c implements these functions.
+ */
+
+#ifndef LSBATCH_H
+#define LSBATCH_H 1
+
+#include <time.h>
+
+#include "lsf.h"
+
+/* lsb_openjobinfo_a() options */
+#define PEND_JOB 0x0002
+#define RUN_JOB 0x0004
+
+/* jobInfoEnt.status */
+#define JOB_STAT_PEND 0x01
+#define JOB_STAT_RUN 0x04
+
+/* jobDepRequest.options */
+#define QUERY_DEPEND_UNSATISFIED 0x02
+
+#define LSB_MAX_ARRAY_JOBID 0x0FFFFFFFF
+#define LSB_MAX_ARRAY_IDX 0x0FFFFFFFF
+#define LSB_ARRAY_IDX(jobId) \
+  (((jobId) == -1) ? (0) \
+   : (int) (((LS_UNS_LONG_INT) (jobId) >> 32) & LSB_MAX_ARRAY_IDX))
+#define LSB_ARRAY_JOBID(jobId) \
+  (((jobId) == -1) ? (-1) : (int) ((jobId) & LSB_MAX_ARRAY_JOBID))
+#define LSB_JOBID(array_jobId, array_idx) \
+  (((LS_UNS_LONG_INT) (array_idx) << 32) | (array_jobId))
+
+struct submit {
+  int options;
+  int numProcessors;
+  char *resReq;
+};
+
+struct jobInfoEnt {
+  LS_LONG_INT jobId;
+  char *user;
+  int status;
+  int reasons;
+  int subreasons;
+  time_t submitTime;
+  time_t startTime;
+  int numExHosts;
+  struct submit submit;
+  time_t jRusageUpdateTime;
+};
+
+struct jobInfoHead {
+  int numJobs;
+  LS_LONG_INT *jobIds;
+};
+
+struct jobDepRequest {
+  LS_LONG_INT jobId;
+  int options;
+  int level;
+};
+
+struct jobDependInfo {
+  int options;
+  char *jobIds;
+  int jobType;
+  int numJobs;
+  void *depJobs;
+};
+
+int lsb_init (char *appName);
+struct jobInfoHead *lsb_openjobinfo_a (LS_LONG_INT jobId, char *jobName,
+    char *userName, char *queueName, char *hostName, int options);
+struct jobInfoEnt *lsb_readjobinfo (int *more);
+void lsb_closejobinfo (void);
+struct jobDependInfo *lsb_getjobdepinfo (struct jobDepRequest *jobdepReq);
+
+#endif /* LSBATCH_H */
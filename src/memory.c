@@ -70,7 +70,8 @@ static vm_size_t pagesize;
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-/* no global variables */
+# include "utils_procfile.h"
+static procfile_t *proc_meminfo;
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -126,7 +127,8 @@ static int memory_init (void)
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif defined(KERNEL_LINUX)
-/* no init stuff */
+	if (proc_meminfo == NULL)
+		proc_meminfo = procfile_create ("/proc/meminfo");
 /* #endif KERNEL_LINUX */
 
 #elif defined(HAVE_LIBKSTAT)
@@ -275,8 +277,8 @@ static int memory_read_internal (value_list_t *vl)
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-	FILE *fh;
-	char buffer[1024];
+	char *buffer;
+	char *line;
 
 	char *fields[8];
 	int numfields;
@@ -292,51 +294,47 @@ static int memory_read_internal (value_list_t *vl)
 	gauge_t mem_slab_reclaimable = 0;
 	gauge_t mem_slab_unreclaimable = 0;
 
-	if ((fh = fopen ("/proc/meminfo", "r")) == NULL)
+	if (proc_meminfo == NULL)
+		return (-1);
+
+	if ((buffer = procfile_read (proc_meminfo, NULL)) == NULL)
 	{
 		char errbuf[1024];
-		WARNING ("memory: fopen: %s",
+		WARNING ("memory: Reading /proc/meminfo failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	while ((line = procfile_next_line (&buffer)) != NULL)
 	{
 		gauge_t *val = NULL;
 
-		if (strncasecmp (buffer, "MemTotal:", 9) == 0)
+		if (strncasecmp (line, "MemTotal:", 9) == 0)
 			val = &mem_total;
-		else if (strncasecmp (buffer, "MemFree:", 8) == 0)
+		else if (strncasecmp (line, "MemFree:", 8) == 0)
 			val = &mem_free;
-		else if (strncasecmp (buffer, "Buffers:", 8) == 0)
+		else if (strncasecmp (line, "Buffers:", 8) == 0)
 			val = &mem_buffered;
-		else if (strncasecmp (buffer, "Cached:", 7) == 0)
+		else if (strncasecmp (line, "Cached:", 7) == 0)
 			val = &mem_cached;
-		else if (strncasecmp (buffer, "Slab:", 5) == 0)
+		else if (strncasecmp (line, "Slab:", 5) == 0)
 			val = &mem_slab_total;
-		else if (strncasecmp (buffer, "SReclaimable:", 13) == 0) {
+		else if (strncasecmp (line, "SReclaimable:", 13) == 0) {
 			val = &mem_slab_reclaimable;
 			detailed_slab_info = 1;
 		}
-		else if (strncasecmp (buffer, "SUnreclaim:", 11) == 0) {
+		else if (strncasecmp (line, "SUnreclaim:", 11) == 0) {
 			val = &mem_slab_unreclaimable;
 			detailed_slab_info = 1;
 		}
 		else
 			continue;
 
-		numfields = strsplit (buffer, fields, STATIC_ARRAY_SIZE (fields));
+		numfields = procfile_split (line, fields, STATIC_ARRAY_SIZE (fields));
 		if (numfields < 2)
 			continue;
 
-		*val = 1024.0 * atof (fields[1]);
-	}
-
-	if (fclose (fh))
-	{
-		char errbuf[1024];
-		WARNING ("memory: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
+		*val = 1024.0 * (gauge_t) procfile_u64 (fields[1], NULL);
 	}
 
 	if (mem_total < (mem_free + mem_buffered + mem_cached + mem_slab_total))
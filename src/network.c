@@ -57,6 +57,7 @@
 #if HAVE_NET_IF_H
 # include <net/if.h>
 #endif
+#include <sys/un.h>
 
 #if HAVE_LIBGCRYPT
 # include <pthread.h>
@@ -108,11 +109,35 @@ GCRY_THREAD_OPTION_PTHREAD_IMPL;
 # define SECURITY_LEVEL_SIGN    1
 # define SECURITY_LEVEL_ENCRYPT 2
 #endif
+
+#define SOCKENT_PROTOCOL_UDP  0
+#define SOCKENT_PROTOCOL_TCP  1
+#define SOCKENT_PROTOCOL_UNIX 2
+#define SOCKENT_IS_STREAM(se) ((se)->protocol != SOCKENT_PROTOCOL_UDP)
+
+/* Default size of the per-server write buffer used by stream sockets. */
+#define STREAM_BUFFER_SIZE_DEFAULT 65536
+/* Upper limit for the delay between two connection attempts. */
+#define STREAM_RECONNECT_MAX TIME_T_TO_CDTIME_T (60)
+
 struct sockent_client
 {
 	int fd;
 	struct sockaddr_storage *addr;
 	socklen_t                addrlen;
+	/* Stream sockets only: packets are framed and collected in
+	 * `stream_buffer' so that many of them are written with one call to
+	 * send(2). `stream_partial' is the number of bytes at the beginning of
+	 * the buffer that belong to a frame which has already been sent in
+	 * part. */
+	char           *stream_buffer;
+	size_t          stream_buffer_size;
+	size_t          stream_buffer_fill;
+	size_t          stream_partial;
+	cdtime_t        stream_send_timeout;
+	cdtime_t        next_connect_attempt;
+	cdtime_t        connect_backoff;
+	pthread_mutex_t stream_lock;
 #if HAVE_LIBGCRYPT
 	int security_level;
 	char *username;
@@ -141,6 +166,7 @@ typedef struct sockent
 #define SOCKENT_TYPE_CLIENT 1
 #define SOCKENT_TYPE_SERVER 2
 	int type;
+	int protocol;
 
 	char *node;
 	char *service;
@@ -277,6 +303,19 @@ struct receive_list_entry_s
 };
 typedef struct receive_list_entry_s receive_list_entry_t;
 
+/* Connection accepted on a stream (TCP or UNIX domain) socket. */
+struct stream_conn_s
+{
+  int    fd;
+  /* The listening socket the connection was accepted on. Used to find the
+   * `sockent_t' in the dispatch thread. */
+  int    listen_fd;
+  char  *buffer;
+  size_t buffer_size;
+  size_t buffer_fill;
+};
+typedef struct stream_conn_s stream_conn_t;
+
 /*
  * Private variables
  */
@@ -296,6 +335,7 @@ static uint64_t              receive_list_length = 0;
 
 static sockent_t     *listen_sockets = NULL;
 static struct pollfd *listen_sockets_pollfd = NULL;
+static _Bool         *listen_sockets_stream = NULL;
 static size_t         listen_sockets_num = 0;
 
 /* The receive and dispatch threads will run as long as `listen_loop' is set to
@@ -1631,6 +1671,8 @@ static void free_sockent_client (struct sockent_client *sec) /* {{{ */
     sec->fd = -1;
   }
   sfree (sec->addr);
+  sfree (sec->stream_buffer);
+  pthread_mutex_destroy (&sec->stream_lock);
 #if HAVE_LIBGCRYPT
   sfree (sec->username);
   sfree (sec->password);
@@ -1671,14 +1713,26 @@ static void sockent_destroy (sockent_t *se) /* {{{ */
   {
     next = se->next;
 
-    sfree (se->node);
-    sfree (se->service);
-
     if (se->type == SOCKENT_TYPE_CLIENT)
       free_sockent_client (&se->data.client);
     else
+    {
+      /* Remove the socket file of a UNIX stream socket we listened on. */
+      _Bool unlink_node = (se->protocol == SOCKENT_PROTOCOL_UNIX)
+        && (se->data.server.fd_num > 0) && (se->node != NULL);
+
       free_sockent_server (&se->data.server);
 
+      if (unlink_node && (unlink (se->node) != 0))
+      {
+        char errbuf[1024];
+        NOTICE ("network plugin: unlink (%s) failed: %s", se->node,
+            sstrerror (errno, errbuf, sizeof (errbuf)));
+      }
+    }
+
+    sfree (se->node);
+    sfree (se->service);
     sfree (se);
     se = next;
   }
@@ -2020,6 +2074,7 @@ static sockent_t *sockent_create (int type) /* {{{ */
 	memset (se, 0, sizeof (*se));
 
 	se->type = type;
+	se->protocol = SOCKENT_PROTOCOL_UDP;
 	se->node = NULL;
 	se->service = NULL;
 	se->interface = 0;
@@ -2042,6 +2097,14 @@ static sockent_t *sockent_create (int type) /* {{{ */
 		se->data.client.addr = NULL;
 		se->data.client.resolve_interval = 0;
 		se->data.client.next_resolve_reconnect = 0;
+		se->data.client.stream_buffer = NULL;
+		se->data.client.stream_buffer_size = STREAM_BUFFER_SIZE_DEFAULT;
+		se->data.client.stream_buffer_fill = 0;
+		se->data.client.stream_partial = 0;
+		se->data.client.stream_send_timeout = TIME_T_TO_CDTIME_T (10);
+		se->data.client.next_connect_attempt = 0;
+		se->data.client.connect_backoff = 0;
+		pthread_mutex_init (&se->data.client.stream_lock, /* attr = */ NULL);
 #if HAVE_LIBGCRYPT
 		se->data.client.security_level = SECURITY_LEVEL_NONE;
 		se->data.client.username = NULL;
@@ -2108,6 +2171,30 @@ static int sockent_init_crypto (sockent_t *se) /* {{{ */
 	return (0);
 } /* }}} int sockent_init_crypto */
 
+/* Removes the first `sent' bytes from the stream buffer of a client socket.
+ * Keeps track of the frame that has been sent in part, so that its remainder
+ * can be discarded if the connection is lost. */
+static void sockent_stream_consume (struct sockent_client *client, /* {{{ */
+		size_t sent)
+{
+	size_t pos = client->stream_partial;
+
+	assert (sent <= client->stream_buffer_fill);
+
+	while (pos < sent)
+	{
+		uint32_t frame_len;
+
+		memcpy (&frame_len, client->stream_buffer + pos, sizeof (frame_len));
+		pos += NET_STREAM_HEADER_SIZE + ntohl (frame_len);
+	}
+	client->stream_partial = pos - sent;
+
+	memmove (client->stream_buffer, client->stream_buffer + sent,
+			client->stream_buffer_fill - sent);
+	client->stream_buffer_fill -= sent;
+} /* }}} void sockent_stream_consume */
+
 static int sockent_client_disconnect (sockent_t *se) /* {{{ */
 {
 	struct sockent_client *client;
@@ -2122,12 +2209,230 @@ static int sockent_client_disconnect (sockent_t *se) /* {{{ */
 		client->fd = -1;
 	}
 
+	/* The peer never sees the end of a partially sent frame. Don't send the
+	 * remainder over the next connection. */
+	if (client->stream_partial > 0)
+	{
+		WARNING ("network plugin: Discarding a partially sent frame "
+				"(%zu bytes) to %s.", client->stream_partial, se->node);
+		sockent_stream_consume (client, client->stream_partial);
+	}
+
 	sfree (client->addr);
 	client->addrlen = 0;
 
 	return (0);
 } /* }}} int sockent_client_disconnect */
 
+/* Connects `fd' without blocking the write thread for longer than
+ * `timeout' (indefinitely if zero). The socket is left in blocking mode.
+ * Returns zero or an errno value. */
+static int sockent_connect_timeout (int fd, /* {{{ */
+		const struct sockaddr *sa, socklen_t sa_len, cdtime_t timeout)
+{
+	struct pollfd pfd;
+	cdtime_t deadline;
+	socklen_t status_len;
+	int flags;
+	int status;
+
+	flags = fcntl (fd, F_GETFL);
+	if ((flags == -1) || (fcntl (fd, F_SETFL, flags | O_NONBLOCK) != 0))
+		return (errno);
+
+	status = 0;
+	if (connect (fd, sa, sa_len) != 0)
+		status = errno;
+
+	deadline = cdtime () + timeout;
+	while (status == EINPROGRESS)
+	{
+		int timeout_ms = -1;
+		int ready;
+
+		if (timeout != 0)
+		{
+			cdtime_t now = cdtime ();
+
+			if (now >= deadline)
+			{
+				status = ETIMEDOUT;
+				break;
+			}
+			timeout_ms = (int) CDTIME_T_TO_MS (deadline - now);
+		}
+
+		memset (&pfd, 0, sizeof (pfd));
+		pfd.fd = fd;
+		pfd.events = POLLOUT;
+
+		ready = poll (&pfd, 1, timeout_ms);
+		if (ready < 0)
+		{
+			if (errno != EINTR)
+				status = errno;
+			continue;
+		}
+		else if (ready == 0)
+		{
+			status = ETIMEDOUT;
+			break;
+		}
+
+		status_len = sizeof (status);
+		if (getsockopt (fd, SOL_SOCKET, SO_ERROR, &status, &status_len) != 0)
+			status = errno;
+	}
+
+	if ((status == 0) && (fcntl (fd, F_SETFL, flags) != 0))
+		status = errno;
+
+	return (status);
+} /* }}} int sockent_connect_timeout */
+
+static int sockent_client_connect_stream_fd (sockent_t *se, /* {{{ */
+		int family, const struct sockaddr *sa, socklen_t sa_len)
+{
+	struct sockent_client *client = &se->data.client;
+	struct timeval tv;
+	int status;
+
+	client->fd = socket (family, SOCK_STREAM, /* protocol = */ 0);
+	if (client->fd < 0)
+	{
+		char errbuf[1024];
+		ERROR ("network plugin: socket(2) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	status = sockent_connect_timeout (client->fd, sa, sa_len,
+			client->stream_send_timeout);
+	if (status != 0)
+	{
+		close (client->fd);
+		client->fd = -1;
+		return (-1);
+	}
+
+	/* A slow receiver makes send(2) block for at most this long. This is
+	 * what pushes back on the write thread instead of losing data. */
+	CDTIME_T_TO_TIMEVAL (client->stream_send_timeout, &tv);
+	if (setsockopt (client->fd, SOL_SOCKET, SO_SNDTIMEO,
+				&tv, sizeof (tv)) != 0)
+	{
+		char errbuf[1024];
+		WARNING ("network plugin: setsockopt (SO_SNDTIMEO): %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+	}
+
+	client->addr = malloc (sizeof (*client->addr));
+	if (client->addr == NULL)
+	{
+		ERROR ("network plugin: malloc failed.");
+		close (client->fd);
+		client->fd = -1;
+		return (-1);
+	}
+	memset (client->addr, 0, sizeof (*client->addr));
+	assert (sizeof (*client->addr) >= sa_len);
+	memcpy (client->addr, sa, sa_len);
+	client->addrlen = sa_len;
+
+	return (0);
+} /* }}} int sockent_client_connect_stream_fd */
+
+/* Connects a TCP or UNIX domain stream socket. Failed attempts are retried
+ * with an exponential backoff so that an unreachable peer does not cost a
+ * connect(2) for every packet. */
+static int sockent_client_connect_stream (sockent_t *se) /* {{{ */
+{
+	static c_complain_t complaint = C_COMPLAIN_INIT_STATIC;
+
+	struct sockent_client *client = &se->data.client;
+	int status = -1;
+	cdtime_t now;
+
+	if (client->fd >= 0)
+		return (0);
+
+	now = cdtime ();
+	if (now < client->next_connect_attempt)
+		return (-1);
+
+	if (se->protocol == SOCKENT_PROTOCOL_UNIX)
+	{
+		struct sockaddr_un sa;
+
+		memset (&sa, 0, sizeof (sa));
+		sa.sun_family = AF_UNIX;
+		sstrncpy (sa.sun_path, se->node, sizeof (sa.sun_path));
+
+		status = sockent_client_connect_stream_fd (se, AF_UNIX,
+				(struct sockaddr *) &sa, sizeof (sa));
+	}
+	else /* if (se->protocol == SOCKENT_PROTOCOL_TCP) */
+	{
+		struct addrinfo  ai_hints;
+		struct addrinfo *ai_list = NULL, *ai_ptr;
+
+		memset (&ai_hints, 0, sizeof (ai_hints));
+#ifdef AI_ADDRCONFIG
+		ai_hints.ai_flags |= AI_ADDRCONFIG;
+#endif
+		ai_hints.ai_family   = AF_UNSPEC;
+		ai_hints.ai_socktype = SOCK_STREAM;
+		ai_hints.ai_protocol = IPPROTO_TCP;
+
+		status = getaddrinfo (se->node,
+				(se->service != NULL) ? se->service : NET_DEFAULT_PORT,
+				&ai_hints, &ai_list);
+		if (status != 0)
+		{
+			c_complain (LOG_ERR, &complaint,
+					"network plugin: getaddrinfo (%s, %s) failed: %s",
+					(se->node == NULL) ? "(null)" : se->node,
+					(se->service == NULL) ? "(null)" : se->service,
+					gai_strerror (status));
+			status = -1;
+			ai_list = NULL;
+		}
+
+		for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
+		{
+			status = sockent_client_connect_stream_fd (se,
+					ai_ptr->ai_family,
+					ai_ptr->ai_addr, ai_ptr->ai_addrlen);
+			if (status == 0)
+				break;
+		}
+
+		if (ai_list != NULL)
+			freeaddrinfo (ai_list);
+	}
+
+	if (status != 0)
+	{
+		if (client->connect_backoff == 0)
+			client->connect_backoff = TIME_T_TO_CDTIME_T (1);
+		else if (client->connect_backoff < STREAM_RECONNECT_MAX)
+			client->connect_backoff *= 2;
+		client->next_connect_attempt = now + client->connect_backoff;
+
+		c_complain (LOG_ERR, &complaint,
+				"network plugin: Connecting to %s failed. "
+				"Will retry in %.3f seconds.", se->node,
+				CDTIME_T_TO_DOUBLE (client->connect_backoff));
+		return (-1);
+	}
+
+	client->connect_backoff = 0;
+	client->next_connect_attempt = 0;
+	c_release (LOG_NOTICE, &complaint,
+			"network plugin: Successfully connected to %s.", se->node);
+	return (0);
+} /* }}} int sockent_client_connect_stream */
+
 static int sockent_client_connect (sockent_t *se) /* {{{ */
 {
 	static c_complain_t complaint = C_COMPLAIN_INIT_STATIC;
@@ -2144,6 +2449,9 @@ static int sockent_client_connect (sockent_t *se) /* {{{ */
 
 	client = &se->data.client;
 
+	if (SOCKENT_IS_STREAM (se))
+		return (sockent_client_connect_stream (se));
+
 	now = cdtime ();
 	if (client->resolve_interval != 0 && client->next_resolve_reconnect < now) {
 		DEBUG("network plugin: Reconnecting socket, resolve_interval = %lf, next_resolve_reconnect = %lf",
@@ -2229,6 +2537,54 @@ static int sockent_client_connect (sockent_t *se) /* {{{ */
 	return (0);
 } /* }}} int sockent_client_connect */
 
+static int sockent_server_listen_unix (sockent_t *se) /* {{{ */
+{
+	struct sockaddr_un sa;
+	int fd;
+	int *tmp;
+
+	memset (&sa, 0, sizeof (sa));
+	sa.sun_family = AF_UNIX;
+	sstrncpy (sa.sun_path, se->node, sizeof (sa.sun_path));
+
+	fd = socket (AF_UNIX, SOCK_STREAM, /* protocol = */ 0);
+	if (fd < 0)
+	{
+		char errbuf[1024];
+		ERROR ("network plugin: socket(2) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	/* Remove a stale socket left behind by a previous instance. */
+	unlink (sa.sun_path);
+
+	if ((bind (fd, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+			|| (listen (fd, SOMAXCONN) != 0))
+	{
+		char errbuf[1024];
+		ERROR ("network plugin: Listening on %s failed: %s", sa.sun_path,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (fd);
+		unlink (sa.sun_path);
+		return (-1);
+	}
+
+	tmp = realloc (se->data.server.fd, sizeof (*tmp));
+	if (tmp == NULL)
+	{
+		ERROR ("network plugin: realloc failed.");
+		close (fd);
+		unlink (sa.sun_path);
+		return (-1);
+	}
+	se->data.server.fd = tmp;
+	se->data.server.fd[0] = fd;
+	se->data.server.fd_num = 1;
+
+	return (0);
+} /* }}} int sockent_server_listen_unix */
+
 /* Open the file descriptors for a initialized sockent structure. */
 static int sockent_server_listen (sockent_t *se) /* {{{ */
 {
@@ -2254,6 +2610,9 @@ static int sockent_server_listen (sockent_t *se) /* {{{ */
         DEBUG ("network plugin: sockent_server_listen: node = %s; service = %s;",
             node, service);
 
+	if (se->protocol == SOCKENT_PROTOCOL_UNIX)
+		return (sockent_server_listen_unix (se));
+
 	memset (&ai_hints, 0, sizeof (ai_hints));
 	ai_hints.ai_flags  = 0;
 #ifdef AI_PASSIVE
@@ -2263,8 +2622,16 @@ static int sockent_server_listen (sockent_t *se) /* {{{ */
 	ai_hints.ai_flags |= AI_ADDRCONFIG;
 #endif
 	ai_hints.ai_family   = AF_UNSPEC;
-	ai_hints.ai_socktype = SOCK_DGRAM;
-	ai_hints.ai_protocol = IPPROTO_UDP;
+	if (se->protocol == SOCKENT_PROTOCOL_TCP)
+	{
+		ai_hints.ai_socktype = SOCK_STREAM;
+		ai_hints.ai_protocol = IPPROTO_TCP;
+	}
+	else
+	{
+		ai_hints.ai_socktype = SOCK_DGRAM;
+		ai_hints.ai_protocol = IPPROTO_UDP;
+	}
 
 	status = getaddrinfo (node, service, &ai_hints, &ai_list);
 	if (status != 0)
@@ -2302,6 +2669,17 @@ static int sockent_server_listen (sockent_t *se) /* {{{ */
 		}
 
 		status = network_bind_socket (*tmp, ai_ptr, se->interface);
+		if ((status == 0) && (se->protocol == SOCKENT_PROTOCOL_TCP))
+		{
+			status = listen (*tmp, SOMAXCONN);
+			if (status != 0)
+			{
+				char errbuf[1024];
+				ERROR ("network plugin: listen(2) failed: %s",
+						sstrerror (errno, errbuf,
+							sizeof (errbuf)));
+			}
+		}
 		if (status != 0)
 		{
 			close (*tmp);
@@ -2331,6 +2709,7 @@ static int sockent_add (sockent_t *se) /* {{{ */
 	if (se->type == SOCKENT_TYPE_SERVER)
 	{
 		struct pollfd *tmp;
+		_Bool *is_stream;
 		size_t i;
 
 		tmp = realloc (listen_sockets_pollfd,
@@ -2344,12 +2723,24 @@ static int sockent_add (sockent_t *se) /* {{{ */
 		listen_sockets_pollfd = tmp;
 		tmp = listen_sockets_pollfd + listen_sockets_num;
 
+		is_stream = realloc (listen_sockets_stream,
+				sizeof (*is_stream) * (listen_sockets_num
+					+ se->data.server.fd_num));
+		if (is_stream == NULL)
+		{
+			ERROR ("network plugin: realloc failed.");
+			return (-1);
+		}
+		listen_sockets_stream = is_stream;
+		is_stream = listen_sockets_stream + listen_sockets_num;
+
 		for (i = 0; i < se->data.server.fd_num; i++)
 		{
 			memset (tmp + i, 0, sizeof (*tmp));
 			tmp[i].fd = se->data.server.fd[i];
 			tmp[i].events = POLLIN | POLLPRI;
 			tmp[i].revents = 0;
+			is_stream[i] = SOCKENT_IS_STREAM (se);
 		}
 
 		listen_sockets_num += se->data.server.fd_num;
@@ -2438,18 +2829,227 @@ static void *dispatch_thread (void __attribute__((unused)) *arg) /* {{{ */
   return (NULL);
 } /* }}} void *dispatch_thread */
 
+static receive_list_entry_t *receive_list_entry_create (int fd, /* {{{ */
+		const char *data, int data_len)
+{
+	receive_list_entry_t *ent;
+
+	/* TODO: Possible performance enhancement: Do not free
+	 * these entries in the dispatch thread but put them in
+	 * another list, so we don't have to allocate more and
+	 * more of these structures. */
+	ent = malloc (sizeof (receive_list_entry_t));
+	if (ent == NULL)
+	{
+		ERROR ("network plugin: malloc failed.");
+		return (NULL);
+	}
+	memset (ent, 0, sizeof (receive_list_entry_t));
+	ent->data = malloc (network_config_packet_size);
+	if (ent->data == NULL)
+	{
+		sfree (ent);
+		ERROR ("network plugin: malloc failed.");
+		return (NULL);
+	}
+	ent->fd = fd;
+	ent->next = NULL;
+
+	memcpy (ent->data, data, data_len);
+	ent->data_len = data_len;
+
+	return (ent);
+} /* }}} receive_list_entry_t *receive_list_entry_create */
+
+/* Appends `ent' to the receive thread's private list and hands the private
+ * list over to the dispatch thread if the global list is not locked. With
+ * `force' set, waits for the lock instead. */
+static void receive_list_enqueue (receive_list_entry_t *ent, /* {{{ */
+		receive_list_entry_t **private_list_head,
+		receive_list_entry_t **private_list_tail,
+		uint64_t *private_list_length, _Bool force)
+{
+	if (ent != NULL)
+	{
+		if (*private_list_head == NULL)
+			*private_list_head = ent;
+		else
+			(*private_list_tail)->next = ent;
+		*private_list_tail = ent;
+		(*private_list_length)++;
+	}
+
+	if (*private_list_head == NULL)
+		return;
+
+	/* Do not block here. Blocking here has led to
+	 * insufficient performance in the past. */
+	if (force)
+		pthread_mutex_lock (&receive_list_lock);
+	else if (pthread_mutex_trylock (&receive_list_lock) != 0)
+		return;
+
+	assert (((receive_list_head == NULL) && (receive_list_length == 0))
+			|| ((receive_list_head != NULL) && (receive_list_length != 0)));
+
+	if (receive_list_head == NULL)
+		receive_list_head = *private_list_head;
+	else
+		receive_list_tail->next = *private_list_head;
+	receive_list_tail = *private_list_tail;
+	receive_list_length += *private_list_length;
+
+	pthread_cond_signal (&receive_list_cond);
+	pthread_mutex_unlock (&receive_list_lock);
+
+	*private_list_head = NULL;
+	*private_list_tail = NULL;
+	*private_list_length = 0;
+} /* }}} void receive_list_enqueue */
+
+/* Reads from a stream connection and splits the data into frames. Returns
+ * non-zero if the connection has been closed by the peer or has to be closed
+ * because of an error. */
+static int network_receive_stream (stream_conn_t *conn, /* {{{ */
+		receive_list_entry_t **private_list_head,
+		receive_list_entry_t **private_list_tail,
+		uint64_t *private_list_length)
+{
+	ssize_t status;
+	size_t pos;
+
+	status = recv (conn->fd, conn->buffer + conn->buffer_fill,
+			conn->buffer_size - conn->buffer_fill, /* flags = */ 0);
+	if (status < 0)
+	{
+		char errbuf[1024];
+
+		if ((errno == EINTR) || (errno == EAGAIN))
+			return (0);
+
+		ERROR ("network plugin: recv(2) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+	else if (status == 0)
+	{
+		if (conn->buffer_fill > 0)
+			WARNING ("network plugin: Stream connection closed in the "
+					"middle of a frame. %zu bytes have been lost.",
+					conn->buffer_fill);
+		return (-1);
+	}
+
+	stats_octets_rx += ((uint64_t) status);
+	conn->buffer_fill += (size_t) status;
+
+	pos = 0;
+	while ((conn->buffer_fill - pos) >= NET_STREAM_HEADER_SIZE)
+	{
+		receive_list_entry_t *ent;
+		uint32_t frame_len;
+
+		memcpy (&frame_len, conn->buffer + pos, sizeof (frame_len));
+		frame_len = ntohl (frame_len);
+
+		if ((frame_len == 0) || (frame_len > network_config_packet_size))
+		{
+			ERROR ("network plugin: Received a frame of %"PRIu32" bytes "
+					"on a stream connection, but `MaxPacketSize' is "
+					"%zu. Closing the connection.",
+					frame_len, network_config_packet_size);
+			return (-1);
+		}
+
+		if ((conn->buffer_fill - (pos + NET_STREAM_HEADER_SIZE)) < frame_len)
+			break;
+
+		ent = receive_list_entry_create (conn->listen_fd,
+				conn->buffer + pos + NET_STREAM_HEADER_SIZE,
+				(int) frame_len);
+		if (ent == NULL)
+			return (-1);
+
+		stats_packets_rx++;
+		receive_list_enqueue (ent, private_list_head, private_list_tail,
+				private_list_length, /* force = */ 0);
+
+		pos += NET_STREAM_HEADER_SIZE + frame_len;
+	}
+
+	memmove (conn->buffer, conn->buffer + pos, conn->buffer_fill - pos);
+	conn->buffer_fill -= pos;
+
+	return (0);
+} /* }}} int network_receive_stream */
+
+static int network_receive_accept (int listen_fd, /* {{{ */
+		stream_conn_t **conns, size_t *conns_num)
+{
+	stream_conn_t *tmp;
+	int fd;
+
+	fd = accept (listen_fd, /* addr = */ NULL, /* addrlen = */ NULL);
+	if (fd < 0)
+	{
+		char errbuf[1024];
+		if ((errno == EINTR) || (errno == EAGAIN))
+			return (0);
+		ERROR ("network plugin: accept(2) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	tmp = realloc (*conns, sizeof (**conns) * (*conns_num + 1));
+	if (tmp == NULL)
+	{
+		ERROR ("network plugin: realloc failed.");
+		close (fd);
+		return (-1);
+	}
+	*conns = tmp;
+	tmp = *conns + *conns_num;
+
+	memset (tmp, 0, sizeof (*tmp));
+	tmp->fd = fd;
+	tmp->listen_fd = listen_fd;
+	/* Room for several frames, so that one recv(2) picks up a whole batch
+	 * written by the sender. */
+	tmp->buffer_size = 4 * (NET_STREAM_HEADER_SIZE + network_config_packet_size);
+	tmp->buffer = malloc (tmp->buffer_size);
+	if (tmp->buffer == NULL)
+	{
+		ERROR ("network plugin: malloc failed.");
+		close (fd);
+		return (-1);
+	}
+	tmp->buffer_fill = 0;
+
+	(*conns_num)++;
+	return (0);
+} /* }}} int network_receive_accept */
+
 static int network_receive (void) /* {{{ */
 {
 	char buffer[network_config_packet_size];
 	int  buffer_len;
 
 	size_t i;
+	int ready;
 	int status = 0;
 
 	receive_list_entry_t *private_list_head;
 	receive_list_entry_t *private_list_tail;
 	uint64_t              private_list_length;
 
+	/* Connections accepted on stream sockets. They are polled after the
+	 * listening sockets, i.e. `pollfd[listen_sockets_num + n]' belongs to
+	 * `conns[n]'. */
+	stream_conn_t *conns = NULL;
+	size_t         conns_num = 0;
+	struct pollfd *pollfd = NULL;
+	size_t         pollfd_num = 0;
+
 	assert (listen_sockets_num > 0);
 
 	private_list_head = NULL;
@@ -2458,27 +3058,72 @@ static int network_receive (void) /* {{{ */
 
 	while (listen_loop == 0)
 	{
-		status = poll (listen_sockets_pollfd, listen_sockets_num, -1);
-		if (status <= 0)
+		if (pollfd_num != (listen_sockets_num + conns_num))
+		{
+			struct pollfd *tmp;
+
+			pollfd_num = listen_sockets_num + conns_num;
+			tmp = realloc (pollfd, sizeof (*pollfd) * pollfd_num);
+			if (tmp == NULL)
+			{
+				ERROR ("network plugin: realloc failed.");
+				status = ENOMEM;
+				break;
+			}
+			pollfd = tmp;
+
+			memcpy (pollfd, listen_sockets_pollfd,
+					sizeof (*pollfd) * listen_sockets_num);
+			for (i = 0; i < conns_num; i++)
+			{
+				pollfd[listen_sockets_num + i].fd = conns[i].fd;
+				pollfd[listen_sockets_num + i].events = POLLIN;
+				pollfd[listen_sockets_num + i].revents = 0;
+			}
+		}
+
+		ready = poll (pollfd, pollfd_num, -1);
+		if (ready <= 0)
 		{
 			char errbuf[1024];
 			if (errno == EINTR)
 				continue;
 			ERROR ("network plugin: poll(2) failed: %s",
 					sstrerror (errno, errbuf, sizeof (errbuf)));
+			status = -1;
 			break;
 		}
 
-		for (i = 0; (i < listen_sockets_num) && (status > 0); i++)
+		for (i = 0; (i < pollfd_num) && (ready > 0); i++)
 		{
 			receive_list_entry_t *ent;
 
-			if ((listen_sockets_pollfd[i].revents
-						& (POLLIN | POLLPRI)) == 0)
+			if ((pollfd[i].revents
+						& (POLLIN | POLLPRI | POLLERR | POLLHUP)) == 0)
 				continue;
-			status--;
+			ready--;
 
-			buffer_len = recv (listen_sockets_pollfd[i].fd,
+			if (i >= listen_sockets_num)
+			{
+				stream_conn_t *conn = conns + (i - listen_sockets_num);
+
+				if (network_receive_stream (conn, &private_list_head,
+							&private_list_tail,
+							&private_list_length) != 0)
+				{
+					close (conn->fd);
+					conn->fd = -1;
+				}
+				continue;
+			}
+
+			if (listen_sockets_stream[i])
+			{
+				network_receive_accept (pollfd[i].fd, &conns, &conns_num);
+				continue;
+			}
+
+			buffer_len = recv (pollfd[i].fd,
 					buffer, sizeof (buffer),
 					0 /* no flags */);
 			if (buffer_len < 0)
@@ -2493,83 +3138,51 @@ static int network_receive (void) /* {{{ */
 			stats_octets_rx += ((uint64_t) buffer_len);
 			stats_packets_rx++;
 
-			/* TODO: Possible performance enhancement: Do not free
-			 * these entries in the dispatch thread but put them in
-			 * another list, so we don't have to allocate more and
-			 * more of these structures. */
-			ent = malloc (sizeof (receive_list_entry_t));
+			ent = receive_list_entry_create (pollfd[i].fd,
+					buffer, buffer_len);
 			if (ent == NULL)
 			{
-				ERROR ("network plugin: malloc failed.");
 				status = ENOMEM;
 				break;
 			}
-			memset (ent, 0, sizeof (receive_list_entry_t));
-			ent->data = malloc (network_config_packet_size);
-			if (ent->data == NULL)
-			{
-				sfree (ent);
-				ERROR ("network plugin: malloc failed.");
-				status = ENOMEM;
-				break;
-			}
-			ent->fd = listen_sockets_pollfd[i].fd;
-			ent->next = NULL;
 
-			memcpy (ent->data, buffer, buffer_len);
-			ent->data_len = buffer_len;
+			receive_list_enqueue (ent, &private_list_head,
+					&private_list_tail, &private_list_length,
+					/* force = */ 0);
+		} /* for (pollfd) */
 
-			if (private_list_head == NULL)
-				private_list_head = ent;
-			else
-				private_list_tail->next = ent;
-			private_list_tail = ent;
-			private_list_length++;
+		if (status != 0)
+			break;
 
-			/* Do not block here. Blocking here has led to
-			 * insufficient performance in the past. */
-			if (pthread_mutex_trylock (&receive_list_lock) == 0)
+		/* Remove connections which have been closed. */
+		for (i = 0; i < conns_num; )
+		{
+			if (conns[i].fd >= 0)
 			{
-				assert (((receive_list_head == NULL) && (receive_list_length == 0))
-						|| ((receive_list_head != NULL) && (receive_list_length != 0)));
-
-				if (receive_list_head == NULL)
-					receive_list_head = private_list_head;
-				else
-					receive_list_tail->next = private_list_head;
-				receive_list_tail = private_list_tail;
-				receive_list_length += private_list_length;
-
-				pthread_cond_signal (&receive_list_cond);
-				pthread_mutex_unlock (&receive_list_lock);
-
-				private_list_head = NULL;
-				private_list_tail = NULL;
-				private_list_length = 0;
+				i++;
+				continue;
 			}
 
-			status = 0;
-		} /* for (listen_sockets_pollfd) */
-
-		if (status != 0)
-			break;
+			sfree (conns[i].buffer);
+			conns[i] = conns[conns_num - 1];
+			conns_num--;
+			/* Forces the poll set to be rebuilt. */
+			pollfd_num = 0;
+		}
 	} /* while (listen_loop == 0) */
 
 	/* Make sure everything is dispatched before exiting. */
-	if (private_list_head != NULL)
-	{
-		pthread_mutex_lock (&receive_list_lock);
-
-		if (receive_list_head == NULL)
-			receive_list_head = private_list_head;
-		else
-			receive_list_tail->next = private_list_head;
-		receive_list_tail = private_list_tail;
-		receive_list_length += private_list_length;
+	receive_list_enqueue (/* ent = */ NULL, &private_list_head,
+			&private_list_tail, &private_list_length, /* force = */ 1);
 
-		pthread_cond_signal (&receive_list_cond);
-		pthread_mutex_unlock (&receive_list_lock);
+	for (i = 0; i < conns_num; i++)
+	{
+		if (conns[i].fd >= 0)
+			close (conns[i].fd);
+		sfree (conns[i].buffer);
 	}
+	sfree (conns);
+	sfree (pollfd);
 
 	return (status);
 } /* }}} int network_receive */
@@ -2589,11 +3202,140 @@ static void network_init_buffer (void)
 	memset (&send_buffer_vl, 0, sizeof (send_buffer_vl));
 } /* int network_init_buffer */
 
+/* Writes the stream buffer of a client socket to the peer. send(2) blocks
+ * for at most `SendTimeout' when the peer doesn't keep up; whatever could
+ * not be written stays in the buffer. The stream lock must be held. */
+static int sockent_stream_flush (sockent_t *se) /* {{{ */
+{
+	struct sockent_client *client = &se->data.client;
+	size_t sent = 0;
+	int status = 0;
+
+	if (client->stream_buffer_fill == 0)
+		return (0);
+
+	status = sockent_client_connect (se);
+	if (status != 0)
+		return (status);
+
+	while (sent < client->stream_buffer_fill)
+	{
+		ssize_t tmp;
+
+		tmp = send (client->fd, client->stream_buffer + sent,
+				client->stream_buffer_fill - sent, /* flags = */ 0);
+		if (tmp < 0)
+		{
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+			{
+				WARNING ("network plugin: Sending to %s timed out. "
+						"%zu bytes are waiting to be sent.", se->node,
+						client->stream_buffer_fill - sent);
+				status = EAGAIN;
+				break;
+			}
+
+			ERROR ("network plugin: send failed: %s. Closing sending socket.",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			sockent_stream_consume (client, sent);
+			sockent_client_disconnect (se);
+			return (-1);
+		}
+
+		sent += (size_t) tmp;
+	}
+
+	sockent_stream_consume (client, sent);
+	return (status);
+} /* }}} int sockent_stream_flush */
+
+/* Appends one framed packet to the stream buffer of a client socket. The
+ * buffer is written out when it cannot hold the packet. Packets are only
+ * dropped if the buffer is still full after that, i.e. if the peer is
+ * unreachable or blocked for longer than `SendTimeout'. */
+static void sockent_stream_send (sockent_t *se, /* {{{ */
+		const char *buffer, size_t buffer_size)
+{
+	static c_complain_t complaint = C_COMPLAIN_INIT_STATIC;
+
+	struct sockent_client *client = &se->data.client;
+	uint32_t frame_len;
+	size_t required = NET_STREAM_HEADER_SIZE + buffer_size;
+
+	pthread_mutex_lock (&client->stream_lock);
+
+	if (client->stream_buffer == NULL)
+	{
+		client->stream_buffer = malloc (client->stream_buffer_size);
+		if (client->stream_buffer == NULL)
+		{
+			pthread_mutex_unlock (&client->stream_lock);
+			ERROR ("network plugin: malloc failed.");
+			return;
+		}
+		client->stream_buffer_fill = 0;
+		client->stream_partial = 0;
+	}
+
+	if ((client->stream_buffer_size - client->stream_buffer_fill) < required)
+		sockent_stream_flush (se);
+
+	if ((client->stream_buffer_size - client->stream_buffer_fill) < required)
+	{
+		pthread_mutex_unlock (&client->stream_lock);
+		c_complain (LOG_ERR, &complaint,
+				"network plugin: The write buffer for %s is full. "
+				"Dropping packets until the connection recovers.",
+				se->node);
+		return;
+	}
+
+	frame_len = htonl ((uint32_t) buffer_size);
+	memcpy (client->stream_buffer + client->stream_buffer_fill,
+			&frame_len, sizeof (frame_len));
+	memcpy (client->stream_buffer + client->stream_buffer_fill
+			+ NET_STREAM_HEADER_SIZE, buffer, buffer_size);
+	client->stream_buffer_fill += required;
+
+	pthread_mutex_unlock (&client->stream_lock);
+
+	c_release (LOG_NOTICE, &complaint,
+			"network plugin: The write buffer for %s accepts data again.",
+			se->node);
+} /* }}} void sockent_stream_send */
+
+/* Writes the stream buffers of all client sockets to their peers. */
+static void network_stream_flush_all (void) /* {{{ */
+{
+	sockent_t *se;
+
+	for (se = sending_sockets; se != NULL; se = se->next)
+	{
+		if (!SOCKENT_IS_STREAM (se))
+			continue;
+
+		pthread_mutex_lock (&se->data.client.stream_lock);
+		sockent_stream_flush (se);
+		pthread_mutex_unlock (&se->data.client.stream_lock);
+	}
+} /* }}} void network_stream_flush_all */
+
 static void networt_send_buffer_plain (sockent_t *se, /* {{{ */
 		const char *buffer, size_t buffer_size)
 {
 	int status;
 
+	if (SOCKENT_IS_STREAM (se))
+	{
+		sockent_stream_send (se, buffer, buffer_size);
+		return;
+	}
+
 	while (42)
 	{
 		status = sockent_client_connect (se);
@@ -3005,6 +3747,48 @@ static int network_config_set_buffer_size (const oconfig_item_t *ci) /* {{{ */
   return (0);
 } /* }}} int network_config_set_buffer_size */
 
+static int network_config_set_protocol (const oconfig_item_t *ci, /* {{{ */
+    sockent_t *se)
+{
+  char proto[16];
+
+  if (cf_util_get_string_buffer (ci, proto, sizeof (proto)) != 0)
+    return (-1);
+
+  if (strcasecmp ("UDP", proto) == 0)
+    se->protocol = SOCKENT_PROTOCOL_UDP;
+  else if (strcasecmp ("TCP", proto) == 0)
+    se->protocol = SOCKENT_PROTOCOL_TCP;
+  else if (strcasecmp ("Unix", proto) == 0)
+    se->protocol = SOCKENT_PROTOCOL_UNIX;
+  else
+  {
+    WARNING ("network plugin: Unknown protocol: %s. "
+        "Valid protocols are \"UDP\", \"TCP\" and \"Unix\".", proto);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int network_config_set_protocol */
+
+static int network_config_set_write_buffer_size (const oconfig_item_t *ci, /* {{{ */
+    sockent_t *se)
+{
+  int tmp = 0;
+
+  if (cf_util_get_int (ci, &tmp) != 0)
+    return (-1);
+  else if ((tmp >= 1024) && (tmp <= 67108864))
+    se->data.client.stream_buffer_size = (size_t) tmp;
+  else {
+    WARNING ("network plugin: The `WriteBufferSize' must be between 1024 "
+        "and 67108864.");
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int network_config_set_write_buffer_size */
+
 #if HAVE_LIBGCRYPT
 static int network_config_set_security_level (oconfig_item_t *ci, /* {{{ */
     int *retval)
@@ -3075,6 +3859,8 @@ static int network_config_add_listen (const oconfig_item_t *ci) /* {{{ */
 #endif /* HAVE_LIBGCRYPT */
     if (strcasecmp ("Interface", child->key) == 0)
       network_config_set_interface (child, &se->interface);
+    else if (strcasecmp ("Protocol", child->key) == 0)
+      network_config_set_protocol (child, se);
     else
     {
       WARNING ("network plugin: Option `%s' is not allowed here.",
@@ -3165,6 +3951,12 @@ static int network_config_add_server (const oconfig_item_t *ci) /* {{{ */
       network_config_set_interface (child, &se->interface);
     else if (strcasecmp ("ResolveInterval", child->key) == 0)
       cf_util_get_cdtime(child, &se->data.client.resolve_interval);
+    else if (strcasecmp ("Protocol", child->key) == 0)
+      network_config_set_protocol (child, se);
+    else if (strcasecmp ("WriteBufferSize", child->key) == 0)
+      network_config_set_write_buffer_size (child, se);
+    else if (strcasecmp ("SendTimeout", child->key) == 0)
+      cf_util_get_cdtime (child, &se->data.client.stream_send_timeout);
     else
     {
       WARNING ("network plugin: Option `%s' is not allowed here.",
@@ -3348,9 +4140,13 @@ static int network_shutdown (void)
 	}
 
 	sockent_destroy (listen_sockets);
+	sfree (listen_sockets_pollfd);
+	sfree (listen_sockets_stream);
+	listen_sockets_num = 0;
 
 	if (send_buffer_fill > 0)
 		flush_buffer ();
+	network_stream_flush_all ();
 
 	sfree (send_buffer);
 
@@ -3445,6 +4241,7 @@ static int network_stats_read (void) /* {{{ */
 static int network_init (void)
 {
 	static _Bool have_init = 0;
+	sockent_t *se;
 
 	/* Check if we were already initialized. If so, just return - there's
 	 * nothing more to do (for now, that is). */
@@ -3469,6 +4266,16 @@ static int network_init (void)
 	}
 	network_init_buffer ();
 
+	/* Every stream buffer must be able to hold at least one framed packet. */
+	for (se = sending_sockets; se != NULL; se = se->next)
+	{
+		size_t min_size = NET_STREAM_HEADER_SIZE + network_config_packet_size;
+
+		if (SOCKENT_IS_STREAM (se)
+				&& (se->data.client.stream_buffer_size < min_size))
+			se->data.client.stream_buffer_size = min_size;
+	}
+
 	/* setup socket(s) and so on */
 	if (sending_sockets != NULL)
 	{
@@ -3555,6 +4362,8 @@ static int network_flush (cdtime_t timeout,
 	}
 	pthread_mutex_unlock (&send_buffer_lock);
 
+	network_stream_flush_all ();
+
 	return (0);
 } /* int network_flush */
 
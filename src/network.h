@@ -77,4 +77,8 @@
 #define TYPE_SIGN_SHA256     0x0200
 #define TYPE_ENCR_AES256     0x0210
 
+/* On stream sockets (TCP and UNIX domain sockets) every packet is preceded by
+ * its length, a 32 bit unsigned integer in network byte order. */
+#define NET_STREAM_HEADER_SIZE 4
+
 #endif /* NETWORK_H */
@@ -92,6 +92,7 @@
 #  ifndef CONFIG_HZ
 #    define CONFIG_HZ 100
 #  endif
+#  include "utils_proc_events.h"
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && (HAVE_STRUCT_KINFO_PROC_FREEBSD || HAVE_STRUCT_KINFO_PROC_OPENBSD)
@@ -235,6 +236,21 @@ static mach_msg_type_number_t     pset_list_len;
 
 #elif KERNEL_LINUX
 static long pagesize_g;
+
+/* With process events, /proc is only scanned completely every
+ * "FullScanInterval" reads. In between, only the matched processes and the
+ * ones which were started or exec'ed since the last read are looked at. */
+#define PS_PENDING_MAX 4096
+static _Bool conf_process_events = 0;
+static int conf_full_scan_interval = 10;
+static procev_subscriber_t *procev_g = NULL;
+static int reads_until_scan_g = 0;
+static pid_t *pending_g = NULL;
+static size_t pending_num_g = 0;
+static size_t pending_size_g = 0;
+
+/* process states counted by the last full scan */
+static int running_g, sleeping_g, zombies_g, stopped_g, paging_g, blocked_g;
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && (HAVE_STRUCT_KINFO_PROC_FREEBSD || HAVE_STRUCT_KINFO_PROC_OPENBSD)
@@ -611,6 +627,18 @@ static int ps_config (oconfig_item_t *ci)
 		{
 			cf_util_get_boolean (c, &report_ctx_switch);
 		}
+#if KERNEL_LINUX
+		else if (strcasecmp (c->key, "ProcessEvents") == 0)
+		{
+			cf_util_get_boolean (c, &conf_process_events);
+		}
+		else if (strcasecmp (c->key, "FullScanInterval") == 0)
+		{
+			cf_util_get_int (c, &conf_full_scan_interval);
+			if (conf_full_scan_interval < 1)
+				conf_full_scan_interval = 1;
+		}
+#endif
 		else
 		{
 			ERROR ("processes plugin: The `%s' configuration option is not "
@@ -655,6 +683,15 @@ static int ps_init (void)
 	pagesize_g = sysconf(_SC_PAGESIZE);
 	DEBUG ("pagesize_g = %li; CONFIG_HZ = %i;",
 			pagesize_g, CONFIG_HZ);
+
+	if (conf_process_events && (procev_g == NULL))
+	{
+		procev_g = procev_subscribe ();
+		if (procev_g == NULL)
+			NOTICE ("processes plugin: Process events are not available, "
+					"scanning /proc on every read.");
+		reads_until_scan_g = 0;
+	}
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && (HAVE_STRUCT_KINFO_PROC_FREEBSD || HAVE_STRUCT_KINFO_PROC_OPENBSD)
@@ -1322,6 +1359,214 @@ static int read_fork_rate ()
 	ps_submit_fork_rate (value.derive);
 	return (0);
 }
+
+/* Reads one process and adds it to the matching entries of list_head_g. */
+static int ps_read_pid (int pid, char *state)
+{
+	char       cmdline[CMDLINE_BUFFER_SIZE];
+	procstat_t ps;
+	procstat_entry_t pse;
+	int        status;
+
+	status = ps_read_process (pid, &ps, state);
+	if (status != 0)
+	{
+		DEBUG ("ps_read_process failed: %i", status);
+		return (status);
+	}
+
+	memset (&pse, 0, sizeof (pse));
+	pse.id       = pid;
+	pse.age      = 0;
+
+	pse.num_proc   = ps.num_proc;
+	pse.num_lwp    = ps.num_lwp;
+	pse.vmem_size  = ps.vmem_size;
+	pse.vmem_rss   = ps.vmem_rss;
+	pse.vmem_data  = ps.vmem_data;
+	pse.vmem_code  = ps.vmem_code;
+	pse.stack_size = ps.stack_size;
+
+	pse.vmem_minflt = 0;
+	pse.vmem_minflt_counter = ps.vmem_minflt_counter;
+	pse.vmem_majflt = 0;
+	pse.vmem_majflt_counter = ps.vmem_majflt_counter;
+
+	pse.cpu_user = 0;
+	pse.cpu_user_counter = ps.cpu_user_counter;
+	pse.cpu_system = 0;
+	pse.cpu_system_counter = ps.cpu_system_counter;
+
+	pse.io_rchar = ps.io_rchar;
+	pse.io_wchar = ps.io_wchar;
+	pse.io_syscr = ps.io_syscr;
+	pse.io_syscw = ps.io_syscw;
+
+	pse.cswitch_vol = ps.cswitch_vol;
+	pse.cswitch_invol = ps.cswitch_invol;
+
+	ps_list_add (ps.name,
+			ps_get_cmdline (pid, ps.name, cmdline, sizeof (cmdline)),
+			&pse);
+
+	return (0);
+} /* int ps_read_pid */
+
+static int ps_pid_compare (const void *a, const void *b)
+{
+	pid_t pa = *(const pid_t *) a;
+	pid_t pb = *(const pid_t *) b;
+
+	return ((pa > pb) - (pa < pb));
+} /* int ps_pid_compare */
+
+static void ps_pending_add (pid_t pid)
+{
+	if (pending_num_g >= pending_size_g)
+	{
+		pid_t *tmp;
+		size_t size = (pending_size_g == 0) ? 64 : 2 * pending_size_g;
+
+		/* Too much is going on, a full scan is cheaper. */
+		if (size > PS_PENDING_MAX)
+		{
+			reads_until_scan_g = 0;
+			return;
+		}
+
+		tmp = realloc (pending_g, size * sizeof (*tmp));
+		if (tmp == NULL)
+		{
+			reads_until_scan_g = 0;
+			return;
+		}
+		pending_g = tmp;
+		pending_size_g = size;
+	}
+
+	pending_g[pending_num_g] = pid;
+	pending_num_g++;
+} /* void ps_pending_add */
+
+static _Bool ps_pid_matched (pid_t pid)
+{
+	procstat_t *ps;
+	procstat_entry_t *pse;
+
+	for (ps = list_head_g; ps != NULL; ps = ps->next)
+		for (pse = ps->instances; pse != NULL; pse = pse->next)
+			if (pse->id == (unsigned long) pid)
+				return (1);
+
+	return (0);
+} /* _Bool ps_pid_matched */
+
+/* Adds the increase of a counter up to its final value to "sum". */
+static void ps_account_exit (derive_t last, uint64_t value, derive_t *sum)
+{
+	if ((derive_t) value > last)
+		*sum += (derive_t) value - last;
+} /* void ps_account_exit */
+
+/* Removes an exited process from all entries, adding what it did since the
+ * last read. Processes which were started and exited in between are only
+ * accounted to entries matching the process name. */
+static void ps_process_exit (const procev_event_t *ev)
+{
+	procstat_t *ps;
+	procstat_entry_t *pse;
+	procstat_entry_t **prev;
+
+	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	{
+		for (prev = &ps->instances; *prev != NULL; prev = &(*prev)->next)
+			if ((*prev)->id == (unsigned long) ev->pid)
+				break;
+
+		pse = *prev;
+		if (pse == NULL)
+		{
+			_Bool matched = 0;
+
+			if (!ev->have_acct)
+				continue;
+#if HAVE_REGEX_H
+			if (ps->re == NULL)
+#endif
+				matched = (strcmp (ps->name, ev->acct.comm) == 0);
+			if (!matched)
+				continue;
+
+			ps->cpu_user_counter   += (derive_t) ev->acct.cpu_user;
+			ps->cpu_system_counter += (derive_t) ev->acct.cpu_system;
+			ps->vmem_minflt_counter += (derive_t) ev->acct.minflt;
+			ps->vmem_majflt_counter += (derive_t) ev->acct.majflt;
+			continue;
+		}
+
+		if (ev->have_acct)
+		{
+			ps_account_exit (pse->cpu_user_counter, ev->acct.cpu_user,
+					&ps->cpu_user_counter);
+			ps_account_exit (pse->cpu_system_counter, ev->acct.cpu_system,
+					&ps->cpu_system_counter);
+			ps_account_exit (pse->vmem_minflt_counter, ev->acct.minflt,
+					&ps->vmem_minflt_counter);
+			ps_account_exit (pse->vmem_majflt_counter, ev->acct.majflt,
+					&ps->vmem_majflt_counter);
+		}
+
+		/* The PID may be reused, don't mix it up with the next process. */
+		*prev = pse->next;
+		free (pse);
+	}
+} /* void ps_process_exit */
+
+static void ps_process_event (const procev_event_t *ev,
+		void __attribute__((unused)) *user_data)
+{
+	switch (ev->type)
+	{
+		case PROCEV_FORK:
+			/* A child has the name and command line of its parent until it
+			 * calls exec. */
+			if (ps_pid_matched (ev->ppid))
+				ps_pending_add (ev->pid);
+			break;
+		case PROCEV_EXEC:
+			ps_pending_add (ev->pid);
+			break;
+		case PROCEV_EXIT:
+			ps_process_exit (ev);
+			break;
+	}
+} /* void ps_process_event */
+
+/* Reads the processes already matched and the pending ones only. */
+static void ps_read_matched (void)
+{
+	procstat_t *ps;
+	procstat_entry_t *pse;
+	char state;
+	size_t i;
+
+	for (ps = list_head_g; ps != NULL; ps = ps->next)
+		for (pse = ps->instances; pse != NULL; pse = pse->next)
+			ps_pending_add ((pid_t) pse->id);
+
+	/* ps_pending_add gives up if there are too many processes */
+	if (reads_until_scan_g == 0)
+		return;
+
+	/* A process may match several entries and show up in several events. */
+	qsort (pending_g, pending_num_g, sizeof (*pending_g), ps_pid_compare);
+	for (i = 0; i < pending_num_g; i++)
+	{
+		if ((i > 0) && (pending_g[i] == pending_g[i - 1]))
+			continue;
+		ps_read_pid ((int) pending_g[i], &state);
+	}
+} /* void ps_read_matched */
 #endif /*KERNEL_LINUX */
 
 #if KERNEL_SOLARIS
@@ -1816,87 +2061,77 @@ static int ps_read (void)
 	DIR           *proc;
 	int            pid;
 
-	char cmdline[CMDLINE_BUFFER_SIZE];
-
-	int        status;
-	procstat_t ps;
-	procstat_entry_t pse;
 	char       state;
 
 	procstat_t *ps_ptr;
 
+	/* Exits have to be accounted before the entries age in ps_list_reset. */
+	if (procev_g != NULL)
+	{
+		if (procev_poll (procev_g, ps_process_event, NULL) < 0)
+			reads_until_scan_g = 0;
+	}
+
 	running = sleeping = zombies = stopped = paging = blocked = 0;
 	ps_list_reset ();
 
-	if ((proc = opendir ("/proc")) == NULL)
+	if ((procev_g != NULL) && (reads_until_scan_g > 0))
+		ps_read_matched ();
+
+	if ((procev_g != NULL) && (reads_until_scan_g > 0))
 	{
-		char errbuf[1024];
-		ERROR ("Cannot open `/proc': %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		return (-1);
+		/* Between full scans the states of the last one are reported. */
+		reads_until_scan_g--;
+		running  = running_g;
+		sleeping = sleeping_g;
+		zombies  = zombies_g;
+		stopped  = stopped_g;
+		paging   = paging_g;
+		blocked  = blocked_g;
 	}
-
-	while ((ent = readdir (proc)) != NULL)
+	else
 	{
-		if (!isdigit (ent->d_name[0]))
-			continue;
-
-		if ((pid = atoi (ent->d_name)) < 1)
-			continue;
-
-		status = ps_read_process (pid, &ps, &state);
-		if (status != 0)
+		if ((proc = opendir ("/proc")) == NULL)
 		{
-			DEBUG ("ps_read_process failed: %i", status);
-			continue;
+			char errbuf[1024];
+			ERROR ("Cannot open `/proc': %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
 		}
 
-		memset (&pse, 0, sizeof (pse));
-		pse.id       = pid;
-		pse.age      = 0;
-
-		pse.num_proc   = ps.num_proc;
-		pse.num_lwp    = ps.num_lwp;
-		pse.vmem_size  = ps.vmem_size;
-		pse.vmem_rss   = ps.vmem_rss;
-		pse.vmem_data  = ps.vmem_data;
-		pse.vmem_code  = ps.vmem_code;
-		pse.stack_size = ps.stack_size;
-
-		pse.vmem_minflt = 0;
-		pse.vmem_minflt_counter = ps.vmem_minflt_counter;
-		pse.vmem_majflt = 0;
-		pse.vmem_majflt_counter = ps.vmem_majflt_counter;
-
-		pse.cpu_user = 0;
-		pse.cpu_user_counter = ps.cpu_user_counter;
-		pse.cpu_system = 0;
-		pse.cpu_system_counter = ps.cpu_system_counter;
+		while ((ent = readdir (proc)) != NULL)
+		{
+			if (!isdigit (ent->d_name[0]))
+				continue;
 
-		pse.io_rchar = ps.io_rchar;
-		pse.io_wchar = ps.io_wchar;
-		pse.io_syscr = ps.io_syscr;
-		pse.io_syscw = ps.io_syscw;
+			if ((pid = atoi (ent->d_name)) < 1)
+				continue;
 
-		pse.cswitch_vol = ps.cswitch_vol;
-		pse.cswitch_invol = ps.cswitch_invol;
+			if (ps_read_pid (pid, &state) != 0)
+				continue;
 
-		switch (state)
-		{
-			case 'R': running++;  break;
-			case 'S': sleeping++; break;
-			case 'D': blocked++;  break;
-			case 'Z': zombies++;  break;
-			case 'T': stopped++;  break;
-			case 'W': paging++;   break;
+			switch (state)
+			{
+				case 'R': running++;  break;
+				case 'S': sleeping++; break;
+				case 'D': blocked++;  break;
+				case 'Z': zombies++;  break;
+				case 'T': stopped++;  break;
+				case 'W': paging++;   break;
+			}
 		}
 
-		ps_list_add (ps.name,
-				ps_get_cmdline (pid, ps.name, cmdline, sizeof (cmdline)),
-				&pse);
-	}
+		closedir (proc);
 
-	closedir (proc);
+		running_g  = running;
+		sleeping_g = sleeping;
+		zombies_g  = zombies;
+		stopped_g  = stopped;
+		paging_g   = paging;
+		blocked_g  = blocked;
+		reads_until_scan_g = conf_full_scan_interval - 1;
+	}
+	pending_num_g = 0;
 
 	ps_submit_state ("running",  running);
 	ps_submit_state ("sleeping", sleeping);
@@ -2444,9 +2679,23 @@ static int ps_read (void)
 	return (0);
 } /* int ps_read */
 
+static int ps_shutdown (void)
+{
+#if KERNEL_LINUX
+	procev_unsubscribe (procev_g);
+	procev_g = NULL;
+	sfree (pending_g);
+	pending_num_g = 0;
+	pending_size_g = 0;
+#endif
+
+	return (0);
+} /* int ps_shutdown */
+
 void module_register (void)
 {
 	plugin_register_complex_config ("processes", ps_config);
 	plugin_register_init ("processes", ps_init);
 	plugin_register_read ("processes", ps_read);
+	plugin_register_shutdown ("processes", ps_shutdown);
 } /* void module_register */
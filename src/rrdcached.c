@@ -27,12 +27,43 @@
 #include "collectd.h"
 #include "plugin.h"
 #include "common.h"
+#include "utils_avltree.h"
+#include "utils_complain.h"
+#include "utils_rrdcached.h"
 #include "utils_rrdcreate.h"
 
+#include <pthread.h>
+
 #undef HAVE_CONFIG_H
 #include <rrd.h>
 #include <rrd_client.h>
 
+/* Timeout for the responses of the daemon, in milliseconds. */
+#define RC_RESPONSE_TIMEOUT 10000
+
+/*
+ * Private types
+ */
+/* A file which is known to exist or which is being created. While the file is
+ * created, its updates are held in "held". */
+struct rc_file_s
+{
+  _Bool  creating;
+  char  *held;
+  size_t held_len;
+  size_t held_size;
+};
+typedef struct rc_file_s rc_file_t;
+
+struct rc_create_job_s
+{
+  char *filename;
+  const data_set_t *ds;
+  value_list_t vl;
+  struct rc_create_job_s *next;
+};
+typedef struct rc_create_job_s rc_create_job_t;
+
 /*
  * Private variables
  */
@@ -56,6 +87,41 @@ static rrdcreate_config_t rrdcreate_config =
 	/* async = */ 0
 };
 
+static int batch_size = 512;
+static cdtime_t batch_timeout = 0;
+static int pipeline_depth = 8;
+
+/* Update lines, "UPDATE <file> <values>\n", waiting to be sent. Batches are
+ * numbered so that rc_flush() can wait for the updates queued before it. */
+static char    *pending = NULL;
+static size_t   pending_len = 0;
+static size_t   pending_size = 0;
+static int      pending_num = 0;
+static cdtime_t pending_first = 0;
+static _Bool    send_now = 0;
+static uint64_t batches_queued = 0;
+static uint64_t batches_done = 0;
+static _Bool    send_shutdown = 0;
+static pthread_t       send_thread;
+static _Bool           send_thread_running = 0;
+static pthread_mutex_t send_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  send_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  done_cond = PTHREAD_COND_INITIALIZER;
+static c_complain_t    send_complaint = C_COMPLAIN_INIT_STATIC;
+
+/* XXX: If you need to lock both, files_lock and send_lock, at the same time,
+ * ALWAYS lock `files_lock' first! */
+static c_avl_tree_t   *files = NULL;
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static rc_create_job_t *create_head = NULL;
+static rc_create_job_t *create_tail = NULL;
+static _Bool            create_shutdown = 0;
+static pthread_t        create_thread;
+static _Bool            create_thread_running = 0;
+static pthread_mutex_t  create_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   create_cond = PTHREAD_COND_INITIALIZER;
+
 /*
  * Prototypes.
  */
@@ -271,6 +337,20 @@ static int rc_config (oconfig_item_t *ci)
     }
     else if (strcasecmp ("XFF", key) == 0)
       status = rc_config_get_xff (child, &rrdcreate_config.xff);
+    else if (strcasecmp ("BatchSize", key) == 0)
+    {
+      status = rc_config_get_int_positive (child, &batch_size);
+      if ((status == 0) && (batch_size == 0))
+        batch_size = 1;
+    }
+    else if (strcasecmp ("BatchTimeout", key) == 0)
+      status = cf_util_get_cdtime (child, &batch_timeout);
+    else if (strcasecmp ("PipelineDepth", key) == 0)
+    {
+      status = rc_config_get_int_positive (child, &pipeline_depth);
+      if ((status == 0) && (pipeline_depth == 0))
+        pipeline_depth = 1;
+    }
     else
     {
       WARNING ("rrdcached plugin: Ignoring invalid option %s.", key);
@@ -399,11 +479,356 @@ static int rc_read (void)
   return (0);
 } /* int rc_read */
 
+/* Appends "data" to a buffer which grows as needed. */
+static int rc_buffer_append (char **buffer, size_t *len, /* {{{ */
+    size_t *size, const char *data, size_t data_len)
+{
+  if ((*len + data_len) > *size)
+  {
+    size_t new_size = (*size == 0) ? 4096 : 2 * *size;
+    char *tmp;
+
+    while (new_size < (*len + data_len))
+      new_size *= 2;
+
+    tmp = realloc (*buffer, new_size);
+    if (tmp == NULL)
+      return (ENOMEM);
+    *buffer = tmp;
+    *size = new_size;
+  }
+
+  memcpy (*buffer + *len, data, data_len);
+  *len += data_len;
+  return (0);
+} /* }}} int rc_buffer_append */
+
+/* Hands update lines to the send thread. */
+static int rc_queue_lines (const char *lines, size_t lines_len, /* {{{ */
+    int lines_num)
+{
+  int status;
+
+  pthread_mutex_lock (&send_lock);
+  status = rc_buffer_append (&pending, &pending_len, &pending_size,
+      lines, lines_len);
+  if (status != 0)
+  {
+    pthread_mutex_unlock (&send_lock);
+    ERROR ("rrdcached plugin: realloc failed.");
+    return (status);
+  }
+
+  if (pending_num == 0)
+    pending_first = cdtime ();
+  pending_num += lines_num;
+  if (pending_num >= batch_size)
+    pthread_cond_signal (&send_cond);
+  pthread_mutex_unlock (&send_lock);
+
+  return (0);
+} /* }}} int rc_queue_lines */
+
+/* Marks all batches up to "seq" as done and wakes up rc_flush(). */
+static void rc_batches_done (uint64_t seq) /* {{{ */
+{
+  pthread_mutex_lock (&send_lock);
+  if (batches_done < seq)
+    batches_done = seq;
+  pthread_cond_broadcast (&done_cond);
+  pthread_mutex_unlock (&send_lock);
+} /* }}} void rc_batches_done */
+
+/* XXX: You must hold "send_lock" when calling this function! */
+static _Bool rc_batch_ready (void) /* {{{ */
+{
+  if (pending_num == 0)
+    return (0);
+
+  return (send_now || send_shutdown || (pending_num >= batch_size)
+      || (cdtime () >= (pending_first + batch_timeout)));
+} /* }}} _Bool rc_batch_ready */
+
+static void rc_error_cb (int command, const char *message, /* {{{ */
+    void __attribute__((unused)) *user_data)
+{
+  ERROR ("rrdcached plugin: Update %i of a batch failed: %s",
+      command, message);
+} /* }}} void rc_error_cb */
+
+/* Sends the queued updates using the BATCH command. While there are more
+ * updates to send, up to "PipelineDepth" batches are kept in flight before
+ * waiting for the daemon's responses. */
+static void *rc_send_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+  rrdcached_conn_t *conn = NULL;
+  char *lines = NULL;
+  size_t lines_size = 0;
+
+  while (42)
+  {
+    size_t lines_len;
+    uint64_t seq;
+    _Bool more;
+    int status;
+
+    pthread_mutex_lock (&send_lock);
+    while (!rc_batch_ready () && !send_shutdown)
+    {
+      if (pending_num == 0)
+        pthread_cond_wait (&send_cond, &send_lock);
+      else
+      {
+        struct timespec ts;
+
+        CDTIME_T_TO_TIMESPEC (pending_first + batch_timeout, &ts);
+        pthread_cond_timedwait (&send_cond, &send_lock, &ts);
+      }
+    }
+
+    /* We're in the shutdown phase and everything has been sent. */
+    if (pending_num == 0)
+    {
+      pthread_mutex_unlock (&send_lock);
+      break;
+    }
+
+    /* Swap the buffers so new updates can be queued while we're sending. */
+    {
+      char *tmp = lines;
+      size_t tmp_size = lines_size;
+
+      lines = pending;
+      lines_size = pending_size;
+      lines_len = pending_len;
+      pending = tmp;
+      pending_size = tmp_size;
+      pending_len = 0;
+      pending_num = 0;
+    }
+    send_now = 0;
+    seq = ++batches_queued;
+    pthread_mutex_unlock (&send_lock);
+
+    if (conn == NULL)
+    {
+      conn = rrdcached_connect (daemon_address);
+      if (conn == NULL)
+      {
+        char errbuf[1024];
+        c_complain (LOG_ERR, &send_complaint,
+            "rrdcached plugin: Connecting to %s failed: %s",
+            daemon_address, sstrerror (errno, errbuf, sizeof (errbuf)));
+        rc_batches_done (seq);
+        continue;
+      }
+      c_release (LOG_INFO, &send_complaint,
+          "rrdcached plugin: Successfully connected to %s.", daemon_address);
+    }
+
+    status = rrdcached_batch_send (conn, lines, lines_len);
+    if (status == 0)
+    {
+      pthread_mutex_lock (&send_lock);
+      more = rc_batch_ready ();
+      pthread_mutex_unlock (&send_lock);
+
+      status = rrdcached_batch_receive (conn,
+          more ? (size_t) (pipeline_depth - 1) : 0,
+          RC_RESPONSE_TIMEOUT, rc_error_cb, /* user_data = */ NULL);
+    }
+
+    if (status != 0)
+    {
+      char errbuf[1024];
+      ERROR ("rrdcached plugin: Sending updates to %s failed: %s",
+          daemon_address, sstrerror (status, errbuf, sizeof (errbuf)));
+      rrdcached_close (conn);
+      conn = NULL;
+      rc_batches_done (seq);
+      continue;
+    }
+
+    rc_batches_done (seq - rrdcached_batches_pending (conn));
+  } /* while (42) */
+
+  if (conn != NULL)
+  {
+    rrdcached_batch_receive (conn, 0, RC_RESPONSE_TIMEOUT, rc_error_cb,
+        /* user_data = */ NULL);
+    rrdcached_close (conn);
+  }
+  rc_batches_done (batches_queued);
+
+  sfree (lines);
+  return ((void *) 0);
+} /* }}} void *rc_send_thread */
+
+static int rc_create_enqueue (const char *filename, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl)
+{
+  rc_create_job_t *job;
+
+  job = calloc (1, sizeof (*job));
+  if (job == NULL)
+    return (ENOMEM);
+
+  job->filename = strdup (filename);
+  if (job->filename == NULL)
+  {
+    sfree (job);
+    return (ENOMEM);
+  }
+  job->ds = ds;
+  memcpy (&job->vl, vl, sizeof (job->vl));
+  job->vl.values = NULL;
+  job->vl.values_len = 0;
+  job->vl.meta = NULL;
+
+  pthread_mutex_lock (&create_lock);
+  if (create_tail == NULL)
+    create_head = job;
+  else
+    create_tail->next = job;
+  create_tail = job;
+  pthread_cond_signal (&create_cond);
+  pthread_mutex_unlock (&create_lock);
+
+  return (0);
+} /* }}} int rc_create_enqueue */
+
+/* Sends the updates held while the file was created or, if creating the file
+ * failed, forgets about the file so the next update tries again. */
+static void rc_file_created (const char *filename, _Bool success) /* {{{ */
+{
+  rc_file_t *f = NULL;
+
+  pthread_mutex_lock (&files_lock);
+  if (c_avl_get (files, filename, (void *) &f) != 0)
+  {
+    pthread_mutex_unlock (&files_lock);
+    return;
+  }
+
+  if (success)
+  {
+    f->creating = 0;
+    if (f->held_len > 0)
+    {
+      const char *ptr;
+      int lines_num = 0;
+
+      for (ptr = f->held; ptr < f->held + f->held_len; ptr++)
+        if (*ptr == '\n')
+          lines_num++;
+      rc_queue_lines (f->held, f->held_len, lines_num);
+    }
+    sfree (f->held);
+    f->held_len = 0;
+    f->held_size = 0;
+  }
+  else
+  {
+    char *key = NULL;
+
+    c_avl_remove (files, filename, (void *) &key, NULL);
+    sfree (key);
+    sfree (f->held);
+    sfree (f);
+  }
+  pthread_mutex_unlock (&files_lock);
+} /* }}} void rc_file_created */
+
+static void *rc_create_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+  rrdcreate_config_t cfg = rrdcreate_config;
+
+  /* Files are created in this thread, so create them synchronously. */
+  cfg.async = 0;
+
+  while (42)
+  {
+    rc_create_job_t *job;
+    struct stat statbuf;
+    int status;
+
+    pthread_mutex_lock (&create_lock);
+    while ((create_head == NULL) && !create_shutdown)
+      pthread_cond_wait (&create_cond, &create_lock);
+
+    if (create_shutdown)
+    {
+      pthread_mutex_unlock (&create_lock);
+      break;
+    }
+
+    job = create_head;
+    create_head = job->next;
+    if (create_head == NULL)
+      create_tail = NULL;
+    pthread_mutex_unlock (&create_lock);
+
+    /* Somebody else may have created the file in the meantime. */
+    if (stat (job->filename, &statbuf) == 0)
+      status = 0;
+    else
+    {
+      status = cu_rrd_create_file (job->filename, job->ds, &job->vl, &cfg);
+      if (status != 0)
+        ERROR ("rrdcached plugin: cu_rrd_create_file (%s) failed.",
+            job->filename);
+    }
+
+    rc_file_created (job->filename, (status == 0));
+
+    sfree (job->filename);
+    sfree (job);
+  } /* while (42) */
+
+  return ((void *) 0);
+} /* }}} void *rc_create_thread */
+
 static int rc_init (void)
 {
+  int status;
+
   if (config_collect_stats)
     plugin_register_read ("rrdcached", rc_read);
 
+  if (daemon_address == NULL)
+    return (0);
+
+  if (batch_timeout == 0)
+    batch_timeout = TIME_T_TO_CDTIME_T (1);
+
+  files = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+  if (files == NULL)
+  {
+    ERROR ("rrdcached plugin: c_avl_create failed.");
+    return (-1);
+  }
+
+  status = plugin_thread_create (&send_thread, /* attr = */ NULL,
+      rc_send_thread, /* arg = */ NULL);
+  if (status != 0)
+  {
+    ERROR ("rrdcached plugin: Cannot create send thread.");
+    return (-1);
+  }
+  send_thread_running = 1;
+
+  if (config_create_files)
+  {
+    status = plugin_thread_create (&create_thread, /* attr = */ NULL,
+        rc_create_thread, /* arg = */ NULL);
+    if (status != 0)
+    {
+      ERROR ("rrdcached plugin: Cannot create file creation thread.");
+      return (-1);
+    }
+    create_thread_running = 1;
+  }
+
   return (0);
 } /* int rc_init */
 
@@ -412,7 +837,12 @@ static int rc_write (const data_set_t *ds, const value_list_t *vl,
 {
   char filename[PATH_MAX];
   char values[512];
-  char *values_array[2];
+  char line[PATH_MAX + 1024];
+  rc_file_t *f = NULL;
+  struct stat statbuf;
+  _Bool new_file = 0;
+  _Bool creating;
+  int line_len;
   int status;
 
   if (daemon_address == NULL)
@@ -440,50 +870,85 @@ static int rc_write (const data_set_t *ds, const value_list_t *vl,
     return (-1);
   }
 
-  values_array[0] = values;
-  values_array[1] = NULL;
-
-  if (config_create_files)
+  line_len = rrdcached_format_update (line, sizeof (line), filename, values);
+  if (line_len < 0)
   {
-    struct stat statbuf;
+    ERROR ("rrdcached plugin: rrdcached_format_update failed.");
+    return (-1);
+  }
+
+  if (!config_create_files)
+    return (rc_queue_lines (line, (size_t) line_len, 1));
+
+  /* Files are only stat'ed the first time they are seen. */
+  pthread_mutex_lock (&files_lock);
+  status = c_avl_get (files, filename, (void *) &f);
+  creating = (status == 0) && f->creating;
+  pthread_mutex_unlock (&files_lock);
+  if ((status == 0) && !creating)
+    return (rc_queue_lines (line, (size_t) line_len, 1));
 
+  if (status != 0)
+  {
     status = stat (filename, &statbuf);
-    if (status != 0)
+    if ((status != 0) && (errno != ENOENT))
     {
-      if (errno != ENOENT)
-      {
-        char errbuf[1024];
-        ERROR ("rrdcached plugin: stat (%s) failed: %s",
-            filename, sstrerror (errno, errbuf, sizeof (errbuf)));
-        return (-1);
-      }
+      char errbuf[1024];
+      ERROR ("rrdcached plugin: stat (%s) failed: %s",
+          filename, sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+  }
 
-      status = cu_rrd_create_file (filename, ds, vl, &rrdcreate_config);
-      if (status != 0)
-      {
-        ERROR ("rrdcached plugin: cu_rrd_create_file (%s) failed.",
-            filename);
-        return (-1);
-      }
-      else if (rrdcreate_config.async)
-        return (0);
+  pthread_mutex_lock (&files_lock);
+  if (c_avl_get (files, filename, (void *) &f) != 0)
+  {
+    char *key;
+
+    f = calloc (1, sizeof (*f));
+    key = strdup (filename);
+    if ((f == NULL) || (key == NULL)
+        || (c_avl_insert (files, key, f) != 0))
+    {
+      pthread_mutex_unlock (&files_lock);
+      ERROR ("rrdcached plugin: Adding \"%s\" to the file cache failed.",
+          filename);
+      sfree (f);
+      sfree (key);
+      return (-1);
     }
+    f->creating = (status != 0);
+    new_file = 1;
   }
 
-  status = rrdc_connect (daemon_address);
-  if (status != 0)
+  if (!f->creating)
   {
-    ERROR ("rrdcached plugin: rrdc_connect (%s) failed with status %i.",
-        daemon_address, status);
-    return (-1);
+    pthread_mutex_unlock (&files_lock);
+    return (rc_queue_lines (line, (size_t) line_len, 1));
   }
 
-  status = rrdc_update (filename, /* values_num = */ 1, (void *) values_array);
+  /* The file is being created: hold the update until it exists, unless
+   * "CreateFilesAsync" is set, which drops updates in the meantime. */
+  status = 0;
+  if (!rrdcreate_config.async)
+    status = rc_buffer_append (&f->held, &f->held_len, &f->held_size,
+        line, (size_t) line_len);
+  if (new_file && (rc_create_enqueue (filename, ds, vl) != 0))
+  {
+    char *key = NULL;
+
+    c_avl_remove (files, filename, (void *) &key, NULL);
+    sfree (key);
+    sfree (f->held);
+    sfree (f);
+    status = ENOMEM;
+  }
+  pthread_mutex_unlock (&files_lock);
+
   if (status != 0)
   {
-    ERROR ("rrdcached plugin: rrdc_update (%s, [%s], 1) failed with "
-        "status %i.",
-        filename, values_array[0], status);
+    ERROR ("rrdcached plugin: Queuing \"%s\" for creation failed.",
+        filename);
     return (-1);
   }
 
@@ -495,6 +960,8 @@ static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
     __attribute__((unused)) user_data_t *ud)
 {
   char filename[PATH_MAX + 1];
+  uint64_t target;
+  struct timespec ts;
   int status;
 
   if (identifier == NULL)
@@ -505,6 +972,20 @@ static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
   else
     ssnprintf (filename, sizeof (filename), "%s.rrd", identifier);
 
+  /* Make sure the updates queued so far have reached the daemon. */
+  CDTIME_T_TO_TIMESPEC (cdtime () + MS_TO_CDTIME_T (RC_RESPONSE_TIMEOUT), &ts);
+  pthread_mutex_lock (&send_lock);
+  target = batches_queued + ((pending_num > 0) ? 1 : 0);
+  if (pending_num > 0)
+  {
+    send_now = 1;
+    pthread_cond_signal (&send_cond);
+  }
+  while (send_thread_running && (batches_done < target))
+    if (pthread_cond_timedwait (&done_cond, &send_lock, &ts) == ETIMEDOUT)
+      break;
+  pthread_mutex_unlock (&send_lock);
+
   status = rrdc_connect (daemon_address);
   if (status != 0)
   {
@@ -527,6 +1008,56 @@ static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
 
 static int rc_shutdown (void)
 {
+  if (create_thread_running)
+  {
+    pthread_mutex_lock (&create_lock);
+    create_shutdown = 1;
+    pthread_cond_broadcast (&create_cond);
+    pthread_mutex_unlock (&create_lock);
+
+    pthread_join (create_thread, NULL);
+    create_thread_running = 0;
+  }
+
+  while (create_head != NULL)
+  {
+    rc_create_job_t *job = create_head;
+    create_head = job->next;
+    sfree (job->filename);
+    sfree (job);
+  }
+  create_tail = NULL;
+
+  /* Sends the remaining updates before exiting. */
+  if (send_thread_running)
+  {
+    pthread_mutex_lock (&send_lock);
+    send_shutdown = 1;
+    pthread_cond_broadcast (&send_cond);
+    pthread_mutex_unlock (&send_lock);
+
+    pthread_join (send_thread, NULL);
+    send_thread_running = 0;
+  }
+  sfree (pending);
+  pending_len = pending_size = 0;
+  pending_num = 0;
+
+  if (files != NULL)
+  {
+    char *key;
+    rc_file_t *f;
+
+    while (c_avl_pick (files, (void *) &key, (void *) &f) == 0)
+    {
+      sfree (key);
+      sfree (f->held);
+      sfree (f);
+    }
+    c_avl_destroy (files);
+    files = NULL;
+  }
+
   rrdc_disconnect ();
   return (0);
 } /* int rc_shutdown */
@@ -29,6 +29,7 @@
 #include "utils_avltree.h"
 #include "utils_random.h"
 #include "utils_rrdcreate.h"
+#include "utils_stats.h"
 
 #include <rrd.h>
 
@@ -41,11 +42,24 @@
  */
 struct rrd_cache_s
 {
-	int      values_num;
-	char   **values;
+	/* Values are kept in binary form and only formatted as strings by the
+	 * queue threads, outside of "cache_lock". "values" holds
+	 * "values_num * ds->ds_num" entries, "times" one per update. */
+	const data_set_t *ds;
+	size_t    values_num;
+	size_t    values_size;
+	cdtime_t *times;
+	value_t  *values;
 	cdtime_t first_value;
 	cdtime_t last_value;
 	int64_t  random_variation;
+	/* Location of the file on disk, used to sort batches of updates. */
+	dev_t    dev;
+	ino_t    ino;
+	/* A queue thread is currently writing to this file. Queue entries for
+	 * busy files are deferred until the write has finished. */
+	_Bool    busy;
+	_Bool    deferred;
 	enum
 	{
 		FLAG_NONE   = 0x00,
@@ -65,10 +79,24 @@ typedef enum rrd_queue_dir_e rrd_queue_dir_t;
 struct rrd_queue_s
 {
 	char *filename;
+	cdtime_t enqueued;
 	struct rrd_queue_s *next;
 };
 typedef struct rrd_queue_s rrd_queue_t;
 
+/* One file of a batch of updates taken from the queue by a queue thread. */
+struct rrd_update_s
+{
+	rrd_queue_t *queue_entry;
+	const data_set_t *ds;
+	size_t    values_num;
+	cdtime_t *times;
+	value_t  *values;
+	dev_t     dev;
+	ino_t     ino;
+};
+typedef struct rrd_update_s rrd_update_t;
+
 /*
  * Private variables
  */
@@ -84,7 +112,11 @@ static const char *config_keys[] =
 	"RRATimespan",
 	"XFF",
 	"WritesPerSecond",
-	"RandomTimeout"
+	"RandomTimeout",
+	"WriteThreads",
+	"WriteBatchSize",
+	"ReadAhead",
+	"ReportStats"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -122,11 +154,31 @@ static rrd_queue_t    *queue_head = NULL;
 static rrd_queue_t    *queue_tail = NULL;
 static rrd_queue_t    *flushq_head = NULL;
 static rrd_queue_t    *flushq_tail = NULL;
-static pthread_t       queue_thread;
-static int             queue_thread_running = 1;
+static size_t          queue_length = 0;
+static pthread_t      *queue_threads = NULL;
+static size_t          queue_threads_num = 0;
+static struct timeval  queue_next_update;
 static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t  queue_cond = PTHREAD_COND_INITIALIZER;
 
+static size_t write_threads = 1;
+static size_t write_batch_size = 64;
+static _Bool  read_ahead = 0;
+static _Bool  report_stats = 0;
+
+/* Statistics reported by rrd_stats_read(). The latencies are reset with
+ * every read. */
+struct rrd_stats_s
+{
+	derive_t values_written;
+	derive_t updates;
+	derive_t updates_failed;
+	stats_latency_t queue_age;
+	stats_latency_t update_time;
+};
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rrd_stats_s stats;
+
 #if !HAVE_THREADSAFE_LIBRRD
 static pthread_mutex_t librrd_lock = PTHREAD_MUTEX_INITIALIZER;
 #endif
@@ -321,24 +373,272 @@ static int value_list_to_filename (char *buffer, size_t buffer_size,
 	return (0);
 } /* int value_list_to_filename */
 
+static int rrd_queue_enqueue (const char *filename,
+    rrd_queue_t **head, rrd_queue_t **tail)
+{
+  rrd_queue_t *queue_entry;
+
+  queue_entry = (rrd_queue_t *) malloc (sizeof (rrd_queue_t));
+  if (queue_entry == NULL)
+    return (-1);
+
+  queue_entry->filename = strdup (filename);
+  if (queue_entry->filename == NULL)
+  {
+    free (queue_entry);
+    return (-1);
+  }
+
+  queue_entry->enqueued = cdtime ();
+  queue_entry->next = NULL;
+
+  pthread_mutex_lock (&queue_lock);
+
+  if (*tail == NULL)
+    *head = queue_entry;
+  else
+    (*tail)->next = queue_entry;
+  *tail = queue_entry;
+  queue_length++;
+
+  pthread_cond_signal (&queue_cond);
+  pthread_mutex_unlock (&queue_lock);
+
+  return (0);
+} /* int rrd_queue_enqueue */
+
+static int rrd_queue_dequeue (const char *filename,
+    rrd_queue_t **head, rrd_queue_t **tail)
+{
+  rrd_queue_t *this;
+  rrd_queue_t *prev;
+
+  pthread_mutex_lock (&queue_lock);
+
+  prev = NULL;
+  this = *head;
+
+  while (this != NULL)
+  {
+    if (strcmp (this->filename, filename) == 0)
+      break;
+    
+    prev = this;
+    this = this->next;
+  }
+
+  if (this == NULL)
+  {
+    pthread_mutex_unlock (&queue_lock);
+    return (-1);
+  }
+
+  if (prev == NULL)
+    *head = this->next;
+  else
+    prev->next = this->next;
+
+  if (this->next == NULL)
+    *tail = prev;
+  queue_length--;
+
+  pthread_mutex_unlock (&queue_lock);
+
+  sfree (this->filename);
+  sfree (this);
+
+  return (0);
+} /* int rrd_queue_dequeue */
+
+/* Takes the cached values of all files in the batch. Entries of files which
+ * are no longer cached or which are being written by another thread are
+ * removed from the batch; the latter are queued again once that write has
+ * finished. */
+static void rrd_batch_take (rrd_update_t *batch, size_t *batch_num) /* {{{ */
+{
+	size_t num = 0;
+	size_t i;
+
+	/* We need the cache lock so the entries aren't updated while we take
+	 * their values */
+	pthread_mutex_lock (&cache_lock);
+	for (i = 0; i < *batch_num; i++)
+	{
+		rrd_queue_t *queue_entry = batch[i].queue_entry;
+		rrd_cache_t *rc = NULL;
+		int status;
+
+		status = c_avl_get (cache, queue_entry->filename, (void *) &rc);
+		if ((status == 0) && rc->busy)
+		{
+			rc->deferred = 1;
+			status = -1;
+		}
+
+		if (status != 0)
+		{
+			sfree (queue_entry->filename);
+			sfree (queue_entry);
+			continue;
+		}
+
+		batch[num].queue_entry = queue_entry;
+		batch[num].ds = rc->ds;
+		batch[num].values_num = rc->values_num;
+		batch[num].times = rc->times;
+		batch[num].values = rc->values;
+		batch[num].dev = rc->dev;
+		batch[num].ino = rc->ino;
+		num++;
+
+		rc->values_num = 0;
+		rc->values_size = 0;
+		rc->times = NULL;
+		rc->values = NULL;
+		rc->flags = FLAG_NONE;
+		rc->busy = 1;
+	}
+	pthread_mutex_unlock (&cache_lock);
+
+	*batch_num = num;
+} /* }}} void rrd_batch_take */
+
+/* Marks the file as idle again and queues it if it was requested while it
+ * was busy. */
+static void rrd_batch_release (const char *filename) /* {{{ */
+{
+	rrd_cache_t *rc = NULL;
+
+	pthread_mutex_lock (&cache_lock);
+	if ((cache != NULL) && (c_avl_get (cache, filename, (void *) &rc) == 0))
+	{
+		rc->busy = 0;
+		if (rc->deferred)
+		{
+			rc->deferred = 0;
+			if (rc->flags == FLAG_FLUSHQ)
+				rrd_queue_enqueue (filename, &flushq_head, &flushq_tail);
+			else if (rc->flags == FLAG_QUEUED)
+				rrd_queue_enqueue (filename, &queue_head, &queue_tail);
+		}
+	}
+	pthread_mutex_unlock (&cache_lock);
+} /* }}} void rrd_batch_release */
+
+static int rrd_update_compare (const void *a_ptr, const void *b_ptr) /* {{{ */
+{
+	const rrd_update_t *a = a_ptr;
+	const rrd_update_t *b = b_ptr;
+
+	if (a->dev != b->dev)
+		return ((a->dev < b->dev) ? -1 : 1);
+	if (a->ino != b->ino)
+		return ((a->ino < b->ino) ? -1 : 1);
+	return (strcmp (a->queue_entry->filename, b->queue_entry->filename));
+} /* }}} int rrd_update_compare */
+
+/* Asks the kernel to start reading the files of a batch, so that the reads
+ * done by librrd are served from the page cache. */
+static void rrd_batch_read_ahead (rrd_update_t const *batch, /* {{{ */
+		size_t batch_num)
+{
+#if defined(POSIX_FADV_WILLNEED)
+	size_t i;
+
+	for (i = 0; i < batch_num; i++)
+	{
+		int fd;
+
+		fd = open (batch[i].queue_entry->filename, O_RDONLY);
+		if (fd < 0)
+			continue;
+		posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+		close (fd);
+	}
+#endif
+} /* }}} void rrd_batch_read_ahead */
+
+static int rrd_update_file (rrd_update_t const *u) /* {{{ */
+{
+	size_t line_size;
+	char *buffer;
+	char **argv;
+	cdtime_t start;
+	cdtime_t duration;
+	int argc = 0;
+	int status;
+	size_t i;
+
+	/* Every value takes at most 24 bytes (GAUGE_FORMAT) plus the colon. */
+	line_size = 32 + 32 * u->ds->ds_num;
+	buffer = malloc (u->values_num * line_size);
+	argv = malloc (u->values_num * sizeof (*argv));
+	if ((buffer == NULL) || (argv == NULL))
+	{
+		ERROR ("rrdtool plugin: malloc failed.");
+		sfree (buffer);
+		sfree (argv);
+		return (-1);
+	}
+
+	for (i = 0; i < u->values_num; i++)
+	{
+		value_list_t vl = VALUE_LIST_STATIC;
+
+		vl.values = u->values + i * u->ds->ds_num;
+		vl.values_len = u->ds->ds_num;
+		vl.time = u->times[i];
+
+		argv[argc] = buffer + i * line_size;
+		if (value_list_to_string (argv[argc], (int) line_size, u->ds, &vl) == 0)
+			argc++;
+	}
+
+	start = cdtime ();
+	status = srrd_update (u->queue_entry->filename, NULL,
+			argc, (const char **) argv);
+	duration = cdtime () - start;
+	DEBUG ("rrdtool plugin: queue thread: Wrote %i value%s to %s",
+			argc, (argc == 1) ? "" : "s",
+			u->queue_entry->filename);
+
+	pthread_mutex_lock (&stats_lock);
+	stats.updates++;
+	if (status != 0)
+		stats.updates_failed++;
+	else
+		stats.values_written += (derive_t) argc;
+	stats_latency_add (&stats.update_time, duration);
+	pthread_mutex_unlock (&stats_lock);
+
+	sfree (argv);
+	sfree (buffer);
+
+	return (status);
+} /* }}} int rrd_update_file */
+
 static void *rrd_queue_thread (void __attribute__((unused)) *data)
 {
-        struct timeval tv_next_update;
-        struct timeval tv_now;
+	rrd_update_t *batch;
+	size_t batch_size;
 
-        gettimeofday (&tv_next_update, /* timezone = */ NULL);
+	/* Rate limiting works on single files. */
+	batch_size = (write_rate > 0.0) ? 1 : write_batch_size;
+	batch = calloc (batch_size, sizeof (*batch));
+	if (batch == NULL)
+	{
+		ERROR ("rrdtool plugin: calloc failed.");
+		pthread_exit ((void *) 0);
+		return ((void *) 0);
+	}
 
 	while (42)
 	{
-		rrd_queue_t *queue_entry;
-		rrd_cache_t *cache_entry;
-		char **values;
-		int    values_num;
-		int    status;
-		int    i;
-
-		values = NULL;
-		values_num = 0;
+		struct timeval tv_now;
+		cdtime_t now;
+		size_t batch_num = 0;
+		size_t i;
+		int status;
 
                 pthread_mutex_lock (&queue_lock);
                 /* Wait for values to arrive */
@@ -366,7 +666,7 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
                     break;
 
                   gettimeofday (&tv_now, /* timezone = */ NULL);
-                  status = timeval_cmp (tv_next_update, tv_now, NULL);
+                  status = timeval_cmp (queue_next_update, tv_now, NULL);
                   /* We're good to go */
                   if (status <= 0)
                     break;
@@ -374,8 +674,8 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
                   /* We're supposed to wait a bit with this update, so we'll
                    * wait for the next addition to the queue or to the end of
                    * the wait period - whichever comes first. */
-                  ts_wait.tv_sec = tv_next_update.tv_sec;
-                  ts_wait.tv_nsec = 1000 * tv_next_update.tv_usec;
+                  ts_wait.tv_sec = queue_next_update.tv_sec;
+                  ts_wait.tv_nsec = 1000 * queue_next_update.tv_usec;
 
                   status = pthread_cond_timedwait (&queue_cond, &queue_lock,
                       &ts_wait);
@@ -393,162 +693,89 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
                   break;
                 }
 
-                if (flushq_head != NULL)
+                /* Dequeue a batch of entries, flush entries first */
+                now = cdtime ();
+                while (batch_num < batch_size)
                 {
-                  /* Dequeue the first flush entry */
-                  queue_entry = flushq_head;
-                  if (flushq_head == flushq_tail)
-                    flushq_head = flushq_tail = NULL;
+                  rrd_queue_t *queue_entry;
+
+                  if (flushq_head != NULL)
+                  {
+                    queue_entry = flushq_head;
+                    if (flushq_head == flushq_tail)
+                      flushq_head = flushq_tail = NULL;
+                    else
+                      flushq_head = flushq_head->next;
+                  }
+                  else if (queue_head != NULL)
+                  {
+                    queue_entry = queue_head;
+                    if (queue_head == queue_tail)
+                      queue_head = queue_tail = NULL;
+                    else
+                      queue_head = queue_head->next;
+                  }
                   else
-                    flushq_head = flushq_head->next;
+                    break;
+
+                  queue_length--;
+                  batch[batch_num].queue_entry = queue_entry;
+                  batch_num++;
+
+                  pthread_mutex_lock (&stats_lock);
+                  stats_latency_add (&stats.queue_age,
+                      now - queue_entry->enqueued);
+                  pthread_mutex_unlock (&stats_lock);
                 }
-                else /* if (queue_head != NULL) */
+
+                /* Update `queue_next_update' */
+                if (write_rate > 0.0)
                 {
-                  /* Dequeue the first regular entry */
-                  queue_entry = queue_head;
-                  if (queue_head == queue_tail)
-                    queue_head = queue_tail = NULL;
-                  else
-                    queue_head = queue_head->next;
+                  gettimeofday (&tv_now, /* timezone = */ NULL);
+                  queue_next_update.tv_sec = tv_now.tv_sec;
+                  queue_next_update.tv_usec = tv_now.tv_usec
+                    + ((suseconds_t) (1000000 * write_rate));
+                  while (queue_next_update.tv_usec > 1000000)
+                  {
+                    queue_next_update.tv_sec++;
+                    queue_next_update.tv_usec -= 1000000;
+                  }
                 }
 
 		/* Unlock the queue again */
 		pthread_mutex_unlock (&queue_lock);
 
-		/* We now need the cache lock so the entry isn't updated while
-		 * we make a copy of it's values */
-		pthread_mutex_lock (&cache_lock);
-
-		status = c_avl_get (cache, queue_entry->filename,
-				(void *) &cache_entry);
-
-		if (status == 0)
-		{
-			values = cache_entry->values;
-			values_num = cache_entry->values_num;
-
-			cache_entry->values = NULL;
-			cache_entry->values_num = 0;
-			cache_entry->flags = FLAG_NONE;
-		}
+		rrd_batch_take (batch, &batch_num);
 
-		pthread_mutex_unlock (&cache_lock);
+		/* Write the files in the order they are stored on disk. */
+		if (batch_num > 1)
+			qsort (batch, batch_num, sizeof (*batch), rrd_update_compare);
+		if (read_ahead)
+			rrd_batch_read_ahead (batch, batch_num);
 
-		if (status != 0)
+		for (i = 0; i < batch_num; i++)
 		{
-			sfree (queue_entry->filename);
-			sfree (queue_entry);
-			continue;
-		}
+			rrd_update_t *u = batch + i;
 
-		/* Update `tv_next_update' */
-		if (write_rate > 0.0) 
-                {
-                  gettimeofday (&tv_now, /* timezone = */ NULL);
-                  tv_next_update.tv_sec = tv_now.tv_sec;
-                  tv_next_update.tv_usec = tv_now.tv_usec
-                    + ((suseconds_t) (1000000 * write_rate));
-                  while (tv_next_update.tv_usec > 1000000)
-                  {
-                    tv_next_update.tv_sec++;
-                    tv_next_update.tv_usec -= 1000000;
-                  }
-                }
+			/* Write the values to the RRD-file */
+			if (u->values_num > 0)
+				rrd_update_file (u);
 
-		/* Write the values to the RRD-file */
-		srrd_update (queue_entry->filename, NULL,
-				values_num, (const char **)values);
-		DEBUG ("rrdtool plugin: queue thread: Wrote %i value%s to %s",
-				values_num, (values_num == 1) ? "" : "s",
-				queue_entry->filename);
+			rrd_batch_release (u->queue_entry->filename);
 
-		for (i = 0; i < values_num; i++)
-		{
-			sfree (values[i]);
+			sfree (u->times);
+			sfree (u->values);
+			sfree (u->queue_entry->filename);
+			sfree (u->queue_entry);
 		}
-		sfree (values);
-		sfree (queue_entry->filename);
-		sfree (queue_entry);
 	} /* while (42) */
 
+	sfree (batch);
+
 	pthread_exit ((void *) 0);
 	return ((void *) 0);
 } /* void *rrd_queue_thread */
 
-static int rrd_queue_enqueue (const char *filename,
-    rrd_queue_t **head, rrd_queue_t **tail)
-{
-  rrd_queue_t *queue_entry;
-
-  queue_entry = (rrd_queue_t *) malloc (sizeof (rrd_queue_t));
-  if (queue_entry == NULL)
-    return (-1);
-
-  queue_entry->filename = strdup (filename);
-  if (queue_entry->filename == NULL)
-  {
-    free (queue_entry);
-    return (-1);
-  }
-
-  queue_entry->next = NULL;
-
-  pthread_mutex_lock (&queue_lock);
-
-  if (*tail == NULL)
-    *head = queue_entry;
-  else
-    (*tail)->next = queue_entry;
-  *tail = queue_entry;
-
-  pthread_cond_signal (&queue_cond);
-  pthread_mutex_unlock (&queue_lock);
-
-  return (0);
-} /* int rrd_queue_enqueue */
-
-static int rrd_queue_dequeue (const char *filename,
-    rrd_queue_t **head, rrd_queue_t **tail)
-{
-  rrd_queue_t *this;
-  rrd_queue_t *prev;
-
-  pthread_mutex_lock (&queue_lock);
-
-  prev = NULL;
-  this = *head;
-
-  while (this != NULL)
-  {
-    if (strcmp (this->filename, filename) == 0)
-      break;
-    
-    prev = this;
-    this = this->next;
-  }
-
-  if (this == NULL)
-  {
-    pthread_mutex_unlock (&queue_lock);
-    return (-1);
-  }
-
-  if (prev == NULL)
-    *head = this->next;
-  else
-    prev->next = this->next;
-
-  if (this->next == NULL)
-    *tail = prev;
-
-  pthread_mutex_unlock (&queue_lock);
-
-  sfree (this->filename);
-  sfree (this);
-
-  return (0);
-} /* int rrd_queue_dequeue */
-
 /* XXX: You must hold "cache_lock" when calling this function! */
 static void rrd_cache_flush (cdtime_t timeout)
 {
@@ -586,6 +813,8 @@ static void rrd_cache_flush (cdtime_t timeout)
 			if (status == 0)
 				rc->flags = FLAG_QUEUED;
 		}
+		else if (rc->busy)
+			continue;
 		else /* ancient and no values -> waste of memory */
 		{
 			char **tmp = (char **) realloc ((void *) keys,
@@ -668,8 +897,13 @@ static int rrd_cache_flush_identifier (cdtime_t timeout,
   }
   else if (rc->flags == FLAG_QUEUED)
   {
-    rrd_queue_dequeue (key, &queue_head, &queue_tail);
-    status = rrd_queue_enqueue (key, &flushq_head, &flushq_tail);
+    /* An entry which is no longer in the queue is being written already or,
+     * if it has been deferred, is queued again according to its flags once
+     * the running write has finished. */
+    if (rrd_queue_dequeue (key, &queue_head, &queue_tail) == 0)
+      status = rrd_queue_enqueue (key, &flushq_head, &flushq_tail);
+    else
+      status = 0;
     if (status == 0)
       rc->flags = FLAG_FLUSHQ;
   }
@@ -709,12 +943,47 @@ static int64_t rrd_get_random_variation (void)
   return ((int64_t) cdrand_range (min, max));
 } /* int64_t rrd_get_random_variation */
 
+/* Appends the values of "vl" to the cache entry, doubling the size of the
+ * value arrays as needed. */
+static int rrd_cache_append (rrd_cache_t *rc, /* {{{ */
+		const data_set_t *ds, const value_list_t *vl)
+{
+	if (rc->values_num >= rc->values_size)
+	{
+		size_t new_size = (rc->values_size == 0) ? 4 : 2 * rc->values_size;
+		cdtime_t *new_times;
+		value_t *new_values;
+
+		new_times = realloc (rc->times, new_size * sizeof (*new_times));
+		if (new_times == NULL)
+			return (ENOMEM);
+		rc->times = new_times;
+
+		new_values = realloc (rc->values,
+				new_size * ds->ds_num * sizeof (*new_values));
+		if (new_values == NULL)
+			return (ENOMEM);
+		rc->values = new_values;
+
+		rc->values_size = new_size;
+	}
+
+	rc->ds = ds;
+	rc->times[rc->values_num] = vl->time;
+	memcpy (rc->values + rc->values_num * ds->ds_num, vl->values,
+			ds->ds_num * sizeof (*rc->values));
+	rc->values_num++;
+
+	return (0);
+} /* }}} int rrd_cache_append */
+
 static int rrd_cache_insert (const char *filename,
-		const char *value, cdtime_t value_time)
+		const data_set_t *ds, const value_list_t *vl,
+		struct stat const *statbuf)
 {
 	rrd_cache_t *rc = NULL;
 	int new_rc = 0;
-	char **values_new;
+	cdtime_t value_time = vl->time;
 
 	pthread_mutex_lock (&cache_lock);
 
@@ -731,13 +1000,12 @@ static int rrd_cache_insert (const char *filename,
 
 	if (rc == NULL)
 	{
-		rc = malloc (sizeof (*rc));
+		rc = calloc (1, sizeof (*rc));
 		if (rc == NULL)
+		{
+			pthread_mutex_unlock (&cache_lock);
 			return (-1);
-		rc->values_num = 0;
-		rc->values = NULL;
-		rc->first_value = 0;
-		rc->last_value = 0;
+		}
 		rc->random_variation = rrd_get_random_variation ();
 		rc->flags = FLAG_NONE;
 		new_rc = 1;
@@ -753,30 +1021,34 @@ static int rrd_cache_insert (const char *filename,
 		return (-1);
 	}
 
-	values_new = (char **) realloc ((void *) rc->values,
-			(rc->values_num + 1) * sizeof (char *));
-	if (values_new == NULL)
+	/* The values of a file are written in one go, so its data set must
+	 * not change in between. */
+	if ((rc->values_num > 0) && (rc->ds != ds))
 	{
-		char errbuf[1024];
-		void *cache_key = NULL;
-
-		sstrerror (errno, errbuf, sizeof (errbuf));
-
-		c_avl_remove (cache, filename, &cache_key, NULL);
 		pthread_mutex_unlock (&cache_lock);
+		ERROR ("rrdtool plugin: Data set of \"%s\" changed.", filename);
+		return (-1);
+	}
 
-		ERROR ("rrdtool plugin: realloc failed: %s", errbuf);
-
-		sfree (cache_key);
-		sfree (rc->values);
-		sfree (rc);
+	/* On failure the value is dropped, the entry stays intact. */
+	if (rrd_cache_append (rc, ds, vl) != 0)
+	{
+		pthread_mutex_unlock (&cache_lock);
+		ERROR ("rrdtool plugin: realloc failed.");
+		if (new_rc)
+		{
+			sfree (rc->times);
+			sfree (rc->values);
+			sfree (rc);
+		}
 		return (-1);
 	}
-	rc->values = values_new;
 
-	rc->values[rc->values_num] = strdup (value);
-	if (rc->values[rc->values_num] != NULL)
-		rc->values_num++;
+	if (statbuf != NULL)
+	{
+		rc->dev = statbuf->st_dev;
+		rc->ino = statbuf->st_ino;
+	}
 
 	if (rc->values_num == 1)
 		rc->first_value = value_time;
@@ -796,7 +1068,7 @@ static int rrd_cache_insert (const char *filename,
 
 			ERROR ("rrdtool plugin: strdup failed: %s", errbuf);
 
-			sfree (rc->values[0]);
+			sfree (rc->times);
 			sfree (rc->values);
 			sfree (rc);
 			return (-1);
@@ -806,7 +1078,7 @@ static int rrd_cache_insert (const char *filename,
 	}
 
 	DEBUG ("rrdtool plugin: rrd_cache_insert: file = %s; "
-			"values_num = %i; age = %.3f;",
+			"values_num = %zu; age = %.3f;",
 			filename, rc->values_num,
 			CDTIME_T_TO_DOUBLE (rc->last_value - rc->first_value));
 
@@ -857,7 +1129,6 @@ static int rrd_cache_destroy (void) /* {{{ */
   while (c_avl_pick (cache, &key, &value) == 0)
   {
     rrd_cache_t *rc;
-    int i;
 
     sfree (key);
     key = NULL;
@@ -868,8 +1139,7 @@ static int rrd_cache_destroy (void) /* {{{ */
     if (rc->values_num > 0)
       non_empty++;
 
-    for (i = 0; i < rc->values_num; i++)
-      sfree (rc->values[i]);
+    sfree (rc->times);
     sfree (rc->values);
     sfree (rc);
   }
@@ -910,7 +1180,6 @@ static int rrd_write (const data_set_t *ds, const value_list_t *vl,
 {
 	struct stat  statbuf;
 	char         filename[512];
-	char         values[512];
 	int          status;
 
 	if (do_shutdown)
@@ -924,9 +1193,6 @@ static int rrd_write (const data_set_t *ds, const value_list_t *vl,
 	if (value_list_to_filename (filename, sizeof (filename), vl) != 0)
 		return (-1);
 
-	if (value_list_to_string (values, sizeof (values), ds, vl) != 0)
-		return (-1);
-
 	if (stat (filename, &statbuf) == -1)
 	{
 		if (errno == ENOENT)
@@ -937,6 +1203,8 @@ static int rrd_write (const data_set_t *ds, const value_list_t *vl,
 				return (-1);
 			else if (rrdcreate_config.async)
 				return (0);
+			else if (stat (filename, &statbuf) == -1)
+				memset (&statbuf, 0, sizeof (statbuf));
 		}
 		else
 		{
@@ -954,7 +1222,7 @@ static int rrd_write (const data_set_t *ds, const value_list_t *vl,
 		return (-1);
 	}
 
-	status = rrd_cache_insert (filename, values, vl->time);
+	status = rrd_cache_insert (filename, ds, vl, &statbuf);
 
 	return (status);
 } /* int rrd_write */
@@ -1143,6 +1411,40 @@ static int rrd_config (const char *key, const char *value)
 			random_timeout = DOUBLE_TO_CDTIME_T (tmp);
 		}
 	}
+	else if (strcasecmp ("WriteThreads", key) == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp <= 0)
+		{
+			fprintf (stderr, "rrdtool: `WriteThreads' must "
+					"be greater than 0.\n");
+			ERROR ("rrdtool: `WriteThreads' must "
+					"be greater than 0.");
+			return (1);
+		}
+		write_threads = (size_t) tmp;
+	}
+	else if (strcasecmp ("WriteBatchSize", key) == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp <= 0)
+		{
+			fprintf (stderr, "rrdtool: `WriteBatchSize' must "
+					"be greater than 0.\n");
+			ERROR ("rrdtool: `WriteBatchSize' must "
+					"be greater than 0.");
+			return (1);
+		}
+		write_batch_size = (size_t) tmp;
+	}
+	else if (strcasecmp ("ReadAhead", key) == 0)
+	{
+		read_ahead = IS_TRUE (value) ? 1 : 0;
+	}
+	else if (strcasecmp ("ReportStats", key) == 0)
+	{
+		report_stats = IS_TRUE (value) ? 1 : 0;
+	}
 	else
 	{
 		return (-1);
@@ -1150,36 +1452,70 @@ static int rrd_config (const char *key, const char *value)
 	return (0);
 } /* int rrd_config */
 
+static int rrd_stats_read (void) /* {{{ */
+{
+	struct rrd_stats_s copy;
+	size_t length;
+
+	pthread_mutex_lock (&queue_lock);
+	length = queue_length;
+	pthread_mutex_unlock (&queue_lock);
+
+	pthread_mutex_lock (&stats_lock);
+	copy = stats;
+	memset (&stats.queue_age, 0, sizeof (stats.queue_age));
+	memset (&stats.update_time, 0, sizeof (stats.update_time));
+	pthread_mutex_unlock (&stats_lock);
+
+	stats_submit_gauge ("rrdtool", NULL, "queue_length", "",
+			(gauge_t) length);
+	stats_submit_gauge ("rrdtool", NULL, "latency", "queue_age",
+			stats_latency_average (&copy.queue_age));
+	stats_submit_gauge ("rrdtool", NULL, "latency", "queue_age_max",
+			stats_latency_max (&copy.queue_age));
+	stats_submit_gauge ("rrdtool", NULL, "latency", "update",
+			stats_latency_average (&copy.update_time));
+	stats_submit_gauge ("rrdtool", NULL, "latency", "update_max",
+			stats_latency_max (&copy.update_time));
+	stats_submit_derive ("rrdtool", NULL, "total_values", "written",
+			copy.values_written);
+	stats_submit_derive ("rrdtool", NULL, "total_operations", "update",
+			copy.updates);
+	stats_submit_derive ("rrdtool", NULL, "total_operations",
+			"update_failed", copy.updates_failed);
+
+	return (0);
+} /* }}} int rrd_stats_read */
+
 static int rrd_shutdown (void)
 {
+	size_t i;
+
 	pthread_mutex_lock (&cache_lock);
 	rrd_cache_flush (0);
 	pthread_mutex_unlock (&cache_lock);
 
 	pthread_mutex_lock (&queue_lock);
 	do_shutdown = 1;
-	pthread_cond_signal (&queue_cond);
+	pthread_cond_broadcast (&queue_cond);
 	pthread_mutex_unlock (&queue_lock);
 
-	if ((queue_thread_running != 0)
+	if ((queue_threads_num > 0)
 			&& ((queue_head != NULL) || (flushq_head != NULL)))
 	{
-		INFO ("rrdtool plugin: Shutting down the queue thread. "
+		INFO ("rrdtool plugin: Shutting down the queue threads. "
 				"This may take a while.");
 	}
-	else if (queue_thread_running != 0)
+	else if (queue_threads_num > 0)
 	{
-		INFO ("rrdtool plugin: Shutting down the queue thread.");
+		INFO ("rrdtool plugin: Shutting down the queue threads.");
 	}
 
 	/* Wait for all the values to be written to disk before returning. */
-	if (queue_thread_running != 0)
-	{
-		pthread_join (queue_thread, NULL);
-		memset (&queue_thread, 0, sizeof (queue_thread));
-		queue_thread_running = 0;
-		DEBUG ("rrdtool plugin: queue_thread exited.");
-	}
+	for (i = 0; i < queue_threads_num; i++)
+		pthread_join (queue_threads[i], NULL);
+	sfree (queue_threads);
+	queue_threads_num = 0;
 
 	rrd_cache_destroy ();
 
@@ -1190,6 +1526,7 @@ static int rrd_init (void)
 {
 	static int init_once = 0;
 	int status;
+	size_t i;
 
 	if (init_once != 0)
 		return (0);
@@ -1204,6 +1541,7 @@ static int rrd_init (void)
 	cache = c_avl_create ((int (*) (const void *, const void *)) strcmp);
 	if (cache == NULL)
 	{
+		pthread_mutex_unlock (&cache_lock);
 		ERROR ("rrdtool plugin: c_avl_create failed.");
 		return (-1);
 	}
@@ -1218,22 +1556,41 @@ static int rrd_init (void)
 
 	pthread_mutex_unlock (&cache_lock);
 
-	status = plugin_thread_create (&queue_thread, /* attr = */ NULL,
-			rrd_queue_thread, /* args = */ NULL);
-	if (status != 0)
+	gettimeofday (&queue_next_update, /* timezone = */ NULL);
+
+	queue_threads = calloc (write_threads, sizeof (*queue_threads));
+	if (queue_threads == NULL)
 	{
-		ERROR ("rrdtool plugin: Cannot create queue-thread.");
+		ERROR ("rrdtool plugin: calloc failed.");
 		return (-1);
 	}
-	queue_thread_running = 1;
+
+	for (i = 0; i < write_threads; i++)
+	{
+		status = plugin_thread_create (&queue_threads[queue_threads_num],
+				/* attr = */ NULL, rrd_queue_thread, /* args = */ NULL);
+		if (status != 0)
+		{
+			ERROR ("rrdtool plugin: Cannot create queue-thread.");
+			break;
+		}
+		queue_threads_num++;
+	}
+	if (queue_threads_num == 0)
+		return (-1);
+
+	if (report_stats)
+		plugin_register_read ("rrdtool", rrd_stats_read);
 
 	DEBUG ("rrdtool plugin: rrd_init: datadir = %s; stepsize = %lu;"
-			" heartbeat = %i; rrarows = %i; xff = %lf;",
+			" heartbeat = %i; rrarows = %i; xff = %lf;"
+			" write_threads = %zu; write_batch_size = %zu;",
 			(datadir == NULL) ? "(null)" : datadir,
 			rrdcreate_config.stepsize,
 			rrdcreate_config.heartbeat,
 			rrdcreate_config.rrarows,
-			rrdcreate_config.xff);
+			rrdcreate_config.xff,
+			queue_threads_num, write_batch_size);
 
 	return (0);
 } /* int rrd_init */
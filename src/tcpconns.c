@@ -74,9 +74,11 @@
 /* sys/socket.h is necessary to compile when using netlink on older systems. */
 # include <sys/socket.h>
 # include <linux/netlink.h>
+# include <linux/rtnetlink.h>
 #if HAVE_LINUX_INET_DIAG_H
 # include <linux/inet_diag.h>
 #endif
+# include <netinet/tcp.h>
 # include <sys/socket.h>
 # include <arpa/inet.h>
 /* #endif KERNEL_LINUX */
@@ -144,6 +146,14 @@ struct nlreq {
   struct nlmsghdr nlh;
   struct inet_diag_req r;
 };
+
+/* The kernel fills dump messages up to the size of the receive buffer, up to
+ * 32 kByte. Fewer, larger messages save system calls with many sockets. */
+# define NETLINK_BUFFER_SIZE 32768
+
+/* Each port of the socket filter takes a condition and a jump, 16 bytes.
+ * The jump offsets are 16 bit wide, which limits the number of ports. */
+# define FILTER_PORTS_MAX 4000
 #endif
 
 static const char *tcp_state[] =
@@ -259,12 +269,25 @@ extern int netinfo (int proto, void *data, int *size,  int n);
 #define PORT_COLLECT_REMOTE 0x02
 #define PORT_IS_LISTENING   0x04
 
+/* Sums of the TCP_INFO and MEMINFO extensions of all connections of a port
+ * which are not listening. */
+typedef struct port_stats_s
+{
+  uint32_t rtt_num;
+  uint64_t rtt_sum; /* in microseconds */
+  uint64_t retrans;
+  uint64_t rmem;
+  uint64_t wmem;
+} port_stats_t;
+
 typedef struct port_entry_s
 {
   uint16_t port;
   uint16_t flags;
   uint32_t count_local[TCP_STATE_MAX + 1];
   uint32_t count_remote[TCP_STATE_MAX + 1];
+  port_stats_t stats_local;
+  port_stats_t stats_remote;
   struct port_entry_s *next;
 } port_entry_t;
 
@@ -273,12 +296,16 @@ static const char *config_keys[] =
   "ListeningPorts",
   "LocalPort",
   "RemotePort",
-  "AllPortsSummary"
+  "AllPortsSummary",
+  "ExtendedStatistics"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static int port_collect_listening = 0;
 static int port_collect_total = 0;
+static int port_collect_extended = 0;
+/* Set if the last read provided the extended statistics. */
+static _Bool have_extended = 0;
 static port_entry_t *port_list_head = NULL;
 static uint32_t count_total[TCP_STATE_MAX + 1];
 
@@ -307,6 +334,39 @@ static void conn_prepare_vl (value_list_t *vl, value_t *values)
   sstrncpy (vl->type, "tcp_connections", sizeof (vl->type));
 }
 
+static void conn_submit_port_stats (const char *plugin_instance,
+    const port_stats_t *stats)
+{
+  value_t values[1];
+  value_list_t vl = VALUE_LIST_INIT;
+
+  conn_prepare_vl (&vl, values);
+  sstrncpy (vl.plugin_instance, plugin_instance, sizeof (vl.plugin_instance));
+
+  sstrncpy (vl.type, "latency", sizeof (vl.type));
+  sstrncpy (vl.type_instance, "rtt", sizeof (vl.type_instance));
+  if (stats->rtt_num > 0)
+    vl.values[0].gauge = ((gauge_t) stats->rtt_sum)
+      / (1e6 * ((gauge_t) stats->rtt_num));
+  else
+    vl.values[0].gauge = NAN;
+  plugin_dispatch_values (&vl);
+
+  sstrncpy (vl.type, "count", sizeof (vl.type));
+  sstrncpy (vl.type_instance, "retransmits", sizeof (vl.type_instance));
+  vl.values[0].gauge = (gauge_t) stats->retrans;
+  plugin_dispatch_values (&vl);
+
+  sstrncpy (vl.type, "bytes", sizeof (vl.type));
+  sstrncpy (vl.type_instance, "rmem", sizeof (vl.type_instance));
+  vl.values[0].gauge = (gauge_t) stats->rmem;
+  plugin_dispatch_values (&vl);
+
+  sstrncpy (vl.type_instance, "wmem", sizeof (vl.type_instance));
+  vl.values[0].gauge = (gauge_t) stats->wmem;
+  plugin_dispatch_values (&vl);
+} /* void conn_submit_port_stats */
+
 static void conn_submit_port_entry (port_entry_t *pe)
 {
   value_t values[1];
@@ -329,6 +389,9 @@ static void conn_submit_port_entry (port_entry_t *pe)
 
       plugin_dispatch_values (&vl);
     }
+
+    if (have_extended)
+      conn_submit_port_stats (vl.plugin_instance, &pe->stats_local);
   }
 
   if (pe->flags & PORT_COLLECT_REMOTE)
@@ -344,6 +407,9 @@ static void conn_submit_port_entry (port_entry_t *pe)
 
       plugin_dispatch_values (&vl);
     }
+
+    if (have_extended)
+      conn_submit_port_stats (vl.plugin_instance, &pe->stats_remote);
   }
 } /* void conn_submit */
 
@@ -440,6 +506,8 @@ static void conn_reset_port_entry (void)
 
     memset (pe->count_local, '\0', sizeof (pe->count_local));
     memset (pe->count_remote, '\0', sizeof (pe->count_remote));
+    memset (&pe->stats_local, '\0', sizeof (pe->stats_local));
+    memset (&pe->stats_remote, '\0', sizeof (pe->stats_remote));
     pe->flags &= ~PORT_IS_LISTENING;
 
     prev = pe;
@@ -487,30 +555,161 @@ static int conn_handle_ports (uint16_t port_local, uint16_t port_remote, uint8_t
 } /* int conn_handle_ports */
 
 #if KERNEL_LINUX
-/* Returns zero on success, less than zero on socket error and greater than
- * zero on other errors. */
-static int conn_read_netlink (void)
-{
 #if HAVE_STRUCT_LINUX_INET_DIAG_REQ
-  int fd;
-  struct sockaddr_nl nladdr;
-  struct nlreq req;
-  struct msghdr msg;
-  struct iovec iov;
-  struct inet_diag_msg *r;
-  char buf[8192];
+static void conn_add_stats (port_stats_t *stats, const port_stats_t *socket)
+{
+  stats->rtt_num += socket->rtt_num;
+  stats->rtt_sum += socket->rtt_sum;
+  stats->retrans += socket->retrans;
+  stats->rmem += socket->rmem;
+  stats->wmem += socket->wmem;
+} /* void conn_add_stats */
+
+static void conn_handle_netlink_msg (struct nlmsghdr *h)
+{
+  struct inet_diag_msg *r = NLMSG_DATA (h);
+  uint16_t port_local = ntohs (r->id.idiag_sport);
+  uint16_t port_remote = ntohs (r->id.idiag_dport);
+  port_stats_t stats;
+  port_entry_t *pe;
+  struct rtattr *attr;
+  int attr_len;
 
-  /* If this fails, it's likely a permission problem. We'll fall back to
-   * reading this information from files below. */
-  fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_INET_DIAG);
-  if (fd < 0)
+  /* This code does not (need to) distinguish between IPv4 and IPv6. */
+  if (conn_handle_ports (port_local, port_remote, r->idiag_state) != 0)
+    return;
+
+  if (!port_collect_extended || (r->idiag_state == TCP_STATE_LISTEN))
+    return;
+
+  memset (&stats, 0, sizeof (stats));
+  attr = (struct rtattr *) (r + 1);
+  attr_len = (int) h->nlmsg_len - NLMSG_LENGTH (sizeof (*r));
+  for (; RTA_OK (attr, attr_len); attr = RTA_NEXT (attr, attr_len))
   {
-    ERROR ("tcpconns plugin: conn_read_netlink: socket(AF_NETLINK, SOCK_RAW, "
-	"NETLINK_INET_DIAG) failed: %s",
-	sstrerror (errno, buf, sizeof (buf)));
-    return (-1);
+    if ((attr->rta_type == INET_DIAG_INFO)
+        && (RTA_PAYLOAD (attr) >= offsetof (struct tcp_info, tcpi_rttvar)))
+    {
+      struct tcp_info *info = RTA_DATA (attr);
+
+      stats.rtt_num = 1;
+      stats.rtt_sum = info->tcpi_rtt;
+      stats.retrans = info->tcpi_retrans;
+    }
+    else if ((attr->rta_type == INET_DIAG_MEMINFO)
+        && (RTA_PAYLOAD (attr) >= sizeof (struct inet_diag_meminfo)))
+    {
+      struct inet_diag_meminfo *mem = RTA_DATA (attr);
+
+      stats.rmem = mem->idiag_rmem;
+      stats.wmem = mem->idiag_wmem;
+    }
   }
 
+  pe = conn_get_port_entry (port_local, 0 /* no create */);
+  if (pe != NULL)
+    conn_add_stats (&pe->stats_local, &stats);
+
+  pe = conn_get_port_entry (port_remote, 0 /* no create */);
+  if (pe != NULL)
+    conn_add_stats (&pe->stats_remote, &stats);
+} /* void conn_handle_netlink_msg */
+
+/* Builds the inet_diag bytecode selecting the sockets with one of the local
+ * or listening ports as their local port, or one of the remote ports as their
+ * remote port, so that the kernel does not send all the others. Returns the
+ * length of the filter, or zero if it cannot be used.
+ *
+ * For every port there is a condition followed by a jump. If the condition
+ * holds, the jump to the end of the program accepts the socket, otherwise the
+ * next condition is checked. Failing the last one jumps past the end, which
+ * rejects the socket. */
+static size_t conn_build_filter (char **ret_filter, size_t *ret_size)
+{
+  const size_t cond_size = sizeof (struct inet_diag_bc_op)
+    + sizeof (struct inet_diag_hostcond);
+  const size_t entry_size = cond_size + sizeof (struct inet_diag_bc_op);
+  port_entry_t *pe;
+  size_t ports_num = 0;
+  size_t filter_len;
+  size_t offset;
+
+  for (pe = port_list_head; pe != NULL; pe = pe->next)
+  {
+    if (pe->flags & (PORT_COLLECT_LOCAL | PORT_IS_LISTENING))
+      ports_num++;
+    if (pe->flags & PORT_COLLECT_REMOTE)
+      ports_num++;
+  }
+
+  if ((ports_num == 0) || (ports_num > FILTER_PORTS_MAX))
+    return (0);
+
+  filter_len = ports_num * entry_size;
+  if (*ret_size < filter_len)
+  {
+    char *tmp = realloc (*ret_filter, filter_len);
+    if (tmp == NULL)
+      return (0);
+    *ret_filter = tmp;
+    *ret_size = filter_len;
+  }
+
+  offset = 0;
+  for (pe = port_list_head; pe != NULL; pe = pe->next)
+  {
+    int pass;
+
+    for (pass = 0; pass < 2; pass++)
+    {
+      struct inet_diag_bc_op *op;
+      struct inet_diag_hostcond *cond;
+      struct inet_diag_bc_op *jmp;
+      size_t remaining = filter_len - offset;
+
+      if ((pass == 0) && !(pe->flags & (PORT_COLLECT_LOCAL | PORT_IS_LISTENING)))
+        continue;
+      if ((pass == 1) && !(pe->flags & PORT_COLLECT_REMOTE))
+        continue;
+
+      op = (struct inet_diag_bc_op *) (*ret_filter + offset);
+      cond = (struct inet_diag_hostcond *) (op + 1);
+      jmp = (struct inet_diag_bc_op *) (*ret_filter + offset + cond_size);
+
+      op->code = (pass == 0) ? INET_DIAG_BC_S_COND : INET_DIAG_BC_D_COND;
+      op->yes = cond_size;
+      /* The next condition, or past the end for the last one. */
+      op->no = (remaining > entry_size) ? entry_size : remaining + 4;
+
+      memset (cond, 0, sizeof (*cond));
+      cond->family = AF_UNSPEC;
+      cond->prefix_len = 0;
+      cond->port = pe->port;
+
+      jmp->code = INET_DIAG_BC_JMP;
+      jmp->yes = sizeof (*jmp);
+      jmp->no = remaining - cond_size;
+
+      offset += entry_size;
+    }
+  }
+
+  return (filter_len);
+} /* size_t conn_build_filter */
+
+/* Requests the sockets in the given states, optionally selected by a filter,
+ * and handles the replies. Returns zero on success,
+ * less than zero on socket error and greater than zero on other errors. */
+static int conn_netlink_dump (int fd, uint32_t states,
+    const char *filter, size_t filter_len)
+{
+  static char buf[NETLINK_BUFFER_SIZE];
+  struct sockaddr_nl nladdr;
+  struct nlreq req;
+  struct rtattr filter_attr;
+  struct msghdr msg;
+  struct iovec iov[3];
+
   memset(&nladdr, 0, sizeof(nladdr));
   nladdr.nl_family = AF_NETLINK;
 
@@ -526,30 +725,47 @@ static int conn_read_netlink (void)
    * reliable, we don't want to end up with a corrupt or incomplete old
    * message in case the system is/was out of memory. */
   req.nlh.nlmsg_seq = ++sequence_number;
+  /* The kernel returns both IPv4 and IPv6 sockets for this request type. */
   req.r.idiag_family = AF_INET;
-  req.r.idiag_states = 0xfff;
+  req.r.idiag_states = states;
   req.r.idiag_ext = 0;
+  if (port_collect_extended)
+    req.r.idiag_ext = (1 << (INET_DIAG_INFO - 1))
+      | (1 << (INET_DIAG_MEMINFO - 1));
 
-  memset(&iov, 0, sizeof(iov));
-  iov.iov_base = &req;
-  iov.iov_len = sizeof(req);
+  memset(iov, 0, sizeof(iov));
+  iov[0].iov_base = &req;
+  iov[0].iov_len = sizeof(req);
 
   memset(&msg, 0, sizeof(msg));
   msg.msg_name = (void*)&nladdr;
   msg.msg_namelen = sizeof(nladdr);
-  msg.msg_iov = &iov;
+  msg.msg_iov = iov;
   msg.msg_iovlen = 1;
 
+  if (filter_len > 0)
+  {
+    memset (&filter_attr, 0, sizeof (filter_attr));
+    filter_attr.rta_type = INET_DIAG_REQ_BYTECODE;
+    filter_attr.rta_len = RTA_LENGTH (filter_len);
+    req.nlh.nlmsg_len += RTA_LENGTH (filter_len);
+
+    iov[1].iov_base = &filter_attr;
+    iov[1].iov_len = sizeof (filter_attr);
+    iov[2].iov_base = (void *) filter;
+    iov[2].iov_len = filter_len;
+    msg.msg_iovlen = 3;
+  }
+
   if (sendmsg (fd, &msg, 0) < 0)
   {
     ERROR ("tcpconns plugin: conn_read_netlink: sendmsg(2) failed: %s",
 	sstrerror (errno, buf, sizeof (buf)));
-    close (fd);
     return (-1);
   }
 
-  iov.iov_base = buf;
-  iov.iov_len = sizeof(buf);
+  iov[0].iov_base = buf;
+  iov[0].iov_len = sizeof(buf);
 
   while (1)
   {
@@ -559,7 +775,7 @@ static int conn_read_netlink (void)
     memset(&msg, 0, sizeof(msg));
     msg.msg_name = (void*)&nladdr;
     msg.msg_namelen = sizeof(nladdr);
-    msg.msg_iov = &iov;
+    msg.msg_iov = iov;
     msg.msg_iovlen = 1;
 
     status = recvmsg(fd, (void *) &msg, /* flags = */ 0);
@@ -570,12 +786,10 @@ static int conn_read_netlink (void)
 
       ERROR ("tcpconns plugin: conn_read_netlink: recvmsg(2) failed: %s",
 	  sstrerror (errno, buf, sizeof (buf)));
-      close (fd);
       return (-1);
     }
     else if (status == 0)
     {
-      close (fd);
       DEBUG ("tcpconns plugin: conn_read_netlink: Unexpected zero-sized "
 	  "reply from netlink socket.");
       return (0);
@@ -592,7 +806,6 @@ static int conn_read_netlink (void)
 
       if (h->nlmsg_type == NLMSG_DONE)
       {
-	close (fd);
 	return (0);
       }
       else if (h->nlmsg_type == NLMSG_ERROR)
@@ -603,16 +816,10 @@ static int conn_read_netlink (void)
 	WARNING ("tcpconns plugin: conn_read_netlink: Received error %i.",
 	    msg_error->error);
 
-	close (fd);
 	return (1);
       }
 
-      r = NLMSG_DATA(h);
-
-      /* This code does not (need to) distinguish between IPv4 and IPv6. */
-      conn_handle_ports (ntohs(r->id.idiag_sport),
-	  ntohs(r->id.idiag_dport),
-	  r->idiag_state);
+      conn_handle_netlink_msg (h);
 
       h = NLMSG_NEXT(h, status);
     } /* while (NLMSG_OK) */
@@ -620,6 +827,65 @@ static int conn_read_netlink (void)
 
   /* Not reached because the while() loop above handles the exit condition. */
   return (0);
+} /* int conn_netlink_dump */
+#endif /* HAVE_STRUCT_LINUX_INET_DIAG_REQ */
+
+/* Returns zero on success, less than zero on socket error and greater than
+ * zero on other errors. */
+static int conn_read_netlink (void)
+{
+#if HAVE_STRUCT_LINUX_INET_DIAG_REQ
+  static char *filter = NULL;
+  static size_t filter_size = 0;
+  size_t filter_len;
+  uint32_t states = 0xfff;
+  int fd;
+  int status;
+
+  /* If this fails, it's likely a permission problem. We'll fall back to
+   * reading this information from files below. */
+  fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_INET_DIAG);
+  if (fd < 0)
+  {
+    char errbuf[1024];
+    ERROR ("tcpconns plugin: conn_read_netlink: socket(AF_NETLINK, SOCK_RAW, "
+	"NETLINK_INET_DIAG) failed: %s",
+	sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  /* The summary needs every socket. */
+  if (port_collect_total)
+  {
+    status = conn_netlink_dump (fd, states, NULL, 0);
+    close (fd);
+    return (status);
+  }
+
+  /* Find the listening ports first, so that the filter for the other
+   * sockets can include them. */
+  if (port_collect_listening)
+  {
+    status = conn_netlink_dump (fd, 1 << TCP_STATE_LISTEN, NULL, 0);
+    if (status != 0)
+    {
+      close (fd);
+      return (status);
+    }
+    states &= ~(1 << TCP_STATE_LISTEN);
+  }
+
+  filter_len = conn_build_filter (&filter, &filter_size);
+  if ((filter_len == 0) && (port_list_head == NULL))
+  {
+    /* No port selected and none listening. */
+    close (fd);
+    return (0);
+  }
+
+  status = conn_netlink_dump (fd, states, filter, filter_len);
+  close (fd);
+  return (status);
 #else
   return (1);
 #endif /* HAVE_STRUCT_LINUX_INET_DIAG_REQ */
@@ -747,6 +1013,13 @@ static int conn_config (const char *key, const char *value)
     else
       port_collect_total = 0;
   }
+  else if (strcasecmp (key, "ExtendedStatistics") == 0)
+  {
+    if (IS_TRUE (value))
+      port_collect_extended = 1;
+    else
+      port_collect_extended = 0;
+  }
   else
   {
     return (-1);
@@ -769,6 +1042,7 @@ static int conn_read (void)
   int status;
 
   conn_reset_port_entry ();
+  have_extended = 0;
 
   if (linux_source == SRC_NETLINK)
   {
@@ -810,11 +1084,15 @@ static int conn_read (void)
     }
   }
 
-  if (status == 0)
-    conn_submit_all ();
-  else
+  if (status != 0)
     return (status);
 
+  /* The extended statistics are only available through netlink. */
+  if (port_collect_extended && (linux_source == SRC_NETLINK))
+    have_extended = 1;
+
+  conn_submit_all ();
+
   return (0);
 } /* int conn_read */
 /* #endif KERNEL_LINUX */
@@ -32,6 +32,7 @@
  * - CPU_FREE
  * - CPU_ALLOC
  * - CPU_ALLOC_SIZE
+ * - pthread_setaffinity_np
  */
 #define _GNU_SOURCE
 
@@ -42,9 +43,14 @@
 
 #include <asm/msr-index.h>
 #include <cpuid.h>
+#include <pthread.h>
 #ifdef HAVE_SYS_CAPABILITY_H
 #include <sys/capability.h>
 #endif /* HAVE_SYS_CAPABILITY_H */
+#if HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif /* HAVE_LINUX_PERF_EVENT_H */
 
 #define PLUGIN_NAME "turbostat"
 
@@ -122,6 +128,14 @@ static unsigned int config_rapl;
 static _Bool apply_config_rapl;
 static double rapl_energy_units;
 
+/*
+ * Boolean indicating if TSC, APERF, MPERF and the RAPL energy counters
+ * should be read through perf_event(2) rather than through the MSRs.
+ * perf_rapl tells if the energy counters actually are.
+ */
+static _Bool config_perf_events;
+static _Bool perf_rapl;
+
 #define RAPL_PKG		(1 << 0)
 					/* 0x610 MSR_PKG_POWER_LIMIT */
 					/* 0x611 MSR_PKG_ENERGY_STATUS */
@@ -139,8 +153,13 @@ static double rapl_energy_units;
 					/* 0x642 MSR_PP1_POLICY */
 #define	TJMAX_DEFAULT	100
 
-static cpu_set_t *cpu_present_set, *cpu_affinity_set, *cpu_saved_affinity_set;
-static size_t cpu_present_setsize, cpu_affinity_setsize, cpu_saved_affinity_setsize;
+static cpu_set_t *cpu_present_set;
+static size_t cpu_present_setsize;
+
+/*
+ * MSR devices, indexed by cpu id, kept open between reads
+ */
+static int *msr_fds;
 
 static struct thread_data {
 	unsigned long long tsc;
@@ -171,10 +190,10 @@ static struct pkg_data {
 	unsigned long long pc9;
 	unsigned long long pc10;
 	unsigned int package_id;
-	uint32_t energy_pkg;	/* MSR_PKG_ENERGY_STATUS */
-	uint32_t energy_dram;	/* MSR_DRAM_ENERGY_STATUS */
-	uint32_t energy_cores;	/* MSR_PP0_ENERGY_STATUS */
-	uint32_t energy_gfx;	/* MSR_PP1_ENERGY_STATUS */
+	unsigned long long energy_pkg;		/* MSR_PKG_ENERGY_STATUS */
+	unsigned long long energy_dram;		/* MSR_DRAM_ENERGY_STATUS */
+	unsigned long long energy_cores;	/* MSR_PP0_ENERGY_STATUS */
+	unsigned long long energy_gfx;		/* MSR_PP1_ENERGY_STATUS */
 	unsigned int tcc_activation_temp;
 	unsigned int pkg_temp_c;
 } *package_delta, *package_even, *package_odd;
@@ -224,6 +243,7 @@ static const char *config_keys[] =
 	"PackageThermalManagement",
 	"TCCActivationTemp",
 	"RunningAveragePowerLimit",
+	"PerfEvents",
 };
 static const int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -233,39 +253,38 @@ static const int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 /*
  * Open a MSR device for reading
- * Can change the scheduling affinity of the current process if multiple_read is 1
+ * Once the buffers are allocated, the device stays open until they are freed
  */
 static int __attribute__((warn_unused_result))
-open_msr(unsigned int cpu, _Bool multiple_read)
+open_msr(unsigned int cpu)
 {
 	char pathname[32];
 	int fd;
 
-	/*
-	 * If we need to do multiple read, let's migrate to the CPU
-	 * Otherwise, we would lose time calling functions on another CPU
-	 *
-	 * If we are not yet initialized (cpu_affinity_setsize = 0),
-	 * we need to skip this optimisation.
-	 */
-	if (multiple_read && cpu_affinity_setsize) {
-		CPU_ZERO_S(cpu_affinity_setsize, cpu_affinity_set);
-		CPU_SET_S(cpu, cpu_affinity_setsize, cpu_affinity_set);
-		if (sched_setaffinity(0, cpu_affinity_setsize, cpu_affinity_set) == -1) {
-			ERROR("turbostat plugin: Could not migrate to CPU %d", cpu);
-			return -1;
-		}
-	}
+	if (msr_fds != NULL && msr_fds[cpu] >= 0)
+		return msr_fds[cpu];
 
 	ssnprintf(pathname, sizeof(pathname), "/dev/cpu/%d/msr", cpu);
-	fd = open(pathname, O_RDONLY);
+	fd = open(pathname, O_RDONLY | O_CLOEXEC);
 	if (fd < 0) {
 		ERROR("turbostat plugin: failed to open %s", pathname);
 		return -1;
 	}
+	if (msr_fds != NULL)
+		msr_fds[cpu] = fd;
 	return fd;
 }
 
+/*
+ * Close a MSR device unless it is kept open
+ */
+static void
+close_msr(int fd)
+{
+	if (msr_fds == NULL)
+		close(fd);
+}
+
 /*
  * Read a single MSR from an open file descriptor
  */
@@ -286,7 +305,6 @@ read_msr(int fd, off_t offset, unsigned long long *msr)
 
 /*
  * Open a MSR device for reading, read the value asked for and close it.
- * This call will not affect the scheduling affinity of this thread.
  */
 static ssize_t __attribute__((warn_unused_result))
 get_msr(unsigned int cpu, off_t offset, unsigned long long *msr)
@@ -294,15 +312,281 @@ get_msr(unsigned int cpu, off_t offset, unsigned long long *msr)
 	ssize_t retval;
 	int fd;
 
-	fd = open_msr(cpu, 0);
+	fd = open_msr(cpu);
 	if (fd < 0)
 		return fd;
 	retval = read_msr(fd, offset, msr);
-	close(fd);
+	close_msr(fd);
 	return retval;
 }
 
 
+#if HAVE_LINUX_PERF_EVENT_H
+/***********************************
+ * perf_event manipulation helpers *
+ ***********************************/
+
+/*
+ * The kernel exposes TSC, APERF and MPERF through the "msr" PMU and the RAPL
+ * energy counters through the "power" PMU. The three thread counters are
+ * opened as one group, so that a single read(2) returns all of them, instead
+ * of three pread(2) on the MSR device. The energy counters are 64 bits wide
+ * and come with their own scale, so they neither wrap around after 32 bits
+ * nor depend on the units in MSR_RAPL_POWER_UNIT.
+ */
+#define PERF_PMU_DIR "/sys/bus/event_source/devices"
+#define PERF_THREAD_COUNTERS 3
+#define PERF_RAPL_DOMAINS 4
+
+static const char *perf_thread_events[PERF_THREAD_COUNTERS] = {
+	"tsc", "aperf", "mperf"
+};
+
+/* Indexed by the bit number of RAPL_PKG, RAPL_DRAM, RAPL_CORES and RAPL_GFX */
+static const char *perf_rapl_events[PERF_RAPL_DOMAINS] = {
+	"energy-pkg", "energy-ram", "energy-cores", "energy-gpu"
+};
+
+static int *perf_cpu_fds;
+static int *perf_pkg_fds;
+static double perf_energy_scale[PERF_RAPL_DOMAINS];
+
+static int cpu_is_not_present(unsigned int cpu);
+
+/*
+ * Read a sysfs attribute of a PMU, e.g. "type" or "events/aperf"
+ */
+static int
+perf_pmu_attr(const char *pmu, const char *attr, char *buffer, size_t size)
+{
+	char path[PATH_MAX];
+	ssize_t len;
+
+	ssnprintf(path, sizeof(path), PERF_PMU_DIR "/%s/%s", pmu, attr);
+	if (access(path, R_OK) != 0)
+		return -1;
+	len = read_file_contents(path, buffer, size - 1);
+	if (len <= 0)
+		return -1;
+	buffer[len] = 0;
+	return 0;
+}
+
+/*
+ * Look up the type of a PMU and the config of one of its events
+ */
+static int
+perf_event_lookup(const char *pmu, const char *event, struct perf_event_attr *attr)
+{
+	char buffer[64];
+	char attr_name[64];
+	unsigned long long config;
+
+	if (perf_pmu_attr(pmu, "type", buffer, sizeof(buffer)) != 0)
+		return -1;
+	memset(attr, 0, sizeof(*attr));
+	attr->size = sizeof(*attr);
+	attr->type = (uint32_t) strtoul(buffer, NULL, 0);
+
+	/* file format: "event=0x01" */
+	ssnprintf(attr_name, sizeof(attr_name), "events/%s", event);
+	if (perf_pmu_attr(pmu, attr_name, buffer, sizeof(buffer)) != 0)
+		return -1;
+	if (sscanf(buffer, "event=%llx", &config) != 1)
+		return -1;
+	attr->config = config;
+	return 0;
+}
+
+static int
+perf_event_open(struct perf_event_attr *attr, unsigned int cpu, int group_fd)
+{
+	return (int) syscall(__NR_perf_event_open, attr, -1, (int) cpu, group_fd, 0);
+}
+
+static void
+perf_close_fds(int **fds, size_t num)
+{
+	size_t i;
+
+	if (*fds == NULL)
+		return;
+	for (i = 0; i < num; ++i)
+		if ((*fds)[i] >= 0)
+			close((*fds)[i]);
+	sfree(*fds);
+}
+
+static int *
+perf_alloc_fds(size_t num)
+{
+	int *fds;
+	size_t i;
+
+	fds = calloc(num, sizeof(*fds));
+	if (fds == NULL) {
+		ERROR("turbostat plugin: calloc failed");
+		return NULL;
+	}
+	for (i = 0; i < num; ++i)
+		fds[i] = -1;
+	return fds;
+}
+
+/*
+ * Open the TSC/APERF/MPERF group of every present CPU
+ */
+static int
+perf_open_thread_counters(void)
+{
+	struct perf_event_attr attr[PERF_THREAD_COUNTERS];
+	size_t num = PERF_THREAD_COUNTERS * (topology.max_cpu_id + 1);
+	unsigned int cpu;
+	int i;
+
+	for (i = 0; i < PERF_THREAD_COUNTERS; ++i) {
+		if (perf_event_lookup("msr", perf_thread_events[i], &attr[i]) != 0) {
+			WARNING("turbostat plugin: The kernel does not provide "
+				"msr/%s, reading the MSRs instead",
+				perf_thread_events[i]);
+			return -1;
+		}
+	}
+	attr[0].read_format = PERF_FORMAT_GROUP;
+
+	perf_cpu_fds = perf_alloc_fds(num);
+	if (perf_cpu_fds == NULL)
+		return -1;
+
+	for (cpu = 0; cpu <= topology.max_cpu_id; ++cpu) {
+		int *fds = perf_cpu_fds + PERF_THREAD_COUNTERS * cpu;
+
+		if (cpu_is_not_present(cpu))
+			continue;
+		for (i = 0; i < PERF_THREAD_COUNTERS; ++i) {
+			fds[i] = perf_event_open(&attr[i], cpu, (i == 0) ? -1 : fds[0]);
+			if (fds[i] < 0) {
+				char errbuf[1024];
+				WARNING("turbostat plugin: Unable to open msr/%s "
+					"on cpu %u, reading the MSRs instead: %s",
+					perf_thread_events[i], cpu,
+					sstrerror(errno, errbuf, sizeof(errbuf)));
+				perf_close_fds(&perf_cpu_fds, num);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Open the energy counters of the enabled RAPL domains in every package, on
+ * the CPU which collects the package counters
+ */
+static int
+perf_open_rapl_counters(void)
+{
+	struct perf_event_attr attr[PERF_RAPL_DOMAINS];
+	size_t num = PERF_RAPL_DOMAINS * topology.num_packages;
+	unsigned int cpu;
+	int i;
+
+	for (i = 0; i < PERF_RAPL_DOMAINS; ++i) {
+		char attr_name[64];
+		char buffer[64];
+
+		if (!(do_rapl & (1 << i)))
+			continue;
+		ssnprintf(attr_name, sizeof(attr_name), "events/%s.scale",
+			perf_rapl_events[i]);
+		if (perf_event_lookup("power", perf_rapl_events[i], &attr[i]) != 0
+		    || perf_pmu_attr("power", attr_name, buffer, sizeof(buffer)) != 0) {
+			WARNING("turbostat plugin: The kernel does not provide "
+				"power/%s, reading the MSRs instead",
+				perf_rapl_events[i]);
+			return -1;
+		}
+		perf_energy_scale[i] = atof(buffer);
+	}
+
+	perf_pkg_fds = perf_alloc_fds(num);
+	if (perf_pkg_fds == NULL)
+		return -1;
+
+	for (cpu = 0; cpu <= topology.max_cpu_id; ++cpu) {
+		int *fds = perf_pkg_fds + PERF_RAPL_DOMAINS * topology.cpus[cpu].package_id;
+
+		if (cpu_is_not_present(cpu) || !topology.cpus[cpu].first_core_in_package)
+			continue;
+		for (i = 0; i < PERF_RAPL_DOMAINS; ++i) {
+			if (!(do_rapl & (1 << i)))
+				continue;
+			fds[i] = perf_event_open(&attr[i], cpu, -1);
+			if (fds[i] < 0) {
+				char errbuf[1024];
+				WARNING("turbostat plugin: Unable to open power/%s "
+					"on cpu %u, reading the MSRs instead: %s",
+					perf_rapl_events[i], cpu,
+					sstrerror(errno, errbuf, sizeof(errbuf)));
+				perf_close_fds(&perf_pkg_fds, num);
+				return -1;
+			}
+		}
+	}
+	perf_rapl = 1;
+	return 0;
+}
+
+static void
+perf_close_all(void)
+{
+	perf_close_fds(&perf_cpu_fds, PERF_THREAD_COUNTERS * (topology.max_cpu_id + 1));
+	perf_close_fds(&perf_pkg_fds, PERF_RAPL_DOMAINS * topology.num_packages);
+	perf_rapl = 0;
+}
+
+static int __attribute__((warn_unused_result))
+perf_read_thread_counters(struct thread_data *t)
+{
+	/* PERF_FORMAT_GROUP: number of counters, then their values */
+	unsigned long long values[1 + PERF_THREAD_COUNTERS];
+	ssize_t len;
+
+	len = read(perf_cpu_fds[PERF_THREAD_COUNTERS * t->cpu_id], values, sizeof(values));
+	if (len != sizeof(values) || values[0] != PERF_THREAD_COUNTERS) {
+		ERROR("turbostat plugin: Unable to read the perf counters of cpu %u",
+		      t->cpu_id);
+		return -1;
+	}
+	t->tsc = values[1];
+	t->aperf = values[2];
+	t->mperf = values[3];
+	return 0;
+}
+
+static int __attribute__((warn_unused_result))
+perf_read_energy(struct pkg_data *p)
+{
+	unsigned long long *energy[PERF_RAPL_DOMAINS] = {
+		&p->energy_pkg, &p->energy_dram, &p->energy_cores, &p->energy_gfx
+	};
+	int *fds = perf_pkg_fds + PERF_RAPL_DOMAINS * p->package_id;
+	int i;
+
+	for (i = 0; i < PERF_RAPL_DOMAINS; ++i) {
+		if (fds[i] < 0)
+			continue;
+		if (read(fds[i], energy[i], sizeof(*energy[i])) != sizeof(*energy[i])) {
+			ERROR("turbostat plugin: Unable to read power/%s of package %u",
+			      perf_rapl_events[i], p->package_id);
+			return -1;
+		}
+	}
+	return 0;
+}
+#endif /* HAVE_LINUX_PERF_EVENT_H */
+
+
 /********************************
  * Raw data acquisition (1 CPU) *
  ********************************/
@@ -312,8 +596,6 @@ get_msr(unsigned int cpu, off_t offset, unsigned long long *msr)
  *
  * Core data is shared for all threads in one core: extracted only for the first thread
  * Package data is shared for all core in one package: extracted only for the first thread of the first core
- *
- * Side effect: migrates to the targeted CPU
  */
 static int __attribute__((warn_unused_result))
 get_counters(struct thread_data *t, struct core_data *c, struct pkg_data *p)
@@ -323,7 +605,7 @@ get_counters(struct thread_data *t, struct core_data *c, struct pkg_data *p)
 	int msr_fd;
 	int retval = 0;
 
-	msr_fd = open_msr(cpu, 1);
+	msr_fd = open_msr(cpu);
 	if (msr_fd < 0)
 		return msr_fd;
 
@@ -336,10 +618,20 @@ do {									\
 	}								\
 } while (0)
 
-	READ_MSR(MSR_IA32_TSC, &t->tsc);
+#if HAVE_LINUX_PERF_EVENT_H
+	if (perf_cpu_fds != NULL) {
+		if (perf_read_thread_counters(t)) {
+			retval = -1;
+			goto out;
+		}
+	} else
+#endif /* HAVE_LINUX_PERF_EVENT_H */
+	{
+		READ_MSR(MSR_IA32_TSC, &t->tsc);
 
-	READ_MSR(MSR_IA32_APERF, &t->aperf);
-	READ_MSR(MSR_IA32_MPERF, &t->mperf);
+		READ_MSR(MSR_IA32_APERF, &t->aperf);
+		READ_MSR(MSR_IA32_MPERF, &t->mperf);
+	}
 
 	if (do_smi) {
 		READ_MSR(MSR_SMI_COUNT, &msr);
@@ -385,21 +677,31 @@ do {									\
 	if (do_pkg_cstate & (1 << 10))
 		READ_MSR(MSR_PKG_C10_RESIDENCY, &p->pc10);
 
-	if (do_rapl & RAPL_PKG) {
-		READ_MSR(MSR_PKG_ENERGY_STATUS, &msr);
-		p->energy_pkg = msr & 0xFFFFFFFF;
-	}
-	if (do_rapl & RAPL_CORES) {
-		READ_MSR(MSR_PP0_ENERGY_STATUS, &msr);
-		p->energy_cores = msr & 0xFFFFFFFF;
-	}
-	if (do_rapl & RAPL_DRAM) {
-		READ_MSR(MSR_DRAM_ENERGY_STATUS, &msr);
-		p->energy_dram = msr & 0xFFFFFFFF;
-	}
-	if (do_rapl & RAPL_GFX) {
-		READ_MSR(MSR_PP1_ENERGY_STATUS, &msr);
-		p->energy_gfx = msr & 0xFFFFFFFF;
+#if HAVE_LINUX_PERF_EVENT_H
+	if (perf_rapl) {
+		if (perf_read_energy(p)) {
+			retval = -1;
+			goto out;
+		}
+	} else
+#endif /* HAVE_LINUX_PERF_EVENT_H */
+	{
+		if (do_rapl & RAPL_PKG) {
+			READ_MSR(MSR_PKG_ENERGY_STATUS, &msr);
+			p->energy_pkg = msr & 0xFFFFFFFF;
+		}
+		if (do_rapl & RAPL_CORES) {
+			READ_MSR(MSR_PP0_ENERGY_STATUS, &msr);
+			p->energy_cores = msr & 0xFFFFFFFF;
+		}
+		if (do_rapl & RAPL_DRAM) {
+			READ_MSR(MSR_DRAM_ENERGY_STATUS, &msr);
+			p->energy_dram = msr & 0xFFFFFFFF;
+		}
+		if (do_rapl & RAPL_GFX) {
+			READ_MSR(MSR_PP1_ENERGY_STATUS, &msr);
+			p->energy_gfx = msr & 0xFFFFFFFF;
+		}
 	}
 	if (do_ptm) {
 		READ_MSR(MSR_IA32_PACKAGE_THERM_STATUS, &msr);
@@ -407,7 +709,7 @@ do {									\
 	}
 
 out:
-	close(msr_fd);
+	close_msr(msr_fd);
 	return retval;
 }
 
@@ -416,6 +718,18 @@ out:
  * Evaluating the changes (1 CPU) *
  **********************************/
 
+/*
+ * The RAPL energy MSRs are 32 bits wide and wrap around, the perf counters
+ * are 64 bits wide
+ */
+static inline unsigned long long
+delta_energy(unsigned long long new, unsigned long long old)
+{
+	if (perf_rapl)
+		return new - old;
+	return (new - old) & 0xFFFFFFFF;
+}
+
 /*
  * Extract the evolution old->new in delta at a package level
  * (some are not new-delta, e.g. temperature)
@@ -432,10 +746,10 @@ delta_package(struct pkg_data *delta, const struct pkg_data *new, const struct p
 	delta->pc10 = new->pc10 - old->pc10;
 	delta->pkg_temp_c = new->pkg_temp_c;
 
-	delta->energy_pkg = new->energy_pkg - old->energy_pkg;
-	delta->energy_cores = new->energy_cores - old->energy_cores;
-	delta->energy_gfx = new->energy_gfx - old->energy_gfx;
-	delta->energy_dram = new->energy_dram - old->energy_dram;
+	delta->energy_pkg = delta_energy(new->energy_pkg, old->energy_pkg);
+	delta->energy_cores = delta_energy(new->energy_cores, old->energy_cores);
+	delta->energy_gfx = delta_energy(new->energy_gfx, old->energy_gfx);
+	delta->energy_dram = delta_energy(new->energy_dram, old->energy_dram);
 }
 
 /*
@@ -517,6 +831,19 @@ delta_thread(struct thread_data *delta, const struct thread_data *new, const str
 /*
  * Submit one gauge value
  */
+/*
+ * Joules per unit of the energy counter of a RAPL domain
+ */
+static double
+energy_units(unsigned int domain)
+{
+#if HAVE_LINUX_PERF_EVENT_H
+	if (perf_rapl)
+		return perf_energy_scale[__builtin_ctz(domain)];
+#endif /* HAVE_LINUX_PERF_EVENT_H */
+	return rapl_energy_units;
+}
+
 static void
 turbostat_submit (const char *plugin_instance,
 	const char *type, const char *type_instance,
@@ -614,13 +941,13 @@ submit_counters(struct thread_data *t, struct core_data *c, struct pkg_data *p)
 
 	if (do_rapl) {
 		if (do_rapl & RAPL_PKG)
-			turbostat_submit(name, "power", "pkg", p->energy_pkg * rapl_energy_units / interval_float);
+			turbostat_submit(name, "power", "pkg", p->energy_pkg * energy_units(RAPL_PKG) / interval_float);
 		if (do_rapl & RAPL_CORES)
-			turbostat_submit(name, "power", "cores", p->energy_cores * rapl_energy_units / interval_float);
+			turbostat_submit(name, "power", "cores", p->energy_cores * energy_units(RAPL_CORES) / interval_float);
 		if (do_rapl & RAPL_GFX)
-			turbostat_submit(name, "power", "GFX", p->energy_gfx * rapl_energy_units / interval_float);
+			turbostat_submit(name, "power", "GFX", p->energy_gfx * energy_units(RAPL_GFX) / interval_float);
 		if (do_rapl & RAPL_DRAM)
-			turbostat_submit(name, "power", "DRAM", p->energy_dram * rapl_energy_units / interval_float);
+			turbostat_submit(name, "power", "DRAM", p->energy_dram * energy_units(RAPL_DRAM) / interval_float);
 	}
 done:
 	return 0;
@@ -641,42 +968,62 @@ cpu_is_not_present(unsigned int cpu)
 }
 
 /*
- * Loop on all CPUs in topological order
+ * Loop on all CPUs of one package in topological order
  *
  * Skip non-present cpus
  * Return the error code at the first error or 0
  */
 static int __attribute__((warn_unused_result))
-for_all_cpus(int (func)(struct thread_data *, struct core_data *, struct pkg_data *),
+for_package_cpus(int (func)(struct thread_data *, struct core_data *, struct pkg_data *),
+	unsigned int pkg_no,
 	struct thread_data *thread_base, struct core_data *core_base, struct pkg_data *pkg_base)
 {
 	int retval;
-	unsigned int pkg_no, core_no, thread_no;
+	unsigned int core_no, thread_no;
 
-	for (pkg_no = 0; pkg_no < topology.num_packages; ++pkg_no) {
-		for (core_no = 0; core_no < topology.num_cores; ++core_no) {
-			for (thread_no = 0; thread_no < topology.num_threads; ++thread_no) {
-				struct thread_data *t;
-				struct core_data *c;
-				struct pkg_data *p;
+	for (core_no = 0; core_no < topology.num_cores; ++core_no) {
+		for (thread_no = 0; thread_no < topology.num_threads; ++thread_no) {
+			struct thread_data *t;
+			struct core_data *c;
+			struct pkg_data *p;
 
-				t = GET_THREAD(thread_base, thread_no, core_no, pkg_no);
+			t = GET_THREAD(thread_base, thread_no, core_no, pkg_no);
 
-				if (cpu_is_not_present(t->cpu_id))
-					continue;
+			if (cpu_is_not_present(t->cpu_id))
+				continue;
 
-				c = GET_CORE(core_base, core_no, pkg_no);
-				p = GET_PKG(pkg_base, pkg_no);
+			c = GET_CORE(core_base, core_no, pkg_no);
+			p = GET_PKG(pkg_base, pkg_no);
 
-				retval = func(t, c, p);
-				if (retval)
-					return retval;
-			}
+			retval = func(t, c, p);
+			if (retval)
+				return retval;
 		}
 	}
 	return 0;
 }
 
+/*
+ * Loop on all CPUs in topological order
+ *
+ * Skip non-present cpus
+ * Return the error code at the first error or 0
+ */
+static int __attribute__((warn_unused_result))
+for_all_cpus(int (func)(struct thread_data *, struct core_data *, struct pkg_data *),
+	struct thread_data *thread_base, struct core_data *core_base, struct pkg_data *pkg_base)
+{
+	int retval;
+	unsigned int pkg_no;
+
+	for (pkg_no = 0; pkg_no < topology.num_packages; ++pkg_no) {
+		retval = for_package_cpus(func, pkg_no, thread_base, core_base, pkg_base);
+		if (retval)
+			return retval;
+	}
+	return 0;
+}
+
 /*
  * Dedicated loop: Extract every data evolution for all CPU
  *
@@ -1168,12 +1515,6 @@ topology_probe()
 	}
 
 	ret = allocate_cpu_set(&cpu_present_set, &cpu_present_setsize);
-	if (ret != 0)
-		goto err;
-	ret = allocate_cpu_set(&cpu_affinity_set, &cpu_affinity_setsize);
-	if (ret != 0)
-		goto err;
-	ret = allocate_cpu_set(&cpu_saved_affinity_set, &cpu_saved_affinity_setsize);
 	if (ret != 0)
 		goto err;
 
@@ -1239,10 +1580,189 @@ topology_probe()
 	return 0;
 err:
 	free(topology.cpus);
+	topology.cpus = NULL;
 	return ret;
 }
 
 
+/*********************
+ * Sampling threads *
+ *********************/
+
+/*
+ * One thread per package reads the counters of the CPUs in that package.
+ * Each thread is pinned to the CPUs of its package, so that reading the
+ * MSRs does not cross sockets, and all threads are released at once, so
+ * that a snapshot of the whole machine takes as long as the largest package
+ * rather than the sum of all CPUs. If the threads cannot be started, the
+ * read callback samples all CPUs itself.
+ */
+struct pkg_sampler {
+	unsigned int package_id;
+	cpu_set_t *cpus;
+	size_t cpus_setsize;
+	pthread_t thread;
+	_Bool running;
+	int retval;
+};
+
+static struct pkg_sampler *samplers;
+static unsigned int samplers_running;
+
+static pthread_mutex_t sample_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sample_start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t sample_done_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long sample_generation;
+static unsigned int sample_pending;
+static _Bool sample_stop;
+static struct thread_data *sample_thread_base;
+static struct core_data *sample_core_base;
+static struct pkg_data *sample_pkg_base;
+
+static void *
+sampler_main(void *arg)
+{
+	struct pkg_sampler *s = arg;
+	unsigned long generation;
+
+	pthread_mutex_lock(&sample_lock);
+	generation = sample_generation;
+	while (1) {
+		while (!sample_stop && generation == sample_generation)
+			pthread_cond_wait(&sample_start_cond, &sample_lock);
+		if (sample_stop)
+			break;
+		generation = sample_generation;
+		pthread_mutex_unlock(&sample_lock);
+
+		s->retval = for_package_cpus(get_counters, s->package_id,
+			sample_thread_base, sample_core_base, sample_pkg_base);
+
+		pthread_mutex_lock(&sample_lock);
+		if (--sample_pending == 0)
+			pthread_cond_signal(&sample_done_cond);
+	}
+	pthread_mutex_unlock(&sample_lock);
+	return NULL;
+}
+
+static void
+stop_samplers(void)
+{
+	unsigned int pkg_no;
+
+	if (samplers == NULL)
+		return;
+
+	pthread_mutex_lock(&sample_lock);
+	sample_stop = 1;
+	pthread_cond_broadcast(&sample_start_cond);
+	pthread_mutex_unlock(&sample_lock);
+
+	for (pkg_no = 0; pkg_no < topology.num_packages; ++pkg_no) {
+		struct pkg_sampler *s = &samplers[pkg_no];
+
+		if (s->running)
+			pthread_join(s->thread, NULL);
+		if (s->cpus != NULL)
+			CPU_FREE(s->cpus);
+	}
+	sfree(samplers);
+	samplers_running = 0;
+	sample_stop = 0;
+}
+
+static int __attribute__((warn_unused_result))
+start_samplers(void)
+{
+	unsigned int cpu, pkg_no;
+
+	samplers = calloc(topology.num_packages, sizeof(*samplers));
+	if (samplers == NULL) {
+		ERROR("turbostat plugin: calloc failed");
+		return -1;
+	}
+
+	for (cpu = 0; cpu <= topology.max_cpu_id; ++cpu) {
+		struct pkg_sampler *s;
+
+		if (cpu_is_not_present(cpu))
+			continue;
+		s = &samplers[topology.cpus[cpu].package_id];
+		if (s->cpus == NULL && allocate_cpu_set(&s->cpus, &s->cpus_setsize) != 0) {
+			stop_samplers();
+			return -1;
+		}
+		CPU_SET_S(cpu, s->cpus_setsize, s->cpus);
+	}
+
+	for (pkg_no = 0; pkg_no < topology.num_packages; ++pkg_no) {
+		struct pkg_sampler *s = &samplers[pkg_no];
+		int status;
+
+		/* Package ids do not need to be contiguous */
+		if (s->cpus == NULL)
+			continue;
+		s->package_id = pkg_no;
+
+		status = plugin_thread_create(&s->thread, NULL, sampler_main, s);
+		if (status != 0) {
+			ERROR("turbostat plugin: Unable to start the sampling "
+			      "thread of package %u", pkg_no);
+			stop_samplers();
+			return -1;
+		}
+		s->running = 1;
+		samplers_running++;
+
+		status = pthread_setaffinity_np(s->thread, s->cpus_setsize, s->cpus);
+		if (status != 0)
+			WARNING("turbostat plugin: Unable to pin the sampling "
+				"thread of package %u to its CPUs", pkg_no);
+	}
+	return 0;
+}
+
+/*
+ * Read the counters of all CPUs. The time of the snapshot is taken in the
+ * middle of the sampling, which is the best estimate for every CPU.
+ */
+static int __attribute__((warn_unused_result))
+sample_all_cpus(struct thread_data *thread_base, struct core_data *core_base,
+	struct pkg_data *pkg_base, cdtime_t *time)
+{
+	cdtime_t start;
+	unsigned int pkg_no;
+	int retval = 0;
+
+	if (samplers == NULL) {
+		start = cdtime();
+		retval = for_all_cpus(get_counters, thread_base, core_base, pkg_base);
+		*time = start + (cdtime() - start) / 2;
+		return retval;
+	}
+
+	pthread_mutex_lock(&sample_lock);
+	sample_thread_base = thread_base;
+	sample_core_base = core_base;
+	sample_pkg_base = pkg_base;
+	sample_pending = samplers_running;
+	sample_generation++;
+
+	start = cdtime();
+	pthread_cond_broadcast(&sample_start_cond);
+	while (sample_pending > 0)
+		pthread_cond_wait(&sample_done_cond, &sample_lock);
+	*time = start + (cdtime() - start) / 2;
+	pthread_mutex_unlock(&sample_lock);
+
+	for (pkg_no = 0; pkg_no < topology.num_packages; ++pkg_no)
+		if (samplers[pkg_no].running && samplers[pkg_no].retval)
+			return samplers[pkg_no].retval;
+	return 0;
+}
+
+
 /************************
  * Main alloc/init/free *
  ************************/
@@ -1333,23 +1853,49 @@ initialize_counters(void)
 
 
 
+/*
+ * Keep the MSR devices open from now on
+ */
+static int __attribute__((warn_unused_result))
+allocate_msr_fds(void)
+{
+	unsigned int i;
+
+	msr_fds = calloc(topology.max_cpu_id + 1, sizeof(*msr_fds));
+	if (msr_fds == NULL) {
+		ERROR("turbostat plugin: calloc failed");
+		return -1;
+	}
+	for (i = 0; i <= topology.max_cpu_id; ++i)
+		msr_fds[i] = -1;
+	return 0;
+}
+
 static void
 free_all_buffers(void)
 {
+	unsigned int i;
+
 	allocated = 0;
 	initialized = 0;
 
-	CPU_FREE(cpu_present_set);
-	cpu_present_set = NULL;
-	cpu_present_set = 0;
+	/* The sampling threads use everything below */
+	stop_samplers();
 
-	CPU_FREE(cpu_affinity_set);
-	cpu_affinity_set = NULL;
-	cpu_affinity_setsize = 0;
+#if HAVE_LINUX_PERF_EVENT_H
+	perf_close_all();
+#endif /* HAVE_LINUX_PERF_EVENT_H */
+
+	if (msr_fds != NULL) {
+		for (i = 0; i <= topology.max_cpu_id; ++i)
+			if (msr_fds[i] >= 0)
+				close(msr_fds[i]);
+		sfree(msr_fds);
+	}
 
-	CPU_FREE(cpu_saved_affinity_set);
-	cpu_saved_affinity_set = NULL;
-	cpu_saved_affinity_setsize = 0;
+	CPU_FREE(cpu_present_set);
+	cpu_present_set = NULL;
+	cpu_present_setsize = 0;
 
 	free(thread_even);
 	free(core_even);
@@ -1393,6 +1939,7 @@ static int setup_all_buffers(void)
 	int ret;
 
 	DO_OR_GOTO_ERR(topology_probe());
+	DO_OR_GOTO_ERR(allocate_msr_fds());
 	DO_OR_GOTO_ERR(allocate_counters(&thread_even, &core_even, &package_even));
 	DO_OR_GOTO_ERR(allocate_counters(&thread_odd, &core_odd, &package_odd));
 	DO_OR_GOTO_ERR(allocate_counters(&thread_delta, &core_delta, &package_delta));
@@ -1400,6 +1947,23 @@ static int setup_all_buffers(void)
 	DO_OR_GOTO_ERR(for_all_cpus(set_temperature_target, EVEN_COUNTERS));
 	DO_OR_GOTO_ERR(for_all_cpus(set_temperature_target, ODD_COUNTERS));
 
+#if HAVE_LINUX_PERF_EVENT_H
+	/* Both fall back to the MSRs on failure */
+	if (config_perf_events) {
+		(void)perf_open_thread_counters();
+		if (do_rapl)
+			(void)perf_open_rapl_counters();
+	}
+#else
+	if (config_perf_events)
+		WARNING("turbostat plugin: perf_event support was not compiled "
+			"in, reading the MSRs instead");
+#endif /* HAVE_LINUX_PERF_EVENT_H */
+
+	if (start_samplers() != 0)
+		WARNING("turbostat plugin: Sampling all CPUs from the read "
+			"thread instead");
+
 	allocated = 1;
 	return 0;
 err:
@@ -1428,16 +1992,9 @@ turbostat_read(void)
 		}
 	}
 
-	/* Saving the scheduling affinity, as it will be modified by get_counters */
-	if (sched_getaffinity(0, cpu_saved_affinity_setsize, cpu_saved_affinity_set) != 0) {
-		ERROR("turbostat plugin: Unable to save the CPU affinity");
-		return -1;
-	}
-
 	if (!initialized) {
-		if ((ret = for_all_cpus(get_counters, EVEN_COUNTERS)) < 0)
+		if ((ret = sample_all_cpus(EVEN_COUNTERS, &time_even)) < 0)
 			goto out;
-		time_even = cdtime();
 		is_even = 1;
 		initialized = 1;
 		ret = 0;
@@ -1445,9 +2002,8 @@ turbostat_read(void)
 	}
 
 	if (is_even) {
-		if ((ret = for_all_cpus(get_counters, ODD_COUNTERS)) < 0)
+		if ((ret = sample_all_cpus(ODD_COUNTERS, &time_odd)) < 0)
 			goto out;
-		time_odd = cdtime();
 		is_even = 0;
 		time_delta = time_odd - time_even;
 		if ((ret = for_all_cpus_delta(ODD_COUNTERS, EVEN_COUNTERS)) < 0)
@@ -1455,9 +2011,8 @@ turbostat_read(void)
 		if ((ret = for_all_cpus(submit_counters, DELTA_COUNTERS)) < 0)
 			goto out;
 	} else {
-		if ((ret = for_all_cpus(get_counters, EVEN_COUNTERS)) < 0)
+		if ((ret = sample_all_cpus(EVEN_COUNTERS, &time_even)) < 0)
 			goto out;
-		time_even = cdtime();
 		is_even = 1;
 		time_delta = time_even - time_odd;
 		if ((ret = for_all_cpus_delta(EVEN_COUNTERS, ODD_COUNTERS)) < 0)
@@ -1467,11 +2022,6 @@ turbostat_read(void)
 	}
 	ret = 0;
 out:
-	/*
-	 * Let's restore the affinity
-	 * This might fail if the number of CPU changed, but we can't do anything in that case..
-	 */
-	(void)sched_setaffinity(0, cpu_saved_affinity_setsize, cpu_saved_affinity_set);
 	return ret;
 }
 
@@ -1601,6 +2151,8 @@ turbostat_config(const char *key, const char *value)
 		}
 		config_rapl = (unsigned int) tmp_val;
 		apply_config_rapl = 1;
+	} else if (strcasecmp("PerfEvents", key) == 0) {
+		config_perf_events = IS_TRUE(value);
 	} else if (strcasecmp("TCCActivationTemp", key) == 0) {
 		tmp_val = strtoul(value, &end, 0);
 		if (*end != '\0' || tmp_val > UINT_MAX) {
@@ -1617,8 +2169,18 @@ turbostat_config(const char *key, const char *value)
 	return 0;
 }
 
+static int
+turbostat_shutdown(void)
+{
+	free_all_buffers();
+	free(topology.cpus);
+	topology.cpus = NULL;
+	return 0;
+}
+
 void module_register(void)
 {
 	plugin_register_init(PLUGIN_NAME, turbostat_init);
+	plugin_register_shutdown(PLUGIN_NAME, turbostat_shutdown);
 	plugin_register_config(PLUGIN_NAME, turbostat_config, config_keys, config_keys_num);
 }
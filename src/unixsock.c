@@ -33,6 +33,7 @@
 #include "utils_cmd_getval.h"
 #include "utils_cmd_getthreshold.h"
 #include "utils_cmd_listval.h"
+#include "utils_cmd_putbatch.h"
 #include "utils_cmd_putval.h"
 #include "utils_cmd_putnotif.h"
 
@@ -42,6 +43,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
+#include <poll.h>
 
 #include <grp.h>
 
@@ -50,6 +52,36 @@
 #endif
 
 #define US_DEFAULT_PATH LOCALSTATEDIR"/run/"PACKAGE_NAME"-unixsock"
+#define US_DEFAULT_WORKER_THREADS 4
+
+/* Longest command line accepted from a client. */
+#define US_LINE_MAX 16384
+#define US_OUTPUT_BUFFER_SIZE 65536
+/* Seconds a worker waits for a client to accept a response. */
+#define US_SEND_TIMEOUT 10
+
+/*
+ * Private data types
+ */
+struct us_client_s
+{
+	int    fd;
+	FILE  *fhout;
+	char   buffer[US_LINE_MAX];
+	size_t buffer_fill;
+
+	/* Set between "BATCH" and "END". */
+	putbatch_t *batch;
+	_Bool       in_batch;
+
+	/* Payload of a "PUTBIN" command that is being received. */
+	char  *binary;
+	size_t binary_size;
+	size_t binary_fill;
+
+	struct us_client_s *next;
+};
+typedef struct us_client_s us_client_t;
 
 /*
  * Private variables
@@ -60,7 +92,8 @@ static const char *config_keys[] =
 	"SocketFile",
 	"SocketGroup",
 	"SocketPerms",
-	"DeleteSocket"
+	"DeleteSocket",
+	"WorkerThreads"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -75,6 +108,22 @@ static _Bool delete_socket = 0;
 
 static pthread_t listen_thread = (pthread_t) 0;
 
+static int        worker_threads_num = US_DEFAULT_WORKER_THREADS;
+static pthread_t *worker_threads = NULL;
+static int        worker_threads_running = 0;
+
+/* Clients with pending input, waiting for a worker thread. */
+static us_client_t     *work_queue_head = NULL;
+static us_client_t     *work_queue_tail = NULL;
+static pthread_mutex_t  work_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   work_queue_cond = PTHREAD_COND_INITIALIZER;
+
+/* Clients handed back to the server thread by the workers. Writing to
+ * `wakeup_pipe' interrupts the server thread's poll(2). */
+static us_client_t     *idle_queue_head = NULL;
+static pthread_mutex_t  idle_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static int              wakeup_pipe[2] = { -1, -1 };
+
 /*
  * Functions
  */
@@ -180,171 +229,468 @@ static int us_open_socket (void)
 	return (0);
 } /* int us_open_socket */
 
-static void *us_handle_client (void *arg)
+static us_client_t *us_client_create (int fd) /* {{{ */
 {
-	int fdin;
+	us_client_t *client;
+	struct timeval tv;
 	int fdout;
-	FILE *fhin, *fhout;
 
-	fdin = *((int *) arg);
-	free (arg);
-	arg = NULL;
-
-	DEBUG ("unixsock plugin: us_handle_client: Reading from fd #%i", fdin);
-
-	fdout = dup (fdin);
+	client = malloc (sizeof (*client));
+	if (client == NULL)
+	{
+		ERROR ("unixsock plugin: malloc failed.");
+		return (NULL);
+	}
+	memset (client, 0, sizeof (*client));
+	client->fd = fd;
+	client->buffer_fill = 0;
+	client->next = NULL;
+
+	/* A client that doesn't read its responses must not occupy a worker
+	 * thread forever. */
+	tv.tv_sec = US_SEND_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+
+	fdout = dup (fd);
 	if (fdout < 0)
 	{
 		char errbuf[1024];
 		ERROR ("unixsock plugin: dup failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		close (fdin);
-		pthread_exit ((void *) 1);
+		sfree (client);
+		return (NULL);
 	}
 
-	fhin  = fdopen (fdin, "r");
-	if (fhin == NULL)
+	/* Responses are collected in the stdio buffer and written once all
+	 * pending commands of a client have been handled. */
+	client->fhout = fdopen (fdout, "w");
+	if (client->fhout == NULL)
 	{
 		char errbuf[1024];
 		ERROR ("unixsock plugin: fdopen failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		close (fdin);
 		close (fdout);
-		pthread_exit ((void *) 1);
-		return ((void *) 1);
+		sfree (client);
+		return (NULL);
 	}
+	setvbuf (client->fhout, NULL, _IOFBF, US_OUTPUT_BUFFER_SIZE);
+
+	return (client);
+} /* }}} us_client_t *us_client_create */
+
+static void us_client_destroy (us_client_t *client) /* {{{ */
+{
+	if (client == NULL)
+		return;
+
+	DEBUG ("unixsock plugin: Closing connection on fd #%i", client->fd);
 
-	fhout = fdopen (fdout, "w");
-	if (fhout == NULL)
+	putbatch_destroy (client->batch);
+	sfree (client->binary);
+	fclose (client->fhout);
+	close (client->fd);
+	sfree (client);
+} /* }}} void us_client_destroy */
+
+static putbatch_t *us_client_batch (us_client_t *client) /* {{{ */
+{
+	if (client->batch == NULL)
+		client->batch = putbatch_create ();
+	if (client->batch == NULL)
+		fprintf (client->fhout, "-1 Out of memory.\n");
+
+	return (client->batch);
+} /* }}} putbatch_t *us_client_batch */
+
+/* Handles one command line. Returns non-zero if the connection should be
+ * closed. */
+static int us_handle_command (us_client_t *client, char *buffer) /* {{{ */
+{
+	FILE *fhout = client->fhout;
+	char buffer_copy[US_LINE_MAX];
+	char *fields[128];
+	int   fields_num;
+
+	/* Within a batch, PUTVAL lines are collected without a response. */
+	if (client->in_batch)
 	{
-		char errbuf[1024];
-		ERROR ("unixsock plugin: fdopen failed: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (fhin); /* this closes fdin as well */
-		close (fdout);
-		pthread_exit ((void *) 1);
-		return ((void *) 1);
+		if (strcasecmp ("END", buffer) == 0)
+		{
+			client->in_batch = 0;
+			handle_putbatch_end (fhout, client->batch);
+		}
+		else
+			putbatch_add_line (client->batch, buffer);
+		return (0);
 	}
 
-	/* change output buffer to line buffered mode */
-	if (setvbuf (fhout, NULL, _IOLBF, 0) != 0)
+	sstrncpy (buffer_copy, buffer, sizeof (buffer_copy));
+
+	fields_num = strsplit (buffer_copy, fields,
+			sizeof (fields) / sizeof (fields[0]));
+	if (fields_num < 1)
 	{
-		char errbuf[1024];
-		ERROR ("unixsock plugin: setvbuf failed: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (fhin);
-		fclose (fhout);
-		pthread_exit ((void *) 1);
-		return ((void *) 0);
+		fprintf (fhout, "-1 Internal error\n");
+		return (-1);
 	}
 
-	while (42)
+	if (strcasecmp (fields[0], "getval") == 0)
 	{
-		char buffer[1024];
-		char buffer_copy[1024];
-		char *fields[128];
-		int   fields_num;
-		int   len;
+		handle_getval (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "getthreshold") == 0)
+	{
+		handle_getthreshold (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "putval") == 0)
+	{
+		handle_putval (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "batch") == 0)
+	{
+		if (us_client_batch (client) == NULL)
+			return (-1);
+		client->in_batch = 1;
+	}
+	else if (strcasecmp (fields[0], "putbin") == 0)
+	{
+		size_t size = 0;
 
-		errno = 0;
-		if (fgets (buffer, sizeof (buffer), fhin) == NULL)
-		{
-			if ((errno == EINTR) || (errno == EAGAIN))
-				continue;
+		if (us_client_batch (client) == NULL)
+			return (-1);
+		/* Without a valid size the payload can't be skipped. */
+		if (handle_putbin (fhout, buffer, &size) != 0)
+			return (-1);
 
-			if (errno != 0)
-			{
-				char errbuf[1024];
-				WARNING ("unixsock plugin: failed to read from socket #%i: %s",
-						fileno (fhin),
-						sstrerror (errno, errbuf, sizeof (errbuf)));
-			}
-			break;
+		client->binary = malloc (size);
+		if (client->binary == NULL)
+		{
+			fprintf (fhout, "-1 Out of memory.\n");
+			return (-1);
+		}
+		client->binary_size = size;
+		client->binary_fill = 0;
+	}
+	else if (strcasecmp (fields[0], "listval") == 0)
+	{
+		handle_listval (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "putnotif") == 0)
+	{
+		handle_putnotif (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "flush") == 0)
+	{
+		handle_flush (fhout, buffer);
+	}
+	else
+	{
+		if (fprintf (fhout, "-1 Unknown command: %s\n", fields[0]) < 0)
+		{
+			char errbuf[1024];
+			WARNING ("unixsock plugin: failed to write to socket #%i: %s",
+					fileno (fhout),
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
 		}
+	}
 
-		len = strlen (buffer);
-		while ((len > 0)
-				&& ((buffer[len - 1] == '\n') || (buffer[len - 1] == '\r')))
-			buffer[--len] = '\0';
+	return (0);
+} /* }}} int us_handle_command */
 
-		if (len == 0)
-			continue;
+/* Called once the payload of a PUTBIN command has been received
+ * completely. */
+static void us_handle_binary (us_client_t *client) /* {{{ */
+{
+	putbatch_add_binary (client->batch, client->binary, client->binary_size);
+	handle_putbatch_end (client->fhout, client->batch);
 
-		sstrncpy (buffer_copy, buffer, sizeof (buffer_copy));
+	sfree (client->binary);
+	client->binary_size = 0;
+	client->binary_fill = 0;
+} /* }}} void us_handle_binary */
 
-		fields_num = strsplit (buffer_copy, fields,
-				sizeof (fields) / sizeof (fields[0]));
-		if (fields_num < 1)
-		{
-			fprintf (fhout, "-1 Internal error\n");
-			fclose (fhin);
-			fclose (fhout);
-			pthread_exit ((void *) 1);
-			return ((void *) 1);
-		}
+/* Handles all complete lines and binary payloads in the client's input
+ * buffer and removes them from the buffer. */
+static int us_process_input (us_client_t *client) /* {{{ */
+{
+	size_t start = 0;
+	int status = 0;
 
-		if (strcasecmp (fields[0], "getval") == 0)
+	while ((status == 0) && (start < client->buffer_fill))
+	{
+		char *line;
+		char *newline;
+		size_t end;
+
+		if (client->binary != NULL)
 		{
-			handle_getval (fhout, buffer);
+			size_t len = client->binary_size - client->binary_fill;
+
+			if (len > (client->buffer_fill - start))
+				len = client->buffer_fill - start;
+
+			memcpy (client->binary + client->binary_fill,
+					client->buffer + start, len);
+			client->binary_fill += len;
+			start += len;
+
+			if (client->binary_fill == client->binary_size)
+				us_handle_binary (client);
+			continue;
 		}
-		else if (strcasecmp (fields[0], "getthreshold") == 0)
+
+		line = client->buffer + start;
+		newline = memchr (line, '\n', client->buffer_fill - start);
+		if (newline == NULL)
+			break;
+
+		end = (size_t) (newline - line);
+		start += end + 1;
+
+		while ((end > 0) && (line[end - 1] == '\r'))
+			end--;
+		line[end] = 0;
+
+		if (end > 0)
+			status = us_handle_command (client, line);
+	}
+
+	memmove (client->buffer, client->buffer + start,
+			client->buffer_fill - start);
+	client->buffer_fill -= start;
+
+	if ((status == 0) && (client->binary == NULL)
+			&& (client->buffer_fill == sizeof (client->buffer)))
+	{
+		fprintf (client->fhout, "-1 Line too long\n");
+		status = -1;
+	}
+
+	return (status);
+} /* }}} int us_process_input */
+
+/* Reads everything the client has sent so far without blocking, handles all
+ * complete commands and writes the responses in one go. Returns non-zero if
+ * the connection has been closed or has to be closed. */
+static int us_handle_client (us_client_t *client) /* {{{ */
+{
+	int status = 0;
+
+	while (status == 0)
+	{
+		ssize_t len;
+
+		/* Large binary payloads are received directly into their
+		 * destination. */
+		if ((client->binary != NULL) && (client->buffer_fill == 0))
+			len = recv (client->fd, client->binary + client->binary_fill,
+					client->binary_size - client->binary_fill, MSG_DONTWAIT);
+		else
+			len = recv (client->fd, client->buffer + client->buffer_fill,
+					sizeof (client->buffer) - client->buffer_fill,
+					MSG_DONTWAIT);
+		if (len < 0)
 		{
-			handle_getthreshold (fhout, buffer);
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+
+			WARNING ("unixsock plugin: failed to read from socket #%i: %s",
+					client->fd,
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			status = -1;
+			break;
 		}
-		else if (strcasecmp (fields[0], "putval") == 0)
+		else if (len == 0) /* connection closed by the client */
 		{
-			handle_putval (fhout, buffer);
+			status = -1;
+			break;
 		}
-		else if (strcasecmp (fields[0], "listval") == 0)
+
+		if ((client->binary != NULL) && (client->buffer_fill == 0))
 		{
-			handle_listval (fhout, buffer);
+			client->binary_fill += (size_t) len;
+			if (client->binary_fill == client->binary_size)
+				us_handle_binary (client);
+			continue;
 		}
-		else if (strcasecmp (fields[0], "putnotif") == 0)
+
+		client->buffer_fill += (size_t) len;
+		status = us_process_input (client);
+	}
+
+	if (fflush (client->fhout) != 0)
+	{
+		char errbuf[1024];
+		WARNING ("unixsock plugin: failed to write to socket #%i: %s",
+				client->fd, sstrerror (errno, errbuf, sizeof (errbuf)));
+		status = -1;
+	}
+
+	return (status);
+} /* }}} int us_handle_client */
+
+static void *us_worker_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+	while (42)
+	{
+		us_client_t *client;
+
+		pthread_mutex_lock (&work_queue_lock);
+		while ((loop != 0) && (work_queue_head == NULL))
+			pthread_cond_wait (&work_queue_cond, &work_queue_lock);
+
+		client = work_queue_head;
+		if (client != NULL)
 		{
-			handle_putnotif (fhout, buffer);
+			work_queue_head = client->next;
+			if (work_queue_head == NULL)
+				work_queue_tail = NULL;
+			client->next = NULL;
 		}
-		else if (strcasecmp (fields[0], "flush") == 0)
+		pthread_mutex_unlock (&work_queue_lock);
+
+		if (client == NULL) /* shutting down */
+			break;
+
+		if (us_handle_client (client) != 0)
 		{
-			handle_flush (fhout, buffer);
+			us_client_destroy (client);
+			continue;
 		}
-		else
+
+		/* Hand the client back to the server thread, which waits for more
+		 * input on it. */
+		pthread_mutex_lock (&idle_queue_lock);
+		client->next = idle_queue_head;
+		idle_queue_head = client;
+		pthread_mutex_unlock (&idle_queue_lock);
+
+		if (write (wakeup_pipe[1], "", 1) < 0)
 		{
-			if (fprintf (fhout, "-1 Unknown command: %s\n", fields[0]) < 0)
+			/* EAGAIN: The pipe is full, i.e. the server thread will wake
+			 * up anyway. */
+			if (errno != EAGAIN)
 			{
 				char errbuf[1024];
-				WARNING ("unixsock plugin: failed to write to socket #%i: %s",
-						fileno (fhout),
+				ERROR ("unixsock plugin: write to wakeup pipe failed: %s",
 						sstrerror (errno, errbuf, sizeof (errbuf)));
-				break;
 			}
 		}
-	} /* while (fgets) */
+	} /* while (42) */
 
-	DEBUG ("unixsock plugin: us_handle_client: Exiting..");
-	fclose (fhin);
-	fclose (fhout);
-
-	pthread_exit ((void *) 0);
 	return ((void *) 0);
-} /* void *us_handle_client */
+} /* }}} void *us_worker_thread */
+
+static void us_work_queue_append (us_client_t *client) /* {{{ */
+{
+	client->next = NULL;
 
-static void *us_server_thread (void __attribute__((unused)) *arg)
+	pthread_mutex_lock (&work_queue_lock);
+	if (work_queue_tail == NULL)
+		work_queue_head = client;
+	else
+		work_queue_tail->next = client;
+	work_queue_tail = client;
+	pthread_cond_signal (&work_queue_cond);
+	pthread_mutex_unlock (&work_queue_lock);
+} /* }}} void us_work_queue_append */
+
+/* Makes room for at least one more idle client in "clients" and "pollfd".
+ * Both arrays grow by doubling; "pollfd" has two more entries, for the
+ * listening socket and the wakeup pipe. */
+static int us_clients_reserve (us_client_t ***clients, /* {{{ */
+		struct pollfd **pollfd, size_t clients_num, size_t *clients_size)
 {
-	int  status;
-	int *remote_fd;
-	pthread_t th;
-	pthread_attr_t th_attr;
+	us_client_t **tmp_clients;
+	struct pollfd *tmp_pollfd;
+	size_t new_size;
+
+	if (clients_num < *clients_size)
+		return (0);
+
+	new_size = (*clients_size == 0) ? 16 : 2 * *clients_size;
+
+	tmp_clients = realloc (*clients, sizeof (**clients) * new_size);
+	if (tmp_clients == NULL)
+		return (ENOMEM);
+	*clients = tmp_clients;
+
+	tmp_pollfd = realloc (*pollfd, sizeof (**pollfd) * (new_size + 2));
+	if (tmp_pollfd == NULL)
+		return (ENOMEM);
+	*pollfd = tmp_pollfd;
+
+	*clients_size = new_size;
+	return (0);
+} /* }}} int us_clients_reserve */
 
-	pthread_attr_init (&th_attr);
-	pthread_attr_setdetachstate (&th_attr, PTHREAD_CREATE_DETACHED);
+/* The server thread accepts connections and polls all idle connections.
+ * Connections with pending input are passed to the worker threads, which
+ * hand them back when all input has been processed. */
+static void *us_server_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+	/* "pollfd[i + 2]" belongs to "clients[i]". */
+	us_client_t **clients = NULL;
+	size_t clients_num = 0;
+	size_t clients_size = 0;
+	struct pollfd *pollfd = NULL;
+	size_t i;
+	int status;
 
 	if (us_open_socket () != 0)
 		pthread_exit ((void *) 1);
 
+	if (us_clients_reserve (&clients, &pollfd, 0, &clients_size) != 0)
+	{
+		ERROR ("unixsock plugin: malloc failed.");
+		pthread_exit ((void *) 1);
+	}
+	memset (pollfd, 0, 2 * sizeof (*pollfd));
+	pollfd[0].fd = sock_fd;
+	pollfd[0].events = POLLIN;
+	pollfd[1].fd = wakeup_pipe[0];
+	pollfd[1].events = POLLIN;
+
 	while (loop != 0)
 	{
-		DEBUG ("unixsock plugin: Calling accept..");
-		status = accept (sock_fd, NULL, NULL);
+		us_client_t *idle;
+		size_t polled_num;
+
+		pthread_mutex_lock (&idle_queue_lock);
+		idle = idle_queue_head;
+		idle_queue_head = NULL;
+		pthread_mutex_unlock (&idle_queue_lock);
+
+		while (idle != NULL)
+		{
+			us_client_t *next = idle->next;
+
+			if (us_clients_reserve (&clients, &pollfd, clients_num,
+						&clients_size) != 0)
+			{
+				ERROR ("unixsock plugin: realloc failed.");
+				us_client_destroy (idle);
+				idle = next;
+				continue;
+			}
+
+			idle->next = NULL;
+			clients[clients_num] = idle;
+			pollfd[clients_num + 2].fd = idle->fd;
+			pollfd[clients_num + 2].events = POLLIN;
+			pollfd[clients_num + 2].revents = 0;
+			clients_num++;
+			idle = next;
+		}
+		polled_num = clients_num;
+
+		status = poll (pollfd, (nfds_t) (polled_num + 2), -1);
 		if (status < 0)
 		{
 			char errbuf[1024];
@@ -352,43 +698,74 @@ static void *us_server_thread (void __attribute__((unused)) *arg)
 			if (errno == EINTR)
 				continue;
 
-			ERROR ("unixsock plugin: accept failed: %s",
+			ERROR ("unixsock plugin: poll failed: %s",
 					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (sock_fd);
-			sock_fd = -1;
-			pthread_attr_destroy (&th_attr);
-			pthread_exit ((void *) 1);
+			break;
 		}
 
-		remote_fd = (int *) malloc (sizeof (int));
-		if (remote_fd == NULL)
+		if (pollfd[1].revents != 0)
 		{
-			char errbuf[1024];
-			WARNING ("unixsock plugin: malloc failed: %s",
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (status);
-			continue;
+			char drain[64];
+			while (read (wakeup_pipe[0], drain, sizeof (drain)) > 0)
+				/* do nothing */;
 		}
-		*remote_fd = status;
 
-		DEBUG ("Spawning child to handle connection on fd #%i", *remote_fd);
+		/* Pass connections with pending input (or EOF) to the workers and
+		 * close the gaps they leave in both arrays. */
+		clients_num = 0;
+		for (i = 0; i < polled_num; i++)
+		{
+			if (pollfd[i + 2].revents != 0)
+			{
+				us_work_queue_append (clients[i]);
+				continue;
+			}
 
-		status = plugin_thread_create (&th, &th_attr,
-				us_handle_client, (void *) remote_fd);
-		if (status != 0)
+			if (clients_num != i)
+			{
+				clients[clients_num] = clients[i];
+				pollfd[clients_num + 2] = pollfd[i + 2];
+			}
+			clients_num++;
+		}
+
+		if (pollfd[0].revents != 0)
 		{
-			char errbuf[1024];
-			WARNING ("unixsock plugin: pthread_create failed: %s",
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (*remote_fd);
-			free (remote_fd);
-			continue;
+			us_client_t *client;
+
+			DEBUG ("unixsock plugin: Calling accept..");
+			status = accept (sock_fd, NULL, NULL);
+			if (status < 0)
+			{
+				char errbuf[1024];
+
+				if (errno == EINTR)
+					continue;
+
+				ERROR ("unixsock plugin: accept failed: %s",
+						sstrerror (errno, errbuf, sizeof (errbuf)));
+				break;
+			}
+
+			client = us_client_create (status);
+			if (client == NULL)
+			{
+				close (status);
+				continue;
+			}
+
+			/* Most clients send their command right away. */
+			us_work_queue_append (client);
 		}
 	} /* while (loop) */
 
+	for (i = 0; i < clients_num; i++)
+		us_client_destroy (clients[i]);
+	sfree (clients);
+	sfree (pollfd);
+
 	close (sock_fd);
 	sock_fd = -1;
-	pthread_attr_destroy (&th_attr);
 
 	status = unlink ((sock_file != NULL) ? sock_file : US_DEFAULT_PATH);
 	if (status != 0)
@@ -400,7 +777,7 @@ static void *us_server_thread (void __attribute__((unused)) *arg)
 	}
 
 	return ((void *) 0);
-} /* void *us_server_thread */
+} /* }}} void *us_server_thread */
 
 static int us_config (const char *key, const char *val)
 {
@@ -433,6 +810,16 @@ static int us_config (const char *key, const char *val)
 		else
 			delete_socket = 0;
 	}
+	else if (strcasecmp (key, "WorkerThreads") == 0)
+	{
+		int tmp = atoi (val);
+		if (tmp < 1)
+		{
+			WARNING ("unixsock plugin: `WorkerThreads' must be at least 1.");
+			return (1);
+		}
+		worker_threads_num = tmp;
+	}
 	else
 	{
 		return (-1);
@@ -446,6 +833,7 @@ static int us_init (void)
 	static int have_init = 0;
 
 	int status;
+	int i;
 
 	/* Initialize only once. */
 	if (have_init != 0)
@@ -454,6 +842,40 @@ static int us_init (void)
 
 	loop = 1;
 
+	if (pipe (wakeup_pipe) != 0)
+	{
+		char errbuf[1024];
+		ERROR ("unixsock plugin: pipe failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+	fcntl (wakeup_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl (wakeup_pipe[1], F_SETFL, O_NONBLOCK);
+
+	worker_threads = calloc ((size_t) worker_threads_num,
+			sizeof (*worker_threads));
+	if (worker_threads == NULL)
+	{
+		ERROR ("unixsock plugin: calloc failed.");
+		return (-1);
+	}
+
+	for (i = 0; i < worker_threads_num; i++)
+	{
+		status = plugin_thread_create (&worker_threads[i], NULL,
+				us_worker_thread, NULL);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("unixsock plugin: pthread_create failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
+		worker_threads_running++;
+	}
+	if (worker_threads_running == 0)
+		return (-1);
+
 	status = plugin_thread_create (&listen_thread, NULL,
 			us_server_thread, NULL);
 	if (status != 0)
@@ -470,16 +892,56 @@ static int us_init (void)
 static int us_shutdown (void)
 {
 	void *ret;
+	int i;
 
 	loop = 0;
 
 	if (listen_thread != (pthread_t) 0)
 	{
-		pthread_kill (listen_thread, SIGTERM);
+		/* Wakes the server thread up, which then sees that "loop" has been
+		 * cleared. */
+		if (write (wakeup_pipe[1], "", 1) < 0)
+		{
+			char errbuf[1024];
+			if (errno != EAGAIN)
+				ERROR ("unixsock plugin: write to wakeup pipe failed: %s",
+						sstrerror (errno, errbuf, sizeof (errbuf)));
+		}
 		pthread_join (listen_thread, &ret);
 		listen_thread = (pthread_t) 0;
 	}
 
+	pthread_mutex_lock (&work_queue_lock);
+	pthread_cond_broadcast (&work_queue_cond);
+	pthread_mutex_unlock (&work_queue_lock);
+
+	for (i = 0; i < worker_threads_running; i++)
+		pthread_join (worker_threads[i], &ret);
+	worker_threads_running = 0;
+	sfree (worker_threads);
+
+	while (work_queue_head != NULL)
+	{
+		us_client_t *next = work_queue_head->next;
+		us_client_destroy (work_queue_head);
+		work_queue_head = next;
+	}
+	work_queue_tail = NULL;
+
+	while (idle_queue_head != NULL)
+	{
+		us_client_t *next = idle_queue_head->next;
+		us_client_destroy (idle_queue_head);
+		idle_queue_head = next;
+	}
+
+	if (wakeup_pipe[0] >= 0)
+	{
+		close (wakeup_pipe[0]);
+		close (wakeup_pipe[1]);
+		wakeup_pipe[0] = wakeup_pipe[1] = -1;
+	}
+
 	plugin_unregister_init ("unixsock");
 	plugin_unregister_shutdown ("unixsock");
 
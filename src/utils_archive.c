@@ -0,0 +1,897 @@
+/**
+ * collectd - src/utils_archive.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+#include "collectd.h"
+#include "plugin.h"
+#include "utils_archive.h"
+
+#include <sys/mman.h>
+
+#define ARCHIVE_FILE_MAGIC "CDARCHV1"
+#define ARCHIVE_FILE_VERSION 1
+#define ARCHIVE_BLOCK_MAGIC 0x42414443 /* "CDAB" */
+
+/* Upper bound of the bits needed for one point. */
+#define ARCHIVE_POINT_MAX_BITS 160
+
+#define PAD8(n) (((n) + 7) & ~((size_t) 7))
+
+struct archive_file_s
+{
+  const uint8_t *map;
+  size_t size;
+};
+
+/*
+ * Little-endian (de)serialization
+ */
+static void put_u16 (uint8_t *p, uint16_t v) /* {{{ */
+{
+  p[0] = (uint8_t) v;
+  p[1] = (uint8_t) (v >> 8);
+} /* }}} void put_u16 */
+
+static void put_u32 (uint8_t *p, uint32_t v) /* {{{ */
+{
+  int i;
+  for (i = 0; i < 4; i++)
+    p[i] = (uint8_t) (v >> (8 * i));
+} /* }}} void put_u32 */
+
+static void put_u64 (uint8_t *p, uint64_t v) /* {{{ */
+{
+  int i;
+  for (i = 0; i < 8; i++)
+    p[i] = (uint8_t) (v >> (8 * i));
+} /* }}} void put_u64 */
+
+static uint16_t get_u16 (const uint8_t *p) /* {{{ */
+{
+  return ((uint16_t) (p[0] | (p[1] << 8)));
+} /* }}} uint16_t get_u16 */
+
+static uint32_t get_u32 (const uint8_t *p) /* {{{ */
+{
+  uint32_t v = 0;
+  int i;
+  for (i = 3; i >= 0; i--)
+    v = (v << 8) | p[i];
+  return (v);
+} /* }}} uint32_t get_u32 */
+
+static uint64_t get_u64 (const uint8_t *p) /* {{{ */
+{
+  uint64_t v = 0;
+  int i;
+  for (i = 7; i >= 0; i--)
+    v = (v << 8) | p[i];
+  return (v);
+} /* }}} uint64_t get_u64 */
+
+/* FNV-1a */
+static uint32_t archive_checksum (const uint8_t *data, size_t size) /* {{{ */
+{
+  uint32_t hash = 2166136261U;
+  size_t i;
+
+  for (i = 0; i < size; i++)
+  {
+    hash ^= data[i];
+    hash *= 16777619U;
+  }
+
+  return (hash);
+} /* }}} uint32_t archive_checksum */
+
+static int count_leading_zeros (uint64_t x) /* {{{ */
+{
+#if defined(__GNUC__)
+  return (__builtin_clzll (x));
+#else
+  int n = 0;
+  while ((x & (((uint64_t) 1) << 63)) == 0)
+  {
+    x <<= 1;
+    n++;
+  }
+  return (n);
+#endif
+} /* }}} int count_leading_zeros */
+
+static int count_trailing_zeros (uint64_t x) /* {{{ */
+{
+#if defined(__GNUC__)
+  return (__builtin_ctzll (x));
+#else
+  int n = 0;
+  while ((x & 1) == 0)
+  {
+    x >>= 1;
+    n++;
+  }
+  return (n);
+#endif
+} /* }}} int count_trailing_zeros */
+
+/*
+ * Bit streams
+ */
+/* Writes the "n" least significant bits of "value", most significant first.
+ * The buffer must be zeroed and large enough. */
+static void bits_write (uint8_t *data, uint64_t *pos, /* {{{ */
+    uint64_t value, int n)
+{
+  while (n > 0)
+  {
+    size_t idx = (size_t) (*pos >> 3);
+    int avail = 8 - (int) (*pos & 7);
+    int k = (n < avail) ? n : avail;
+    uint8_t chunk = (uint8_t) ((value >> (n - k)) & ((1U << k) - 1));
+
+    data[idx] |= (uint8_t) (chunk << (avail - k));
+    *pos += (uint64_t) k;
+    n -= k;
+  }
+} /* }}} void bits_write */
+
+static int bits_read (const uint8_t *data, uint64_t bits, /* {{{ */
+    uint64_t *pos, int n, uint64_t *ret_value)
+{
+  uint64_t value = 0;
+
+  if ((*pos + (uint64_t) n) > bits)
+    return (-1);
+
+  while (n > 0)
+  {
+    size_t idx = (size_t) (*pos >> 3);
+    int avail = 8 - (int) (*pos & 7);
+    int k = (n < avail) ? n : avail;
+    uint8_t chunk = (uint8_t) ((data[idx] >> (avail - k)) & ((1U << k) - 1));
+
+    value = (value << k) | chunk;
+    *pos += (uint64_t) k;
+    n -= k;
+  }
+
+  *ret_value = value;
+  return (0);
+} /* }}} int bits_read */
+
+static _Bool fits_signed (int64_t v, int n) /* {{{ */
+{
+  int64_t limit = ((int64_t) 1) << (n - 1);
+  return ((v >= -limit) && (v < limit));
+} /* }}} _Bool fits_signed */
+
+/* Delta of deltas: "0" for zero, otherwise a prefix of up to four bits
+ * selecting a 16, 24, 32 or 64 bit two's complement number. */
+static void dod_write (uint8_t *data, uint64_t *pos, uint64_t dod) /* {{{ */
+{
+  int64_t v = (int64_t) dod;
+
+  if (v == 0)
+    bits_write (data, pos, 0x0, 1);
+  else if (fits_signed (v, 16))
+  {
+    bits_write (data, pos, 0x2, 2);
+    bits_write (data, pos, dod, 16);
+  }
+  else if (fits_signed (v, 24))
+  {
+    bits_write (data, pos, 0x6, 3);
+    bits_write (data, pos, dod, 24);
+  }
+  else if (fits_signed (v, 32))
+  {
+    bits_write (data, pos, 0xe, 4);
+    bits_write (data, pos, dod, 32);
+  }
+  else
+  {
+    bits_write (data, pos, 0xf, 4);
+    bits_write (data, pos, dod, 64);
+  }
+} /* }}} void dod_write */
+
+static int dod_read (const uint8_t *data, uint64_t bits, /* {{{ */
+    uint64_t *pos, uint64_t *ret_dod)
+{
+  static const int widths[] = { 0, 16, 24, 32, 64 };
+  uint64_t bit;
+  uint64_t value;
+  int ones = 0;
+
+  while (ones < 4)
+  {
+    if (bits_read (data, bits, pos, 1, &bit) != 0)
+      return (-1);
+    if (bit == 0)
+      break;
+    ones++;
+  }
+
+  if (ones == 0)
+  {
+    *ret_dod = 0;
+    return (0);
+  }
+
+  if (bits_read (data, bits, pos, widths[ones], &value) != 0)
+    return (-1);
+
+  /* sign extension */
+  if ((widths[ones] < 64) && ((value >> (widths[ones] - 1)) & 1))
+    value |= ~((uint64_t) 0) << widths[ones];
+
+  *ret_dod = value;
+  return (0);
+} /* }}} int dod_read */
+
+static uint64_t value_to_raw (int ds_type, value_t v) /* {{{ */
+{
+  uint64_t raw = 0;
+
+  if (ds_type == DS_TYPE_GAUGE)
+    memcpy (&raw, &v.gauge, sizeof (raw));
+  else if (ds_type == DS_TYPE_COUNTER)
+    raw = (uint64_t) v.counter;
+  else if (ds_type == DS_TYPE_DERIVE)
+    raw = (uint64_t) v.derive;
+  else if (ds_type == DS_TYPE_ABSOLUTE)
+    raw = (uint64_t) v.absolute;
+
+  return (raw);
+} /* }}} uint64_t value_to_raw */
+
+static value_t raw_to_value (int ds_type, uint64_t raw) /* {{{ */
+{
+  value_t v;
+
+  memset (&v, 0, sizeof (v));
+  if (ds_type == DS_TYPE_GAUGE)
+    memcpy (&v.gauge, &raw, sizeof (raw));
+  else if (ds_type == DS_TYPE_COUNTER)
+    v.counter = (counter_t) raw;
+  else if (ds_type == DS_TYPE_DERIVE)
+    v.derive = (derive_t) raw;
+  else if (ds_type == DS_TYPE_ABSOLUTE)
+    v.absolute = (absolute_t) raw;
+
+  return (v);
+} /* }}} value_t raw_to_value */
+
+static _Bool ds_type_valid (int ds_type) /* {{{ */
+{
+  return ((ds_type == DS_TYPE_COUNTER) || (ds_type == DS_TYPE_GAUGE)
+      || (ds_type == DS_TYPE_DERIVE) || (ds_type == DS_TYPE_ABSOLUTE));
+} /* }}} _Bool ds_type_valid */
+
+/*
+ * Encoder
+ */
+void archive_encoder_init (archive_encoder_t *e, int ds_type) /* {{{ */
+{
+  memset (e, 0, sizeof (*e));
+  e->ds_type = ds_type;
+  e->leading = -1;
+} /* }}} void archive_encoder_init */
+
+void archive_encoder_reset (archive_encoder_t *e) /* {{{ */
+{
+  size_t used = archive_encoder_size (e);
+
+  if (e->data != NULL)
+    memset (e->data, 0, used);
+  e->bits = 0;
+  e->points_num = 0;
+  e->time_first = 0;
+  e->time_last = 0;
+  e->time_delta = 0;
+  e->value_last = 0;
+  e->value_delta = 0;
+  e->leading = -1;
+  e->trailing = 0;
+} /* }}} void archive_encoder_reset */
+
+void archive_encoder_free (archive_encoder_t *e) /* {{{ */
+{
+  if (e == NULL)
+    return;
+
+  free (e->data);
+  e->data = NULL;
+  e->data_size = 0;
+  archive_encoder_reset (e);
+} /* }}} void archive_encoder_free */
+
+size_t archive_encoder_size (archive_encoder_t const *e) /* {{{ */
+{
+  return ((size_t) ((e->bits + 7) / 8));
+} /* }}} size_t archive_encoder_size */
+
+static int archive_encoder_reserve (archive_encoder_t *e) /* {{{ */
+{
+  size_t need = (size_t) ((e->bits + ARCHIVE_POINT_MAX_BITS + 7) / 8);
+  size_t new_size;
+  uint8_t *tmp;
+
+  if (need <= e->data_size)
+    return (0);
+
+  new_size = (e->data_size > 0) ? e->data_size : 64;
+  while (new_size < need)
+    new_size *= 2;
+
+  tmp = realloc (e->data, new_size);
+  if (tmp == NULL)
+    return (ENOMEM);
+  memset (tmp + e->data_size, 0, new_size - e->data_size);
+
+  e->data = tmp;
+  e->data_size = new_size;
+  return (0);
+} /* }}} int archive_encoder_reserve */
+
+static void archive_encoder_add_gauge (archive_encoder_t *e, /* {{{ */
+    uint64_t raw)
+{
+  uint64_t x = raw ^ e->value_last;
+  int leading;
+  int trailing;
+  int sig;
+
+  if (x == 0)
+  {
+    bits_write (e->data, &e->bits, 0x0, 1);
+    return;
+  }
+
+  leading = count_leading_zeros (x);
+  trailing = count_trailing_zeros (x);
+  if (leading > 31)
+    leading = 31;
+
+  /* The meaningful bits fit into the window of the previous value. */
+  if ((e->leading >= 0) && (leading >= e->leading)
+      && (trailing >= e->trailing))
+  {
+    sig = 64 - e->leading - e->trailing;
+    bits_write (e->data, &e->bits, 0x2, 2);
+    bits_write (e->data, &e->bits, x >> e->trailing, sig);
+    return;
+  }
+
+  sig = 64 - leading - trailing;
+  bits_write (e->data, &e->bits, 0x3, 2);
+  bits_write (e->data, &e->bits, (uint64_t) leading, 5);
+  bits_write (e->data, &e->bits, (uint64_t) ((sig == 64) ? 0 : sig), 6);
+  bits_write (e->data, &e->bits, x >> trailing, sig);
+
+  e->leading = leading;
+  e->trailing = trailing;
+} /* }}} void archive_encoder_add_gauge */
+
+int archive_encoder_add (archive_encoder_t *e, cdtime_t t, value_t v) /* {{{ */
+{
+  uint64_t raw;
+  int status;
+
+  if ((e == NULL) || !ds_type_valid (e->ds_type))
+    return (EINVAL);
+  if ((e->points_num > 0) && (t < e->time_last))
+    return (EINVAL);
+  if (e->points_num == UINT32_MAX)
+    return (ENOMEM);
+
+  status = archive_encoder_reserve (e);
+  if (status != 0)
+    return (status);
+
+  raw = value_to_raw (e->ds_type, v);
+
+  if (e->points_num == 0)
+  {
+    bits_write (e->data, &e->bits, (uint64_t) t, 64);
+    bits_write (e->data, &e->bits, raw, 64);
+    e->time_first = t;
+  }
+  else
+  {
+    uint64_t delta = (uint64_t) (t - e->time_last);
+
+    dod_write (e->data, &e->bits, delta - e->time_delta);
+    e->time_delta = delta;
+
+    if (e->ds_type == DS_TYPE_GAUGE)
+      archive_encoder_add_gauge (e, raw);
+    else
+    {
+      delta = raw - e->value_last;
+      dod_write (e->data, &e->bits, delta - e->value_delta);
+      e->value_delta = delta;
+    }
+  }
+
+  e->time_last = t;
+  e->value_last = raw;
+  e->points_num++;
+
+  return (0);
+} /* }}} int archive_encoder_add */
+
+/*
+ * Decoder
+ */
+void archive_decoder_init (archive_decoder_t *d, /* {{{ */
+    archive_series_t const *s)
+{
+  memset (d, 0, sizeof (*d));
+  memcpy (&d->series, s, sizeof (d->series));
+  d->points_left = s->points_num;
+  d->leading = -1;
+} /* }}} void archive_decoder_init */
+
+static int archive_decoder_next_gauge (archive_decoder_t *d) /* {{{ */
+{
+  const uint8_t *data = d->series.data;
+  uint64_t bits = d->series.bits;
+  uint64_t bit;
+  uint64_t tmp;
+  uint64_t x;
+  int sig;
+
+  if (bits_read (data, bits, &d->pos, 1, &bit) != 0)
+    return (-1);
+  if (bit == 0)
+    return (0);
+
+  if (bits_read (data, bits, &d->pos, 1, &bit) != 0)
+    return (-1);
+
+  if (bit == 0)
+  {
+    if (d->leading < 0)
+      return (-1);
+    sig = 64 - d->leading - d->trailing;
+  }
+  else
+  {
+    if (bits_read (data, bits, &d->pos, 5, &tmp) != 0)
+      return (-1);
+    d->leading = (int) tmp;
+    if (bits_read (data, bits, &d->pos, 6, &tmp) != 0)
+      return (-1);
+    sig = (tmp == 0) ? 64 : (int) tmp;
+    d->trailing = 64 - d->leading - sig;
+    if (d->trailing < 0)
+      return (-1);
+  }
+
+  if (bits_read (data, bits, &d->pos, sig, &x) != 0)
+    return (-1);
+
+  d->value_last ^= x << d->trailing;
+  return (0);
+} /* }}} int archive_decoder_next_gauge */
+
+int archive_decoder_next (archive_decoder_t *d, /* {{{ */
+    cdtime_t *ret_time, value_t *ret_value)
+{
+  const uint8_t *data = d->series.data;
+  uint64_t bits = d->series.bits;
+  uint64_t tmp;
+
+  if (d->points_left == 0)
+    return (1);
+
+  if (d->points_left == d->series.points_num)
+  {
+    if (bits_read (data, bits, &d->pos, 64, &tmp) != 0)
+      return (-1);
+    d->time_last = (cdtime_t) tmp;
+    if (bits_read (data, bits, &d->pos, 64, &d->value_last) != 0)
+      return (-1);
+  }
+  else
+  {
+    if (dod_read (data, bits, &d->pos, &tmp) != 0)
+      return (-1);
+    d->time_delta += tmp;
+    d->time_last += d->time_delta;
+
+    if (d->series.ds_type == DS_TYPE_GAUGE)
+    {
+      if (archive_decoder_next_gauge (d) != 0)
+        return (-1);
+    }
+    else
+    {
+      if (dod_read (data, bits, &d->pos, &tmp) != 0)
+        return (-1);
+      d->value_delta += tmp;
+      d->value_last += d->value_delta;
+    }
+  }
+
+  d->points_left--;
+  *ret_time = d->time_last;
+  *ret_value = raw_to_value (d->series.ds_type, d->value_last);
+  return (0);
+} /* }}} int archive_decoder_next */
+
+/*
+ * Blocks
+ */
+static int archive_block_entry_compare (const void *a, const void *b) /* {{{ */
+{
+  archive_block_entry_t const *e0 = a;
+  archive_block_entry_t const *e1 = b;
+  int status;
+
+  status = strcmp (e0->identifier, e1->identifier);
+  if (status != 0)
+    return (status);
+  return (strcmp (e0->ds_name, e1->ds_name));
+} /* }}} int archive_block_entry_compare */
+
+size_t archive_block_series_size (archive_block_entry_t const *entry) /* {{{ */
+{
+  if (entry->encoder->points_num == 0)
+    return (0);
+
+  return (ARCHIVE_DIR_ENTRY_SIZE
+      + strlen (entry->identifier) + strlen (entry->ds_name) + 2
+      + PAD8 (archive_encoder_size (entry->encoder)));
+} /* }}} size_t archive_block_series_size */
+
+int archive_block_build (archive_block_entry_t *entries, /* {{{ */
+    size_t entries_num, void **ret_block, size_t *ret_block_size)
+{
+  size_t series_num = 0;
+  size_t strings_size = 0;
+  size_t data_size = 0;
+  size_t block_size;
+  size_t strings_start;
+  size_t strings_pos;
+  size_t data_pos;
+  uint64_t points_num = 0;
+  cdtime_t time_min = 0;
+  cdtime_t time_max = 0;
+  uint8_t *block;
+  size_t i;
+
+  if ((ret_block == NULL) || (ret_block_size == NULL))
+    return (EINVAL);
+
+  /* Move entries without points to the end. */
+  for (i = 0; i < entries_num; i++)
+  {
+    archive_block_entry_t tmp;
+    size_t id_len;
+    size_t ds_len;
+
+    if (entries[i].encoder->points_num == 0)
+      continue;
+
+    id_len = strlen (entries[i].identifier);
+    ds_len = strlen (entries[i].ds_name);
+    if ((id_len > UINT16_MAX) || (ds_len > UINT16_MAX))
+      return (EINVAL);
+
+    strings_size += id_len + ds_len + 2;
+    data_size += PAD8 (archive_encoder_size (entries[i].encoder));
+
+    memcpy (&tmp, entries + series_num, sizeof (tmp));
+    memcpy (entries + series_num, entries + i, sizeof (tmp));
+    memcpy (entries + i, &tmp, sizeof (tmp));
+    series_num++;
+  }
+
+  if ((series_num == 0) || (series_num > UINT32_MAX)
+      || (strings_size > UINT32_MAX))
+    return (EINVAL);
+
+  qsort (entries, series_num, sizeof (*entries), archive_block_entry_compare);
+
+  strings_size = PAD8 (strings_size);
+  strings_start = ARCHIVE_BLOCK_HEADER_SIZE
+    + series_num * ARCHIVE_DIR_ENTRY_SIZE;
+  strings_pos = strings_start;
+  data_pos = strings_start + strings_size;
+  block_size = data_pos + data_size;
+
+  block = calloc (1, block_size);
+  if (block == NULL)
+    return (ENOMEM);
+
+  for (i = 0; i < series_num; i++)
+  {
+    archive_encoder_t const *e = entries[i].encoder;
+    uint8_t *dir = block + ARCHIVE_BLOCK_HEADER_SIZE
+      + i * ARCHIVE_DIR_ENTRY_SIZE;
+    size_t id_len = strlen (entries[i].identifier);
+    size_t ds_len = strlen (entries[i].ds_name);
+    size_t size = archive_encoder_size (e);
+
+    put_u32 (dir + 0, (uint32_t) (strings_pos - strings_start));
+    put_u16 (dir + 4, (uint16_t) id_len);
+    put_u16 (dir + 6, (uint16_t) ds_len);
+    dir[8] = (uint8_t) e->ds_type;
+    put_u32 (dir + 12, e->points_num);
+    put_u64 (dir + 16, (uint64_t) data_pos);
+    put_u64 (dir + 24, e->bits);
+    put_u64 (dir + 32, (uint64_t) e->time_first);
+    put_u64 (dir + 40, (uint64_t) e->time_last);
+
+    memcpy (block + strings_pos, entries[i].identifier, id_len);
+    strings_pos += id_len + 1;
+    memcpy (block + strings_pos, entries[i].ds_name, ds_len);
+    strings_pos += ds_len + 1;
+
+    memcpy (block + data_pos, e->data, size);
+    data_pos += PAD8 (size);
+
+    if ((i == 0) || (e->time_first < time_min))
+      time_min = e->time_first;
+    if ((i == 0) || (e->time_last > time_max))
+      time_max = e->time_last;
+    points_num += e->points_num;
+  }
+
+  put_u32 (block + 0, ARCHIVE_BLOCK_MAGIC);
+  put_u32 (block + 4, (uint32_t) series_num);
+  put_u64 (block + 8, (uint64_t) block_size);
+  put_u64 (block + 16, (uint64_t) time_min);
+  put_u64 (block + 24, (uint64_t) time_max);
+  put_u64 (block + 32, points_num);
+  put_u32 (block + 40, (uint32_t) strings_size);
+  put_u32 (block + 44, archive_checksum (block + ARCHIVE_BLOCK_HEADER_SIZE,
+        block_size - ARCHIVE_BLOCK_HEADER_SIZE));
+
+  *ret_block = block;
+  *ret_block_size = block_size;
+  return (0);
+} /* }}} int archive_block_build */
+
+int archive_block_parse (const void *data, size_t size, /* {{{ */
+    archive_block_t *ret_block)
+{
+  const uint8_t *p = data;
+  uint64_t block_size;
+  uint64_t strings_size;
+  uint32_t series_num;
+
+  if (size == 0)
+    return (1);
+  if (size < ARCHIVE_BLOCK_HEADER_SIZE)
+    return (-1);
+
+  if (get_u32 (p) != ARCHIVE_BLOCK_MAGIC)
+    return (-1);
+
+  series_num = get_u32 (p + 4);
+  block_size = get_u64 (p + 8);
+  strings_size = get_u32 (p + 40);
+
+  if ((block_size > (uint64_t) size) || ((block_size % 8) != 0)
+      || (block_size < ARCHIVE_BLOCK_HEADER_SIZE
+        + ((uint64_t) series_num) * ARCHIVE_DIR_ENTRY_SIZE + strings_size))
+    return (-1);
+
+  if (get_u32 (p + 44) != archive_checksum (p + ARCHIVE_BLOCK_HEADER_SIZE,
+        (size_t) block_size - ARCHIVE_BLOCK_HEADER_SIZE))
+    return (-1);
+
+  ret_block->data = p;
+  ret_block->size = (size_t) block_size;
+  ret_block->series_num = series_num;
+  ret_block->time_min = (cdtime_t) get_u64 (p + 16);
+  ret_block->time_max = (cdtime_t) get_u64 (p + 24);
+  ret_block->points_num = get_u64 (p + 32);
+  return (0);
+} /* }}} int archive_block_parse */
+
+int archive_block_series (archive_block_t const *b, uint32_t index, /* {{{ */
+    archive_series_t *ret_series)
+{
+  const uint8_t *dir;
+  size_t strings_pos;
+  size_t strings_size;
+  size_t str_offset;
+  size_t id_len;
+  size_t ds_len;
+  uint64_t data_offset;
+  uint64_t bits;
+
+  if (index >= b->series_num)
+    return (EINVAL);
+
+  dir = b->data + ARCHIVE_BLOCK_HEADER_SIZE + index * ARCHIVE_DIR_ENTRY_SIZE;
+  strings_pos = ARCHIVE_BLOCK_HEADER_SIZE
+    + ((size_t) b->series_num) * ARCHIVE_DIR_ENTRY_SIZE;
+  strings_size = get_u32 (b->data + 40);
+
+  str_offset = get_u32 (dir + 0);
+  id_len = get_u16 (dir + 4);
+  ds_len = get_u16 (dir + 6);
+  if ((str_offset + id_len + ds_len + 2) > strings_size)
+    return (EINVAL);
+  if ((b->data[strings_pos + str_offset + id_len] != 0)
+      || (b->data[strings_pos + str_offset + id_len + 1 + ds_len] != 0))
+    return (EINVAL);
+
+  data_offset = get_u64 (dir + 16);
+  bits = get_u64 (dir + 24);
+  if ((data_offset < strings_pos + strings_size)
+      || (data_offset > b->size)
+      || (((bits + 7) / 8) > b->size - data_offset))
+    return (EINVAL);
+
+  ret_series->identifier = (const char *) b->data + strings_pos + str_offset;
+  ret_series->ds_name = ret_series->identifier + id_len + 1;
+  ret_series->ds_type = (int) dir[8];
+  ret_series->points_num = get_u32 (dir + 12);
+  ret_series->data = b->data + data_offset;
+  ret_series->bits = bits;
+  ret_series->time_first = (cdtime_t) get_u64 (dir + 32);
+  ret_series->time_last = (cdtime_t) get_u64 (dir + 40);
+
+  if (!ds_type_valid (ret_series->ds_type))
+    return (EINVAL);
+
+  return (0);
+} /* }}} int archive_block_series */
+
+int archive_block_find (archive_block_t const *b, /* {{{ */
+    const char *identifier, const char *ds_name,
+    archive_series_t *ret_series)
+{
+  uint32_t lo = 0;
+  uint32_t hi = b->series_num;
+
+  while (lo < hi)
+  {
+    uint32_t mid = lo + (hi - lo) / 2;
+    archive_series_t s;
+    int status;
+
+    status = archive_block_series (b, mid, &s);
+    if (status != 0)
+      return (status);
+
+    status = strcmp (identifier, s.identifier);
+    if (status == 0)
+      status = strcmp (ds_name, s.ds_name);
+
+    if (status == 0)
+    {
+      memcpy (ret_series, &s, sizeof (*ret_series));
+      return (0);
+    }
+    else if (status < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  return (ENOENT);
+} /* }}} int archive_block_find */
+
+/*
+ * Files
+ */
+void archive_file_header (void *buffer, cdtime_t created) /* {{{ */
+{
+  uint8_t *p = buffer;
+
+  memset (p, 0, ARCHIVE_FILE_HEADER_SIZE);
+  memcpy (p, ARCHIVE_FILE_MAGIC, 8);
+  put_u32 (p + 8, ARCHIVE_FILE_VERSION);
+  put_u32 (p + 12, ARCHIVE_FILE_HEADER_SIZE);
+  put_u64 (p + 16, (uint64_t) created);
+} /* }}} void archive_file_header */
+
+archive_file_t *archive_file_open (const char *path) /* {{{ */
+{
+  archive_file_t *f;
+  struct stat statbuf;
+  void *map;
+  int fd;
+
+  fd = open (path, O_RDONLY);
+  if (fd < 0)
+    return (NULL);
+
+  if (fstat (fd, &statbuf) != 0)
+  {
+    int saved_errno = errno;
+    close (fd);
+    errno = saved_errno;
+    return (NULL);
+  }
+
+  if ((size_t) statbuf.st_size < ARCHIVE_FILE_HEADER_SIZE)
+  {
+    close (fd);
+    errno = EINVAL;
+    return (NULL);
+  }
+
+  map = mmap (NULL, (size_t) statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    return (NULL);
+
+  if ((memcmp (map, ARCHIVE_FILE_MAGIC, 8) != 0)
+      || (get_u32 ((const uint8_t *) map + 8) != ARCHIVE_FILE_VERSION)
+      || (get_u32 ((const uint8_t *) map + 12) != ARCHIVE_FILE_HEADER_SIZE))
+  {
+    munmap (map, (size_t) statbuf.st_size);
+    errno = EINVAL;
+    return (NULL);
+  }
+
+  f = calloc (1, sizeof (*f));
+  if (f == NULL)
+  {
+    munmap (map, (size_t) statbuf.st_size);
+    errno = ENOMEM;
+    return (NULL);
+  }
+  f->map = map;
+  f->size = (size_t) statbuf.st_size;
+
+  return (f);
+} /* }}} archive_file_t *archive_file_open */
+
+void archive_file_close (archive_file_t *f) /* {{{ */
+{
+  if (f == NULL)
+    return;
+
+  munmap ((void *) f->map, f->size);
+  free (f);
+} /* }}} void archive_file_close */
+
+int archive_file_next_block (archive_file_t *f, size_t *offset, /* {{{ */
+    archive_block_t *ret_block)
+{
+  int status;
+
+  if (*offset == 0)
+    *offset = ARCHIVE_FILE_HEADER_SIZE;
+  if (*offset > f->size)
+    return (-1);
+
+  status = archive_block_parse (f->map + *offset, f->size - *offset,
+      ret_block);
+  if (status != 0)
+    return (status);
+
+  *offset += ret_block->size;
+  return (0);
+} /* }}} int archive_file_next_block */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,197 @@
+/**
+ * collectd - src/utils_archive.h
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+#ifndef UTILS_ARCHIVE_H
+#define UTILS_ARCHIVE_H 1
+
+#include "plugin.h"
+
+/*
+ * Archive file format
+ *
+ * An archive file consists of a file header followed by any number of
+ * self-contained blocks. All integers are stored in little-endian byte order
+ * and all structures are aligned to eight bytes, so files can be scanned
+ * in place after mapping them into memory.
+ *
+ *   File header (32 bytes):
+ *     magic "CDARCHV1", version, header size, creation time, reserved
+ *
+ *   Block:
+ *     header (48 bytes): magic "CDAB", number of series, block size,
+ *       first and last time, number of points, size of the string table,
+ *       checksum of everything following the header
+ *     directory: one 48 byte entry per series, sorted by identifier and data
+ *       source name, with the offset and length of the series' data
+ *     string table: "identifier\0ds_name\0" for every series
+ *     data: one compressed bit stream per series
+ *
+ * Each series stores the time stamps as deltas of deltas. Gauges are stored
+ * as the XOR of consecutive values as described in "Gorilla: A Fast,
+ * Scalable, In-Memory Time Series Database" (Pelkonen et al., 2015); the other
+ * data source types are stored as deltas of deltas, too.
+ */
+#define ARCHIVE_FILE_HEADER_SIZE 32
+#define ARCHIVE_BLOCK_HEADER_SIZE 48
+#define ARCHIVE_DIR_ENTRY_SIZE 48
+
+/*
+ * Encoder / decoder of a single series
+ */
+struct archive_encoder_s
+{
+  int       ds_type;
+
+  uint8_t  *data;
+  size_t    data_size;
+  uint64_t  bits;
+
+  uint32_t  points_num;
+  cdtime_t  time_first;
+  cdtime_t  time_last;
+
+  /* State for the next point. */
+  uint64_t  time_delta;
+  uint64_t  value_last;
+  uint64_t  value_delta;
+  int       leading;
+  int       trailing;
+};
+typedef struct archive_encoder_s archive_encoder_t;
+
+void archive_encoder_init (archive_encoder_t *e, int ds_type);
+void archive_encoder_reset (archive_encoder_t *e);
+void archive_encoder_free (archive_encoder_t *e);
+
+/* Appends one point. Time stamps must not decrease. Returns zero on success
+ * and ENOMEM or EINVAL on failure. */
+int archive_encoder_add (archive_encoder_t *e, cdtime_t t, value_t v);
+
+/* Returns the number of bytes used by the encoded data. */
+size_t archive_encoder_size (archive_encoder_t const *e);
+
+/* Description of one series in a block. The pointers point into the block. */
+struct archive_series_s
+{
+  const char    *identifier;
+  const char    *ds_name;
+  int            ds_type;
+  uint32_t       points_num;
+  cdtime_t       time_first;
+  cdtime_t       time_last;
+  const uint8_t *data;
+  uint64_t       bits;
+};
+typedef struct archive_series_s archive_series_t;
+
+struct archive_decoder_s
+{
+  archive_series_t series;
+  uint64_t  pos;
+  uint32_t  points_left;
+
+  cdtime_t  time_last;
+  uint64_t  time_delta;
+  uint64_t  value_last;
+  uint64_t  value_delta;
+  int       leading;
+  int       trailing;
+};
+typedef struct archive_decoder_s archive_decoder_t;
+
+void archive_decoder_init (archive_decoder_t *d, archive_series_t const *s);
+
+/* Returns zero and the next point, a positive value after the last point or a
+ * negative value if the data is corrupt. */
+int archive_decoder_next (archive_decoder_t *d, cdtime_t *ret_time,
+    value_t *ret_value);
+
+/*
+ * Blocks
+ */
+struct archive_block_entry_s
+{
+  const char *identifier;
+  const char *ds_name;
+  archive_encoder_t const *encoder;
+};
+typedef struct archive_block_entry_s archive_block_entry_t;
+
+/* Returns the number of bytes a series adds to a block: its directory entry,
+ * its strings and its data. Zero if the series has no points. A block is at
+ * most ARCHIVE_BLOCK_HEADER_SIZE + 7 bytes larger than the sum over its
+ * series. */
+size_t archive_block_series_size (archive_block_entry_t const *entry);
+
+/* Serializes the series into a newly allocated block. The entries are sorted
+ * in place; entries without points are skipped. */
+int archive_block_build (archive_block_entry_t *entries, size_t entries_num,
+    void **ret_block, size_t *ret_block_size);
+
+struct archive_block_s
+{
+  const uint8_t *data;
+  size_t    size;
+  uint32_t  series_num;
+  uint64_t  points_num;
+  cdtime_t  time_min;
+  cdtime_t  time_max;
+};
+typedef struct archive_block_s archive_block_t;
+
+/* Parses and verifies the block at the beginning of "data". Returns zero on
+ * success, a positive value if "size" is zero and a negative value if the
+ * block is truncated or corrupt. */
+int archive_block_parse (const void *data, size_t size,
+    archive_block_t *ret_block);
+
+int archive_block_series (archive_block_t const *b, uint32_t index,
+    archive_series_t *ret_series);
+
+/* Looks up a series using a binary search. Returns ENOENT if the block does
+ * not contain the series. */
+int archive_block_find (archive_block_t const *b,
+    const char *identifier, const char *ds_name,
+    archive_series_t *ret_series);
+
+/*
+ * Files
+ */
+void archive_file_header (void *buffer, cdtime_t created);
+
+struct archive_file_s;
+typedef struct archive_file_s archive_file_t;
+
+/* Maps an archive file into memory. Returns NULL and sets errno on failure. */
+archive_file_t *archive_file_open (const char *path);
+void archive_file_close (archive_file_t *f);
+
+/* Iterates over the blocks of a file. "offset" must be initialized to zero
+ * and is advanced to the next block. Returns zero on success, a positive
+ * value at the end of the file and a negative value if the block at "offset"
+ * is truncated or corrupt. */
+int archive_file_next_block (archive_file_t *f, size_t *offset,
+    archive_block_t *ret_block);
+
+#endif /* UTILS_ARCHIVE_H */
@@ -0,0 +1,213 @@
+/**
+ * collectd - src/utils_archive_test.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+#include "testing.h"
+#include "collectd.h"
+#include "utils_archive.h"
+
+#define POINTS_NUM 1000
+
+static cdtime_t test_time (int i)
+{
+  /* 10 second interval with a few milliseconds of jitter and a gap. */
+  cdtime_t t = TIME_T_TO_CDTIME_T (1400000000) + ((cdtime_t) i) * MS_TO_CDTIME_T (10000);
+  if ((i % 7) == 0)
+    t += MS_TO_CDTIME_T (i % 13);
+  if (i > POINTS_NUM / 2)
+    t += TIME_T_TO_CDTIME_T (3600);
+  return (t);
+}
+
+static value_t test_value (int ds_type, int i)
+{
+  value_t v;
+
+  memset (&v, 0, sizeof (v));
+  if (ds_type == DS_TYPE_GAUGE)
+  {
+    if (i == 10)
+      v.gauge = NAN;
+    else if ((i % 50) < 25)
+      v.gauge = 42.0;
+    else
+      v.gauge = 100.0 * sin (((double) i) / 10.0);
+  }
+  else if (ds_type == DS_TYPE_COUNTER)
+    /* wraps around */
+    v.counter = ((counter_t) -5000) + ((counter_t) i) * 17;
+  else if (ds_type == DS_TYPE_DERIVE)
+    v.derive = ((i % 100) == 0) ? INT64_MIN + i : -((derive_t) i) * 1000003;
+  else
+    v.absolute = ((absolute_t) i) << 40;
+
+  return (v);
+}
+
+static _Bool value_equal (int ds_type, value_t a, value_t b)
+{
+  if (ds_type == DS_TYPE_GAUGE)
+    return (memcmp (&a.gauge, &b.gauge, sizeof (a.gauge)) == 0);
+  else if (ds_type == DS_TYPE_COUNTER)
+    return (a.counter == b.counter);
+  else if (ds_type == DS_TYPE_DERIVE)
+    return (a.derive == b.derive);
+  return (a.absolute == b.absolute);
+}
+
+static int check_series (archive_series_t const *s, int ds_type)
+{
+  archive_decoder_t d;
+  cdtime_t t;
+  value_t v;
+  int i;
+
+  archive_decoder_init (&d, s);
+  for (i = 0; i < POINTS_NUM; i++)
+  {
+    if (archive_decoder_next (&d, &t, &v) != 0)
+      return (-1);
+    if ((t != test_time (i)) || !value_equal (ds_type, v, test_value (ds_type, i)))
+      return (-1);
+  }
+
+  return ((archive_decoder_next (&d, &t, &v) > 0) ? 0 : -1);
+}
+
+DEF_TEST(encoder)
+{
+  int ds_types[] = { DS_TYPE_GAUGE, DS_TYPE_COUNTER, DS_TYPE_DERIVE,
+    DS_TYPE_ABSOLUTE };
+  size_t i;
+
+  for (i = 0; i < sizeof (ds_types) / sizeof (ds_types[0]); i++)
+  {
+    archive_encoder_t e;
+    archive_series_t s;
+    int status = 0;
+    int j;
+
+    archive_encoder_init (&e, ds_types[i]);
+    for (j = 0; j < POINTS_NUM; j++)
+      status |= archive_encoder_add (&e, test_time (j),
+          test_value (ds_types[i], j));
+    CHECK_ZERO (status);
+
+    memset (&s, 0, sizeof (s));
+    s.ds_type = ds_types[i];
+    s.points_num = e.points_num;
+    s.data = e.data;
+    s.bits = e.bits;
+    CHECK_ZERO (check_series (&s, ds_types[i]));
+
+    /* Less than half of the 16 bytes of an uncompressed point. */
+    printf ("ds_type %i: %zu bytes for %i points\n", ds_types[i],
+        archive_encoder_size (&e), POINTS_NUM);
+    OK (archive_encoder_size (&e) < 8 * POINTS_NUM);
+
+    /* Time must not go backwards. */
+    OK (archive_encoder_add (&e, test_time (0), test_value (ds_types[i], 0))
+        == EINVAL);
+
+    archive_encoder_reset (&e);
+    OK (e.points_num == 0);
+    CHECK_ZERO (archive_encoder_add (&e, 0, test_value (ds_types[i], 0)));
+
+    archive_encoder_free (&e);
+  }
+
+  return (0);
+}
+
+DEF_TEST(block)
+{
+  archive_encoder_t e[3];
+  archive_block_entry_t entries[3] = {
+    { "host/plugin/type", "value", &e[0] },
+    { "host/cpu-0/cpu-idle", "value", &e[1] },
+    { "host/empty/gauge", "value", &e[2] },
+  };
+  archive_block_t b;
+  archive_series_t s;
+  void *block = NULL;
+  size_t block_size = 0;
+  size_t series_size;
+  int i;
+
+  archive_encoder_init (&e[0], DS_TYPE_GAUGE);
+  archive_encoder_init (&e[1], DS_TYPE_DERIVE);
+  archive_encoder_init (&e[2], DS_TYPE_GAUGE);
+  for (i = 0; i < POINTS_NUM; i++)
+  {
+    archive_encoder_add (&e[0], test_time (i), test_value (DS_TYPE_GAUGE, i));
+    archive_encoder_add (&e[1], test_time (i), test_value (DS_TYPE_DERIVE, i));
+  }
+
+  series_size = archive_block_series_size (entries + 0)
+    + archive_block_series_size (entries + 1)
+    + archive_block_series_size (entries + 2);
+  OK (archive_block_series_size (entries + 2) == 0);
+
+  CHECK_ZERO (archive_block_build (entries, 3, &block, &block_size));
+  OK ((block_size % 8) == 0);
+  OK (block_size >= ARCHIVE_BLOCK_HEADER_SIZE + series_size);
+  OK (block_size <= ARCHIVE_BLOCK_HEADER_SIZE + series_size + 7);
+
+  CHECK_ZERO (archive_block_parse (block, block_size, &b));
+  OK (b.series_num == 2);
+  OK (b.points_num == 2 * POINTS_NUM);
+  OK (b.time_min == test_time (0));
+  OK (b.time_max == test_time (POINTS_NUM - 1));
+
+  /* Sorted by identifier. */
+  CHECK_ZERO (archive_block_series (&b, 0, &s));
+  STREQ ("host/cpu-0/cpu-idle", s.identifier);
+  CHECK_ZERO (check_series (&s, DS_TYPE_DERIVE));
+
+  CHECK_ZERO (archive_block_find (&b, "host/plugin/type", "value", &s));
+  STREQ ("value", s.ds_name);
+  CHECK_ZERO (check_series (&s, DS_TYPE_GAUGE));
+  OK (archive_block_find (&b, "host/empty/gauge", "value", &s) == ENOENT);
+
+  /* Truncated and corrupted blocks are detected. */
+  OK (archive_block_parse (block, block_size - 8, &b) < 0);
+  ((uint8_t *) block)[block_size - 1] ^= 0x01;
+  OK (archive_block_parse (block, block_size, &b) < 0);
+  OK (archive_block_parse (block, 0, &b) > 0);
+
+  free (block);
+  for (i = 0; i < 3; i++)
+    archive_encoder_free (&e[i]);
+
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(encoder);
+  RUN_TEST(block);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -54,7 +54,6 @@ int handle_flush (FILE *fh, char *buffer)
 			strarray_free (identifiers, identifiers_num); \
 			return -1; \
 		} \
-		fflush(fh); \
 	} while (0)
 
 	if ((fh == NULL) || (buffer == NULL))
@@ -39,9 +39,131 @@
           fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf))); \
       return -1; \
     } \
-    fflush(fh); \
   } while (0)
 
+/* State of a GETVAL command with a wildcard pattern. The response lines are
+ * formatted while iterating over the cache and written after the cache lock
+ * has been released. */
+typedef struct getval_buffer_s
+{
+  char  *data;
+  size_t size;
+  size_t fill;
+  size_t num;
+} getval_buffer_t;
+
+static int getval_append (getval_buffer_t *gb, /* {{{ */
+    const char *format, ...)
+{
+  va_list ap;
+  int status;
+
+  while (42)
+  {
+    va_start (ap, format);
+    status = vsnprintf (gb->data + gb->fill, gb->size - gb->fill, format, ap);
+    va_end (ap);
+    if (status < 0)
+      return (-1);
+    if (((size_t) status) < (gb->size - gb->fill))
+      break;
+
+    /* Not enough space, grow the buffer and try again. */
+    {
+      size_t new_size = (gb->size == 0) ? 4096 : 2 * gb->size;
+      char *tmp;
+
+      while (new_size <= (gb->fill + (size_t) status))
+        new_size *= 2;
+
+      tmp = realloc (gb->data, new_size);
+      if (tmp == NULL)
+        return (ENOMEM);
+      gb->data = tmp;
+      gb->size = new_size;
+    }
+  }
+
+  gb->fill += (size_t) status;
+  return (0);
+} /* }}} int getval_append */
+
+static int getval_add (const char *name, /* {{{ */
+    cdtime_t __attribute__((unused)) last_time,
+    const gauge_t *rates, size_t rates_num, void *user_data)
+{
+  getval_buffer_t *gb = user_data;
+  const data_set_t *ds;
+  char type[DATA_MAX_NAME_LEN];
+  const char *ptr;
+  size_t i;
+  int status;
+
+  /* The type is the part of the last field before the first hyphen. */
+  ptr = strrchr (name, '/');
+  ptr = (ptr == NULL) ? name : ptr + 1;
+  sstrncpy (type, ptr, sizeof (type));
+  type[strcspn (type, "-")] = 0;
+
+  ds = plugin_get_ds (type);
+  if ((ds == NULL) || (ds->ds_num != rates_num))
+    return (0);
+
+  status = getval_append (gb, "%s", name);
+  for (i = 0; (status == 0) && (i < rates_num); i++)
+  {
+    if (isnan (rates[i]))
+      status = getval_append (gb, " %s=NaN", ds->ds[i].name);
+    else
+      status = getval_append (gb, " %s=%12e", ds->ds[i].name, rates[i]);
+  }
+  if (status == 0)
+    status = getval_append (gb, "\n");
+  if (status != 0)
+    return (status);
+
+  gb->num++;
+  return (0);
+} /* }}} int getval_add */
+
+/* Handles "GETVAL <pattern>": Prints one line per matching identifier,
+ * containing the identifier followed by "<ds>=<value>" pairs. */
+static int handle_getval_match (FILE *fh, const char *pattern) /* {{{ */
+{
+  getval_buffer_t gb;
+  int status;
+
+  memset (&gb, 0, sizeof (gb));
+
+  status = uc_iterate (pattern, getval_add, &gb);
+  if (status != 0)
+  {
+    sfree (gb.data);
+    print_to_socket (fh, "-1 Reading values from the cache failed.\n");
+    return (-1);
+  }
+
+  if (gb.num == 0)
+  {
+    print_to_socket (fh, "-1 No such value\n");
+    return (-1);
+  }
+
+  if ((fprintf (fh, "%zu Value%s found\n", gb.num,
+          (gb.num == 1) ? "" : "s") < 0)
+      || (fwrite (gb.data, 1, gb.fill, fh) != gb.fill))
+  {
+    char errbuf[1024];
+    WARNING ("handle_getval: failed to write to socket #%i: %s",
+        fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf)));
+    sfree (gb.data);
+    return (-1);
+  }
+
+  sfree (gb.data);
+  return (0);
+} /* }}} int handle_getval_match */
+
 int handle_getval (FILE *fh, char *buffer)
 {
   char *command;
@@ -97,6 +219,9 @@ int handle_getval (FILE *fh, char *buffer)
     return (-1);
   }
 
+  if (strpbrk (identifier, "*?[") != NULL)
+    return (handle_getval_match (fh, identifier));
+
   /* parse_identifier() modifies its first argument,
    * returning pointers into it */
   identifier_copy = sstrdup (identifier);
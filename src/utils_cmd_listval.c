@@ -32,37 +32,69 @@
 #include "utils_cache.h"
 #include "utils_parse_option.h"
 
-#define free_everything_and_return(status) do { \
-    size_t j; \
-    for (j = 0; j < number; j++) { \
-      sfree(names[j]); \
-      names[j] = NULL; \
-    } \
-    sfree(names); \
-    sfree(times); \
-    return (status); \
-  } while (0)
-
 #define print_to_socket(fh, ...) \
   do { \
     if (fprintf (fh, __VA_ARGS__) < 0) { \
       char errbuf[1024]; \
       WARNING ("handle_listval: failed to write to socket #%i: %s", \
           fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf))); \
-      free_everything_and_return (-1); \
+      sfree (lb.data); \
+      return (-1); \
     } \
-    fflush(fh); \
   } while (0)
 
+/* The response lines are formatted while iterating over the cache and
+ * written after the cache lock has been released. Only matching entries are
+ * copied. */
+typedef struct listval_buffer_s
+{
+  char  *data;
+  size_t size;
+  size_t fill;
+  size_t num;
+} listval_buffer_t;
+
+static int listval_add (const char *name, cdtime_t last_time, /* {{{ */
+    const gauge_t __attribute__((unused)) *rates,
+    size_t __attribute__((unused)) rates_num, void *user_data)
+{
+  listval_buffer_t *lb = user_data;
+  int status;
+
+  while (42)
+  {
+    status = snprintf (lb->data + lb->fill, lb->size - lb->fill,
+        "%.3f %s\n", CDTIME_T_TO_DOUBLE (last_time), name);
+    if (status < 0)
+      return (-1);
+    if (((size_t) status) < (lb->size - lb->fill))
+      break;
+
+    /* Not enough space, grow the buffer and try again. */
+    {
+      size_t new_size = (lb->size == 0) ? 4096 : 2 * lb->size;
+      char *tmp = realloc (lb->data, new_size);
+      if (tmp == NULL)
+        return (ENOMEM);
+      lb->data = tmp;
+      lb->size = new_size;
+    }
+  }
+
+  lb->fill += (size_t) status;
+  lb->num++;
+  return (0);
+} /* }}} int listval_add */
+
 int handle_listval (FILE *fh, char *buffer)
 {
   char *command;
-  char **names = NULL;
-  cdtime_t *times = NULL;
-  size_t number = 0;
-  size_t i;
+  char *pattern = NULL;
+  listval_buffer_t lb;
   int status;
 
+  memset (&lb, 0, sizeof (lb));
+
   DEBUG ("utils_cmd_listval: handle_listval (fh = %p, buffer = %s);",
       (void *) fh, buffer);
 
@@ -71,37 +103,55 @@ int handle_listval (FILE *fh, char *buffer)
   if (status != 0)
   {
     print_to_socket (fh, "-1 Cannot parse command.\n");
-    free_everything_and_return (-1);
+    return (-1);
   }
   assert (command != NULL);
 
   if (strcasecmp ("LISTVAL", command) != 0)
   {
     print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
-    free_everything_and_return (-1);
+    return (-1);
+  }
+
+  /* An optional pattern restricts the listing to matching identifiers. */
+  if (*buffer != 0)
+  {
+    status = parse_string (&buffer, &pattern);
+    if (status != 0)
+    {
+      print_to_socket (fh, "-1 Cannot parse pattern.\n");
+      return (-1);
+    }
   }
 
   if (*buffer != 0)
   {
     print_to_socket (fh, "-1 Garbage after end of command: %s\n", buffer);
-    free_everything_and_return (-1);
+    return (-1);
   }
 
-  status = uc_get_names (&names, &times, &number);
+  status = uc_iterate (pattern, listval_add, &lb);
   if (status != 0)
   {
-    DEBUG ("command listval: uc_get_names failed with status %i", status);
-    print_to_socket (fh, "-1 uc_get_names failed.\n");
-    free_everything_and_return (-1);
+    DEBUG ("command listval: uc_iterate failed with status %i", status);
+    print_to_socket (fh, "-1 uc_iterate failed.\n");
+    sfree (lb.data);
+    return (-1);
   }
 
   print_to_socket (fh, "%i Value%s found\n",
-      (int) number, (number == 1) ? "" : "s");
-  for (i = 0; i < number; i++)
-    print_to_socket (fh, "%.3f %s\n", CDTIME_T_TO_DOUBLE (times[i]),
-       	names[i]);
+      (int) lb.num, (lb.num == 1) ? "" : "s");
+  if ((lb.fill > 0) && (fwrite (lb.data, 1, lb.fill, fh) != lb.fill))
+  {
+    char errbuf[1024];
+    WARNING ("handle_listval: failed to write to socket #%i: %s",
+        fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf)));
+    sfree (lb.data);
+    return (-1);
+  }
 
-  free_everything_and_return (0);
+  sfree (lb.data);
+  return (0);
 } /* int handle_listval */
 
 /* vim: set sw=2 sts=2 ts=8 : */
@@ -0,0 +1,492 @@
+/**
+ * collectd - src/utils_cmd_putbatch.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+
+#include "utils_cmd_putbatch.h"
+#include "utils_cmd_putval.h"
+#include "utils_parse_option.h"
+#include "network.h"
+
+#include <arpa/inet.h>
+
+/* Number of value lists collected before they are handed to the daemon. This
+ * bounds the memory used by large batches. */
+#define PUTBATCH_CHUNK_SIZE 1024
+
+#define print_to_socket(fh, ...) \
+    do { \
+        if (fprintf (fh, __VA_ARGS__) < 0) { \
+            char errbuf[1024]; \
+            WARNING ("handle_putbatch: failed to write to socket #%i: %s", \
+                    fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf))); \
+            return -1; \
+        } \
+    } while (0)
+
+struct putbatch_s
+{
+	/* Pending value lists. The `values' member of each entry is only set
+	 * right before dispatching, because `values' may be moved by realloc. */
+	value_list_t *vl;
+	size_t       *values_offset;
+	size_t        vl_num;
+	size_t        vl_size;
+
+	value_t *values;
+	size_t   values_num;
+	size_t   values_size;
+
+	/* Statistics reported when the batch ends. */
+	size_t lines_num;
+	size_t dispatched_num;
+	size_t errors_num;
+	char   first_error[256];
+};
+
+static void putbatch_error (putbatch_t *batch, /* {{{ */
+		char const *format, ...)
+{
+	va_list ap;
+
+	batch->errors_num++;
+	if (batch->errors_num != 1)
+		return;
+
+	va_start (ap, format);
+	vsnprintf (batch->first_error, sizeof (batch->first_error), format, ap);
+	batch->first_error[sizeof (batch->first_error) - 1] = 0;
+	va_end (ap);
+} /* }}} void putbatch_error */
+
+static int putbatch_flush (putbatch_t *batch) /* {{{ */
+{
+	size_t i;
+	int status;
+
+	if (batch->vl_num == 0)
+		return (0);
+
+	for (i = 0; i < batch->vl_num; i++)
+		batch->vl[i].values = batch->values + batch->values_offset[i];
+
+	status = plugin_dispatch_values_batch (batch->vl, batch->vl_num);
+	if (status != 0)
+		putbatch_error (batch, "Dispatching %zu value lists failed.",
+				batch->vl_num);
+	else
+		batch->dispatched_num += batch->vl_num;
+
+	batch->vl_num = 0;
+	batch->values_num = 0;
+
+	return (status);
+} /* }}} int putbatch_flush */
+
+static int putbatch_append (value_list_t const *vl, void *user_data) /* {{{ */
+{
+	putbatch_t *batch = user_data;
+	value_list_t *new_vl;
+
+	if (batch->vl_num >= batch->vl_size)
+	{
+		size_t new_size = (batch->vl_size == 0) ? 64 : 2 * batch->vl_size;
+		size_t *tmp;
+
+		new_vl = realloc (batch->vl, new_size * sizeof (*batch->vl));
+		if (new_vl == NULL)
+			return (ENOMEM);
+		batch->vl = new_vl;
+
+		tmp = realloc (batch->values_offset,
+				new_size * sizeof (*batch->values_offset));
+		if (tmp == NULL)
+			return (ENOMEM);
+		batch->values_offset = tmp;
+
+		batch->vl_size = new_size;
+	}
+
+	if ((batch->values_num + vl->values_len) > batch->values_size)
+	{
+		size_t new_size = (batch->values_size == 0) ? 256 : batch->values_size;
+		value_t *tmp;
+
+		while (new_size < (batch->values_num + vl->values_len))
+			new_size *= 2;
+
+		tmp = realloc (batch->values, new_size * sizeof (*batch->values));
+		if (tmp == NULL)
+			return (ENOMEM);
+		batch->values = tmp;
+		batch->values_size = new_size;
+	}
+
+	memcpy (batch->values + batch->values_num, vl->values,
+			vl->values_len * sizeof (*vl->values));
+
+	new_vl = batch->vl + batch->vl_num;
+	memcpy (new_vl, vl, sizeof (*new_vl));
+	new_vl->values = NULL;
+	new_vl->meta = NULL;
+	batch->values_offset[batch->vl_num] = batch->values_num;
+
+	batch->values_num += vl->values_len;
+	batch->vl_num++;
+
+	if (batch->vl_num >= PUTBATCH_CHUNK_SIZE)
+		putbatch_flush (batch);
+
+	return (0);
+} /* }}} int putbatch_append */
+
+putbatch_t *putbatch_create (void) /* {{{ */
+{
+	putbatch_t *batch;
+
+	batch = malloc (sizeof (*batch));
+	if (batch == NULL)
+		return (NULL);
+	memset (batch, 0, sizeof (*batch));
+
+	return (batch);
+} /* }}} putbatch_t *putbatch_create */
+
+void putbatch_destroy (putbatch_t *batch) /* {{{ */
+{
+	if (batch == NULL)
+		return;
+
+	sfree (batch->vl);
+	sfree (batch->values_offset);
+	sfree (batch->values);
+	sfree (batch);
+} /* }}} void putbatch_destroy */
+
+int putbatch_add_line (putbatch_t *batch, char *buffer) /* {{{ */
+{
+	char errbuf[256];
+	int status;
+
+	batch->lines_num++;
+
+	status = parse_putval (buffer, putbatch_append, batch,
+			/* values num = */ NULL, errbuf, sizeof (errbuf));
+	if (status != 0)
+	{
+		putbatch_error (batch, "Line %zu: %s", batch->lines_num, errbuf);
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int putbatch_add_line */
+
+static int putbatch_read_string (char const *payload, /* {{{ */
+		size_t payload_size, char *output, size_t output_size)
+{
+	if ((payload_size == 0) || (payload_size > output_size)
+			|| (payload[payload_size - 1] != 0))
+		return (-1);
+
+	memcpy (output, payload, payload_size);
+	return (0);
+} /* }}} int putbatch_read_string */
+
+static int putbatch_read_number (char const *payload, /* {{{ */
+		size_t payload_size, uint64_t *ret_value)
+{
+	uint64_t tmp;
+
+	if (payload_size != sizeof (tmp))
+		return (-1);
+
+	memcpy (&tmp, payload, sizeof (tmp));
+	*ret_value = ntohll (tmp);
+	return (0);
+} /* }}} int putbatch_read_number */
+
+/* Reads a values part into "values" and the data source types of the values
+ * into "types". */
+static int putbatch_read_values (char const *payload, /* {{{ */
+		size_t payload_size, value_list_t *vl, value_t *values,
+		uint8_t *types_out, size_t values_size)
+{
+	uint16_t tmp16;
+	size_t num;
+	uint8_t const *types;
+	size_t i;
+
+	if (payload_size < sizeof (tmp16))
+		return (-1);
+
+	memcpy (&tmp16, payload, sizeof (tmp16));
+	num = (size_t) ntohs (tmp16);
+	if ((num == 0) || (num > values_size)
+			|| (payload_size != sizeof (tmp16)
+				+ num * (sizeof (uint8_t) + sizeof (value_t))))
+		return (-1);
+
+	types = (uint8_t const *) (payload + sizeof (tmp16));
+	memcpy (values, types + num, num * sizeof (value_t));
+	memcpy (types_out, types, num * sizeof (*types));
+
+	for (i = 0; i < num; i++)
+	{
+		switch (types[i])
+		{
+			case DS_TYPE_COUNTER:
+				values[i].counter = (counter_t) ntohll (values[i].counter);
+				break;
+			case DS_TYPE_GAUGE:
+				values[i].gauge = (gauge_t) ntohd (values[i].gauge);
+				break;
+			case DS_TYPE_DERIVE:
+				values[i].derive = (derive_t) ntohll (values[i].derive);
+				break;
+			case DS_TYPE_ABSOLUTE:
+				values[i].absolute = (absolute_t) ntohll (values[i].absolute);
+				break;
+			default:
+				return (-1);
+		}
+	}
+
+	vl->values = values;
+	vl->values_len = num;
+	return (0);
+} /* }}} int putbatch_read_values */
+
+int putbatch_add_binary (putbatch_t *batch, /* {{{ */
+		void *buffer, size_t buffer_size)
+{
+	char const *ptr = buffer;
+	size_t remaining = buffer_size;
+	value_list_t vl = VALUE_LIST_INIT;
+	value_t values[64];
+	uint8_t types[STATIC_ARRAY_SIZE (values)];
+
+	memset (&vl, 0, sizeof (vl));
+
+	while (remaining > 0)
+	{
+		uint16_t tmp16;
+		uint16_t part_type;
+		size_t part_size;
+		char const *payload;
+		size_t payload_size;
+		uint64_t tmp64;
+		int status = 0;
+
+		if (remaining < 2 * sizeof (tmp16))
+		{
+			putbatch_error (batch, "Byte %zu: Truncated part header.",
+					buffer_size - remaining);
+			return (-1);
+		}
+
+		memcpy (&tmp16, ptr, sizeof (tmp16));
+		part_type = ntohs (tmp16);
+		memcpy (&tmp16, ptr + sizeof (tmp16), sizeof (tmp16));
+		part_size = (size_t) ntohs (tmp16);
+
+		if ((part_size < 2 * sizeof (tmp16)) || (part_size > remaining))
+		{
+			putbatch_error (batch, "Byte %zu: Invalid part size %zu.",
+					buffer_size - remaining, part_size);
+			return (-1);
+		}
+
+		payload = ptr + 2 * sizeof (tmp16);
+		payload_size = part_size - 2 * sizeof (tmp16);
+
+		switch (part_type)
+		{
+			case TYPE_HOST:
+				status = putbatch_read_string (payload, payload_size,
+						vl.host, sizeof (vl.host));
+				break;
+			case TYPE_PLUGIN:
+				status = putbatch_read_string (payload, payload_size,
+						vl.plugin, sizeof (vl.plugin));
+				break;
+			case TYPE_PLUGIN_INSTANCE:
+				status = putbatch_read_string (payload, payload_size,
+						vl.plugin_instance, sizeof (vl.plugin_instance));
+				break;
+			case TYPE_TYPE:
+				status = putbatch_read_string (payload, payload_size,
+						vl.type, sizeof (vl.type));
+				break;
+			case TYPE_TYPE_INSTANCE:
+				status = putbatch_read_string (payload, payload_size,
+						vl.type_instance, sizeof (vl.type_instance));
+				break;
+			case TYPE_TIME:
+				status = putbatch_read_number (payload, payload_size, &tmp64);
+				if (status == 0)
+					vl.time = TIME_T_TO_CDTIME_T (tmp64);
+				break;
+			case TYPE_TIME_HR:
+				status = putbatch_read_number (payload, payload_size, &tmp64);
+				if (status == 0)
+					vl.time = (cdtime_t) tmp64;
+				break;
+			case TYPE_INTERVAL:
+				status = putbatch_read_number (payload, payload_size, &tmp64);
+				if (status == 0)
+					vl.interval = TIME_T_TO_CDTIME_T (tmp64);
+				break;
+			case TYPE_INTERVAL_HR:
+				status = putbatch_read_number (payload, payload_size, &tmp64);
+				if (status == 0)
+					vl.interval = (cdtime_t) tmp64;
+				break;
+			case TYPE_VALUES:
+			{
+				const data_set_t *ds;
+				size_t i = 0;
+
+				status = putbatch_read_values (payload, payload_size, &vl,
+						values, types, STATIC_ARRAY_SIZE (values));
+				if (status != 0)
+					break;
+
+				ds = plugin_get_ds (vl.type);
+				if (ds != NULL)
+				{
+					for (i = 0; i < ds->ds_num && i < vl.values_len; i++)
+						if (ds->ds[i].type != (int) types[i])
+							break;
+				}
+
+				if (ds == NULL)
+					putbatch_error (batch, "Byte %zu: Type `%s' isn't defined.",
+							buffer_size - remaining, vl.type);
+				else if (ds->ds_num != vl.values_len)
+					putbatch_error (batch, "Byte %zu: Type `%s' expects %zu "
+							"values, got %zu.", buffer_size - remaining,
+							vl.type, ds->ds_num, vl.values_len);
+				else if (i < vl.values_len)
+					putbatch_error (batch, "Byte %zu: Data source %zu of "
+							"type `%s' is a %s, got a %s.",
+							buffer_size - remaining, i, vl.type,
+							DS_TYPE_TO_STRING (ds->ds[i].type),
+							DS_TYPE_TO_STRING (types[i]));
+				else if (putbatch_append (&vl, batch) != 0)
+					putbatch_error (batch, "Byte %zu: Out of memory.",
+							buffer_size - remaining);
+
+				vl.values = NULL;
+				vl.values_len = 0;
+				break;
+			}
+			case TYPE_ENCR_AES256:
+				putbatch_error (batch, "Byte %zu: Encrypted parts are not "
+						"supported.", buffer_size - remaining);
+				return (-1);
+			default:
+				/* Notifications and signatures are ignored. */
+				break;
+		}
+
+		if (status != 0)
+		{
+			putbatch_error (batch, "Byte %zu: Malformed part of type %#x.",
+					buffer_size - remaining, (unsigned int) part_type);
+			return (-1);
+		}
+
+		ptr += part_size;
+		remaining -= part_size;
+	} /* while (remaining > 0) */
+
+	return (0);
+} /* }}} int putbatch_add_binary */
+
+int handle_putbatch_end (FILE *fh, putbatch_t *batch) /* {{{ */
+{
+	size_t dispatched_num;
+	size_t errors_num;
+
+	putbatch_flush (batch);
+
+	dispatched_num = batch->dispatched_num;
+	errors_num = batch->errors_num;
+
+	batch->lines_num = 0;
+	batch->dispatched_num = 0;
+	batch->errors_num = 0;
+
+	if (errors_num != 0)
+	{
+		print_to_socket (fh, "-1 %zu %s, %zu %s been dispatched. "
+				"First error: %s\n",
+				errors_num, (errors_num == 1) ? "error" : "errors",
+				dispatched_num,
+				(dispatched_num == 1) ? "value has" : "values have",
+				batch->first_error);
+		return (-1);
+	}
+
+	print_to_socket (fh, "0 Success: %zu %s been dispatched.\n",
+			dispatched_num,
+			(dispatched_num == 1) ? "value has" : "values have");
+	return (0);
+} /* }}} int handle_putbatch_end */
+
+int handle_putbin (FILE *fh, char *buffer, size_t *ret_size) /* {{{ */
+{
+	char *command = NULL;
+	char *size_str = NULL;
+	char *endptr = NULL;
+	unsigned long long size;
+
+	if ((parse_string (&buffer, &command) != 0)
+			|| (strcasecmp ("PUTBIN", command) != 0))
+	{
+		print_to_socket (fh, "-1 Cannot parse command.\n");
+		return (-1);
+	}
+
+	if ((parse_string (&buffer, &size_str) != 0) || (*buffer != 0))
+	{
+		print_to_socket (fh, "-1 Usage: PUTBIN <size>\n");
+		return (-1);
+	}
+
+	errno = 0;
+	size = strtoull (size_str, &endptr, 10);
+	if ((errno != 0) || (endptr == size_str) || (*endptr != 0)
+			|| (size == 0) || (size > PUTBATCH_BINARY_MAX))
+	{
+		print_to_socket (fh, "-1 Invalid size: %s (maximum: %i)\n",
+				size_str, PUTBATCH_BINARY_MAX);
+		return (-1);
+	}
+
+	*ret_size = (size_t) size;
+	return (0);
+} /* }}} int handle_putbin */
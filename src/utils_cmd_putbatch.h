@@ -0,0 +1,58 @@
+/**
+ * collectd - src/utils_cmd_putbatch.h
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+#ifndef UTILS_CMD_PUTBATCH_H
+#define UTILS_CMD_PUTBATCH_H 1
+
+#include <stdio.h>
+
+#include "plugin.h"
+
+/* Upper limit for the payload of a single PUTBIN command. */
+#define PUTBATCH_BINARY_MAX (16 * 1024 * 1024)
+
+struct putbatch_s;
+typedef struct putbatch_s putbatch_t;
+
+putbatch_t *putbatch_create (void);
+void putbatch_destroy (putbatch_t *batch);
+
+/* Parses one PUTVAL line and adds the contained value lists to the batch.
+ * Errors are remembered and reported by `handle_putbatch_end'. */
+int putbatch_add_line (putbatch_t *batch, char *buffer);
+
+/* Decodes a packet in the binary network protocol, as produced by the
+ * libcollectdclient network buffer, and adds all value lists to the batch.
+ * Signed and encrypted parts are not supported. */
+int putbatch_add_binary (putbatch_t *batch, void *buffer, size_t buffer_size);
+
+/* Dispatches all remaining value lists, prints a single status line for the
+ * entire batch to `fh' and resets the batch. */
+int handle_putbatch_end (FILE *fh, putbatch_t *batch);
+
+/* Parses the size argument of a "PUTBIN <size>" command line. Prints an
+ * error to `fh' and returns a negative value on failure. */
+int handle_putbin (FILE *fh, char *buffer, size_t *ret_size);
+
+#endif /* UTILS_CMD_PUTBATCH_H */
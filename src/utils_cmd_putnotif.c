@@ -38,7 +38,6 @@
           fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf))); \
       return -1; \
     } \
-    fflush(fh); \
   } while (0)
 
 static int set_option_severity (notification_t *n, const char *value)
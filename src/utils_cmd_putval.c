@@ -36,10 +36,8 @@
             char errbuf[1024]; \
             WARNING ("handle_putval: failed to write to socket #%i: %s", \
                     fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf))); \
-            sfree (vl.values); \
             return -1; \
         } \
-        fflush(fh); \
     } while (0)
 
 static int set_option (value_list_t *vl, const char *key, const char *value)
@@ -66,7 +64,10 @@ static int set_option (value_list_t *vl, const char *key, const char *value)
 	return (0);
 } /* int parse_option */
 
-int handle_putval (FILE *fh, char *buffer)
+int parse_putval (char *buffer, /* {{{ */
+		int (*callback) (value_list_t const *vl, void *user_data),
+		void *user_data, int *ret_values_num,
+		char *errbuf, size_t errbuf_size)
 {
 	char *command;
 	char *identifier;
@@ -84,21 +85,23 @@ int handle_putval (FILE *fh, char *buffer)
 	value_list_t vl = VALUE_LIST_INIT;
 	vl.values = NULL;
 
-	DEBUG ("utils_cmd_putval: handle_putval (fh = %p, buffer = %s);",
-			(void *) fh, buffer);
+	DEBUG ("utils_cmd_putval: parse_putval (buffer = %s);", buffer);
+
+	if (ret_values_num != NULL)
+		*ret_values_num = 0;
 
 	command = NULL;
 	status = parse_string (&buffer, &command);
 	if (status != 0)
 	{
-		print_to_socket (fh, "-1 Cannot parse command.\n");
+		ssnprintf (errbuf, errbuf_size, "Cannot parse command.");
 		return (-1);
 	}
 	assert (command != NULL);
 
 	if (strcasecmp ("PUTVAL", command) != 0)
 	{
-		print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
+		ssnprintf (errbuf, errbuf_size, "Unexpected command: `%s'.", command);
 		return (-1);
 	}
 
@@ -106,7 +109,7 @@ int handle_putval (FILE *fh, char *buffer)
 	status = parse_string (&buffer, &identifier);
 	if (status != 0)
 	{
-		print_to_socket (fh, "-1 Cannot parse identifier.\n");
+		ssnprintf (errbuf, errbuf_size, "Cannot parse identifier.");
 		return (-1);
 	}
 	assert (identifier != NULL);
@@ -120,9 +123,9 @@ int handle_putval (FILE *fh, char *buffer)
 			&type, &type_instance);
 	if (status != 0)
 	{
-		DEBUG ("handle_putval: Cannot parse identifier `%s'.",
+		DEBUG ("parse_putval: Cannot parse identifier `%s'.",
 				identifier);
-		print_to_socket (fh, "-1 Cannot parse identifier `%s'.\n",
+		ssnprintf (errbuf, errbuf_size, "Cannot parse identifier `%s'.",
 				identifier);
 		sfree (identifier_copy);
 		return (-1);
@@ -135,7 +138,7 @@ int handle_putval (FILE *fh, char *buffer)
 			|| ((type_instance != NULL)
 				&& (strlen (type_instance) >= sizeof (vl.type_instance))))
 	{
-		print_to_socket (fh, "-1 Identifier too long.\n");
+		ssnprintf (errbuf, errbuf_size, "Identifier too long.");
 		sfree (identifier_copy);
 		return (-1);
 	}
@@ -150,7 +153,7 @@ int handle_putval (FILE *fh, char *buffer)
 
 	ds = plugin_get_ds (type);
 	if (ds == NULL) {
-		print_to_socket (fh, "-1 Type `%s' isn't defined.\n", type);
+		ssnprintf (errbuf, errbuf_size, "Type `%s' isn't defined.", type);
 		sfree (identifier_copy);
 		return (-1);
 	}
@@ -165,7 +168,7 @@ int handle_putval (FILE *fh, char *buffer)
 	vl.values = (value_t *) malloc (vl.values_len * sizeof (value_t));
 	if (vl.values == NULL)
 	{
-		print_to_socket (fh, "-1 malloc failed.\n");
+		ssnprintf (errbuf, errbuf_size, "malloc failed.");
 		return (-1);
 	}
 
@@ -181,7 +184,7 @@ int handle_putval (FILE *fh, char *buffer)
 		{
 			/* parse_option failed, buffer has been modified.
 			 * => we need to abort */
-			print_to_socket (fh, "-1 Misformatted option.\n");
+			ssnprintf (errbuf, errbuf_size, "Misformatted option.");
 			sfree (vl.values);
 			return (-1);
 		}
@@ -198,7 +201,7 @@ int handle_putval (FILE *fh, char *buffer)
 		status = parse_string (&buffer, &string);
 		if (status != 0)
 		{
-			print_to_socket (fh, "-1 Misformatted value.\n");
+			ssnprintf (errbuf, errbuf_size, "Misformatted value.");
 			sfree (vl.values);
 			return (-1);
 		}
@@ -207,21 +210,59 @@ int handle_putval (FILE *fh, char *buffer)
 		status = parse_values (string, &vl, ds);
 		if (status != 0)
 		{
-			print_to_socket (fh, "-1 Parsing the values string failed.\n");
+			ssnprintf (errbuf, errbuf_size,
+					"Parsing the values string failed.");
+			sfree (vl.values);
+			return (-1);
+		}
+
+		status = (*callback) (&vl, user_data);
+		if (status != 0)
+		{
+			ssnprintf (errbuf, errbuf_size,
+					"Dispatching the values failed.");
 			sfree (vl.values);
 			return (-1);
 		}
 
-		plugin_dispatch_values (&vl);
 		values_submitted++;
+		if (ret_values_num != NULL)
+			*ret_values_num = values_submitted;
 	} /* while (*buffer != 0) */
 	/* Done parsing the options. */
 
+	sfree (vl.values);
+	return (0);
+} /* }}} int parse_putval */
+
+static int putval_dispatch (value_list_t const *vl, /* {{{ */
+		void __attribute__((unused)) *user_data)
+{
+	plugin_dispatch_values (vl);
+	return (0);
+} /* }}} int putval_dispatch */
+
+int handle_putval (FILE *fh, char *buffer)
+{
+	char errbuf[1024];
+	int values_submitted = 0;
+	int status;
+
+	DEBUG ("utils_cmd_putval: handle_putval (fh = %p, buffer = %s);",
+			(void *) fh, buffer);
+
+	status = parse_putval (buffer, putval_dispatch, /* user data = */ NULL,
+			&values_submitted, errbuf, sizeof (errbuf));
+	if (status != 0)
+	{
+		print_to_socket (fh, "-1 %s\n", errbuf);
+		return (-1);
+	}
+
 	print_to_socket (fh, "0 Success: %i %s been dispatched.\n",
 			values_submitted,
 			(values_submitted == 1) ? "value has" : "values have");
 
-	sfree (vl.values);
 	return (0);
 } /* int handle_putval */
 
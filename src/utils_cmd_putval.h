@@ -33,6 +33,15 @@
 
 int handle_putval (FILE *fh, char *buffer);
 
+/* Parses a PUTVAL command line without dispatching anything. `callback' is
+ * called once for each values string on the line. On failure, a negative
+ * value is returned and a description of the problem is stored in
+ * `errbuf'. */
+int parse_putval (char *buffer,
+		int (*callback) (value_list_t const *vl, void *user_data),
+		void *user_data, int *ret_values_num,
+		char *errbuf, size_t errbuf_size);
+
 int create_putval (char *ret, size_t ret_len,
 		const data_set_t *ds, const value_list_t *vl);
 
@@ -0,0 +1,342 @@
+/**
+ * collectd - src/utils_format.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_format.h"
+
+#include <float.h>
+#include <math.h>
+
+/*
+ * Numbers
+ */
+static const char fmt_digit_pairs[201] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+/* Powers of ten which can be represented exactly. */
+static const double fmt_pow10[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Number of significant digits printed by GAUGE_FORMAT. */
+#define FMT_DOUBLE_DIGITS 15
+
+size_t fmt_uint64 (char *buffer, uint64_t value) /* {{{ */
+{
+  char tmp[20];
+  size_t pos = sizeof (tmp);
+  size_t len;
+
+  /* Two digits at a time, starting with the least significant ones. */
+  while (value >= 100)
+  {
+    unsigned int i = (unsigned int) (value % 100) * 2;
+    value /= 100;
+    tmp[--pos] = fmt_digit_pairs[i + 1];
+    tmp[--pos] = fmt_digit_pairs[i];
+  }
+  if (value >= 10)
+  {
+    unsigned int i = (unsigned int) value * 2;
+    tmp[--pos] = fmt_digit_pairs[i + 1];
+    tmp[--pos] = fmt_digit_pairs[i];
+  }
+  else
+    tmp[--pos] = (char) ('0' + value);
+
+  len = sizeof (tmp) - pos;
+  memcpy (buffer, tmp + pos, len);
+  buffer[len] = 0;
+  return (len);
+} /* }}} size_t fmt_uint64 */
+
+size_t fmt_int64 (char *buffer, int64_t value) /* {{{ */
+{
+  if (value < 0)
+  {
+    buffer[0] = '-';
+    /* Negate in unsigned arithmetic so INT64_MIN doesn't overflow. */
+    return (1 + fmt_uint64 (buffer + 1, ~((uint64_t) value) + 1));
+  }
+
+  return (fmt_uint64 (buffer, (uint64_t) value));
+} /* }}} size_t fmt_int64 */
+
+/* Returns "value * 10^exp" rounded to the nearest integer, ties to even, like
+ * printf does. "value * 10^exp" must be below 2^53 and "value" must not be
+ * negative. */
+static uint64_t fmt_scale_round (double value, int exp) /* {{{ */
+{
+  double scaled = value * fmt_pow10[exp];
+  uint64_t ret = (uint64_t) scaled;
+  double frac = scaled - (double) ret;
+  double ulp = scaled * DBL_EPSILON;
+
+  /* "scaled" has been rounded, so the fraction is only known up to one unit
+   * in the last place. If that is not enough to decide, add the rounding
+   * error of the product, which a fused multiply-add computes exactly. Both
+   * terms are exact, so the sign of the sum is right. */
+  if (fabs (frac - 0.5) <= ulp)
+  {
+    double error = fma (value, fmt_pow10[exp], -scaled);
+    double tie = (frac - 0.5) + error;
+
+    frac = (tie > 0.0) ? 1.0 : ((tie < 0.0) ? 0.0 : 0.5);
+  }
+
+  if ((frac > 0.5) || ((frac == 0.5) && ((ret % 2) != 0)))
+    ret++;
+
+  return (ret);
+} /* }}} uint64_t fmt_scale_round */
+
+size_t fmt_double (char *buffer, double value) /* {{{ */
+{
+  char digits[FMT_NUMBER_MAX];
+  double abs_value = fabs (value);
+  uint64_t mantissa;
+  size_t len;
+  size_t pos = 0;
+  int exp;
+  int i;
+
+  if ((abs_value < 1e15) && (value == (double) ((int64_t) value)))
+  {
+    if ((value == 0.0) && signbit (value))
+    {
+      sstrncpy (buffer, "-0", FMT_NUMBER_MAX);
+      return (2);
+    }
+    return (fmt_int64 (buffer, (int64_t) value));
+  }
+
+  /* NaN, infinity and everything printed in exponential notation. */
+  if (!isfinite (value) || (abs_value < 1e-4) || (abs_value >= 1e15))
+    return ((size_t) ssnprintf (buffer, FMT_NUMBER_MAX, GAUGE_FORMAT, value));
+
+  /* Estimate the decimal exponent, then correct it so that the rounded
+   * mantissa has exactly FMT_DOUBLE_DIGITS digits. */
+  exp = 0;
+  if (abs_value >= 1.0)
+    while ((exp < 14) && (abs_value >= fmt_pow10[exp + 1]))
+      exp++;
+  else
+    while ((exp > -4) && (abs_value * fmt_pow10[-exp] < 1.0))
+      exp--;
+
+  while (42)
+  {
+    mantissa = fmt_scale_round (abs_value, FMT_DOUBLE_DIGITS - 1 - exp);
+    if ((mantissa >= 1000000000000000ULL) && (exp < 14))
+      exp++;
+    else if ((mantissa < 100000000000000ULL) && (exp > -4))
+      exp--;
+    else
+      break;
+  }
+
+  /* Rounding carried over into the exponent range printed with "e". */
+  if (mantissa >= 1000000000000000ULL)
+    return ((size_t) ssnprintf (buffer, FMT_NUMBER_MAX, GAUGE_FORMAT, value));
+
+  len = fmt_uint64 (digits, mantissa);
+  assert (len == FMT_DOUBLE_DIGITS);
+  /* Trailing zeros are not printed, like with "%g". */
+  while ((len > 0) && (digits[len - 1] == '0'))
+    len--;
+
+  if (value < 0)
+    buffer[pos++] = '-';
+
+  if (exp >= 0)
+  {
+    memcpy (buffer + pos, digits, (size_t) exp + 1);
+    pos += (size_t) exp + 1;
+    if (len > (size_t) exp + 1)
+    {
+      buffer[pos++] = '.';
+      memcpy (buffer + pos, digits + exp + 1, len - (size_t) exp - 1);
+      pos += len - (size_t) exp - 1;
+    }
+  }
+  else
+  {
+    buffer[pos++] = '0';
+    buffer[pos++] = '.';
+    for (i = -1; i > exp; i--)
+      buffer[pos++] = '0';
+    memcpy (buffer + pos, digits, len);
+    pos += len;
+  }
+
+  buffer[pos] = 0;
+  return (pos);
+} /* }}} size_t fmt_double */
+
+size_t fmt_double_fixed (char *buffer, double value, int decimals) /* {{{ */
+{
+  static const uint64_t divisors[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL
+  };
+  uint64_t scaled;
+  uint64_t frac;
+  size_t pos = 0;
+  int i;
+
+  assert ((decimals >= 0) && (decimals <= 9));
+  assert (!isfinite (value) || (fabs (value) < 1e15));
+
+  /* The scaled value must be exact in a double for the rounding below. */
+  if (!isfinite (value)
+      || (fabs (value) * fmt_pow10[decimals] >= 9007199254740992.0))
+    return ((size_t) ssnprintf (buffer, FMT_NUMBER_MAX, "%.*f",
+          decimals, value));
+
+  scaled = fmt_scale_round (fabs (value), decimals);
+
+  /* printf prints the sign of negative values that round to zero, too. */
+  if (signbit (value))
+    buffer[pos++] = '-';
+  pos += fmt_uint64 (buffer + pos, scaled / divisors[decimals]);
+  if (decimals > 0)
+  {
+    frac = scaled % divisors[decimals];
+    buffer[pos++] = '.';
+    for (i = decimals - 1; i >= 0; i--)
+    {
+      buffer[pos + i] = (char) ('0' + (frac % 10));
+      frac /= 10;
+    }
+    pos += decimals;
+  }
+
+  buffer[pos] = 0;
+  return (pos);
+} /* }}} size_t fmt_double_fixed */
+
+size_t fmt_value (char *buffer, int ds_type, value_t value) /* {{{ */
+{
+  switch (ds_type)
+  {
+    case DS_TYPE_GAUGE:
+      return (fmt_double (buffer, value.gauge));
+    case DS_TYPE_COUNTER:
+      return (fmt_uint64 (buffer, (uint64_t) value.counter));
+    case DS_TYPE_DERIVE:
+      return (fmt_int64 (buffer, value.derive));
+    case DS_TYPE_ABSOLUTE:
+      return (fmt_uint64 (buffer, value.absolute));
+  }
+
+  buffer[0] = 0;
+  return (0);
+} /* }}} size_t fmt_value */
+
+/*
+ * Buffers
+ */
+void fmt_buffer_init (fmt_buffer_t *b, char *data, size_t size, /* {{{ */
+    size_t fill)
+{
+  b->data = data;
+  b->size = size;
+  b->fill = fill;
+  b->overflow = (size == 0) || (fill >= size);
+} /* }}} void fmt_buffer_init */
+
+void fmt_append (fmt_buffer_t *b, char const *str, size_t len) /* {{{ */
+{
+  if (b->overflow)
+    return;
+
+  if (len >= (b->size - b->fill))
+  {
+    b->overflow = 1;
+    return;
+  }
+
+  memcpy (b->data + b->fill, str, len);
+  b->fill += len;
+  b->data[b->fill] = 0;
+} /* }}} void fmt_append */
+
+void fmt_append_string (fmt_buffer_t *b, char const *str) /* {{{ */
+{
+  fmt_append (b, str, strlen (str));
+} /* }}} void fmt_append_string */
+
+void fmt_append_char (fmt_buffer_t *b, char c) /* {{{ */
+{
+  fmt_append (b, &c, 1);
+} /* }}} void fmt_append_char */
+
+void fmt_append_uint64 (fmt_buffer_t *b, uint64_t value) /* {{{ */
+{
+  char tmp[FMT_NUMBER_MAX];
+  fmt_append (b, tmp, fmt_uint64 (tmp, value));
+} /* }}} void fmt_append_uint64 */
+
+void fmt_append_double (fmt_buffer_t *b, double value) /* {{{ */
+{
+  char tmp[FMT_NUMBER_MAX];
+  fmt_append (b, tmp, fmt_double (tmp, value));
+} /* }}} void fmt_append_double */
+
+void fmt_append_double_fixed (fmt_buffer_t *b, double value, /* {{{ */
+    int decimals)
+{
+  char tmp[FMT_NUMBER_MAX];
+
+  if (isfinite (value) && (fabs (value) >= 1e15))
+  {
+    char big[DBL_MAX_10_EXP + 16];
+    int len = ssnprintf (big, sizeof (big), "%.*f", decimals, value);
+    if (len > 0)
+      fmt_append (b, big, (size_t) len);
+    return;
+  }
+
+  fmt_append (b, tmp, fmt_double_fixed (tmp, value, decimals));
+} /* }}} void fmt_append_double_fixed */
+
+void fmt_append_value (fmt_buffer_t *b, int ds_type, value_t value) /* {{{ */
+{
+  char tmp[FMT_NUMBER_MAX];
+  fmt_append (b, tmp, fmt_value (tmp, ds_type, value));
+} /* }}} void fmt_append_value */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,80 @@
+/**
+ * collectd - src/utils_format.h
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+#ifndef UTILS_FORMAT_H
+#define UTILS_FORMAT_H 1
+
+#include "collectd.h"
+#include "plugin.h"
+
+/*
+ * Building blocks shared by the output formats (Graphite, OpenTSDB, JSON):
+ * appending to a caller provided buffer without going through
+ * printf(3) and fast number conversion.
+ */
+
+/* Enough for any number formatted by the functions below, including the
+ * terminating null byte. */
+#define FMT_NUMBER_MAX 32
+
+/* Writes "value" as decimal number to "buffer", which must hold at least
+ * FMT_NUMBER_MAX bytes, and returns the length excluding the null byte. */
+size_t fmt_uint64 (char *buffer, uint64_t value);
+size_t fmt_int64 (char *buffer, int64_t value);
+
+/* Same output as printf(3) with GAUGE_FORMAT ("%.15g"). Values in the range
+ * that is printed in fixed point notation are converted without printf. */
+size_t fmt_double (char *buffer, double value);
+
+/* Same output as printf(3) with "%.<decimals>f". "decimals" must be at most
+ * nine and the absolute value below 1e15, so that the result fits into
+ * FMT_NUMBER_MAX bytes. fmt_append_double_fixed() accepts any value. */
+size_t fmt_double_fixed (char *buffer, double value, int decimals);
+
+/* Formats a value of the given data source type. */
+size_t fmt_value (char *buffer, int ds_type, value_t value);
+
+/* Output buffer. The append functions stop writing and set "overflow" once
+ * the data doesn't fit anymore, so callers only check once when they are
+ * done. "fill" never exceeds "size - 1" and the data is null terminated. */
+struct fmt_buffer_s
+{
+  char *data;
+  size_t size;
+  size_t fill;
+  _Bool overflow;
+};
+typedef struct fmt_buffer_s fmt_buffer_t;
+
+void fmt_buffer_init (fmt_buffer_t *b, char *data, size_t size, size_t fill);
+
+void fmt_append (fmt_buffer_t *b, char const *str, size_t len);
+void fmt_append_string (fmt_buffer_t *b, char const *str);
+void fmt_append_char (fmt_buffer_t *b, char c);
+void fmt_append_uint64 (fmt_buffer_t *b, uint64_t value);
+void fmt_append_double (fmt_buffer_t *b, double value);
+void fmt_append_double_fixed (fmt_buffer_t *b, double value, int decimals);
+void fmt_append_value (fmt_buffer_t *b, int ds_type, value_t value);
+
+#endif /* UTILS_FORMAT_H */
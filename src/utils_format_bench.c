@@ -0,0 +1,247 @@
+/**
+ * collectd - src/utils_format_bench.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+/*
+ * Microbenchmark of the Graphite, OpenTSDB and JSON formats. Compares the
+ * printf based formatting the writers used before with utils_format, and
+ * the JSON stream with and without its template cache.
+ * Build with "make bench_utils_format" and run without arguments.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "utils_format.h"
+#include "utils_format_graphite.h"
+#include "utils_format_json.h"
+
+#define BENCH_HOSTS 16
+#define BENCH_INSTANCES 64
+#define BENCH_ROUNDS 200
+
+static double now_seconds (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ((double) ts.tv_sec + ((double) ts.tv_nsec) / 1e9);
+}
+
+/* The escaping and formatting the Graphite format used before, condensed. */
+static void legacy_escape (char *dst, char const *src, size_t dst_len)
+{
+  size_t i;
+
+  for (i = 0; (i < dst_len - 1) && (src[i] != 0); i++)
+    dst[i] = ((src[i] == '.') || isspace ((int) src[i])
+        || iscntrl ((int) src[i])) ? '_' : src[i];
+  dst[i] = 0;
+}
+
+static size_t legacy_graphite (char *buffer, size_t buffer_size,
+    value_list_t const *vl)
+{
+  char host[DATA_MAX_NAME_LEN];
+  char plugin[DATA_MAX_NAME_LEN];
+  char plugin_instance[DATA_MAX_NAME_LEN];
+  char type[DATA_MAX_NAME_LEN];
+  char type_instance[DATA_MAX_NAME_LEN];
+  char key[10 * DATA_MAX_NAME_LEN];
+  char value[512];
+  char *ptr;
+
+  legacy_escape (host, vl->host, sizeof (host));
+  legacy_escape (plugin, vl->plugin, sizeof (plugin));
+  legacy_escape (plugin_instance, vl->plugin_instance,
+      sizeof (plugin_instance));
+  legacy_escape (type, vl->type, sizeof (type));
+  legacy_escape (type_instance, vl->type_instance, sizeof (type_instance));
+
+  ssnprintf (key, sizeof (key), "collectd.%s.%s-%s.%s-%s",
+      host, plugin, plugin_instance, type, type_instance);
+  for (ptr = key + strcspn (key, " \t\"\\:!/()\n\r"); *ptr != 0;
+      ptr += strcspn (ptr, " \t\"\\:!/()\n\r"))
+    *ptr = '_';
+
+  ssnprintf (value, sizeof (value), GAUGE_FORMAT, vl->values[0].gauge);
+  return ((size_t) ssnprintf (buffer, buffer_size, "%s %s %u\r\n", key, value,
+        (unsigned int) CDTIME_T_TO_TIME_T (vl->time)));
+}
+
+static size_t legacy_tsdb (char *buffer, size_t buffer_size,
+    value_list_t const *vl)
+{
+  char key[10 * DATA_MAX_NAME_LEN];
+  char value[512];
+
+  ssnprintf (key, sizeof (key), "%s.%s.%s.%s", vl->plugin,
+      vl->plugin_instance, vl->type, vl->type_instance);
+  ssnprintf (value, sizeof (value), GAUGE_FORMAT, vl->values[0].gauge);
+  return ((size_t) ssnprintf (buffer, buffer_size,
+        "put %s %.0f %s fqdn=%s %s %s\r\n", key, CDTIME_T_TO_DOUBLE (vl->time),
+        value, vl->host, "", "dc=zrh"));
+}
+
+static size_t fast_tsdb (char *buffer, size_t buffer_size,
+    value_list_t const *vl)
+{
+  fmt_buffer_t b;
+
+  fmt_buffer_init (&b, buffer, buffer_size, 0);
+  fmt_append (&b, "put ", 4);
+  fmt_append_string (&b, vl->plugin);
+  fmt_append_char (&b, '.');
+  fmt_append_string (&b, vl->plugin_instance);
+  fmt_append_char (&b, '.');
+  fmt_append_string (&b, vl->type);
+  fmt_append_char (&b, '.');
+  fmt_append_string (&b, vl->type_instance);
+  fmt_append_char (&b, ' ');
+  fmt_append_uint64 (&b, (uint64_t) CDTIME_T_TO_TIME_T (vl->time));
+  fmt_append_char (&b, ' ');
+  fmt_append_double (&b, vl->values[0].gauge);
+  fmt_append (&b, " fqdn=", 6);
+  fmt_append_string (&b, vl->host);
+  fmt_append (&b, "  dc=zrh\r\n", 10);
+  return (b.fill);
+}
+
+enum bench_mode_e
+{
+  GRAPHITE_LEGACY,
+  GRAPHITE_FAST,
+  TSDB_LEGACY,
+  TSDB_FAST,
+  JSON_BUFFER,
+  JSON_STREAM,
+};
+
+static value_list_t vls[BENCH_HOSTS * BENCH_INSTANCES];
+static value_t values[BENCH_HOSTS * BENCH_INSTANCES];
+
+/* The identifiers are set up once so that only formatting is measured. */
+static void init_value_lists (void)
+{
+  size_t i;
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (vls); i++)
+  {
+    value_list_t *vl = vls + i;
+
+    memset (vl, 0, sizeof (*vl));
+    vl->values = values + i;
+    vl->values_len = 1;
+    ssnprintf (vl->host, sizeof (vl->host), "node%03zu.cluster.example.com",
+        i / BENCH_INSTANCES);
+    sstrncpy (vl->plugin, "cpu", sizeof (vl->plugin));
+    ssnprintf (vl->plugin_instance, sizeof (vl->plugin_instance), "%zu",
+        i % BENCH_INSTANCES);
+    sstrncpy (vl->type, "cpu", sizeof (vl->type));
+    sstrncpy (vl->type_instance, "idle", sizeof (vl->type_instance));
+  }
+}
+
+static void run (char const *name, enum bench_mode_e mode)
+{
+  data_source_t dsrc = { "value", DS_TYPE_GAUGE, 0, NAN };
+  data_set_t ds = { "cpu", 1, &dsrc };
+  char buffer[1024];
+  format_json_stream_t *stream = NULL;
+  size_t bytes = 0;
+  size_t lines = 0;
+  double start;
+  double elapsed;
+  int round;
+  size_t i;
+
+  if (mode == JSON_STREAM)
+    stream = format_json_stream_create (65536,
+        (strstr (name, "cache") != NULL) ? 4096 : 0);
+
+  start = now_seconds ();
+  for (round = 0; round < BENCH_ROUNDS; round++)
+  {
+    for (i = 0; i < STATIC_ARRAY_SIZE (vls); i++)
+    {
+      value_list_t *vl = vls + i;
+      size_t fill = 0;
+
+      vl->time = TIME_T_TO_CDTIME_T (1420070400 + round);
+      values[i].gauge = 12345.0 * (double) (i + 1) / (round + 1);
+
+      switch (mode)
+      {
+        case GRAPHITE_LEGACY:
+          fill = legacy_graphite (buffer, sizeof (buffer), vl);
+          break;
+        case GRAPHITE_FAST:
+          format_graphite_append (buffer, sizeof (buffer), &fill, &ds, vl,
+              "collectd.", NULL, '_', 0);
+          break;
+        case TSDB_LEGACY:
+          fill = legacy_tsdb (buffer, sizeof (buffer), vl);
+          break;
+        case TSDB_FAST:
+          fill = fast_tsdb (buffer, sizeof (buffer), vl);
+          break;
+        case JSON_BUFFER:
+        {
+          size_t bfree = sizeof (buffer);
+          format_json_value_list (buffer, &fill, &bfree, &ds, vl, 0);
+          break;
+        }
+        case JSON_STREAM:
+          fill = format_json_stream_length (stream);
+          format_json_stream_value_list (stream, &ds, vl, 0);
+          fill = format_json_stream_length (stream) - fill;
+          if (format_json_stream_length (stream) > 1048576)
+            format_json_stream_reset (stream);
+          break;
+      }
+
+      bytes += fill;
+      lines++;
+    }
+  }
+  elapsed = now_seconds () - start;
+  format_json_stream_destroy (stream);
+
+  printf ("%-18s %8.1f ns/line %8.1f MB/s\n", name,
+      1e9 * elapsed / (double) lines, ((double) bytes) / elapsed / 1e6);
+}
+
+int main (void)
+{
+  init_value_lists ();
+
+  run ("graphite printf", GRAPHITE_LEGACY);
+  run ("graphite", GRAPHITE_FAST);
+  run ("tsdb printf", TSDB_LEGACY);
+  run ("tsdb", TSDB_FAST);
+  run ("json", JSON_BUFFER);
+  run ("json stream", JSON_STREAM);
+  run ("json stream cache", JSON_STREAM);
+
+  return (0);
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -26,6 +26,7 @@
 #include "common.h"
 
 #include "utils_format_graphite.h"
+#include "utils_format.h"
 #include "utils_cache.h"
 
 #define GRAPHITE_FORBIDDEN " \t\"\\:!/()\n\r"
@@ -33,225 +34,197 @@
 /* Utils functions to format data sets in graphite format.
  * Largely taken from write_graphite.c as it remains the same formatting */
 
-static int gr_format_values (char *ret, size_t ret_len,
-        int ds_num, const data_set_t *ds, const value_list_t *vl,
-        gauge_t const *rates)
-{
-    size_t offset = 0;
-    int status;
-
-    assert (0 == strcmp (ds->type, vl->type));
-
-    memset (ret, 0, ret_len);
-
-#define BUFFER_ADD(...) do { \
-    status = ssnprintf (ret + offset, ret_len - offset, \
-            __VA_ARGS__); \
-    if (status < 1) \
-    { \
-        return (-1); \
-    } \
-    else if (((size_t) status) >= (ret_len - offset)) \
-    { \
-        return (-1); \
-    } \
-    else \
-    offset += ((size_t) status); \
-} while (0)
-
-    if (ds->ds[ds_num].type == DS_TYPE_GAUGE)
-        BUFFER_ADD (GAUGE_FORMAT, vl->values[ds_num].gauge);
-    else if (rates != NULL)
-        BUFFER_ADD ("%f", rates[ds_num]);
-    else if (ds->ds[ds_num].type == DS_TYPE_COUNTER)
-        BUFFER_ADD ("%llu", vl->values[ds_num].counter);
-    else if (ds->ds[ds_num].type == DS_TYPE_DERIVE)
-        BUFFER_ADD ("%"PRIi64, vl->values[ds_num].derive);
-    else if (ds->ds[ds_num].type == DS_TYPE_ABSOLUTE)
-        BUFFER_ADD ("%"PRIu64, vl->values[ds_num].absolute);
-    else
-    {
-        ERROR ("gr_format_values plugin: Unknown data source type: %i",
-                ds->ds[ds_num].type);
-        return (-1);
-    }
-
-#undef BUFFER_ADD
-
-    return (0);
-}
-
-static void gr_copy_escape_part (char *dst, const char *src, size_t dst_len,
-    char escape_char)
+/* Characters which are replaced: GR_FORBIDDEN in every part of the metric
+ * name, GR_SPECIAL (dots, white space and control characters) in addition
+ * in the fields of the identifier. */
+#define GR_FORBIDDEN 0x01
+#define GR_SPECIAL   0x02
+#define GR_BOTH      (GR_FORBIDDEN | GR_SPECIAL)
+static const unsigned char gr_escape_table[256] = {
+    /* control characters */
+    GR_SPECIAL, GR_SPECIAL, GR_SPECIAL, GR_SPECIAL,
+    GR_SPECIAL, GR_SPECIAL, GR_SPECIAL, GR_SPECIAL,
+    GR_SPECIAL, GR_BOTH,    GR_BOTH,    GR_SPECIAL,  /* \t \n */
+    GR_SPECIAL, GR_BOTH,    GR_SPECIAL, GR_SPECIAL,  /* \r */
+    GR_SPECIAL, GR_SPECIAL, GR_SPECIAL, GR_SPECIAL,
+    GR_SPECIAL, GR_SPECIAL, GR_SPECIAL, GR_SPECIAL,
+    GR_SPECIAL, GR_SPECIAL, GR_SPECIAL, GR_SPECIAL,
+    GR_SPECIAL, GR_SPECIAL, GR_SPECIAL, GR_SPECIAL,
+    [' ']  = GR_BOTH,
+    ['!']  = GR_BOTH,
+    ['"']  = GR_BOTH,
+    ['(']  = GR_BOTH,
+    [')']  = GR_BOTH,
+    ['.']  = GR_SPECIAL,
+    ['/']  = GR_BOTH,
+    [':']  = GR_BOTH,
+    ['\\'] = GR_BOTH,
+    [127]  = GR_SPECIAL,
+};
+
+/* Appends "src", replacing the characters selected by "mask". */
+static void gr_append_escaped (fmt_buffer_t *b, char const *src,
+        char escape_char, unsigned char mask)
 {
+    size_t len = strlen (src);
+    char *dst;
     size_t i;
 
-    memset (dst, 0, dst_len);
-
-    if (src == NULL)
+    if (b->overflow)
         return;
-
-    for (i = 0; i < dst_len; i++)
+    if (len >= (b->size - b->fill))
     {
-        if (src[i] == 0)
-        {
-            dst[i] = 0;
-            break;
-        }
+        b->overflow = 1;
+        return;
+    }
 
-        if ((src[i] == '.')
-                || isspace ((int) src[i])
-                || iscntrl ((int) src[i]))
+    dst = b->data + b->fill;
+    for (i = 0; i < len; i++)
+    {
+        if (gr_escape_table[(unsigned char) src[i]] & mask)
             dst[i] = escape_char;
         else
             dst[i] = src[i];
     }
+    b->fill += len;
+    b->data[b->fill] = 0;
 }
 
-static int gr_format_name (char *ret, int ret_len,
+/* Appends the name without the data source, i.e.
+ * "<prefix><host><postfix>.<plugin>-<plugin instance>.<type>-<type instance>" */
+static void gr_append_name (fmt_buffer_t *b,
         value_list_t const *vl,
-        char const *ds_name,
         char const *prefix,
         char const *postfix,
         char const escape_char,
         unsigned int flags)
 {
-    char n_host[DATA_MAX_NAME_LEN];
-    char n_plugin[DATA_MAX_NAME_LEN];
-    char n_plugin_instance[DATA_MAX_NAME_LEN];
-    char n_type[DATA_MAX_NAME_LEN];
-    char n_type_instance[DATA_MAX_NAME_LEN];
-
-    char tmp_plugin[2 * DATA_MAX_NAME_LEN + 1];
-    char tmp_type[2 * DATA_MAX_NAME_LEN + 1];
-
-    if (prefix == NULL)
-        prefix = "";
-
-    if (postfix == NULL)
-        postfix = "";
-
-    gr_copy_escape_part (n_host, vl->host,
-            sizeof (n_host), escape_char);
-    gr_copy_escape_part (n_plugin, vl->plugin,
-            sizeof (n_plugin), escape_char);
-    gr_copy_escape_part (n_plugin_instance, vl->plugin_instance,
-            sizeof (n_plugin_instance), escape_char);
-    gr_copy_escape_part (n_type, vl->type,
-            sizeof (n_type), escape_char);
-    gr_copy_escape_part (n_type_instance, vl->type_instance,
-            sizeof (n_type_instance), escape_char);
-
-    if (n_plugin_instance[0] != '\0')
-        ssnprintf (tmp_plugin, sizeof (tmp_plugin), "%s%c%s",
-            n_plugin,
-            (flags & GRAPHITE_SEPARATE_INSTANCES) ? '.' : '-',
-            n_plugin_instance);
-    else
-        sstrncpy (tmp_plugin, n_plugin, sizeof (tmp_plugin));
+    char separator = (flags & GRAPHITE_SEPARATE_INSTANCES) ? '.' : '-';
 
-    if (n_type_instance[0] != '\0')
-        ssnprintf (tmp_type, sizeof (tmp_type), "%s%c%s",
-            n_type,
-            (flags & GRAPHITE_SEPARATE_INSTANCES) ? '.' : '-',
-            n_type_instance);
-    else
-        sstrncpy (tmp_type, n_type, sizeof (tmp_type));
+    if (prefix != NULL)
+        gr_append_escaped (b, prefix, escape_char, GR_FORBIDDEN);
+    gr_append_escaped (b, vl->host, escape_char, GR_BOTH);
+    if (postfix != NULL)
+        gr_append_escaped (b, postfix, escape_char, GR_FORBIDDEN);
 
-    /* Assert always_append_ds -> ds_name */
-    assert (!(flags & GRAPHITE_ALWAYS_APPEND_DS) || (ds_name != NULL));
-    if (ds_name != NULL)
-        ssnprintf (ret, ret_len, "%s%s%s.%s.%s.%s",
-            prefix, n_host, postfix, tmp_plugin, tmp_type, ds_name);
-    else
-        ssnprintf (ret, ret_len, "%s%s%s.%s.%s",
-            prefix, n_host, postfix, tmp_plugin, tmp_type);
-
-    return (0);
-}
-
-static void escape_graphite_string (char *buffer, char escape_char)
-{
-	char *head;
-
-	assert (strchr(GRAPHITE_FORBIDDEN, escape_char) == NULL);
+    fmt_append_char (b, '.');
+    gr_append_escaped (b, vl->plugin, escape_char, GR_BOTH);
+    if (vl->plugin_instance[0] != '\0')
+    {
+        fmt_append_char (b, separator);
+        gr_append_escaped (b, vl->plugin_instance, escape_char, GR_BOTH);
+    }
 
-	for (head = buffer + strcspn(buffer, GRAPHITE_FORBIDDEN);
-	     *head != '\0';
-	     head += strcspn(head, GRAPHITE_FORBIDDEN))
-		*head = escape_char;
+    fmt_append_char (b, '.');
+    gr_append_escaped (b, vl->type, escape_char, GR_BOTH);
+    if (vl->type_instance[0] != '\0')
+    {
+        fmt_append_char (b, separator);
+        gr_append_escaped (b, vl->type_instance, escape_char, GR_BOTH);
+    }
 }
 
-int format_graphite (char *buffer, size_t buffer_size,
+int format_graphite_append (char *buffer, size_t buffer_size,
+    size_t *buffer_fill,
     data_set_t const *ds, value_list_t const *vl,
     char const *prefix, char const *postfix, char const escape_char,
     unsigned int flags)
 {
-    int status = 0;
+    fmt_buffer_t b;
     size_t i;
-    int buffer_pos = 0;
+    size_t name_pos = 0;
+    size_t name_len = 0;
+    char time_str[FMT_NUMBER_MAX];
+    size_t time_len;
 
     gauge_t *rates = NULL;
+
+    assert (strchr (GRAPHITE_FORBIDDEN, escape_char) == NULL);
+
+    if (0 != strcmp (ds->type, vl->type))
+    {
+        ERROR ("format_graphite: DS type does not match value list type");
+        return (-1);
+    }
+
     if (flags & GRAPHITE_STORE_RATES)
       rates = uc_get_rate (ds, vl);
 
+    time_len = fmt_uint64 (time_str,
+            (uint64_t) CDTIME_T_TO_TIME_T (vl->time));
+
+    fmt_buffer_init (&b, buffer, buffer_size, *buffer_fill);
     for (i = 0; i < ds->ds_num; i++)
     {
-        char const *ds_name = NULL;
-        char        key[10*DATA_MAX_NAME_LEN];
-        char        values[512];
-        size_t      message_len;
-        char        message[1024];
+        int ds_type = ds->ds[i].type;
+
+        /* The name is only formatted for the first data source and copied
+         * for all others. */
+        if (i == 0)
+        {
+            name_pos = b.fill;
+            gr_append_name (&b, vl, prefix, postfix, escape_char, flags);
+            name_len = b.fill - name_pos;
+        }
+        else
+            fmt_append (&b, b.data + name_pos, name_len);
 
         if ((flags & GRAPHITE_ALWAYS_APPEND_DS)
             || (ds->ds_num > 1))
-          ds_name = ds->ds[i].name;
-
-        /* Copy the identifier to `key' and escape it. */
-        status = gr_format_name (key, sizeof (key), vl, ds_name,
-                    prefix, postfix, escape_char, flags);
-        if (status != 0)
         {
-            ERROR ("format_graphite: error with gr_format_name");
-            sfree (rates);
-            return (status);
+            fmt_append_char (&b, '.');
+            gr_append_escaped (&b, ds->ds[i].name, escape_char, GR_FORBIDDEN);
         }
 
-        escape_graphite_string (key, escape_char);
-        /* Convert the values to an ASCII representation and put that into
-         * `values'. */
-        status = gr_format_values (values, sizeof (values), i, ds, vl, rates);
-        if (status != 0)
+        fmt_append_char (&b, ' ');
+        if (ds_type == DS_TYPE_GAUGE)
+            fmt_append_double (&b, vl->values[i].gauge);
+        else if (rates != NULL)
+            fmt_append_double_fixed (&b, rates[i], 6);
+        else if ((ds_type == DS_TYPE_COUNTER) || (ds_type == DS_TYPE_DERIVE)
+                || (ds_type == DS_TYPE_ABSOLUTE))
+            fmt_append_value (&b, ds_type, vl->values[i]);
+        else
         {
-            ERROR ("format_graphite: error with gr_format_values");
+            ERROR ("format_graphite: Unknown data source type: %i", ds_type);
             sfree (rates);
-            return (status);
+            return (-1);
         }
 
-        /* Compute the graphite command */
-        message_len = (size_t) ssnprintf (message, sizeof (message),
-                "%s %s %u\r\n",
-                key,
-                values,
-                (unsigned int) CDTIME_T_TO_TIME_T (vl->time));
-        if (message_len >= sizeof (message)) {
-            ERROR ("format_graphite: message buffer too small: "
-                    "Need %zu bytes.", message_len + 1);
-            sfree (rates);
-            return (-ENOMEM);
-        }
+        fmt_append_char (&b, ' ');
+        fmt_append (&b, time_str, time_len);
+        fmt_append (&b, "\r\n", 2);
 
-        /* Append it in case we got multiple data set */
-        if ((buffer_pos + message_len) >= buffer_size)
-        {
-            ERROR ("format_graphite: target buffer too small");
-            sfree (rates);
-            return (-ENOMEM);
-        }
-        memcpy((void *) (buffer + buffer_pos), message, message_len);
-        buffer_pos += message_len;
+        if (b.overflow)
+            break;
     }
     sfree (rates);
+
+    if (b.overflow)
+    {
+        /* Leave the buffer as it was. */
+        if (*buffer_fill < buffer_size)
+            buffer[*buffer_fill] = 0;
+        return (-ENOMEM);
+    }
+
+    *buffer_fill = b.fill;
+    return (0);
+} /* int format_graphite_append */
+
+int format_graphite (char *buffer, size_t buffer_size,
+    data_set_t const *ds, value_list_t const *vl,
+    char const *prefix, char const *postfix, char const escape_char,
+    unsigned int flags)
+{
+    size_t buffer_fill = 0;
+    int status;
+
+    status = format_graphite_append (buffer, buffer_size, &buffer_fill,
+            ds, vl, prefix, postfix, escape_char, flags);
+    if (status == -ENOMEM)
+        ERROR ("format_graphite: target buffer too small");
+
     return (status);
 } /* int format_graphite */
 
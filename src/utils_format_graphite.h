@@ -35,4 +35,13 @@ int format_graphite (char *buffer,
     const char *postfix, const char escape_char,
     unsigned int flags);
 
+/* Like format_graphite(), but appends the lines at "*buffer_fill" and updates
+ * it. Returns -ENOMEM without changing "*buffer_fill" if the lines don't fit
+ * into the buffer. */
+int format_graphite_append (char *buffer, size_t buffer_size,
+    size_t *buffer_fill,
+    const data_set_t *ds, const value_list_t *vl,
+    const char *prefix, const char *postfix, const char escape_char,
+    unsigned int flags);
+
 #endif /* UTILS_FORMAT_GRAPHITE_H */
@@ -29,94 +29,125 @@
 #include "common.h"
 
 #include "utils_cache.h"
+#include "utils_format.h"
 #include "utils_format_json.h"
 
-static int json_escape_string (char *buffer, size_t buffer_size, /* {{{ */
-    const char *string)
-{
-  size_t src_pos;
-  size_t dst_pos;
+/* Upper limit for the size of a single value list. */
+#define JSON_VALUE_LIST_MAX (1024 * 1024)
 
-  if ((buffer == NULL) || (string == NULL))
-    return (-EINVAL);
+/* Associativity of the template cache; a power of two. */
+#define JSON_TEMPLATE_WAYS 4
 
-  if (buffer_size < 3)
-    return (-ENOMEM);
-
-  dst_pos = 0;
+/* The parts of a value list's JSON object which only depend on its identifier
+ * (and therefore the data set): the "dstypes" and "dsnames" arrays, and the
+ * escaped identifier fields. The object is assembled from these and the
+ * values, time, interval and meta data. */
+struct json_template_s
+{
+  uint32_t hash;
+  /* The identifier fields, each null terminated. */
+  char *key;
+  size_t key_len;
+  /* ',"dstypes":[...],"dsnames":[...]' followed by ',"host":...' */
+  char *data;
+  size_t ds_len;
+  size_t id_len;
+};
+typedef struct json_template_s json_template_t;
+
+struct format_json_stream_s
+{
+  format_json_chunk_t *head;
+  format_json_chunk_t *tail;
+  size_t chunk_size;
+  size_t length;
+  size_t values_num;
+  _Bool finalized;
+
+  /* Cache of templates, indexed by the hash of the identifier. */
+  json_template_t *templates;
+  size_t templates_mask;
+};
+
+static void json_append_escaped (fmt_buffer_t *b, /* {{{ */
+    const char *string)
+{
+  size_t len = strlen (string);
+  char *dst;
+  size_t i;
 
-#define BUFFER_ADD(c) do { \
-  if (dst_pos >= (buffer_size - 1)) { \
-    buffer[buffer_size - 1] = 0; \
-    return (-ENOMEM); \
-  } \
-  buffer[dst_pos] = (c); \
-  dst_pos++; \
-} while (0)
+  /* Escaping at most doubles the length; two bytes for the quotes. */
+  if (b->overflow || ((2 * len + 2) >= (b->size - b->fill)))
+  {
+    /* Slow path, only taken when the buffer is almost full. */
+    fmt_append_char (b, '"');
+    for (i = 0; i < len; i++)
+    {
+      if ((string[i] == '"') || (string[i] == '\\'))
+      {
+        fmt_append_char (b, '\\');
+        fmt_append_char (b, string[i]);
+      }
+      else if (string[i] <= 0x001F)
+        fmt_append_char (b, '?');
+      else
+        fmt_append_char (b, string[i]);
+    }
+    fmt_append_char (b, '"');
+    return;
+  }
 
-  /* Escape special characters */
-  BUFFER_ADD ('"');
-  for (src_pos = 0; string[src_pos] != 0; src_pos++)
+  dst = b->data + b->fill;
+  *(dst++) = '"';
+  for (i = 0; i < len; i++)
   {
-    if ((string[src_pos] == '"')
-        || (string[src_pos] == '\\'))
+    if ((string[i] == '"') || (string[i] == '\\'))
     {
-      BUFFER_ADD ('\\');
-      BUFFER_ADD (string[src_pos]);
+      *(dst++) = '\\';
+      *(dst++) = string[i];
     }
-    else if (string[src_pos] <= 0x001F)
-      BUFFER_ADD ('?');
+    else if (string[i] <= 0x001F)
+      *(dst++) = '?';
     else
-      BUFFER_ADD (string[src_pos]);
-  } /* for */
-  BUFFER_ADD ('"');
-  buffer[dst_pos] = 0;
-
-#undef BUFFER_ADD
+      *(dst++) = string[i];
+  }
+  *(dst++) = '"';
+  *dst = 0;
+  b->fill = (size_t) (dst - b->data);
+} /* }}} void json_append_escaped */
 
-  return (0);
-} /* }}} int json_escape_string */
+static void json_append_gauge (fmt_buffer_t *b, gauge_t value) /* {{{ */
+{
+  if (!isfinite (value))
+    fmt_append (b, "null", 4);
+  /* The comparison of the constants is folded by the compiler. */
+  else if (strcmp (JSON_GAUGE_FORMAT, GAUGE_FORMAT) == 0)
+    fmt_append_double (b, value);
+  else
+  {
+    char tmp[64];
+    int len = ssnprintf (tmp, sizeof (tmp), JSON_GAUGE_FORMAT, value);
+    if (len > 0)
+      fmt_append (b, tmp, (size_t) len);
+  }
+} /* }}} void json_append_gauge */
 
-static int values_to_json (char *buffer, size_t buffer_size, /* {{{ */
-                const data_set_t *ds, const value_list_t *vl, int store_rates)
+static int json_append_values (fmt_buffer_t *b, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl, int store_rates)
 {
-  size_t offset = 0;
   size_t i;
   gauge_t *rates = NULL;
 
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  int status; \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-  { \
-    sfree(rates); \
-    return (-1); \
-  } \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-  { \
-    sfree(rates); \
-    return (-ENOMEM); \
-  } \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
-  BUFFER_ADD ("[");
+  fmt_append_char (b, '[');
   for (i = 0; i < ds->ds_num; i++)
   {
+    int ds_type = ds->ds[i].type;
+
     if (i > 0)
-      BUFFER_ADD (",");
+      fmt_append_char (b, ',');
 
-    if (ds->ds[i].type == DS_TYPE_GAUGE)
-    {
-      if(isfinite (vl->values[i].gauge))
-        BUFFER_ADD (JSON_GAUGE_FORMAT, vl->values[i].gauge);
-      else
-        BUFFER_ADD ("null");
-    }
+    if (ds_type == DS_TYPE_GAUGE)
+      json_append_gauge (b, vl->values[i].gauge);
     else if (store_rates)
     {
       if (rates == NULL)
@@ -124,148 +155,91 @@ static int values_to_json (char *buffer, size_t buffer_size, /* {{{ */
       if (rates == NULL)
       {
         WARNING ("utils_format_json: uc_get_rate failed.");
-        sfree(rates);
         return (-1);
       }
 
-      if(isfinite (rates[i]))
-        BUFFER_ADD (JSON_GAUGE_FORMAT, rates[i]);
-      else
-        BUFFER_ADD ("null");
+      json_append_gauge (b, rates[i]);
     }
-    else if (ds->ds[i].type == DS_TYPE_COUNTER)
-      BUFFER_ADD ("%llu", vl->values[i].counter);
-    else if (ds->ds[i].type == DS_TYPE_DERIVE)
-      BUFFER_ADD ("%"PRIi64, vl->values[i].derive);
-    else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
-      BUFFER_ADD ("%"PRIu64, vl->values[i].absolute);
+    else if ((ds_type == DS_TYPE_COUNTER) || (ds_type == DS_TYPE_DERIVE)
+        || (ds_type == DS_TYPE_ABSOLUTE))
+      fmt_append_value (b, ds_type, vl->values[i]);
     else
     {
-      ERROR ("format_json: Unknown data source type: %i",
-          ds->ds[i].type);
+      ERROR ("format_json: Unknown data source type: %i", ds_type);
       sfree (rates);
       return (-1);
     }
   } /* for ds->ds_num */
-  BUFFER_ADD ("]");
-
-#undef BUFFER_ADD
+  fmt_append_char (b, ']');
 
-  DEBUG ("format_json: values_to_json: buffer = %s;", buffer);
-  sfree(rates);
+  sfree (rates);
   return (0);
-} /* }}} int values_to_json */
+} /* }}} int json_append_values */
 
-static int dstypes_to_json (char *buffer, size_t buffer_size, /* {{{ */
-                const data_set_t *ds)
+/* Appends ',"dstypes":[...],"dsnames":[...]'. */
+static void json_append_data_set (fmt_buffer_t *b, /* {{{ */
+    const data_set_t *ds)
 {
-  size_t offset = 0;
   size_t i;
 
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  int status; \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
-  BUFFER_ADD ("[");
+  fmt_append_string (b, ",\"dstypes\":[");
   for (i = 0; i < ds->ds_num; i++)
   {
     if (i > 0)
-      BUFFER_ADD (",");
-
-    BUFFER_ADD ("\"%s\"", DS_TYPE_TO_STRING (ds->ds[i].type));
-  } /* for ds->ds_num */
-  BUFFER_ADD ("]");
-
-#undef BUFFER_ADD
-
-  DEBUG ("format_json: dstypes_to_json: buffer = %s;", buffer);
-
-  return (0);
-} /* }}} int dstypes_to_json */
-
-static int dsnames_to_json (char *buffer, size_t buffer_size, /* {{{ */
-                const data_set_t *ds)
-{
-  size_t offset = 0;
-  size_t i;
+      fmt_append_char (b, ',');
+    fmt_append_char (b, '"');
+    fmt_append_string (b, DS_TYPE_TO_STRING (ds->ds[i].type));
+    fmt_append_char (b, '"');
+  }
 
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  int status; \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
-  BUFFER_ADD ("[");
+  fmt_append_string (b, "],\"dsnames\":[");
   for (i = 0; i < ds->ds_num; i++)
   {
     if (i > 0)
-      BUFFER_ADD (",");
-
-    BUFFER_ADD ("\"%s\"", ds->ds[i].name);
-  } /* for ds->ds_num */
-  BUFFER_ADD ("]");
-
-#undef BUFFER_ADD
-
-  DEBUG ("format_json: dsnames_to_json: buffer = %s;", buffer);
-
-  return (0);
-} /* }}} int dsnames_to_json */
+      fmt_append_char (b, ',');
+    fmt_append_char (b, '"');
+    fmt_append_string (b, ds->ds[i].name);
+    fmt_append_char (b, '"');
+  }
+  fmt_append_char (b, ']');
+} /* }}} void json_append_data_set */
 
-static int meta_data_to_json (char *buffer, size_t buffer_size, /* {{{ */
+/* Appends ',"host":"...",...,"type_instance":"..."'. */
+static void json_append_identifier (fmt_buffer_t *b, /* {{{ */
+    const value_list_t *vl)
+{
+  fmt_append_string (b, ",\"host\":");
+  json_append_escaped (b, vl->host);
+  fmt_append_string (b, ",\"plugin\":");
+  json_append_escaped (b, vl->plugin);
+  fmt_append_string (b, ",\"plugin_instance\":");
+  json_append_escaped (b, vl->plugin_instance);
+  fmt_append_string (b, ",\"type\":");
+  json_append_escaped (b, vl->type);
+  fmt_append_string (b, ",\"type_instance\":");
+  json_append_escaped (b, vl->type_instance);
+} /* }}} void json_append_identifier */
+
+/* Appends ',"meta":{...}' if there is meta data which can be represented. */
+static void json_append_meta_data (fmt_buffer_t *b, /* {{{ */
     meta_data_t *meta)
 {
-  size_t offset = 0;
   char **keys = NULL;
   int keys_num;
-  int status;
+  int printed = 0;
   int i;
 
-  buffer[0] = 0;
-
-  if (meta == NULL)
-    return (EINVAL);
-
-#define BUFFER_ADD(...) do { \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
   keys_num = meta_data_toc (meta, &keys);
-  if (keys_num == 0)
-  {
-    sfree (keys);
-    return (0);
-  }
-
   for (i = 0; i < keys_num; ++i)
   {
-    int type;
     char *key = keys[i];
+    size_t fill = b->fill;
+    _Bool ok = 0;
+    int type;
+
+    fmt_append_string (b, (printed == 0) ? ",\"meta\":{\"" : ",\"");
+    fmt_append_string (b, key);
+    fmt_append (b, "\":", 2);
 
     type = meta_data_type (meta, key);
     if (type == MD_TYPE_STRING)
@@ -273,148 +247,497 @@ static int meta_data_to_json (char *buffer, size_t buffer_size, /* {{{ */
       char *value = NULL;
       if (meta_data_get_string (meta, key, &value) == 0)
       {
-        char temp[512] = "";
-        json_escape_string (temp, sizeof (temp), value);
-        sfree (value);
-        BUFFER_ADD (",\"%s\":%s", key, temp);
+        json_append_escaped (b, value);
+        ok = 1;
       }
+      sfree (value);
     }
     else if (type == MD_TYPE_SIGNED_INT)
     {
       int64_t value = 0;
       if (meta_data_get_signed_int (meta, key, &value) == 0)
-        BUFFER_ADD (",\"%s\":%"PRIi64, key, value);
+      {
+        char tmp[FMT_NUMBER_MAX];
+        fmt_append (b, tmp, fmt_int64 (tmp, value));
+        ok = 1;
+      }
     }
     else if (type == MD_TYPE_UNSIGNED_INT)
     {
       uint64_t value = 0;
       if (meta_data_get_unsigned_int (meta, key, &value) == 0)
-        BUFFER_ADD (",\"%s\":%"PRIu64, key, value);
+      {
+        fmt_append_uint64 (b, value);
+        ok = 1;
+      }
     }
     else if (type == MD_TYPE_DOUBLE)
     {
       double value = 0.0;
       if (meta_data_get_double (meta, key, &value) == 0)
-        BUFFER_ADD (",\"%s\":%f", key, value);
+      {
+        fmt_append_double_fixed (b, value, 6);
+        ok = 1;
+      }
     }
     else if (type == MD_TYPE_BOOLEAN)
     {
       _Bool value = 0;
       if (meta_data_get_boolean (meta, key, &value) == 0)
-        BUFFER_ADD (",\"%s\":%s", key, value ? "true" : "false");
+      {
+        fmt_append_string (b, value ? "true" : "false");
+        ok = 1;
+      }
+    }
+
+    if (ok)
+      printed++;
+    else if (!b->overflow)
+    {
+      /* Remove the key again. */
+      b->fill = fill;
+      b->data[fill] = 0;
     }
 
     free (key);
   } /* for (keys) */
   free (keys);
 
-  if (offset <= 0)
-    return (ENOENT);
+  if (printed > 0)
+    fmt_append_char (b, '}');
+} /* }}} void json_append_meta_data */
+
+/* Appends one value list as JSON object, preceded by "separator". The static
+ * parts are copied from the template "t", if given. Returns non-zero if the
+ * values could not be formatted; the caller checks for overflow. */
+static int json_append_value_list (fmt_buffer_t *b, /* {{{ */
+    char separator, const data_set_t *ds, const value_list_t *vl,
+    int store_rates, const json_template_t *t)
+{
+  int status;
+
+  fmt_append_char (b, separator);
+  fmt_append_string (b, "{\"values\":");
+  status = json_append_values (b, ds, vl, store_rates);
+  if (status != 0)
+    return (status);
+
+  if (t != NULL)
+    fmt_append (b, t->data, t->ds_len);
+  else
+    json_append_data_set (b, ds);
+
+  fmt_append_string (b, ",\"time\":");
+  fmt_append_double_fixed (b, CDTIME_T_TO_DOUBLE (vl->time), 3);
+  fmt_append_string (b, ",\"interval\":");
+  fmt_append_double_fixed (b, CDTIME_T_TO_DOUBLE (vl->interval), 3);
 
-  buffer[0] = '{'; /* replace leading ',' */
-  BUFFER_ADD ("}");
+  if (t != NULL)
+    fmt_append (b, t->data + t->ds_len, t->id_len);
+  else
+    json_append_identifier (b, vl);
 
-#undef BUFFER_ADD
+  if (vl->meta != NULL)
+    json_append_meta_data (b, vl->meta);
 
+  fmt_append_char (b, '}');
   return (0);
-} /* }}} int meta_data_to_json */
+} /* }}} int json_append_value_list */
 
-static int value_list_to_json (char *buffer, size_t buffer_size, /* {{{ */
-                const data_set_t *ds, const value_list_t *vl, int store_rates)
+/*
+ * Template cache
+ */
+static uint32_t json_identifier_hash (const value_list_t *vl) /* {{{ */
 {
-  char temp[512];
-  size_t offset = 0;
-  int status;
+  const char *fields[] = { vl->host, vl->plugin, vl->plugin_instance,
+    vl->type, vl->type_instance };
+  uint32_t hash = 2166136261U;
+  size_t i;
 
-  memset (buffer, 0, buffer_size);
+  /* FNV-1a, including the terminating null bytes. */
+  for (i = 0; i < STATIC_ARRAY_SIZE (fields); i++)
+  {
+    const unsigned char *ptr = (const unsigned char *) fields[i];
+    do
+    {
+      hash ^= (uint32_t) *ptr;
+      hash *= 16777619U;
+    } while (*(ptr++) != 0);
+  }
 
-#define BUFFER_ADD(...) do { \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
+  return (hash);
+} /* }}} uint32_t json_identifier_hash */
 
-  /* All value lists have a leading comma. The first one will be replaced with
-   * a square bracket in `format_json_finalize'. */
-  BUFFER_ADD (",{");
+static _Bool json_template_matches (const json_template_t *t, /* {{{ */
+    uint32_t hash, const value_list_t *vl)
+{
+  const char *fields[] = { vl->host, vl->plugin, vl->plugin_instance,
+    vl->type, vl->type_instance };
+  const char *key;
+  size_t i;
 
-  status = values_to_json (temp, sizeof (temp), ds, vl, store_rates);
-  if (status != 0)
-    return (status);
-  BUFFER_ADD ("\"values\":%s", temp);
+  if ((t->key == NULL) || (t->hash != hash))
+    return (0);
 
-  status = dstypes_to_json (temp, sizeof (temp), ds);
-  if (status != 0)
-    return (status);
-  BUFFER_ADD (",\"dstypes\":%s", temp);
+  key = t->key;
+  for (i = 0; i < STATIC_ARRAY_SIZE (fields); i++)
+  {
+    if (strcmp (key, fields[i]) != 0)
+      return (0);
+    key += strlen (key) + 1;
+  }
 
-  status = dsnames_to_json (temp, sizeof (temp), ds);
-  if (status != 0)
-    return (status);
-  BUFFER_ADD (",\"dsnames\":%s", temp);
+  return (1);
+} /* }}} _Bool json_template_matches */
 
-  BUFFER_ADD (",\"time\":%.3f", CDTIME_T_TO_DOUBLE (vl->time));
-  BUFFER_ADD (",\"interval\":%.3f", CDTIME_T_TO_DOUBLE (vl->interval));
+static int json_template_build (json_template_t *t, /* {{{ */
+    uint32_t hash, const data_set_t *ds, const value_list_t *vl)
+{
+  const char *fields[] = { vl->host, vl->plugin, vl->plugin_instance,
+    vl->type, vl->type_instance };
+  size_t data_size = 128;
+  size_t key_size = 0;
+  fmt_buffer_t b;
+  size_t i;
 
-#define BUFFER_ADD_KEYVAL(key, value) do { \
-  status = json_escape_string (temp, sizeof (temp), (value)); \
-  if (status != 0) \
-    return (status); \
-  BUFFER_ADD (",\"%s\":%s", (key), temp); \
-} while (0)
+  for (i = 0; i < ds->ds_num; i++)
+    data_size += strlen (ds->ds[i].name) + 16;
+  for (i = 0; i < STATIC_ARRAY_SIZE (fields); i++)
+  {
+    size_t len = strlen (fields[i]);
+    key_size += len + 1;
+    data_size += 2 * len + 32;
+  }
 
-  BUFFER_ADD_KEYVAL ("host", vl->host);
-  BUFFER_ADD_KEYVAL ("plugin", vl->plugin);
-  BUFFER_ADD_KEYVAL ("plugin_instance", vl->plugin_instance);
-  BUFFER_ADD_KEYVAL ("type", vl->type);
-  BUFFER_ADD_KEYVAL ("type_instance", vl->type_instance);
+  sfree (t->key);
+  sfree (t->data);
+  t->key = malloc (key_size);
+  t->data = malloc (data_size);
+  if ((t->key == NULL) || (t->data == NULL))
+  {
+    sfree (t->key);
+    sfree (t->data);
+    return (-ENOMEM);
+  }
 
-  if (vl->meta != NULL)
+  t->key_len = 0;
+  for (i = 0; i < STATIC_ARRAY_SIZE (fields); i++)
   {
-    char meta_buffer[buffer_size];
-    memset (meta_buffer, 0, sizeof (meta_buffer));
-    status = meta_data_to_json (meta_buffer, sizeof (meta_buffer), vl->meta);
+    size_t len = strlen (fields[i]) + 1;
+    memcpy (t->key + t->key_len, fields[i], len);
+    t->key_len += len;
+  }
+
+  fmt_buffer_init (&b, t->data, data_size, 0);
+  json_append_data_set (&b, ds);
+  t->ds_len = b.fill;
+  json_append_identifier (&b, vl);
+  t->id_len = b.fill - t->ds_len;
+  assert (!b.overflow);
+
+  t->hash = hash;
+  return (0);
+} /* }}} int json_template_build */
+
+static const json_template_t *json_template_get ( /* {{{ */
+    format_json_stream_t *s, const data_set_t *ds, const value_list_t *vl)
+{
+  json_template_t *set;
+  json_template_t *t = NULL;
+  uint32_t hash;
+  size_t i;
+
+  if (s->templates == NULL)
+    return (NULL);
+
+  /* The cache is organized in sets of JSON_TEMPLATE_WAYS entries, so that
+   * a few identifiers hashing to the same set don't evict each other. */
+  hash = json_identifier_hash (vl);
+  set = s->templates + (hash & s->templates_mask & ~(JSON_TEMPLATE_WAYS - 1));
+  for (i = 0; i < JSON_TEMPLATE_WAYS; i++)
+  {
+    if (json_template_matches (set + i, hash, vl))
+      return (set + i);
+    if ((t == NULL) && (set[i].key == NULL))
+      t = set + i;
+  }
+
+  /* Set is full: replace an entry picked by the upper bits of the hash. */
+  if (t == NULL)
+    t = set + ((hash >> 24) % JSON_TEMPLATE_WAYS);
+
+  if (json_template_build (t, hash, ds, vl) != 0)
+    return (NULL);
+  return (t);
+} /* }}} json_template_t *json_template_get */
+
+/*
+ * Streaming interface
+ */
+static format_json_chunk_t *json_chunk_append (format_json_stream_t *s, /* {{{ */
+    size_t size)
+{
+  format_json_chunk_t *c;
+
+  c = malloc (sizeof (*c) + size);
+  if (c == NULL)
+    return (NULL);
+  c->next = NULL;
+  c->size = size;
+  c->fill = 0;
+  c->data[0] = 0;
+
+  if (s->tail == NULL)
+    s->head = c;
+  else
+    s->tail->next = c;
+  s->tail = c;
+
+  return (c);
+} /* }}} format_json_chunk_t *json_chunk_append */
+
+/* Resizes the empty last chunk "c". */
+static format_json_chunk_t *json_chunk_resize (format_json_stream_t *s, /* {{{ */
+    format_json_chunk_t *c, size_t size)
+{
+  format_json_chunk_t *prev = NULL;
+  format_json_chunk_t *new;
+
+  assert ((c == s->tail) && (c->fill == 0));
+
+  if (s->head != c)
+    for (prev = s->head; prev->next != c; prev = prev->next)
+      /* do nothing */;
+
+  new = realloc (c, sizeof (*c) + size);
+  if (new == NULL)
+    return (NULL);
+  new->size = size;
+
+  if (prev == NULL)
+    s->head = new;
+  else
+    prev->next = new;
+  s->tail = new;
+
+  return (new);
+} /* }}} format_json_chunk_t *json_chunk_resize */
+
+format_json_stream_t *format_json_stream_create (size_t chunk_size, /* {{{ */
+    size_t cache_size)
+{
+  format_json_stream_t *s;
+
+  s = calloc (1, sizeof (*s));
+  if (s == NULL)
+    return (NULL);
+
+  s->chunk_size = (chunk_size < 1024) ? 1024 : chunk_size;
+
+  if (cache_size > 0)
+  {
+    size_t n = JSON_TEMPLATE_WAYS;
+    while (n < cache_size)
+      n *= 2;
+
+    s->templates = calloc (n, sizeof (*s->templates));
+    if (s->templates == NULL)
+    {
+      sfree (s);
+      return (NULL);
+    }
+    s->templates_mask = n - 1;
+  }
+
+  return (s);
+} /* }}} format_json_stream_t *format_json_stream_create */
+
+void format_json_stream_destroy (format_json_stream_t *s) /* {{{ */
+{
+  format_json_chunk_t *c;
+  size_t i;
+
+  if (s == NULL)
+    return;
+
+  c = s->head;
+  while (c != NULL)
+  {
+    format_json_chunk_t *next = c->next;
+    sfree (c);
+    c = next;
+  }
+
+  if (s->templates != NULL)
+  {
+    for (i = 0; i <= s->templates_mask; i++)
+    {
+      sfree (s->templates[i].key);
+      sfree (s->templates[i].data);
+    }
+    sfree (s->templates);
+  }
+
+  sfree (s);
+} /* }}} void format_json_stream_destroy */
+
+void format_json_stream_reset (format_json_stream_t *s) /* {{{ */
+{
+  format_json_chunk_t *c;
+
+  if (s == NULL)
+    return;
+
+  /* Keep the first chunk around, it will be needed again. */
+  if (s->head != NULL)
+  {
+    c = s->head->next;
+    while (c != NULL)
+    {
+      format_json_chunk_t *next = c->next;
+      sfree (c);
+      c = next;
+    }
+    s->head->next = NULL;
+    s->head->fill = 0;
+    s->head->data[0] = 0;
+    s->tail = s->head;
+  }
+
+  s->length = 0;
+  s->values_num = 0;
+  s->finalized = 0;
+} /* }}} void format_json_stream_reset */
+
+int format_json_stream_value_list (format_json_stream_t *s, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl, int store_rates)
+{
+  const json_template_t *t;
+  format_json_chunk_t *c;
+  size_t size;
+
+  if ((s == NULL) || (ds == NULL) || (vl == NULL) || s->finalized)
+    return (-EINVAL);
+
+  t = json_template_get (s, ds, vl);
+
+  c = s->tail;
+  if (c == NULL)
+    c = json_chunk_append (s, s->chunk_size);
+  if (c == NULL)
+    return (-ENOMEM);
+
+  size = s->chunk_size;
+  while (42)
+  {
+    fmt_buffer_t b;
+    size_t fill = c->fill;
+    int status;
+
+    /* One byte is kept free for the closing bracket. */
+    fmt_buffer_init (&b, c->data, c->size - 1, c->fill);
+    status = json_append_value_list (&b, (s->values_num == 0) ? '[' : ',',
+        ds, vl, store_rates, t);
     if (status != 0)
+    {
+      c->fill = fill;
+      c->data[fill] = 0;
       return (status);
+    }
 
-    BUFFER_ADD (",\"meta\":%s", meta_buffer);
-  } /* if (vl->meta != NULL) */
+    if (!b.overflow)
+    {
+      s->length += b.fill - c->fill;
+      s->values_num++;
+      c->fill = b.fill;
+      return (0);
+    }
 
-  BUFFER_ADD ("}");
+    c->data[fill] = 0;
+    if (fill > 0)
+      c = json_chunk_append (s, size);
+    else
+    {
+      /* The value list didn't fit into an empty chunk: grow it. */
+      if (size >= JSON_VALUE_LIST_MAX)
+        return (-ENOMEM);
+      size *= 2;
+      c = json_chunk_resize (s, c, size);
+    }
+    if (c == NULL)
+      return (-ENOMEM);
+  }
+} /* }}} int format_json_stream_value_list */
 
-#undef BUFFER_ADD_KEYVAL
-#undef BUFFER_ADD
+int format_json_stream_finalize (format_json_stream_t *s) /* {{{ */
+{
+  format_json_chunk_t *c;
+
+  if ((s == NULL) || (s->values_num == 0))
+    return (-EINVAL);
+  if (s->finalized)
+    return (0);
 
-  DEBUG ("format_json: value_list_to_json: buffer = %s;", buffer);
+  /* Space for the bracket has been reserved when appending. */
+  c = s->tail;
+  c->data[c->fill] = ']';
+  c->fill++;
+  c->data[c->fill] = 0;
+  s->length++;
+  s->finalized = 1;
 
   return (0);
-} /* }}} int value_list_to_json */
+} /* }}} int format_json_stream_finalize */
 
-static int format_json_value_list_nocheck (char *buffer, /* {{{ */
-    size_t *ret_buffer_fill, size_t *ret_buffer_free,
-    const data_set_t *ds, const value_list_t *vl,
-    int store_rates, size_t temp_size)
+size_t format_json_stream_length (format_json_stream_t const *s) /* {{{ */
 {
-  char temp[temp_size];
-  int status;
+  return ((s == NULL) ? 0 : s->length);
+} /* }}} size_t format_json_stream_length */
 
-  status = value_list_to_json (temp, sizeof (temp), ds, vl, store_rates);
-  if (status != 0)
-    return (status);
-  temp_size = strlen (temp);
+size_t format_json_stream_values_num (format_json_stream_t const *s) /* {{{ */
+{
+  return ((s == NULL) ? 0 : s->values_num);
+} /* }}} size_t format_json_stream_values_num */
 
-  memcpy (buffer + (*ret_buffer_fill), temp, temp_size + 1);
-  (*ret_buffer_fill) += temp_size;
-  (*ret_buffer_free) -= temp_size;
+format_json_chunk_t const *format_json_stream_chunks ( /* {{{ */
+    format_json_stream_t const *s)
+{
+  return ((s == NULL) ? NULL : s->head);
+} /* }}} format_json_chunk_t *format_json_stream_chunks */
 
-  return (0);
-} /* }}} int format_json_value_list_nocheck */
+size_t format_json_stream_read (format_json_stream_t const *s, /* {{{ */
+    size_t offset, char *buffer, size_t buffer_size)
+{
+  format_json_chunk_t const *c;
+  size_t copied = 0;
+
+  if (s == NULL)
+    return (0);
+
+  for (c = s->head; (c != NULL) && (copied < buffer_size); c = c->next)
+  {
+    size_t len;
+
+    if (offset >= c->fill)
+    {
+      offset -= c->fill;
+      continue;
+    }
 
+    len = c->fill - offset;
+    if (len > (buffer_size - copied))
+      len = buffer_size - copied;
+    memcpy (buffer + copied, c->data + offset, len);
+    copied += len;
+    offset = 0;
+  }
+
+  return (copied);
+} /* }}} size_t format_json_stream_read */
+
+/*
+ * Buffer interface
+ */
 int format_json_initialize (char *buffer, /* {{{ */
     size_t *ret_buffer_fill, size_t *ret_buffer_free)
 {
@@ -451,8 +774,8 @@ int format_json_finalize (char *buffer, /* {{{ */
   if (*ret_buffer_free < 2)
     return (-ENOMEM);
 
-  /* Replace the leading comma added in `value_list_to_json' with a square
-   * bracket. */
+  /* Replace the leading comma added in `format_json_value_list' with a
+   * square bracket. */
   if (buffer[0] != ',')
     return (-EINVAL);
   buffer[0] = '[';
@@ -471,6 +794,9 @@ int format_json_value_list (char *buffer, /* {{{ */
     size_t *ret_buffer_fill, size_t *ret_buffer_free,
     const data_set_t *ds, const value_list_t *vl, int store_rates)
 {
+  fmt_buffer_t b;
+  int status;
+
   if ((buffer == NULL)
       || (ret_buffer_fill == NULL) || (ret_buffer_free == NULL)
       || (ds == NULL) || (vl == NULL))
@@ -479,9 +805,25 @@ int format_json_value_list (char *buffer, /* {{{ */
   if (*ret_buffer_free < 3)
     return (-ENOMEM);
 
-  return (format_json_value_list_nocheck (buffer,
-        ret_buffer_fill, ret_buffer_free, ds, vl,
-        store_rates, (*ret_buffer_free) - 2));
+  /* Two bytes are reserved for the closing bracket and the null byte. */
+  fmt_buffer_init (&b, buffer,
+      *ret_buffer_fill + *ret_buffer_free - 1, *ret_buffer_fill);
+  status = json_append_value_list (&b, ',', ds, vl, store_rates,
+      /* template = */ NULL);
+  if ((status == 0) && b.overflow)
+    status = -ENOMEM;
+  if (status != 0)
+  {
+    buffer[*ret_buffer_fill] = 0;
+    return (status);
+  }
+
+  DEBUG ("format_json: format_json_value_list: buffer = %s;",
+      buffer + *ret_buffer_fill);
+
+  *ret_buffer_free -= b.fill - *ret_buffer_fill;
+  *ret_buffer_fill = b.fill;
+  return (0);
 } /* }}} int format_json_value_list */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -42,4 +42,48 @@ int format_json_value_list (char *buffer,
 int format_json_finalize (char *buffer,
     size_t *ret_buffer_fill, size_t *ret_buffer_free);
 
+/*
+ * Streaming interface: value lists are appended to a chain of buffers which
+ * grows as needed, so appending never fails because a buffer is full. The
+ * parts of the JSON object which only depend on the identifier are cached
+ * and copied instead of being formatted again. A stream is not thread safe;
+ * callers have to serialize access.
+ */
+struct format_json_chunk_s
+{
+  struct format_json_chunk_s *next;
+  size_t size;
+  size_t fill;
+  char data[];
+};
+typedef struct format_json_chunk_s format_json_chunk_t;
+
+struct format_json_stream_s;
+typedef struct format_json_stream_s format_json_stream_t;
+
+/* "chunk_size" is the size of the buffers, "cache_size" the number of cached
+ * identifiers; zero disables the cache. */
+format_json_stream_t *format_json_stream_create (size_t chunk_size,
+    size_t cache_size);
+void format_json_stream_destroy (format_json_stream_t *s);
+/* Removes all data, keeping the cache and the first buffer. */
+void format_json_stream_reset (format_json_stream_t *s);
+
+int format_json_stream_value_list (format_json_stream_t *s,
+    const data_set_t *ds, const value_list_t *vl, int store_rates);
+/* Closes the array. No value lists can be added until the next reset. */
+int format_json_stream_finalize (format_json_stream_t *s);
+
+size_t format_json_stream_length (format_json_stream_t const *s);
+size_t format_json_stream_values_num (format_json_stream_t const *s);
+
+/* Value lists are never split across chunks, so every chunk on its own is
+ * a sequence of complete objects. */
+format_json_chunk_t const *format_json_stream_chunks (
+    format_json_stream_t const *s);
+/* Copies up to "buffer_size" bytes starting at "offset" to "buffer" and
+ * returns the number of bytes copied. */
+size_t format_json_stream_read (format_json_stream_t const *s,
+    size_t offset, char *buffer, size_t buffer_size);
+
 #endif /* UTILS_FORMAT_JSON_H */
@@ -0,0 +1,187 @@
+/**
+ * collectd - src/utils_format_json_test.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+
+#include "testing.h"
+#include "collectd.h"
+#include "common.h"
+#include "meta_data.h"
+#include "utils_format_json.h"
+
+static value_t values[] = { { .gauge = 0.25 }, { .derive = -3 } };
+static data_source_t dsrc[] = {
+  { "rx", DS_TYPE_GAUGE, 0, NAN },
+  { "tx", DS_TYPE_DERIVE, 0, NAN },
+};
+static data_set_t ds = { "if_octets", STATIC_ARRAY_SIZE (dsrc), dsrc };
+
+static void init_value_list (value_list_t *vl, int num)
+{
+  memset (vl, 0, sizeof (*vl));
+  vl->values = values;
+  vl->values_len = STATIC_ARRAY_SIZE (values);
+  vl->time = MS_TO_CDTIME_T (1420070400250);
+  vl->interval = TIME_T_TO_CDTIME_T (10);
+  sstrncpy (vl->host, "host \"1\"", sizeof (vl->host));
+  sstrncpy (vl->plugin, "interface", sizeof (vl->plugin));
+  ssnprintf (vl->plugin_instance, sizeof (vl->plugin_instance), "eth%i", num);
+  sstrncpy (vl->type, "if_octets", sizeof (vl->type));
+}
+
+#define EXPECT_OBJECT(pi) "{\"values\":[0.25,-3]," \
+  "\"dstypes\":[\"gauge\",\"derive\"],\"dsnames\":[\"rx\",\"tx\"]," \
+  "\"time\":1420070400.250,\"interval\":10.000," \
+  "\"host\":\"host \\\"1\\\"\",\"plugin\":\"interface\"," \
+  "\"plugin_instance\":\"" pi "\",\"type\":\"if_octets\"," \
+  "\"type_instance\":\"\""
+
+DEF_TEST(buffer)
+{
+  value_list_t vl;
+  char buffer[1024];
+  size_t fill = 0;
+  size_t bfree = sizeof (buffer);
+
+  init_value_list (&vl, 0);
+  CHECK_ZERO (format_json_initialize (buffer, &fill, &bfree));
+  CHECK_ZERO (format_json_value_list (buffer, &fill, &bfree, &ds, &vl, 0));
+  init_value_list (&vl, 1);
+  CHECK_ZERO (format_json_value_list (buffer, &fill, &bfree, &ds, &vl, 0));
+  CHECK_ZERO (format_json_finalize (buffer, &fill, &bfree));
+  STREQ ("[" EXPECT_OBJECT ("eth0") "}," EXPECT_OBJECT ("eth1") "}]", buffer);
+  OK (fill == strlen (buffer));
+  OK (fill + bfree == sizeof (buffer));
+
+  /* Nothing is changed if the value list doesn't fit. */
+  fill = 0;
+  bfree = 200;
+  CHECK_ZERO (format_json_initialize (buffer, &fill, &bfree));
+  OK (format_json_value_list (buffer, &fill, &bfree, &ds, &vl, 0) == -ENOMEM);
+  OK (fill == 0);
+  OK (bfree == 200);
+
+  return (0);
+}
+
+DEF_TEST(meta_data)
+{
+  value_list_t vl;
+  char buffer[1024];
+  size_t fill = 0;
+  size_t bfree = sizeof (buffer);
+
+  init_value_list (&vl, 0);
+  vl.meta = meta_data_create ();
+  CHECK_NOT_NULL (vl.meta);
+
+  /* Empty meta data is left out. */
+  CHECK_ZERO (format_json_initialize (buffer, &fill, &bfree));
+  CHECK_ZERO (format_json_value_list (buffer, &fill, &bfree, &ds, &vl, 0));
+  STREQ ("," EXPECT_OBJECT ("eth0") "}", buffer);
+
+  CHECK_ZERO (meta_data_add_string (vl.meta, "s", "a\"b"));
+  CHECK_ZERO (meta_data_add_signed_int (vl.meta, "i", -7));
+  CHECK_ZERO (meta_data_add_boolean (vl.meta, "b", 1));
+  CHECK_ZERO (meta_data_add_double (vl.meta, "d", 0.5));
+
+  fill = 0;
+  bfree = sizeof (buffer);
+  CHECK_ZERO (format_json_initialize (buffer, &fill, &bfree));
+  CHECK_ZERO (format_json_value_list (buffer, &fill, &bfree, &ds, &vl, 0));
+  STREQ ("," EXPECT_OBJECT ("eth0")
+      ",\"meta\":{\"s\":\"a\\\"b\",\"i\":-7,\"b\":true,\"d\":0.500000}}",
+      buffer);
+
+  meta_data_destroy (vl.meta);
+  return (0);
+}
+
+DEF_TEST(stream)
+{
+  format_json_stream_t *s;
+  format_json_chunk_t const *c;
+  char expect[65536];
+  char actual[65536];
+  size_t fill = 0;
+  size_t bfree = sizeof (expect);
+  size_t chunks_num = 0;
+  size_t len;
+  int i;
+
+  /* Small chunks and a small cache, so both are exhausted. */
+  s = format_json_stream_create (1024, 4);
+  CHECK_NOT_NULL (s);
+
+  CHECK_ZERO (format_json_initialize (expect, &fill, &bfree));
+  for (i = 0; i < 200; i++)
+  {
+    value_list_t vl;
+
+    init_value_list (&vl, i % 10);
+    CHECK_ZERO (format_json_value_list (expect, &fill, &bfree, &ds, &vl, 0));
+    CHECK_ZERO (format_json_stream_value_list (s, &ds, &vl, 0));
+  }
+  CHECK_ZERO (format_json_finalize (expect, &fill, &bfree));
+  CHECK_ZERO (format_json_stream_finalize (s));
+
+  OK (format_json_stream_values_num (s) == 200);
+  OK (format_json_stream_length (s) == fill);
+
+  /* Every chunk holds complete objects only. */
+  for (c = format_json_stream_chunks (s); c != NULL; c = c->next)
+  {
+    OK ((c->data[0] == '[') || (c->data[0] == ','));
+    OK (c->data[c->fill - 1] == '}' || c->data[c->fill - 1] == ']');
+    chunks_num++;
+  }
+  OK (chunks_num > 1);
+
+  len = format_json_stream_read (s, 0, actual, sizeof (actual));
+  OK (len == fill);
+  actual[len] = 0;
+  STREQ (expect, actual);
+
+  /* Reading at an offset. */
+  len = format_json_stream_read (s, 1500, actual, 10);
+  OK (len == 10);
+  OK (memcmp (actual, expect + 1500, 10) == 0);
+
+  format_json_stream_reset (s);
+  OK (format_json_stream_length (s) == 0);
+  OK (format_json_stream_finalize (s) == -EINVAL);
+
+  format_json_stream_destroy (s);
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(buffer);
+  RUN_TEST(meta_data);
+  RUN_TEST(stream);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -0,0 +1,257 @@
+/**
+ * collectd - src/utils_format_test.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+#include "testing.h"
+#include "collectd.h"
+#include "common.h"
+#include "utils_format.h"
+#include "utils_format_graphite.h"
+
+#include <float.h>
+#include <math.h>
+
+/* xorshift64, so the "random" values are the same on every run. */
+static uint64_t next_random (uint64_t *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return (*state);
+}
+
+static int check_double (double value)
+{
+  char expect[FMT_NUMBER_MAX];
+  char actual[FMT_NUMBER_MAX];
+  size_t len;
+
+  snprintf (expect, sizeof (expect), GAUGE_FORMAT, value);
+  len = fmt_double (actual, value);
+  if ((strcmp (expect, actual) != 0) || (len != strlen (expect)))
+  {
+    STREQ (expect, actual);
+    return (-1);
+  }
+
+  return (0);
+}
+
+DEF_TEST(integers)
+{
+  struct {
+    int64_t value;
+    char const *expect;
+  } cases[] = {
+    { 0, "0" },
+    { 7, "7" },
+    { 10, "10" },
+    { 99, "99" },
+    { 100, "100" },
+    { -12345, "-12345" },
+    { INT64_MAX, "9223372036854775807" },
+    { INT64_MIN, "-9223372036854775808" },
+  };
+  char buffer[FMT_NUMBER_MAX];
+  size_t i;
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (cases); i++)
+  {
+    OK (fmt_int64 (buffer, cases[i].value) == strlen (cases[i].expect));
+    STREQ (cases[i].expect, buffer);
+  }
+
+  OK (fmt_uint64 (buffer, UINT64_MAX) == 20);
+  STREQ ("18446744073709551615", buffer);
+
+  return (0);
+}
+
+DEF_TEST(doubles)
+{
+  double cases[] = {
+    0.0, -0.0, 1.0, -1.0, 0.1, 0.5, 1.5, 2.5, 3.14159265358979,
+    1.0 / 3.0, 2.0 / 3.0, 100.25, 1e-4, 9.9999999999999999e-5, 1e-5,
+    0.000123456789, 123456789012345.5, 123456789012346.5,
+    99999999999999.95, 999999999999999.0, 999999999999999.5, 1e15,
+    1e300, -1e-300, NAN, INFINITY, -INFINITY, DBL_MAX, DBL_MIN,
+  };
+  uint64_t state = 88172645463325252ULL;
+  int mismatches = 0;
+  size_t i;
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (cases); i++)
+    if (check_double (cases[i]) != 0)
+      mismatches++;
+
+  /* Decimal numbers of all lengths and magnitudes ... */
+  for (i = 0; i < 200000; i++)
+  {
+    uint64_t r = next_random (&state);
+    double mantissa = (double) (r % 10000000000000000ULL);
+    int exp = (int) ((r >> 56) % 40) - 24;
+    double value = (exp < 0)
+      ? mantissa / pow (10.0, -exp) : mantissa * pow (10.0, exp);
+
+    if (check_double ((r & 1) ? -value : value) != 0)
+      mismatches++;
+  }
+
+  /* ... and arbitrary bit patterns. */
+  for (i = 0; i < 200000; i++)
+  {
+    uint64_t r = next_random (&state);
+    double value;
+
+    memcpy (&value, &r, sizeof (value));
+    if (check_double (value) != 0)
+      mismatches++;
+  }
+
+  OK (mismatches == 0);
+  return ((mismatches == 0) ? 0 : -1);
+}
+
+DEF_TEST(doubles_fixed)
+{
+  /* Values close to a tie below one decimal place need the exact product in
+   * fmt_scale_round(). */
+  double cases[] = {
+    0.0, -0.0, 0.0005, 0.0015, 0.0025, -0.0005, 0.0000005, 0.0000025,
+    0.0000015, 1.5, 1420070400.123, 1420070400.1235, 999999999999999.9,
+    -123.456789, NAN, INFINITY,
+  };
+  uint64_t state = 88172645463325252ULL;
+  char expect[FMT_NUMBER_MAX];
+  char actual[FMT_NUMBER_MAX];
+  int mismatches = 0;
+  size_t i;
+
+  for (i = 0; i < 200000 + STATIC_ARRAY_SIZE (cases); i++)
+  {
+    int decimals = (i % 2) ? 3 : 6;
+    double value;
+    size_t len;
+
+    if (i < STATIC_ARRAY_SIZE (cases))
+      value = cases[i];
+    else
+    {
+      uint64_t r = next_random (&state);
+      value = ((double) (r % 100000000000000ULL))
+        / pow (10.0, (double) ((r >> 56) % 16));
+    }
+
+    snprintf (expect, sizeof (expect), "%.*f", decimals, value);
+    len = fmt_double_fixed (actual, value, decimals);
+    if ((strcmp (expect, actual) != 0) || (len != strlen (expect)))
+    {
+      STREQ (expect, actual);
+      mismatches++;
+    }
+  }
+
+  OK (mismatches == 0);
+  return ((mismatches == 0) ? 0 : -1);
+}
+
+DEF_TEST(buffer)
+{
+  char data[8];
+  fmt_buffer_t b;
+
+  fmt_buffer_init (&b, data, sizeof (data), 0);
+  fmt_append_string (&b, "abc");
+  fmt_append_char (&b, ' ');
+  fmt_append_uint64 (&b, 42);
+  OK (!b.overflow);
+  OK (b.fill == 6);
+  STREQ ("abc 42", data);
+
+  /* One byte is needed for the null byte. */
+  fmt_append (&b, "xy", 2);
+  OK (b.overflow);
+  OK (b.fill == 6);
+  fmt_append_char (&b, 'z');
+  OK (b.fill == 6);
+  STREQ ("abc 42", data);
+
+  return (0);
+}
+
+DEF_TEST(graphite)
+{
+  value_t values[] = { { .gauge = 0.25 }, { .derive = -3 } };
+  data_source_t dsrc[] = {
+    { "rx", DS_TYPE_GAUGE, 0, NAN },
+    { "tx", DS_TYPE_DERIVE, 0, NAN },
+  };
+  data_set_t ds = { "if_octets", STATIC_ARRAY_SIZE (dsrc), dsrc };
+  value_list_t vl;
+  char buffer[256];
+  size_t fill;
+
+  memset (&vl, 0, sizeof (vl));
+  vl.values = values;
+  vl.values_len = STATIC_ARRAY_SIZE (values);
+  vl.time = TIME_T_TO_CDTIME_T (1420070400);
+  sstrncpy (vl.host, "host.example.com", sizeof (vl.host));
+  sstrncpy (vl.plugin, "interface", sizeof (vl.plugin));
+  sstrncpy (vl.plugin_instance, "eth 0", sizeof (vl.plugin_instance));
+  sstrncpy (vl.type, "if_octets", sizeof (vl.type));
+
+  fill = 0;
+  CHECK_ZERO (format_graphite_append (buffer, sizeof (buffer), &fill,
+        &ds, &vl, "collectd.", "/x", '_', GRAPHITE_SEPARATE_INSTANCES));
+  STREQ ("collectd.host_example_com_x.interface.eth_0.if_octets.rx "
+      "0.25 1420070400\r\n"
+      "collectd.host_example_com_x.interface.eth_0.if_octets.tx "
+      "-3 1420070400\r\n", buffer);
+  OK (fill == strlen (buffer));
+
+  /* Lines are appended; nothing is changed if they don't fit. */
+  ds.ds_num = 1;
+  fill = 0;
+  CHECK_ZERO (format_graphite_append (buffer, sizeof (buffer), &fill,
+        &ds, &vl, NULL, NULL, '_', GRAPHITE_ALWAYS_APPEND_DS));
+  STREQ ("host_example_com.interface-eth_0.if_octets.rx "
+      "0.25 1420070400\r\n", buffer);
+  OK (format_graphite_append (buffer, fill + 10, &fill,
+        &ds, &vl, NULL, NULL, '_', 0) == -ENOMEM);
+  OK (fill == strlen (buffer));
+
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(integers);
+  RUN_TEST(doubles);
+  RUN_TEST(doubles_fixed);
+  RUN_TEST(buffer);
+  RUN_TEST(graphite);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -0,0 +1,438 @@
+/**
+ * collectd - src/utils_rrdcached.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "utils_rrdcached.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#define RRDCACHED_DEFAULT_PORT "42217"
+
+enum rrdcached_state_e
+{
+  STATE_GO_AHEAD,   /* waiting for the answer to "BATCH" */
+  STATE_RESULT,     /* waiting for "<N> errors" */
+  STATE_ERROR_LINES /* reading the error lines */
+};
+
+struct rrdcached_conn_s
+{
+  int fd;
+
+  char   buffer[4096];
+  size_t buffer_fill;
+
+  size_t batches_pending;
+  enum rrdcached_state_e state;
+  int    lines_left;
+};
+
+static int rrdcached_connect_unix (const char *path) /* {{{ */
+{
+  struct sockaddr_un sa;
+  int fd;
+
+  if (strlen (path) >= sizeof (sa.sun_path))
+  {
+    errno = ENAMETOOLONG;
+    return (-1);
+  }
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sun_family = AF_UNIX;
+  sstrncpy (sa.sun_path, path, sizeof (sa.sun_path));
+
+  fd = socket (PF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return (-1);
+
+  if (connect (fd, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+  {
+    int saved_errno = errno;
+    close (fd);
+    errno = saved_errno;
+    return (-1);
+  }
+
+  return (fd);
+} /* }}} int rrdcached_connect_unix */
+
+static int rrdcached_connect_inet (const char *address) /* {{{ */
+{
+  struct addrinfo ai_hints;
+  struct addrinfo *ai_list = NULL;
+  struct addrinfo *ai_ptr;
+  char host[NI_MAXHOST];
+  const char *port = RRDCACHED_DEFAULT_PORT;
+  char *ptr;
+  int fd = -1;
+  int status;
+
+  sstrncpy (host, address, sizeof (host));
+  if (host[0] == '[')
+  {
+    /* "[host]" or "[host]:port" */
+    ptr = strchr (host, ']');
+    if (ptr == NULL)
+    {
+      errno = EINVAL;
+      return (-1);
+    }
+    *ptr = 0;
+    if (ptr[1] == ':')
+      port = address + (ptr - host) + 2;
+    else if (ptr[1] != 0)
+    {
+      errno = EINVAL;
+      return (-1);
+    }
+    memmove (host, host + 1, strlen (host));
+  }
+  else if (((ptr = strchr (host, ':')) != NULL) && (strchr (ptr + 1, ':') == NULL))
+  {
+    /* "host:port", but not a bare IPv6 address */
+    *ptr = 0;
+    port = address + (ptr - host) + 1;
+  }
+
+  memset (&ai_hints, 0, sizeof (ai_hints));
+  ai_hints.ai_family = AF_UNSPEC;
+  ai_hints.ai_socktype = SOCK_STREAM;
+#ifdef AI_ADDRCONFIG
+  ai_hints.ai_flags = AI_ADDRCONFIG;
+#endif
+
+  status = getaddrinfo (host, port, &ai_hints, &ai_list);
+  if (status != 0)
+  {
+    errno = (status == EAI_SYSTEM) ? errno : EHOSTUNREACH;
+    return (-1);
+  }
+
+  for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
+  {
+    int one = 1;
+
+    fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
+    if (fd < 0)
+      continue;
+
+    if (connect (fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen) != 0)
+    {
+      close (fd);
+      fd = -1;
+      continue;
+    }
+
+    /* Batches are written in one go; don't let Nagle's algorithm wait for the
+     * acknowledgement of the previous batch. */
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+    break;
+  }
+
+  freeaddrinfo (ai_list);
+  if (fd < 0)
+    errno = ECONNREFUSED;
+  return (fd);
+} /* }}} int rrdcached_connect_inet */
+
+rrdcached_conn_t *rrdcached_connect (const char *address) /* {{{ */
+{
+  rrdcached_conn_t *c;
+  int fd;
+
+  if (address == NULL)
+  {
+    errno = EINVAL;
+    return (NULL);
+  }
+
+  if (strncmp ("unix:", address, strlen ("unix:")) == 0)
+    fd = rrdcached_connect_unix (address + strlen ("unix:"));
+  else if (address[0] == '/')
+    fd = rrdcached_connect_unix (address);
+  else
+    fd = rrdcached_connect_inet (address);
+  if (fd < 0)
+    return (NULL);
+
+  c = calloc (1, sizeof (*c));
+  if (c == NULL)
+  {
+    close (fd);
+    errno = ENOMEM;
+    return (NULL);
+  }
+  c->fd = fd;
+  c->state = STATE_GO_AHEAD;
+
+  return (c);
+} /* }}} rrdcached_conn_t *rrdcached_connect */
+
+void rrdcached_close (rrdcached_conn_t *c) /* {{{ */
+{
+  if (c == NULL)
+    return;
+
+  close (c->fd);
+  free (c);
+} /* }}} void rrdcached_close */
+
+int rrdcached_format_update (char *buffer, size_t buffer_size, /* {{{ */
+    const char *filename, const char *values)
+{
+  size_t values_len = strlen (values);
+  size_t pos;
+  const char *ptr;
+
+  if (buffer_size < sizeof ("UPDATE "))
+    return (-1);
+  memcpy (buffer, "UPDATE ", strlen ("UPDATE "));
+  pos = strlen ("UPDATE ");
+
+  for (ptr = filename; *ptr != 0; ptr++)
+  {
+    if (pos + 2 >= buffer_size)
+      return (-1);
+    if ((*ptr == ' ') || (*ptr == '\\'))
+      buffer[pos++] = '\\';
+    buffer[pos++] = *ptr;
+  }
+
+  /* " <values>\n\0" */
+  if (pos + values_len + 3 > buffer_size)
+    return (-1);
+  buffer[pos++] = ' ';
+  memcpy (buffer + pos, values, values_len);
+  pos += values_len;
+  buffer[pos++] = '\n';
+  buffer[pos] = 0;
+
+  return ((int) pos);
+} /* }}} int rrdcached_format_update */
+
+int rrdcached_batch_send (rrdcached_conn_t *c, /* {{{ */
+    const char *lines, size_t lines_len)
+{
+  static char batch_begin[] = "BATCH\n";
+  static char batch_end[] = ".\n";
+  struct iovec iov[3];
+  int iov_num = 3;
+  struct iovec *iov_ptr = iov;
+
+  if ((c == NULL) || (lines == NULL))
+    return (EINVAL);
+
+  iov[0].iov_base = batch_begin;
+  iov[0].iov_len = strlen (batch_begin);
+  iov[1].iov_base = (void *) lines;
+  iov[1].iov_len = lines_len;
+  iov[2].iov_base = batch_end;
+  iov[2].iov_len = strlen (batch_end);
+
+  while (iov_num > 0)
+  {
+    ssize_t status;
+
+    status = writev (c->fd, iov_ptr, iov_num);
+    if (status < 0)
+    {
+      if ((errno == EINTR) || (errno == EAGAIN))
+        continue;
+      return (errno);
+    }
+
+    /* Skip what has been written. */
+    while ((iov_num > 0) && ((size_t) status >= iov_ptr->iov_len))
+    {
+      status -= (ssize_t) iov_ptr->iov_len;
+      iov_ptr++;
+      iov_num--;
+    }
+    if (iov_num > 0)
+    {
+      iov_ptr->iov_base = ((char *) iov_ptr->iov_base) + status;
+      iov_ptr->iov_len -= (size_t) status;
+    }
+  }
+
+  c->batches_pending++;
+  return (0);
+} /* }}} int rrdcached_batch_send */
+
+size_t rrdcached_batches_pending (rrdcached_conn_t const *c) /* {{{ */
+{
+  return ((c == NULL) ? 0 : c->batches_pending);
+} /* }}} size_t rrdcached_batches_pending */
+
+/* Handles one response line. Returns zero on success and EPROTO if the
+ * daemon's answer doesn't make sense. */
+static int rrdcached_handle_line (rrdcached_conn_t *c, char *line, /* {{{ */
+    rrdcached_error_cb_t error_cb, void *user_data)
+{
+  char *endptr = NULL;
+  long num;
+
+  if (c->batches_pending == 0)
+    return (EPROTO);
+
+  num = strtol (line, &endptr, 10);
+  if (endptr == line)
+    return (EPROTO);
+  while (*endptr == ' ')
+    endptr++;
+
+  if (c->state == STATE_GO_AHEAD)
+  {
+    /* The daemon refused to start a batch. The commands would be treated as
+     * individual commands, so the connection can't be used any further. */
+    if (num != 0)
+      return (EPROTO);
+    c->state = STATE_RESULT;
+    return (0);
+  }
+
+  if (c->state == STATE_RESULT)
+  {
+    if (num > 0)
+    {
+      c->state = STATE_ERROR_LINES;
+      c->lines_left = (int) num;
+      return (0);
+    }
+    if (num < 0)
+      error_cb (0, endptr, user_data);
+  }
+  else /* if (c->state == STATE_ERROR_LINES) */
+  {
+    error_cb ((int) num, endptr, user_data);
+    c->lines_left--;
+    if (c->lines_left > 0)
+      return (0);
+  }
+
+  c->state = STATE_GO_AHEAD;
+  c->batches_pending--;
+  return (0);
+} /* }}} int rrdcached_handle_line */
+
+/* Handles all complete lines in the receive buffer. */
+static int rrdcached_handle_buffer (rrdcached_conn_t *c, /* {{{ */
+    rrdcached_error_cb_t error_cb, void *user_data)
+{
+  char *line = c->buffer;
+  char *eol;
+  int status = 0;
+
+  while ((eol = memchr (line, '\n', c->buffer_fill - (line - c->buffer)))
+      != NULL)
+  {
+    *eol = 0;
+    status = rrdcached_handle_line (c, line, error_cb, user_data);
+    line = eol + 1;
+    if (status != 0)
+      break;
+  }
+
+  c->buffer_fill -= line - c->buffer;
+  memmove (c->buffer, line, c->buffer_fill);
+
+  /* A line longer than the buffer can't be a valid response. */
+  if ((status == 0) && (c->buffer_fill >= sizeof (c->buffer)))
+    status = EPROTO;
+  return (status);
+} /* }}} int rrdcached_handle_buffer */
+
+int rrdcached_batch_receive (rrdcached_conn_t *c, size_t max_pending, /* {{{ */
+    int timeout_ms, rrdcached_error_cb_t error_cb, void *user_data)
+{
+  cdtime_t deadline = 0;
+
+  if (c == NULL)
+    return (EINVAL);
+
+  if (timeout_ms > 0)
+    deadline = cdtime () + MS_TO_CDTIME_T (timeout_ms);
+
+  while (c->batches_pending > 0)
+  {
+    struct pollfd pfd = { c->fd, POLLIN, 0 };
+    int wait_ms = 0;
+    ssize_t len;
+    int status;
+
+    /* Keep waiting only while too many batches are outstanding. */
+    if (c->batches_pending > max_pending)
+    {
+      if (timeout_ms < 0)
+        wait_ms = -1;
+      else if (timeout_ms > 0)
+      {
+        cdtime_t now = cdtime ();
+        if (now >= deadline)
+          return (ETIMEDOUT);
+        wait_ms = (int) CDTIME_T_TO_MS (deadline - now);
+        if (wait_ms == 0)
+          wait_ms = 1;
+      }
+    }
+
+    status = poll (&pfd, 1, wait_ms);
+    if (status < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return (errno);
+    }
+    else if (status == 0)
+      return ((c->batches_pending > max_pending) ? ETIMEDOUT : 0);
+
+    len = read (c->fd, c->buffer + c->buffer_fill,
+        sizeof (c->buffer) - c->buffer_fill);
+    if (len < 0)
+    {
+      if ((errno == EINTR) || (errno == EAGAIN))
+        continue;
+      return (errno);
+    }
+    else if (len == 0)
+      return (ECONNRESET);
+    c->buffer_fill += (size_t) len;
+
+    status = rrdcached_handle_buffer (c, error_cb, user_data);
+    if (status != 0)
+      return (status);
+  }
+
+  return (0);
+} /* }}} int rrdcached_batch_receive */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,76 @@
+/**
+ * collectd - src/utils_rrdcached.h
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+#ifndef UTILS_RRDCACHED_H
+#define UTILS_RRDCACHED_H 1
+
+#include <stddef.h>
+
+/*
+ * Minimal client for the rrdcached protocol, used to send updates with the
+ * BATCH command. librrd's client only supports one synchronous command at a
+ * time; this client sends a batch without waiting for the "Go ahead" answer
+ * and lets the caller keep several batches in flight on one connection.
+ *
+ * A batch is answered with two responses: "0 Go ahead..." and "<N> errors",
+ * followed by N lines of the form "<command number> <message>".
+ */
+struct rrdcached_conn_s;
+typedef struct rrdcached_conn_s rrdcached_conn_t;
+
+/* Called for every failed command of a batch. "command" is the number of the
+ * command within its batch as reported by the daemon. */
+typedef void (*rrdcached_error_cb_t) (int command, const char *message,
+    void *user_data);
+
+/* Connects to the daemon. "address" has the same format as rrdcached's
+ * "-l" option: "unix:/path", "/path", "host", "host:port" or "[host]:port".
+ * Returns NULL and sets errno on failure. */
+rrdcached_conn_t *rrdcached_connect (const char *address);
+void rrdcached_close (rrdcached_conn_t *c);
+
+/* Formats "UPDATE <filename> <values>\n", escaping spaces and backslashes in
+ * the file name. Returns the length of the line or -1 if the buffer is too
+ * small. */
+int rrdcached_format_update (char *buffer, size_t buffer_size,
+    const char *filename, const char *values);
+
+/* Sends "BATCH", the "lines" and the terminating "." without waiting for a
+ * response. "lines" must consist of complete, newline terminated commands.
+ * Returns zero on success and an errno value on failure. */
+int rrdcached_batch_send (rrdcached_conn_t *c,
+    const char *lines, size_t lines_len);
+
+/* Number of batches sent whose result has not been received yet. */
+size_t rrdcached_batches_pending (rrdcached_conn_t const *c);
+
+/* Processes responses until at most "max_pending" batches are outstanding,
+ * waiting up to "timeout_ms" milliseconds (-1 waits indefinitely). Responses
+ * which are already available are always processed. Returns zero on success,
+ * ETIMEDOUT if the timeout expired and another errno value if the connection
+ * failed; the connection must be closed in the latter case. */
+int rrdcached_batch_receive (rrdcached_conn_t *c, size_t max_pending,
+    int timeout_ms, rrdcached_error_cb_t error_cb, void *user_data);
+
+#endif /* UTILS_RRDCACHED_H */
@@ -0,0 +1,205 @@
+/**
+ * collectd - src/utils_rrdcached_test.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+#include "testing.h"
+#include "collectd.h"
+#include "common.h"
+#include "utils_rrdcached.h"
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Stand-in for rrdcached: answers BATCH commands like the real daemon and
+ * reports every update of a file containing "bad" as an error. */
+struct server_s
+{
+  int listen_fd;
+  int updates_num;
+  int batches_num;
+  _Bool escaped_seen;
+};
+typedef struct server_s server_t;
+
+static void *server_thread (void *arg)
+{
+  server_t *s = arg;
+  FILE *fh;
+  char line[1024];
+  char errors[1024] = "";
+  int errors_num = 0;
+  int command = 0;
+  int fd;
+
+  fd = accept (s->listen_fd, NULL, NULL);
+  if (fd < 0)
+    return (NULL);
+  fh = fdopen (fd, "r+");
+  if (fh == NULL)
+  {
+    close (fd);
+    return (NULL);
+  }
+  setvbuf (fh, NULL, _IONBF, 0);
+
+  while (fgets (line, sizeof (line), fh) != NULL)
+  {
+    if (strcmp ("BATCH\n", line) == 0)
+    {
+      fprintf (fh, "0 Go ahead.  End with dot '.' on its own line.\n");
+      command = 0;
+      errors_num = 0;
+      errors[0] = 0;
+    }
+    else if (strcmp (".\n", line) == 0)
+    {
+      fprintf (fh, "%i errors\n%s", errors_num, errors);
+      s->batches_num++;
+    }
+    else if (strncmp ("UPDATE ", line, 7) == 0)
+    {
+      command++;
+      s->updates_num++;
+      if (strstr (line, "with\\ space") != NULL)
+        s->escaped_seen = 1;
+      if (strstr (line, "bad") != NULL)
+      {
+        size_t len = strlen (errors);
+        snprintf (errors + len, sizeof (errors) - len,
+            "%i No such file: bad.rrd\n", command);
+        errors_num++;
+      }
+    }
+  }
+
+  fclose (fh);
+  return (NULL);
+}
+
+struct errors_s
+{
+  int num;
+  int command;
+  char message[256];
+};
+
+static void error_cb (int command, const char *message, void *user_data)
+{
+  struct errors_s *e = user_data;
+
+  e->num++;
+  e->command = command;
+  sstrncpy (e->message, message, sizeof (e->message));
+}
+
+DEF_TEST(format_update)
+{
+  char buffer[64];
+
+  OK (rrdcached_format_update (buffer, sizeof (buffer), "/a/b.rrd", "1:2") == 20);
+  STREQ ("UPDATE /a/b.rrd 1:2\n", buffer);
+
+  OK (rrdcached_format_update (buffer, sizeof (buffer), "/a b\\c.rrd", "N:1") > 0);
+  STREQ ("UPDATE /a\\ b\\\\c.rrd N:1\n", buffer);
+
+  OK (rrdcached_format_update (buffer, 20, "/a/b.rrd", "1:2") < 0);
+  OK (rrdcached_format_update (buffer, 21, "/a/b.rrd", "1:2") == 20);
+
+  return (0);
+}
+
+DEF_TEST(batch)
+{
+  char dir[] = "/tmp/collectd-test-XXXXXX";
+  char path[256];
+  char address[sizeof (path) + 5];
+  struct sockaddr_un sa;
+  server_t server;
+  struct errors_s errors;
+  pthread_t tid;
+  rrdcached_conn_t *c;
+  const char *batches[] = {
+    "UPDATE /good1.rrd 1:1\nUPDATE /good2.rrd 1:2\n",
+    "UPDATE /good1.rrd 2:1\nUPDATE /bad.rrd 2:2\n",
+    "UPDATE /with\\ space.rrd 3:1\n",
+  };
+  size_t i;
+
+  OK (mkdtemp (dir) != NULL);
+  snprintf (path, sizeof (path), "%s/rrdcached.sock", dir);
+  snprintf (address, sizeof (address), "unix:%s", path);
+
+  /* Nobody listening yet. */
+  OK (rrdcached_connect (address) == NULL);
+
+  memset (&server, 0, sizeof (server));
+  memset (&sa, 0, sizeof (sa));
+  sa.sun_family = AF_UNIX;
+  sstrncpy (sa.sun_path, path, sizeof (sa.sun_path));
+  server.listen_fd = socket (PF_UNIX, SOCK_STREAM, 0);
+  OK (server.listen_fd >= 0);
+  CHECK_ZERO (bind (server.listen_fd, (struct sockaddr *) &sa, sizeof (sa)));
+  CHECK_ZERO (listen (server.listen_fd, 1));
+  CHECK_ZERO (pthread_create (&tid, NULL, server_thread, &server));
+
+  c = rrdcached_connect (address);
+  OK (c != NULL);
+
+  /* All batches are sent before any response is read. */
+  for (i = 0; i < STATIC_ARRAY_SIZE (batches); i++)
+    CHECK_ZERO (rrdcached_batch_send (c, batches[i], strlen (batches[i])));
+  OK (rrdcached_batches_pending (c) == 3);
+
+  memset (&errors, 0, sizeof (errors));
+  CHECK_ZERO (rrdcached_batch_receive (c, 0, 5000, error_cb, &errors));
+  OK (rrdcached_batches_pending (c) == 0);
+  OK (errors.num == 1);
+  OK (errors.command == 2);
+  STREQ ("No such file: bad.rrd", errors.message);
+
+  /* Nothing outstanding: returns right away. */
+  CHECK_ZERO (rrdcached_batch_receive (c, 0, 5000, error_cb, &errors));
+
+  rrdcached_close (c);
+  pthread_join (tid, NULL);
+  close (server.listen_fd);
+  unlink (path);
+  rmdir (dir);
+
+  OK (server.batches_num == 3);
+  OK (server.updates_num == 5);
+  OK (server.escaped_seen);
+
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(format_update);
+  RUN_TEST(batch);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -36,6 +36,9 @@ static const char *config_keys[] =
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static int verbose_output = 0;
+
+#include "utils_procfile.h"
+static procfile_t *proc_vmstat = NULL;
 /* #endif KERNEL_LINUX */
 
 #else
@@ -110,19 +113,23 @@ static int vmem_read (void)
   derive_t pgmajfault = 0;
   int pgfaultvalid = 0;
 
-  FILE *fh;
-  char buffer[1024];
+  char *buffer;
+  char *line;
+
+  if ((proc_vmstat == NULL)
+      && ((proc_vmstat = procfile_create ("/proc/vmstat")) == NULL))
+    return (-1);
 
-  fh = fopen ("/proc/vmstat", "r");
-  if (fh == NULL)
+  buffer = procfile_read (proc_vmstat, NULL);
+  if (buffer == NULL)
   {
     char errbuf[1024];
-    ERROR ("vmem plugin: fopen (/proc/vmstat) failed: %s",
+    ERROR ("vmem plugin: Reading /proc/vmstat failed: %s",
 	sstrerror (errno, errbuf, sizeof (errbuf)));
     return (-1);
   }
 
-  while (fgets (buffer, sizeof (buffer), fh) != NULL)
+  while ((line = procfile_next_line (&buffer)) != NULL)
   {
     char *fields[4];
     int fields_num;
@@ -131,21 +138,18 @@ static int vmem_read (void)
     derive_t counter;
     gauge_t gauge;
 
-    fields_num = strsplit (buffer, fields, STATIC_ARRAY_SIZE (fields));
+    fields_num = procfile_split (line, fields, STATIC_ARRAY_SIZE (fields));
     if (fields_num != 2)
       continue;
 
     key = fields[0];
 
+    /* All values in /proc/vmstat are unsigned integers. */
     endptr = NULL;
-    counter = strtoll (fields[1], &endptr, 10);
-    if (fields[1] == endptr)
-      continue;
-
-    endptr = NULL;
-    gauge = strtod (fields[1], &endptr);
+    counter = (derive_t) procfile_u64 (fields[1], &endptr);
     if (fields[1] == endptr)
       continue;
+    gauge = (gauge_t) counter;
 
     /* 
      * Number of pages
@@ -267,10 +271,7 @@ static int vmem_read (void)
       value_t value  = { .derive = counter };
       submit_one (NULL, "vmpage_action", "deactivate", value);
     }
-  } /* while (fgets) */
-
-  fclose (fh);
-  fh = NULL;
+  } /* while (procfile_next_line) */
 
   if (pgfaultvalid == 0x03)
     submit_two (NULL, "vmpage_faults", NULL, pgfault, pgmajfault);
@@ -50,12 +50,16 @@
 #include "utils_cache.h"
 #include "utils_complain.h"
 #include "utils_format_graphite.h"
+#include "utils_stats.h"
 
 /* Folks without pthread will need to disable this plugin. */
 #include <pthread.h>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
 
 #ifndef WG_DEFAULT_NODE
 # define WG_DEFAULT_NODE "localhost"
@@ -82,6 +86,27 @@
 # define WG_SEND_BUF_SIZE 1428
 #endif
 
+/* Default size of the send buffers for TCP connections. With UDP, every
+ * buffer is sent as one datagram and WG_SEND_BUF_SIZE is used. */
+#ifndef WG_DEFAULT_BUFFER_SIZE
+# define WG_DEFAULT_BUFFER_SIZE 65536
+#endif
+
+/* Default limit of the data waiting to be sent, in bytes. */
+#ifndef WG_DEFAULT_SEND_QUEUE_SIZE
+# define WG_DEFAULT_SEND_QUEUE_SIZE (16 * 1024 * 1024)
+#endif
+
+/* Maximum number of buffers passed to a single writev(2) call. */
+#ifndef WG_IOV_MAX
+# define WG_IOV_MAX 64
+#endif
+
+/* How long to wait for the queue to drain when shutting down. */
+#ifndef WG_SHUTDOWN_TIMEOUT_MS
+# define WG_SHUTDOWN_TIMEOUT_MS 5000
+#endif
+
 #ifndef WG_MIN_RECONNECT_INTERVAL
 # define WG_MIN_RECONNECT_INTERVAL TIME_T_TO_CDTIME_T (1)
 #endif
@@ -89,6 +114,30 @@
 /*
  * Private variables
  */
+/* A buffer of formatted lines. Full buffers are appended to the send queue
+ * and written to the socket with writev(2) without blocking. */
+struct wg_buffer
+{
+    char    *data;
+    size_t   size;
+    size_t   fill;
+    size_t   sent;
+    size_t   lines;
+
+    struct wg_buffer *next;
+};
+
+/* Statistics reported with "ReportStats". Protected by send_lock. */
+struct wg_stats
+{
+    derive_t bytes_sent;
+    derive_t lines_sent;
+    derive_t lines_dropped;
+    derive_t send_calls;
+    derive_t send_blocked;
+    derive_t connects;
+};
+
 struct wg_callback
 {
     int      sock_fd;
@@ -105,10 +154,21 @@ struct wg_callback
 
     unsigned int format_flags;
 
-    char     send_buf[WG_SEND_BUF_SIZE];
-    size_t   send_buf_free;
-    size_t   send_buf_fill;
+    size_t   buffer_size;
+    size_t   send_queue_size;
+    _Bool    report_stats;
+
+    struct wg_buffer *send_buf;
     cdtime_t send_buf_init_time;
+    struct wg_buffer *queue_head;
+    struct wg_buffer *queue_tail;
+    size_t   queue_bytes;
+    size_t   queue_lines;
+    struct wg_buffer *spare_buf;
+
+    _Bool    connecting;
+
+    struct wg_stats stats;
 
     pthread_mutex_t send_lock;
     c_complain_t init_complaint;
@@ -119,70 +179,111 @@ struct wg_callback
 /*
  * Functions
  */
-static void wg_reset_buffer (struct wg_callback *cb)
+static _Bool wg_is_udp (struct wg_callback const *cb)
 {
-    memset (cb->send_buf, 0, sizeof (cb->send_buf));
-    cb->send_buf_free = sizeof (cb->send_buf);
-    cb->send_buf_fill = 0;
-    cb->send_buf_init_time = cdtime ();
+    return ((cb->protocol != NULL) && (strcasecmp ("udp", cb->protocol) == 0));
 }
 
-static int wg_send_buffer (struct wg_callback *cb)
+/* Returns an empty buffer, reusing the last buffer that has been sent. */
+static struct wg_buffer *wg_buffer_get (struct wg_callback *cb)
 {
-    ssize_t status = 0;
+    struct wg_buffer *buf;
 
-    status = swrite (cb->sock_fd, cb->send_buf, strlen (cb->send_buf));
-    if (status < 0)
+    if (cb->spare_buf != NULL)
     {
-        const char *protocol = cb->protocol ? cb->protocol : WG_DEFAULT_PROTOCOL;
-
-        if (cb->log_send_errors)
+        buf = cb->spare_buf;
+        cb->spare_buf = NULL;
+    }
+    else
+    {
+        buf = malloc (sizeof (*buf));
+        if (buf == NULL)
+            return (NULL);
+        buf->size = cb->buffer_size;
+        buf->data = malloc (buf->size);
+        if (buf->data == NULL)
         {
-            char errbuf[1024];
-            ERROR ("write_graphite plugin: send to %s:%s (%s) failed with status %zi (%s)",
-                    cb->node, cb->service, protocol,
-                    status, sstrerror (errno, errbuf, sizeof (errbuf)));
+            sfree (buf);
+            return (NULL);
         }
+    }
 
-        close (cb->sock_fd);
-        cb->sock_fd = -1;
+    buf->fill = 0;
+    buf->sent = 0;
+    buf->lines = 0;
+    buf->next = NULL;
+    return (buf);
+}
 
-        return (-1);
+static void wg_buffer_put (struct wg_callback *cb, struct wg_buffer *buf)
+{
+    if (buf == NULL)
+        return;
+
+    if (cb->spare_buf == NULL)
+    {
+        cb->spare_buf = buf;
+        return;
     }
 
-    return (0);
+    sfree (buf->data);
+    sfree (buf);
 }
 
 /* NOTE: You must hold cb->send_lock when calling this function! */
-static int wg_flush_nolock (cdtime_t timeout, struct wg_callback *cb)
+static void wg_close (struct wg_callback *cb)
 {
-    int status;
+    if (cb->sock_fd >= 0)
+        close (cb->sock_fd);
+    cb->sock_fd = -1;
+    cb->connecting = 0;
 
-    DEBUG ("write_graphite plugin: wg_flush_nolock: timeout = %.3f; "
-            "send_buf_fill = %zu;",
-            (double)timeout,
-            cb->send_buf_fill);
+    /* A partially sent buffer is sent again on the next connection, so the
+     * receiver doesn't get the tail of a line. */
+    if (cb->queue_head != NULL)
+        cb->queue_head->sent = 0;
+}
 
-    /* timeout == 0  => flush unconditionally */
-    if (timeout > 0)
-    {
-        cdtime_t now;
+/* Appends the current buffer to the send queue. If the queue exceeds its
+ * limit, the oldest buffers are dropped.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static void wg_queue_buffer (struct wg_callback *cb)
+{
+    struct wg_buffer *buf = cb->send_buf;
 
-        now = cdtime ();
-        if ((cb->send_buf_init_time + timeout) > now)
-            return (0);
+    cb->send_buf = NULL;
+    if (buf == NULL)
+        return;
+    if (buf->fill == 0)
+    {
+        wg_buffer_put (cb, buf);
+        return;
     }
 
-    if (cb->send_buf_fill <= 0)
+    if (cb->queue_tail == NULL)
+        cb->queue_head = buf;
+    else
+        cb->queue_tail->next = buf;
+    cb->queue_tail = buf;
+    cb->queue_bytes += buf->fill;
+    cb->queue_lines += buf->lines;
+
+    while ((cb->queue_bytes > cb->send_queue_size)
+            && (cb->queue_head != cb->queue_tail)
+            && (cb->queue_head->sent == 0))
     {
-        cb->send_buf_init_time = cdtime ();
-        return (0);
-    }
+        struct wg_buffer *drop = cb->queue_head;
 
-    status = wg_send_buffer (cb);
-    wg_reset_buffer (cb);
+        cb->queue_head = drop->next;
+        cb->queue_bytes -= drop->fill;
+        cb->queue_lines -= drop->lines;
+        cb->stats.lines_dropped += (derive_t) drop->lines;
 
-    return (status);
+        if (cb->log_send_errors)
+            WARNING ("write_graphite plugin: Send queue to %s:%s is full. "
+                    "Dropping %zu lines.", cb->node, cb->service, drop->lines);
+        wg_buffer_put (cb, drop);
+    }
 }
 
 static int wg_callback_init (struct wg_callback *cb)
@@ -233,6 +334,8 @@ static int wg_callback_init (struct wg_callback *cb)
     assert (ai_list != NULL);
     for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
     {
+        int flags;
+
         cb->sock_fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
                 ai_ptr->ai_protocol);
         if (cb->sock_fd < 0) {
@@ -242,8 +345,20 @@ static int wg_callback_init (struct wg_callback *cb)
             continue;
         }
 
+        /* Neither connecting nor sending may block the write thread. */
+        flags = fcntl (cb->sock_fd, F_GETFL);
+        if (flags >= 0)
+            fcntl (cb->sock_fd, F_SETFL, flags | O_NONBLOCK);
+
         status = connect (cb->sock_fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
-        if (status != 0)
+        if ((status != 0) && (errno == EINPROGRESS))
+        {
+            /* Completed by wg_wait_writable(). Other addresses are not tried
+             * if it fails. */
+            cb->connecting = 1;
+            break;
+        }
+        else if (status != 0)
         {
             char errbuf[1024];
             snprintf (connerr, sizeof (connerr), "failed to connect to remote "
@@ -268,18 +383,196 @@ static int wg_callback_init (struct wg_callback *cb)
                   "The last error was: %s", node, service, protocol, connerr);
         return (-1);
     }
-    else
+    else if (!cb->connecting)
     {
+        cb->stats.connects++;
         c_release (LOG_INFO, &cb->init_complaint,
                 "write_graphite plugin: Successfully connected to %s:%s via %s.",
                 node, service, protocol);
     }
 
-    wg_reset_buffer (cb);
+    return (0);
+}
+
+/* Waits until the socket is writable or "deadline" has passed. Completes a
+ * pending connect. Returns zero if the socket is writable, EAGAIN if it isn't
+ * and another error if the connection failed.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static int wg_wait_writable (struct wg_callback *cb, cdtime_t deadline)
+{
+    struct pollfd pfd;
+    cdtime_t now;
+    int timeout_ms = 0;
+    int status;
+
+    now = cdtime ();
+    if (deadline > now)
+        timeout_ms = (int) CDTIME_T_TO_MS (deadline - now);
+
+    memset (&pfd, 0, sizeof (pfd));
+    pfd.fd = cb->sock_fd;
+    pfd.events = POLLOUT;
+
+    status = poll (&pfd, 1, timeout_ms);
+    if (status < 0)
+        return ((errno == EINTR) ? EAGAIN : errno);
+    else if (status == 0)
+        return (EAGAIN);
+
+    if (cb->connecting)
+    {
+        const char *protocol = cb->protocol ? cb->protocol : WG_DEFAULT_PROTOCOL;
+        int so_error = 0;
+        socklen_t so_error_len = sizeof (so_error);
+
+        status = getsockopt (cb->sock_fd, SOL_SOCKET, SO_ERROR,
+                &so_error, &so_error_len);
+        if ((status != 0) || (so_error != 0))
+        {
+            char errbuf[1024];
+            c_complain (LOG_ERR, &cb->init_complaint,
+                    "write_graphite plugin: Connecting to %s:%s via %s failed. "
+                    "The last error was: failed to connect to remote host: %s",
+                    cb->node, cb->service, protocol,
+                    sstrerror ((status != 0) ? errno : so_error,
+                        errbuf, sizeof (errbuf)));
+            wg_close (cb);
+            return (ECONNREFUSED);
+        }
+
+        cb->connecting = 0;
+        cb->stats.connects++;
+        c_release (LOG_INFO, &cb->init_complaint,
+                "write_graphite plugin: Successfully connected to %s:%s via %s.",
+                cb->node, cb->service, protocol);
+    }
+
+    return (0);
+}
+
+/* Sends queued buffers until the queue is empty, the socket would block
+ * for longer than "timeout_ms" or an error occurs. Buffers which have not been
+ * sent stay queued.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static int wg_send_queue (struct wg_callback *cb, int timeout_ms)
+{
+    cdtime_t deadline = cdtime () + MS_TO_CDTIME_T (timeout_ms);
+    int status;
+
+    while (cb->queue_head != NULL)
+    {
+        struct iovec iov[WG_IOV_MAX];
+        int iov_num = 0;
+        struct wg_buffer *buf;
+        ssize_t bytes;
+
+        if (cb->sock_fd < 0)
+        {
+            status = wg_callback_init (cb);
+            if (status != 0)
+                return (status);
+        }
+
+        if (cb->connecting)
+        {
+            status = wg_wait_writable (cb, deadline);
+            if (status != 0)
+                return ((status == EAGAIN) ? 0 : status);
+        }
+
+        /* Every buffer is a datagram with UDP. */
+        for (buf = cb->queue_head;
+                (buf != NULL) && (iov_num < WG_IOV_MAX);
+                buf = buf->next)
+        {
+            iov[iov_num].iov_base = buf->data + buf->sent;
+            iov[iov_num].iov_len = buf->fill - buf->sent;
+            iov_num++;
+            if (wg_is_udp (cb))
+                break;
+        }
+
+        bytes = writev (cb->sock_fd, iov, iov_num);
+        cb->stats.send_calls++;
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                cb->stats.send_blocked++;
+                status = wg_wait_writable (cb, deadline);
+                if (status == 0)
+                    continue;
+                return ((status == EAGAIN) ? 0 : status);
+            }
+
+            if (cb->log_send_errors)
+            {
+                const char *protocol = cb->protocol ? cb->protocol : WG_DEFAULT_PROTOCOL;
+                char errbuf[1024];
+                ERROR ("write_graphite plugin: send to %s:%s (%s) failed with status %zi (%s)",
+                        cb->node, cb->service, protocol,
+                        bytes, sstrerror (errno, errbuf, sizeof (errbuf)));
+            }
+
+            wg_close (cb);
+            return (-1);
+        }
+
+        cb->stats.bytes_sent += (derive_t) bytes;
+        while ((bytes > 0) || ((cb->queue_head != NULL)
+                    && (cb->queue_head->sent == cb->queue_head->fill)))
+        {
+            size_t n;
+
+            buf = cb->queue_head;
+            n = buf->fill - buf->sent;
+            if (n > (size_t) bytes)
+                n = (size_t) bytes;
+            buf->sent += n;
+            bytes -= (ssize_t) n;
+
+            if (buf->sent < buf->fill)
+                break;
+
+            cb->queue_head = buf->next;
+            if (cb->queue_head == NULL)
+                cb->queue_tail = NULL;
+            cb->queue_bytes -= buf->fill;
+            cb->queue_lines -= buf->lines;
+            cb->stats.lines_sent += (derive_t) buf->lines;
+            wg_buffer_put (cb, buf);
+        }
+    }
 
     return (0);
 }
 
+/* NOTE: You must hold cb->send_lock when calling this function! */
+static int wg_flush_nolock (cdtime_t timeout, struct wg_callback *cb)
+{
+    DEBUG ("write_graphite plugin: wg_flush_nolock: timeout = %.3f; "
+            "send_buf_fill = %zu;",
+            (double)timeout,
+            (cb->send_buf != NULL) ? cb->send_buf->fill : 0);
+
+    /* timeout == 0  => flush unconditionally */
+    if (timeout > 0)
+    {
+        cdtime_t now;
+
+        now = cdtime ();
+        if ((cb->send_buf_init_time + timeout) > now)
+            return (0);
+    }
+
+    wg_queue_buffer (cb);
+    cb->send_buf_init_time = cdtime ();
+
+    return (wg_send_queue (cb, /* timeout = */ 0));
+}
+
 static void wg_callback_free (void *data)
 {
     struct wg_callback *cb;
@@ -291,12 +584,27 @@ static void wg_callback_free (void *data)
 
     pthread_mutex_lock (&cb->send_lock);
 
-    wg_flush_nolock (/* timeout = */ 0, cb);
+    /* Try hard to get the remaining data out. */
+    wg_queue_buffer (cb);
+    cb->last_connect_time = 0;
+    wg_send_queue (cb, WG_SHUTDOWN_TIMEOUT_MS);
+    if (cb->queue_lines > 0)
+        WARNING ("write_graphite plugin: %zu lines to %s:%s have not been "
+                "sent.", cb->queue_lines, cb->node, cb->service);
 
-    if (cb->sock_fd >= 0)
+    wg_close (cb);
+
+    while (cb->queue_head != NULL)
     {
-        close (cb->sock_fd);
-        cb->sock_fd = -1;
+        struct wg_buffer *buf = cb->queue_head;
+        cb->queue_head = buf->next;
+        sfree (buf->data);
+        sfree (buf);
+    }
+    if (cb->spare_buf != NULL)
+    {
+        sfree (cb->spare_buf->data);
+        sfree (cb->spare_buf);
     }
 
     sfree(cb->name);
@@ -306,6 +614,7 @@ static void wg_callback_free (void *data)
     sfree(cb->prefix);
     sfree(cb->postfix);
 
+    pthread_mutex_unlock (&cb->send_lock);
     pthread_mutex_destroy (&cb->send_lock);
 
     sfree(cb);
@@ -324,100 +633,95 @@ static int wg_flush (cdtime_t timeout,
     cb = user_data->data;
 
     pthread_mutex_lock (&cb->send_lock);
+    status = wg_flush_nolock (timeout, cb);
+    pthread_mutex_unlock (&cb->send_lock);
 
-    if (cb->sock_fd < 0)
+    return (status);
+}
+
+/* Returns the buffer new lines are appended to, allocating one if necessary.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static struct wg_buffer *wg_current_buffer (struct wg_callback *cb)
+{
+    if (cb->send_buf == NULL)
     {
-        status = wg_callback_init (cb);
-        if (status != 0)
+        cb->send_buf = wg_buffer_get (cb);
+        if (cb->send_buf == NULL)
         {
-            /* An error message has already been printed. */
-            pthread_mutex_unlock (&cb->send_lock);
-            return (-1);
+            ERROR ("write_graphite plugin: malloc failed.");
+            return (NULL);
         }
+        cb->send_buf_init_time = cdtime ();
     }
 
-    status = wg_flush_nolock (timeout, cb);
-    pthread_mutex_unlock (&cb->send_lock);
-
-    return (status);
+    return (cb->send_buf);
 }
 
-static int wg_send_message (char const *message, struct wg_callback *cb)
+static int wg_write_messages (const data_set_t *ds, const value_list_t *vl,
+        struct wg_callback *cb)
 {
+    struct wg_buffer *buf;
     int status;
-    size_t message_len;
 
-    message_len = strlen (message);
+    if (0 != strcmp (ds->type, vl->type))
+    {
+        ERROR ("write_graphite plugin: DS type does not match "
+                "value list type");
+        return -1;
+    }
 
     pthread_mutex_lock (&cb->send_lock);
 
-    if (cb->sock_fd < 0)
+    /* The lines are formatted right into the send buffer. If they don't fit,
+     * the buffer is queued and the lines go into the next one. */
+    buf = wg_current_buffer (cb);
+    if (buf == NULL)
     {
-        status = wg_callback_init (cb);
-        if (status != 0)
-        {
-            /* An error message has already been printed. */
-            pthread_mutex_unlock (&cb->send_lock);
-            return (-1);
-        }
+        pthread_mutex_unlock (&cb->send_lock);
+        return (ENOMEM);
     }
 
-    if (message_len >= cb->send_buf_free)
+    status = format_graphite_append (buf->data, buf->size, &buf->fill,
+            ds, vl, cb->prefix, cb->postfix, cb->escape_char,
+            cb->format_flags);
+    if ((status == -ENOMEM) && (buf->fill > 0))
     {
-        status = wg_flush_nolock (/* timeout = */ 0, cb);
-        if (status != 0)
+        wg_queue_buffer (cb);
+        buf = wg_current_buffer (cb);
+        if (buf == NULL)
         {
             pthread_mutex_unlock (&cb->send_lock);
-            return (status);
+            return (ENOMEM);
         }
-    }
 
-    /* Assert that we have enough space for this message. */
-    assert (message_len < cb->send_buf_free);
+        status = format_graphite_append (buf->data, buf->size, &buf->fill,
+                ds, vl, cb->prefix, cb->postfix, cb->escape_char,
+                cb->format_flags);
+    }
 
-    /* `message_len + 1' because `message_len' does not include the
-     * trailing null byte. Neither does `send_buffer_fill'. */
-    memcpy (cb->send_buf + cb->send_buf_fill,
-            message, message_len + 1);
-    cb->send_buf_fill += message_len;
-    cb->send_buf_free -= message_len;
+    if (status != 0)
+    {
+        pthread_mutex_unlock (&cb->send_lock);
+        if (status == -ENOMEM)
+            ERROR ("write_graphite plugin: The lines for \"%s\" don't fit "
+                    "into the send buffer.", vl->type);
+        return (status);
+    }
+    buf->lines += ds->ds_num;
 
-    DEBUG ("write_graphite plugin: [%s]:%s (%s) buf %zu/%zu (%.1f %%) \"%s\"",
+    DEBUG ("write_graphite plugin: [%s]:%s (%s) buf %zu/%zu (%.1f %%)",
             cb->node,
             cb->service,
             cb->protocol,
-            cb->send_buf_fill, sizeof (cb->send_buf),
-            100.0 * ((double) cb->send_buf_fill) / ((double) sizeof (cb->send_buf)),
-            message);
-
-    pthread_mutex_unlock (&cb->send_lock);
-
-    return (0);
-}
+            buf->fill, buf->size,
+            100.0 * ((double) buf->fill) / ((double) buf->size));
 
-static int wg_write_messages (const data_set_t *ds, const value_list_t *vl,
-        struct wg_callback *cb)
-{
-    char buffer[WG_SEND_BUF_SIZE];
-    int status;
-
-    if (0 != strcmp (ds->type, vl->type))
-    {
-        ERROR ("write_graphite plugin: DS type does not match "
-                "value list type");
-        return -1;
-    }
+    /* Sending doesn't block. Whatever can't be sent stays queued, so an
+     * error is not passed on to the caller. */
+    if (cb->queue_head != NULL)
+        wg_send_queue (cb, /* timeout = */ 0);
 
-    memset (buffer, 0, sizeof (buffer));
-    status = format_graphite (buffer, sizeof (buffer), ds, vl,
-            cb->prefix, cb->postfix, cb->escape_char, cb->format_flags);
-    if (status != 0) /* error message has been printed already. */
-        return (status);
-
-    /* Send the message to graphite */
-    status = wg_send_message (buffer, cb);
-    if (status != 0) /* error message has been printed already. */
-        return (status);
+    pthread_mutex_unlock (&cb->send_lock);
 
     return (0);
 } /* int wg_write_messages */
@@ -438,6 +742,52 @@ static int wg_write (const data_set_t *ds, const value_list_t *vl,
     return (status);
 }
 
+static int wg_stats_read (user_data_t *user_data)
+{
+    struct wg_callback *cb = user_data->data;
+    struct wg_stats stats;
+    size_t queue_bytes;
+    size_t queue_lines;
+    char plugin_instance[DATA_MAX_NAME_LEN];
+
+    pthread_mutex_lock (&cb->send_lock);
+    stats = cb->stats;
+    queue_bytes = cb->queue_bytes;
+    queue_lines = cb->queue_lines;
+    if (cb->send_buf != NULL)
+    {
+        queue_bytes += cb->send_buf->fill;
+        queue_lines += cb->send_buf->lines;
+    }
+    pthread_mutex_unlock (&cb->send_lock);
+
+    if (cb->name != NULL)
+        sstrncpy (plugin_instance, cb->name, sizeof (plugin_instance));
+    else
+        ssnprintf (plugin_instance, sizeof (plugin_instance), "%s_%s",
+                cb->node != NULL ? cb->node : WG_DEFAULT_NODE,
+                cb->service != NULL ? cb->service : WG_DEFAULT_SERVICE);
+
+    stats_submit_derive ("write_graphite", plugin_instance,
+            "total_bytes", "sent", stats.bytes_sent);
+    stats_submit_derive ("write_graphite", plugin_instance,
+            "total_values", "sent", stats.lines_sent);
+    stats_submit_derive ("write_graphite", plugin_instance,
+            "total_values", "dropped", stats.lines_dropped);
+    stats_submit_derive ("write_graphite", plugin_instance,
+            "total_operations", "send", stats.send_calls);
+    stats_submit_derive ("write_graphite", plugin_instance,
+            "total_operations", "blocked", stats.send_blocked);
+    stats_submit_derive ("write_graphite", plugin_instance,
+            "total_operations", "connect", stats.connects);
+    stats_submit_gauge ("write_graphite", plugin_instance,
+            "queue_length", "", (gauge_t) queue_lines);
+    stats_submit_gauge ("write_graphite", plugin_instance,
+            "bytes", "queued", (gauge_t) queue_bytes);
+
+    return (0);
+}
+
 static int config_set_char (char *dest,
         oconfig_item_t *ci)
 {
@@ -494,6 +844,9 @@ static int wg_config_node (oconfig_item_t *ci)
     cb->postfix = NULL;
     cb->escape_char = WG_DEFAULT_ESCAPE;
     cb->format_flags = GRAPHITE_STORE_RATES;
+    cb->buffer_size = 0;
+    cb->send_queue_size = WG_DEFAULT_SEND_QUEUE_SIZE;
+    cb->report_stats = 0;
 
     /* FIXME: Legacy configuration syntax. */
     if (strcasecmp ("Carbon", ci->key) != 0)
@@ -546,6 +899,34 @@ static int wg_config_node (oconfig_item_t *ci)
                     GRAPHITE_ALWAYS_APPEND_DS);
         else if (strcasecmp ("EscapeCharacter", child->key) == 0)
             config_set_char (&cb->escape_char, child);
+        else if (strcasecmp ("BufferSize", child->key) == 0)
+        {
+            int tmp = 0;
+            status = cf_util_get_int (child, &tmp);
+            if ((status == 0) && (tmp < WG_SEND_BUF_SIZE))
+            {
+                WARNING ("write_graphite plugin: BufferSize must be at "
+                        "least %i.", WG_SEND_BUF_SIZE);
+                tmp = WG_SEND_BUF_SIZE;
+            }
+            if (status == 0)
+                cb->buffer_size = (size_t) tmp;
+        }
+        else if (strcasecmp ("SendQueueSize", child->key) == 0)
+        {
+            int tmp = 0;
+            status = cf_util_get_int (child, &tmp);
+            if ((status == 0) && (tmp < 0))
+            {
+                ERROR ("write_graphite plugin: SendQueueSize must not be "
+                        "negative.");
+                status = -1;
+            }
+            if (status == 0)
+                cb->send_queue_size = (size_t) tmp;
+        }
+        else if (strcasecmp ("ReportStats", child->key) == 0)
+            cf_util_get_boolean (child, &cb->report_stats);
         else
         {
             ERROR ("write_graphite plugin: Invalid configuration "
@@ -563,6 +944,13 @@ static int wg_config_node (oconfig_item_t *ci)
         return (status);
     }
 
+    /* Every buffer is sent as one datagram with UDP, so the buffers must not
+     * exceed the MTU there. */
+    if (wg_is_udp (cb))
+        cb->buffer_size = WG_SEND_BUF_SIZE;
+    else if (cb->buffer_size == 0)
+        cb->buffer_size = WG_DEFAULT_BUFFER_SIZE;
+
     /* FIXME: Legacy configuration syntax. */
     if (cb->name == NULL)
         ssnprintf (callback_name, sizeof (callback_name), "write_graphite/%s/%s/%s",
@@ -581,6 +969,10 @@ static int wg_config_node (oconfig_item_t *ci)
     user_data.free_func = NULL;
     plugin_register_flush (callback_name, wg_flush, &user_data);
 
+    if (cb->report_stats)
+        plugin_register_complex_read (/* group = */ NULL, callback_name,
+                wg_stats_read, /* interval = */ 0, &user_data);
+
     return (0);
 }
 
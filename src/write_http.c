@@ -28,20 +28,72 @@
 #include "common.h"
 #include "utils_cache.h"
 #include "utils_format_json.h"
+#include "utils_complain.h"
+#include "write_http.h"
 
 #if HAVE_PTHREAD_H
 # include <pthread.h>
 #endif
 
+#if HAVE_ZLIB
+# include <zlib.h>
+#endif
+
 #include <curl/curl.h>
 
+#if !HAVE_CURL_MULTI_WAIT
+# include <sys/select.h>
+#endif
+
 #ifndef WRITE_HTTP_DEFAULT_BUFFER_SIZE
-# define WRITE_HTTP_DEFAULT_BUFFER_SIZE 4096
+# define WRITE_HTTP_DEFAULT_BUFFER_SIZE 65536
+#endif
+
+/* Number of identifiers for which the JSON serializer caches the static
+ * parts of the objects. */
+#ifndef WRITE_HTTP_JSON_CACHE_SIZE
+# define WRITE_HTTP_JSON_CACHE_SIZE 4096
 #endif
 
+#define WH_DEFAULT_MAX_REQUESTS 4
+#define WH_DEFAULT_MAX_RETRIES 3
+#define WH_DEFAULT_SPOOL_SIZE (16 * 1024 * 1024)
+
+/* Failed requests are retried after 1, 2, 4, ... seconds, at most after
+ * WH_RETRY_INTERVAL_MAX. */
+#define WH_RETRY_INTERVAL_MAX TIME_T_TO_CDTIME_T (60)
+
+/* How long the sender thread keeps sending queued data on shutdown. */
+#define WH_SHUTDOWN_TIMEOUT TIME_T_TO_CDTIME_T (5)
+
 /*
  * Private variables
  */
+
+/* One request body. Batches are created by the write callbacks and sent by
+ * the sender thread of the node. */
+struct wh_batch_s
+{
+        char *data;
+        size_t size;
+        _Bool compressed;
+
+        int attempts;
+        cdtime_t next_attempt;
+
+        struct wh_batch_s *next;
+};
+typedef struct wh_batch_s wh_batch_t;
+
+/* A curl handle of the pool and the batch it is currently sending. */
+struct wh_request_s
+{
+        CURL *curl;
+        char curl_errbuf[CURL_ERROR_SIZE];
+        wh_batch_t *batch;
+};
+typedef struct wh_request_s wh_request_t;
+
 struct wh_callback_s
 {
         char *name;
@@ -62,13 +114,16 @@ struct wh_callback_s
         int   low_speed_limit;
         time_t low_speed_time;
         int timeout;
+        _Bool compress;
+        int max_requests;
+        int max_retries;
+        size_t spool_size;
 
 #define WH_FORMAT_COMMAND 0
 #define WH_FORMAT_JSON    1
         int format;
 
-        CURL *curl;
-        char curl_errbuf[CURL_ERROR_SIZE];
+        struct curl_slist *headers;
 
         char  *send_buffer;
         size_t send_buffer_size;
@@ -76,91 +131,318 @@ struct wh_callback_s
         size_t send_buffer_fill;
         cdtime_t send_buffer_init_time;
 
+        /* Used instead of send_buffer with the JSON format. */
+        format_json_stream_t *json;
+
         pthread_mutex_t send_lock;
+
+        /* Batches waiting to be sent, oldest first. Batches which failed
+         * are put back at the front. Protected by queue_lock. */
+        wh_batch_t *queue_head;
+        wh_batch_t *queue_tail;
+        size_t queue_bytes;
+        uint64_t dropped_batches;
+        _Bool shutdown;
+        _Bool sender_running;
+        pthread_t sender_thread;
+        pthread_mutex_t queue_lock;
+
+        /* Written to when a batch is queued, so the sender thread wakes up
+         * while it waits for the transfers in progress. */
+        int wakeup_pipe[2];
+
+        /* Only used by the sender thread. */
+        CURLM *multi;
+        wh_request_t *requests;
+        c_complain_t init_complaint;
 };
-typedef struct wh_callback_s wh_callback_t;
+
+static void wh_batch_free (wh_batch_t *b) /* {{{ */
+{
+        if (b == NULL)
+                return;
+
+        sfree (b->data);
+        sfree (b);
+} /* }}} void wh_batch_free */
 
 static void wh_reset_buffer (wh_callback_t *cb)  /* {{{ */
 {
-        memset (cb->send_buffer, 0, cb->send_buffer_size);
-        cb->send_buffer_free = cb->send_buffer_size;
-        cb->send_buffer_fill = 0;
         cb->send_buffer_init_time = cdtime ();
 
         if (cb->format == WH_FORMAT_JSON)
         {
-                format_json_initialize (cb->send_buffer,
-                                &cb->send_buffer_fill,
-                                &cb->send_buffer_free);
+                format_json_stream_reset (cb->json);
+                return;
         }
+
+        memset (cb->send_buffer, 0, cb->send_buffer_size);
+        cb->send_buffer_free = cb->send_buffer_size;
+        cb->send_buffer_fill = 0;
 } /* }}} wh_reset_buffer */
 
-static int wh_send_buffer (wh_callback_t *cb) /* {{{ */
+/* Wakes up the sender thread. */
+static void wh_wakeup (wh_callback_t *cb) /* {{{ */
 {
-        int status = 0;
+        char c = 0;
 
-        curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDS, cb->send_buffer);
-        status = curl_easy_perform (cb->curl);
-        if (status != CURLE_OK)
+        if (write (cb->wakeup_pipe[1], &c, sizeof (c)) < 0)
         {
-                ERROR ("write_http plugin: curl_easy_perform failed with "
-                                "status %i: %s",
-                                status, cb->curl_errbuf);
+                /* The pipe is full if the sender has many wakeups pending
+                 * already; nothing to do. */
         }
-        return (status);
-} /* }}} wh_send_buffer */
+} /* }}} void wh_wakeup */
 
-static int wh_callback_init (wh_callback_t *cb) /* {{{ */
+/* Appends a batch to the queue and drops the oldest batches if the queue
+ * exceeds SpoolSize. Called with queue_lock held. */
+static void wh_queue_append (wh_callback_t *cb, wh_batch_t *b) /* {{{ */
 {
-        struct curl_slist *headers;
+        b->next = NULL;
+        if (cb->queue_tail == NULL)
+                cb->queue_head = b;
+        else
+                cb->queue_tail->next = b;
+        cb->queue_tail = b;
+        cb->queue_bytes += b->size;
+
+        while ((cb->queue_bytes > cb->spool_size)
+                        && (cb->queue_head != b))
+        {
+                wh_batch_t *old = cb->queue_head;
+
+                cb->queue_head = old->next;
+                cb->queue_bytes -= old->size;
+                cb->dropped_batches++;
+                wh_batch_free (old);
+        }
+} /* }}} void wh_queue_append */
 
-        if (cb->curl != NULL)
-                return (0);
+/* Puts a failed batch back at the front of the queue. Called with
+ * queue_lock held. */
+static void wh_queue_prepend (wh_callback_t *cb, wh_batch_t *b) /* {{{ */
+{
+        b->next = cb->queue_head;
+        cb->queue_head = b;
+        if (cb->queue_tail == NULL)
+                cb->queue_tail = b;
+        cb->queue_bytes += b->size;
+} /* }}} void wh_queue_prepend */
+
+/* Removes the first batch which is due for sending. Batches waiting for a
+ * retry are skipped; the earliest retry time is stored in "next_attempt".
+ * Called with queue_lock held. */
+static wh_batch_t *wh_queue_take (wh_callback_t *cb, /* {{{ */
+                cdtime_t now, cdtime_t *next_attempt)
+{
+        wh_batch_t *prev = NULL;
+        wh_batch_t *b;
 
-        cb->curl = curl_easy_init ();
-        if (cb->curl == NULL)
+        for (b = cb->queue_head; b != NULL; prev = b, b = b->next)
         {
-                ERROR ("curl plugin: curl_easy_init failed.");
+                if (b->next_attempt <= now)
+                        break;
+                if ((*next_attempt == 0) || (b->next_attempt < *next_attempt))
+                        *next_attempt = b->next_attempt;
+        }
+        if (b == NULL)
+                return (NULL);
+
+        if (prev == NULL)
+                cb->queue_head = b->next;
+        else
+                prev->next = b->next;
+        if (cb->queue_tail == b)
+                cb->queue_tail = prev;
+        cb->queue_bytes -= b->size;
+        b->next = NULL;
+
+        return (b);
+} /* }}} wh_batch_t *wh_queue_take */
+
+#if HAVE_ZLIB
+static int wh_compress (wh_batch_t *b) /* {{{ */
+{
+        z_stream z;
+        char *data;
+        size_t data_size;
+        int status;
+
+        memset (&z, 0, sizeof (z));
+        /* windowBits = 15 + 16 selects the gzip format. */
+        status = deflateInit2 (&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                        15 + 16, 8, Z_DEFAULT_STRATEGY);
+        if (status != Z_OK)
                 return (-1);
+
+        data_size = (size_t) deflateBound (&z, (uLong) b->size);
+        data = malloc (data_size);
+        if (data == NULL)
+        {
+                deflateEnd (&z);
+                return (-1);
+        }
+
+        z.next_in = (Bytef *) b->data;
+        z.avail_in = (uInt) b->size;
+        z.next_out = (Bytef *) data;
+        z.avail_out = (uInt) data_size;
+        status = deflate (&z, Z_FINISH);
+        deflateEnd (&z);
+        if (status != Z_STREAM_END)
+        {
+                sfree (data);
+                return (-1);
+        }
+
+        sfree (b->data);
+        b->data = data;
+        b->size = (size_t) z.total_out;
+        b->compressed = 1;
+        return (0);
+} /* }}} int wh_compress */
+#endif
+
+/* Moves the buffered data into a new batch and queues it. Called with
+ * send_lock held. */
+static int wh_submit_nolock (wh_callback_t *cb) /* {{{ */
+{
+        wh_batch_t *b;
+
+        b = calloc (1, sizeof (*b));
+        if (b == NULL)
+                return (-1);
+
+        if (cb->format == WH_FORMAT_JSON)
+        {
+                int status;
+
+                status = format_json_stream_finalize (cb->json);
+                if (status != 0)
+                {
+                        ERROR ("write_http plugin: "
+                                        "format_json_stream_finalize failed.");
+                        sfree (b);
+                        return (status);
+                }
+
+                b->size = format_json_stream_length (cb->json);
+                b->data = malloc (b->size);
+                if (b->data == NULL)
+                {
+                        sfree (b);
+                        return (-1);
+                }
+                format_json_stream_read (cb->json, 0, b->data, b->size);
+        }
+        else
+        {
+                /* Hand over the buffer instead of copying it. */
+                char *buffer = malloc (cb->send_buffer_size);
+                if (buffer == NULL)
+                {
+                        sfree (b);
+                        return (-1);
+                }
+                b->data = cb->send_buffer;
+                b->size = cb->send_buffer_fill;
+                cb->send_buffer = buffer;
+        }
+
+        pthread_mutex_lock (&cb->queue_lock);
+        wh_queue_append (cb, b);
+        pthread_mutex_unlock (&cb->queue_lock);
+        wh_wakeup (cb);
+
+        return (0);
+} /* }}} int wh_submit_nolock */
+
+static CURL *wh_curl_init (wh_callback_t *cb, wh_request_t *r) /* {{{ */
+{
+        CURL *curl;
+
+        curl = curl_easy_init ();
+        if (curl == NULL)
+        {
+                ERROR ("curl plugin: curl_easy_init failed.");
+                return (NULL);
         }
 
         if (cb->low_speed_limit > 0 && cb->low_speed_time > 0)
         {
-                curl_easy_setopt (cb->curl, CURLOPT_LOW_SPEED_LIMIT,
+                curl_easy_setopt (curl, CURLOPT_LOW_SPEED_LIMIT,
                                   (long) (cb->low_speed_limit * cb->low_speed_time));
-                curl_easy_setopt (cb->curl, CURLOPT_LOW_SPEED_TIME,
+                curl_easy_setopt (curl, CURLOPT_LOW_SPEED_TIME,
                                   (long) cb->low_speed_time);
         }
 
 #ifdef HAVE_CURLOPT_TIMEOUT_MS
         if (cb->timeout > 0)
-                curl_easy_setopt (cb->curl, CURLOPT_TIMEOUT_MS, (long) cb->timeout);
+                curl_easy_setopt (curl, CURLOPT_TIMEOUT_MS, (long) cb->timeout);
 #endif
 
-        curl_easy_setopt (cb->curl, CURLOPT_NOSIGNAL, 1L);
-        curl_easy_setopt (cb->curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
-
-        headers = NULL;
-        headers = curl_slist_append (headers, "Accept:  */*");
-        if (cb->format == WH_FORMAT_JSON)
-                headers = curl_slist_append (headers, "Content-Type: application/json");
-        else
-                headers = curl_slist_append (headers, "Content-Type: text/plain");
-        headers = curl_slist_append (headers, "Expect:");
-        curl_easy_setopt (cb->curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt (curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt (curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
+        curl_easy_setopt (curl, CURLOPT_HTTPHEADER, cb->headers);
+        curl_easy_setopt (curl, CURLOPT_PRIVATE, r);
 
-        curl_easy_setopt (cb->curl, CURLOPT_ERRORBUFFER, cb->curl_errbuf);
-        curl_easy_setopt (cb->curl, CURLOPT_URL, cb->location);
-        curl_easy_setopt (cb->curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt (cb->curl, CURLOPT_MAXREDIRS, 50L);
+        curl_easy_setopt (curl, CURLOPT_ERRORBUFFER, r->curl_errbuf);
+        curl_easy_setopt (curl, CURLOPT_URL, cb->location);
+        curl_easy_setopt (curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt (curl, CURLOPT_MAXREDIRS, 50L);
 
         if (cb->user != NULL)
         {
 #ifdef HAVE_CURLOPT_USERNAME
-                curl_easy_setopt (cb->curl, CURLOPT_USERNAME, cb->user);
-                curl_easy_setopt (cb->curl, CURLOPT_PASSWORD,
+                curl_easy_setopt (curl, CURLOPT_USERNAME, cb->user);
+                curl_easy_setopt (curl, CURLOPT_PASSWORD,
                         (cb->pass == NULL) ? "" : cb->pass);
 #else
+                curl_easy_setopt (curl, CURLOPT_USERPWD, cb->credentials);
+#endif
+                curl_easy_setopt (curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+        }
+
+        curl_easy_setopt (curl, CURLOPT_SSL_VERIFYPEER, (long) cb->verify_peer);
+        curl_easy_setopt (curl, CURLOPT_SSL_VERIFYHOST,
+                        cb->verify_host ? 2L : 0L);
+        curl_easy_setopt (curl, CURLOPT_SSLVERSION, cb->sslversion);
+        if (cb->cacert != NULL)
+                curl_easy_setopt (curl, CURLOPT_CAINFO, cb->cacert);
+        if (cb->capath != NULL)
+                curl_easy_setopt (curl, CURLOPT_CAPATH, cb->capath);
+
+        if (cb->clientkey != NULL && cb->clientcert != NULL)
+        {
+            curl_easy_setopt (curl, CURLOPT_SSLKEY, cb->clientkey);
+            curl_easy_setopt (curl, CURLOPT_SSLCERT, cb->clientcert);
+
+            if (cb->clientkeypass != NULL)
+                curl_easy_setopt (curl, CURLOPT_SSLKEYPASSWD, cb->clientkeypass);
+        }
+
+        return (curl);
+} /* }}} CURL *wh_curl_init */
+
+/* Sets up the settings shared by all curl handles of a node. */
+static int wh_callback_init (wh_callback_t *cb) /* {{{ */
+{
+        cb->headers = curl_slist_append (cb->headers, "Accept:  */*");
+        if (cb->format == WH_FORMAT_JSON)
+                cb->headers = curl_slist_append (cb->headers, "Content-Type: application/json");
+        else
+                cb->headers = curl_slist_append (cb->headers, "Content-Type: text/plain");
+        if (cb->compress)
+                cb->headers = curl_slist_append (cb->headers, "Content-Encoding: gzip");
+        cb->headers = curl_slist_append (cb->headers, "Expect:");
+        if (cb->headers == NULL)
+        {
+                ERROR ("write_http plugin: curl_slist_append failed.");
+                return (-1);
+        }
+
+#ifndef HAVE_CURLOPT_USERNAME
+        if (cb->user != NULL)
+        {
                 size_t credentials_size;
 
                 credentials_size = strlen (cb->user) + 2;
@@ -176,34 +458,311 @@ static int wh_callback_init (wh_callback_t *cb) /* {{{ */
 
                 ssnprintf (cb->credentials, credentials_size, "%s:%s",
                                 cb->user, (cb->pass == NULL) ? "" : cb->pass);
-                curl_easy_setopt (cb->curl, CURLOPT_USERPWD, cb->credentials);
+        }
 #endif
-                curl_easy_setopt (cb->curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+
+        if (pipe (cb->wakeup_pipe) != 0)
+        {
+                char errbuf[1024];
+                ERROR ("write_http plugin: pipe failed: %s",
+                                sstrerror (errno, errbuf, sizeof (errbuf)));
+                cb->wakeup_pipe[0] = cb->wakeup_pipe[1] = -1;
+                return (-1);
+        }
+        fcntl (cb->wakeup_pipe[0], F_SETFL,
+                        fcntl (cb->wakeup_pipe[0], F_GETFL) | O_NONBLOCK);
+        fcntl (cb->wakeup_pipe[1], F_SETFL,
+                        fcntl (cb->wakeup_pipe[1], F_GETFL) | O_NONBLOCK);
+
+        cb->multi = curl_multi_init ();
+        cb->requests = calloc ((size_t) cb->max_requests, sizeof (*cb->requests));
+        if ((cb->multi == NULL) || (cb->requests == NULL))
+        {
+                ERROR ("write_http plugin: Allocating the curl handles failed.");
+                return (-1);
         }
 
-        curl_easy_setopt (cb->curl, CURLOPT_SSL_VERIFYPEER, (long) cb->verify_peer);
-        curl_easy_setopt (cb->curl, CURLOPT_SSL_VERIFYHOST,
-                        cb->verify_host ? 2L : 0L);
-        curl_easy_setopt (cb->curl, CURLOPT_SSLVERSION, cb->sslversion);
-        if (cb->cacert != NULL)
-                curl_easy_setopt (cb->curl, CURLOPT_CAINFO, cb->cacert);
-        if (cb->capath != NULL)
-                curl_easy_setopt (cb->curl, CURLOPT_CAPATH, cb->capath);
+        return (0);
+} /* }}} int wh_callback_init */
 
-        if (cb->clientkey != NULL && cb->clientcert != NULL)
-        {
-            curl_easy_setopt (cb->curl, CURLOPT_SSLKEY, cb->clientkey);
-            curl_easy_setopt (cb->curl, CURLOPT_SSLCERT, cb->clientcert);
+/* Starts sending batch "b" with the idle request "r". */
+static int wh_request_start (wh_callback_t *cb, wh_request_t *r, /* {{{ */
+                wh_batch_t *b)
+{
+        CURLMcode status;
 
-            if (cb->clientkeypass != NULL)
-                curl_easy_setopt (cb->curl, CURLOPT_SSLKEYPASSWD, cb->clientkeypass);
+#if HAVE_ZLIB
+        if (cb->compress && !b->compressed && (wh_compress (b) != 0))
+        {
+                ERROR ("write_http plugin: Compressing %zu bytes failed.",
+                                b->size);
+                return (-1);
         }
+#endif
 
-        wh_reset_buffer (cb);
+        r->batch = b;
+        r->curl_errbuf[0] = 0;
+        curl_easy_setopt (r->curl, CURLOPT_POSTFIELDSIZE_LARGE,
+                        (curl_off_t) b->size);
+        curl_easy_setopt (r->curl, CURLOPT_POSTFIELDS, b->data);
+
+        status = curl_multi_add_handle (cb->multi, r->curl);
+        if (status != CURLM_OK)
+        {
+                ERROR ("write_http plugin: curl_multi_add_handle failed: %s",
+                                curl_multi_strerror (status));
+                r->batch = NULL;
+                return (-1);
+        }
 
         return (0);
-} /* }}} int wh_callback_init */
+} /* }}} int wh_request_start */
+
+/* Handles a finished transfer: failed batches are queued again until
+ * MaxRetries is exceeded. Server errors (5xx), "408 Request Timeout" and
+ * "429 Too Many Requests" are retried, other client errors are not. */
+static void wh_request_done (wh_callback_t *cb, wh_request_t *r, /* {{{ */
+                CURLcode result)
+{
+        wh_batch_t *b = r->batch;
+        cdtime_t interval;
+        long response_code = 0;
+        _Bool retry = 0;
 
+        curl_multi_remove_handle (cb->multi, r->curl);
+        r->batch = NULL;
+
+        curl_easy_getinfo (r->curl, CURLINFO_RESPONSE_CODE, &response_code);
+
+        if (result != CURLE_OK)
+        {
+                ERROR ("write_http plugin: curl_easy_perform failed with "
+                                "status %i: %s",
+                                result, r->curl_errbuf);
+                retry = 1;
+        }
+        else if (response_code >= 400)
+        {
+                ERROR ("write_http plugin: <%s> answered with status %ld.",
+                                cb->location, response_code);
+                retry = (response_code >= 500) || (response_code == 408)
+                        || (response_code == 429);
+        }
+        else
+        {
+                wh_batch_free (b);
+                return;
+        }
+
+        b->attempts++;
+        if (!retry || (b->attempts > cb->max_retries))
+        {
+                ERROR ("write_http plugin: Dropping %zu bytes for <%s> "
+                                "after %i attempt(s).",
+                                b->size, cb->location, b->attempts);
+                wh_batch_free (b);
+                return;
+        }
+
+        interval = WH_RETRY_INTERVAL_MAX;
+        if (b->attempts <= 6)
+                interval = TIME_T_TO_CDTIME_T (1 << (b->attempts - 1));
+        if (interval > WH_RETRY_INTERVAL_MAX)
+                interval = WH_RETRY_INTERVAL_MAX;
+        b->next_attempt = cdtime () + interval;
+
+        pthread_mutex_lock (&cb->queue_lock);
+        wh_queue_prepend (cb, b);
+        pthread_mutex_unlock (&cb->queue_lock);
+} /* }}} void wh_request_done */
+
+/* Waits for activity on the transfers or the wakeup pipe, for at most
+ * "timeout_ms" milliseconds. */
+static void wh_multi_wait (wh_callback_t *cb, long timeout_ms) /* {{{ */
+{
+        _Bool woken = 0;
+#if HAVE_CURL_MULTI_WAIT
+        struct curl_waitfd wfd;
+
+        memset (&wfd, 0, sizeof (wfd));
+        wfd.fd = cb->wakeup_pipe[0];
+        wfd.events = CURL_WAIT_POLLIN;
+        curl_multi_wait (cb->multi, &wfd, 1, (int) timeout_ms, NULL);
+        woken = (wfd.revents != 0);
+#else
+        fd_set rfds, wfds, efds;
+        struct timeval tv;
+        int max_fd = -1;
+
+        FD_ZERO (&rfds);
+        FD_ZERO (&wfds);
+        FD_ZERO (&efds);
+        curl_multi_fdset (cb->multi, &rfds, &wfds, &efds, &max_fd);
+        FD_SET (cb->wakeup_pipe[0], &rfds);
+        if (cb->wakeup_pipe[0] > max_fd)
+                max_fd = cb->wakeup_pipe[0];
+
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        if (select (max_fd + 1, &rfds, &wfds, &efds, &tv) > 0)
+                woken = FD_ISSET (cb->wakeup_pipe[0], &rfds) ? 1 : 0;
+#endif
+
+        if (woken)
+        {
+                char buffer[64];
+                while (read (cb->wakeup_pipe[0], buffer, sizeof (buffer)) > 0)
+                        /* drain */;
+        }
+} /* }}} void wh_multi_wait */
+
+/* Sends the queued batches with up to MaxConcurrentRequests transfers in
+ * parallel, so that the write callbacks never wait for the server. */
+static void *wh_sender_thread (void *arg) /* {{{ */
+{
+        wh_callback_t *cb = arg;
+        cdtime_t shutdown_deadline = 0;
+        int i;
+
+        for (i = 0; i < cb->max_requests; i++)
+        {
+                cb->requests[i].curl = wh_curl_init (cb, cb->requests + i);
+                if (cb->requests[i].curl == NULL)
+                        break;
+        }
+        if (i < cb->max_requests)
+        {
+                c_complain (LOG_ERR, &cb->init_complaint,
+                                "write_http plugin: Creating curl handles for "
+                                "<%s> failed. Will retry with the next flush.",
+                                cb->location);
+                while (i > 0)
+                {
+                        i--;
+                        curl_easy_cleanup (cb->requests[i].curl);
+                        cb->requests[i].curl = NULL;
+                }
+
+                /* The next flush starts a new thread. On shutdown,
+                 * wh_callback_free joins this one. */
+                pthread_mutex_lock (&cb->queue_lock);
+                if (!cb->shutdown)
+                {
+                        cb->sender_running = 0;
+                        pthread_detach (pthread_self ());
+                }
+                pthread_mutex_unlock (&cb->queue_lock);
+                return (NULL);
+        }
+        c_release (LOG_INFO, &cb->init_complaint,
+                        "write_http plugin: Created the curl handles for <%s>.",
+                        cb->location);
+
+        while (42)
+        {
+                CURLMsg *msg;
+                cdtime_t now = cdtime ();
+                cdtime_t next_attempt = 0;
+                long timeout_ms = 1000;
+                long curl_timeout = -1;
+                int active = 0;
+                int running;
+                int msgs;
+                _Bool queue_empty;
+                _Bool shutdown;
+
+                /* Start a transfer for every idle handle with a batch to
+                 * send. On shutdown, failed batches are retried right
+                 * away. */
+                pthread_mutex_lock (&cb->queue_lock);
+                shutdown = cb->shutdown;
+                for (i = 0; i < cb->max_requests; i++)
+                {
+                        wh_request_t *r = cb->requests + i;
+                        wh_batch_t *b;
+
+                        if (r->batch == NULL)
+                        {
+                                b = wh_queue_take (cb,
+                                                shutdown ? (cdtime_t) -1 : now,
+                                                &next_attempt);
+                                if ((b != NULL) && (wh_request_start (cb, r, b) != 0))
+                                        wh_batch_free (b);
+                        }
+
+                        if (r->batch != NULL)
+                                active++;
+                }
+
+                queue_empty = (cb->queue_head == NULL);
+                if (cb->dropped_batches > 0)
+                {
+                        WARNING ("write_http plugin: Spool of <%s> is full, "
+                                        "dropped the %"PRIu64" oldest "
+                                        "batch(es).", cb->location,
+                                        cb->dropped_batches);
+                        cb->dropped_batches = 0;
+                }
+                pthread_mutex_unlock (&cb->queue_lock);
+
+                if (shutdown)
+                {
+                        if (shutdown_deadline == 0)
+                                shutdown_deadline = now + WH_SHUTDOWN_TIMEOUT;
+                        if ((active == 0) && queue_empty)
+                                break;
+                        if (now >= shutdown_deadline)
+                                break;
+                }
+
+                curl_multi_perform (cb->multi, &running);
+                while ((msg = curl_multi_info_read (cb->multi, &msgs)) != NULL)
+                {
+                        wh_request_t *r = NULL;
+
+                        if (msg->msg != CURLMSG_DONE)
+                                continue;
+
+                        curl_easy_getinfo (msg->easy_handle, CURLINFO_PRIVATE,
+                                        (char **) &r);
+                        wh_request_done (cb, r, msg->data.result);
+                }
+
+                if (next_attempt != 0)
+                {
+                        cdtime_t wait = (next_attempt > now) ? (next_attempt - now) : 0;
+                        if (CDTIME_T_TO_MS (wait) < (uint64_t) timeout_ms)
+                                timeout_ms = (long) CDTIME_T_TO_MS (wait);
+                }
+                if ((curl_multi_timeout (cb->multi, &curl_timeout) == CURLM_OK)
+                                && (curl_timeout >= 0) && (curl_timeout < timeout_ms))
+                        timeout_ms = curl_timeout;
+                if (shutdown && (timeout_ms > 100))
+                        timeout_ms = 100;
+
+                wh_multi_wait (cb, timeout_ms);
+        }
+
+        /* Give up on transfers which are still in progress. */
+        for (i = 0; i < cb->max_requests; i++)
+        {
+                wh_request_t *r = cb->requests + i;
+
+                if (r->batch != NULL)
+                {
+                        curl_multi_remove_handle (cb->multi, r->curl);
+                        WARNING ("write_http plugin: Aborting a request to <%s> "
+                                        "on shutdown.", cb->location);
+                        wh_batch_free (r->batch);
+                        r->batch = NULL;
+                }
+        }
+
+        return (NULL);
+} /* }}} void *wh_sender_thread */
+
+/* Queues the buffered data for sending. The data is sent by the sender
+ * thread, this function doesn't wait for the server. */
 static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
 {
         int status;
@@ -211,7 +770,9 @@ static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
         DEBUG ("write_http plugin: wh_flush_nolock: timeout = %.3f; "
                         "send_buffer_fill = %zu;",
                         CDTIME_T_TO_DOUBLE (timeout),
-                        cb->send_buffer_fill);
+                        (cb->format == WH_FORMAT_JSON)
+                        ? format_json_stream_length (cb->json)
+                        : cb->send_buffer_fill);
 
         /* timeout == 0  => flush unconditionally */
         if (timeout > 0)
@@ -230,31 +791,14 @@ static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
                         cb->send_buffer_init_time = cdtime ();
                         return (0);
                 }
-
-                status = wh_send_buffer (cb);
-                wh_reset_buffer (cb);
         }
         else if (cb->format == WH_FORMAT_JSON)
         {
-                if (cb->send_buffer_fill <= 2)
+                if (format_json_stream_values_num (cb->json) == 0)
                 {
                         cb->send_buffer_init_time = cdtime ();
                         return (0);
                 }
-
-                status = format_json_finalize (cb->send_buffer,
-                                &cb->send_buffer_fill,
-                                &cb->send_buffer_free);
-                if (status != 0)
-                {
-                        ERROR ("write_http: wh_flush_nolock: "
-                                        "format_json_finalize failed.");
-                        wh_reset_buffer (cb);
-                        return (status);
-                }
-
-                status = wh_send_buffer (cb);
-                wh_reset_buffer (cb);
         }
         else
         {
@@ -264,6 +808,28 @@ static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
                 return (-1);
         }
 
+        pthread_mutex_lock (&cb->queue_lock);
+        if (!cb->sender_running)
+        {
+                status = plugin_thread_create (&cb->sender_thread, /* attr = */ NULL,
+                                wh_sender_thread, cb);
+                if (status != 0)
+                {
+                        char errbuf[1024];
+                        ERROR ("write_http plugin: Starting the sender thread "
+                                        "failed: %s",
+                                        sstrerror (errno, errbuf, sizeof (errbuf)));
+                        pthread_mutex_unlock (&cb->queue_lock);
+                        wh_reset_buffer (cb);
+                        return (-1);
+                }
+                cb->sender_running = 1;
+        }
+        pthread_mutex_unlock (&cb->queue_lock);
+
+        status = wh_submit_nolock (cb);
+        wh_reset_buffer (cb);
+
         return (status);
 } /* }}} wh_flush_nolock */
 
@@ -280,27 +846,16 @@ static int wh_flush (cdtime_t timeout, /* {{{ */
         cb = user_data->data;
 
         pthread_mutex_lock (&cb->send_lock);
-
-        if (cb->curl == NULL)
-        {
-                status = wh_callback_init (cb);
-                if (status != 0)
-                {
-                        ERROR ("write_http plugin: wh_callback_init failed.");
-                        pthread_mutex_unlock (&cb->send_lock);
-                        return (-1);
-                }
-        }
-
         status = wh_flush_nolock (timeout, cb);
         pthread_mutex_unlock (&cb->send_lock);
 
         return (status);
 } /* }}} int wh_flush */
 
-static void wh_callback_free (void *data) /* {{{ */
+void wh_callback_free (void *data) /* {{{ */
 {
         wh_callback_t *cb;
+        _Bool sender_running;
 
         if (data == NULL)
                 return;
@@ -309,11 +864,45 @@ static void wh_callback_free (void *data) /* {{{ */
 
         wh_flush_nolock (/* timeout = */ 0, cb);
 
-        if (cb->curl != NULL)
+        /* Let the sender thread send what is queued. */
+        pthread_mutex_lock (&cb->queue_lock);
+        cb->shutdown = 1;
+        sender_running = cb->sender_running;
+        pthread_mutex_unlock (&cb->queue_lock);
+        if (sender_running)
+        {
+                wh_wakeup (cb);
+                pthread_join (cb->sender_thread, NULL);
+        }
+
+        if (cb->queue_head != NULL)
+                WARNING ("write_http plugin: Discarding %zu queued bytes for "
+                                "<%s> on shutdown.", cb->queue_bytes, cb->location);
+        while (cb->queue_head != NULL)
         {
-                curl_easy_cleanup (cb->curl);
-                cb->curl = NULL;
+                wh_batch_t *next = cb->queue_head->next;
+                wh_batch_free (cb->queue_head);
+                cb->queue_head = next;
+        }
+
+        if (cb->requests != NULL)
+        {
+                int i;
+
+                for (i = 0; i < cb->max_requests; i++)
+                        if (cb->requests[i].curl != NULL)
+                                curl_easy_cleanup (cb->requests[i].curl);
+                sfree (cb->requests);
         }
+        if (cb->multi != NULL)
+                curl_multi_cleanup (cb->multi);
+        if (cb->headers != NULL)
+                curl_slist_free_all (cb->headers);
+        if (cb->wakeup_pipe[0] >= 0)
+                close (cb->wakeup_pipe[0]);
+        if (cb->wakeup_pipe[1] >= 0)
+                close (cb->wakeup_pipe[1]);
+
         sfree (cb->name);
         sfree (cb->location);
         sfree (cb->user);
@@ -325,7 +914,10 @@ static void wh_callback_free (void *data) /* {{{ */
         sfree (cb->clientcert);
         sfree (cb->clientkeypass);
         sfree (cb->send_buffer);
+        format_json_stream_destroy (cb->json);
 
+        pthread_mutex_destroy (&cb->send_lock);
+        pthread_mutex_destroy (&cb->queue_lock);
         sfree (cb);
 } /* }}} void wh_callback_free */
 
@@ -375,17 +967,6 @@ static int wh_write_command (const data_set_t *ds, const value_list_t *vl, /* {{
 
         pthread_mutex_lock (&cb->send_lock);
 
-        if (cb->curl == NULL)
-        {
-                status = wh_callback_init (cb);
-                if (status != 0)
-                {
-                        ERROR ("write_http plugin: wh_callback_init failed.");
-                        pthread_mutex_unlock (&cb->send_lock);
-                        return (-1);
-                }
-        }
-
         if (command_len >= cb->send_buffer_free)
         {
                 status = wh_flush_nolock (/* timeout = */ 0, cb);
@@ -423,36 +1004,10 @@ static int wh_write_json (const data_set_t *ds, const value_list_t *vl, /* {{{ *
 
         pthread_mutex_lock (&cb->send_lock);
 
-        if (cb->curl == NULL)
-        {
-                status = wh_callback_init (cb);
-                if (status != 0)
-                {
-                        ERROR ("write_http plugin: wh_callback_init failed.");
-                        pthread_mutex_unlock (&cb->send_lock);
-                        return (-1);
-                }
-        }
-
-        status = format_json_value_list (cb->send_buffer,
-                        &cb->send_buffer_fill,
-                        &cb->send_buffer_free,
+        /* The stream grows as needed; it is sent once it has reached the
+         * configured buffer size. */
+        status = format_json_stream_value_list (cb->json,
                         ds, vl, cb->store_rates);
-        if (status == (-ENOMEM))
-        {
-                status = wh_flush_nolock (/* timeout = */ 0, cb);
-                if (status != 0)
-                {
-                        wh_reset_buffer (cb);
-                        pthread_mutex_unlock (&cb->send_lock);
-                        return (status);
-                }
-
-                status = format_json_value_list (cb->send_buffer,
-                                &cb->send_buffer_fill,
-                                &cb->send_buffer_free,
-                                ds, vl, cb->store_rates);
-        }
         if (status != 0)
         {
                 pthread_mutex_unlock (&cb->send_lock);
@@ -461,16 +1016,19 @@ static int wh_write_json (const data_set_t *ds, const value_list_t *vl, /* {{{ *
 
         DEBUG ("write_http plugin: <%s> buffer %zu/%zu (%g%%)",
                         cb->location,
-                        cb->send_buffer_fill, cb->send_buffer_size,
-                        100.0 * ((double) cb->send_buffer_fill) / ((double) cb->send_buffer_size));
+                        format_json_stream_length (cb->json), cb->send_buffer_size,
+                        100.0 * ((double) format_json_stream_length (cb->json))
+                        / ((double) cb->send_buffer_size));
+
+        if (format_json_stream_length (cb->json) >= cb->send_buffer_size)
+                status = wh_flush_nolock (/* timeout = */ 0, cb);
 
-        /* Check if we have enough space for this command. */
         pthread_mutex_unlock (&cb->send_lock);
 
-        return (0);
+        return (status);
 } /* }}} int wh_write_json */
 
-static int wh_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
+int wh_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
                 user_data_t *user_data)
 {
         wh_callback_t *cb;
@@ -517,7 +1075,7 @@ static int config_set_format (wh_callback_t *cb, /* {{{ */
         return (0);
 } /* }}} int config_set_format */
 
-static int wh_config_node (oconfig_item_t *ci) /* {{{ */
+int wh_config_node (oconfig_item_t *ci) /* {{{ */
 {
         wh_callback_t *cb;
         int buffer_size = 0;
@@ -532,14 +1090,20 @@ static int wh_config_node (oconfig_item_t *ci) /* {{{ */
                 return (-1);
         }
         memset (cb, 0, sizeof (*cb));
+        C_COMPLAIN_INIT (&cb->init_complaint);
         cb->verify_peer = 1;
         cb->verify_host = 1;
         cb->format = WH_FORMAT_COMMAND;
         cb->sslversion = CURL_SSLVERSION_DEFAULT;
         cb->low_speed_limit = 0;
         cb->timeout = 0;
+        cb->max_requests = WH_DEFAULT_MAX_REQUESTS;
+        cb->max_retries = WH_DEFAULT_MAX_RETRIES;
+        cb->spool_size = WH_DEFAULT_SPOOL_SIZE;
+        cb->wakeup_pipe[0] = cb->wakeup_pipe[1] = -1;
 
         pthread_mutex_init (&cb->send_lock, /* attr = */ NULL);
+        pthread_mutex_init (&cb->queue_lock, /* attr = */ NULL);
 
         cf_util_get_string (ci, &cb->name);
 
@@ -609,6 +1173,35 @@ static int wh_config_node (oconfig_item_t *ci) /* {{{ */
                         cf_util_get_int (child, &cb->low_speed_limit);
                 else if (strcasecmp ("Timeout", child->key) == 0)
                         cf_util_get_int (child, &cb->timeout);
+                else if (strcasecmp ("MaxConcurrentRequests", child->key) == 0)
+                        cf_util_get_int (child, &cb->max_requests);
+                else if (strcasecmp ("MaxRetries", child->key) == 0)
+                        cf_util_get_int (child, &cb->max_retries);
+                else if (strcasecmp ("SpoolSize", child->key) == 0)
+                {
+                        int tmp = 0;
+                        if (cf_util_get_int (child, &tmp) == 0)
+                        {
+                                if (tmp > 0)
+                                        cb->spool_size = (size_t) tmp;
+                                else
+                                        ERROR ("write_http plugin: SpoolSize "
+                                                        "must be positive.");
+                        }
+                }
+                else if (strcasecmp ("Compress", child->key) == 0)
+                {
+                        cf_util_get_boolean (child, &cb->compress);
+#if !HAVE_ZLIB
+                        if (cb->compress)
+                        {
+                                WARNING ("write_http plugin: Compress is not "
+                                                "supported, collectd has been "
+                                                "built without zlib.");
+                                cb->compress = 0;
+                        }
+#endif
+                }
                 else
                 {
                         ERROR ("write_http plugin: Invalid configuration "
@@ -627,6 +1220,22 @@ static int wh_config_node (oconfig_item_t *ci) /* {{{ */
         if (cb->low_speed_limit > 0)
                 cb->low_speed_time = CDTIME_T_TO_TIME_T(plugin_get_interval());
 
+        if (cb->max_requests < 1)
+        {
+                ERROR ("write_http plugin: MaxConcurrentRequests must be at "
+                                "least 1, using 1.");
+                cb->max_requests = 1;
+        }
+        if (cb->max_retries < 0)
+                cb->max_retries = 0;
+
+        if (wh_callback_init (cb) != 0)
+        {
+                ERROR ("write_http plugin: wh_callback_init failed.");
+                wh_callback_free (cb);
+                return (-1);
+        }
+
         /* Determine send_buffer_size. */
         cb->send_buffer_size = WRITE_HTTP_DEFAULT_BUFFER_SIZE;
         if (buffer_size >= 1024)
@@ -636,12 +1245,26 @@ static int wh_config_node (oconfig_item_t *ci) /* {{{ */
                                 buffer_size);
 
         /* Allocate the buffer. */
-        cb->send_buffer = malloc (cb->send_buffer_size);
-        if (cb->send_buffer == NULL)
+        if (cb->format == WH_FORMAT_JSON)
         {
-                ERROR ("write_http plugin: malloc(%zu) failed.", cb->send_buffer_size);
-                wh_callback_free (cb);
-                return (-1);
+                cb->json = format_json_stream_create (cb->send_buffer_size,
+                                WRITE_HTTP_JSON_CACHE_SIZE);
+                if (cb->json == NULL)
+                {
+                        ERROR ("write_http plugin: format_json_stream_create failed.");
+                        wh_callback_free (cb);
+                        return (-1);
+                }
+        }
+        else
+        {
+                cb->send_buffer = malloc (cb->send_buffer_size);
+                if (cb->send_buffer == NULL)
+                {
+                        ERROR ("write_http plugin: malloc(%zu) failed.", cb->send_buffer_size);
+                        wh_callback_free (cb);
+                        return (-1);
+                }
         }
         /* Nulls the buffer and sets ..._free and ..._fill. */
         wh_reset_buffer (cb);
@@ -688,7 +1311,7 @@ static int wh_config (oconfig_item_t *ci) /* {{{ */
         return (0);
 } /* }}} int wh_config */
 
-static int wh_init (void) /* {{{ */
+int wh_init (void) /* {{{ */
 {
         /* Call this while collectd is still single-threaded to avoid
          * initialization issues in libgcrypt. */
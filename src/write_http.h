@@ -0,0 +1,42 @@
+/**
+ * collectd - src/write_http.h
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/* Entry points of the write_http plugin which its test calls directly. */
+
+#ifndef WRITE_HTTP_H
+#define WRITE_HTTP_H 1
+
+#include "plugin.h"
+
+struct wh_callback_s;
+typedef struct wh_callback_s wh_callback_t;
+
+int wh_init (void);
+int wh_config_node (oconfig_item_t *ci);
+int wh_write (const data_set_t *ds, const value_list_t *vl,
+    user_data_t *user_data);
+/* Sends what is queued, waiting for at most a few seconds, and frees "data",
+ * a wh_callback_t. */
+void wh_callback_free (void *data);
+
+#endif /* WRITE_HTTP_H */
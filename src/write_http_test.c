@@ -0,0 +1,477 @@
+/**
+ * collectd - src/write_http_test.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+#include "testing.h"
+#include "collectd.h"
+#include "common.h"
+#include "write_http.h"
+
+#if HAVE_ZLIB
+# include <zlib.h>
+#endif
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/*
+ * Stand-ins for the daemon. The time mock always returns zero, so a failed
+ * batch is never due for a retry until the node shuts down; then all
+ * retries are made right away.
+ */
+static user_data_t write_user_data;
+
+int plugin_register_complex_config (const char *type,
+    int (*callback) (oconfig_item_t *))
+{
+  return (0);
+}
+
+int plugin_register_init (const char *name, plugin_init_cb callback)
+{
+  return (0);
+}
+
+int plugin_register_write (const char *name, plugin_write_cb callback,
+    user_data_t *user_data)
+{
+  write_user_data = *user_data;
+  return (0);
+}
+
+int plugin_register_flush (const char *name, plugin_flush_cb callback,
+    user_data_t *user_data)
+{
+  return (0);
+}
+
+cdtime_t plugin_get_interval (void)
+{
+  return (TIME_T_TO_CDTIME_T (10));
+}
+
+int plugin_thread_create (pthread_t *thread, const pthread_attr_t *attr,
+    void *(*start_routine) (void *), void *arg)
+{
+  return (pthread_create (thread, attr, start_routine, arg));
+}
+
+/*
+ * HTTP server answering each request with the next status of "script", or
+ * with "status" once the script is used up. Bodies of successful requests
+ * are counted.
+ */
+struct server_s
+{
+  int listen_fd;
+  int port;
+  pthread_t tid;
+  pthread_mutex_t lock;
+
+  int script[4];
+  int script_num;
+  int status;
+
+  int requests_num;
+  int gzip_num;
+  int lines_num;
+  size_t bytes;
+  size_t max_body;
+};
+typedef struct server_s server_t;
+
+static int count_lines (const char *body, size_t size)
+{
+  int num = 0;
+  size_t i;
+
+  for (i = 0; i + 1 < size; i++)
+    if ((body[i] == '\r') && (body[i + 1] == '\n'))
+      num++;
+  return (num);
+}
+
+#if HAVE_ZLIB
+static char *gunzip (const char *data, size_t size, size_t *ret_size)
+{
+  z_stream z;
+  size_t buffer_size = 16 * size + 1024;
+  char *buffer;
+  int status;
+
+  buffer = malloc (buffer_size);
+  if (buffer == NULL)
+    return (NULL);
+
+  memset (&z, 0, sizeof (z));
+  if (inflateInit2 (&z, 15 + 16) != Z_OK)
+  {
+    free (buffer);
+    return (NULL);
+  }
+  z.next_in = (Bytef *) data;
+  z.avail_in = (uInt) size;
+  z.next_out = (Bytef *) buffer;
+  z.avail_out = (uInt) buffer_size;
+  status = inflate (&z, Z_FINISH);
+  inflateEnd (&z);
+  if (status != Z_STREAM_END)
+  {
+    free (buffer);
+    return (NULL);
+  }
+
+  *ret_size = (size_t) z.total_out;
+  return (buffer);
+}
+#endif
+
+static void server_handle (server_t *s, int fd)
+{
+  FILE *fh;
+  char line[1024];
+  char response[256];
+  char *body = NULL;
+  size_t body_size = 0;
+  _Bool gzip = 0;
+  int status;
+
+  fh = fdopen (dup (fd), "r");
+  if (fh == NULL)
+    return;
+
+  while (fgets (line, sizeof (line), fh) != NULL)
+  {
+    if (strcmp ("\r\n", line) == 0)
+      break;
+    if (strncasecmp ("Content-Length:", line, 15) == 0)
+      body_size = (size_t) atol (line + 15);
+    else if (strncasecmp ("Content-Encoding: gzip", line, 22) == 0)
+      gzip = 1;
+  }
+
+  body = malloc (body_size + 1);
+  if ((body == NULL)
+      || (fread (body, 1, body_size, fh) != body_size))
+  {
+    free (body);
+    fclose (fh);
+    return;
+  }
+  fclose (fh);
+
+#if HAVE_ZLIB
+  if (gzip)
+  {
+    char *data = gunzip (body, body_size, &body_size);
+    free (body);
+    body = data;
+  }
+#endif
+
+  pthread_mutex_lock (&s->lock);
+  status = (s->requests_num < s->script_num)
+    ? s->script[s->requests_num] : s->status;
+  s->requests_num++;
+  if (gzip)
+    s->gzip_num++;
+  if ((status < 300) && (body != NULL))
+  {
+    s->lines_num += count_lines (body, body_size);
+    s->bytes += body_size;
+    if (body_size > s->max_body)
+      s->max_body = body_size;
+  }
+  pthread_mutex_unlock (&s->lock);
+  free (body);
+
+  snprintf (response, sizeof (response),
+      "HTTP/1.1 %i Test\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+      status);
+  if (write (fd, response, strlen (response)) < 0)
+    return;
+}
+
+static void *server_thread (void *arg)
+{
+  server_t *s = arg;
+  int fd;
+
+  while ((fd = accept (s->listen_fd, NULL, NULL)) >= 0)
+  {
+    server_handle (s, fd);
+    close (fd);
+  }
+
+  return (NULL);
+}
+
+static int server_start (server_t *s, int status)
+{
+  struct sockaddr_in sa;
+  socklen_t sa_len = sizeof (sa);
+
+  memset (s, 0, sizeof (*s));
+  s->status = status;
+  pthread_mutex_init (&s->lock, NULL);
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  s->listen_fd = socket (PF_INET, SOCK_STREAM, 0);
+  if ((s->listen_fd < 0)
+      || (bind (s->listen_fd, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+      || (listen (s->listen_fd, 16) != 0)
+      || (getsockname (s->listen_fd, (struct sockaddr *) &sa, &sa_len) != 0))
+    return (-1);
+  s->port = ntohs (sa.sin_port);
+
+  return (pthread_create (&s->tid, NULL, server_thread, s));
+}
+
+static void server_stop (server_t *s)
+{
+  shutdown (s->listen_fd, SHUT_RDWR);
+  pthread_join (s->tid, NULL);
+  close (s->listen_fd);
+  pthread_mutex_destroy (&s->lock);
+}
+
+/*
+ * The node under test
+ */
+static wh_callback_t *node_create (server_t *s, int buffer_size,
+    int spool_size, int max_requests, int max_retries, _Bool compress)
+{
+  char url[64];
+  oconfig_value_t values[] = {
+    { .value.string = "test", .type = OCONFIG_TYPE_STRING },
+    { .value.string = url, .type = OCONFIG_TYPE_STRING },
+    { .value.number = buffer_size, .type = OCONFIG_TYPE_NUMBER },
+    { .value.number = spool_size, .type = OCONFIG_TYPE_NUMBER },
+    { .value.number = max_requests, .type = OCONFIG_TYPE_NUMBER },
+    { .value.number = max_retries, .type = OCONFIG_TYPE_NUMBER },
+    { .value.boolean = compress, .type = OCONFIG_TYPE_BOOLEAN },
+  };
+  oconfig_item_t children[] = {
+    { .key = "URL", .values = values + 1, .values_num = 1 },
+    { .key = "BufferSize", .values = values + 2, .values_num = 1 },
+    { .key = "SpoolSize", .values = values + 3, .values_num = 1 },
+    { .key = "MaxConcurrentRequests", .values = values + 4, .values_num = 1 },
+    { .key = "MaxRetries", .values = values + 5, .values_num = 1 },
+    { .key = "Compress", .values = values + 6, .values_num = 1 },
+  };
+  oconfig_item_t node = {
+    .key = "Node", .values = values, .values_num = 1,
+    .children = children, .children_num = STATIC_ARRAY_SIZE (children),
+  };
+
+  snprintf (url, sizeof (url), "http://127.0.0.1:%i/", s->port);
+
+  memset (&write_user_data, 0, sizeof (write_user_data));
+  if (wh_config_node (&node) != 0)
+    return (NULL);
+  return (write_user_data.data);
+}
+
+/* Writes "num" values, each of which is one line of about 60 bytes. */
+static int node_write (wh_callback_t *cb, int num)
+{
+  data_source_t dsrc = { "value", DS_TYPE_GAUGE, 0.0, NAN };
+  data_set_t ds = { "gauge", 1, &dsrc };
+  value_list_t vl = VALUE_LIST_INIT;
+  value_t value;
+  int i;
+
+  vl.values = &value;
+  vl.values_len = 1;
+  vl.time = TIME_T_TO_CDTIME_T (1400000000);
+  sstrncpy (vl.host, "example.com", sizeof (vl.host));
+  sstrncpy (vl.plugin, "test", sizeof (vl.plugin));
+  sstrncpy (vl.type, "gauge", sizeof (vl.type));
+
+  for (i = 0; i < num; i++)
+  {
+    value.gauge = (gauge_t) i;
+    ssnprintf (vl.type_instance, sizeof (vl.type_instance), "%04i", i);
+    if (wh_write (&ds, &vl, &write_user_data) != 0)
+      return (-1);
+  }
+
+  return (0);
+}
+
+DEF_TEST(batching)
+{
+  server_t s;
+  wh_callback_t *cb;
+
+  CHECK_ZERO (server_start (&s, 200));
+  cb = node_create (&s, 1024, 1 << 20, 4, 3, 0);
+  CHECK_NOT_NULL (cb);
+  if (cb == NULL)
+    return (-1);
+
+  CHECK_ZERO (node_write (cb, 100));
+  /* Flushes the last batch and waits until everything has been sent. */
+  wh_callback_free (cb);
+  server_stop (&s);
+
+  OK (s.lines_num == 100);
+  OK (s.requests_num > 1);
+  OK (s.max_body <= 1024);
+  OK (s.gzip_num == 0);
+
+  return (0);
+}
+
+#if HAVE_ZLIB
+DEF_TEST(gzip)
+{
+  server_t s;
+  wh_callback_t *cb;
+
+  CHECK_ZERO (server_start (&s, 200));
+  cb = node_create (&s, 1024, 1 << 20, 4, 3, 1);
+  CHECK_NOT_NULL (cb);
+  if (cb == NULL)
+    return (-1);
+
+  CHECK_ZERO (node_write (cb, 100));
+  wh_callback_free (cb);
+  server_stop (&s);
+
+  OK (s.lines_num == 100);
+  OK (s.requests_num > 1);
+  OK (s.gzip_num == s.requests_num);
+
+  return (0);
+}
+#endif
+
+DEF_TEST(retry)
+{
+  server_t s;
+  wh_callback_t *cb;
+
+  /* Server errors and "429 Too Many Requests" are retried. */
+  CHECK_ZERO (server_start (&s, 200));
+  s.script[0] = 503;
+  s.script[1] = 429;
+  s.script_num = 2;
+  cb = node_create (&s, 1024, 1 << 20, 1, 3, 0);
+  CHECK_NOT_NULL (cb);
+  if (cb == NULL)
+    return (-1);
+
+  CHECK_ZERO (node_write (cb, 1));
+  wh_callback_free (cb);
+  server_stop (&s);
+
+  OK (s.requests_num == 3);
+  OK (s.lines_num == 1);
+
+  /* Given up after MaxRetries. */
+  CHECK_ZERO (server_start (&s, 500));
+  cb = node_create (&s, 1024, 1 << 20, 1, 2, 0);
+  CHECK_NOT_NULL (cb);
+  if (cb == NULL)
+    return (-1);
+
+  CHECK_ZERO (node_write (cb, 1));
+  wh_callback_free (cb);
+  server_stop (&s);
+
+  OK (s.requests_num == 3);
+  OK (s.lines_num == 0);
+
+  return (0);
+}
+
+DEF_TEST(client_error)
+{
+  server_t s;
+  wh_callback_t *cb;
+
+  /* Other client errors are not retried. */
+  CHECK_ZERO (server_start (&s, 400));
+  cb = node_create (&s, 1024, 1 << 20, 1, 3, 0);
+  CHECK_NOT_NULL (cb);
+  if (cb == NULL)
+    return (-1);
+
+  CHECK_ZERO (node_write (cb, 1));
+  wh_callback_free (cb);
+  server_stop (&s);
+
+  OK (s.requests_num == 1);
+  OK (s.lines_num == 0);
+
+  return (0);
+}
+
+DEF_TEST(spool)
+{
+  server_t s;
+  wh_callback_t *cb;
+
+  /* Failed batches wait for their retry in the spool, which keeps only the
+   * newest 2 kB. */
+  CHECK_ZERO (server_start (&s, 503));
+  cb = node_create (&s, 1024, 2048, 1, 10, 0);
+  CHECK_NOT_NULL (cb);
+  if (cb == NULL)
+    return (-1);
+
+  CHECK_ZERO (node_write (cb, 200));
+
+  pthread_mutex_lock (&s.lock);
+  s.status = 200;
+  pthread_mutex_unlock (&s.lock);
+  wh_callback_free (cb);
+  server_stop (&s);
+
+  OK (s.lines_num > 0);
+  OK (s.lines_num < 200);
+  /* the spool and the batch in transfer */
+  OK (s.bytes <= 2048 + 1024);
+
+  return (0);
+}
+
+int main (void)
+{
+  wh_init ();
+
+  RUN_TEST(batching);
+#if HAVE_ZLIB
+  RUN_TEST(gzip);
+#endif
+  RUN_TEST(retry);
+  RUN_TEST(client_error);
+  RUN_TEST(spool);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
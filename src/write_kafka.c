@@ -33,6 +33,7 @@
 #include "utils_format_graphite.h"
 #include "utils_format_json.h"
 #include "utils_crc32.h"
+#include "utils_stats.h"
 
 #include <sys/types.h>
 #include <librdkafka/rdkafka.h>
@@ -40,6 +41,47 @@
 #include <zlib.h>
 #include <errno.h>
 
+#define KAFKA_BUFFER_SIZE 8192
+
+/* Number of identifiers for which the JSON serializer caches the static
+ * parts of the objects. */
+#define KAFKA_JSON_CACHE_SIZE 4096
+
+/* Payloads of one batch are stored back to back in a pooled buffer. */
+#define KAFKA_POOL_BUFFER_SIZE (256 * 1024)
+#define KAFKA_POOL_MAX 32
+
+#define KAFKA_DEFAULT_BATCH_SIZE 1000
+#define KAFKA_DEFAULT_BATCH_TIMEOUT TIME_T_TO_CDTIME_T (1)
+
+/* Number of seconds to wait for outstanding delivery reports on shutdown. */
+#define KAFKA_SHUTDOWN_TIMEOUT 5
+
+/* librdkafka references the payloads of the messages without copying them.
+ * A buffer is therefore handed back to the pool only after the delivery
+ * reports of all messages stored in it have been received. */
+typedef struct kafka_buffer_s kafka_buffer_t;
+struct kafka_buffer_s {
+    kafka_buffer_t              *next;
+    cdtime_t                     produced;
+    size_t                       fill;
+    size_t                       refs;
+    char                         data[KAFKA_POOL_BUFFER_SIZE];
+};
+
+/* Statistics reported with "ReportStats". Protected by the lock of the
+ * topic context. */
+struct kafka_stats {
+    derive_t                     values;
+    derive_t                     values_dropped;
+    derive_t                     batches;
+    derive_t                     delivered;
+    derive_t                     failed;
+    derive_t                     dropped;
+    derive_t                     bytes;
+    stats_latency_t              latency;
+};
+
 struct kafka_topic_context {
 #define KAFKA_FORMAT_JSON        0
 #define KAFKA_FORMAT_COMMAND     1
@@ -51,12 +93,41 @@ struct kafka_topic_context {
     rd_kafka_topic_t            *topic;
     rd_kafka_conf_t             *kafka_conf;
     rd_kafka_t                  *kafka;
-    int                          has_key;
+#define KAFKA_KEY_RANDOM         0
+#define KAFKA_KEY_FIXED          1
+#define KAFKA_KEY_HOST           2
+    int                          key_type;
     u_int32_t                    key;
     char                        *prefix;
     char                        *postfix;
     char                         escape_char;
     char                        *topic_name;
+    format_json_stream_t        *json;
+
+    /* Messages waiting for the next rd_kafka_produce_batch() call. */
+    size_t                       batch_size;
+    cdtime_t                     batch_timeout;
+    cdtime_t                     batch_init_time;
+    rd_kafka_message_t          *msgs;
+    u_int32_t                   *keys;
+    size_t                       msgs_num;
+    kafka_buffer_t              *buffer;
+
+    /* Message currently being packed. With the JSON format it is assembled
+     * in "json", otherwise it starts at "msg_offset" in "buffer". */
+    size_t                       values_per_message;
+    size_t                       msg_values;
+    size_t                       msg_offset;
+    u_int32_t                    msg_key;
+    char                         msg_host[DATA_MAX_NAME_LEN];
+
+    kafka_buffer_t              *pool;
+    kafka_buffer_t              *buffers[KAFKA_POOL_MAX];
+    size_t                       buffers_num;
+
+    _Bool                        report_stats;
+    struct kafka_stats           stats;
+
     pthread_mutex_t 		lock;
 };
 
@@ -143,29 +214,255 @@ static int kafka_handle(struct kafka_topic_context *ctx) /* {{{ */
 
 } /* }}} int kafka_handle */
 
+/* Delivery reports are served from rd_kafka_poll(), which is only called with
+ * ctx->lock held. */
+static void kafka_delivery_report(rd_kafka_t *rk, /* {{{ */
+                                  const rd_kafka_message_t *msg,
+                                  void *opaque)
+{
+    struct kafka_topic_context *ctx = opaque;
+    kafka_buffer_t             *buf = msg->_private;
+    cdtime_t                    latency;
+
+    if ((ctx == NULL) || (buf == NULL))
+        return;
+
+    if (msg->err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+        ctx->stats.failed++;
+        DEBUG("write_kafka plugin: delivery to topic \"%s\" failed: %s",
+              ctx->topic_name, rd_kafka_err2str(msg->err));
+    } else {
+        ctx->stats.delivered++;
+        ctx->stats.bytes += (derive_t) msg->len;
+    }
+
+    latency = cdtime() - buf->produced;
+    stats_latency_add(&ctx->stats.latency, latency);
+
+    assert(buf->refs > 0);
+    buf->refs--;
+    if (buf->refs == 0) {
+        buf->next = ctx->pool;
+        ctx->pool = buf;
+    }
+} /* }}} void kafka_delivery_report */
+
+static kafka_buffer_t *kafka_buffer_get(struct kafka_topic_context *ctx) /* {{{ */
+{
+    kafka_buffer_t *buf;
+
+    if (ctx->buffer != NULL)
+        return ctx->buffer;
+
+    /* Give librdkafka a chance to hand back buffers of delivered batches. */
+    if (ctx->pool == NULL)
+        rd_kafka_poll(ctx->kafka, 0);
+
+    if (ctx->pool != NULL) {
+        buf = ctx->pool;
+        ctx->pool = buf->next;
+    } else if (ctx->buffers_num < KAFKA_POOL_MAX) {
+        if ((buf = malloc(sizeof(*buf))) == NULL)
+            return NULL;
+        ctx->buffers[ctx->buffers_num++] = buf;
+    } else {
+        return NULL;
+    }
+
+    buf->next = NULL;
+    buf->fill = 0;
+    buf->refs = 0;
+    ctx->buffer = buf;
+    return buf;
+} /* }}} kafka_buffer_t *kafka_buffer_get */
+
+/* Hands all closed messages to librdkafka in one call. The payloads stay in
+ * the pooled buffer until they have been delivered. */
+static int kafka_batch_produce(struct kafka_topic_context *ctx) /* {{{ */
+{
+    kafka_buffer_t *buf = ctx->buffer;
+    size_t          i;
+    int             enqueued;
+
+    ctx->batch_init_time = 0;
+    if (ctx->msgs_num == 0)
+        return 0;
+
+    assert(buf != NULL);
+    buf->produced = cdtime();
+    buf->refs = ctx->msgs_num;
+    ctx->buffer = NULL;
+
+    enqueued = rd_kafka_produce_batch(ctx->topic, RD_KAFKA_PARTITION_UA,
+                                      /* msgflags = */ 0,
+                                      ctx->msgs, (int) ctx->msgs_num);
+    ctx->stats.batches++;
+
+    if ((enqueued < 0) || ((size_t) enqueued < ctx->msgs_num)) {
+        size_t failed = 0;
+
+        for (i = 0; i < ctx->msgs_num; i++) {
+            if ((enqueued >= 0) && (ctx->msgs[i].err == 0))
+                continue;
+            failed++;
+        }
+        ctx->stats.dropped += (derive_t) failed;
+        buf->refs -= failed;
+        WARNING("write_kafka plugin: %zu of %zu messages could not be "
+                "queued for topic \"%s\".",
+                failed, ctx->msgs_num, ctx->topic_name);
+    }
+    ctx->msgs_num = 0;
+
+    if (buf->refs == 0) {
+        buf->next = ctx->pool;
+        ctx->pool = buf;
+    }
+
+    rd_kafka_poll(ctx->kafka, 0);
+    return (buf->refs == 0) ? -1 : 0;
+} /* }}} int kafka_batch_produce */
+
+/* Appends the message being packed to the batch. */
+static int kafka_message_close(struct kafka_topic_context *ctx) /* {{{ */
+{
+    rd_kafka_message_t *msg;
+    kafka_buffer_t     *buf;
+    int                 status;
+
+    if (ctx->msg_values == 0)
+        return 0;
+
+    if (ctx->format == KAFKA_FORMAT_JSON) {
+        size_t len;
+
+        status = format_json_stream_finalize(ctx->json);
+        len = format_json_stream_length(ctx->json);
+        if ((status == 0) && (len > KAFKA_POOL_BUFFER_SIZE))
+            status = -ENOMEM;
+        if ((status == 0) && (ctx->buffer != NULL)
+                && (len > KAFKA_POOL_BUFFER_SIZE - ctx->buffer->fill))
+            kafka_batch_produce(ctx);
+        if ((status == 0) && ((buf = kafka_buffer_get(ctx)) == NULL))
+            status = -ENOBUFS;
+        if (status != 0) {
+            ERROR("write_kafka plugin: Packing JSON message for topic \"%s\" "
+                  "failed with status %i.", ctx->topic_name, status);
+            ctx->stats.values_dropped += (derive_t) ctx->msg_values;
+            ctx->msg_values = 0;
+            format_json_stream_reset(ctx->json);
+            return status;
+        }
+
+        ctx->msg_offset = buf->fill;
+        buf->fill += format_json_stream_read(ctx->json, 0,
+                                             buf->data + buf->fill, len);
+        format_json_stream_reset(ctx->json);
+    } else {
+        buf = ctx->buffer;
+        assert(buf != NULL);
+    }
+
+    msg = ctx->msgs + ctx->msgs_num;
+    memset(msg, 0, sizeof(*msg));
+    ctx->keys[ctx->msgs_num] = ctx->msg_key;
+    msg->payload = buf->data + ctx->msg_offset;
+    msg->len = buf->fill - ctx->msg_offset;
+    msg->key = ctx->keys + ctx->msgs_num;
+    msg->key_len = sizeof(*ctx->keys);
+    msg->_private = buf;
+    ctx->msgs_num++;
+
+    ctx->stats.values += (derive_t) ctx->msg_values;
+    ctx->msg_values = 0;
+
+    if (ctx->msgs_num >= ctx->batch_size)
+        return kafka_batch_produce(ctx);
+    return 0;
+} /* }}} int kafka_message_close */
+
+static void kafka_message_open(struct kafka_topic_context *ctx, /* {{{ */
+                               const value_list_t *vl)
+{
+    /*
+     * We partition our stream by metric name
+     */
+    if (ctx->key_type == KAFKA_KEY_FIXED)
+        ctx->msg_key = ctx->key;
+    else if (ctx->key_type == KAFKA_KEY_HOST)
+        ctx->msg_key = crc32_buffer((u_char *)vl->host, strlen(vl->host));
+    else
+        ctx->msg_key = rand();
+
+    sstrncpy(ctx->msg_host, vl->host, sizeof(ctx->msg_host));
+    if (ctx->buffer != NULL)
+        ctx->msg_offset = ctx->buffer->fill;
+    if (ctx->batch_init_time == 0)
+        ctx->batch_init_time = cdtime();
+} /* }}} void kafka_message_open */
+
+/* Appends one formatted value list to the message being packed, which lives
+ * in the current pool buffer. */
+static int kafka_message_append(struct kafka_topic_context *ctx, /* {{{ */
+                                const value_list_t *vl,
+                                const char *data, size_t len)
+{
+    kafka_buffer_t *buf = ctx->buffer;
+    size_t          need = len;
+
+    if (ctx->msg_values > 0)
+        need++; /* separator */
+
+    if ((buf != NULL) && (need > KAFKA_POOL_BUFFER_SIZE - buf->fill)) {
+        kafka_message_close(ctx);
+        kafka_batch_produce(ctx);
+    }
+
+    if ((buf = kafka_buffer_get(ctx)) == NULL)
+        return -ENOBUFS;
+
+    if (ctx->msg_values == 0)
+        kafka_message_open(ctx, vl);
+    else if (ctx->format == KAFKA_FORMAT_COMMAND)
+        buf->data[buf->fill++] = '\n';
+
+    memcpy(buf->data + buf->fill, data, len);
+    buf->fill += len;
+    ctx->msg_values++;
+    return 0;
+} /* }}} int kafka_message_append */
+
+static int kafka_flush_nolock(struct kafka_topic_context *ctx, /* {{{ */
+                              cdtime_t timeout)
+{
+    int status;
+
+    if ((ctx->kafka == NULL) || (ctx->batch_init_time == 0))
+        return 0;
+
+    /* timeout == 0  => flush unconditionally */
+    if ((timeout > 0) && ((ctx->batch_init_time + timeout) > cdtime()))
+        return 0;
+
+    status = kafka_message_close(ctx);
+    if (ctx->msgs_num > 0)
+        status = kafka_batch_produce(ctx);
+    return status;
+} /* }}} int kafka_flush_nolock */
+
 static int kafka_write(const data_set_t *ds, /* {{{ */
 	      const value_list_t *vl,
 	      user_data_t *ud)
 {
 	int			 status = 0;
-    u_int32_t    key;
-    char         buffer[8192];
-    size_t bfree = sizeof(buffer);
-    size_t bfill = 0;
-    size_t blen = 0;
+    char         buffer[KAFKA_BUFFER_SIZE];
 	struct kafka_topic_context	*ctx = ud->data;
 
     if ((ds == NULL) || (vl == NULL) || (ctx == NULL))
         return EINVAL;
 
-    pthread_mutex_lock (&ctx->lock);
-    status = kafka_handle(ctx);
-    pthread_mutex_unlock (&ctx->lock);
-    if( status != 0 )
-        return status;
-
-    bzero(buffer, sizeof(buffer));
-
+    /* Formatting is done outside of the lock, except for JSON: the stream
+     * caches the static parts of the objects. */
     switch (ctx->format) {
     case KAFKA_FORMAT_COMMAND:
         status = create_putval(buffer, sizeof(buffer), ds, vl);
@@ -174,15 +471,8 @@ static int kafka_write(const data_set_t *ds, /* {{{ */
                   status);
             return status;
         }
-        blen = strlen(buffer);
         break;
     case KAFKA_FORMAT_JSON:
-
-        format_json_initialize(buffer, &bfill, &bfree);
-        format_json_value_list(buffer, &bfill, &bfree, ds, vl,
-                               ctx->store_rates);
-        format_json_finalize(buffer, &bfill, &bfree);
-        blen = strlen(buffer);
         break;
     case KAFKA_FORMAT_GRAPHITE:
         status = format_graphite(buffer, sizeof(buffer), ds, vl,
@@ -193,37 +483,131 @@ static int kafka_write(const data_set_t *ds, /* {{{ */
                   status);
             return status;
         }
-        blen = strlen(buffer);
         break;
     default:
         ERROR("write_kafka plugin: invalid format %i.", ctx->format);
         return -1;
     }
 
-    /*
-     * We partition our stream by metric name
-     */
-    if (ctx->has_key)
-        key = ctx->key;
-    else
-        key = rand();
+    pthread_mutex_lock (&ctx->lock);
+    status = kafka_handle(ctx);
+    if (status != 0) {
+        pthread_mutex_unlock (&ctx->lock);
+        return status;
+    }
 
-    rd_kafka_produce(ctx->topic, RD_KAFKA_PARTITION_UA,
-                     RD_KAFKA_MSG_F_COPY, buffer, blen,
-                     &key, sizeof(key), NULL);
+    /* Only value lists of the same host are packed into one message. */
+    if ((ctx->msg_values > 0) && (strcmp(ctx->msg_host, vl->host) != 0))
+        kafka_message_close(ctx);
+
+    if (ctx->format == KAFKA_FORMAT_JSON) {
+        if (ctx->msg_values == 0)
+            kafka_message_open(ctx, vl);
+        status = format_json_stream_value_list(ctx->json, ds, vl,
+                                               ctx->store_rates);
+        if (status == 0) {
+            ctx->msg_values++;
+            /* Keep messages to a reasonable size. */
+            if (format_json_stream_length(ctx->json) >= KAFKA_BUFFER_SIZE)
+                kafka_message_close(ctx);
+        } else {
+            ERROR("write_kafka plugin: Formatting JSON failed "
+                  "with status %i.", status);
+        }
+    } else {
+        status = kafka_message_append(ctx, vl, buffer, strlen(buffer));
+        if (status != 0) {
+            ctx->stats.values_dropped++;
+            ERROR("write_kafka plugin: No buffer available for topic \"%s\", "
+                  "dropping value.", ctx->topic_name);
+        }
+    }
+
+    if (ctx->msg_values >= ctx->values_per_message)
+        kafka_message_close(ctx);
+    kafka_flush_nolock(ctx, ctx->batch_timeout);
+    pthread_mutex_unlock (&ctx->lock);
 
 	return status;
 } /* }}} int kafka_write */
 
+static int kafka_flush(cdtime_t timeout, /* {{{ */
+                       const char *identifier __attribute__((unused)),
+                       user_data_t *ud)
+{
+    struct kafka_topic_context *ctx = ud->data;
+    int                         status;
+
+    pthread_mutex_lock (&ctx->lock);
+    status = kafka_flush_nolock(ctx, timeout);
+    if (ctx->kafka != NULL)
+        rd_kafka_poll(ctx->kafka, 0);
+    pthread_mutex_unlock (&ctx->lock);
+
+    return status;
+} /* }}} int kafka_flush */
+
+static int kafka_stats_read(user_data_t *ud) /* {{{ */
+{
+    struct kafka_topic_context *ctx = ud->data;
+    struct kafka_stats          stats;
+    gauge_t                     queue_length = 0;
+    const char                 *topic = ctx->topic_name;
+
+    pthread_mutex_lock (&ctx->lock);
+    if (ctx->kafka != NULL) {
+        rd_kafka_poll(ctx->kafka, 0);
+        queue_length = (gauge_t) rd_kafka_outq_len(ctx->kafka);
+    }
+    stats = ctx->stats;
+    memset(&ctx->stats.latency, 0, sizeof(ctx->stats.latency));
+    pthread_mutex_unlock (&ctx->lock);
+
+    stats_submit_derive("write_kafka", topic, "total_values", "sent",
+                        stats.values);
+    stats_submit_derive("write_kafka", topic, "total_values", "dropped",
+                        stats.values_dropped);
+    stats_submit_derive("write_kafka", topic, "total_operations", "produce",
+                        stats.batches);
+    stats_submit_derive("write_kafka", topic, "total_requests", "delivered",
+                        stats.delivered);
+    stats_submit_derive("write_kafka", topic, "total_requests", "failed",
+                        stats.failed);
+    stats_submit_derive("write_kafka", topic, "total_requests", "dropped",
+                        stats.dropped);
+    stats_submit_derive("write_kafka", topic, "total_bytes", "delivered",
+                        stats.bytes);
+    stats_submit_gauge("write_kafka", topic, "queue_length", "",
+                       queue_length);
+    stats_submit_gauge("write_kafka", topic, "latency", "delivery",
+                       stats_latency_average(&stats.latency));
+    stats_submit_gauge("write_kafka", topic, "latency", "delivery-max",
+                       stats_latency_max(&stats.latency));
+
+    return 0;
+} /* }}} int kafka_stats_read */
+
 static void kafka_topic_context_free(void *p) /* {{{ */
 {
 	struct kafka_topic_context *ctx = p;
+    size_t i;
 
 	if (ctx == NULL)
 		return;
 
-    if (ctx->topic_name != NULL)
-        sfree(ctx->topic_name);
+    if (ctx->kafka != NULL) {
+        cdtime_t deadline = cdtime()
+            + TIME_T_TO_CDTIME_T(KAFKA_SHUTDOWN_TIMEOUT);
+
+        kafka_flush_nolock(ctx, /* timeout = */ 0);
+        while ((rd_kafka_outq_len(ctx->kafka) > 0) && (cdtime() < deadline))
+            rd_kafka_poll(ctx->kafka, 100);
+        if (rd_kafka_outq_len(ctx->kafka) > 0)
+            WARNING("write_kafka plugin: %i messages for topic \"%s\" have "
+                    "not been delivered.",
+                    rd_kafka_outq_len(ctx->kafka), ctx->topic_name);
+    }
+
     if (ctx->topic != NULL)
         rd_kafka_topic_destroy(ctx->topic);
     if (ctx->conf != NULL)
@@ -232,6 +616,18 @@ static void kafka_topic_context_free(void *p) /* {{{ */
         rd_kafka_conf_destroy(ctx->kafka_conf);
     if (ctx->kafka != NULL)
         rd_kafka_destroy(ctx->kafka);
+    if (ctx->topic_name != NULL)
+        sfree(ctx->topic_name);
+    format_json_stream_destroy(ctx->json);
+
+    /* librdkafka no longer references the payloads. */
+    for (i = 0; i < ctx->buffers_num; i++)
+        sfree(ctx->buffers[i]);
+    sfree(ctx->msgs);
+    sfree(ctx->keys);
+    sfree(ctx->prefix);
+    sfree(ctx->postfix);
+    pthread_mutex_destroy(&ctx->lock);
 
     sfree(ctx);
 } /* }}} void kafka_topic_context_free */
@@ -257,6 +653,10 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
     tctx->escape_char = '.';
     tctx->store_rates = 1;
     tctx->format = KAFKA_FORMAT_JSON;
+    tctx->key_type = KAFKA_KEY_RANDOM;
+    tctx->batch_size = KAFKA_DEFAULT_BATCH_SIZE;
+    tctx->batch_timeout = KAFKA_DEFAULT_BATCH_TIMEOUT;
+    tctx->values_per_message = 1;
 
     if ((tctx->kafka_conf = rd_kafka_conf_dup(conf)) == NULL) {
         sfree(tctx);
@@ -267,6 +667,8 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
 #ifdef HAVE_LIBRDKAFKA_LOG_CB
     rd_kafka_conf_set_log_cb(tctx->kafka_conf, kafka_log);
 #endif
+    rd_kafka_conf_set_dr_msg_cb(tctx->kafka_conf, kafka_delivery_report);
+    rd_kafka_conf_set_opaque(tctx->kafka_conf, tctx);
 
     if ((tctx->conf = rd_kafka_topic_conf_new()) == NULL) {
         rd_kafka_conf_destroy(tctx->kafka_conf);
@@ -326,8 +728,12 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
                 break;
             }
 
-            if (strcasecmp(tmp_buf, "Random") != 0) {
-                tctx->has_key = 1;
+            if (strcasecmp(tmp_buf, "Random") == 0) {
+                tctx->key_type = KAFKA_KEY_RANDOM;
+            } else if (strcasecmp(tmp_buf, "Host") == 0) {
+                tctx->key_type = KAFKA_KEY_HOST;
+            } else {
+                tctx->key_type = KAFKA_KEY_FIXED;
                 tctx->key = crc32_buffer((u_char *)tmp_buf, strlen(tmp_buf));
             }
             sfree(tmp_buf);
@@ -380,6 +786,30 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
                         "only one character. Others will be ignored.");
             tctx->escape_char = tmp_buff[0];
             sfree (tmp_buff);
+        } else if (strcasecmp ("BatchSize", child->key) == 0) {
+            int tmp = 0;
+            status = cf_util_get_int (child, &tmp);
+            if ((status == 0) && (tmp < 1)) {
+                WARNING ("write_kafka plugin: \"BatchSize\" must be at "
+                         "least 1.");
+                status = -1;
+            }
+            if (status == 0)
+                tctx->batch_size = (size_t) tmp;
+        } else if (strcasecmp ("BatchTimeout", child->key) == 0) {
+            status = cf_util_get_cdtime (child, &tctx->batch_timeout);
+        } else if (strcasecmp ("ValuesPerMessage", child->key) == 0) {
+            int tmp = 0;
+            status = cf_util_get_int (child, &tmp);
+            if ((status == 0) && (tmp < 1)) {
+                WARNING ("write_kafka plugin: \"ValuesPerMessage\" must be "
+                         "at least 1.");
+                status = -1;
+            }
+            if (status == 0)
+                tctx->values_per_message = (size_t) tmp;
+        } else if (strcasecmp ("ReportStats", child->key) == 0) {
+            status = cf_util_get_boolean (child, &tctx->report_stats);
         } else {
             WARNING ("write_kafka plugin: Invalid directive: %s.", child->key);
         }
@@ -388,12 +818,30 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
             break;
     }
 
+    if (tctx->format == KAFKA_FORMAT_JSON) {
+        tctx->json = format_json_stream_create(KAFKA_BUFFER_SIZE,
+                                               KAFKA_JSON_CACHE_SIZE);
+        if (tctx->json == NULL) {
+            ERROR("write_kafka plugin: format_json_stream_create failed.");
+            goto errout;
+        }
+    }
+
+    tctx->msgs = calloc(tctx->batch_size, sizeof(*tctx->msgs));
+    tctx->keys = calloc(tctx->batch_size, sizeof(*tctx->keys));
+    if ((tctx->msgs == NULL) || (tctx->keys == NULL)) {
+        ERROR("write_kafka plugin: calloc failed.");
+        goto errout;
+    }
+
     rd_kafka_topic_conf_set_partitioner_cb(tctx->conf, kafka_partition);
     rd_kafka_topic_conf_set_opaque(tctx->conf, tctx);
 
     ssnprintf(callback_name, sizeof(callback_name),
               "write_kafka/%s", tctx->topic_name);
 
+    pthread_mutex_init (&tctx->lock, /* attr = */ NULL);
+
     ud.data = tctx;
     ud.free_func = kafka_topic_context_free;
 
@@ -402,10 +850,17 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
 		WARNING ("write_kafka plugin: plugin_register_write (\"%s\") "
 				"failed with status %i.",
 				callback_name, status);
+        pthread_mutex_destroy (&tctx->lock);
         goto errout;
     }
 
-    pthread_mutex_init (&tctx->lock, /* attr = */ NULL);
+    ud.free_func = NULL;
+    plugin_register_flush (callback_name, kafka_flush, &ud);
+
+    if (tctx->report_stats)
+        plugin_register_complex_read (/* group = */ NULL, callback_name,
+                                      kafka_stats_read, /* interval = */ 0,
+                                      &ud);
 
     return;
  errout:
@@ -415,6 +870,11 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
         rd_kafka_topic_conf_destroy(tctx->conf);
     if (tctx->kafka_conf != NULL)
 		rd_kafka_conf_destroy(tctx->kafka_conf);
+    format_json_stream_destroy(tctx->json);
+    sfree(tctx->msgs);
+    sfree(tctx->keys);
+    sfree(tctx->prefix);
+    sfree(tctx->postfix);
     sfree(tctx);
 } /* }}} int kafka_config_topic */
 
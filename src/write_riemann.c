@@ -31,43 +31,18 @@
 #include "common.h"
 #include "configfile.h"
 #include "utils_cache.h"
-#include "riemann.pb-c.h"
+#include "write_riemann.h"
 
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <netdb.h>
 #include <inttypes.h>
 #include <pthread.h>
-
-#define RIEMANN_HOST		"localhost"
-#define RIEMANN_PORT		"5555"
-#define RIEMANN_TTL_FACTOR      2.0
-#define RIEMANN_BATCH_MAX      8192
-
-int write_riemann_threshold_check(const data_set_t *, const value_list_t *, int *);
-
-struct riemann_host {
-	char			*name;
-	char			*event_service_prefix;
-#define F_CONNECT	 0x01
-	uint8_t			 flags;
-	pthread_mutex_t	 lock;
-    _Bool            batch_mode;
-	_Bool            notifications;
-	_Bool            check_thresholds;
-	_Bool			 store_rates;
-	_Bool			 always_append_ds;
-	char			*node;
-	char			*service;
-	_Bool			 use_tcp;
-	int			     s;
-	double			 ttl_factor;
-    Msg             *batch_msg;
-    cdtime_t         batch_init;
-    int              batch_max;
-	int			     reference_count;
-};
+#include <fcntl.h>
+#include <poll.h>
 
 static char	**riemann_tags;
 static size_t	  riemann_tags_num;
@@ -163,6 +138,15 @@ static int riemann_connect(struct riemann_host *host) /* {{{ */
 			continue;
 		}
 
+		/* Messages are sent without waiting for the acknowledgement
+		 * of the previous one; don't let Nagle's algorithm hold them
+		 * back. */
+		if (host->use_tcp) {
+			int yes = 1;
+			setsockopt (host->s, IPPROTO_TCP, TCP_NODELAY,
+					&yes, sizeof (yes));
+		}
+
 		host->flags |= F_CONNECT;
 		DEBUG("write_riemann plugin: got a successful connection for: %s:%s",
 				node, service);
@@ -188,10 +172,30 @@ static int riemann_disconnect (struct riemann_host *host) /* {{{ */
 	close (host->s);
 	host->s = -1;
 	host->flags &= ~F_CONNECT;
+	host->outstanding = 0;
 
 	return (0);
 } /* }}} int riemann_disconnect */
 
+static int riemann_send_buffer (struct riemann_host *host, /* {{{ */
+		u_char const *buffer, size_t buffer_len)
+{
+	int status;
+
+	status = (int) swrite (host->s, buffer, buffer_len);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("write_riemann plugin: Sending to Riemann at %s:%s failed: %s",
+				(host->node != NULL) ? host->node : RIEMANN_HOST,
+				(host->service != NULL) ? host->service : RIEMANN_PORT,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return -1;
+	}
+
+	return 0;
+} /* }}} int riemann_send_buffer */
+
 static int riemann_send_msg (struct riemann_host *host, const Msg *msg) /* {{{ */
 {
 	int status = 0;
@@ -225,20 +229,9 @@ static int riemann_send_msg (struct riemann_host *host, const Msg *msg) /* {{{ *
 		msg__pack(msg, buffer);
 	}
 
-	status = (int) swrite (host->s, buffer, buffer_len);
-	if (status != 0)
-	{
-		char errbuf[1024];
-		ERROR ("write_riemann plugin: Sending to Riemann at %s:%s failed: %s",
-				(host->node != NULL) ? host->node : RIEMANN_HOST,
-				(host->service != NULL) ? host->service : RIEMANN_PORT,
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		sfree (buffer);
-		return -1;
-	}
-
+	status = riemann_send_buffer (host, buffer, buffer_len);
 	sfree (buffer);
-	return 0;
+	return status;
 } /* }}} int riemann_send_msg */
 
 static int riemann_recv_ack(struct riemann_host *host) /* {{{ */
@@ -464,6 +457,34 @@ static Msg *riemann_notification_to_protobuf(struct riemann_host *host, /* {{{ *
 	return (msg);
 } /* }}} Msg *riemann_notification_to_protobuf */
 
+static void riemann_format_service (struct riemann_host const *host, /* {{{ */
+		data_set_t const *ds, value_list_t const *vl, size_t index,
+		char *buffer, size_t buffer_size)
+{
+	char name_buffer[5 * DATA_MAX_NAME_LEN];
+
+	format_name (name_buffer, sizeof (name_buffer),
+			/* host = */ "", vl->plugin, vl->plugin_instance,
+			vl->type, vl->type_instance);
+	if (host->always_append_ds || (ds->ds_num > 1))
+	{
+		if (host->event_service_prefix == NULL)
+			ssnprintf (buffer, buffer_size, "%s/%s",
+					&name_buffer[1], ds->ds[index].name);
+		else
+			ssnprintf (buffer, buffer_size, "%s%s/%s",
+					host->event_service_prefix, &name_buffer[1], ds->ds[index].name);
+	}
+	else
+	{
+		if (host->event_service_prefix == NULL)
+			sstrncpy (buffer, &name_buffer[1], buffer_size);
+		else
+			ssnprintf (buffer, buffer_size, "%s%s",
+					host->event_service_prefix, &name_buffer[1]);
+	}
+} /* }}} void riemann_format_service */
+
 static Event *riemann_value_to_protobuf(struct riemann_host const *host, /* {{{ */
 		data_set_t const *ds,
 		value_list_t const *vl, size_t index,
@@ -471,7 +492,6 @@ static Event *riemann_value_to_protobuf(struct riemann_host const *host, /* {{{
 					 int status)
 {
 	Event *event;
-	char name_buffer[5 * DATA_MAX_NAME_LEN];
 	char service_buffer[6 * DATA_MAX_NAME_LEN];
 	double ttl;
 	size_t i;
@@ -570,27 +590,8 @@ static Event *riemann_value_to_protobuf(struct riemann_host const *host, /* {{{
 			event->metric_sint64 = (int64_t) vl->values[index].counter;
 	}
 
-	format_name (name_buffer, sizeof (name_buffer),
-			/* host = */ "", vl->plugin, vl->plugin_instance,
-			vl->type, vl->type_instance);
-	if (host->always_append_ds || (ds->ds_num > 1))
-	{
-		if (host->event_service_prefix == NULL)
-			ssnprintf (service_buffer, sizeof (service_buffer), "%s/%s",
-					&name_buffer[1], ds->ds[index].name);
-		else
-			ssnprintf (service_buffer, sizeof (service_buffer), "%s%s/%s",
-					host->event_service_prefix, &name_buffer[1], ds->ds[index].name);
-	}
-	else
-	{
-		if (host->event_service_prefix == NULL)
-			sstrncpy (service_buffer, &name_buffer[1], sizeof (service_buffer));
-		else
-			ssnprintf (service_buffer, sizeof (service_buffer), "%s%s",
-					host->event_service_prefix, &name_buffer[1]);
-	}
-
+	riemann_format_service (host, ds, vl, index,
+			service_buffer, sizeof (service_buffer));
 	event->service = strdup (service_buffer);
 
 	DEBUG ("write_riemann plugin: Successfully created protobuf for metric: "
@@ -656,50 +657,612 @@ static Msg *riemann_value_list_to_protobuf (struct riemann_host const *host, /*
 } /* }}} Msg *riemann_value_list_to_protobuf */
 
 
-/*
- * Always call while holding host->lock !
- */
-static int riemann_batch_flush_nolock (cdtime_t timeout,
-                                       struct riemann_host *host)
+void riemann_batch_reset (riemann_batch_t *batch) /* {{{ */
+{
+	riemann_string_chunk_t *chunk;
+
+	for (chunk = batch->strings; chunk != NULL; chunk = chunk->next)
+		chunk->fill = 0;
+	batch->strings_tail = batch->strings;
+	batch->events_num = 0;
+	batch->attributes_num = 0;
+	batch->packed_size = 0;
+	batch->init = 0;
+	batch->next = NULL;
+	riemann_msg_protobuf_free (batch->notification);
+	batch->notification = NULL;
+} /* }}} void riemann_batch_reset */
+
+void riemann_batch_free (riemann_batch_t *batch) /* {{{ */
 {
-    cdtime_t    now;
-    int         status = 0;
+	riemann_string_chunk_t *chunk;
 
-    if (timeout > 0) {
-        now = cdtime ();
-        if ((host->batch_init + timeout) > now)
-            return status;
-    }
-    riemann_send_msg(host, host->batch_msg);
-    riemann_msg_protobuf_free(host->batch_msg);
+	if (batch == NULL)
+		return;
 
-	if (host->use_tcp && ((status = riemann_recv_ack(host)) != 0))
-        riemann_disconnect (host);
+	chunk = batch->strings;
+	while (chunk != NULL)
+	{
+		riemann_string_chunk_t *next = chunk->next;
+		sfree (chunk);
+		chunk = next;
+	}
 
-    host->batch_init = cdtime();
-    host->batch_msg = NULL;
-    return status;
-}
+	riemann_msg_protobuf_free (batch->notification);
+	sfree (batch->events);
+	sfree (batch->attributes_first);
+	sfree (batch->attributes);
+	sfree (batch->event_ptrs);
+	sfree (batch->attribute_ptrs);
+	sfree (batch->buffer);
+	sfree (batch);
+} /* }}} void riemann_batch_free */
+
+/* Copies a string into the arena. The strings live until the batch has been
+ * sent. */
+static char *riemann_batch_strdup (riemann_batch_t *batch, /* {{{ */
+		char const *str)
+{
+	riemann_string_chunk_t *chunk = batch->strings_tail;
+	size_t len = strlen (str) + 1;
+	char *ret;
+
+	if (len > RIEMANN_STRING_CHUNK_SIZE)
+		len = RIEMANN_STRING_CHUNK_SIZE;
+
+	if ((chunk != NULL) && (len > RIEMANN_STRING_CHUNK_SIZE - chunk->fill))
+	{
+		chunk = chunk->next;
+		if (chunk != NULL)
+			batch->strings_tail = chunk;
+	}
+
+	if (chunk == NULL)
+	{
+		chunk = malloc (sizeof (*chunk));
+		if (chunk == NULL)
+			return (NULL);
+		chunk->next = NULL;
+		chunk->fill = 0;
+
+		if (batch->strings_tail == NULL)
+			batch->strings = chunk;
+		else
+			batch->strings_tail->next = chunk;
+		batch->strings_tail = chunk;
+	}
+
+	ret = chunk->data + chunk->fill;
+	sstrncpy (ret, str, len);
+	chunk->fill += len;
+	return (ret);
+} /* }}} char *riemann_batch_strdup */
+
+static int riemann_batch_add_attribute (riemann_batch_t *batch, /* {{{ */
+		Event *event, char const *key, char const *value, _Bool copy)
+{
+	Attribute *a;
+
+	if (batch->attributes_num >= batch->attributes_size)
+	{
+		size_t new_size = 2 * batch->attributes_size;
+		Attribute *tmp;
+
+		if (new_size == 0)
+			new_size = 64 * RIEMANN_EVENT_ATTRIBUTES;
+		tmp = realloc (batch->attributes, new_size * sizeof (*tmp));
+		if (tmp == NULL)
+			return (ENOMEM);
+		batch->attributes = tmp;
+		batch->attributes_size = new_size;
+	}
+
+	a = batch->attributes + batch->attributes_num;
+	attribute__init (a);
+	/* Keys are constants or configured strings which outlive the batch. */
+	a->key = (char *) key;
+	if (copy)
+	{
+		a->value = riemann_batch_strdup (batch, value);
+		if (a->value == NULL)
+			return (ENOMEM);
+	}
+	else
+	{
+		a->value = (char *) value;
+	}
+
+	batch->attributes_num++;
+	event->n_attributes++;
+	return (0);
+} /* }}} int riemann_batch_add_attribute */
+
+/* Adds the event for one data source to the arena. Does the same as
+ * riemann_value_to_protobuf() without allocating memory per event. */
+static int riemann_batch_add_value (struct riemann_host const *host, /* {{{ */
+		riemann_batch_t *batch,
+		data_set_t const *ds, value_list_t const *vl, size_t index,
+		gauge_t const *rates, int status)
+{
+	Event *event;
+	Attribute *attributes[RIEMANN_EVENT_ATTRIBUTES + riemann_attrs_num / 2];
+	char service_buffer[6 * DATA_MAX_NAME_LEN];
+	char ds_type[DATA_MAX_NAME_LEN];
+	char ds_index[DATA_MAX_NAME_LEN];
+	size_t first;
+	size_t event_size;
+	size_t i;
+	int failed = 0;
+
+	if (batch->events_num >= batch->events_size)
+	{
+		size_t new_size = 2 * batch->events_size;
+		Event *tmp;
+		size_t *tmp_first;
+
+		if (new_size == 0)
+			new_size = 64;
+		tmp = realloc (batch->events, new_size * sizeof (*tmp));
+		if (tmp == NULL)
+			return (ENOMEM);
+		batch->events = tmp;
+		tmp_first = realloc (batch->attributes_first,
+				new_size * sizeof (*tmp_first));
+		if (tmp_first == NULL)
+			return (ENOMEM);
+		batch->attributes_first = tmp_first;
+		batch->events_size = new_size;
+	}
+
+	first = batch->attributes_num;
+	event = batch->events + batch->events_num;
+	event__init (event);
+
+	event->host = riemann_batch_strdup (batch, vl->host);
+	event->time = CDTIME_T_TO_TIME_T (vl->time);
+	event->has_time = 1;
+
+	if (host->check_thresholds) {
+		switch (status) {
+			case STATE_OKAY:
+				event->state = (char *) "ok";
+				break;
+			case STATE_ERROR:
+				event->state = (char *) "critical";
+				break;
+			case STATE_WARNING:
+				event->state = (char *) "warning";
+				break;
+			case STATE_MISSING:
+				event->state = (char *) "unknown";
+				break;
+		}
+	}
+
+	event->ttl = (float) (CDTIME_T_TO_DOUBLE (vl->interval) * host->ttl_factor);
+	event->has_ttl = 1;
+
+	failed |= riemann_batch_add_attribute (batch, event, "plugin",
+			vl->plugin, /* copy = */ 1);
+	if (vl->plugin_instance[0] != 0)
+		failed |= riemann_batch_add_attribute (batch, event,
+				"plugin_instance", vl->plugin_instance, 1);
+
+	failed |= riemann_batch_add_attribute (batch, event, "type",
+			vl->type, 1);
+	if (vl->type_instance[0] != 0)
+		failed |= riemann_batch_add_attribute (batch, event,
+				"type_instance", vl->type_instance, 1);
+
+	if ((ds->ds[index].type != DS_TYPE_GAUGE) && (rates != NULL))
+		ssnprintf (ds_type, sizeof (ds_type), "%s:rate",
+				DS_TYPE_TO_STRING(ds->ds[index].type));
+	else
+		sstrncpy (ds_type, DS_TYPE_TO_STRING(ds->ds[index].type),
+				sizeof (ds_type));
+	failed |= riemann_batch_add_attribute (batch, event, "ds_type",
+			ds_type, 1);
+	failed |= riemann_batch_add_attribute (batch, event, "ds_name",
+			ds->ds[index].name, 1);
+	ssnprintf (ds_index, sizeof (ds_index), "%zu", index);
+	failed |= riemann_batch_add_attribute (batch, event, "ds_index",
+			ds_index, 1);
+
+	for (i = 0; i < riemann_attrs_num; i += 2)
+		failed |= riemann_batch_add_attribute (batch, event,
+				riemann_attrs[i], riemann_attrs[i + 1],
+				/* copy = */ 0);
+
+	/* The tags are the same for all events. */
+	event->tags = riemann_tags;
+	event->n_tags = riemann_tags_num;
+
+	if (ds->ds[index].type == DS_TYPE_GAUGE)
+	{
+		event->has_metric_d = 1;
+		event->metric_d = (double) vl->values[index].gauge;
+	}
+	else if (rates != NULL)
+	{
+		event->has_metric_d = 1;
+		event->metric_d = (double) rates[index];
+	}
+	else
+	{
+		event->has_metric_sint64 = 1;
+		if (ds->ds[index].type == DS_TYPE_DERIVE)
+			event->metric_sint64 = (int64_t) vl->values[index].derive;
+		else if (ds->ds[index].type == DS_TYPE_ABSOLUTE)
+			event->metric_sint64 = (int64_t) vl->values[index].absolute;
+		else
+			event->metric_sint64 = (int64_t) vl->values[index].counter;
+	}
+
+	riemann_format_service (host, ds, vl, index,
+			service_buffer, sizeof (service_buffer));
+	event->service = riemann_batch_strdup (batch, service_buffer);
+
+	if (failed || (event->host == NULL) || (event->service == NULL))
+	{
+		batch->attributes_num = first;
+		return (ENOMEM);
+	}
+
+	/* Account for the size of the event inside the message: tag, length
+	 * and the event itself. */
+	for (i = 0; i < event->n_attributes; i++)
+		attributes[i] = batch->attributes + first + i;
+	event->attributes = attributes;
+	event_size = event__get_packed_size (event);
+	event->attributes = NULL;
+	batch->packed_size += 1 + event_size;
+	for (i = event_size; i >= 0x80; i >>= 7)
+		batch->packed_size++;
+	batch->packed_size++;
+
+	batch->attributes_first[batch->events_num] = first;
+	batch->events_num++;
+	return (0);
+} /* }}} int riemann_batch_add_value */
+
+/* Packs a batch into its buffer, prefixed with the length as required by the
+ * TCP protocol. Returns the number of bytes to send or zero on error. */
+static size_t riemann_batch_pack (riemann_batch_t *batch) /* {{{ */
+{
+	Msg batch_msg;
+	Msg const *msg = batch->notification;
+	size_t len;
+	size_t i;
+
+	if (msg == NULL)
+	{
+		if (batch->event_ptrs_size < batch->events_num)
+		{
+			Event **tmp = realloc (batch->event_ptrs,
+					batch->events_size * sizeof (*tmp));
+			if (tmp == NULL)
+				return (0);
+			batch->event_ptrs = tmp;
+			batch->event_ptrs_size = batch->events_size;
+		}
+		if (batch->attribute_ptrs_size < batch->attributes_num)
+		{
+			Attribute **tmp = realloc (batch->attribute_ptrs,
+					batch->attributes_size * sizeof (*tmp));
+			if (tmp == NULL)
+				return (0);
+			batch->attribute_ptrs = tmp;
+			batch->attribute_ptrs_size = batch->attributes_size;
+		}
+
+		for (i = 0; i < batch->attributes_num; i++)
+			batch->attribute_ptrs[i] = batch->attributes + i;
+		for (i = 0; i < batch->events_num; i++)
+		{
+			batch->event_ptrs[i] = batch->events + i;
+			batch->events[i].attributes = batch->attribute_ptrs
+				+ batch->attributes_first[i];
+		}
+
+		msg__init (&batch_msg);
+		batch_msg.events = batch->event_ptrs;
+		batch_msg.n_events = batch->events_num;
+		msg = &batch_msg;
+	}
+
+	len = msg__get_packed_size (msg);
+	if (batch->buffer_size < len + 4)
+	{
+		u_char *tmp = realloc (batch->buffer, len + 4);
+		if (tmp == NULL)
+			return (0);
+		batch->buffer = tmp;
+		batch->buffer_size = len + 4;
+	}
+
+	{
+		uint32_t length = htonl ((uint32_t) len);
+		memcpy (batch->buffer, &length, 4);
+	}
+	msg__pack (msg, batch->buffer + 4);
+
+	return (len + 4);
+} /* }}} size_t riemann_batch_pack */
+
+/* Wakes up the sender thread. */
+static void riemann_wakeup (struct riemann_host *host) /* {{{ */
+{
+	char c = 0;
+
+	if (write (host->wakeup_pipe[1], &c, sizeof (c)) < 0)
+	{
+		/* The pipe is full if the sender has many wakeups pending
+		 * already; nothing to do. */
+	}
+} /* }}} void riemann_wakeup */
+
+/* Returns a batch to the pool of arenas. */
+static void riemann_batch_release (struct riemann_host *host, /* {{{ */
+		riemann_batch_t *batch)
+{
+	if (batch->notification != NULL)
+	{
+		riemann_batch_free (batch);
+		return;
+	}
+
+	riemann_batch_reset (batch);
+
+	pthread_mutex_lock (&host->lock);
+	batch->next = host->free_batches;
+	host->free_batches = batch;
+	pthread_mutex_unlock (&host->lock);
+} /* }}} void riemann_batch_release */
+
+/* Waits for one acknowledgement. Disconnects on errors, which also forgets
+ * about all outstanding messages. */
+static int riemann_sender_recv_ack (struct riemann_host *host) /* {{{ */
+{
+	int status;
+
+	status = riemann_recv_ack (host);
+	if (status != 0)
+	{
+		riemann_disconnect (host);
+		return (status);
+	}
+
+	host->outstanding--;
+	return (0);
+} /* }}} int riemann_sender_recv_ack */
+
+static void riemann_sender_send (struct riemann_host *host, /* {{{ */
+		riemann_batch_t *batch)
+{
+	size_t len;
+	int status;
+
+	while ((host->flags & F_CONNECT)
+			&& (host->outstanding >= host->pipeline_depth))
+		riemann_sender_recv_ack (host);
+
+	len = riemann_batch_pack (batch);
+	if (len == 0)
+	{
+		ERROR ("write_riemann plugin: Packing %zu events failed.",
+				batch->events_num);
+		riemann_batch_release (host, batch);
+		return;
+	}
+
+	status = riemann_connect (host);
+	if (status == 0)
+		status = riemann_send_buffer (host, batch->buffer, len);
+	if (status != 0)
+	{
+		riemann_disconnect (host);
+		if (batch->notification == NULL)
+			WARNING ("write_riemann plugin: Dropping %zu events.",
+					batch->events_num);
+	}
+	else
+	{
+		host->outstanding++;
+	}
+
+	riemann_batch_release (host, batch);
+} /* }}} void riemann_sender_send */
+
+/* host->lock must be held when calling this function. */
+static void riemann_batch_queue_nolock (struct riemann_host *host) /* {{{ */
+{
+	riemann_batch_t *batch = host->batch;
+
+	if ((batch == NULL) || (batch->events_num == 0))
+		return;
+
+	host->batch = NULL;
+	if (host->queue_tail == NULL)
+		host->queue_head = batch;
+	else
+		host->queue_tail->next = batch;
+	host->queue_tail = batch;
+
+	riemann_wakeup (host);
+} /* }}} void riemann_batch_queue_nolock */
+
+/* The sender thread owns the socket in batch mode. Batches are sent without
+ * waiting for the acknowledgement of the previous message, up to
+ * "PipelineDepth" messages may be unacknowledged. */
+static void *riemann_sender_thread (void *arg) /* {{{ */
+{
+	struct riemann_host *host = arg;
+	cdtime_t deadline = 0;
+
+	while (42)
+	{
+		struct pollfd fds[2];
+		int fds_num = 1;
+		int timeout = -1;
+		riemann_batch_t *notifications;
+		riemann_batch_t *queue;
+		_Bool shutdown;
+
+		memset (fds, 0, sizeof (fds));
+		fds[0].fd = host->wakeup_pipe[0];
+		fds[0].events = POLLIN;
+		if ((host->flags & F_CONNECT) && (host->outstanding > 0))
+		{
+			fds[1].fd = host->s;
+			fds[1].events = POLLIN;
+			fds_num = 2;
+		}
+		if (host->batch_timeout > 0)
+			timeout = (int) CDTIME_T_TO_MS (host->batch_timeout);
+		if (deadline != 0)
+			timeout = 100;
+
+		if (poll (fds, (nfds_t) fds_num, timeout) > 0)
+		{
+			if (fds[0].revents != 0)
+			{
+				char buffer[64];
+				while (read (host->wakeup_pipe[0], buffer, sizeof (buffer)) > 0)
+					/* empty */;
+			}
+			if ((fds_num > 1) && (fds[1].revents != 0))
+				riemann_sender_recv_ack (host);
+		}
+
+		pthread_mutex_lock (&host->lock);
+		if ((host->batch != NULL) && (host->batch_timeout > 0)
+				&& ((host->batch->init + host->batch_timeout) <= cdtime ()))
+			riemann_batch_queue_nolock (host);
+		notifications = host->notification_head;
+		host->notification_head = host->notification_tail = NULL;
+		queue = host->queue_head;
+		host->queue_head = host->queue_tail = NULL;
+		shutdown = host->shutdown;
+		pthread_mutex_unlock (&host->lock);
+
+		/* Notifications go out before the batches. */
+		while (notifications != NULL)
+		{
+			riemann_batch_t *next = notifications->next;
+			riemann_sender_send (host, notifications);
+			notifications = next;
+		}
+		while (queue != NULL)
+		{
+			riemann_batch_t *next = queue->next;
+			riemann_sender_send (host, queue);
+			queue = next;
+		}
+
+		if (!shutdown)
+			continue;
+
+		/* Everything has been sent, wait for the acknowledgements. */
+		if (deadline == 0)
+			deadline = cdtime ()
+				+ TIME_T_TO_CDTIME_T (RIEMANN_SHUTDOWN_TIMEOUT);
+		if (!(host->flags & F_CONNECT) || (host->outstanding <= 0))
+			break;
+		if (cdtime () >= deadline)
+		{
+			WARNING ("write_riemann plugin: %i messages have not been "
+					"acknowledged on shutdown.", host->outstanding);
+			break;
+		}
+	}
+
+	riemann_disconnect (host);
+	return (NULL);
+} /* }}} void *riemann_sender_thread */
+
+/* host->lock must be held when calling this function. */
+static int riemann_sender_start_nolock (struct riemann_host *host) /* {{{ */
+{
+	int status;
+
+	if (host->sender_running)
+		return (0);
+
+	status = plugin_thread_create (&host->sender_thread, /* attr = */ NULL,
+			riemann_sender_thread, host);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("write_riemann plugin: Starting the sender thread failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	host->sender_running = 1;
+	return (0);
+} /* }}} int riemann_sender_start_nolock */
+
+/* host->lock must be held when calling this function. Returns the batch that
+ * values are added to, taking an arena from the pool if necessary. */
+static riemann_batch_t *riemann_batch_get_nolock (struct riemann_host *host) /* {{{ */
+{
+	riemann_batch_t *batch = host->batch;
+
+	if (batch != NULL)
+		return (batch);
+
+	if (host->free_batches != NULL)
+	{
+		batch = host->free_batches;
+		host->free_batches = batch->next;
+	}
+	else if (host->batches_num < RIEMANN_BATCH_QUEUE_MAX)
+	{
+		batch = calloc (1, sizeof (*batch));
+		if (batch == NULL)
+			return (NULL);
+		host->batches_num++;
+	}
+	else if (host->queue_head != NULL)
+	{
+		/* The sender does not keep up: drop the oldest batch. */
+		batch = host->queue_head;
+		host->queue_head = batch->next;
+		if (host->queue_head == NULL)
+			host->queue_tail = NULL;
+		WARNING ("write_riemann plugin: Queue is full, dropping %zu "
+				"events.", batch->events_num);
+		riemann_batch_reset (batch);
+	}
+	else
+	{
+		return (NULL);
+	}
+
+	batch->next = NULL;
+	batch->init = cdtime ();
+	host->batch = batch;
+	return (batch);
+} /* }}} riemann_batch_t *riemann_batch_get_nolock */
 
 static int riemann_batch_flush (cdtime_t timeout,
         const char *identifier __attribute__((unused)),
         user_data_t *user_data)
 {
     struct riemann_host *host;
-    int status;
 
     if (user_data == NULL)
         return (-EINVAL);
 
     host = user_data->data;
     pthread_mutex_lock (&host->lock);
-    status = riemann_batch_flush_nolock (timeout, host);
-    if (status != 0)
-        ERROR ("write_riemann plugin: riemann_send failed with status %i",
-               status);
-
+    /* timeout == 0  => flush unconditionally */
+    if ((host->batch != NULL) && ((timeout == 0)
+                || ((host->batch->init + timeout) <= cdtime ())))
+        riemann_batch_queue_nolock (host);
     pthread_mutex_unlock(&host->lock);
-    return status;
+
+    return 0;
 }
 
 static int riemann_batch_add_value_list (struct riemann_host *host, /* {{{ */
@@ -707,52 +1270,47 @@ static int riemann_batch_add_value_list (struct riemann_host *host, /* {{{ */
                                          value_list_t const *vl,
                                          int *statuses)
 {
-	size_t i;
-    Event **events;
-    Msg *msg;
-    size_t len;
-    int ret;
-
-    msg = riemann_value_list_to_protobuf (host, ds, vl, statuses);
-    if (msg == NULL)
-        return -1;
-
-    pthread_mutex_lock(&host->lock);
-
-    if (host->batch_msg == NULL) {
-        host->batch_msg = msg;
-    } else {
-        len = msg->n_events + host->batch_msg->n_events;
-        events = realloc(host->batch_msg->events,
-                         (len * sizeof(*host->batch_msg->events)));
-        if (events == NULL) {
-            pthread_mutex_unlock(&host->lock);
-            ERROR ("write_riemann plugin: out of memory");
-            riemann_msg_protobuf_free (msg);
+    riemann_batch_t *batch;
+    gauge_t *rates = NULL;
+    size_t i;
+    int status = 0;
+
+    if (host->store_rates)
+    {
+        rates = uc_get_rate (ds, vl);
+        if (rates == NULL)
+        {
+            ERROR ("write_riemann plugin: uc_get_rate failed.");
             return -1;
         }
-        host->batch_msg->events = events;
+    }
 
-        for (i = host->batch_msg->n_events; i < len; i++)
-            host->batch_msg->events[i] = msg->events[i - host->batch_msg->n_events];
+    pthread_mutex_lock(&host->lock);
 
-        host->batch_msg->n_events = len;
-        sfree (msg->events);
-        msg->n_events = 0;
-        sfree (msg);
-    }
+    if (riemann_sender_start_nolock (host) != 0)
+        status = -1;
+    else if ((batch = riemann_batch_get_nolock (host)) == NULL)
+        status = ENOMEM;
 
-	len = msg__get_packed_size(host->batch_msg);
-    ret = 0;
-    if ((host->batch_max < 0) || (((size_t) host->batch_max) <= len)) {
-	    ret = riemann_batch_flush_nolock(0, host);
-    }
+    for (i = 0; (status == 0) && (i < vl->values_len); i++)
+        status = riemann_batch_add_value (host, batch, ds, vl, i, rates,
+                                          statuses[i]);
+    if (status != 0)
+        ERROR ("write_riemann plugin: Adding values to the batch failed "
+               "with status %i.", status);
+
+    /* The length of the message header is not accounted for; it is a few
+     * bytes at most. */
+    if ((host->batch != NULL) && ((host->batch_max < 0)
+                || (((size_t) host->batch_max) <= host->batch->packed_size)))
+        riemann_batch_queue_nolock (host);
 
     pthread_mutex_unlock(&host->lock);
-    return ret;
-} /* }}} Msg *riemann_batch_add_value_list */
+    sfree (rates);
+    return status;
+} /* }}} int riemann_batch_add_value_list */
 
-static int riemann_notification(const notification_t *n, user_data_t *ud) /* {{{ */
+int riemann_notification(const notification_t *n, user_data_t *ud) /* {{{ */
 {
 	int			 status;
 	struct riemann_host	*host = ud->data;
@@ -768,6 +1326,39 @@ static int riemann_notification(const notification_t *n, user_data_t *ud) /* {{{
 	if (msg == NULL)
 		return (-1);
 
+	/* In batch mode the socket belongs to the sender thread: queue the
+	 * notification, it is sent before the batches. Notifications do not
+	 * take an arena from the pool, so the oldest batch dropped when the
+	 * pool is exhausted is never a notification. */
+	if (host->use_tcp && host->batch_mode)
+	{
+		riemann_batch_t *batch = calloc (1, sizeof (*batch));
+		if (batch == NULL)
+		{
+			ERROR ("write_riemann plugin: calloc failed.");
+			riemann_msg_protobuf_free (msg);
+			return (-1);
+		}
+		batch->notification = msg;
+
+		pthread_mutex_lock (&host->lock);
+		status = riemann_sender_start_nolock (host);
+		if (status == 0)
+		{
+			if (host->notification_tail == NULL)
+				host->notification_head = batch;
+			else
+				host->notification_tail->next = batch;
+			host->notification_tail = batch;
+			riemann_wakeup (host);
+		}
+		pthread_mutex_unlock (&host->lock);
+
+		if (status != 0)
+			riemann_batch_free (batch);
+		return (status);
+	}
+
 	status = riemann_send (host, msg);
 	if (status != 0)
 		ERROR ("write_riemann plugin: riemann_send failed with status %i",
@@ -777,7 +1368,7 @@ static int riemann_notification(const notification_t *n, user_data_t *ud) /* {{{
 	return (status);
 } /* }}} int riemann_notification */
 
-static int riemann_write(const data_set_t *ds, /* {{{ */
+int riemann_write(const data_set_t *ds, /* {{{ */
 		const value_list_t *vl,
 		user_data_t *ud)
 {
@@ -808,7 +1399,7 @@ static int riemann_write(const data_set_t *ds, /* {{{ */
 	return status;
 } /* }}} int riemann_write */
 
-static void riemann_free(void *p) /* {{{ */
+void riemann_free(void *p) /* {{{ */
 {
 	struct riemann_host	*host = p;
 
@@ -824,8 +1415,47 @@ static void riemann_free(void *p) /* {{{ */
 		return;
 	}
 
+	/* Let the sender thread send what is queued. */
+	if (host->sender_running)
+	{
+		if (host->batch != NULL)
+			riemann_batch_queue_nolock (host);
+		host->shutdown = 1;
+		riemann_wakeup (host);
+		pthread_mutex_unlock (&host->lock);
+		pthread_join (host->sender_thread, NULL);
+		pthread_mutex_lock (&host->lock);
+		host->sender_running = 0;
+	}
+
 	riemann_disconnect (host);
 
+	riemann_batch_free (host->batch);
+	while (host->notification_head != NULL)
+	{
+		riemann_batch_t *next = host->notification_head->next;
+		riemann_batch_free (host->notification_head);
+		host->notification_head = next;
+	}
+	while (host->queue_head != NULL)
+	{
+		riemann_batch_t *next = host->queue_head->next;
+		riemann_batch_free (host->queue_head);
+		host->queue_head = next;
+	}
+	while (host->free_batches != NULL)
+	{
+		riemann_batch_t *next = host->free_batches->next;
+		riemann_batch_free (host->free_batches);
+		host->free_batches = next;
+	}
+	if (host->wakeup_pipe[0] >= 0)
+		close (host->wakeup_pipe[0]);
+	if (host->wakeup_pipe[1] >= 0)
+		close (host->wakeup_pipe[1]);
+
+	pthread_mutex_unlock (&host->lock);
+
 	sfree(host->service);
 	pthread_mutex_destroy (&host->lock);
 	sfree(host);
@@ -855,7 +1485,9 @@ static int riemann_config_node(oconfig_item_t *ci) /* {{{ */
 	host->use_tcp = 1;
 	host->batch_mode = 1;
 	host->batch_max = RIEMANN_BATCH_MAX; /* typical MSS */
-	host->batch_init = cdtime();
+	host->batch_timeout = RIEMANN_BATCH_TIMEOUT;
+	host->pipeline_depth = RIEMANN_PIPELINE_DEPTH;
+	host->wakeup_pipe[0] = host->wakeup_pipe[1] = -1;
 	host->ttl_factor = RIEMANN_TTL_FACTOR;
 
 	status = cf_util_get_string (ci, &host->name);
@@ -897,6 +1529,19 @@ static int riemann_config_node(oconfig_item_t *ci) /* {{{ */
             status = cf_util_get_int(child, &host->batch_max);
             if (status != 0)
                 break;
+        } else if (strcasecmp("BatchFlushTimeout", child->key) == 0) {
+            status = cf_util_get_cdtime(child, &host->batch_timeout);
+            if (status != 0)
+                break;
+        } else if (strcasecmp("PipelineDepth", child->key) == 0) {
+            status = cf_util_get_int(child, &host->pipeline_depth);
+            if (status != 0)
+                break;
+            if (host->pipeline_depth < 1) {
+                WARNING ("write_riemann plugin: \"PipelineDepth\" must be "
+                         "at least 1.");
+                host->pipeline_depth = 1;
+            }
 		} else if (strcasecmp ("Port", child->key) == 0) {
 			status = cf_util_get_service (child, &host->service);
 			if (status != 0) {
@@ -973,6 +1618,21 @@ static int riemann_config_node(oconfig_item_t *ci) /* {{{ */
 		return status;
 	}
 
+	if (host->use_tcp && host->batch_mode) {
+		if (pipe (host->wakeup_pipe) != 0) {
+			char errbuf[1024];
+			ERROR ("write_riemann plugin: pipe failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			host->wakeup_pipe[0] = host->wakeup_pipe[1] = -1;
+			riemann_free (host);
+			return -1;
+		}
+		fcntl (host->wakeup_pipe[0], F_SETFL,
+				fcntl (host->wakeup_pipe[0], F_GETFL) | O_NONBLOCK);
+		fcntl (host->wakeup_pipe[1], F_SETFL,
+				fcntl (host->wakeup_pipe[1], F_GETFL) | O_NONBLOCK);
+	}
+
 	ssnprintf (callback_name, sizeof (callback_name), "write_riemann/%s",
 			host->name);
 	ud.data = host;
@@ -0,0 +1,140 @@
+/**
+ * collectd - src/write_riemann.h
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/* Internals of the write_riemann plugin, shared by its source files and
+ * its test. */
+
+#ifndef WRITE_RIEMANN_H
+#define WRITE_RIEMANN_H 1
+
+#include "plugin.h"
+#include "riemann.pb-c.h"
+
+#include <pthread.h>
+
+#define RIEMANN_HOST		"localhost"
+#define RIEMANN_PORT		"5555"
+#define RIEMANN_TTL_FACTOR      2.0
+#define RIEMANN_BATCH_MAX      8192
+#define RIEMANN_BATCH_TIMEOUT   TIME_T_TO_CDTIME_T (1)
+#define RIEMANN_PIPELINE_DEPTH  4
+/* Maximum number of event arenas per node. When all of them are filled or
+ * queued, the oldest queued batch is dropped. Notifications are not
+ * counted. */
+#define RIEMANN_BATCH_QUEUE_MAX 64
+#define RIEMANN_STRING_CHUNK_SIZE 16384
+/* Number of attributes set for every value, not counting the global ones. */
+#define RIEMANN_EVENT_ATTRIBUTES 7
+/* Number of seconds to wait for outstanding acknowledgements on shutdown. */
+#define RIEMANN_SHUTDOWN_TIMEOUT 5
+
+typedef struct riemann_string_chunk_s riemann_string_chunk_t;
+struct riemann_string_chunk_s {
+	riemann_string_chunk_t	*next;
+	size_t			 fill;
+	char			 data[RIEMANN_STRING_CHUNK_SIZE];
+};
+
+/* Event arena: the events of one batch together with their attributes and
+ * strings. Arenas are reused, so adding events to a batch does not allocate
+ * memory once an arena has grown to its working size. The attribute and event
+ * pointers needed by protobuf-c are only set up when the batch is packed,
+ * which allows the arrays to be grown with realloc(). */
+typedef struct riemann_batch_s riemann_batch_t;
+struct riemann_batch_s {
+	riemann_batch_t		*next;
+	/* Notifications are queued as a batch holding a single message, on
+	 * a queue of their own. */
+	Msg			*notification;
+
+	Event			*events;
+	size_t			*attributes_first;
+	size_t			 events_num;
+	size_t			 events_size;
+	Attribute		*attributes;
+	size_t			 attributes_num;
+	size_t			 attributes_size;
+	riemann_string_chunk_t	*strings;
+	riemann_string_chunk_t	*strings_tail;
+	size_t			 packed_size;
+	cdtime_t		 init;
+
+	/* Only used by the sender thread. */
+	Event			**event_ptrs;
+	size_t			 event_ptrs_size;
+	Attribute		**attribute_ptrs;
+	size_t			 attribute_ptrs_size;
+	u_char			*buffer;
+	size_t			 buffer_size;
+};
+
+struct riemann_host {
+	char			*name;
+	char			*event_service_prefix;
+#define F_CONNECT	 0x01
+	uint8_t			 flags;
+	pthread_mutex_t	 lock;
+    _Bool            batch_mode;
+	_Bool            notifications;
+	_Bool            check_thresholds;
+	_Bool			 store_rates;
+	_Bool			 always_append_ds;
+	char			*node;
+	char			*service;
+	_Bool			 use_tcp;
+	int			     s;
+	double			 ttl_factor;
+    int              batch_max;
+	cdtime_t		 batch_timeout;
+	int			 pipeline_depth;
+	int			     reference_count;
+
+	/* Batch mode: values are collected in "batch" and queued for the
+	 * sender thread, which owns the socket and keeps up to
+	 * "pipeline_depth" messages unacknowledged. Protected by "lock". */
+	riemann_batch_t		*batch;
+	riemann_batch_t		*queue_head;
+	riemann_batch_t		*queue_tail;
+	riemann_batch_t		*notification_head;
+	riemann_batch_t		*notification_tail;
+	riemann_batch_t		*free_batches;
+	size_t			 batches_num;
+	pthread_t		 sender_thread;
+	_Bool			 sender_running;
+	_Bool			 shutdown;
+	int			 wakeup_pipe[2];
+	int			 outstanding;
+};
+
+int write_riemann_threshold_check (const data_set_t *ds,
+		const value_list_t *vl, int *statuses);
+
+int riemann_write (const data_set_t *ds, const value_list_t *vl,
+		user_data_t *ud);
+int riemann_notification (const notification_t *n, user_data_t *ud);
+void riemann_free (void *p);
+
+void riemann_batch_reset (riemann_batch_t *batch);
+void riemann_batch_free (riemann_batch_t *batch);
+
+#endif /* WRITE_RIEMANN_H */
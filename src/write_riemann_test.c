@@ -0,0 +1,192 @@
+/**
+ * collectd - src/write_riemann_test.c
+ * Copyright (C) 2026       ETH Zurich
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **/
+
+#include "testing.h"
+#include "collectd.h"
+#include "common.h"
+#include "write_riemann.h"
+
+/*
+ * Stand-ins for the daemon and the threshold checks, which are not part of
+ * the test build.
+ */
+int plugin_register_complex_config (const char *type,
+    int (*callback) (oconfig_item_t *))
+{
+  return (0);
+}
+
+int plugin_register_write (const char *name, plugin_write_cb callback,
+    user_data_t *user_data)
+{
+  return (0);
+}
+
+int plugin_register_flush (const char *name, plugin_flush_cb callback,
+    user_data_t *user_data)
+{
+  return (0);
+}
+
+int plugin_register_notification (const char *name,
+    plugin_notification_cb callback, user_data_t *user_data)
+{
+  return (0);
+}
+
+int plugin_thread_create (pthread_t *thread, const pthread_attr_t *attr,
+    void *(*start_routine) (void *), void *arg)
+{
+  return (pthread_create (thread, attr, start_routine, arg));
+}
+
+cdtime_t plugin_get_interval (void)
+{
+  return (TIME_T_TO_CDTIME_T (10));
+}
+
+int write_riemann_threshold_check (const data_set_t *ds,
+    const value_list_t *vl, int *statuses)
+{
+  memset (statuses, 0, vl->values_len * sizeof (*statuses));
+  return (0);
+}
+
+/* A node in batch mode whose sender thread is pretended to be running, so
+ * that batches stay queued. Every value list is queued as a batch of its
+ * own. */
+static struct riemann_host *host_create (void)
+{
+  struct riemann_host *host;
+
+  host = calloc (1, sizeof (*host));
+  if (host == NULL)
+    return (NULL);
+
+  pthread_mutex_init (&host->lock, NULL);
+  host->reference_count = 1;
+  host->notifications = 1;
+  host->use_tcp = 1;
+  host->batch_mode = 1;
+  host->batch_max = 1;
+  host->batch_timeout = RIEMANN_BATCH_TIMEOUT;
+  host->pipeline_depth = RIEMANN_PIPELINE_DEPTH;
+  host->ttl_factor = RIEMANN_TTL_FACTOR;
+  host->s = -1;
+  if (pipe (host->wakeup_pipe) != 0)
+  {
+    free (host);
+    return (NULL);
+  }
+  fcntl (host->wakeup_pipe[1], F_SETFL,
+      fcntl (host->wakeup_pipe[1], F_GETFL) | O_NONBLOCK);
+  host->sender_running = 1;
+
+  return (host);
+}
+
+static size_t queue_length (riemann_batch_t *batch)
+{
+  size_t num = 0;
+
+  for (; batch != NULL; batch = batch->next)
+    num++;
+  return (num);
+}
+
+DEF_TEST(full_queue)
+{
+  struct riemann_host *host;
+  user_data_t ud = { NULL, NULL };
+  notification_t n;
+  data_source_t dsrc = { "value", DS_TYPE_GAUGE, 0.0, NAN };
+  data_set_t ds = { "gauge", 1, &dsrc };
+  value_list_t vl = VALUE_LIST_INIT;
+  value_t value;
+  riemann_batch_t *batch;
+  _Bool events_only = 1;
+  int i;
+
+  host = host_create ();
+  CHECK_NOT_NULL (host);
+  if (host == NULL)
+    return (-1);
+  ud.data = host;
+
+  /* The notification is queued first. */
+  memset (&n, 0, sizeof (n));
+  n.severity = NOTIF_WARNING;
+  n.time = TIME_T_TO_CDTIME_T (1400000000);
+  sstrncpy (n.message, "test", sizeof (n.message));
+  sstrncpy (n.host, "example.com", sizeof (n.host));
+  sstrncpy (n.plugin, "test", sizeof (n.plugin));
+  CHECK_ZERO (riemann_notification (&n, &ud));
+
+  vl.values = &value;
+  vl.values_len = 1;
+  vl.time = TIME_T_TO_CDTIME_T (1400000000);
+  sstrncpy (vl.host, "example.com", sizeof (vl.host));
+  sstrncpy (vl.plugin, "test", sizeof (vl.plugin));
+  sstrncpy (vl.type, "gauge", sizeof (vl.type));
+
+  /* Exhausts the pool; the last writes drop the oldest batches. */
+  for (i = 0; i < RIEMANN_BATCH_QUEUE_MAX + 3; i++)
+  {
+    value.gauge = (gauge_t) i;
+    CHECK_ZERO (riemann_write (&ds, &vl, &ud));
+  }
+
+  OK (host->batches_num == RIEMANN_BATCH_QUEUE_MAX);
+  OK (queue_length (host->queue_head) == RIEMANN_BATCH_QUEUE_MAX);
+  for (batch = host->queue_head; batch != NULL; batch = batch->next)
+    if ((batch->notification != NULL) || (batch->events_num != 1))
+      events_only = 0;
+  OK (events_only);
+
+  /* The notification has not been dropped or reused for events. */
+  OK (queue_length (host->notification_head) == 1);
+  OK (host->notification_head->notification != NULL);
+  OK (host->notification_head->events_num == 0);
+
+  /* A reset batch does not hold on to a notification. */
+  batch = host->notification_head;
+  host->notification_head = host->notification_tail = NULL;
+  riemann_batch_reset (batch);
+  OK (batch->notification == NULL);
+  riemann_batch_free (batch);
+
+  host->sender_running = 0;
+  riemann_free (host);
+
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(full_queue);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -47,6 +47,7 @@
 #include "configfile.h"
 
 #include "utils_cache.h"
+#include "utils_format.h"
 
 #include <pthread.h>
 #include <sys/socket.h>
@@ -277,68 +278,35 @@ static int wt_flush(cdtime_t timeout,
     return status;
 }
 
-static int wt_format_values(char *ret, size_t ret_len,
-                            int ds_num, const data_set_t *ds,
-                            const value_list_t *vl,
-                            _Bool store_rates)
+/* Appends the key without the data source name. The order of the
+ * components depends on the instances being set and is kept for
+ * compatibility with existing installations. */
+static void wt_append_name(fmt_buffer_t *b, const value_list_t *vl,
+                           const char *prefix, _Bool with_ds)
 {
-    size_t offset = 0;
-    int status;
-    gauge_t *rates = NULL;
+    fmt_append_string(b, prefix);
+    fmt_append_string(b, vl->plugin);
 
-    assert(0 == strcmp (ds->type, vl->type));
-
-    memset(ret, 0, ret_len);
-
-#define BUFFER_ADD(...) do { \
-        status = ssnprintf (ret + offset, ret_len - offset, \
-                            __VA_ARGS__); \
-        if (status < 1) \
-        { \
-            sfree(rates); \
-            return -1; \
-        } \
-        else if (((size_t) status) >= (ret_len - offset)) \
-        { \
-            sfree(rates); \
-            return -1; \
-        } \
-        else \
-            offset += ((size_t) status); \
-} while (0)
-
-    if (ds->ds[ds_num].type == DS_TYPE_GAUGE)
-        BUFFER_ADD(GAUGE_FORMAT, vl->values[ds_num].gauge);
-    else if (store_rates)
-    {
-        if (rates == NULL)
-            rates = uc_get_rate (ds, vl);
-        if (rates == NULL)
-        {
-            WARNING("format_values: "
-                    "uc_get_rate failed.");
-            return -1;
-        }
-        BUFFER_ADD(GAUGE_FORMAT, rates[ds_num]);
-    }
-    else if (ds->ds[ds_num].type == DS_TYPE_COUNTER)
-        BUFFER_ADD("%llu", vl->values[ds_num].counter);
-    else if (ds->ds[ds_num].type == DS_TYPE_DERIVE)
-        BUFFER_ADD("%" PRIi64, vl->values[ds_num].derive);
-    else if (ds->ds[ds_num].type == DS_TYPE_ABSOLUTE)
-        BUFFER_ADD("%" PRIu64, vl->values[ds_num].absolute);
-    else
-    {
-        ERROR("format_values plugin: Unknown data source type: %i",
-              ds->ds[ds_num].type);
-        sfree(rates);
-        return -1;
+    if (vl->plugin_instance[0] != '\0') {
+        fmt_append_char(b, '.');
+        fmt_append_string(b, vl->plugin_instance);
     }
 
-#undef BUFFER_ADD
+    if (!with_ds && (vl->plugin_instance[0] == '\0')
+            && (vl->type_instance[0] != '\0')) {
+        fmt_append_char(b, '.');
+        fmt_append_string(b, vl->type_instance);
+        fmt_append_char(b, '.');
+        fmt_append_string(b, vl->type);
+        return;
+    }
 
-    sfree(rates);
-    return 0;
+    fmt_append_char(b, '.');
+    fmt_append_string(b, vl->type);
+    if (vl->type_instance[0] != '\0') {
+        fmt_append_char(b, '.');
+        fmt_append_string(b, vl->type_instance);
+    }
 }
 
 static int wt_format_name(char *ret, int ret_len,
@@ -350,6 +318,7 @@ static int wt_format_name(char *ret, int ret_len,
     char *temp = NULL;
     char *prefix = "";
     const char *meta_prefix = "tsdb_prefix";
+    fmt_buffer_t b;
 
     if (vl->meta) {
         status = meta_data_get_string(vl->meta, meta_prefix, &temp);
@@ -363,47 +332,28 @@ static int wt_format_name(char *ret, int ret_len,
         }
     }
 
+    fmt_buffer_init(&b, ret, (size_t) ret_len, 0);
+    wt_append_name(&b, vl, prefix, ds_name != NULL);
     if (ds_name != NULL) {
-        if (vl->plugin_instance[0] == '\0') {
-            if (vl->type_instance[0] == '\0') {
-                ssnprintf(ret, ret_len, "%s%s.%s.%s", prefix, vl->plugin,
-                        vl->type, ds_name);
-            } else {
-                ssnprintf(ret, ret_len, "%s%s.%s.%s.%s", prefix, vl->plugin,
-                        vl->type, vl->type_instance, ds_name);
-            }
-        } else { /* vl->plugin_instance != "" */
-            if (vl->type_instance[0] == '\0') {
-                ssnprintf(ret, ret_len, "%s%s.%s.%s.%s", prefix, vl->plugin,
-                        vl->plugin_instance, vl->type, ds_name);
-            } else {
-                ssnprintf(ret, ret_len, "%s%s.%s.%s.%s.%s", prefix,
-                        vl->plugin, vl->plugin_instance, vl->type,
-                        vl->type_instance, ds_name);
-            }
-        }
-    } else { /* ds_name == NULL */
-        if (vl->plugin_instance[0] == '\0') {
-            if (vl->type_instance[0] == '\0') {
-                ssnprintf(ret, ret_len, "%s%s.%s", prefix, vl->plugin,
-                        vl->type);
-            } else {
-                ssnprintf(ret, ret_len, "%s%s.%s.%s", prefix, vl->plugin,
-                        vl->type_instance, vl->type);
-            }
-        } else { /* vl->plugin_instance != "" */
-            if (vl->type_instance[0] == '\0') {
-                ssnprintf(ret, ret_len, "%s%s.%s.%s", prefix, vl->plugin,
-                        vl->plugin_instance, vl->type);
-            } else {
-                ssnprintf(ret, ret_len, "%s%s.%s.%s.%s", prefix, vl->plugin,
-                        vl->plugin_instance, vl->type, vl->type_instance);
-            }
-        }
+        fmt_append_char(&b, '.');
+        fmt_append_string(&b, ds_name);
     }
 
     sfree(temp);
-    return 0;
+    return b.overflow ? -ENOMEM : 0;
+}
+
+/* Rounds to full seconds, ties to even, like "%.0f" does. */
+static uint64_t wt_time_seconds(cdtime_t t)
+{
+    uint64_t seconds = (uint64_t) CDTIME_T_TO_TIME_T(t);
+    cdtime_t frac = t - TIME_T_TO_CDTIME_T(seconds);
+    cdtime_t half = TIME_T_TO_CDTIME_T(1) / 2;
+
+    if ((frac > half) || ((frac == half) && ((seconds % 2) != 0)))
+        seconds++;
+
+    return seconds;
 }
 
 static int wt_send_message (const char* key, const char* value,
@@ -417,6 +367,7 @@ static int wt_send_message (const char* key, const char* value,
     char message[1024];
     char *host_tags = cb->host_tags ? cb->host_tags : "";
     const char *meta_tsdb = "tsdb_tags";
+    fmt_buffer_t b;
 
     /* skip if value is NaN */
     if (value[0] == 'n')
@@ -436,25 +387,27 @@ static int wt_send_message (const char* key, const char* value,
         }
     }
 
-    status = ssnprintf (message,
-                             sizeof(message),
-                             "put %s %.0f %s fqdn=%s %s %s\r\n",
-                             key,
-                             CDTIME_T_TO_DOUBLE(time),
-                             value,
-                             host,
-                             tags,
-                             host_tags);
+    fmt_buffer_init(&b, message, sizeof(message), 0);
+    fmt_append(&b, "put ", 4);
+    fmt_append_string(&b, key);
+    fmt_append_char(&b, ' ');
+    fmt_append_uint64(&b, wt_time_seconds(time));
+    fmt_append_char(&b, ' ');
+    fmt_append_string(&b, value);
+    fmt_append(&b, " fqdn=", 6);
+    fmt_append_string(&b, host);
+    fmt_append_char(&b, ' ');
+    fmt_append_string(&b, tags);
+    fmt_append_char(&b, ' ');
+    fmt_append_string(&b, host_tags);
+    fmt_append(&b, "\r\n", 2);
     sfree(temp);
-    if (status < 0)
-        return -1;
-    message_len = (size_t) status;
 
-    if (message_len >= sizeof(message)) {
-        ERROR("write_tsdb plugin: message buffer too small: "
-              "Need %zu bytes.", message_len + 1);
+    if (b.overflow) {
+        ERROR("write_tsdb plugin: message buffer too small.");
         return -1;
     }
+    message_len = b.fill;
 
     pthread_mutex_lock(&cb->send_lock);
 
@@ -506,9 +459,10 @@ static int wt_write_messages(const data_set_t *ds, const value_list_t *vl,
                              struct wt_callback *cb)
 {
     char key[10*DATA_MAX_NAME_LEN];
-    char values[512];
+    char values[FMT_NUMBER_MAX];
+    gauge_t *rates = NULL;
 
-    int status;
+    int status = 0;
     size_t i;
 
     if (0 != strcmp(ds->type, vl->type))
@@ -521,6 +475,7 @@ static int wt_write_messages(const data_set_t *ds, const value_list_t *vl,
     for (i = 0; i < ds->ds_num; i++)
     {
         const char *ds_name = NULL;
+        int ds_type = ds->ds[i].type;
 
         if (cb->always_append_ds || (ds->ds_num > 1))
             ds_name = ds->ds[i].name;
@@ -530,19 +485,35 @@ static int wt_write_messages(const data_set_t *ds, const value_list_t *vl,
         if (status != 0)
         {
             ERROR("write_tsdb plugin: error with format_name");
-            return status;
+            break;
         }
 
         escape_string(key, sizeof(key));
         /* Convert the values to an ASCII representation and put that into
          * 'values'. */
-        status = wt_format_values(values, sizeof(values), i, ds, vl,
-                                  cb->store_rates);
-        if (status != 0)
+        if (ds_type == DS_TYPE_GAUGE)
+            fmt_double(values, vl->values[i].gauge);
+        else if (cb->store_rates)
         {
-            ERROR("write_tsdb plugin: error with "
-                  "wt_format_values");
-            return status;
+            if (rates == NULL)
+                rates = uc_get_rate(ds, vl);
+            if (rates == NULL)
+            {
+                WARNING("write_tsdb plugin: uc_get_rate failed.");
+                status = -1;
+                break;
+            }
+            fmt_double(values, rates[i]);
+        }
+        else if ((ds_type == DS_TYPE_COUNTER) || (ds_type == DS_TYPE_DERIVE)
+                || (ds_type == DS_TYPE_ABSOLUTE))
+            fmt_value(values, ds_type, vl->values[i]);
+        else
+        {
+            ERROR("write_tsdb plugin: Unknown data source type: %i",
+                  ds_type);
+            status = -1;
+            break;
         }
 
         /* Send the message to tsdb */
@@ -551,11 +522,12 @@ static int wt_write_messages(const data_set_t *ds, const value_list_t *vl,
         {
             ERROR("write_tsdb plugin: error with "
                   "wt_send_message");
-            return status;
+            break;
         }
     }
 
-    return 0;
+    sfree(rates);
+    return status;
 }
 
 static int wt_write(const data_set_t *ds, const value_list_t *vl,